@@ -153,6 +153,13 @@ def _cc_dependencies():
         sha256 = "d87849e281d376a1c955f867cf10be0d672ff41dbe7fd600bcc2faa9bcb6e23f",
     )
 
+    maybe(
+        git_repository,
+        name = "com_github_google_benchmark",
+        commit = "73d4d5e8d6d449fc8663765a42aa8aeeee844489",  # v1.5.2
+        remote = "https://github.com/google/benchmark",
+    )
+
     maybe(
         github_archive,
         name = "com_github_google_glog",
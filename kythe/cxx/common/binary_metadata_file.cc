@@ -0,0 +1,236 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/binary_metadata_file.h"
+
+#include <functional>
+#include <map>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/strip.h"
+#include "glog/logging.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "kythe/cxx/common/vname_ordering.h"
+
+namespace kythe {
+namespace {
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::io::CodedOutputStream;
+
+/// Bits of the flags byte written for each rule.
+constexpr uint32_t kReverseEdge = 1;
+constexpr uint32_t kGenerateAnchor = 2;
+
+/// \brief Assigns each distinct value an index in order of first use.
+template <typename T, typename Less>
+class InternTable {
+ public:
+  uint32_t Intern(const T& value) {
+    auto inserted = index_.emplace(value, values_.size());
+    if (inserted.second) {
+      values_.push_back(&inserted.first->first);
+    }
+    return inserted.first->second;
+  }
+
+  const std::vector<const T*>& values() const { return values_; }
+
+ private:
+  std::map<T, uint32_t, Less> index_;
+  std::vector<const T*> values_;
+};
+
+void WriteString(absl::string_view value, CodedOutputStream* output) {
+  output->WriteVarint32(value.size());
+  output->WriteRaw(value.data(), value.size());
+}
+
+bool ReadString(CodedInputStream* input, std::string* value) {
+  uint32_t size;
+  return input->ReadVarint32(&size) && input->ReadString(value, size);
+}
+
+/// \brief Writes the parts of `rule` other than its range.
+void WriteRuleBody(const MetadataFile::Rule& rule,
+                   InternTable<std::string, std::less<>>* edges,
+                   InternTable<proto::VName, VNameLess>* vnames,
+                   CodedOutputStream* output) {
+  output->WriteVarint32(edges->Intern(rule.edge_in));
+  output->WriteVarint32(edges->Intern(rule.edge_out));
+  output->WriteVarint32(vnames->Intern(rule.vname));
+  output->WriteVarint32((rule.reverse_edge ? kReverseEdge : 0) |
+                        (rule.generate_anchor ? kGenerateAnchor : 0));
+  if (rule.generate_anchor) {
+    output->WriteVarint32(rule.anchor_begin);
+    output->WriteVarint32(rule.anchor_end);
+  }
+}
+
+/// \brief Reads the parts of `rule` other than its range.
+bool ReadRuleBody(CodedInputStream* input,
+                  const std::vector<std::string>& edges,
+                  const std::vector<proto::VName>& vnames,
+                  MetadataFile::Rule* rule) {
+  uint32_t edge_in, edge_out, vname, flags;
+  if (!input->ReadVarint32(&edge_in) || !input->ReadVarint32(&edge_out) ||
+      !input->ReadVarint32(&vname) || !input->ReadVarint32(&flags) ||
+      edge_in >= edges.size() || edge_out >= edges.size() ||
+      vname >= vnames.size()) {
+    return false;
+  }
+  rule->edge_in = edges[edge_in];
+  rule->edge_out = edges[edge_out];
+  rule->vname = vnames[vname];
+  rule->reverse_edge = flags & kReverseEdge;
+  rule->generate_anchor = flags & kGenerateAnchor;
+  rule->anchor_begin = 0;
+  rule->anchor_end = 0;
+  if (rule->generate_anchor) {
+    return input->ReadVarint32(&rule->anchor_begin) &&
+           input->ReadVarint32(&rule->anchor_end);
+  }
+  return true;
+}
+}  // anonymous namespace
+
+std::string EncodeBinaryMetadata(const MetadataFile& file) {
+  // The tables come first, but are only known once the rules are written.
+  InternTable<std::string, std::less<>> edges;
+  InternTable<proto::VName, VNameLess> vnames;
+  std::string rules;
+  {
+    google::protobuf::io::StringOutputStream stream(&rules);
+    CodedOutputStream output(&stream);
+    output.WriteVarint32(file.rules().size());
+    unsigned previous_begin = 0;
+    for (const auto& rule : file.rules()) {
+      output.WriteVarint32(rule.begin - previous_begin);
+      output.WriteVarint32(rule.end);
+      previous_begin = rule.begin;
+      WriteRuleBody(rule, &edges, &vnames, &output);
+    }
+    output.WriteVarint32(file.file_scope_rules().size());
+    for (const auto& rule : file.file_scope_rules()) {
+      WriteRuleBody(rule, &edges, &vnames, &output);
+    }
+  }
+  std::string encoded(kBinaryMetadataMagic);
+  {
+    google::protobuf::io::StringOutputStream stream(&encoded);
+    CodedOutputStream output(&stream);
+    output.WriteVarint32(edges.values().size());
+    for (const auto* edge : edges.values()) {
+      WriteString(*edge, &output);
+    }
+    output.WriteVarint32(vnames.values().size());
+    for (const auto* vname : vnames.values()) {
+      WriteString(vname->signature(), &output);
+      WriteString(vname->corpus(), &output);
+      WriteString(vname->root(), &output);
+      WriteString(vname->path(), &output);
+      WriteString(vname->language(), &output);
+    }
+  }
+  encoded.append(rules);
+  return encoded;
+}
+
+std::unique_ptr<MetadataFile> BinaryMetadataSupport::Decode(
+    absl::string_view id, absl::string_view buffer) {
+  if (!absl::ConsumePrefix(&buffer, kBinaryMetadataMagic)) {
+    return nullptr;
+  }
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(buffer.data()),
+                         buffer.size());
+  // Every table entry and rule takes at least a byte, so no count may exceed
+  // the size of the buffer.
+  auto read_count = [&](uint32_t* count) {
+    return input.ReadVarint32(count) && *count <= buffer.size();
+  };
+  uint32_t count;
+  if (!read_count(&count)) {
+    return nullptr;
+  }
+  std::vector<std::string> edges(count);
+  for (auto& edge : edges) {
+    if (!ReadString(&input, &edge)) {
+      return nullptr;
+    }
+  }
+  if (!read_count(&count)) {
+    return nullptr;
+  }
+  std::vector<proto::VName> vnames(count);
+  for (auto& vname : vnames) {
+    if (!ReadString(&input, vname.mutable_signature()) ||
+        !ReadString(&input, vname.mutable_corpus()) ||
+        !ReadString(&input, vname.mutable_root()) ||
+        !ReadString(&input, vname.mutable_path()) ||
+        !ReadString(&input, vname.mutable_language())) {
+      return nullptr;
+    }
+  }
+  if (!read_count(&count)) {
+    return nullptr;
+  }
+  std::vector<MetadataFile::Rule> rules(count);
+  unsigned previous_begin = 0;
+  for (auto& rule : rules) {
+    uint32_t begin_delta;
+    if (!input.ReadVarint32(&begin_delta) || !input.ReadVarint32(&rule.end) ||
+        !ReadRuleBody(&input, edges, vnames, &rule)) {
+      return nullptr;
+    }
+    rule.begin = previous_begin + begin_delta;
+    rule.whole_file = false;
+    previous_begin = rule.begin;
+  }
+  if (!read_count(&count)) {
+    return nullptr;
+  }
+  rules.reserve(rules.size() + count);
+  for (uint32_t i = 0; i < count; ++i) {
+    MetadataFile::Rule rule;
+    if (!ReadRuleBody(&input, edges, vnames, &rule)) {
+      return nullptr;
+    }
+    rule.begin = 0;
+    rule.end = 0;
+    rule.whole_file = true;
+    rules.push_back(std::move(rule));
+  }
+  if (input.CurrentPosition() != static_cast<int>(buffer.size())) {
+    return nullptr;
+  }
+  return MetadataFile::LoadFromRules(id, rules.begin(), rules.end());
+}
+
+std::unique_ptr<kythe::MetadataFile> BinaryMetadataSupport::ParseFile(
+    const std::string& raw_filename, const std::string& filename,
+    absl::string_view buffer) {
+  if (!absl::StartsWith(buffer, kBinaryMetadataMagic)) {
+    return nullptr;
+  }
+  auto metadata = Decode(raw_filename, buffer);
+  if (!metadata) {
+    LOG(WARNING) << "Failed decoding binary metadata: " << raw_filename;
+  }
+  return metadata;
+}
+
+}  // namespace kythe
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_BINARY_METADATA_FILE_H_
+#define KYTHE_CXX_COMMON_BINARY_METADATA_FILE_H_
+
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "kythe/cxx/common/kythe_metadata_file.h"
+
+namespace kythe {
+
+/// \brief The bytes that begin every binary metadata file.
+inline constexpr absl::string_view kBinaryMetadataMagic = "\x89kythe-meta1\n";
+
+/// \brief Encodes `file` in the binary metadata format.
+///
+/// The format is meant to be written by code generators in place of JSON
+/// metadata and read without any intermediate parse. After
+/// `kBinaryMetadataMagic` come varint-prefixed tables of the distinct edge
+/// kinds and VNames the rules use, then the ranged rules in the order of
+/// `MetadataFile::rules()` with each `begin` stored as the difference from
+/// the previous one, then the file-scope rules. Rules refer to edge kinds
+/// and VNames by their index in the tables.
+std::string EncodeBinaryMetadata(const MetadataFile& file);
+
+/// \brief Enables support for metadata files in the binary format.
+///
+/// Files are recognized by `kBinaryMetadataMagic` whatever their name, so
+/// this support can be tried before the others at little cost.
+class BinaryMetadataSupport : public MetadataSupport {
+ public:
+  std::unique_ptr<kythe::MetadataFile> ParseFile(
+      const std::string& raw_filename, const std::string& filename,
+      absl::string_view buffer) override;
+
+  /// \brief Decodes `buffer` with the id `id`.
+  /// \return null if `buffer` isn't a well-formed binary metadata file.
+  static std::unique_ptr<MetadataFile> Decode(absl::string_view id,
+                                              absl::string_view buffer);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_BINARY_METADATA_FILE_H_
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/binary_metadata_file.h"
+
+#include "absl/memory/memory.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/metadata_cache.h"
+#include "kythe/cxx/common/protobuf_metadata_file.h"
+#include "kythe/cxx/common/schema/edges.h"
+
+namespace kythe {
+namespace {
+
+MetadataFile::Rule MakeRule(unsigned begin, unsigned end,
+                            const std::string& signature) {
+  MetadataFile::Rule rule{};
+  rule.begin = begin;
+  rule.end = end;
+  rule.edge_in = common::schema::kDefinesBinding;
+  rule.edge_out = common::schema::kGenerates;
+  rule.vname.set_corpus("corpus");
+  rule.vname.set_signature(signature);
+  rule.reverse_edge = true;
+  return rule;
+}
+
+void ExpectSameRule(const MetadataFile::Rule& expected,
+                    const MetadataFile::Rule& actual) {
+  EXPECT_EQ(expected.begin, actual.begin);
+  EXPECT_EQ(expected.end, actual.end);
+  EXPECT_EQ(expected.edge_in, actual.edge_in);
+  EXPECT_EQ(expected.edge_out, actual.edge_out);
+  EXPECT_EQ(expected.vname.DebugString(), actual.vname.DebugString());
+  EXPECT_EQ(expected.reverse_edge, actual.reverse_edge);
+  EXPECT_EQ(expected.generate_anchor, actual.generate_anchor);
+  EXPECT_EQ(expected.anchor_begin, actual.anchor_begin);
+  EXPECT_EQ(expected.anchor_end, actual.anchor_end);
+  EXPECT_EQ(expected.whole_file, actual.whole_file);
+}
+
+TEST(BinaryMetadataFileTest, RoundTrips) {
+  std::vector<MetadataFile::Rule> rules = {MakeRule(30, 35, "b"),
+                                           MakeRule(10, 20, "a"),
+                                           MakeRule(30, 35, "a")};
+  rules[1].generate_anchor = true;
+  rules[1].anchor_begin = 100;
+  rules[1].anchor_end = 107;
+  MetadataFile::Rule file_rule = MakeRule(0, 0, "");
+  file_rule.edge_in.clear();
+  file_rule.whole_file = true;
+  rules.push_back(file_rule);
+  auto file = MetadataFile::LoadFromRules("id", rules.begin(), rules.end());
+
+  const std::string encoded = EncodeBinaryMetadata(*file);
+  auto decoded = BinaryMetadataSupport::Decode("other_id", encoded);
+  ASSERT_NE(decoded, nullptr);
+  EXPECT_EQ("other_id", decoded->id());
+  ASSERT_EQ(file->rules().size(), decoded->rules().size());
+  for (size_t i = 0; i < file->rules().size(); ++i) {
+    ExpectSameRule(file->rules()[i], decoded->rules()[i]);
+  }
+  ASSERT_EQ(1, decoded->file_scope_rules().size());
+  ExpectSameRule(file_rule, decoded->file_scope_rules()[0]);
+}
+
+TEST(BinaryMetadataFileTest, RejectsOtherInput) {
+  std::vector<MetadataFile::Rule> rules = {MakeRule(10, 20, "a")};
+  auto file = MetadataFile::LoadFromRules("id", rules.begin(), rules.end());
+  const std::string encoded = EncodeBinaryMetadata(*file);
+  BinaryMetadataSupport support;
+  EXPECT_EQ(nullptr, support.ParseFile("a.meta", "a.meta", "{\"meta\":[]}"));
+  EXPECT_EQ(nullptr,
+            support.ParseFile("a.meta", "a.meta",
+                              encoded.substr(0, encoded.size() - 1)));
+  EXPECT_EQ(nullptr, support.ParseFile("a.meta", "a.meta", encoded + "x"));
+  EXPECT_NE(nullptr, support.ParseFile("a.meta", "a.meta", encoded));
+}
+
+TEST(MetadataCacheTest, SharesFilesWithTheSameLookups) {
+  google::protobuf::GeneratedCodeInfo info;
+  auto* annotation = info.add_annotation();
+  annotation->set_source_file("a.proto");
+  annotation->add_path(4);
+  annotation->set_begin(10);
+  annotation->set_end(20);
+  const std::string buffer = info.SerializeAsString();
+
+  MetadataCache cache(16);
+  std::string corpus = "first";
+  auto lookup = [&corpus](const std::string& path, proto::VName* out) {
+    out->set_corpus(corpus);
+    return true;
+  };
+  auto make_supports = [&] {
+    auto supports = absl::make_unique<MetadataSupports>();
+    supports->Add(absl::make_unique<ProtobufMetadataSupport>());
+    supports->UseCache(&cache);
+    supports->UseVNameLookup(lookup);
+    return supports;
+  };
+
+  auto first = make_supports();
+  auto parsed = first->ParseFile("a.pb.h.meta", buffer, "");
+  ASSERT_NE(parsed, nullptr);
+  ASSERT_EQ(1, parsed->rules().size());
+  EXPECT_EQ("first", parsed->rules()[0].vname.corpus());
+  EXPECT_EQ(0, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+
+  auto second = make_supports();
+  EXPECT_EQ(parsed, second->ParseFile("a.pb.h.meta", buffer, ""));
+  EXPECT_EQ(1, cache.hits());
+
+  // A unit that would resolve the proto differently parses it again.
+  corpus = "second";
+  auto reparsed = second->ParseFile("a.pb.h.meta", buffer, "");
+  ASSERT_NE(reparsed, nullptr);
+  EXPECT_NE(parsed, reparsed);
+  EXPECT_EQ("second", reparsed->rules()[0].vname.corpus());
+  EXPECT_EQ(2, cache.misses());
+}
+
+}  // namespace
+}  // namespace kythe
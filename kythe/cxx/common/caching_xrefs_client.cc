@@ -0,0 +1,151 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/caching_xrefs_client.h"
+
+#include <utility>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+
+namespace kythe {
+namespace {
+/// \brief Appends the deterministic serialization of `request` to `key`, so
+/// that requests with the same contents (including map fields) share a key.
+void AppendRequestKey(const google::protobuf::Message& request,
+                      std::string* key) {
+  google::protobuf::io::StringOutputStream stream(key);
+  google::protobuf::io::CodedOutputStream coded(&stream);
+  coded.SetSerializationDeterministic(true);
+  request.SerializeToCodedStream(&coded);
+}
+}  // anonymous namespace
+
+template <typename Request, typename Reply>
+bool CachingXrefsClient::Call(
+    Method method,
+    bool (XrefsClient::*call)(const Request&, Reply*, std::string*),
+    const Request& request, Reply* reply, std::string* error_text) {
+  std::string key(1, static_cast<char>(method));
+  AppendRequestKey(request, &key);
+  EntryList::iterator pending;
+  {
+    absl::MutexLock lock(&mu_);
+    bool waited = false;
+    while (true) {
+      auto found = index_.find(key);
+      if (found == index_.end()) {
+        ++stats_.misses;
+        entries_.push_front(Entry{std::move(key), nullptr, absl::Time(),
+                                  std::make_shared<bool>(false)});
+        // The key views the string stored in the list node, which doesn't
+        // move.
+        index_.emplace(entries_.front().key, entries_.begin());
+        pending = entries_.begin();
+        break;
+      }
+      Entry& entry = *found->second;
+      if (entry.reply == nullptr) {
+        // Someone else is fetching this reply; wait for them and look again.
+        if (!waited) {
+          ++stats_.coalesced;
+          waited = true;
+        }
+        std::shared_ptr<bool> fetching = entry.done;
+        mu_.Await(absl::Condition(fetching.get()));
+        continue;
+      }
+      if (absl::Now() - entry.fetched >= options_.ttl) {
+        ++stats_.evictions;
+        EraseLocked(found->second);
+        continue;
+      }
+      ++stats_.hits;
+      entries_.splice(entries_.begin(), entries_, found->second);
+      reply->MergeFrom(*entry.reply);
+      return true;
+    }
+  }
+
+  // This call fetches the reply for `pending`. Nothing else removes an entry
+  // whose reply is still null, so the iterator stays valid.
+  auto fresh = std::make_shared<Reply>();
+  bool ok = (client_.get()->*call)(request, fresh.get(), error_text);
+  if (ok) {
+    reply->MergeFrom(*fresh);
+  }
+  absl::MutexLock lock(&mu_);
+  *pending->done = true;
+  if (ok) {
+    pending->reply = std::move(fresh);
+    pending->fetched = absl::Now();
+    EvictLocked();
+  } else {
+    EraseLocked(pending);
+  }
+  return ok;
+}
+
+bool CachingXrefsClient::Nodes(const proto::NodesRequest& request,
+                               proto::NodesReply* reply,
+                               std::string* error_text) {
+  return Call(Method::kNodes, &XrefsClient::Nodes, request, reply, error_text);
+}
+
+bool CachingXrefsClient::Edges(const proto::EdgesRequest& request,
+                               proto::EdgesReply* reply,
+                               std::string* error_text) {
+  return Call(Method::kEdges, &XrefsClient::Edges, request, reply, error_text);
+}
+
+bool CachingXrefsClient::Decorations(const proto::DecorationsRequest& request,
+                                     proto::DecorationsReply* reply,
+                                     std::string* error_text) {
+  return Call(Method::kDecorations, &XrefsClient::Decorations, request, reply,
+              error_text);
+}
+
+bool CachingXrefsClient::Documentation(
+    const proto::DocumentationRequest& request,
+    proto::DocumentationReply* reply, std::string* error_text) {
+  return Call(Method::kDocumentation, &XrefsClient::Documentation, request,
+              reply, error_text);
+}
+
+CachingXrefsClient::Stats CachingXrefsClient::stats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+void CachingXrefsClient::EvictLocked() {
+  auto entry = entries_.end();
+  while (index_.size() > options_.max_entries && entry != entries_.begin()) {
+    --entry;
+    if (entry->reply == nullptr) {
+      continue;
+    }
+    ++stats_.evictions;
+    auto evicted = entry++;
+    EraseLocked(evicted);
+  }
+}
+
+void CachingXrefsClient::EraseLocked(EntryList::iterator entry) {
+  index_.erase(entry->key);
+  entries_.erase(entry);
+}
+
+}  // namespace kythe
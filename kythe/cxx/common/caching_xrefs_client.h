@@ -0,0 +1,135 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_CACHING_XREFS_CLIENT_H_
+#define KYTHE_CXX_COMMON_CACHING_XREFS_CLIENT_H_
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "google/protobuf/message.h"
+#include "kythe/cxx/common/net_client.h"
+
+namespace kythe {
+
+/// \brief An XrefsClient that remembers the replies of another.
+///
+/// Tools like fyi ask about the same tickets over and over. Successful
+/// replies are kept in a least-recently-used cache keyed by the request's
+/// deterministic serialization, and are served from there until they are
+/// older than the configured time-to-live. Callers that ask for a reply that
+/// is already being fetched wait for it rather than issuing the request
+/// again. Failures are never cached.
+///
+/// CachingXrefsClient is thread-safe as long as the client it wraps is.
+class CachingXrefsClient : public XrefsClient {
+ public:
+  struct Options {
+    /// The maximum number of replies to keep.
+    size_t max_entries = 4096;
+    /// How long a reply is served from the cache.
+    absl::Duration ttl = absl::Minutes(5);
+  };
+
+  /// \param client The client to forward cache misses to.
+  CachingXrefsClient(std::unique_ptr<XrefsClient> client, Options options)
+      : client_(std::move(client)), options_(options) {}
+  CachingXrefsClient(const CachingXrefsClient&) = delete;
+  CachingXrefsClient& operator=(const CachingXrefsClient&) = delete;
+
+  bool Nodes(const proto::NodesRequest& request, proto::NodesReply* reply,
+             std::string* error_text) override;
+  bool Edges(const proto::EdgesRequest& request, proto::EdgesReply* reply,
+             std::string* error_text) override;
+  bool Decorations(const proto::DecorationsRequest& request,
+                   proto::DecorationsReply* reply,
+                   std::string* error_text) override;
+  bool Documentation(const proto::DocumentationRequest& request,
+                     proto::DocumentationReply* reply,
+                     std::string* error_text) override;
+
+  /// \brief Statistics about cache usage.
+  struct Stats {
+    /// How many calls were answered from the cache.
+    size_t hits = 0;
+    /// How many calls were forwarded to the wrapped client.
+    size_t misses = 0;
+    /// How many calls waited for a reply another call was fetching.
+    size_t coalesced = 0;
+    /// How many replies were dropped to make room or because they expired.
+    size_t evictions = 0;
+  };
+  Stats stats() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  /// \brief The method a request was made to, which prefixes its cache key.
+  enum class Method : char {
+    kNodes = 'n',
+    kEdges = 'e',
+    kDecorations = 'd',
+    kDocumentation = 'o'
+  };
+
+  struct Entry {
+    std::string key;
+    /// The reply, or null while it is being fetched.
+    std::shared_ptr<const google::protobuf::Message> reply;
+    /// When `reply` was fetched.
+    absl::Time fetched;
+    /// Becomes true (under `mu_`) when the fetch for this entry finishes,
+    /// whether or not it succeeded. Waiters hold their own reference, since
+    /// a failed fetch removes the entry.
+    std::shared_ptr<bool> done;
+  };
+  using EntryList = std::list<Entry>;
+
+  /// \brief Answers `request` from the cache or by calling `call` on the
+  /// wrapped client.
+  template <typename Request, typename Reply>
+  bool Call(Method method,
+            bool (XrefsClient::*call)(const Request&, Reply*, std::string*),
+            const Request& request, Reply* reply, std::string* error_text)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Drops least recently used replies until at most
+  /// `options_.max_entries` remain. Replies still being fetched are kept.
+  void EvictLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  /// \brief Forgets the entry at `entry`.
+  void EraseLocked(EntryList::iterator entry)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  std::unique_ptr<XrefsClient> client_;
+  const Options options_;
+  mutable absl::Mutex mu_;
+  /// Entries ordered from most to least recently used.
+  EntryList entries_ ABSL_GUARDED_BY(mu_);
+  /// Maps keys to their positions in `entries_`.
+  absl::flat_hash_map<absl::string_view, EntryList::iterator> index_
+      ABSL_GUARDED_BY(mu_);
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_CACHING_XREFS_CLIENT_H_
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/caching_xrefs_client.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Answers Nodes calls with a node per ticket, counting the calls and
+/// failing for the ticket "fail".
+class FakeXrefsClient : public XrefsClient {
+ public:
+  explicit FakeXrefsClient(std::atomic<int>* calls) : calls_(calls) {}
+
+  bool Nodes(const proto::NodesRequest& request, proto::NodesReply* reply,
+             std::string* error_text) override {
+    ++*calls_;
+    if (started_ != nullptr) {
+      started_->Notify();
+      release_->WaitForNotification();
+    }
+    for (const auto& ticket : request.ticket()) {
+      if (ticket == "fail") {
+        *error_text = "failed";
+        return false;
+      }
+      (*reply->mutable_nodes())[ticket].mutable_facts()->insert(
+          {"/kythe/node/kind", "file"});
+    }
+    return true;
+  }
+
+  /// \brief Makes each call announce itself on `started` and then wait for
+  /// `release`.
+  void Block(absl::Notification* started, absl::Notification* release) {
+    started_ = started;
+    release_ = release;
+  }
+
+ private:
+  std::atomic<int>* calls_;
+  absl::Notification* started_ = nullptr;
+  absl::Notification* release_ = nullptr;
+};
+
+proto::NodesRequest Request(const std::string& ticket) {
+  proto::NodesRequest request;
+  request.add_ticket(ticket);
+  return request;
+}
+
+TEST(CachingXrefsClientTest, RepeatedRequestsAreServedFromTheCache) {
+  std::atomic<int> calls(0);
+  CachingXrefsClient client(absl::make_unique<FakeXrefsClient>(&calls), {});
+  std::string error;
+  for (int i = 0; i < 3; ++i) {
+    proto::NodesReply reply;
+    ASSERT_TRUE(client.Nodes(Request("a"), &reply, &error)) << error;
+    EXPECT_EQ(1, reply.nodes().count("a"));
+  }
+  proto::NodesReply reply;
+  ASSERT_TRUE(client.Nodes(Request("b"), &reply, &error)) << error;
+  EXPECT_EQ(1, reply.nodes().count("b"));
+  EXPECT_EQ(2, calls);
+  EXPECT_EQ(2, client.stats().hits);
+  EXPECT_EQ(2, client.stats().misses);
+}
+
+TEST(CachingXrefsClientTest, FailuresAreNotCached) {
+  std::atomic<int> calls(0);
+  CachingXrefsClient client(absl::make_unique<FakeXrefsClient>(&calls), {});
+  std::string error;
+  proto::NodesReply reply;
+  EXPECT_FALSE(client.Nodes(Request("fail"), &reply, &error));
+  EXPECT_EQ("failed", error);
+  EXPECT_FALSE(client.Nodes(Request("fail"), &reply, &error));
+  EXPECT_EQ(2, calls);
+}
+
+TEST(CachingXrefsClientTest, ExpiredAndEvictedRepliesAreFetchedAgain) {
+  std::atomic<int> calls(0);
+  CachingXrefsClient expiring(absl::make_unique<FakeXrefsClient>(&calls),
+                              {/*max_entries=*/10, absl::ZeroDuration()});
+  std::string error;
+  proto::NodesReply reply;
+  ASSERT_TRUE(expiring.Nodes(Request("a"), &reply, &error));
+  ASSERT_TRUE(expiring.Nodes(Request("a"), &reply, &error));
+  EXPECT_EQ(2, calls);
+
+  calls = 0;
+  CachingXrefsClient small(absl::make_unique<FakeXrefsClient>(&calls),
+                           {/*max_entries=*/1, absl::InfiniteDuration()});
+  ASSERT_TRUE(small.Nodes(Request("a"), &reply, &error));
+  ASSERT_TRUE(small.Nodes(Request("b"), &reply, &error));
+  ASSERT_TRUE(small.Nodes(Request("b"), &reply, &error));
+  ASSERT_TRUE(small.Nodes(Request("a"), &reply, &error));
+  EXPECT_EQ(3, calls);
+  EXPECT_EQ(2, small.stats().evictions);
+}
+
+TEST(CachingXrefsClientTest, ConcurrentRequestsShareOneFetch) {
+  std::atomic<int> calls(0);
+  auto fake = absl::make_unique<FakeXrefsClient>(&calls);
+  absl::Notification started, release;
+  fake->Block(&started, &release);
+  CachingXrefsClient client(std::move(fake), {});
+  std::thread first([&] {
+    proto::NodesReply reply;
+    std::string error;
+    EXPECT_TRUE(client.Nodes(Request("a"), &reply, &error));
+    EXPECT_EQ(1, reply.nodes().count("a"));
+  });
+  started.WaitForNotification();
+  std::thread second([&] {
+    proto::NodesReply reply;
+    std::string error;
+    EXPECT_TRUE(client.Nodes(Request("a"), &reply, &error));
+    EXPECT_EQ(1, reply.nodes().count("a"));
+  });
+  absl::SleepFor(absl::Milliseconds(50));
+  release.Notify();
+  first.join();
+  second.join();
+  EXPECT_EQ(1, calls);
+}
+
+}  // namespace
+}  // namespace kythe
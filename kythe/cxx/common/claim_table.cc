@@ -0,0 +1,261 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/common/claim_table.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "absl/base/config.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "glog/logging.h"
+#include "kythe/cxx/common/vname_ordering.h"
+
+namespace kythe {
+namespace {
+struct Header {
+  char magic[8];
+  uint32_t vname_count;
+  uint32_t claim_count;
+  uint64_t string_pool_size;
+};
+static_assert(sizeof(Header) == 24, "unexpected claim table header layout");
+}  // anonymous namespace
+
+constexpr absl::string_view ClaimTable::kMagic;
+
+/// \brief A VName whose fields are views, for comparing table entries with
+/// each other and with VName protos.
+class ClaimTable::VNameView {
+ public:
+  VNameView(absl::string_view signature, absl::string_view corpus,
+            absl::string_view root, absl::string_view path,
+            absl::string_view language)
+      : signature_(signature),
+        corpus_(corpus),
+        root_(root),
+        path_(path),
+        language_(language) {}
+  explicit VNameView(const proto::VName& vname)
+      : VNameView(vname.signature(), vname.corpus(), vname.root(),
+                  vname.path(), vname.language()) {}
+  /// \brief Views `record`, whose strings are in `pool`. References past the
+  /// end of the pool view empty strings.
+  VNameView(const VNameRecord& record, absl::string_view pool)
+      : VNameView(Resolve(record.signature, pool),
+                  Resolve(record.corpus, pool), Resolve(record.root, pool),
+                  Resolve(record.path, pool),
+                  Resolve(record.language, pool)) {}
+  absl::string_view signature() const { return signature_; }
+  absl::string_view corpus() const { return corpus_; }
+  absl::string_view root() const { return root_; }
+  absl::string_view path() const { return path_; }
+  absl::string_view language() const { return language_; }
+
+ private:
+  static absl::string_view Resolve(const StringRef& ref,
+                                   absl::string_view pool) {
+    if (ref.offset > pool.size() || ref.size > pool.size() - ref.offset) {
+      return absl::string_view();
+    }
+    return pool.substr(ref.offset, ref.size);
+  }
+
+  absl::string_view signature_, corpus_, root_, path_, language_;
+};
+
+bool ClaimTable::HasMagic(absl::string_view prefix) {
+  return prefix.substr(0, kMagic.size()) == kMagic;
+}
+
+absl::StatusOr<std::unique_ptr<ClaimTable>> ClaimTable::FromBuffer(
+    absl::string_view data) {
+  auto table = absl::WrapUnique(new ClaimTable());
+  table->data_ = data;
+  auto status = table->Init();
+  if (!status.ok()) {
+    return status;
+  }
+  return table;
+}
+
+absl::StatusOr<std::unique_ptr<ClaimTable>> ClaimTable::Open(
+    const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("Couldn't open ", path, ": ", strerror(errno)));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0 || info.st_size == 0) {
+    ::close(fd);
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is empty or can't be read"));
+  }
+  void* mapping =
+      ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, /*offset=*/0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return absl::InternalError(
+        absl::StrCat("Couldn't map ", path, ": ", strerror(errno)));
+  }
+  auto table = absl::WrapUnique(new ClaimTable());
+  table->mapping_ = mapping;
+  table->mapping_size_ = info.st_size;
+  table->data_ =
+      absl::string_view(static_cast<const char*>(mapping), info.st_size);
+  auto status = table->Init();
+  if (!status.ok()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, ": ", status.message()));
+  }
+  return table;
+}
+
+ClaimTable::~ClaimTable() {
+  if (mapping_ != nullptr) {
+    ::munmap(mapping_, mapping_size_);
+  }
+}
+
+absl::Status ClaimTable::Init() {
+#ifdef ABSL_IS_BIG_ENDIAN
+  return absl::UnimplementedError("claim tables are little-endian");
+#endif
+  if (reinterpret_cast<uintptr_t>(data_.data()) % alignof(uint32_t) != 0) {
+    return absl::InvalidArgumentError("claim table is misaligned");
+  }
+  Header header;
+  if (data_.size() < sizeof(header) || !HasMagic(data_)) {
+    return absl::InvalidArgumentError("not a claim table");
+  }
+  memcpy(&header, data_.data(), sizeof(header));
+  const uint64_t vnames_size =
+      static_cast<uint64_t>(header.vname_count) * sizeof(VNameRecord);
+  const uint64_t claims_size =
+      static_cast<uint64_t>(header.claim_count) * sizeof(Claim);
+  if (data_.size() - sizeof(header) <
+          vnames_size + claims_size + header.string_pool_size ||
+      header.string_pool_size > data_.size()) {
+    return absl::InvalidArgumentError("claim table is truncated");
+  }
+  const char* vnames = data_.data() + sizeof(header);
+  const char* claims = vnames + vnames_size;
+  vnames_ = reinterpret_cast<const VNameRecord*>(vnames);
+  vname_count_ = header.vname_count;
+  claims_ = reinterpret_cast<const Claim*>(claims);
+  claim_count_ = header.claim_count;
+  pool_ = absl::string_view(claims + claims_size, header.string_pool_size);
+  return absl::OkStatus();
+}
+
+ClaimTable::VNameView ClaimTable::View(uint32_t index) const {
+  if (index >= vname_count_) {
+    return VNameView(absl::string_view(), absl::string_view(),
+                     absl::string_view(), absl::string_view(),
+                     absl::string_view());
+  }
+  return VNameView(vnames_[index], pool_);
+}
+
+absl::optional<bool> ClaimTable::IsClaimedBy(
+    const proto::VName& dependency, const proto::VName& claimant) const {
+  const VNameView key(dependency);
+  const Claim* end = claims_ + claim_count_;
+  const Claim* found = std::lower_bound(
+      claims_, end, key, [this](const Claim& claim, const VNameView& key) {
+        return VNameLess()(View(claim.dependency), key);
+      });
+  if (found == end || !VNameEquals(View(found->dependency), key)) {
+    return absl::nullopt;
+  }
+  return VNameEquals(View(found->claimant), VNameView(claimant));
+}
+
+ClaimTable::StringRef ClaimTableWriter::InternString(
+    const std::string& value) {
+  CHECK_LE(pool_.size() + value.size(), UINT32_MAX)
+      << "claim table string pool is too big";
+  auto inserted = string_index_.emplace(
+      value, ClaimTable::StringRef{static_cast<uint32_t>(pool_.size()),
+                                   static_cast<uint32_t>(value.size())});
+  if (inserted.second) {
+    pool_.append(value);
+  }
+  return inserted.first->second;
+}
+
+uint32_t ClaimTableWriter::Intern(const proto::VName& vname) {
+  ClaimTable::VNameRecord record;
+  record.signature = InternString(vname.signature());
+  record.corpus = InternString(vname.corpus());
+  record.root = InternString(vname.root());
+  record.path = InternString(vname.path());
+  record.language = InternString(vname.language());
+  auto inserted = record_index_.emplace(
+      std::string(reinterpret_cast<const char*>(&record), sizeof(record)),
+      static_cast<uint32_t>(records_.size()));
+  if (inserted.second) {
+    records_.push_back(record);
+  }
+  return inserted.first->second;
+}
+
+void ClaimTableWriter::Add(const proto::VName& dependency,
+                           const proto::VName& claimant) {
+  const uint32_t dependency_index = Intern(dependency);
+  const uint32_t claimant_index = Intern(claimant);
+  auto inserted = claim_index_.emplace(dependency_index, claims_.size());
+  if (inserted.second) {
+    claims_.push_back({dependency_index, claimant_index});
+  } else {
+    claims_[inserted.first->second].claimant = claimant_index;
+  }
+}
+
+std::string ClaimTableWriter::Finish() {
+  std::sort(claims_.begin(), claims_.end(),
+            [this](const ClaimTable::Claim& lhs, const ClaimTable::Claim& rhs) {
+              return VNameLess()(
+                  ClaimTable::VNameView(records_[lhs.dependency], pool_),
+                  ClaimTable::VNameView(records_[rhs.dependency], pool_));
+            });
+  Header header;
+  memcpy(header.magic, ClaimTable::kMagic.data(), sizeof(header.magic));
+  header.vname_count = records_.size();
+  header.claim_count = claims_.size();
+  header.string_pool_size = pool_.size();
+  std::string table;
+  table.reserve(sizeof(header) + records_.size() * sizeof(records_[0]) +
+                claims_.size() * sizeof(claims_[0]) + pool_.size());
+  table.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  table.append(reinterpret_cast<const char*>(records_.data()),
+               records_.size() * sizeof(records_[0]));
+  table.append(reinterpret_cast<const char*>(claims_.data()),
+               claims_.size() * sizeof(claims_[0]));
+  table.append(pool_);
+  return table;
+}
+
+}  // namespace kythe
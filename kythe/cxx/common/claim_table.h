@@ -0,0 +1,144 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_COMMON_CLAIM_TABLE_H_
+#define KYTHE_CXX_COMMON_CLAIM_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+
+/// \brief A read-only static claim table that is used in place, usually
+/// from a memory-mapped file.
+///
+/// A claim table maps dependency VNames to the compilation units that claim
+/// them, as the gzipped `ClaimAssignment` stream written by `static_claim`
+/// does. Instead of being decoded into a map, though, it is laid out so
+/// that lookups can binary-search it directly:
+///
+///     Header: "KCLAIMT1", then uint32 vname_count, uint32 claim_count,
+///             uint64 string_pool_size, all little-endian.
+///     VNames: vname_count records of five (uint32 offset, uint32 size)
+///             string references into the pool, for signature, corpus,
+///             root, path and language.
+///     Claims: claim_count (uint32 dependency, uint32 claimant) pairs of
+///             indices into the VNames, sorted by dependency in `VNameLess`
+///             order.
+///     Pool:   string_pool_size bytes of interned strings.
+///
+/// Every distinct string and every distinct VName is stored once, and all
+/// processes that map the same file share its pages.
+class ClaimTable {
+ public:
+  /// \brief Maps the table at `path` into memory.
+  static absl::StatusOr<std::unique_ptr<ClaimTable>> Open(
+      const std::string& path);
+  /// \brief Uses the table in `data`, which must outlive the result and be
+  /// 4-byte aligned.
+  static absl::StatusOr<std::unique_ptr<ClaimTable>> FromBuffer(
+      absl::string_view data);
+  /// \return true if `prefix`, the start of a file, looks like a claim
+  /// table.
+  static bool HasMagic(absl::string_view prefix);
+
+  ClaimTable(const ClaimTable&) = delete;
+  ClaimTable& operator=(const ClaimTable&) = delete;
+  ~ClaimTable();
+
+  /// \return whether `claimant` is responsible for `dependency`, or nullopt
+  /// if the table doesn't assign `dependency` to anyone.
+  absl::optional<bool> IsClaimedBy(const proto::VName& dependency,
+                                   const proto::VName& claimant) const;
+
+  /// \return the number of claims in the table.
+  size_t size() const { return claim_count_; }
+
+  /// \brief The magic bytes every claim table starts with.
+  static constexpr absl::string_view kMagic = "KCLAIMT1";
+
+ private:
+  struct StringRef {
+    uint32_t offset;
+    uint32_t size;
+  };
+  struct VNameRecord {
+    StringRef signature, corpus, root, path, language;
+  };
+  struct Claim {
+    uint32_t dependency;
+    uint32_t claimant;
+  };
+  class VNameView;
+  friend class ClaimTableWriter;
+
+  ClaimTable() = default;
+  /// \brief Checks the layout of `data_` and sets up the section pointers.
+  absl::Status Init();
+  VNameView View(uint32_t index) const;
+  absl::string_view String(const StringRef& ref) const;
+
+  absl::string_view data_;
+  /// The address and size to unmap on destruction, if mapped.
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  const VNameRecord* vnames_ = nullptr;
+  uint32_t vname_count_ = 0;
+  const Claim* claims_ = nullptr;
+  uint32_t claim_count_ = 0;
+  absl::string_view pool_;
+};
+
+/// \brief Builds a `ClaimTable`.
+class ClaimTableWriter {
+ public:
+  /// \brief Assigns `dependency` to `claimant`. Each dependency should be
+  /// added at most once; only the last claimant added for it is kept.
+  void Add(const proto::VName& dependency, const proto::VName& claimant);
+  /// \return the serialized table. The writer can't be used afterward.
+  std::string Finish();
+
+ private:
+  /// \return the index of `vname` among `records_`, adding it if needed.
+  uint32_t Intern(const proto::VName& vname);
+  /// \return a reference to `value` in `pool_`, adding it if needed.
+  ClaimTable::StringRef InternString(const std::string& value);
+
+  std::vector<ClaimTable::VNameRecord> records_;
+  std::vector<ClaimTable::Claim> claims_;
+  std::string pool_;
+  /// Maps the bytes of each record to its index in `records_`.
+  absl::flat_hash_map<std::string, uint32_t> record_index_;
+  /// Maps each string in `pool_` to its reference.
+  absl::flat_hash_map<std::string, ClaimTable::StringRef> string_index_;
+  /// Maps each dependency's record index to its claim in `claims_`.
+  absl::flat_hash_map<uint32_t, size_t> claim_index_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_CLAIM_TABLE_H_
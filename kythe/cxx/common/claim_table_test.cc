@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/common/claim_table.h"
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+proto::VName MakeVName(const std::string& path, const std::string& signature,
+                       const std::string& corpus = "corpus") {
+  proto::VName vname;
+  vname.set_corpus(corpus);
+  vname.set_path(path);
+  vname.set_signature(signature);
+  return vname;
+}
+
+class ClaimTableTest : public ::testing::Test {
+ protected:
+  ClaimTableTest()
+      : unit_a_(MakeVName("a.cc", "", "units")),
+        unit_b_(MakeVName("b.cc", "", "units")) {
+    ClaimTableWriter writer;
+    // Added out of order, with shared strings.
+    writer.Add(MakeVName("z.h", "ctx1"), unit_b_);
+    writer.Add(MakeVName("a.h", ""), unit_a_);
+    writer.Add(MakeVName("z.h", "ctx0"), unit_a_);
+    writer.Add(MakeVName("m.h", ""), unit_a_);
+    // Reassigned; the last claimant wins.
+    writer.Add(MakeVName("m.h", ""), unit_b_);
+    data_ = writer.Finish();
+  }
+
+  proto::VName unit_a_;
+  proto::VName unit_b_;
+  std::string data_;
+};
+
+TEST_F(ClaimTableTest, AnswersClaims) {
+  auto table = ClaimTable::FromBuffer(data_);
+  ASSERT_TRUE(table.ok()) << table.status();
+  EXPECT_EQ(4, (*table)->size());
+  EXPECT_EQ(true, (*table)->IsClaimedBy(MakeVName("a.h", ""), unit_a_));
+  EXPECT_EQ(false, (*table)->IsClaimedBy(MakeVName("a.h", ""), unit_b_));
+  EXPECT_EQ(true, (*table)->IsClaimedBy(MakeVName("z.h", "ctx0"), unit_a_));
+  EXPECT_EQ(true, (*table)->IsClaimedBy(MakeVName("z.h", "ctx1"), unit_b_));
+  EXPECT_EQ(true, (*table)->IsClaimedBy(MakeVName("m.h", ""), unit_b_));
+  EXPECT_EQ(absl::nullopt,
+            (*table)->IsClaimedBy(MakeVName("z.h", "ctx2"), unit_a_));
+  EXPECT_EQ(absl::nullopt,
+            (*table)->IsClaimedBy(MakeVName("a.h", "", "other"), unit_a_));
+}
+
+TEST_F(ClaimTableTest, InternsStrings) {
+  // Each distinct string is stored once.
+  for (const char* value : {"corpus", "units", "z.h", "ctx1"}) {
+    size_t first = data_.find(value);
+    ASSERT_NE(std::string::npos, first) << value;
+    EXPECT_EQ(std::string::npos, data_.find(value, first + 1)) << value;
+  }
+}
+
+TEST_F(ClaimTableTest, RejectsBadTables) {
+  EXPECT_TRUE(ClaimTable::HasMagic(data_));
+  EXPECT_FALSE(ClaimTable::FromBuffer("").ok());
+  std::string bad_magic = data_;
+  bad_magic[0] = 'X';
+  EXPECT_FALSE(ClaimTable::HasMagic(bad_magic));
+  EXPECT_FALSE(ClaimTable::FromBuffer(bad_magic).ok());
+  std::string truncated = data_.substr(0, data_.size() - 1);
+  EXPECT_FALSE(ClaimTable::FromBuffer(truncated).ok());
+}
+
+TEST_F(ClaimTableTest, MapsFiles) {
+  const char* temp_dir = getenv("TEST_TMPDIR");
+  std::string path =
+      std::string(temp_dir != nullptr ? temp_dir : "/tmp") + "/claims.XXXXXX";
+  int fd = mkstemp(&path[0]);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(data_.size(), write(fd, data_.data(), data_.size()));
+  close(fd);
+  auto table = ClaimTable::Open(path);
+  ASSERT_TRUE(table.ok()) << table.status();
+  EXPECT_EQ(true, (*table)->IsClaimedBy(MakeVName("z.h", "ctx1"), unit_b_));
+  unlink(path.c_str());
+  EXPECT_FALSE(ClaimTable::Open(path).ok());
+}
+
+}  // namespace
+}  // namespace kythe
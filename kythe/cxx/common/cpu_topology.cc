@@ -0,0 +1,129 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/cpu_topology.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <fstream>
+#include <string>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Reads the first line of the file at `path`.
+absl::optional<std::string> ReadLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  if (!file || !std::getline(file, line)) {
+    return absl::nullopt;
+  }
+  return line;
+}
+
+}  // anonymous namespace
+
+absl::optional<std::vector<int>> ParseCpuList(absl::string_view list) {
+  std::vector<int> cpus;
+  list = absl::StripAsciiWhitespace(list);
+  if (list.empty()) {
+    return cpus;
+  }
+  for (absl::string_view range : absl::StrSplit(list, ',')) {
+    const size_t dash = range.find('-');
+    int first, last;
+    if (!absl::SimpleAtoi(range.substr(0, dash), &first) || first < 0) {
+      return absl::nullopt;
+    }
+    last = first;
+    if (dash != absl::string_view::npos &&
+        (!absl::SimpleAtoi(range.substr(dash + 1), &last) || last < first)) {
+      return absl::nullopt;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> ReadNumaNodeCpus() {
+  std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+  const std::string kNodeRoot = "/sys/devices/system/node/";
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return nodes;
+  }
+  auto online = ReadLine(kNodeRoot + "online");
+  if (!online) {
+    return nodes;
+  }
+  auto node_ids = ParseCpuList(*online);
+  if (!node_ids) {
+    return nodes;
+  }
+  for (int node : *node_ids) {
+    auto line = ReadLine(absl::StrCat(kNodeRoot, "node", node, "/cpulist"));
+    if (!line) {
+      return {};
+    }
+    auto cpus = ParseCpuList(*line);
+    if (!cpus) {
+      return {};
+    }
+    std::vector<int> usable;
+    for (int cpu : *cpus) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+        usable.push_back(cpu);
+      }
+    }
+    if (!usable.empty()) {
+      nodes.push_back(std::move(usable));
+    }
+  }
+#endif
+  return nodes;
+}
+
+bool PinCurrentThreadToCpus(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  if (CPU_COUNT(&set) == 0) {
+    return false;
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace kythe
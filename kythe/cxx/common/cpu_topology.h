@@ -0,0 +1,43 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_CPU_TOPOLOGY_H_
+#define KYTHE_CXX_COMMON_CPU_TOPOLOGY_H_
+
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace kythe {
+
+/// \brief Parses a list of CPU (or NUMA node) numbers in the format Linux
+/// uses under /sys, such as "0-3,8,10-11".
+/// \return the numbers in the list in order, or nullopt if it is malformed.
+absl::optional<std::vector<int>> ParseCpuList(absl::string_view list);
+
+/// \return the CPUs that this process may run on, grouped by NUMA node. Nodes
+/// without any such CPUs are left out. Empty if the topology couldn't be
+/// read (as on platforms other than Linux).
+std::vector<std::vector<int>> ReadNumaNodeCpus();
+
+/// \brief Restricts the calling thread to running on `cpus`.
+/// \return false if that isn't supported or didn't work.
+bool PinCurrentThreadToCpus(const std::vector<int>& cpus);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_CPU_TOPOLOGY_H_
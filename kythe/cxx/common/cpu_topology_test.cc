@@ -0,0 +1,47 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/cpu_topology.h"
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(CpuTopologyTest, ParsesCpuLists) {
+  EXPECT_EQ(std::vector<int>{}, ParseCpuList(""));
+  EXPECT_EQ(std::vector<int>{}, ParseCpuList("\n"));
+  EXPECT_EQ(std::vector<int>{3}, ParseCpuList("3\n"));
+  EXPECT_EQ((std::vector<int>{0, 1, 2, 3, 8, 10, 11}),
+            ParseCpuList("0-3,8,10-11"));
+}
+
+TEST(CpuTopologyTest, RejectsMalformedCpuLists) {
+  EXPECT_FALSE(ParseCpuList("a").has_value());
+  EXPECT_FALSE(ParseCpuList("0-").has_value());
+  EXPECT_FALSE(ParseCpuList("3-1").has_value());
+  EXPECT_FALSE(ParseCpuList("1,,2").has_value());
+  EXPECT_FALSE(ParseCpuList("-1").has_value());
+}
+
+TEST(CpuTopologyTest, NodesHaveCpus) {
+  for (const auto& node : ReadNumaNodeCpus()) {
+    EXPECT_FALSE(node.empty());
+  }
+}
+
+}  // namespace
+}  // namespace kythe
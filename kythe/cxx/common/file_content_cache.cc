@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/file_content_cache.h"
+
+#include <utility>
+
+namespace kythe {
+
+std::shared_ptr<const std::string> FileContentCache::Find(
+    absl::string_view digest) {
+  absl::MutexLock lock(&mu_);
+  auto found = index_.find(digest);
+  if (found == index_.end()) {
+    ++stats_.misses;
+    return nullptr;
+  }
+  ++stats_.hits;
+  entries_.splice(entries_.begin(), entries_, found->second);
+  return found->second->content;
+}
+
+void FileContentCache::Insert(absl::string_view digest,
+                              std::shared_ptr<const std::string> content) {
+  if (content == nullptr || content->size() > max_bytes_) {
+    return;
+  }
+  absl::MutexLock lock(&mu_);
+  if (index_.contains(digest)) {
+    return;
+  }
+  size_bytes_ += content->size();
+  entries_.push_front(Entry{std::string(digest), std::move(content)});
+  // The key views the digest stored in the list node, which doesn't move.
+  index_.emplace(entries_.front().digest, entries_.begin());
+  EvictLocked();
+}
+
+absl::StatusOr<std::shared_ptr<const std::string>> FileContentCache::ReadFile(
+    IndexReader* reader, absl::string_view digest) {
+  if (auto content = Find(digest)) {
+    return content;
+  }
+  absl::StatusOr<std::string> content = reader->ReadFile(digest);
+  if (!content.ok()) {
+    return content.status();
+  }
+  auto shared = std::make_shared<const std::string>(*std::move(content));
+  Insert(digest, shared);
+  return shared;
+}
+
+FileContentCache::Stats FileContentCache::stats() const {
+  absl::MutexLock lock(&mu_);
+  return stats_;
+}
+
+size_t FileContentCache::size_bytes() const {
+  absl::MutexLock lock(&mu_);
+  return size_bytes_;
+}
+
+void FileContentCache::EvictLocked() {
+  while (size_bytes_ > max_bytes_ && !entries_.empty()) {
+    Entry& last = entries_.back();
+    size_bytes_ -= last.content->size();
+    index_.erase(last.digest);
+    entries_.pop_back();
+    ++stats_.evictions;
+  }
+}
+
+}  // namespace kythe
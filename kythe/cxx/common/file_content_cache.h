@@ -0,0 +1,107 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_FILE_CONTENT_CACHE_H_
+#define KYTHE_CXX_COMMON_FILE_CONTENT_CACHE_H_
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "kythe/cxx/common/index_reader.h"
+
+namespace kythe {
+
+/// \brief Returns the content of the file with the given digest.
+using FileContentReader =
+    std::function<absl::StatusOr<std::shared_ptr<const std::string>>(
+        absl::string_view digest)>;
+
+/// \brief A size-bounded, least-recently-used cache of file contents keyed by
+/// digest.
+///
+/// Units in the same kzip tend to share most of their (system and
+/// third-party) headers. Caching their contents means they are read and
+/// decompressed once instead of once per unit. FileContentCache is
+/// thread-safe.
+class FileContentCache {
+ public:
+  /// \param max_bytes The maximum total size of the cached contents.
+  explicit FileContentCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+  FileContentCache(const FileContentCache&) = delete;
+  FileContentCache& operator=(const FileContentCache&) = delete;
+
+  /// \return the cached content for `digest` or null if there isn't any.
+  std::shared_ptr<const std::string> Find(absl::string_view digest)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Caches `content` for `digest`, evicting old entries if
+  /// necessary. Contents larger than the cache itself are not cached.
+  void Insert(absl::string_view digest,
+              std::shared_ptr<const std::string> content)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Returns the content for `digest`, reading it from `reader` and
+  /// caching it if it isn't already cached.
+  absl::StatusOr<std::shared_ptr<const std::string>> ReadFile(
+      IndexReader* reader, absl::string_view digest);
+
+  /// \brief Statistics about cache usage.
+  struct Stats {
+    /// How many lookups found a cached entry.
+    size_t hits = 0;
+    /// How many lookups did not.
+    size_t misses = 0;
+    /// How many entries were evicted to make room.
+    size_t evictions = 0;
+  };
+  Stats stats() const ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \return the total size of the cached contents.
+  size_t size_bytes() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  struct Entry {
+    std::string digest;
+    std::shared_ptr<const std::string> content;
+  };
+  using EntryList = std::list<Entry>;
+
+  /// \brief Evicts entries until the total size is at most `max_bytes_`.
+  void EvictLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  const size_t max_bytes_;
+  mutable absl::Mutex mu_;
+  /// Entries ordered from most to least recently used.
+  EntryList entries_ ABSL_GUARDED_BY(mu_);
+  /// Maps digests to their positions in `entries_`.
+  absl::flat_hash_map<absl::string_view, EntryList::iterator> index_
+      ABSL_GUARDED_BY(mu_);
+  /// The sum of the sizes of the contents in `entries_`.
+  size_t size_bytes_ ABSL_GUARDED_BY(mu_) = 0;
+  Stats stats_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_FILE_CONTENT_CACHE_H_
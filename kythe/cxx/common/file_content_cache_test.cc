@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/file_content_cache.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+class FakeIndexReader : public IndexReaderInterface {
+ public:
+  explicit FakeIndexReader(int* reads) : reads_(reads) {}
+
+  absl::Status Scan(const ScanCallback& scan) override {
+    return absl::OkStatus();
+  }
+  absl::StatusOr<proto::IndexedCompilation> ReadUnit(
+      absl::string_view digest) override {
+    return absl::NotFoundError("no units");
+  }
+  absl::StatusOr<std::string> ReadFile(absl::string_view digest) override {
+    ++*reads_;
+    if (digest == "missing") {
+      return absl::NotFoundError("missing");
+    }
+    return std::string(digest);
+  }
+
+ private:
+  int* reads_;
+};
+
+std::shared_ptr<const std::string> Content(const std::string& content) {
+  return std::make_shared<const std::string>(content);
+}
+
+TEST(FileContentCacheTest, FindsInsertedContent) {
+  FileContentCache cache(100);
+  EXPECT_EQ(cache.Find("a"), nullptr);
+  cache.Insert("a", Content("aaaa"));
+  ASSERT_NE(cache.Find("a"), nullptr);
+  EXPECT_EQ(*cache.Find("a"), "aaaa");
+  EXPECT_EQ(cache.size_bytes(), 4);
+  EXPECT_EQ(cache.stats().hits, 2);
+  EXPECT_EQ(cache.stats().misses, 1);
+}
+
+TEST(FileContentCacheTest, EvictsLeastRecentlyUsed) {
+  FileContentCache cache(8);
+  cache.Insert("a", Content("aaaa"));
+  cache.Insert("b", Content("bbbb"));
+  // Touch "a" so that "b" is the least recently used.
+  EXPECT_NE(cache.Find("a"), nullptr);
+  cache.Insert("c", Content("cccc"));
+  EXPECT_NE(cache.Find("a"), nullptr);
+  EXPECT_EQ(cache.Find("b"), nullptr);
+  EXPECT_NE(cache.Find("c"), nullptr);
+  EXPECT_EQ(cache.size_bytes(), 8);
+  EXPECT_EQ(cache.stats().evictions, 1);
+}
+
+TEST(FileContentCacheTest, SkipsOversizedContent) {
+  FileContentCache cache(2);
+  cache.Insert("a", Content("aaaa"));
+  EXPECT_EQ(cache.Find("a"), nullptr);
+  EXPECT_EQ(cache.size_bytes(), 0);
+}
+
+TEST(FileContentCacheTest, ReadFileReadsOnce) {
+  int reads = 0;
+  IndexReader reader(absl::make_unique<FakeIndexReader>(&reads));
+  FileContentCache cache(100);
+  for (int i = 0; i < 3; ++i) {
+    auto content = cache.ReadFile(&reader, "digest");
+    ASSERT_TRUE(content.ok()) << content.status();
+    EXPECT_EQ(**content, "digest");
+  }
+  EXPECT_EQ(reads, 1);
+  EXPECT_FALSE(cache.ReadFile(&reader, "missing").ok());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -16,6 +16,8 @@
 
 #include "file_vname_generator.h"
 
+#include <algorithm>
+
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_replace.h"
@@ -29,6 +31,9 @@ namespace {
 
 const LazyRE2 kSubstitutionsPattern = {R"(@\w+@)"};
 
+/// The number of lookups to remember before starting over.
+constexpr size_t kMaxMemoizedLookups = 1 << 16;
+
 std::string EscapeBackslashes(absl::string_view value) {
   return absl::StrReplaceAll(value, {{R"(\)", R"(\\)"}});
 }
@@ -88,32 +93,70 @@ absl::StatusOr<std::string> ParseTemplateMember(const RE2& pattern,
 
 }  // namespace
 
+int FileVNameGenerator::FindFirstMatchingRule(absl::string_view path) const {
+  if (rule_set_ok_) {
+    absl::StatusOr<std::vector<int>> matches = rule_set_.ExplainMatch(path);
+    if (matches.ok()) {
+      return matches->empty()
+                 ? -1
+                 : *std::min_element(matches->begin(), matches->end());
+    }
+    LOG(WARNING) << "Falling back to matching VName rules one at a time: "
+                 << matches.status();
+  }
+  for (size_t i = 0; i < rules_.size(); ++i) {
+    if (RE2::FullMatch(path, *rules_[i].pattern)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+kythe::proto::VName FileVNameGenerator::ApplyRule(const VNameRule& rule,
+                                                  absl::string_view path) {
+  std::vector<re2::StringPiece> captures(
+      1 + std::max({RE2::MaxSubmatch(rule.corpus), RE2::MaxSubmatch(rule.root),
+                    RE2::MaxSubmatch(rule.path)}));
+  kythe::proto::VName result;
+  if (!rule.pattern->Match(path, 0, path.size(), RE2::ANCHOR_BOTH,
+                           captures.data(), captures.size())) {
+    LOG(DFATAL) << "VName rule " << rule.pattern->pattern()
+                << " was expected to match " << path;
+    return result;
+  }
+  if (!rule.corpus.empty()) {
+    rule.pattern->Rewrite(result.mutable_corpus(), rule.corpus,
+                          captures.data(), captures.size());
+  }
+  if (!rule.root.empty()) {
+    rule.pattern->Rewrite(result.mutable_root(), rule.root, captures.data(),
+                          captures.size());
+  }
+  if (!rule.path.empty()) {
+    rule.pattern->Rewrite(result.mutable_path(), rule.path, captures.data(),
+                          captures.size());
+  }
+  return result;
+}
+
 kythe::proto::VName FileVNameGenerator::LookupBaseVName(
     absl::string_view path) const {
-  for (const auto& rule : rules_) {
-    std::vector<re2::StringPiece> captures(
-        1 +
-        std::max({RE2::MaxSubmatch(rule.corpus), RE2::MaxSubmatch(rule.root),
-                  RE2::MaxSubmatch(rule.path)}));
-    if (rule.pattern->Match(path, 0, path.size(), RE2::ANCHOR_BOTH,
-                            captures.data(), captures.size())) {
-      kythe::proto::VName result;
-      if (!rule.corpus.empty()) {
-        rule.pattern->Rewrite(result.mutable_corpus(), rule.corpus,
-                              captures.data(), captures.size());
-      }
-      if (!rule.root.empty()) {
-        rule.pattern->Rewrite(result.mutable_root(), rule.root, captures.data(),
-                              captures.size());
-      }
-      if (!rule.path.empty()) {
-        rule.pattern->Rewrite(result.mutable_path(), rule.path, captures.data(),
-                              captures.size());
-      }
-      return result;
+  {
+    absl::MutexLock lock(&memo_->mutex);
+    auto found = memo_->vnames.find(path);
+    if (found != memo_->vnames.end()) {
+      return found->second;
     }
   }
-  return default_vname_;
+  int rule = FindFirstMatchingRule(path);
+  kythe::proto::VName result =
+      rule < 0 ? default_vname_ : ApplyRule(rules_[rule], path);
+  absl::MutexLock lock(&memo_->mutex);
+  if (memo_->vnames.size() >= kMaxMemoizedLookups) {
+    memo_->vnames.clear();
+  }
+  memo_->vnames.emplace(path, result);
+  return result;
 }
 
 kythe::proto::VName FileVNameGenerator::LookupVName(
@@ -136,6 +179,10 @@ bool FileVNameGenerator::LoadJsonString(absl::string_view data,
 
 absl::Status FileVNameGenerator::LoadJsonString(absl::string_view data) {
   using Value = rapidjson::Value;
+  // Rules may be added below even if loading fails partway, so the combined
+  // set can't be trusted until it has been rebuilt.
+  rule_set_ok_ = false;
+  memo_ = std::make_shared<LookupMemo>();
   rapidjson::Document document;
   document.Parse(data.data(), data.size());
   if (document.HasParseError()) {
@@ -189,6 +236,19 @@ absl::Status FileVNameGenerator::LoadJsonString(absl::string_view data) {
 
     rules_.push_back(next_rule);
   }
+  std::vector<absl::string_view> patterns;
+  patterns.reserve(rules_.size());
+  for (const auto& rule : rules_) {
+    patterns.push_back(rule.pattern->pattern());
+  }
+  absl::StatusOr<RegexSet> rule_set =
+      RegexSet::Build(patterns, RE2::DefaultOptions, RE2::ANCHOR_BOTH);
+  rule_set_ok_ = rule_set.ok();
+  if (rule_set_ok_) {
+    rule_set_ = *std::move(rule_set);
+  } else {
+    LOG(WARNING) << "Couldn't combine VName rules: " << rule_set.status();
+  }
   return absl::OkStatus();
 }
 }  // namespace kythe
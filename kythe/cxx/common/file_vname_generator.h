@@ -21,9 +21,13 @@
 #include <string>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "kythe/cxx/common/regex.h"
 #include "kythe/proto/storage.pb.h"
 #include "re2/re2.h"
 
@@ -42,7 +46,8 @@ class FileVNameGenerator {
   absl::Status LoadJsonString(absl::string_view data);
 
   /// \brief Returns a base VName for a given file path (or an empty VName if
-  /// no configuration rule matches the path).
+  /// no configuration rule matches the path). Results are remembered, so
+  /// looking up the same path again is cheap. Thread-safe.
   kythe::proto::VName LookupBaseVName(absl::string_view path) const;
 
   /// \brief Returns a VName for the given file path.
@@ -51,6 +56,7 @@ class FileVNameGenerator {
   /// \brief Sets the default base VName to use when no rules match.
   void set_default_base_vname(const kythe::proto::VName& default_vname) {
     default_vname_ = default_vname;
+    memo_ = std::make_shared<LookupMemo>();
   }
 
  private:
@@ -65,10 +71,33 @@ class FileVNameGenerator {
     /// Substitution pattern used to construct the path.
     std::string path;
   };
+  /// \brief Base VNames that have already been looked up. Copies of a
+  /// generator share their memo until one of them is reconfigured.
+  struct LookupMemo {
+    absl::Mutex mutex;
+    absl::flat_hash_map<std::string, kythe::proto::VName> vnames
+        ABSL_GUARDED_BY(mutex);
+  };
+
+  /// \return the index in `rules_` of the first rule whose pattern matches
+  /// all of `path`, or -1 if none does.
+  int FindFirstMatchingRule(absl::string_view path) const;
+
+  /// \return the base VName that `rule` (which matches) gives `path`.
+  static kythe::proto::VName ApplyRule(const VNameRule& rule,
+                                       absl::string_view path);
+
   /// The rules to apply to incoming paths. The first one to match is used.
   std::vector<VNameRule> rules_;
+  /// Every rule's pattern, anchored at both ends, in the same order as
+  /// `rules_`. Finds the rules that match a path in one pass.
+  RegexSet rule_set_;
+  /// Whether `rule_set_` is usable; if it isn't, rules are tried one by one.
+  bool rule_set_ok_ = true;
   /// The default base VName to use when no rules match.
   kythe::proto::VName default_vname_;
+  /// Lookups made against the current configuration.
+  std::shared_ptr<LookupMemo> memo_ = std::make_shared<LookupMemo>();
 };
 }  // namespace kythe
 
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for FileVNameGenerator.
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "benchmark/benchmark.h"
+#include "glog/logging.h"
+#include "kythe/cxx/common/file_vname_generator.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Returns a configuration with `count` rules, each matching its own
+/// directory, followed by a catch-all rule like the one in vnames.json.
+std::string MakeConfig(int count) {
+  std::vector<std::string> rules;
+  for (int i = 0; i < count; ++i) {
+    rules.push_back(absl::StrCat("{\"pattern\": \"third_party/lib", i,
+                                 "/(.*)\", \"vname\": {\"corpus\": \"lib", i,
+                                 "\", \"path\": \"@1@\"}}"));
+  }
+  rules.push_back(
+      "{\"pattern\": \"(.*)\", "
+      "\"vname\": {\"corpus\": \"CORPUS\", \"path\": \"@1@\"}}");
+  return absl::StrCat("[", absl::StrJoin(rules, ","), "]");
+}
+
+/// \brief Looks up paths that match the first rule, the last specific rule
+/// and the catch-all rule in a configuration with `range(0)` rules.
+void BM_LookupVName(benchmark::State& state) {
+  const int rules = state.range(0);
+  FileVNameGenerator generator;
+  std::string error_text;
+  CHECK(generator.LoadJsonString(MakeConfig(rules), &error_text))
+      << error_text;
+  const std::vector<std::string> paths = {
+      "third_party/lib0/src/file.cc",
+      absl::StrCat("third_party/lib", rules - 1, "/include/file.h"),
+      "kythe/cxx/common/file_vname_generator.cc",
+  };
+  size_t next = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        generator.LookupVName(paths[next++ % paths.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LookupVName)->RangeMultiplier(4)->Range(1, 1024);
+
+}  // anonymous namespace
+}  // namespace kythe
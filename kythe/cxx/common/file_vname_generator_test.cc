@@ -114,6 +114,27 @@ TEST(FileVNameGenerator, LookupGroups) {
           .DebugString());
 }
 
+TEST(FileVNameGenerator, LookupsFollowNewRules) {
+  FileVNameGenerator generator;
+  std::string error_text;
+  ASSERT_TRUE(generator.LoadJsonString(
+      R"([{"pattern": "a/(.*)", "vname": {"corpus": "a", "path": "@1@"}}])",
+      &error_text))
+      << "Couldn't parse: " << error_text;
+  EXPECT_EQ("a", generator.LookupBaseVName("a/x").corpus());
+  EXPECT_EQ("a", generator.LookupBaseVName("a/x").corpus());
+  EXPECT_EQ("", generator.LookupBaseVName("b/x").corpus());
+  FileVNameGenerator copy = generator;
+  ASSERT_TRUE(generator.LoadJsonString(
+      R"([{"pattern": "(a|b)/(.*)", "vname": {"corpus": "ab"}}])",
+      &error_text))
+      << "Couldn't parse: " << error_text;
+  // Earlier rules still take precedence; earlier misses may now match.
+  EXPECT_EQ("a", generator.LookupBaseVName("a/x").corpus());
+  EXPECT_EQ("ab", generator.LookupBaseVName("b/x").corpus());
+  EXPECT_EQ("", copy.LookupBaseVName("b/x").corpus());
+}
+
 TEST(FileVNameGenerator, ActualConfigTests) {
   FileVNameGenerator generator;
   std::string error_text;
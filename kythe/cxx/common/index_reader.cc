@@ -16,4 +16,16 @@
 
 #include "kythe/cxx/common/index_reader.h"
 
-// This file intentionally left blank.
+namespace kythe {
+
+absl::Status IndexReaderInterface::ReadFiles(
+    absl::Span<const std::string> digests, const ReadFilesCallback& callback) {
+  for (const std::string& digest : digests) {
+    if (!callback(digest, ReadFile(digest))) {
+      break;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace kythe
@@ -23,6 +23,7 @@
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "kythe/proto/analysis.pb.h"
 
 namespace kythe {
@@ -34,6 +35,11 @@ class IndexReaderInterface {
   /// \brief Callback invoked for each available unit digest.
   using ScanCallback = std::function<bool(absl::string_view)>;
 
+  /// \brief Callback invoked by ReadFiles with a requested digest and its
+  /// contents or the error reading them. Returns false to stop early.
+  using ReadFilesCallback = std::function<bool(
+      absl::string_view digest, absl::StatusOr<std::string> content)>;
+
   IndexReaderInterface() = default;
   // IndexReaderInterface is neither copyable nor movable.
   IndexReaderInterface(const IndexReaderInterface&) = delete;
@@ -52,12 +58,20 @@ class IndexReaderInterface {
   /// \brief Reads and returns the requested file data.
   ///  Returns kNotFound if the digest isn't present.
   virtual absl::StatusOr<std::string> ReadFile(absl::string_view digest) = 0;
+
+  /// \brief Reads each of `digests`, invoking `callback` with the results in
+  /// the order requested or until it returns false. Implementations may read
+  /// the files in whatever order suits the underlying store. The default
+  /// calls ReadFile for each digest.
+  virtual absl::Status ReadFiles(absl::Span<const std::string> digests,
+                                 const ReadFilesCallback& callback);
 };
 
 /// \brief Pimpl wrapper around IndexReaderInterface.
 class IndexReader {
  public:
   using ScanCallback = IndexReaderInterface::ScanCallback;
+  using ReadFilesCallback = IndexReaderInterface::ReadFilesCallback;
 
   /// \brief Constructs an IndexReader from the provided implementation.
   explicit IndexReader(std::unique_ptr<IndexReaderInterface> impl)
@@ -84,6 +98,13 @@ class IndexReader {
     return impl_->ReadFile(digest);
   }
 
+  /// \brief Reads each of `digests`, invoking `callback` with the results in
+  /// the order requested or until it returns false.
+  absl::Status ReadFiles(absl::Span<const std::string> digests,
+                         const ReadFilesCallback& callback) {
+    return impl_->ReadFiles(digests, callback);
+  }
+
  private:
   std::unique_ptr<IndexReaderInterface> impl_;
 };
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/AsyncOutputStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "glog/logging.h"
+
+namespace kythe {
+
+AsyncOutputStream::AsyncOutputStream(
+    google::protobuf::io::FileOutputStream* sink, size_t slab_size,
+    size_t slab_count)
+    : AsyncOutputStream(sink, sink, slab_size, slab_count) {}
+
+AsyncOutputStream::AsyncOutputStream(
+    google::protobuf::io::ZeroCopyOutputStream* sink, size_t slab_size,
+    size_t slab_count)
+    : AsyncOutputStream(sink, nullptr, slab_size, slab_count) {}
+
+AsyncOutputStream::AsyncOutputStream(
+    google::protobuf::io::ZeroCopyOutputStream* sink,
+    google::protobuf::io::FileOutputStream* file_sink, size_t slab_size,
+    size_t slab_count)
+    : sink_(CHECK_NOTNULL(sink)),
+      file_sink_(file_sink),
+      slab_size_(slab_size),
+      slab_used_(slab_count, 0) {
+  CHECK_GT(slab_size, 0);
+  CHECK_GE(slab_count, 2);
+  for (size_t i = 0; i < slab_count; ++i) {
+    slabs_.emplace_back(new char[slab_size]);
+  }
+  writer_ = std::thread([this] { WriteLoop(); });
+}
+
+AsyncOutputStream::~AsyncOutputStream() {
+  Publish();
+  {
+    absl::MutexLock lock(&mu_);
+    closing_ = true;
+  }
+  writer_.join();
+}
+
+bool AsyncOutputStream::Next(void** data, int* size) {
+  if (failed_) {
+    return false;
+  }
+  if (fill_used_ == slab_size_) {
+    Publish();
+  }
+  *data = slabs_[fill_index_].get() + fill_used_;
+  *size = static_cast<int>(slab_size_ - fill_used_);
+  fill_used_ = slab_size_;
+  byte_count_ += *size;
+  return true;
+}
+
+void AsyncOutputStream::BackUp(int count) {
+  CHECK_LE(static_cast<size_t>(count), fill_used_);
+  fill_used_ -= count;
+  byte_count_ -= count;
+}
+
+void AsyncOutputStream::Flush() {
+  // If the writer has anything queued, this data will be picked up behind
+  // it; handing over nearly-empty slabs would only make the producer stall.
+  if (fill_used_ != 0 && queued_ == 0) {
+    Publish();
+  }
+}
+
+bool AsyncOutputStream::Sync() {
+  Publish();
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](AsyncOutputStream* stream) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+           stream->mu_) { return stream->queued_ == 0; },
+      this));
+  return !failed_;
+}
+
+void AsyncOutputStream::Publish() {
+  if (fill_used_ == 0) {
+    return;
+  }
+  absl::MutexLock lock(&mu_);
+  slab_used_[fill_index_] = fill_used_;
+  ++queued_;
+  fill_index_ = (fill_index_ + 1) % slabs_.size();
+  fill_used_ = 0;
+  if (queued_ == slabs_.size()) {
+    ++stall_count_;
+    mu_.Await(absl::Condition(
+        +[](AsyncOutputStream* stream) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+             stream->mu_) { return stream->queued_ < stream->slabs_.size(); },
+        this));
+  }
+}
+
+void AsyncOutputStream::WriteLoop() {
+  for (;;) {
+    size_t index;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(
+          +[](AsyncOutputStream* stream) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+               stream->mu_) { return stream->queued_ > 0 || stream->closing_; },
+          this));
+      if (queued_ == 0) {
+        break;
+      }
+      index = (fill_index_ + slabs_.size() - queued_) % slabs_.size();
+    }
+    // The producer won't touch this slab until we release it below.
+    if (!failed_ && !WriteToSink(slabs_[index].get(), slab_used_[index])) {
+      LOG(ERROR) << "Failed writing output; dropping the rest.";
+      failed_ = true;
+    }
+    // If this was the last queued slab, we're about to go idle, so make what
+    // we've written visible. Checking without `mu_` is safe: the producer
+    // can only add slabs, and any it adds get their own chance to flush.
+    if (queued_ == 1 && file_sink_ != nullptr && !failed_ &&
+        !file_sink_->Flush()) {
+      LOG(ERROR) << "Failed flushing output; dropping the rest.";
+      failed_ = true;
+    }
+    absl::MutexLock lock(&mu_);
+    --queued_;
+  }
+}
+
+bool AsyncOutputStream::WriteToSink(const char* data, size_t size) {
+  while (size > 0) {
+    void* buffer;
+    int buffer_size;
+    if (!sink_->Next(&buffer, &buffer_size)) {
+      return false;
+    }
+    size_t copied = std::min(size, static_cast<size_t>(buffer_size));
+    ::memcpy(buffer, data, copied);
+    if (copied < static_cast<size_t>(buffer_size)) {
+      sink_->BackUp(buffer_size - copied);
+    }
+    data += copied;
+    size -= copied;
+  }
+  return true;
+}
+
+}  // namespace kythe
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_ASYNC_OUTPUT_STREAM_H_
+#define KYTHE_CXX_COMMON_INDEXING_ASYNC_OUTPUT_STREAM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+
+namespace kythe {
+
+/// \brief A `ZeroCopyOutputStream` that hands filled slabs of output to a
+/// background thread, which writes them to another stream.
+///
+/// The slabs form a fixed ring shared by exactly one producer (the caller)
+/// and one consumer (the writer thread). The producer only waits when every
+/// slab is queued for writing, so a slow reader on the other end of a pipe
+/// or a slow network filesystem costs one ring of buffered output before it
+/// stalls indexing.
+class AsyncOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  /// \param sink The stream to write to. Only the writer thread touches it
+  /// until this stream is destroyed. It is flushed whenever the writer
+  /// runs out of queued slabs.
+  /// \param slab_size The size of each slab in bytes.
+  /// \param slab_count The number of slabs in the ring. Must be >= 2.
+  explicit AsyncOutputStream(google::protobuf::io::FileOutputStream* sink,
+                             size_t slab_size = kDefaultSlabSize,
+                             size_t slab_count = kDefaultSlabCount);
+  /// \brief Writes to an arbitrary `ZeroCopyOutputStream`, which is never
+  /// flushed.
+  explicit AsyncOutputStream(google::protobuf::io::ZeroCopyOutputStream* sink,
+                             size_t slab_size = kDefaultSlabSize,
+                             size_t slab_count = kDefaultSlabCount);
+  AsyncOutputStream(const AsyncOutputStream&) = delete;
+  AsyncOutputStream& operator=(const AsyncOutputStream&) = delete;
+
+  /// \brief Writes all remaining output, then joins the writer thread.
+  ~AsyncOutputStream() override;
+
+  bool Next(void** data, int* size) override;
+  void BackUp(int count) override;
+  google::protobuf::int64 ByteCount() const override { return byte_count_; }
+
+  /// \brief Hands the partially-filled slab to the writer if the writer is
+  /// idle. Returns without waiting for any write to finish.
+  void Flush();
+
+  /// \brief Hands the partially-filled slab to the writer and waits until
+  /// all output so far has been written to (and flushed on) the sink.
+  /// \return false if the sink has failed.
+  bool Sync() ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \return the number of times the producer had to wait for a free slab.
+  size_t stall_count() const { return stall_count_; }
+
+  static constexpr size_t kDefaultSlabSize = 64 * 1024;
+  static constexpr size_t kDefaultSlabCount = 8;
+
+ private:
+  AsyncOutputStream(google::protobuf::io::ZeroCopyOutputStream* sink,
+                    google::protobuf::io::FileOutputStream* file_sink,
+                    size_t slab_size, size_t slab_count);
+
+  /// \brief Queues the slab being filled (if it is nonempty) and waits for
+  /// the next slab to be free.
+  void Publish() ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief The body of the writer thread.
+  void WriteLoop() ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Copies `size` bytes at `data` to `sink_`.
+  bool WriteToSink(const char* data, size_t size);
+
+  /// The stream the writer thread writes to.
+  google::protobuf::io::ZeroCopyOutputStream* sink_;
+  /// `sink_`, if it's a `FileOutputStream`; otherwise null.
+  google::protobuf::io::FileOutputStream* file_sink_;
+  /// The size of each slab.
+  const size_t slab_size_;
+  /// The ring of slabs.
+  std::vector<std::unique_ptr<char[]>> slabs_;
+  /// The number of bytes used in each queued slab.
+  std::vector<size_t> slab_used_;
+
+  /// The slab the producer is filling. Only modified by the producer with
+  /// `mu_` held.
+  size_t fill_index_ = 0;
+  /// The number of bytes used in the slab being filled. Only the producer
+  /// touches this.
+  size_t fill_used_ = 0;
+  /// The total number of bytes handed out by `Next` less those returned by
+  /// `BackUp`.
+  google::protobuf::int64 byte_count_ = 0;
+  /// The number of times `Publish` had to wait.
+  size_t stall_count_ = 0;
+
+  absl::Mutex mu_;
+  /// The number of slabs queued for (or being) written, starting at
+  /// `(fill_index_ + slabs_.size() - queued_) % slabs_.size()`. Only
+  /// modified with `mu_` held, but may be read without it.
+  std::atomic<size_t> queued_{0};
+  /// Set when the producer is done.
+  bool closing_ ABSL_GUARDED_BY(mu_) = false;
+  /// Set when a write to `sink_` fails.
+  std::atomic<bool> failed_{false};
+  /// The writer thread.
+  std::thread writer_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_ASYNC_OUTPUT_STREAM_H_
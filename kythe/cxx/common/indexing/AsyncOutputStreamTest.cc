@@ -0,0 +1,144 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/AsyncOutputStream.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Appends to a string, optionally waiting for permission first.
+class GatedStringStream : public google::protobuf::io::CopyingOutputStream {
+ public:
+  explicit GatedStringStream(absl::Notification* gate) : gate_(gate) {}
+  bool Write(const void* buffer, int size) override {
+    if (gate_ != nullptr) {
+      gate_->WaitForNotification();
+    }
+    absl::MutexLock lock(&mu_);
+    data_.append(static_cast<const char*>(buffer), size);
+    return true;
+  }
+  std::string data() {
+    absl::MutexLock lock(&mu_);
+    return data_;
+  }
+
+ private:
+  absl::Notification* gate_;
+  absl::Mutex mu_;
+  std::string data_;
+};
+
+std::string MakeData(size_t size) {
+  std::string data;
+  for (size_t i = 0; i < size; ++i) {
+    data.push_back('a' + i % 26);
+  }
+  return data;
+}
+
+void WriteInPieces(google::protobuf::io::ZeroCopyOutputStream* stream,
+                   const std::string& data) {
+  for (size_t i = 0; i < data.size(); i += 100) {
+    google::protobuf::io::CodedOutputStream coded_stream(stream);
+    coded_stream.WriteRaw(data.data() + i,
+                          std::min<size_t>(100, data.size() - i));
+  }
+}
+
+TEST(AsyncOutputStreamTest, WritesEverythingOnDestruction) {
+  GatedStringStream sink(nullptr);
+  std::string data = MakeData(100000);
+  {
+    google::protobuf::io::CopyingOutputStreamAdaptor adaptor(&sink);
+    {
+      AsyncOutputStream stream(&adaptor, 1024, 4);
+      WriteInPieces(&stream, data);
+      EXPECT_EQ(data.size(), stream.ByteCount());
+    }
+  }
+  EXPECT_EQ(data, sink.data());
+}
+
+TEST(AsyncOutputStreamTest, SyncWaitsForWriterAndFlushes) {
+  FILE* file = ::tmpfile();
+  ASSERT_NE(nullptr, file);
+  google::protobuf::io::FileOutputStream file_stream(::fileno(file));
+  AsyncOutputStream stream(&file_stream, 64, 2);
+  std::string data = MakeData(1000);
+  WriteInPieces(&stream, data);
+  EXPECT_TRUE(stream.Sync());
+  std::string written(data.size(), '\0');
+  EXPECT_EQ(data.size(),
+            ::pread(::fileno(file), &written[0], written.size(), 0));
+  EXPECT_EQ(data, written);
+  ::fclose(file);
+}
+
+TEST(AsyncOutputStreamTest, ProducerRunsAheadOfBlockedSink) {
+  absl::Notification gate;
+  GatedStringStream sink(&gate);
+  std::string data = MakeData(3 * 1024 + 512);
+  {
+    google::protobuf::io::CopyingOutputStreamAdaptor adaptor(&sink, 1024);
+    {
+      AsyncOutputStream stream(&adaptor, 1024, 4);
+      WriteInPieces(&stream, data);
+      EXPECT_EQ(0, stream.stall_count());
+      gate.Notify();
+    }
+  }
+  EXPECT_EQ(data, sink.data());
+}
+
+TEST(AsyncOutputStreamTest, ProducerStallsWhenRingIsFull) {
+  absl::Notification gate;
+  GatedStringStream sink(&gate);
+  std::string data = MakeData(8 * 1024);
+  {
+    google::protobuf::io::CopyingOutputStreamAdaptor adaptor(&sink, 1024);
+    {
+      AsyncOutputStream stream(&adaptor, 1024, 2);
+      std::thread opener([&gate] {
+        absl::SleepFor(absl::Milliseconds(50));
+        gate.Notify();
+      });
+      WriteInPieces(&stream, data);
+      EXPECT_GT(stream.stall_count(), 0);
+      opener.join();
+    }
+  }
+  EXPECT_EQ(data, sink.data());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/EntrySetEncoder.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace kythe {
+
+void EntrySetEncoder::Clear() {
+  symbol_ids_.clear();
+  symbols_.clear();
+  node_ids_.clear();
+  nodes_.clear();
+  facts_.clear();
+  edges_.clear();
+  entries_ = 0;
+  Symbol("");
+}
+
+int32_t EntrySetEncoder::Symbol(absl::string_view symbol) {
+  auto [iter, inserted] = symbol_ids_.try_emplace(
+      std::string(symbol), static_cast<int32_t>(symbols_.size()));
+  if (inserted) {
+    symbols_.push_back(&iter->first);
+  }
+  return iter->second;
+}
+
+int32_t EntrySetEncoder::NodeFor(const proto::VName& vname) {
+  Node node = {Symbol(vname.corpus()), Symbol(vname.language()),
+               Symbol(vname.path()), Symbol(vname.root()),
+               Symbol(vname.signature())};
+  auto [iter, inserted] =
+      node_ids_.try_emplace(node, static_cast<int32_t>(nodes_.size()));
+  if (inserted) {
+    nodes_.push_back(node);
+    facts_.emplace_back();
+    edges_.emplace_back();
+  }
+  return iter->second;
+}
+
+void EntrySetEncoder::Add(const proto::Entry& entry) {
+  int32_t source = NodeFor(entry.source());
+  if (entry.has_target()) {
+    int32_t kind = Symbol(entry.edge_kind());
+    int32_t target = NodeFor(entry.target());
+    edges_[source].emplace_back(kind, target);
+  } else {
+    int32_t name = Symbol(entry.fact_name());
+    int32_t value = Symbol(entry.fact_value());
+    facts_[source].emplace_back(name, value);
+  }
+  ++entries_;
+}
+
+void EntrySetEncoder::Encode(storage::EntrySet* set) {
+  set->Clear();
+  // Sort the symbol table. The empty string sorts first, so it keeps id 0.
+  std::vector<int32_t> order(symbols_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [this](int32_t a, int32_t b) {
+    return *symbols_[a] < *symbols_[b];
+  });
+  std::vector<int32_t> remap(symbols_.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    remap[order[i]] = static_cast<int32_t>(i);
+  }
+  absl::string_view previous;
+  for (size_t i = 1; i < order.size(); ++i) {
+    absl::string_view symbol = *symbols_[order[i]];
+    size_t prefix = std::mismatch(previous.begin(), previous.end(),
+                                  symbol.begin(), symbol.end())
+                        .first -
+                    previous.begin();
+    auto* coded = set->add_symbols();
+    coded->set_prefix(static_cast<int32_t>(prefix));
+    coded->set_suffix(std::string(symbol.substr(prefix)));
+    previous = symbol;
+  }
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    const Node& node = nodes_[i];
+    auto* coded = set->add_nodes();
+    coded->set_corpus(remap[node[0]]);
+    coded->set_language(remap[node[1]]);
+    coded->set_path(remap[node[2]]);
+    coded->set_root(remap[node[3]]);
+    coded->set_signature(remap[node[4]]);
+    auto* facts = set->add_fact_groups();
+    for (const auto& [name, value] : facts_[i]) {
+      auto* fact = facts->add_facts();
+      fact->set_name(remap[name]);
+      fact->set_value(remap[value]);
+    }
+    auto* edges = set->add_edge_groups();
+    for (const auto& [kind, target] : edges_[i]) {
+      auto* edge = edges->add_edges();
+      edge->set_kind(remap[kind]);
+      edge->set_target(target);
+    }
+  }
+  Clear();
+}
+
+}  // namespace kythe
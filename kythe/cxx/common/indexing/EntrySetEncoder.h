@@ -0,0 +1,87 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_ENTRY_SET_ENCODER_H_
+#define KYTHE_CXX_COMMON_INDEXING_ENTRY_SET_ENCODER_H_
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "kythe/proto/entryset.pb.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+
+/// \brief Accumulates entries into a `kythe.storage.EntrySet`.
+///
+/// An EntrySet stores each distinct string (VName component, fact name,
+/// fact value or edge kind) once in a prefix-coded symbol table and each
+/// distinct VName once as a tuple of symbol ids, so that facts and edges
+/// are written as small integer references. The encoded sets can be read
+/// with kythe/go/storage/entryset.
+class EntrySetEncoder {
+ public:
+  EntrySetEncoder() { Clear(); }
+
+  /// \brief Adds a fact (if `entry` has no target) or an edge.
+  void Add(const proto::Entry& entry);
+
+  /// \return the number of entries added since the last `Encode`.
+  size_t size() const { return entries_; }
+  bool empty() const { return entries_ == 0; }
+
+  /// \brief Encodes the entries added so far into `set` and then forgets
+  /// them. The symbol table in `set` is sorted.
+  void Encode(storage::EntrySet* set);
+
+ private:
+  /// The symbol ids of a node's corpus, language, path, root and signature.
+  using Node = std::array<int32_t, 5>;
+
+  /// \return the id of `symbol`, assigning it the next id if it is new.
+  int32_t Symbol(absl::string_view symbol);
+
+  /// \return the id of `vname`, assigning it the next id if it is new.
+  int32_t NodeFor(const proto::VName& vname);
+
+  /// \brief Resets to the empty set.
+  void Clear();
+
+  /// Maps symbols to their ids. Id 0 is always the empty string.
+  absl::node_hash_map<std::string, int32_t> symbol_ids_;
+  /// Symbols by id; these point into `symbol_ids_`.
+  std::vector<const std::string*> symbols_;
+  /// Maps nodes to their ids.
+  absl::flat_hash_map<Node, int32_t> node_ids_;
+  /// Nodes by id.
+  std::vector<Node> nodes_;
+  /// (name, value) symbol pairs for each node's facts, by node id.
+  std::vector<std::vector<std::pair<int32_t, int32_t>>> facts_;
+  /// (kind symbol, target node) pairs for each node's edges, by node id.
+  std::vector<std::vector<std::pair<int32_t, int32_t>>> edges_;
+  /// The number of entries added since the last `Encode`.
+  size_t entries_ = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_ENTRY_SET_ENCODER_H_
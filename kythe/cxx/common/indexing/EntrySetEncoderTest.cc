@@ -0,0 +1,160 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/EntrySetEncoder.h"
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
+
+namespace kythe {
+namespace {
+
+proto::VName MakeVName(const std::string& signature) {
+  proto::VName vname;
+  vname.set_corpus("corpus");
+  vname.set_language("c++");
+  vname.set_path("path/to/file.cc");
+  vname.set_signature(signature);
+  return vname;
+}
+
+proto::Entry MakeFact(const std::string& signature, const std::string& name,
+                      const std::string& value) {
+  proto::Entry entry;
+  *entry.mutable_source() = MakeVName(signature);
+  entry.set_fact_name(name);
+  entry.set_fact_value(value);
+  return entry;
+}
+
+proto::Entry MakeEdge(const std::string& source, const std::string& kind,
+                      const std::string& target) {
+  proto::Entry entry;
+  *entry.mutable_source() = MakeVName(source);
+  entry.set_edge_kind(kind);
+  *entry.mutable_target() = MakeVName(target);
+  entry.set_fact_name("/");
+  return entry;
+}
+
+/// \brief Expands `set` back to entries, checking that it is well-formed.
+std::vector<std::string> Decode(const storage::EntrySet& set) {
+  std::vector<std::string> symbols = {""};
+  for (const auto& symbol : set.symbols()) {
+    EXPECT_LE(symbol.prefix(), symbols.back().size());
+    std::string expanded =
+        symbols.back().substr(0, symbol.prefix()) + symbol.suffix();
+    EXPECT_LT(symbols.back(), expanded);
+    symbols.push_back(expanded);
+  }
+  EXPECT_EQ(set.nodes_size(), set.fact_groups_size());
+  EXPECT_EQ(set.nodes_size(), set.edge_groups_size());
+  auto node = [&](int id) {
+    const auto& n = set.nodes(id);
+    return symbols[n.corpus()] + "," + symbols[n.language()] + "," +
+           symbols[n.path()] + "," + symbols[n.root()] + "," +
+           symbols[n.signature()];
+  };
+  std::vector<std::string> entries;
+  for (int i = 0; i < set.nodes_size(); ++i) {
+    for (const auto& fact : set.fact_groups(i).facts()) {
+      entries.push_back(node(i) + " " + symbols[fact.name()] + " " +
+                        symbols[fact.value()]);
+    }
+    for (const auto& edge : set.edge_groups(i).edges()) {
+      EXPECT_LT(edge.target(), set.nodes_size());
+      entries.push_back(node(i) + " " + symbols[edge.kind()] + " " +
+                        node(edge.target()));
+    }
+  }
+  return entries;
+}
+
+TEST(EntrySetEncoderTest, EmptySet) {
+  EntrySetEncoder encoder;
+  EXPECT_TRUE(encoder.empty());
+  storage::EntrySet set;
+  encoder.Encode(&set);
+  EXPECT_EQ(0, set.nodes_size());
+  EXPECT_EQ(0, set.symbols_size());
+}
+
+TEST(EntrySetEncoderTest, RoundTripsFactsAndEdges) {
+  EntrySetEncoder encoder;
+  encoder.Add(MakeFact("a", "/kythe/node/kind", "record"));
+  encoder.Add(MakeFact("b", "/kythe/node/kind", "function"));
+  encoder.Add(MakeEdge("b", "/kythe/edge/childof", "a"));
+  EXPECT_EQ(3, encoder.size());
+  storage::EntrySet set;
+  encoder.Encode(&set);
+  EXPECT_TRUE(encoder.empty());
+  EXPECT_EQ(2, set.nodes_size());
+  EXPECT_EQ(std::vector<std::string>(
+                {"corpus,c++,path/to/file.cc,,a /kythe/node/kind record",
+                 "corpus,c++,path/to/file.cc,,b /kythe/node/kind function",
+                 "corpus,c++,path/to/file.cc,,b /kythe/edge/childof "
+                 "corpus,c++,path/to/file.cc,,a"}),
+            Decode(set));
+}
+
+TEST(EntrySetEncoderTest, SharesSymbols) {
+  EntrySetEncoder encoder;
+  for (int i = 0; i < 10; ++i) {
+    encoder.Add(MakeFact("sig", "/kythe/node/kind", "record"));
+  }
+  storage::EntrySet set;
+  encoder.Encode(&set);
+  EXPECT_EQ(1, set.nodes_size());
+  // corpus, language, path, signature, fact name and fact value.
+  EXPECT_EQ(6, set.symbols_size());
+  EXPECT_EQ(10, set.fact_groups(0).facts_size());
+}
+
+TEST(EntrySetEncoderTest, FileOutputStreamWritesBundles) {
+  std::string output;
+  proto::VName sig = MakeVName("sig");
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    FileOutputStream file_stream(&stream);
+    file_stream.set_entry_set_bundle_size(2);
+    KytheGraphRecorder recorder(&file_stream);
+    VNameRef vname(sig);
+    recorder.AddProperty(vname, PropertyID::kNodeKind, "record");
+    recorder.AddProperty(vname, PropertyID::kComplete, "definition");
+    recorder.AddEdge(vname, EdgeKindID::kChildOf, vname);
+  }
+  google::protobuf::io::CodedInputStream coded_stream(
+      reinterpret_cast<const uint8_t*>(output.data()), output.size());
+  std::vector<size_t> sizes;
+  uint32_t size;
+  while (coded_stream.ReadVarint32(&size)) {
+    auto limit = coded_stream.PushLimit(size);
+    storage::EntrySet set;
+    ASSERT_TRUE(set.ParseFromCodedStream(&coded_stream));
+    coded_stream.PopLimit(limit);
+    sizes.push_back(Decode(set).size());
+  }
+  EXPECT_EQ(std::vector<size_t>({2, 1}), sizes);
+}
+
+}  // namespace
+}  // namespace kythe
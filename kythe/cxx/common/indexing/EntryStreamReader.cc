@@ -0,0 +1,382 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/EntryStreamReader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "kythe/cxx/common/indexing/SnappyOutputStream.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/proto/entryset.pb.h"
+#include "snappy.h"
+
+namespace kythe {
+namespace {
+
+/// The stream identifier chunk that starts every framed snappy stream.
+constexpr absl::string_view kStreamIdentifier("\xff\x06\x00\x00sNaPpY", 10);
+/// Chunk types from the framing format.
+constexpr unsigned char kCompressedChunk = 0x00;
+constexpr unsigned char kUncompressedChunk = 0x01;
+constexpr unsigned char kStreamIdentifierChunk = 0xff;
+/// Chunks of this type and above (other than stream identifiers) are
+/// skipped; the types below it that aren't data are reserved.
+constexpr unsigned char kFirstSkippableChunk = 0x80;
+/// How many chunks are decompressed at a time for each decoding thread.
+constexpr size_t kChunksPerThread = 16;
+
+/// \brief Reads a varint of at most 32 bits from the front of `data`,
+/// advancing it.
+bool ReadVarint32(absl::string_view* data, uint32_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < data->size() && i < 5; ++i) {
+    const uint8_t byte = static_cast<uint8_t>((*data)[i]);
+    *value |= static_cast<uint32_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      data->remove_prefix(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// \return the little-endian integer in the first `bytes` bytes of `data`.
+uint32_t ReadLittleEndian(absl::string_view data, size_t bytes) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+/// \brief A data chunk of a framed snappy stream.
+struct Chunk {
+  bool compressed;
+  /// The masked CRC-32C of the chunk's uncompressed data.
+  uint32_t crc;
+  /// The chunk's (possibly compressed) data.
+  absl::string_view data;
+  /// The size of the chunk's uncompressed data.
+  size_t size;
+  /// Where the uncompressed data goes in the batch being decoded.
+  size_t offset;
+};
+
+/// \brief Decompresses or copies `chunk`'s data to `out` and checks it.
+absl::Status DecodeChunk(const Chunk& chunk, char* out) {
+  if (chunk.compressed) {
+    if (!snappy::RawUncompress(chunk.data.data(), chunk.data.size(), out)) {
+      return absl::DataLossError("Corrupt compressed chunk");
+    }
+  } else {
+    ::memcpy(out, chunk.data.data(), chunk.size);
+  }
+  if (SnappyOutputStream::MaskedCrc32c(absl::string_view(out, chunk.size)) !=
+      chunk.crc) {
+    return absl::DataLossError("Chunk checksum mismatch");
+  }
+  return absl::OkStatus();
+}
+
+/// \brief Looks up symbol `id` in `symbols`.
+/// \return false if there is no such symbol.
+bool FindSymbol(const std::vector<std::string>& symbols, int32_t id,
+                absl::string_view* symbol) {
+  if (id < 0 || static_cast<size_t>(id) >= symbols.size()) {
+    return false;
+  }
+  *symbol = symbols[id];
+  return true;
+}
+
+}  // anonymous namespace
+
+absl::StatusOr<std::unique_ptr<EntryStreamReader>> EntryStreamReader::Open(
+    const std::string& path, const Options& options) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("Couldn't open ", path, ": ", ::strerror(errno)));
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0) {
+    const int error = errno;
+    ::close(fd);
+    return absl::UnknownError(
+        absl::StrCat("Couldn't stat ", path, ": ", ::strerror(error)));
+  }
+  const size_t size = info.st_size;
+  void* mapping = nullptr;
+  if (size > 0) {
+    mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      const int error = errno;
+      ::close(fd);
+      return absl::UnknownError(
+          absl::StrCat("Couldn't map ", path, ": ", ::strerror(error)));
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+  auto reader = absl::make_unique<EntryStreamReader>(
+      absl::string_view(static_cast<const char*>(mapping), size), options);
+  reader->mapping_ = mapping;
+  reader->mapping_size_ = size;
+  return reader;
+}
+
+EntryStreamReader::~EntryStreamReader() {
+  if (mapping_ != nullptr) {
+    ::munmap(mapping_, mapping_size_);
+  }
+}
+
+absl::Status EntryStreamReader::ForEach(
+    absl::FunctionRef<bool(const EntryView&)> visit) {
+  if (absl::StartsWith(data_, kStreamIdentifier)) {
+    return ForEachCompressed(visit);
+  }
+  bool stopped = false;
+  auto visited = VisitMessages(data_, visit, &stopped);
+  if (!visited.ok()) {
+    return visited.status();
+  }
+  if (!stopped && *visited != data_.size()) {
+    return absl::DataLossError("Truncated entry stream");
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<size_t> EntryStreamReader::VisitMessages(
+    absl::string_view messages,
+    absl::FunctionRef<bool(const EntryView&)> visit, bool* stopped) {
+  absl::string_view rest = messages;
+  while (!rest.empty()) {
+    absl::string_view next = rest;
+    uint32_t size;
+    if (!ReadVarint32(&next, &size)) {
+      if (rest.size() < 5) {
+        break;  // The size may be continued in the next batch.
+      }
+      return absl::DataLossError("Malformed message size");
+    }
+    if (size > next.size()) {
+      break;
+    }
+    const absl::string_view message = next.substr(0, size);
+    next.remove_prefix(size);
+    if (options_.format == Format::kEntries) {
+      EntryView entry;
+      if (!EntryWireFormat::Parse(message, &entry)) {
+        return absl::DataLossError("Malformed Entry");
+      }
+      *stopped = !visit(entry);
+    } else {
+      auto status = VisitEntrySet(message, visit, stopped);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    rest = next;
+    if (*stopped) {
+      break;
+    }
+  }
+  return messages.size() - rest.size();
+}
+
+absl::Status EntryStreamReader::VisitEntrySet(
+    absl::string_view data, absl::FunctionRef<bool(const EntryView&)> visit,
+    bool* stopped) {
+  storage::EntrySet set;
+  if (!set.ParseFromArray(data.data(), data.size())) {
+    return absl::DataLossError("Malformed EntrySet");
+  }
+  // Symbol 0 is always the empty string; each other symbol shares a prefix
+  // with the one before it.
+  std::vector<std::string> symbols(1);
+  symbols.reserve(set.symbols_size() + 1);
+  for (const auto& symbol : set.symbols()) {
+    absl::string_view previous = symbols.back();
+    if (symbol.prefix() < 0 ||
+        static_cast<size_t>(symbol.prefix()) > previous.size()) {
+      return absl::DataLossError("Malformed EntrySet symbol");
+    }
+    symbols.push_back(
+        absl::StrCat(previous.substr(0, symbol.prefix()), symbol.suffix()));
+  }
+  auto malformed = [] { return absl::DataLossError("Malformed EntrySet"); };
+  std::vector<VNameRef> nodes(set.nodes_size());
+  for (int i = 0; i < set.nodes_size(); ++i) {
+    const auto& node = set.nodes(i);
+    absl::string_view corpus, language, path, root, signature;
+    if (!FindSymbol(symbols, node.corpus(), &corpus) ||
+        !FindSymbol(symbols, node.language(), &language) ||
+        !FindSymbol(symbols, node.path(), &path) ||
+        !FindSymbol(symbols, node.root(), &root) ||
+        !FindSymbol(symbols, node.signature(), &signature)) {
+      return malformed();
+    }
+    nodes[i].set_corpus(corpus);
+    nodes[i].set_language(language);
+    nodes[i].set_path(path);
+    nodes[i].set_root(root);
+    nodes[i].set_signature(signature);
+  }
+  if (set.fact_groups_size() > set.nodes_size() ||
+      set.edge_groups_size() > set.nodes_size()) {
+    return malformed();
+  }
+  for (int i = 0; i < set.nodes_size(); ++i) {
+    if (i < set.fact_groups_size()) {
+      for (const auto& fact : set.fact_groups(i).facts()) {
+        EntryView entry;
+        entry.source = nodes[i];
+        if (!FindSymbol(symbols, fact.name(), &entry.fact_name) ||
+            !FindSymbol(symbols, fact.value(), &entry.fact_value)) {
+          return malformed();
+        }
+        if (!visit(entry)) {
+          *stopped = true;
+          return absl::OkStatus();
+        }
+      }
+    }
+    if (i < set.edge_groups_size()) {
+      for (const auto& edge : set.edge_groups(i).edges()) {
+        EntryView entry;
+        entry.source = nodes[i];
+        if (!FindSymbol(symbols, edge.kind(), &entry.edge_kind) ||
+            edge.target() < 0 || edge.target() >= set.nodes_size()) {
+          return malformed();
+        }
+        entry.target = nodes[edge.target()];
+        entry.fact_name = "/";
+        if (!visit(entry)) {
+          *stopped = true;
+          return absl::OkStatus();
+        }
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status EntryStreamReader::ForEachCompressed(
+    absl::FunctionRef<bool(const EntryView&)> visit) {
+  std::unique_ptr<ThreadPool> pool;
+  if (options_.decode_threads > 1) {
+    pool = absl::make_unique<ThreadPool>(options_.decode_threads);
+  }
+  const size_t batch_chunks =
+      kChunksPerThread * std::max<size_t>(1, options_.decode_threads);
+  absl::string_view rest = data_.substr(kStreamIdentifier.size());
+  // The unvisited end of the last batch, followed by this batch's data.
+  std::string batch;
+  std::vector<Chunk> chunks;
+  std::vector<absl::Status> statuses;
+  while (!rest.empty()) {
+    chunks.clear();
+    size_t batch_size = batch.size();
+    while (!rest.empty() && chunks.size() < batch_chunks) {
+      if (rest.size() < 4) {
+        return absl::DataLossError("Truncated chunk header");
+      }
+      const unsigned char type = rest[0];
+      const size_t length = ReadLittleEndian(rest.substr(1), 3);
+      if (rest.size() - 4 < length) {
+        return absl::DataLossError("Truncated chunk");
+      }
+      const absl::string_view body = rest.substr(4, length);
+      rest.remove_prefix(4 + length);
+      if (type == kCompressedChunk || type == kUncompressedChunk) {
+        if (length < 4) {
+          return absl::DataLossError("Chunk too short");
+        }
+        Chunk chunk;
+        chunk.compressed = type == kCompressedChunk;
+        chunk.crc = ReadLittleEndian(body, 4);
+        chunk.data = body.substr(4);
+        chunk.size = chunk.data.size();
+        if (chunk.compressed &&
+            !snappy::GetUncompressedLength(chunk.data.data(),
+                                           chunk.data.size(), &chunk.size)) {
+          return absl::DataLossError("Corrupt compressed chunk");
+        }
+        if (chunk.size > SnappyOutputStream::kMaxChunkSize) {
+          return absl::DataLossError("Chunk too long");
+        }
+        chunk.offset = batch_size;
+        batch_size += chunk.size;
+        chunks.push_back(chunk);
+      } else if (type == kStreamIdentifierChunk) {
+        if (body != kStreamIdentifier.substr(4)) {
+          return absl::DataLossError("Malformed stream identifier");
+        }
+      } else if (type < kFirstSkippableChunk) {
+        return absl::DataLossError(
+            absl::StrCat("Reserved chunk type ", static_cast<int>(type)));
+      }
+    }
+    batch.resize(batch_size);
+    statuses.assign(chunks.size(), absl::OkStatus());
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      auto decode = [&, i] {
+        statuses[i] = DecodeChunk(chunks[i], &batch[chunks[i].offset]);
+      };
+      if (pool != nullptr) {
+        pool->Schedule(decode);
+      } else {
+        decode();
+      }
+    }
+    if (pool != nullptr) {
+      pool->Wait();
+    }
+    for (const auto& status : statuses) {
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    bool stopped = false;
+    auto visited = VisitMessages(batch, visit, &stopped);
+    if (!visited.ok()) {
+      return visited.status();
+    }
+    if (stopped) {
+      return absl::OkStatus();
+    }
+    batch.erase(0, *visited);
+  }
+  if (!batch.empty()) {
+    return absl::DataLossError("Truncated entry stream");
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace kythe
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_ENTRY_STREAM_READER_H_
+#define KYTHE_CXX_COMMON_INDEXING_ENTRY_STREAM_READER_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
+
+namespace kythe {
+
+/// \brief Reads the entries in a stream written by `FileOutputStream`.
+///
+/// The stream holds varint-delimited `kythe.proto.Entry` messages or, if it
+/// was written with an entry set bundle size, varint-delimited
+/// `kythe.storage.EntrySet` messages. Either may be compressed with the
+/// snappy framing format (see `SnappyOutputStream`), which is detected from
+/// the stream's first bytes. Files are mapped into memory rather than read,
+/// and entries are visited as `EntryView`s that point into the mapping (or
+/// into the decompressed chunks), so no `proto::Entry` is ever built.
+class EntryStreamReader {
+ public:
+  /// \brief How the stream's messages are encoded.
+  enum class Format {
+    kEntries,    ///< varint-delimited `kythe.proto.Entry` messages
+    kEntrySets,  ///< varint-delimited `kythe.storage.EntrySet` messages
+  };
+
+  struct Options {
+    Format format = Format::kEntries;
+    /// Compressed streams are decompressed on up to this many threads.
+    /// `FileOutputStream` ends a chunk with each buffer it emits, so the
+    /// chunks can be decompressed independently.
+    size_t decode_threads = 1;
+  };
+
+  /// \brief Maps the file at `path` into memory and reads it.
+  static absl::StatusOr<std::unique_ptr<EntryStreamReader>> Open(
+      const std::string& path, const Options& options);
+
+  /// \brief Reads the stream in `data`, which must outlive the reader.
+  EntryStreamReader(absl::string_view data, const Options& options)
+      : data_(data), options_(options) {}
+  EntryStreamReader(const EntryStreamReader&) = delete;
+  EntryStreamReader& operator=(const EntryStreamReader&) = delete;
+  ~EntryStreamReader();
+
+  /// \brief Calls `visit` with each entry in the stream, in order, until it
+  /// returns false. The entries in an `EntrySet` are visited by source node:
+  /// each node's facts, then its edges. Views are only valid during the call
+  /// that they are passed to.
+  /// \return an error if the stream is malformed, after visiting the
+  /// entries before the error.
+  absl::Status ForEach(absl::FunctionRef<bool(const EntryView&)> visit);
+
+ private:
+  /// \brief Visits the complete messages at the start of `messages`.
+  /// \return the number of bytes visited, or an error. `*stopped` is set if
+  /// `visit` returned false.
+  absl::StatusOr<size_t> VisitMessages(
+      absl::string_view messages,
+      absl::FunctionRef<bool(const EntryView&)> visit, bool* stopped);
+
+  /// \brief Visits the entries in the serialized `EntrySet` in `data`.
+  absl::Status VisitEntrySet(absl::string_view data,
+                             absl::FunctionRef<bool(const EntryView&)> visit,
+                             bool* stopped);
+
+  /// \brief Decompresses the framed snappy stream in `data_` a few chunks
+  /// at a time, visiting the messages in each batch.
+  absl::Status ForEachCompressed(
+      absl::FunctionRef<bool(const EntryView&)> visit);
+
+  /// The stream.
+  absl::string_view data_;
+  const Options options_;
+  /// The memory mapping `data_` points into, if any.
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_ENTRY_STREAM_READER_H_
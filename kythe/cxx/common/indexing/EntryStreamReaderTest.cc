@@ -0,0 +1,198 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/EntryStreamReader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/indexing/SnappyOutputStream.h"
+
+namespace kythe {
+namespace {
+
+proto::VName MakeVName(const std::string& signature) {
+  proto::VName vname;
+  vname.set_corpus("corpus");
+  vname.set_language("c++");
+  vname.set_path("path/to/file.cc");
+  vname.set_signature(signature);
+  return vname;
+}
+
+/// \brief Describes `entry` for comparisons.
+std::string Describe(const EntryView& entry) {
+  if (entry.edge_kind.empty()) {
+    return absl::StrCat(entry.source.DebugString(), " ", entry.fact_name, " ",
+                        entry.fact_value);
+  }
+  return absl::StrCat(entry.source.DebugString(), " ", entry.edge_kind, " ",
+                      entry.target.DebugString(), " ", entry.fact_name);
+}
+
+/// \brief Emits `count` nodes, each with a fact and an edge to the previous
+/// node, to `output`.
+/// \return the entries emitted, as `Describe` would describe them.
+std::vector<std::string> EmitNodes(int count, KytheOutputStream* output) {
+  std::vector<std::string> expected;
+  std::vector<proto::VName> vnames;
+  for (int i = 0; i < count; ++i) {
+    vnames.push_back(MakeVName(absl::StrCat("node", i)));
+  }
+  for (int i = 0; i < count; ++i) {
+    VNameRef source(vnames[i]);
+    const std::string value = absl::StrCat("value", i);
+    output->Emit(FactRef{&source, "/kythe/text", value});
+    expected.push_back(
+        absl::StrCat(source.DebugString(), " /kythe/text ", value));
+    if (i > 0) {
+      VNameRef target(vnames[i - 1]);
+      output->Emit(EdgeRef{&source, "/kythe/edge/childof", &target});
+      expected.push_back(absl::StrCat(source.DebugString(),
+                                      " /kythe/edge/childof ",
+                                      target.DebugString(), " /"));
+    }
+  }
+  return expected;
+}
+
+std::vector<std::string> ReadAll(absl::string_view data,
+                                 const EntryStreamReader::Options& options) {
+  std::vector<std::string> entries;
+  EntryStreamReader reader(data, options);
+  auto status = reader.ForEach([&](const EntryView& entry) {
+    entries.push_back(Describe(entry));
+    return true;
+  });
+  EXPECT_TRUE(status.ok()) << status;
+  return entries;
+}
+
+TEST(EntryStreamReaderTest, ReadsEntries) {
+  std::string data;
+  std::vector<std::string> expected;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    FileOutputStream output(&stream);
+    expected = EmitNodes(10, &output);
+  }
+  EXPECT_EQ(expected, ReadAll(data, {}));
+}
+
+TEST(EntryStreamReaderTest, ReadsEntrySets) {
+  std::string data;
+  std::vector<std::string> expected;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    FileOutputStream output(&stream);
+    output.set_entry_set_bundle_size(4);
+    expected = EmitNodes(10, &output);
+  }
+  EntryStreamReader::Options options;
+  options.format = EntryStreamReader::Format::kEntrySets;
+  std::vector<std::string> entries = ReadAll(data, options);
+  // Entry sets group entries by source node, so only the sets are in order.
+  std::sort(expected.begin(), expected.end());
+  std::sort(entries.begin(), entries.end());
+  EXPECT_EQ(expected, entries);
+}
+
+TEST(EntryStreamReaderTest, ReadsCompressedEntriesInParallel) {
+  std::string data;
+  std::vector<std::string> expected;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    SnappyOutputStream snappy_stream(&stream);
+    FileOutputStream output(&snappy_stream);
+    // Enough entries to span many chunks, with entries split between them.
+    expected = EmitNodes(20000, &output);
+  }
+  EntryStreamReader::Options options;
+  EXPECT_EQ(expected, ReadAll(data, options));
+  options.decode_threads = 4;
+  EXPECT_EQ(expected, ReadAll(data, options));
+}
+
+TEST(EntryStreamReaderTest, StopsWhenAsked) {
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    FileOutputStream output(&stream);
+    EmitNodes(10, &output);
+  }
+  EntryStreamReader reader(data, {});
+  int visited = 0;
+  auto status =
+      reader.ForEach([&](const EntryView& entry) { return ++visited < 3; });
+  EXPECT_TRUE(status.ok()) << status;
+  EXPECT_EQ(3, visited);
+}
+
+TEST(EntryStreamReaderTest, RejectsTruncatedStreams) {
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    FileOutputStream output(&stream);
+    EmitNodes(2, &output);
+  }
+  EntryStreamReader reader(absl::string_view(data).substr(0, data.size() - 1),
+                           {});
+  int visited = 0;
+  EXPECT_FALSE(reader
+                   .ForEach([&](const EntryView& entry) {
+                     ++visited;
+                     return true;
+                   })
+                   .ok());
+  EXPECT_EQ(2, visited);
+}
+
+TEST(EntryStreamReaderTest, MapsFiles) {
+  std::string data;
+  std::vector<std::string> expected;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    FileOutputStream output(&stream);
+    expected = EmitNodes(10, &output);
+  }
+  const char* temp_dir = std::getenv("TEST_TMPDIR");
+  const std::string path = absl::StrCat(
+      temp_dir != nullptr ? temp_dir : "/tmp", "/entry_stream_reader_test");
+  std::ofstream(path, std::ios::binary) << data;
+  auto reader = EntryStreamReader::Open(path, {});
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  std::vector<std::string> entries;
+  EXPECT_TRUE((*reader)
+                  ->ForEach([&](const EntryView& entry) {
+                    entries.push_back(Describe(entry));
+                    return true;
+                  })
+                  .ok());
+  EXPECT_EQ(expected, entries);
+  std::remove(path.c_str());
+  EXPECT_FALSE(EntryStreamReader::Open(path, {}).ok());
+}
+
+}  // namespace
+}  // namespace kythe
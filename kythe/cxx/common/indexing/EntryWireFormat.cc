@@ -0,0 +1,270 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
+
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/io/coded_stream.h"
+
+namespace kythe {
+namespace {
+
+using ::google::protobuf::io::CodedOutputStream;
+
+/// Field numbers from kythe/proto/storage.proto.
+enum VNameField : uint8_t {
+  kSignature = 1,
+  kCorpus = 2,
+  kRoot = 3,
+  kPath = 4,
+  kLanguage = 5
+};
+enum EntryField : uint8_t {
+  kSource = 1,
+  kEdgeKind = 2,
+  kTarget = 3,
+  kFactName = 4,
+  kFactValue = 5
+};
+
+/// The fact name every edge has, "/", as a serialized `kFactName` field.
+constexpr absl::string_view kEncodedEdgeFactName = "\x22\x01/";
+
+/// \return the size of a length-delimited field holding `length` bytes.
+/// All of our field numbers are small enough for one-byte tags.
+inline size_t LengthDelimitedSize(size_t length) {
+  return 1 + CodedOutputStream::VarintSize32(length) + length;
+}
+
+/// \return the size of an optional string field holding `value`; proto3
+/// omits empty strings.
+inline size_t StringFieldSize(absl::string_view value) {
+  return value.empty() ? 0 : LengthDelimitedSize(value.size());
+}
+
+inline uint8_t* WriteLengthDelimitedHeader(uint8_t field, size_t length,
+                                           uint8_t* target) {
+  *target++ = (field << 3) | 2;
+  return CodedOutputStream::WriteVarint32ToArray(length, target);
+}
+
+inline uint8_t* WriteStringField(uint8_t field, absl::string_view value,
+                                 uint8_t* target) {
+  if (value.empty()) {
+    return target;
+  }
+  target = WriteLengthDelimitedHeader(field, value.size(), target);
+  ::memcpy(target, value.data(), value.size());
+  return target + value.size();
+}
+
+size_t VNameSize(const VNameRef& vname) {
+  return StringFieldSize(vname.signature()) + StringFieldSize(vname.corpus()) +
+         StringFieldSize(vname.root()) + StringFieldSize(vname.path()) +
+         StringFieldSize(vname.language());
+}
+
+uint8_t* WriteVNameField(uint8_t field, const VNameRef& vname, size_t size,
+                         uint8_t* target) {
+  target = WriteLengthDelimitedHeader(field, size, target);
+  target = WriteStringField(kSignature, vname.signature(), target);
+  target = WriteStringField(kCorpus, vname.corpus(), target);
+  target = WriteStringField(kRoot, vname.root(), target);
+  target = WriteStringField(kPath, vname.path(), target);
+  return WriteStringField(kLanguage, vname.language(), target);
+}
+
+/// \brief Copies `encoded`, a field serialized ahead of time, if it's
+/// there; otherwise serializes `value` as string field `field`.
+inline uint8_t* WritePreEncodedField(uint8_t field, absl::string_view value,
+                                     absl::string_view encoded,
+                                     uint8_t* target) {
+  if (encoded.empty()) {
+    return WriteStringField(field, value, target);
+  }
+  ::memcpy(target, encoded.data(), encoded.size());
+  return target + encoded.size();
+}
+
+/// \return `value` serialized as string field `field`.
+std::string EncodeStringField(uint8_t field, absl::string_view value) {
+  std::string encoded(StringFieldSize(value), '\0');
+  WriteStringField(field, value, reinterpret_cast<uint8_t*>(&encoded[0]));
+  return encoded;
+}
+
+/// \return the size of an edge entry with an `edge_kind_size`-byte kind.
+size_t EdgeSize(const VNameRef& source, size_t edge_kind_size,
+                const VNameRef& target) {
+  return LengthDelimitedSize(VNameSize(source)) +
+         (edge_kind_size == 0 ? 0 : LengthDelimitedSize(edge_kind_size)) +
+         LengthDelimitedSize(VNameSize(target)) + kEncodedEdgeFactName.size();
+}
+
+/// \brief Reads a varint of at most 32 bits from the front of `data`,
+/// advancing it.
+bool ReadVarint32(absl::string_view* data, uint32_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < data->size() && i < 5; ++i) {
+    const uint8_t byte = static_cast<uint8_t>((*data)[i]);
+    *value |= static_cast<uint32_t>(byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      data->remove_prefix(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// \brief Reads the next length-delimited field from `data`, advancing it.
+/// \return false if `data` doesn't start with one.
+bool ReadLengthDelimitedField(absl::string_view* data, uint32_t* field,
+                              absl::string_view* value) {
+  uint32_t tag;
+  uint32_t length;
+  if (!ReadVarint32(data, &tag) || (tag & 7) != 2 ||
+      !ReadVarint32(data, &length) || length > data->size()) {
+    return false;
+  }
+  *field = tag >> 3;
+  *value = data->substr(0, length);
+  data->remove_prefix(length);
+  return true;
+}
+
+bool ParseVName(absl::string_view data, VNameRef* vname) {
+  uint32_t field;
+  absl::string_view value;
+  while (!data.empty()) {
+    if (!ReadLengthDelimitedField(&data, &field, &value)) {
+      return false;
+    }
+    switch (field) {
+      case kSignature:
+        vname->set_signature(value);
+        break;
+      case kCorpus:
+        vname->set_corpus(value);
+        break;
+      case kRoot:
+        vname->set_root(value);
+        break;
+      case kPath:
+        vname->set_path(value);
+        break;
+      case kLanguage:
+        vname->set_language(value);
+        break;
+    }
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+size_t EntryWireFormat::ByteSize(const FactRef& fact) {
+  return LengthDelimitedSize(VNameSize(*fact.source)) +
+         StringFieldSize(fact.fact_name) + StringFieldSize(fact.fact_value);
+}
+
+size_t EntryWireFormat::ByteSize(const EdgeRef& edge) {
+  return EdgeSize(*edge.source, edge.edge_kind.size(), *edge.target);
+}
+
+size_t EntryWireFormat::ByteSize(const OrdinalEdgeRef& edge) {
+  absl::AlphaNum ordinal(edge.ordinal);
+  return EdgeSize(*edge.source,
+                  edge.edge_kind.size() + 1 + ordinal.size(),
+                  *edge.target);
+}
+
+uint8_t* EntryWireFormat::WriteToArray(const FactRef& fact, uint8_t* target) {
+  target = WriteVNameField(kSource, *fact.source, VNameSize(*fact.source),
+                           target);
+  target = WritePreEncodedField(kFactName, fact.fact_name,
+                                fact.encoded_fact_name, target);
+  return WriteStringField(kFactValue, fact.fact_value, target);
+}
+
+uint8_t* EntryWireFormat::WriteToArray(const EdgeRef& edge, uint8_t* target) {
+  target = WriteVNameField(kSource, *edge.source, VNameSize(*edge.source),
+                           target);
+  target = WritePreEncodedField(kEdgeKind, edge.edge_kind,
+                                edge.encoded_edge_kind, target);
+  target = WriteVNameField(kTarget, *edge.target, VNameSize(*edge.target),
+                           target);
+  ::memcpy(target, kEncodedEdgeFactName.data(), kEncodedEdgeFactName.size());
+  return target + kEncodedEdgeFactName.size();
+}
+
+uint8_t* EntryWireFormat::WriteToArray(const OrdinalEdgeRef& edge,
+                                       uint8_t* target) {
+  target = WriteVNameField(kSource, *edge.source, VNameSize(*edge.source),
+                           target);
+  absl::AlphaNum ordinal(edge.ordinal);
+  target = WriteLengthDelimitedHeader(
+      kEdgeKind, edge.edge_kind.size() + 1 + ordinal.size(), target);
+  ::memcpy(target, edge.edge_kind.data(), edge.edge_kind.size());
+  target += edge.edge_kind.size();
+  *target++ = '.';
+  ::memcpy(target, ordinal.data(), ordinal.size());
+  target += ordinal.size();
+  target = WriteVNameField(kTarget, *edge.target, VNameSize(*edge.target),
+                           target);
+  ::memcpy(target, kEncodedEdgeFactName.data(), kEncodedEdgeFactName.size());
+  return target + kEncodedEdgeFactName.size();
+}
+
+std::string EntryWireFormat::EncodeEdgeKind(absl::string_view edge_kind) {
+  return EncodeStringField(kEdgeKind, edge_kind);
+}
+
+std::string EntryWireFormat::EncodeFactName(absl::string_view fact_name) {
+  return EncodeStringField(kFactName, fact_name);
+}
+
+bool EntryWireFormat::Parse(absl::string_view data, EntryView* entry) {
+  *entry = EntryView();
+  uint32_t field;
+  absl::string_view value;
+  while (!data.empty()) {
+    if (!ReadLengthDelimitedField(&data, &field, &value)) {
+      return false;
+    }
+    switch (field) {
+      case kSource:
+        if (!ParseVName(value, &entry->source)) return false;
+        break;
+      case kEdgeKind:
+        entry->edge_kind = value;
+        break;
+      case kTarget:
+        if (!ParseVName(value, &entry->target)) return false;
+        break;
+      case kFactName:
+        entry->fact_name = value;
+        break;
+      case kFactValue:
+        entry->fact_value = value;
+        break;
+    }
+  }
+  return true;
+}
+
+}  // namespace kythe
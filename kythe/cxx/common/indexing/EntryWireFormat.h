@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_ENTRY_WIRE_FORMAT_H_
+#define KYTHE_CXX_COMMON_INDEXING_ENTRY_WIRE_FORMAT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "kythe/cxx/common/indexing/KytheOutputStream.h"
+
+namespace kythe {
+
+/// \brief The fields of a serialized `kythe.proto.Entry`, pointing into the
+/// buffer it was parsed from. Absent fields are empty.
+struct EntryView {
+  VNameRef source;
+  absl::string_view edge_kind;
+  VNameRef target;
+  absl::string_view fact_name;
+  absl::string_view fact_value;
+};
+
+/// \brief Serializes facts and edges as `kythe.proto.Entry` messages
+/// straight from their references, without building a `proto::Entry`.
+///
+/// The output is byte-for-byte what serializing the `Entry` that `Expand`
+/// fills in would produce, so it hashes the same way. Edges carry the fact
+/// name "/", as Kythe requires.
+class EntryWireFormat {
+ public:
+  /// \return the serialized size of the `Entry` for `fact`.
+  static size_t ByteSize(const FactRef& fact);
+  /// \return the serialized size of the `Entry` for `edge`.
+  static size_t ByteSize(const EdgeRef& edge);
+  /// \return the serialized size of the `Entry` for `edge`.
+  static size_t ByteSize(const OrdinalEdgeRef& edge);
+
+  /// \brief Writes the `Entry` for `fact` to `target`, which must have room
+  /// for `ByteSize(fact)` bytes.
+  /// \return a pointer just past the last byte written.
+  static uint8_t* WriteToArray(const FactRef& fact, uint8_t* target);
+  /// \copydoc WriteToArray(const FactRef&, uint8_t*)
+  static uint8_t* WriteToArray(const EdgeRef& edge, uint8_t* target);
+  /// \copydoc WriteToArray(const FactRef&, uint8_t*)
+  static uint8_t* WriteToArray(const OrdinalEdgeRef& edge, uint8_t* target);
+
+  /// \brief Encodes `edge_kind` as the edge kind field of an `Entry`: its
+  /// tag, length and bytes. A kind emitted many times can be encoded once
+  /// and passed as `EdgeRef::encoded_edge_kind`.
+  static std::string EncodeEdgeKind(absl::string_view edge_kind);
+  /// \brief Encodes `fact_name` as the fact name field of an `Entry`, for
+  /// `FactRef::encoded_fact_name`.
+  static std::string EncodeFactName(absl::string_view fact_name);
+
+  /// \brief Parses the serialized `Entry` in `data` into `entry`, which
+  /// refers to `data` and is valid only as long as it is. Unknown
+  /// length-delimited fields are skipped.
+  /// \return false if `data` is not a well-formed `Entry`.
+  static bool Parse(absl::string_view data, EntryView* entry);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_ENTRY_WIRE_FORMAT_H_
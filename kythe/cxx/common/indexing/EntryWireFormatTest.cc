@@ -0,0 +1,202 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+/// \return what serializing `expected` would produce.
+std::string Serialize(const proto::Entry& expected) {
+  std::string data;
+  EXPECT_TRUE(expected.SerializeToString(&data));
+  return data;
+}
+
+template <typename Ref>
+std::string WriteRef(const Ref& ref) {
+  std::string data(EntryWireFormat::ByteSize(ref), '\0');
+  uint8_t* begin = reinterpret_cast<uint8_t*>(&data[0]);
+  EXPECT_EQ(begin + data.size(), EntryWireFormat::WriteToArray(ref, begin));
+  return data;
+}
+
+std::vector<proto::VName> TestVNames() {
+  std::vector<proto::VName> vnames(4);
+  vnames[1].set_signature("sig");
+  vnames[2].set_corpus("corpus");
+  vnames[2].set_path("some/path.cc");
+  vnames[2].set_language("c++");
+  vnames[3].set_signature(std::string(300, 's'));
+  vnames[3].set_corpus("c");
+  vnames[3].set_root("r");
+  vnames[3].set_path(std::string(20000, 'p'));
+  vnames[3].set_language("l");
+  return vnames;
+}
+
+TEST(EntryWireFormatTest, FactsMatchProtoSerialization) {
+  for (const auto& vname : TestVNames()) {
+    VNameRef source(vname);
+    for (const std::string& value : {std::string(), std::string("value"),
+                                     std::string(200, 'v')}) {
+      FactRef fact{&source, "/kythe/node/kind", value};
+      proto::Entry entry;
+      fact.Expand(&entry);
+      EXPECT_EQ(Serialize(entry), WriteRef(fact));
+    }
+  }
+}
+
+TEST(EntryWireFormatTest, EdgesMatchProtoSerialization) {
+  const auto vnames = TestVNames();
+  for (const auto& source_vname : vnames) {
+    for (const auto& target_vname : vnames) {
+      VNameRef source(source_vname);
+      VNameRef target(target_vname);
+      proto::Entry entry;
+      entry.set_fact_name("/");
+      EdgeRef edge{&source, "/kythe/edge/childof", &target};
+      edge.Expand(&entry);
+      EXPECT_EQ(Serialize(entry), WriteRef(edge));
+      for (uint32_t ordinal : {0u, 7u, 123456u, 4294967295u}) {
+        OrdinalEdgeRef ordinal_edge{&source, "/kythe/edge/param", &target,
+                                    ordinal};
+        ordinal_edge.Expand(&entry);
+        EXPECT_EQ(Serialize(entry), WriteRef(ordinal_edge));
+      }
+    }
+  }
+}
+
+TEST(EntryWireFormatTest, PreEncodedNamesMatchEncodedOnes) {
+  const auto vnames = TestVNames();
+  VNameRef source(vnames[1]);
+  VNameRef target(vnames[2]);
+  const std::string fact_name =
+      EntryWireFormat::EncodeFactName("/kythe/node/kind");
+  EXPECT_EQ(WriteRef(FactRef{&source, "/kythe/node/kind", "record"}),
+            WriteRef(FactRef{&source, "/kythe/node/kind", "record",
+                             fact_name}));
+  const std::string edge_kind =
+      EntryWireFormat::EncodeEdgeKind("/kythe/edge/childof");
+  EXPECT_EQ(WriteRef(EdgeRef{&source, "/kythe/edge/childof", &target}),
+            WriteRef(EdgeRef{&source, "/kythe/edge/childof", &target,
+                             edge_kind}));
+  EXPECT_EQ(std::string("\x12\x13/kythe/edge/childof"), edge_kind);
+}
+
+/// \brief Expands `view` back into an `Entry`, leaving out the target if
+/// `view` has none.
+proto::Entry ExpandView(const EntryView& view) {
+  proto::Entry entry;
+  view.source.Expand(entry.mutable_source());
+  entry.set_edge_kind(std::string(view.edge_kind));
+  if (!view.edge_kind.empty()) {
+    view.target.Expand(entry.mutable_target());
+  }
+  entry.set_fact_name(std::string(view.fact_name));
+  entry.set_fact_value(std::string(view.fact_value));
+  return entry;
+}
+
+TEST(EntryWireFormatTest, ParseInvertsWriteToArray) {
+  const auto vnames = TestVNames();
+  for (const auto& source_vname : vnames) {
+    VNameRef source(source_vname);
+    VNameRef target(vnames[2]);
+    proto::Entry entry;
+    FactRef fact{&source, "/kythe/text", std::string(200, 'v')};
+    fact.Expand(&entry);
+    const std::string fact_data = WriteRef(fact);
+    EntryView view;
+    ASSERT_TRUE(EntryWireFormat::Parse(fact_data, &view));
+    EXPECT_EQ(Serialize(entry), Serialize(ExpandView(view)));
+    entry.Clear();
+    entry.set_fact_name("/");
+    OrdinalEdgeRef edge{&source, "/kythe/edge/param", &target, 12};
+    edge.Expand(&entry);
+    const std::string edge_data = WriteRef(edge);
+    ASSERT_TRUE(EntryWireFormat::Parse(edge_data, &view));
+    EXPECT_EQ(Serialize(entry), Serialize(ExpandView(view)));
+  }
+}
+
+TEST(EntryWireFormatTest, ParseRejectsMalformedEntries) {
+  proto::VName vname = TestVNames()[1];
+  VNameRef source(vname);
+  const std::string data = WriteRef(FactRef{&source, "/kythe/text", "text"});
+  EntryView view;
+  // Cutting the entry anywhere inside its last field (the six-byte fact
+  // value) leaves a malformed field behind.
+  for (size_t size = data.size() - 5; size < data.size(); ++size) {
+    EXPECT_FALSE(EntryWireFormat::Parse(data.substr(0, size), &view)) << size;
+  }
+  // A varint field (the tag for field 1 with wire type 0).
+  EXPECT_FALSE(EntryWireFormat::Parse(std::string("\x08\x01", 2), &view));
+}
+
+/// \brief A `HashCache` that never matches, so every buffer is written.
+class MissingHashCache : public HashCache {};
+
+TEST(EntryWireFormatTest, FileOutputStreamWritesDelimitedEntries) {
+  proto::VName vname = TestVNames()[2];
+  VNameRef ref(vname);
+  std::string expected;
+  {
+    google::protobuf::io::StringOutputStream stream(&expected);
+    google::protobuf::io::CodedOutputStream coded_stream(&stream);
+    proto::Entry entry;
+    FactRef{&ref, "/kythe/node/kind", "record"}.Expand(&entry);
+    coded_stream.WriteVarint32(entry.ByteSizeLong());
+    entry.SerializeToCodedStream(&coded_stream);
+    entry.Clear();
+    entry.set_fact_name("/");
+    OrdinalEdgeRef{&ref, "/kythe/edge/param", &ref, 3}.Expand(&entry);
+    coded_stream.WriteVarint32(entry.ByteSizeLong());
+    entry.SerializeToCodedStream(&coded_stream);
+  }
+  for (bool buffered : {false, true}) {
+    std::string actual;
+    MissingHashCache cache;
+    {
+      google::protobuf::io::StringOutputStream stream(&actual);
+      FileOutputStream file_stream(&stream);
+      if (buffered) {
+        file_stream.UseHashCache(&cache);
+        file_stream.PushBuffer();
+      }
+      file_stream.Emit(FactRef{&ref, "/kythe/node/kind", "record"});
+      file_stream.Emit(OrdinalEdgeRef{&ref, "/kythe/edge/param", &ref, 3});
+      if (buffered) {
+        file_stream.PopBuffer();
+      }
+    }
+    EXPECT_EQ(expected, actual) << buffered;
+  }
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/FileHashCache.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "glog/logging.h"
+
+namespace kythe {
+namespace {
+/// The start of every table.
+struct Header {
+  char magic[8];
+  uint64_t slot_count;
+  uint64_t size;
+  uint64_t reserved;
+};
+static_assert(sizeof(Header) == HashCache::kHashSize,
+              "table slots won't be aligned");
+constexpr char kMagic[8] = {'K', 'H', 'A', 'S', 'H', 'T', 'B', '1'};
+/// The smallest table we'll build.
+constexpr uint64_t kMinSlotCount = 1024;
+/// How many bytes of hashes to collect before appending them to the log.
+constexpr size_t kLogBufferSize = 128 * HashCache::kHashSize;
+/// Tables have no all-zero hashes, so that value marks an empty slot.
+const unsigned char kEmptySlot[HashCache::kHashSize] = {};
+
+/// \return the first slot to probe for `hash` in a table of `slot_count`.
+uint64_t HomeSlot(const unsigned char* hash, uint64_t slot_count) {
+  // Skip the first byte, which is `kMurmur3KeyTag` for MurmurHash3 keys.
+  uint64_t key;
+  memcpy(&key, hash + 1, sizeof(key));
+  return key & (slot_count - 1);
+}
+
+/// \brief Reads all of `fd` from the start into `data`.
+bool ReadFile(int fd, std::string* data) {
+  data->clear();
+  char buffer[64 * 1024];
+  off_t offset = 0;
+  for (;;) {
+    ssize_t count = ::pread(fd, buffer, sizeof(buffer), offset);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (count == 0) {
+      return true;
+    }
+    data->append(buffer, count);
+    offset += count;
+  }
+}
+
+/// \brief Writes all of `data` to `fd`.
+bool WriteFully(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t count = ::write(fd, data, size);
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += count;
+    size -= count;
+  }
+  return true;
+}
+}  // anonymous namespace
+
+FileHashCache::~FileHashCache() { Close(); }
+
+void FileHashCache::Close() {
+  if (log_fd_ >= 0) {
+    Flush();
+    ::close(log_fd_);
+    log_fd_ = -1;
+  }
+  ForgetContents();
+  if (lock_fd_ >= 0) {
+    // Closing the file releases the lock.
+    ::close(lock_fd_);
+    lock_fd_ = -1;
+  }
+}
+
+void FileHashCache::ForgetContents() {
+  if (mapping_ != nullptr) {
+    ::munmap(mapping_, mapping_size_);
+    mapping_ = nullptr;
+  }
+  slots_ = nullptr;
+  slot_count_ = 0;
+  table_size_ = 0;
+  logged_.clear();
+}
+
+bool FileHashCache::Open(const std::string& path) {
+  Close();
+  path_ = path;
+  const std::string lock_path = absl::StrCat(path, ".lock");
+  const std::string log_path = absl::StrCat(path, ".log");
+  lock_fd_ = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+  log_fd_ = ::open(log_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (lock_fd_ < 0 || log_fd_ < 0) {
+    LOG(ERROR) << "Couldn't open hash cache " << path << ": "
+               << strerror(errno);
+    Close();
+    return false;
+  }
+  if (::flock(lock_fd_, LOCK_EX | LOCK_NB) == 0) {
+    // Nobody else is using the cache, so it's safe to rewrite the table.
+    struct stat log_info;
+    if (::fstat(log_fd_, &log_info) == 0 && log_info.st_size > 0 &&
+        !Compact()) {
+      LOG(WARNING) << "Couldn't compact hash cache " << path;
+    }
+  }
+  // This waits for anyone who is compacting, and converts our own
+  // exclusive lock if we took one.
+  if (::flock(lock_fd_, LOCK_SH) != 0) {
+    LOG(ERROR) << "Couldn't lock hash cache " << path << ": "
+               << strerror(errno);
+    Close();
+    return false;
+  }
+  if (!TrimLog()) {
+    LOG(WARNING) << "Couldn't trim hash cache log for " << path << ": "
+                 << strerror(errno);
+  }
+  MapTable();
+  ReadLog();
+  return true;
+}
+
+bool FileHashCache::TrimLog() {
+  // Appending also takes this lock, so nobody is halfway through a record.
+  if (::flock(log_fd_, LOCK_EX) != 0) {
+    return false;
+  }
+  struct stat log_info;
+  bool trimmed = ::fstat(log_fd_, &log_info) == 0;
+  if (trimmed && log_info.st_size % kHashSize != 0) {
+    trimmed =
+        ::ftruncate(log_fd_, log_info.st_size - log_info.st_size % kHashSize) ==
+        0;
+  }
+  ::flock(log_fd_, LOCK_UN);
+  return trimmed;
+}
+
+void FileHashCache::MapTable() {
+  int fd = ::open(path_.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (::fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(Header)) {
+    ::close(fd);
+    return;
+  }
+  void* mapping =
+      ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, /*offset=*/0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG(WARNING) << "Couldn't map hash cache " << path_ << ": "
+                 << strerror(errno);
+    return;
+  }
+  Header header;
+  memcpy(&header, mapping, sizeof(header));
+  const uint64_t slots = info.st_size / kHashSize - 1;
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.slot_count == 0 ||
+      (header.slot_count & (header.slot_count - 1)) != 0 ||
+      header.slot_count > slots || header.size >= header.slot_count) {
+    LOG(WARNING) << "Ignoring malformed hash cache " << path_;
+    ::munmap(mapping, info.st_size);
+    return;
+  }
+  mapping_ = mapping;
+  mapping_size_ = info.st_size;
+  slots_ = static_cast<const unsigned char*>(mapping) + kHashSize;
+  slot_count_ = header.slot_count;
+  table_size_ = header.size;
+}
+
+bool FileHashCache::TableContains(const Hash& hash) const {
+  if (slot_count_ == 0) {
+    return false;
+  }
+  // The table is never full, so this finds `hash` or an empty slot.
+  for (uint64_t slot = HomeSlot(hash, slot_count_);;
+       slot = (slot + 1) & (slot_count_ - 1)) {
+    const unsigned char* entry = slots_ + slot * kHashSize;
+    if (memcmp(entry, hash, kHashSize) == 0) {
+      return true;
+    }
+    if (memcmp(entry, kEmptySlot, kHashSize) == 0) {
+      return false;
+    }
+  }
+}
+
+void FileHashCache::ReadLog() {
+  std::string log;
+  if (!ReadFile(log_fd_, &log)) {
+    LOG(WARNING) << "Couldn't read hash cache log for " << path_;
+    return;
+  }
+  // A partial record at the end was cut short by a crash.
+  for (size_t offset = 0; offset + kHashSize <= log.size();
+       offset += kHashSize) {
+    logged_.emplace(log.data() + offset, kHashSize);
+  }
+}
+
+bool FileHashCache::Compact() {
+  MapTable();
+  ReadLog();
+  std::vector<const unsigned char*> hashes;
+  hashes.reserve(table_size_ + logged_.size());
+  for (uint64_t slot = 0; slot < slot_count_; ++slot) {
+    const unsigned char* entry = slots_ + slot * kHashSize;
+    if (memcmp(entry, kEmptySlot, kHashSize) != 0) {
+      hashes.push_back(entry);
+    }
+  }
+  for (const auto& hash : logged_) {
+    hashes.push_back(reinterpret_cast<const unsigned char*>(hash.data()));
+  }
+  // Keep the table at most half full so that probes stay short.
+  uint64_t slot_count = kMinSlotCount;
+  while (slot_count < 2 * hashes.size()) {
+    slot_count *= 2;
+  }
+  std::string image((slot_count + 1) * kHashSize, '\0');
+  unsigned char* slots = reinterpret_cast<unsigned char*>(&image[kHashSize]);
+  uint64_t size = 0;
+  for (const unsigned char* hash : hashes) {
+    if (memcmp(hash, kEmptySlot, kHashSize) == 0) {
+      continue;
+    }
+    for (uint64_t slot = HomeSlot(hash, slot_count);;
+         slot = (slot + 1) & (slot_count - 1)) {
+      unsigned char* entry = slots + slot * kHashSize;
+      if (memcmp(entry, hash, kHashSize) == 0) {
+        break;
+      }
+      if (memcmp(entry, kEmptySlot, kHashSize) == 0) {
+        memcpy(entry, hash, kHashSize);
+        ++size;
+        break;
+      }
+    }
+  }
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.slot_count = slot_count;
+  header.size = size;
+  header.reserved = 0;
+  memcpy(&image[0], &header, sizeof(header));
+  ForgetContents();
+  // Write the new table beside the old one, then swap it in.
+  const std::string temp_path = absl::StrCat(path_, ".tmp");
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const bool wrote = WriteFully(fd, image.data(), image.size());
+  if (::close(fd) != 0 || !wrote ||
+      ::rename(temp_path.c_str(), path_.c_str()) != 0) {
+    ::unlink(temp_path.c_str());
+    return false;
+  }
+  return ::ftruncate(log_fd_, 0) == 0;
+}
+
+void FileHashCache::RegisterHash(const Hash& hash) {
+  if (log_fd_ < 0 || TableContains(hash) ||
+      !logged_.emplace(reinterpret_cast<const char*>(hash), kHashSize)
+           .second) {
+    return;
+  }
+  unwritten_.append(reinterpret_cast<const char*>(hash), kHashSize);
+  if (unwritten_.size() >= kLogBufferSize) {
+    Flush();
+  }
+}
+
+bool FileHashCache::SawHash(const Hash& hash) {
+  return TableContains(hash) ||
+         logged_.contains(
+             absl::string_view(reinterpret_cast<const char*>(hash), kHashSize));
+}
+
+void FileHashCache::Flush() {
+  if (unwritten_.empty() || log_fd_ < 0) {
+    return;
+  }
+  // The log is opened for appending and locked while we write, so records
+  // from concurrent writers land whole and in some order.
+  if (::flock(log_fd_, LOCK_EX) != 0 ||
+      !WriteFully(log_fd_, unwritten_.data(), unwritten_.size())) {
+    LOG(WARNING) << "Couldn't append to hash cache log for " << path_ << ": "
+                 << strerror(errno);
+  }
+  ::flock(log_fd_, LOCK_UN);
+  unwritten_.clear();
+}
+
+}  // namespace kythe
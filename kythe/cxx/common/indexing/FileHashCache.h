@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_FILEHASHCACHE_H_
+#define KYTHE_CXX_COMMON_INDEXING_FILEHASHCACHE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/container/flat_hash_set.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+
+namespace kythe {
+
+/// \brief A `HashCache` kept in files on local disk, so that reindexing on
+/// the same host can skip buffers written by earlier runs.
+///
+/// The cache at `path` is an open-addressing table of hashes (`path`),
+/// which is mapped read-only, and a log of hashes registered since the
+/// table was built (`path.log`), which every run appends to. Several
+/// indexers may use the same cache at once. Whoever opens it while nobody
+/// else has it open first merges the log into a new table.
+class FileHashCache : public HashCache {
+ public:
+  FileHashCache() = default;
+  FileHashCache(const FileHashCache&) = delete;
+  FileHashCache& operator=(const FileHashCache&) = delete;
+  ~FileHashCache() override;
+
+  /// \brief Uses the cache at `path`, creating it if it doesn't exist.
+  /// \return false if the cache's files couldn't be opened.
+  bool Open(const std::string& path);
+
+  void RegisterHash(const Hash& hash) override;
+
+  bool SawHash(const Hash& hash) override;
+
+  /// \brief Appends every hash registered so far to the log.
+  void Flush();
+
+  /// \return the number of hashes in the mapped table.
+  uint64_t table_size() const { return table_size_; }
+
+ private:
+  /// Replaces the table with one holding everything in it and in the log,
+  /// then empties the log. The caller must hold the lock exclusively.
+  bool Compact();
+  /// Maps the table, if there's a valid one.
+  void MapTable();
+  /// \return true if the mapped table holds `hash`.
+  bool TableContains(const Hash& hash) const;
+  /// Adds the hashes in the log to `logged_`.
+  void ReadLog();
+  /// Drops a partial record left at the end of the log by a writer that
+  /// crashed, so that the records appended after it stay aligned.
+  bool TrimLog();
+  /// Unmaps the table and forgets the logged hashes.
+  void ForgetContents();
+  /// Flushes the log and releases the cache's files.
+  void Close();
+
+  std::string path_;
+  /// Held shared while the cache is open and exclusively while compacting.
+  int lock_fd_ = -1;
+  /// The log, opened for appending. Held exclusively while appending to or
+  /// trimming it.
+  int log_fd_ = -1;
+  /// The mapped table (or null).
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  /// The table's slots; `slot_count_` is zero or a power of two.
+  const unsigned char* slots_ = nullptr;
+  uint64_t slot_count_ = 0;
+  uint64_t table_size_ = 0;
+  /// Hashes that are in the log or that we've registered.
+  absl::flat_hash_set<std::string> logged_;
+  /// Registered hashes that haven't been appended to the log yet.
+  std::string unwritten_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_FILEHASHCACHE_H_
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/common/indexing/FileHashCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+class FileHashCacheTest : public ::testing::Test {
+ protected:
+  FileHashCacheTest()
+      : path_(absl::StrCat(::testing::TempDir(), "/hash_cache_",
+                           ::testing::UnitTest::GetInstance()
+                               ->current_test_info()
+                               ->name())) {
+    for (const char* suffix : {"", ".log", ".lock"}) {
+      std::remove(absl::StrCat(path_, suffix).c_str());
+    }
+  }
+
+  /// \brief Sets `hash` to a distinct value for each `i`.
+  static void MakeHash(uint32_t i, HashCache::Hash* hash) {
+    memset(*hash, 0x5a, HashCache::kHashSize);
+    memcpy(*hash + 1, &i, sizeof(i));
+  }
+
+  const std::string path_;
+};
+
+TEST_F(FileHashCacheTest, RemembersHashesAcrossRuns) {
+  HashCache::Hash seen, unseen;
+  MakeHash(1, &seen);
+  MakeHash(2, &unseen);
+  {
+    FileHashCache cache;
+    ASSERT_TRUE(cache.Open(path_));
+    EXPECT_FALSE(cache.SawHash(seen));
+    cache.RegisterHash(seen);
+    EXPECT_TRUE(cache.SawHash(seen));
+    EXPECT_FALSE(cache.SawHash(unseen));
+  }
+  FileHashCache cache;
+  ASSERT_TRUE(cache.Open(path_));
+  // The log was merged into the table when the cache was reopened.
+  EXPECT_EQ(1, cache.table_size());
+  EXPECT_TRUE(cache.SawHash(seen));
+  EXPECT_FALSE(cache.SawHash(unseen));
+}
+
+TEST_F(FileHashCacheTest, SharesHashesWithConcurrentUsers) {
+  HashCache::Hash first, second;
+  MakeHash(1, &first);
+  MakeHash(2, &second);
+  FileHashCache writer;
+  ASSERT_TRUE(writer.Open(path_));
+  writer.RegisterHash(first);
+  writer.Flush();
+  {
+    FileHashCache reader;
+    ASSERT_TRUE(reader.Open(path_));
+    // `writer` still has the cache open, so the log can't be merged.
+    EXPECT_EQ(0, reader.table_size());
+    EXPECT_TRUE(reader.SawHash(first));
+    reader.RegisterHash(second);
+  }
+  writer.RegisterHash(second);
+  writer.Flush();
+  FileHashCache reader;
+  ASSERT_TRUE(reader.Open(path_));
+  EXPECT_TRUE(reader.SawHash(first));
+  EXPECT_TRUE(reader.SawHash(second));
+}
+
+TEST_F(FileHashCacheTest, DropsPartialLogRecords) {
+  HashCache::Hash first, second;
+  MakeHash(1, &first);
+  MakeHash(2, &second);
+  // Keep the cache open so that the log isn't merged into the table.
+  FileHashCache holder;
+  ASSERT_TRUE(holder.Open(path_));
+  holder.RegisterHash(first);
+  holder.Flush();
+  {
+    // A writer crashed halfway through a record.
+    std::ofstream log(absl::StrCat(path_, ".log"),
+                      std::ios::binary | std::ios::app);
+    log << "partial";
+  }
+  {
+    FileHashCache writer;
+    ASSERT_TRUE(writer.Open(path_));
+    writer.RegisterHash(second);
+  }
+  FileHashCache reader;
+  ASSERT_TRUE(reader.Open(path_));
+  EXPECT_EQ(0, reader.table_size());
+  EXPECT_TRUE(reader.SawHash(first));
+  EXPECT_TRUE(reader.SawHash(second));
+}
+
+TEST_F(FileHashCacheTest, GrowsTable) {
+  constexpr uint32_t kCount = 5000;
+  HashCache::Hash hash;
+  for (int run = 0; run < 2; ++run) {
+    FileHashCache cache;
+    ASSERT_TRUE(cache.Open(path_));
+    for (uint32_t i = run; i < kCount; i += 2) {
+      MakeHash(i, &hash);
+      cache.RegisterHash(hash);
+    }
+  }
+  FileHashCache cache;
+  ASSERT_TRUE(cache.Open(path_));
+  EXPECT_EQ(kCount, cache.table_size());
+  for (uint32_t i = 0; i < kCount; ++i) {
+    MakeHash(i, &hash);
+    EXPECT_TRUE(cache.SawHash(hash)) << i;
+  }
+  MakeHash(kCount, &hash);
+  EXPECT_FALSE(cache.SawHash(hash));
+}
+
+TEST_F(FileHashCacheTest, IgnoresMalformedTables) {
+  {
+    std::ofstream table(path_);
+    table << std::string(4096, 'x');
+  }
+  HashCache::Hash hash;
+  MakeHash(1, &hash);
+  {
+    FileHashCache cache;
+    ASSERT_TRUE(cache.Open(path_));
+    EXPECT_FALSE(cache.SawHash(hash));
+    cache.RegisterHash(hash);
+  }
+  FileHashCache cache;
+  ASSERT_TRUE(cache.Open(path_));
+  EXPECT_EQ(1, cache.table_size());
+  EXPECT_TRUE(cache.SawHash(hash));
+}
+
+}  // namespace
+}  // namespace kythe
@@ -17,19 +17,157 @@
 #include "kythe/cxx/common/indexing/KytheCachingOutput.h"
 
 #include <algorithm>
+#include <cstring>
+#include <limits>
 #include <sstream>
+#include <string>
+#include <utility>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
 
 namespace kythe {
+namespace {
+/// \brief Random values for the rolling "gear" hash used to find
+/// content-defined cut points (as in FastCDC). Writers sharing a cache must
+/// agree on these, so they're generated from a fixed seed.
+struct GearTable {
+  constexpr GearTable() : values() {
+    uint64_t state = 0x4b79746865434443;
+    for (uint64_t& value : values) {
+      // SplitMix64.
+      state += 0x9e3779b97f4a7c15;
+      uint64_t z = state;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      value = z ^ (z >> 31);
+    }
+  }
+  uint64_t values[256];
+};
+constexpr GearTable kGearTable;
+}  // anonymous namespace
 
 std::string FileOutputStream::Stats::ToString() const {
   return absl::StrCat(
-      buffers_merged_, " merged ", buffers_split_, " split ", buffers_retired_,
-      " retired ", hashes_matched_, " matches ",
+      buffers_merged_, " merged ", buffers_split_, " split ",
+      buffers_cut_ ? absl::StrCat(buffers_cut_, " cut ") : "",
+      buffers_retired_, " retired ", hashes_matched_, " matches ",
+      hash_batches_ ? absl::StrCat(hash_batches_, " batches ") : "",
       (buffers_retired_ ? (total_bytes_ / buffers_retired_) : 0),
-      " bytes/buffer");
+      " bytes/buffer",
+      entries_checked_ ? absl::StrCat(" ", entries_filtered_, "/",
+                                      entries_checked_, " entries filtered")
+                       : "");
+}
+
+std::string TieredHashCache::Stats::ToString() const {
+  auto percent = [](size_t part, size_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+  };
+  return absl::StrFormat(
+      "%d lookups: %d (%.1f%%) local hits, %d (%.1f%%) remote lookups with "
+      "%d (%.1f%%) remote hits; %d local resets",
+      lookups, local_hits, percent(local_hits, lookups), remote_lookups,
+      percent(remote_lookups, lookups), remote_hits,
+      percent(remote_hits, remote_lookups), local_resets);
+}
+
+TieredHashCache::TieredHashCache(std::unique_ptr<HashCache> remote,
+                                 size_t max_local_bytes)
+    : remote_(std::move(remote)),
+      max_local_keys_(std::max<size_t>(
+          1, max_local_bytes / EntryFingerprintFilter::kBytesPerFingerprint)) {
+  SetSizeLimits(remote_->min_size(), remote_->max_size());
+  set_algorithm(remote_->algorithm());
+  set_batch_size(remote_->batch_size());
+  set_chunking(remote_->chunking());
+}
+
+uint64_t TieredHashCache::LocalKey(const Hash& hash) const {
+  // Skip the first byte, which is `kMurmur3KeyTag` for MurmurHash3 keys.
+  uint64_t key;
+  memcpy(&key, &hash[1], sizeof(key));
+  return key;
+}
+
+void TieredHashCache::InsertLocal(const Hash& hash) {
+  if (local_.size() >= max_local_keys_) {
+    local_.clear();
+    ++stats_.local_resets;
+  }
+  local_.insert(LocalKey(hash));
+}
+
+void TieredHashCache::RegisterHash(const Hash& hash) {
+  InsertLocal(hash);
+  remote_->RegisterHash(hash);
+}
+
+bool TieredHashCache::SawHash(const Hash& hash) {
+  ++stats_.lookups;
+  if (local_.contains(LocalKey(hash))) {
+    ++stats_.local_hits;
+    return true;
+  }
+  ++stats_.remote_lookups;
+  if (!remote_->SawHash(hash)) {
+    return false;
+  }
+  ++stats_.remote_hits;
+  InsertLocal(hash);
+  return true;
+}
+
+void TieredHashCache::SawHashes(absl::Span<const Hash* const> hashes,
+                                std::vector<bool>* seen) {
+  seen->assign(hashes.size(), false);
+  remote_hashes_.clear();
+  remote_indices_.clear();
+  stats_.lookups += hashes.size();
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    if (local_.contains(LocalKey(*hashes[i]))) {
+      ++stats_.local_hits;
+      (*seen)[i] = true;
+    } else {
+      remote_hashes_.push_back(hashes[i]);
+      remote_indices_.push_back(i);
+    }
+  }
+  if (remote_hashes_.empty()) {
+    return;
+  }
+  stats_.remote_lookups += remote_hashes_.size();
+  remote_->SawHashes(remote_hashes_, &remote_seen_);
+  for (size_t i = 0; i < remote_hashes_.size(); ++i) {
+    if (remote_seen_[i]) {
+      ++stats_.remote_hits;
+      (*seen)[remote_indices_[i]] = true;
+      InsertLocal(*remote_hashes_[i]);
+    }
+  }
+}
+
+EntryFingerprintFilter::EntryFingerprintFilter(size_t max_bytes)
+    : max_fingerprints_(
+          std::max<size_t>(1, max_bytes / kBytesPerFingerprint)) {}
+
+bool EntryFingerprintFilter::Insert(uint64_t fingerprint) {
+  if (fingerprints_.size() >= max_fingerprints_) {
+    fingerprints_.clear();
+  }
+  return fingerprints_.insert(fingerprint).second;
+}
+
+uint64_t EntryFingerprintFilter::Fingerprint(const void* data, size_t size) {
+  Murmur3Hasher hasher;
+  hasher.Update(data, size);
+  unsigned char hash[Murmur3Hasher::kHashSize];
+  hasher.Finish(hash);
+  uint64_t fingerprint;
+  memcpy(&fingerprint, hash, sizeof(fingerprint));
+  return fingerprint;
 }
 
 FileOutputStream::~FileOutputStream() {
@@ -37,6 +175,8 @@ FileOutputStream::~FileOutputStream() {
     // Shake out any less-than-minimum-sized buffers that remain.
     EmitAndReleaseTopBuffer();
   }
+  ResolvePendingBuffers();
+  WritePendingEntrySet();
   if (show_stats_) {
     absl::FPrintF(stderr, "%s\n", stats_.ToString());
     fflush(stderr);
@@ -45,14 +185,20 @@ FileOutputStream::~FileOutputStream() {
 
 void FileOutputStream::EnqueueEntry(const proto::Entry& entry) {
   if (cache_ == &default_cache_ || buffers_.empty()) {
+    ResolvePendingBuffers();
+    if (entry_set_bundle_size_ != 0) {
+      entry_set_.Add(entry);
+      if (entry_set_.size() >= entry_set_bundle_size_) {
+        WritePendingEntrySet();
+      }
+      return;
+    }
     {
       google::protobuf::io::CodedOutputStream coded_stream(stream_);
       coded_stream.WriteVarint32(entry.ByteSizeLong());
       entry.SerializeToCodedStream(&coded_stream);
     }
-    if (flush_after_each_entry_) {
-      stream_->Flush();
-    }
+    MaybeFlush();
     return;
   }
 
@@ -67,22 +213,222 @@ void FileOutputStream::EnqueueEntry(const proto::Entry& entry) {
   if (!entry.SerializeToArray(&buffer[size_size], size_delta - size_size)) {
     assert(0 && "bad proto size calculation");
   }
-  stats_.total_bytes_ += size_delta;
+  FinishWriteToTop(buffer, size_delta);
+}
 
+void FileOutputStream::FinishWriteToTop(const unsigned char* data,
+                                        size_t size) {
+  stats_.total_bytes_ += size;
+  // The hash has to see every byte, even those that can't end a buffer.
+  const bool at_cut_point = chunking_ == HashCache::Chunking::kContentDefined &&
+                            RollChunkHash(data, size);
   if (buffers_.top_size() >= max_size_) {
     ++stats_.buffers_split_;
-    EmitAndReleaseTopBuffer();
-    PushBuffer();
+  } else if (at_cut_point && buffers_.top_size() >= min_size_) {
+    ++stats_.buffers_cut_;
+  } else {
+    return;
+  }
+  EmitAndReleaseTopBuffer();
+  PushBuffer();
+}
+
+void FileOutputStream::SetChunking(HashCache::Chunking chunking) {
+  chunking_ = chunking;
+  // Cut points past `min_size_` are expected every 2^bits bytes. Aim for
+  // buffers a quarter of the way from `min_size_` to `max_size_`, which
+  // leaves few to be split at `max_size_`.
+  const size_t spread = max_size_ > min_size_ ? (max_size_ - min_size_) / 4 : 0;
+  int bits = 0;
+  while (bits < 63 && (size_t{2} << bits) <= spread) {
+    ++bits;
+  }
+  // Gear hashes mix each byte into the high bits for longest, so test those.
+  cut_mask_ = bits == 0 ? 0 : ~uint64_t{0} << (64 - bits);
+}
+
+bool FileOutputStream::RollChunkHash(const unsigned char* data, size_t size) {
+  bool at_cut_point = false;
+  for (size_t i = 0; i < size; ++i) {
+    chunk_hash_ = (chunk_hash_ << 1) + kGearTable.values[data[i]];
+    at_cut_point |= (chunk_hash_ & cut_mask_) == 0;
+  }
+  return at_cut_point;
+}
+
+template <typename Ref>
+void FileOutputStream::EnqueueRef(const Ref& ref, proto::Entry* entry) {
+  const bool direct = cache_ == &default_cache_ || buffers_.empty();
+  if (direct) {
+    ResolvePendingBuffers();
+  }
+  if (direct && entry_filter_ != nullptr) {
+    size_t entry_size = EntryWireFormat::ByteSize(ref);
+    scratch_.resize(entry_size);
+    EntryWireFormat::WriteToArray(ref, scratch_.data());
+    ++stats_.entries_checked_;
+    if (!entry_filter_->Insert(EntryFingerprintFilter::Fingerprint(
+            scratch_.data(), scratch_.size()))) {
+      ++stats_.entries_filtered_;
+      return;
+    }
+    if (entry_set_bundle_size_ == 0) {
+      {
+        google::protobuf::io::CodedOutputStream coded_stream(stream_);
+        coded_stream.WriteVarint32(entry_size);
+        coded_stream.WriteRaw(scratch_.data(), entry_size);
+      }
+      MaybeFlush();
+      return;
+    }
+  }
+  if (entry_set_bundle_size_ != 0) {
+    // EntrySetEncoder works from expanded entries.
+    ref.Expand(entry);
+    EnqueueEntry(*entry);
+    return;
+  }
+  const size_t entry_size = EntryWireFormat::ByteSize(ref);
+  const size_t size_delta =
+      google::protobuf::io::CodedOutputStream::VarintSize32(entry_size) +
+      entry_size;
+  auto write_delimited = [&](uint8_t* target) {
+    target = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+        entry_size, target);
+    uint8_t* end = EntryWireFormat::WriteToArray(ref, target);
+    assert(end == target + entry_size && "bad entry size calculation");
+    (void)end;
+  };
+  if (direct) {
+    {
+      google::protobuf::io::CodedOutputStream coded_stream(stream_);
+      if (uint8_t* target =
+              coded_stream.GetDirectBufferForNBytesAndAdvance(size_delta)) {
+        write_delimited(target);
+      } else {
+        scratch_.resize(size_delta);
+        write_delimited(scratch_.data());
+        coded_stream.WriteRaw(scratch_.data(), size_delta);
+      }
+    }
+    MaybeFlush();
+    return;
+  }
+  unsigned char* buffer = buffers_.WriteToTop(size_delta);
+  write_delimited(buffer);
+  FinishWriteToTop(buffer, size_delta);
+}
+
+template <typename Ref>
+void FileOutputStream::EnqueueRefs(absl::Span<const Ref> refs,
+                                   proto::Entry* entry) {
+  const bool direct = cache_ == &default_cache_ || buffers_.empty();
+  if (direct) {
+    ResolvePendingBuffers();
+  }
+  if ((direct && entry_filter_ != nullptr) || entry_set_bundle_size_ != 0) {
+    // These paths look at one entry at a time anyway.
+    for (const auto& ref : refs) {
+      EnqueueRef(ref, entry);
+    }
+    return;
+  }
+  batch_sizes_.resize(refs.size());
+  size_t batch_size = 0;
+  for (size_t i = 0; i < refs.size(); ++i) {
+    batch_sizes_[i] = EntryWireFormat::ByteSize(refs[i]);
+    batch_size +=
+        google::protobuf::io::CodedOutputStream::VarintSize32(batch_sizes_[i]) +
+        batch_sizes_[i];
+  }
+  auto write_delimited = [&](uint8_t* target) {
+    for (size_t i = 0; i < refs.size(); ++i) {
+      target = google::protobuf::io::CodedOutputStream::WriteVarint32ToArray(
+          batch_sizes_[i], target);
+      target = EntryWireFormat::WriteToArray(refs[i], target);
+    }
+  };
+  if (direct) {
+    {
+      google::protobuf::io::CodedOutputStream coded_stream(stream_);
+      if (uint8_t* target =
+              coded_stream.GetDirectBufferForNBytesAndAdvance(batch_size)) {
+        write_delimited(target);
+      } else {
+        scratch_.resize(batch_size);
+        write_delimited(scratch_.data());
+        coded_stream.WriteRaw(scratch_.data(), batch_size);
+      }
+    }
+    MaybeFlush();
+    return;
   }
+  unsigned char* buffer = buffers_.WriteToTop(batch_size);
+  write_delimited(buffer);
+  FinishWriteToTop(buffer, batch_size);
+}
+
+void FileOutputStream::Emit(const FactRef& fact) {
+  EnqueueRef(fact, &fact_entry_);
+}
+
+void FileOutputStream::Emit(const EdgeRef& edge) {
+  EnqueueRef(edge, &edge_entry_);
+}
+
+void FileOutputStream::Emit(const OrdinalEdgeRef& edge) {
+  EnqueueRef(edge, &edge_entry_);
+}
+
+void FileOutputStream::Emit(absl::Span<const FactRef> facts) {
+  EnqueueRefs(facts, &fact_entry_);
+}
+
+void FileOutputStream::Emit(absl::Span<const EdgeRef> edges) {
+  EnqueueRefs(edges, &edge_entry_);
+}
+
+void FileOutputStream::Emit(absl::Span<const OrdinalEdgeRef> edges) {
+  EnqueueRefs(edges, &edge_entry_);
 }
 
 void FileOutputStream::EmitAndReleaseTopBuffer() {
+  if (batch_size_ > 1) {
+    if (pending_count_ == pending_.size()) {
+      pending_.emplace_back();
+    }
+    PendingBuffer& pending = pending_[pending_count_++];
+    buffers_.HashTop(cache_->algorithm(), &pending.hash);
+    pending.data.clear();
+    {
+      google::protobuf::io::StringOutputStream data_stream(&pending.data);
+      buffers_.CopyTopToStream(&data_stream);
+    }
+    buffers_.Pop();
+    ++stats_.buffers_retired_;
+    if (pending_count_ >= batch_size_) {
+      ResolvePendingBuffers();
+    }
+    return;
+  }
   HashCache::Hash hash;
-  buffers_.HashTop(&hash);
+  buffers_.HashTop(cache_->algorithm(), &hash);
   if (!cache_->SawHash(hash)) {
-    buffers_.CopyTopToStream(stream_);
-    if (flush_after_each_entry_) {
-      stream_->Flush();
+    if (entry_set_bundle_size_ != 0) {
+      std::string data;
+      {
+        google::protobuf::io::StringOutputStream data_stream(&data);
+        buffers_.CopyTopToStream(&data_stream);
+      }
+      AddDelimitedEntries(data);
+    } else if (snappy_stream_ != nullptr) {
+      // Line compressed chunks up with the buffers we deduplicate.
+      snappy_stream_->EndFrame();
+      buffers_.CopyTopToStream(stream_);
+      snappy_stream_->EndFrame();
+    } else {
+      buffers_.CopyTopToStream(stream_);
+      MaybeFlush();
     }
     cache_->RegisterHash(hash);
   } else {
@@ -92,10 +438,126 @@ void FileOutputStream::EmitAndReleaseTopBuffer() {
   ++stats_.buffers_retired_;
 }
 
+void FileOutputStream::ResolvePendingBuffers() {
+  if (pending_count_ == 0) {
+    return;
+  }
+  pending_hashes_.clear();
+  for (size_t i = 0; i < pending_count_; ++i) {
+    pending_hashes_.push_back(&pending_[i].hash);
+  }
+  cache_->SawHashes(pending_hashes_, &pending_seen_);
+  ++stats_.hash_batches_;
+  for (size_t i = 0; i < pending_count_; ++i) {
+    if (pending_seen_[i]) {
+      ++stats_.hashes_matched_;
+      continue;
+    }
+    WriteRetiredBuffer(pending_[i].data);
+    cache_->RegisterHash(pending_[i].hash);
+    // The cache couldn't know about repeats within this batch.
+    for (size_t j = i + 1; j < pending_count_; ++j) {
+      if (!memcmp(pending_[i].hash, pending_[j].hash, HashCache::kHashSize)) {
+        pending_seen_[j] = true;
+      }
+    }
+  }
+  pending_count_ = 0;
+}
+
+void FileOutputStream::WriteRetiredBuffer(absl::string_view data) {
+  if (entry_set_bundle_size_ != 0) {
+    AddDelimitedEntries(data);
+    return;
+  }
+  if (snappy_stream_ != nullptr) {
+    snappy_stream_->EndFrame();
+  }
+  {
+    google::protobuf::io::CodedOutputStream coded_stream(stream_);
+    coded_stream.WriteRaw(data.data(), data.size());
+  }
+  if (snappy_stream_ != nullptr) {
+    snappy_stream_->EndFrame();
+  } else {
+    MaybeFlush();
+  }
+}
+
+void FileOutputStream::MaybeFlush() {
+  if (!flush_after_each_entry_) {
+    return;
+  }
+  if (file_stream_ != nullptr) {
+    file_stream_->Flush();
+  } else if (async_stream_ != nullptr) {
+    async_stream_->Flush();
+  }
+}
+
+void FileOutputStream::WriteDelimitedEntries(absl::string_view data) {
+  CHECK(buffers_.empty()) << "WriteDelimitedEntries called with open buffers";
+  ResolvePendingBuffers();
+  WritePendingEntrySet();
+  {
+    google::protobuf::io::CodedOutputStream coded_stream(stream_);
+    coded_stream.WriteRaw(data.data(), data.size());
+  }
+  MaybeFlush();
+}
+
+void FileOutputStream::AddDelimitedEntries(absl::string_view data) {
+  google::protobuf::io::CodedInputStream coded_stream(
+      reinterpret_cast<const uint8_t*>(data.data()), data.size());
+  proto::Entry entry;
+  uint32_t size;
+  while (coded_stream.ReadVarint32(&size)) {
+    auto limit = coded_stream.PushLimit(size);
+    CHECK(entry.ParseFromCodedStream(&coded_stream)) << "bad buffered entry";
+    coded_stream.PopLimit(limit);
+    entry_set_.Add(entry);
+    if (entry_set_.size() >= entry_set_bundle_size_) {
+      WritePendingEntrySet();
+    }
+  }
+}
+
+void FileOutputStream::WritePendingEntrySet() {
+  if (entry_set_.empty()) {
+    return;
+  }
+  storage::EntrySet set;
+  entry_set_.Encode(&set);
+  {
+    google::protobuf::io::CodedOutputStream coded_stream(stream_);
+    coded_stream.WriteVarint32(set.ByteSizeLong());
+    set.SerializeToCodedStream(&coded_stream);
+  }
+  MaybeFlush();
+}
+
+void FileOutputStream::Flush() {
+  ResolvePendingBuffers();
+  WritePendingEntrySet();
+  if (file_stream_ != nullptr) {
+    file_stream_->Flush();
+  } else if (async_stream_ != nullptr) {
+    async_stream_->Sync();
+  } else if (snappy_stream_ != nullptr) {
+    snappy_stream_->Flush();
+  }
+}
+
 void FileOutputStream::PushBuffer() { buffers_.Push(max_size_); }
 
 void FileOutputStream::PopBuffer() {
-  if (buffers_.MergeDownIfTooSmall(min_size_, max_size_)) {
+  // When chunking by content, group boundaries shouldn't end buffers, so
+  // every group is small enough to merge into its parent.
+  const size_t merge_below =
+      chunking_ == HashCache::Chunking::kContentDefined
+          ? std::numeric_limits<size_t>::max()
+          : min_size_;
+  if (buffers_.MergeDownIfTooSmall(merge_below, max_size_)) {
     ++stats_.buffers_merged_;
   } else {
     EmitAndReleaseTopBuffer();
@@ -19,14 +19,25 @@
 
 #include <openssl/sha.h>
 
+#include <cstring>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/indexing/AsyncOutputStream.h"
+#include "kythe/cxx/common/indexing/EntrySetEncoder.h"
 #include "kythe/cxx/common/indexing/KytheOutputStream.h"
+#include "kythe/cxx/common/indexing/Murmur3Hasher.h"
+#include "kythe/cxx/common/indexing/SnappyOutputStream.h"
 #include "kythe/proto/common.pb.h"
 #include "kythe/proto/storage.pb.h"
 
@@ -36,11 +47,44 @@ class HashCache {
  public:
   using Hash = unsigned char[SHA256_DIGEST_LENGTH];
   static constexpr size_t kHashSize = SHA256_DIGEST_LENGTH;
+  /// \brief The ways buffers can be hashed to produce keys for a cache.
+  enum class Algorithm {
+    /// SHA-256, filling the whole `Hash`. This is the original key format.
+    kSha256,
+    /// 128-bit MurmurHash3, which is several times cheaper than SHA-256.
+    /// Keys are `kMurmur3KeyTag`, then the hash, then zeroes, so they
+    /// never match keys hashed with SHA-256 from the same data.
+    kMurmur3
+  };
+  /// \brief The ways a writer can choose where its buffers end.
+  enum class Chunking {
+    /// By the nesting of entry groups: groups smaller than `min_size` are
+    /// merged into their parents, and buffers are split at `max_size`.
+    /// Inserting an entry moves every later boundary in its group.
+    kNested,
+    /// After entries where a rolling hash of the last several bytes written
+    /// takes on a particular value, so that boundaries only move near
+    /// changed content. Buffers are still kept between `min_size` and
+    /// `max_size` when possible.
+    kContentDefined
+  };
+  /// The first byte of every key made with `Algorithm::kMurmur3`. Change it
+  /// if the key format changes.
+  static constexpr unsigned char kMurmur3KeyTag = 0x01;
   virtual ~HashCache() {}
   /// \brief Notes that `hash` was seen.
   virtual void RegisterHash(const Hash& hash) {}
   /// \return true if `hash` has been seen before.
   virtual bool SawHash(const Hash& hash) { return false; }
+  /// \brief Looks up several hashes at once.
+  /// \param seen Set to one value per hash: whether that hash has been seen.
+  virtual void SawHashes(absl::Span<const Hash* const> hashes,
+                         std::vector<bool>* seen) {
+    seen->resize(hashes.size());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+      (*seen)[i] = SawHash(*hashes[i]);
+    }
+  }
   /// \brief Sets guidelines about the amount of source data per hash.
   /// \param min_size no fewer than this many bytes should be hashed.
   /// \param max_size no more than this many bytes should be hashed.
@@ -50,10 +94,157 @@ class HashCache {
   }
   size_t min_size() const { return min_size_; }
   size_t max_size() const { return max_size_; }
+  /// \brief Sets how many finished buffers a writer should hold back so that
+  /// their hashes can be looked up together with `SawHashes`. A writer
+  /// looks up each buffer as soon as it is finished if this is 1 or less.
+  void set_batch_size(size_t batch_size) { batch_size_ = batch_size; }
+  size_t batch_size() const { return batch_size_; }
+  /// \brief Sets how buffers should be hashed for this cache. Every writer
+  /// sharing a cache must use the same algorithm to find each other's keys.
+  void set_algorithm(Algorithm algorithm) { algorithm_ = algorithm; }
+  Algorithm algorithm() const { return algorithm_; }
+  /// \brief Sets how writers should split their output into buffers.
+  /// Writers only find each other's buffers if they agree on this.
+  void set_chunking(Chunking chunking) { chunking_ = chunking; }
+  Chunking chunking() const { return chunking_; }
 
  private:
   size_t min_size_ = 0;
   size_t max_size_ = 32 * 1024;
+  size_t batch_size_ = 1;
+  Algorithm algorithm_ = Algorithm::kSha256;
+  Chunking chunking_ = Chunking::kNested;
+};
+
+/// \brief A `HashCache` that serializes access to another `HashCache`.
+///
+/// This allows a single (non-thread-safe) cache to be shared by several
+/// output streams running on different threads.
+class SynchronizedHashCache : public HashCache {
+ public:
+  /// \param cache The cache to forward to. Not owned; must outlive this.
+  explicit SynchronizedHashCache(HashCache* cache) : cache_(cache) {
+    SetSizeLimits(cache->min_size(), cache->max_size());
+    set_algorithm(cache->algorithm());
+    set_batch_size(cache->batch_size());
+    set_chunking(cache->chunking());
+  }
+  void RegisterHash(const Hash& hash) override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    cache_->RegisterHash(hash);
+  }
+  bool SawHash(const Hash& hash) override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return cache_->SawHash(hash);
+  }
+  void SawHashes(absl::Span<const Hash* const> hashes,
+                 std::vector<bool>* seen) override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    cache_->SawHashes(hashes, seen);
+  }
+
+ private:
+  absl::Mutex mu_;
+  HashCache* cache_ ABSL_GUARDED_BY(mu_);
+};
+
+/// \brief A `HashCache` that answers repeat lookups from memory before
+/// asking a shared cache behind it.
+///
+/// Hashes this process registers or finds in the shared cache are kept in a
+/// size-bounded local set; only hashes missing from it go to the shared
+/// cache. Like `EntryFingerprintFilter`, the set keeps 64 bits of each hash
+/// and starts over empty when it fills. It is not thread-safe on its own;
+/// wrap it in a `SynchronizedHashCache` to share it.
+class TieredHashCache : public HashCache {
+ public:
+  /// \param remote The shared cache. Its size limits, algorithm, and batch
+  /// size are copied, so it should be configured first.
+  /// \param max_local_bytes Roughly how much memory the local set may use.
+  TieredHashCache(std::unique_ptr<HashCache> remote, size_t max_local_bytes);
+  void RegisterHash(const Hash& hash) override;
+  bool SawHash(const Hash& hash) override;
+  void SawHashes(absl::Span<const Hash* const> hashes,
+                 std::vector<bool>* seen) override;
+
+  /// \brief Lookup counts for each tier.
+  struct Stats {
+    /// How many hashes were looked up.
+    size_t lookups = 0;
+    /// How many lookups the local set answered.
+    size_t local_hits = 0;
+    /// How many lookups went to the shared cache.
+    size_t remote_lookups = 0;
+    /// How many of those the shared cache had seen.
+    size_t remote_hits = 0;
+    /// How many times the local set started over.
+    size_t local_resets = 0;
+    /// \brief Return a summary of these statistics as a string.
+    std::string ToString() const;
+  };
+  const Stats& stats() const { return stats_; }
+
+ private:
+  /// \return the part of `hash` kept in the local set.
+  uint64_t LocalKey(const Hash& hash) const;
+  /// Remembers `hash` locally.
+  void InsertLocal(const Hash& hash);
+
+  std::unique_ptr<HashCache> remote_;
+  /// The number of keys to keep before starting over.
+  size_t max_local_keys_;
+  absl::flat_hash_set<uint64_t> local_;
+  Stats stats_;
+  /// Scratch space for the hashes in a batch that go to `remote_`.
+  std::vector<const Hash*> remote_hashes_;
+  std::vector<size_t> remote_indices_;
+  std::vector<bool> remote_seen_;
+};
+
+/// \brief Remembers fingerprints of entries that have been written so that
+/// exact duplicates can be dropped.
+///
+/// Fingerprints are 64-bit hashes of serialized entries, so two distinct
+/// entries are mistaken for each other with probability about 2^-64 per
+/// pair. Memory use is bounded: once the set reaches its limit, it starts
+/// over empty, so duplicates farther apart than that may be written again.
+class EntryFingerprintFilter {
+ public:
+  /// \param max_bytes Roughly how much memory the set may use.
+  explicit EntryFingerprintFilter(size_t max_bytes);
+  virtual ~EntryFingerprintFilter() {}
+  /// \brief Remembers `fingerprint`.
+  /// \return false if `fingerprint` was already remembered.
+  virtual bool Insert(uint64_t fingerprint);
+  /// \return the fingerprint of the `size` bytes at `data`.
+  static uint64_t Fingerprint(const void* data, size_t size);
+  /// Roughly how much memory the set uses per fingerprint.
+  static constexpr size_t kBytesPerFingerprint = 16;
+
+ protected:
+  EntryFingerprintFilter() {}
+
+ private:
+  /// The number of fingerprints to keep before starting over.
+  size_t max_fingerprints_ = 0;
+  /// The fingerprints seen since we last started over.
+  absl::flat_hash_set<uint64_t> fingerprints_;
+};
+
+/// \brief An `EntryFingerprintFilter` that serializes access to another.
+class SynchronizedEntryFingerprintFilter : public EntryFingerprintFilter {
+ public:
+  /// \param filter The filter to forward to. Not owned; must outlive this.
+  explicit SynchronizedEntryFingerprintFilter(EntryFingerprintFilter* filter)
+      : filter_(filter) {}
+  bool Insert(uint64_t fingerprint) override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return filter_->Insert(fingerprint);
+  }
+
+ private:
+  absl::Mutex mu_;
+  EntryFingerprintFilter* filter_ ABSL_GUARDED_BY(mu_);
 };
 
 // Interface for receiving Kythe data.
@@ -70,21 +261,42 @@ class NullOutputStream : public KytheCachingOutput {
   void Emit(const FactRef& fact) override {}
   void Emit(const EdgeRef& edge) override {}
   void Emit(const OrdinalEdgeRef& edge) override {}
+  void Emit(absl::Span<const FactRef> facts) override {}
+  void Emit(absl::Span<const EdgeRef> edges) override {}
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override {}
 };
 
 /// \brief Manages a stack of size-bounded buffers.
 class BufferStack {
  public:
-  /// \brief Hashes the buffer at the top of the stack, returning the result
-  /// in `hash`.
+  /// \brief Hashes the buffer at the top of the stack with SHA-256,
+  /// returning the result in `hash`.
   void HashTop(HashCache::Hash* hash) const {
+    HashTop(HashCache::Algorithm::kSha256, hash);
+  }
+  /// \brief Hashes the buffer at the top of the stack using `algorithm`,
+  /// returning the result in `hash`.
+  void HashTop(HashCache::Algorithm algorithm, HashCache::Hash* hash) const {
     assert(buffers_ != nullptr);
+    unsigned char* out = reinterpret_cast<unsigned char*>(hash);
+    if (algorithm == HashCache::Algorithm::kMurmur3) {
+      Murmur3Hasher hasher;
+      for (Buffer* joined = buffers_; joined; joined = joined->joined) {
+        hasher.Update(joined->slab.get(), joined->size);
+      }
+      static_assert(1 + Murmur3Hasher::kHashSize <= HashCache::kHashSize,
+                    "Murmur3 keys don't fit in a Hash");
+      memset(out, 0, HashCache::kHashSize);
+      out[0] = HashCache::kMurmur3KeyTag;
+      hasher.Finish(out + 1);
+      return;
+    }
     ::SHA256_CTX sha;
     ::SHA256_Init(&sha);
     for (Buffer* joined = buffers_; joined; joined = joined->joined) {
-      ::SHA256_Update(&sha, joined->slab.data(), joined->slab.size());
+      ::SHA256_Update(&sha, joined->slab.get(), joined->size);
     }
-    ::SHA256_Final(reinterpret_cast<unsigned char*>(hash), &sha);
+    ::SHA256_Final(out, &sha);
   }
   /// \brief Copies the buffer at the top of the stack to some `stream`.
   void CopyTopToStream(
@@ -93,15 +305,15 @@ class BufferStack {
       void* proto_data;
       int proto_size;
       size_t write_at = 0;
-      while (write_at < joined->slab.size()) {
-        proto_size = std::min(static_cast<size_t>(INT_MAX),
-                              joined->slab.size() - write_at);
+      while (write_at < joined->size) {
+        proto_size =
+            std::min(static_cast<size_t>(INT_MAX), joined->size - write_at);
         if (!stream->Next(&proto_data, &proto_size)) {
           assert(0 && "bad stream");
         }
-        size_t to_copy = std::min(static_cast<size_t>(proto_size),
-                                  joined->slab.size() - write_at);
-        memcpy(proto_data, joined->slab.data() + write_at, to_copy);
+        size_t to_copy =
+            std::min(static_cast<size_t>(proto_size), joined->size - write_at);
+        memcpy(proto_data, joined->slab.get() + write_at, to_copy);
         if (static_cast<size_t>(proto_size) > to_copy) {
           stream->BackUp(proto_size - to_copy);
         }
@@ -114,24 +326,31 @@ class BufferStack {
   /// \return A pointer to `bytes` bytes of storage.
   unsigned char* WriteToTop(size_t bytes) {
     assert(buffers_);
-    size_t insertion_point = buffers_->slab.size();
-    buffers_->slab.resize(insertion_point + bytes);
-    unsigned char* buffer = &buffers_->slab[insertion_point];
-    buffers_->joined_size += bytes;
+    Buffer* top = buffers_;
+    if (top->size + bytes > top->capacity) {
+      top->Reserve(std::max(top->size + bytes, 2 * top->capacity));
+    }
+    unsigned char* buffer = top->slab.get() + top->size;
+    top->size += bytes;
+    top->joined_size += bytes;
     return buffer;
   }
   /// \brief Pushes a new buffer to the stack.
-  /// \param expected_size An estimate of the buffer's maximum size.
+  /// \param expected_size An estimate of the buffer's maximum size. Buffers
+  /// are recycled along with their storage, so once every recycled buffer
+  /// has this much room, pushing, writing and popping don't allocate.
   void Push(size_t expected_size) {
     Buffer* buffer = free_buffers_;
     if (buffer) {
       free_buffers_ = buffer->previous;
     } else {
       buffer = new Buffer();
-      buffer->slab.reserve(expected_size);
+    }
+    if (buffer->capacity < expected_size) {
+      buffer->Reserve(expected_size);
     }
     buffer->joined = nullptr;
-    buffer->slab.clear();
+    buffer->size = 0;
     buffer->joined_size = 0;
     buffer->previous = buffers_;
     buffers_ = buffer;
@@ -198,8 +417,27 @@ class BufferStack {
 
  private:
   struct Buffer {
+    /// \brief Makes room for at least `new_capacity` bytes, keeping the
+    /// first `size`.
+    void Reserve(size_t new_capacity) {
+      if (new_capacity <= capacity) {
+        return;
+      }
+      // Unlike std::vector, this doesn't zero the storage.
+      std::unique_ptr<unsigned char[]> new_slab(
+          new unsigned char[new_capacity]);
+      if (size != 0) {
+        memcpy(new_slab.get(), slab.get(), size);
+      }
+      slab = std::move(new_slab);
+      capacity = new_capacity;
+    }
     /// Used to allocate storage for messages.
-    std::vector<unsigned char> slab;
+    std::unique_ptr<unsigned char[]> slab;
+    /// The number of bytes allocated for `slab`.
+    size_t capacity = 0;
+    /// The number of bytes of `slab` in use.
+    size_t size = 0;
     /// `size` plus the `size` of all joined buffers.
     size_t joined_size;
     /// The previous buffer on the stack or the freelist.
@@ -213,86 +451,236 @@ class BufferStack {
   Buffer* free_buffers_ = nullptr;
 };
 
+/// \brief Appends everything written to it to a string.
+///
+/// StringOutputStream resizes (and so zero-fills) its string up to capacity
+/// every time a CodedOutputStream is created on it, which FileOutputStream
+/// does once per entry. That made buffering a unit quadratic in its size.
+/// Use this with a `CopyingOutputStreamAdaptor` to buffer a `FileOutputStream`
+/// in memory, e.g. for `FileOutputStream::WriteDelimitedEntries`.
+class StringAppendingStream : public google::protobuf::io::CopyingOutputStream {
+ public:
+  explicit StringAppendingStream(std::string* out) : out_(out) {}
+  bool Write(const void* buffer, int size) override {
+    out_->append(static_cast<const char*>(buffer), size);
+    return true;
+  }
+
+ private:
+  std::string* out_;
+};
+
 // A `KytheCachingOutputStream` that records `Entry` instances to a
 // `FileOutputStream`.
 class FileOutputStream : public KytheCachingOutput {
  public:
   explicit FileOutputStream(google::protobuf::io::FileOutputStream* stream)
+      : stream_(stream), file_stream_(stream) {
+    edge_entry_.set_fact_name("/");
+  }
+  /// \brief Writes to an arbitrary `ZeroCopyOutputStream`. Since such streams
+  /// cannot be flushed, `set_flush_after_each_entry` has no effect.
+  explicit FileOutputStream(google::protobuf::io::ZeroCopyOutputStream* stream)
       : stream_(stream) {
     edge_entry_.set_fact_name("/");
   }
+  /// \brief Writes through `stream`'s background thread. Flushes hand the
+  /// data written so far to that thread without waiting for it to be
+  /// written, except for `Flush`, which waits.
+  explicit FileOutputStream(AsyncOutputStream* stream)
+      : stream_(stream), async_stream_(stream) {
+    edge_entry_.set_fact_name("/");
+  }
+  /// \brief Writes compressed output. Each buffer emitted after checking the
+  /// hash cache is compressed as its own chunk. Since flushing a
+  /// `SnappyOutputStream` ends a chunk, `set_flush_after_each_entry` has no
+  /// effect; `Flush` still flushes.
+  explicit FileOutputStream(SnappyOutputStream* stream)
+      : stream_(stream), snappy_stream_(stream) {
+    edge_entry_.set_fact_name("/");
+  }
 
   /// \brief Dump stats to standard out on destruction?
   void set_show_stats(bool value) { show_stats_ = value; }
+  bool show_stats() const { return show_stats_; }
   void set_flush_after_each_entry(bool value) {
     flush_after_each_entry_ = value;
   }
-  void Emit(const FactRef& fact) override {
-    fact.Expand(&fact_entry_);
-    EnqueueEntry(fact_entry_);
-  }
-  void Emit(const EdgeRef& edge) override {
-    edge.Expand(&edge_entry_);
-    EnqueueEntry(edge_entry_);
-  }
-  void Emit(const OrdinalEdgeRef& edge) override {
-    edge.Expand(&edge_entry_);
-    EnqueueEntry(edge_entry_);
+  bool flush_after_each_entry() const { return flush_after_each_entry_; }
+  /// \brief Write varint-delimited `kythe.storage.EntrySet` messages of up to
+  /// `size` entries each instead of varint-delimited `Entry` messages. If
+  /// `size` is 0 (the default), write `Entry` messages.
+  void set_entry_set_bundle_size(size_t size) {
+    entry_set_bundle_size_ = size;
   }
+  size_t entry_set_bundle_size() const { return entry_set_bundle_size_; }
+  void Emit(const FactRef& fact) override;
+  void Emit(const EdgeRef& edge) override;
+  void Emit(const OrdinalEdgeRef& edge) override;
+  /// \brief Emits `facts` into space reserved for all of them at once.
+  /// With `set_flush_after_each_entry`, flushes once after the batch.
+  void Emit(absl::Span<const FactRef> facts) override;
+  /// \copydoc Emit(absl::Span<const FactRef>)
+  void Emit(absl::Span<const EdgeRef> edges) override;
+  /// \copydoc Emit(absl::Span<const FactRef>)
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override;
   void UseHashCache(HashCache* cache) override {
     cache_ = CHECK_NOTNULL(cache);
     min_size_ = cache_->min_size();
     max_size_ = cache_->max_size();
+    batch_size_ = cache_->batch_size();
+    SetChunking(cache_->chunking());
+  }
+  /// \brief Drops entries that `filter` says were already written.
+  ///
+  /// Only entries that would be written straight to the output are
+  /// filtered. Entries held in buffers for the hash cache are not: those
+  /// buffers' hashes must depend only on their own content.
+  void UseEntryFilter(EntryFingerprintFilter* filter) {
+    entry_filter_ = CHECK_NOTNULL(filter);
   }
   ~FileOutputStream() override;
   void PushBuffer() override;
   void PopBuffer() override;
 
+  /// \brief Copies `data`, which must be a sequence of varint-delimited
+  /// messages written by a `FileOutputStream` with the same
+  /// `entry_set_bundle_size`, directly to the output stream.
+  ///
+  /// This bypasses the hash cache. It must not be called while any buffers
+  /// pushed by `PushBuffer` are still open.
+  void WriteDelimitedEntries(absl::string_view data);
+
+  /// \brief Writes out any partially-filled `EntrySet` and flushes the
+  /// output stream if it's flushable. If the output stream is (or writes
+  /// to) an `AsyncOutputStream`, waits for its writer to catch up.
+  void Flush();
+
   /// \brief Statistics about delimited deduplication.
   struct Stats {
     /// How many buffers we've emitted.
     size_t buffers_retired_ = 0;
     /// How many buffers we've split.
     size_t buffers_split_ = 0;
+    /// How many buffers we've ended at content-defined cut points.
+    size_t buffers_cut_ = 0;
     /// How many buffers we've merged together.
     size_t buffers_merged_ = 0;
     /// How many buffers we didn't emit because their hashes matched.
     size_t hashes_matched_ = 0;
+    /// How many batches of held-back buffers we've looked up.
+    size_t hash_batches_ = 0;
     /// How many bytes in total we've seen (whether or not they were emitted).
     size_t total_bytes_ = 0;
+    /// How many entries we've checked against the entry filter.
+    size_t entries_checked_ = 0;
+    /// How many entries we didn't emit because the entry filter had seen
+    /// them.
+    size_t entries_filtered_ = 0;
     /// \brief Return a summary of these statistics as a string.
     std::string ToString() const;
   } stats_;
 
  private:
   /// Emits all data from the top buffer (if the hash cache says it's relevant).
+  /// If the cache batches lookups, holds the data back in `pending_` instead.
   void EmitAndReleaseTopBuffer();
+  /// Looks up the hashes of all buffers in `pending_` and emits the ones the
+  /// cache hasn't seen, in the order they were finished.
+  void ResolvePendingBuffers();
+  /// Emits `data`, a retired buffer, to the output.
+  void WriteRetiredBuffer(absl::string_view data);
   /// Emits an entry or adds it to a buffer (if the stack is nonempty).
   void EnqueueEntry(const proto::Entry& entry);
+  /// Emits the entry for `ref` or adds it to a buffer, serializing it
+  /// directly when possible. `entry` is scratch space for when it isn't.
+  template <typename Ref>
+  void EnqueueRef(const Ref& ref, proto::Entry* entry);
+  /// Emits the entries for `refs` or adds them to a buffer as `EnqueueRef`
+  /// would, but writes them all to space reserved at once when it can.
+  template <typename Ref>
+  void EnqueueRefs(absl::Span<const Ref> refs, proto::Entry* entry);
+  /// Accounts for the `size` bytes at `data` just written to the top buffer,
+  /// splitting it if it has grown too large or (when chunking by content)
+  /// if they contain a cut point.
+  void FinishWriteToTop(const unsigned char* data, size_t size);
+  /// Chooses how buffers end, picking a cut point frequency to suit the
+  /// size limits.
+  void SetChunking(HashCache::Chunking chunking);
+  /// Adds `size` bytes at `data` to the rolling hash.
+  /// \return true if any of them left the hash at a cut point.
+  bool RollChunkHash(const unsigned char* data, size_t size);
+  /// Flushes the output stream if it's flushable and we were asked to flush
+  /// after each entry.
+  void MaybeFlush();
+  /// Adds `data`, a sequence of varint-delimited `Entry` messages, to the
+  /// pending `EntrySet`.
+  void AddDelimitedEntries(absl::string_view data);
+  /// Writes the pending `EntrySet`, if any.
+  void WritePendingEntrySet();
 
   /// The output stream to write on.
-  google::protobuf::io::FileOutputStream* stream_;
+  google::protobuf::io::ZeroCopyOutputStream* stream_;
+  /// `stream_`, if it's a `FileOutputStream`; otherwise null.
+  google::protobuf::io::FileOutputStream* file_stream_ = nullptr;
+  /// `stream_`, if it's an `AsyncOutputStream`; otherwise null.
+  AsyncOutputStream* async_stream_ = nullptr;
+  /// `stream_`, if it's a `SnappyOutputStream`; otherwise null.
+  SnappyOutputStream* snappy_stream_ = nullptr;
   /// A prototypical Kythe fact, used only to build other Kythe facts.
   proto::Entry fact_entry_;
   /// A prototypical Kythe edge, used only to build same.
   proto::Entry edge_entry_;
   /// Buffers we're holding back for deduplication.
   BufferStack buffers_;
+  /// Scratch space for serializing entries that don't fit in the output
+  /// stream's current buffer.
+  std::vector<uint8_t> scratch_;
+  /// The serialized size of each entry in the batch being emitted.
+  std::vector<size_t> batch_sizes_;
+  /// A finished buffer waiting for its hash to be looked up.
+  struct PendingBuffer {
+    HashCache::Hash hash;
+    std::string data;
+  };
+  /// Finished buffers waiting to be looked up. Only the first
+  /// `pending_count_` are live; the rest are kept to reuse their storage.
+  std::vector<PendingBuffer> pending_;
+  size_t pending_count_ = 0;
+  /// Scratch space for looking up `pending_`.
+  std::vector<const HashCache::Hash*> pending_hashes_;
+  std::vector<bool> pending_seen_;
 
   /// The default hash cache.
   HashCache default_cache_;
   /// The active hash cache; must not be null.
   HashCache* cache_ = &default_cache_;
+  /// The filter for duplicate entries, or null.
+  EntryFingerprintFilter* entry_filter_ = nullptr;
   /// The minimum size a buffer must be to get emitted.
   size_t min_size_ = cache_->min_size();
   /// The maximum size a buffer can reach before it's split.
   size_t max_size_ = cache_->max_size();
+  /// How many finished buffers to hold back for one lookup.
+  size_t batch_size_ = cache_->batch_size();
+  /// How buffers end.
+  HashCache::Chunking chunking_ = HashCache::Chunking::kNested;
+  /// For content-defined chunking, the bits of `chunk_hash_` that are all
+  /// clear at a cut point.
+  uint64_t cut_mask_ = 0;
+  /// The rolling hash of the bytes written to buffers.
+  uint64_t chunk_hash_ = 0;
 
   /// Whether we should dump stats to standard out on destruction.
   bool show_stats_ = false;
   /// Whether we should flush the output stream after each entry
   /// (when the buffer stack is empty).
   bool flush_after_each_entry_ = false;
+  /// The maximum number of entries in each `EntrySet` we write, or 0 if we
+  /// write `Entry` messages.
+  size_t entry_set_bundle_size_ = 0;
+  /// Entries waiting to be written as an `EntrySet`.
+  EntrySetEncoder entry_set_;
 };
 
 }  // namespace kythe
@@ -0,0 +1,451 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+TEST(EntryFingerprintFilterTest, RemembersFingerprints) {
+  EntryFingerprintFilter filter(1 << 20);
+  EXPECT_TRUE(filter.Insert(1));
+  EXPECT_TRUE(filter.Insert(2));
+  EXPECT_FALSE(filter.Insert(1));
+  EXPECT_FALSE(filter.Insert(2));
+}
+
+TEST(EntryFingerprintFilterTest, StartsOverWhenFull) {
+  EntryFingerprintFilter filter(2 *
+                                EntryFingerprintFilter::kBytesPerFingerprint);
+  EXPECT_TRUE(filter.Insert(1));
+  EXPECT_TRUE(filter.Insert(2));
+  EXPECT_TRUE(filter.Insert(3));
+  EXPECT_TRUE(filter.Insert(1));
+}
+
+TEST(EntryFingerprintFilterTest, FingerprintsDependOnContent) {
+  EXPECT_EQ(EntryFingerprintFilter::Fingerprint("abc", 3),
+            EntryFingerprintFilter::Fingerprint("abc", 3));
+  EXPECT_NE(EntryFingerprintFilter::Fingerprint("abc", 3),
+            EntryFingerprintFilter::Fingerprint("abd", 3));
+}
+
+class FileOutputStreamFilterTest : public ::testing::Test {
+ protected:
+  FileOutputStreamFilterTest() {
+    vname_.set_corpus("corpus");
+    vname_.set_signature("sig");
+  }
+
+  /// \brief Emits `count` copies of the same fact and edge to `stream`.
+  void EmitCopies(FileOutputStream* stream, int count) {
+    VNameRef ref(vname_);
+    for (int i = 0; i < count; ++i) {
+      stream->Emit(FactRef{&ref, "/kythe/node/kind", "record"});
+      stream->Emit(EdgeRef{&ref, "/kythe/edge/childof", &ref});
+    }
+  }
+
+  proto::VName vname_;
+  EntryFingerprintFilter filter_{1 << 20};
+};
+
+TEST_F(FileOutputStreamFilterTest, DropsDuplicates) {
+  std::string once, thrice;
+  {
+    google::protobuf::io::StringOutputStream stream(&once);
+    FileOutputStream file_stream(&stream);
+    EmitCopies(&file_stream, 1);
+  }
+  {
+    google::protobuf::io::StringOutputStream stream(&thrice);
+    FileOutputStream file_stream(&stream);
+    file_stream.UseEntryFilter(&filter_);
+    EmitCopies(&file_stream, 3);
+    EXPECT_EQ(6, file_stream.stats_.entries_checked_);
+    EXPECT_EQ(4, file_stream.stats_.entries_filtered_);
+  }
+  EXPECT_EQ(once, thrice);
+}
+
+TEST_F(FileOutputStreamFilterTest, SharesFilterBetweenStreams) {
+  std::string first, second;
+  {
+    google::protobuf::io::StringOutputStream stream(&first);
+    FileOutputStream file_stream(&stream);
+    file_stream.UseEntryFilter(&filter_);
+    EmitCopies(&file_stream, 1);
+  }
+  {
+    google::protobuf::io::StringOutputStream stream(&second);
+    FileOutputStream file_stream(&stream);
+    file_stream.UseEntryFilter(&filter_);
+    EmitCopies(&file_stream, 1);
+  }
+  EXPECT_FALSE(first.empty());
+  EXPECT_TRUE(second.empty());
+}
+
+TEST_F(FileOutputStreamFilterTest, IgnoresBufferedEntries) {
+  HashCache cache;
+  cache.SetSizeLimits(0, 1 << 20);
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    FileOutputStream file_stream(&stream);
+    file_stream.UseHashCache(&cache);
+    file_stream.UseEntryFilter(&filter_);
+    file_stream.PushBuffer();
+    EmitCopies(&file_stream, 2);
+    file_stream.PopBuffer();
+    EXPECT_EQ(0, file_stream.stats_.entries_checked_);
+  }
+  std::string once;
+  {
+    google::protobuf::io::StringOutputStream stream(&once);
+    FileOutputStream file_stream(&stream);
+    EmitCopies(&file_stream, 1);
+  }
+  EXPECT_EQ(once + once, output);
+}
+
+/// \brief The `FileOutputStream` configurations that write entries
+/// differently.
+enum class StreamMode { kDirect, kBuffered, kFiltered, kEntrySets };
+
+/// \brief Records a node with a large text fact and some param edges,
+/// either one entry at a time or in batches, and returns the output.
+std::string RecordNode(StreamMode mode, bool batched) {
+  proto::VName node_vname;
+  node_vname.set_signature("node");
+  std::vector<proto::VName> param_vnames(3);
+  for (size_t i = 0; i < param_vnames.size(); ++i) {
+    param_vnames[i].set_signature(std::to_string(i));
+  }
+  // Too big for the output stream's buffer, so it's written from scratch
+  // space instead.
+  const std::string text(100 * 1024, 't');
+  HashCache cache;
+  cache.SetSizeLimits(0, 1 << 20);
+  EntryFingerprintFilter filter(1 << 20);
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    FileOutputStream file_stream(&stream);
+    if (mode == StreamMode::kBuffered) {
+      file_stream.UseHashCache(&cache);
+    } else if (mode == StreamMode::kFiltered) {
+      file_stream.UseEntryFilter(&filter);
+    } else if (mode == StreamMode::kEntrySets) {
+      file_stream.set_entry_set_bundle_size(2);
+    }
+    KytheGraphRecorder recorder(&file_stream);
+    recorder.PushEntryGroup();
+    VNameRef node(node_vname);
+    std::vector<VNameRef> params(param_vnames.begin(), param_vnames.end());
+    if (batched) {
+      recorder.AddProperties(
+          node, {{PropertyID::kNodeKind, spelling_of(NodeKindID::kTApp)},
+                 {PropertyID::kParamDefault, "1"},
+                 {PropertyID::kText, text}});
+      recorder.AddEdges(node, EdgeKindID::kParam, params, 0);
+    } else {
+      recorder.AddProperty(node, NodeKindID::kTApp);
+      recorder.AddProperty(node, PropertyID::kParamDefault, "1");
+      recorder.AddProperty(node, PropertyID::kText, text);
+      for (uint32_t i = 0; i < params.size(); ++i) {
+        recorder.AddEdge(node, EdgeKindID::kParam, params[i], i);
+      }
+    }
+    recorder.PopEntryGroup();
+  }
+  return output;
+}
+
+TEST(FileOutputStreamBatchTest, BatchesMatchSingleEntries) {
+  for (auto mode : {StreamMode::kDirect, StreamMode::kBuffered,
+                    StreamMode::kFiltered, StreamMode::kEntrySets}) {
+    const std::string expected = RecordNode(mode, false);
+    EXPECT_GT(expected.size(), 100 * 1024);
+    EXPECT_EQ(expected, RecordNode(mode, true))
+        << static_cast<int>(mode);
+  }
+}
+
+/// \brief A `HashCache` that remembers hashes in memory and counts lookups.
+class MemoryHashCache : public HashCache {
+ public:
+  void RegisterHash(const Hash& hash) override {
+    hashes_.emplace(reinterpret_cast<const char*>(hash), kHashSize);
+  }
+  bool SawHash(const Hash& hash) override {
+    ++lookups_;
+    return hashes_.count(
+               std::string(reinterpret_cast<const char*>(hash), kHashSize)) !=
+           0;
+  }
+  void SawHashes(absl::Span<const Hash* const> hashes,
+                 std::vector<bool>* seen) override {
+    ++batches_;
+    HashCache::SawHashes(hashes, seen);
+  }
+  size_t lookups() const { return lookups_; }
+  size_t batches() const { return batches_; }
+
+ private:
+  std::set<std::string> hashes_;
+  size_t lookups_ = 0;
+  size_t batches_ = 0;
+};
+
+/// \brief Writes groups of entries, some of them repeated and some with
+/// ungrouped entries between them, through `cache` and returns the output.
+std::string WriteGroups(HashCache* cache, size_t entry_set_bundle_size) {
+  std::vector<proto::VName> vnames(6);
+  for (size_t i = 0; i < vnames.size(); ++i) {
+    vnames[i].set_signature(std::to_string(i));
+  }
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    FileOutputStream file_stream(&stream);
+    file_stream.UseHashCache(cache);
+    file_stream.set_entry_set_bundle_size(entry_set_bundle_size);
+    KytheGraphRecorder recorder(&file_stream);
+    for (int pass = 0; pass < 2; ++pass) {
+      for (size_t i = 0; i < vnames.size(); ++i) {
+        VNameRef node(vnames[i]);
+        recorder.PushEntryGroup();
+        recorder.AddProperty(node, NodeKindID::kFunction);
+        recorder.PopEntryGroup();
+        if (i % 3 == 2) {
+          recorder.AddEdge(node, EdgeKindID::kChildOf,
+                           VNameRef(vnames[pass]));
+        }
+      }
+    }
+  }
+  return output;
+}
+
+TEST(FileOutputStreamBatchTest, BatchedLookupsPreserveOutput) {
+  for (size_t bundle_size : {0, 2}) {
+    MemoryHashCache sync_cache;
+    sync_cache.SetSizeLimits(0, 1 << 20);
+    const std::string expected = WriteGroups(&sync_cache, bundle_size);
+    EXPECT_EQ(0, sync_cache.batches());
+    for (size_t batch_size : {2, 4, 64}) {
+      MemoryHashCache batch_cache;
+      batch_cache.SetSizeLimits(0, 1 << 20);
+      batch_cache.set_batch_size(batch_size);
+      EXPECT_EQ(expected, WriteGroups(&batch_cache, bundle_size))
+          << bundle_size << " " << batch_size;
+      EXPECT_EQ(sync_cache.lookups(), batch_cache.lookups());
+      EXPECT_LT(batch_cache.batches(), batch_cache.lookups());
+    }
+  }
+}
+
+TEST(FileOutputStreamBatchTest, DropsRepeatsWithinABatch) {
+  proto::VName vname;
+  vname.set_signature("node");
+  auto write_copies = [&](HashCache* cache, int copies) {
+    std::string output;
+    {
+      google::protobuf::io::StringOutputStream stream(&output);
+      FileOutputStream file_stream(&stream);
+      file_stream.UseHashCache(cache);
+      KytheGraphRecorder recorder(&file_stream);
+      for (int i = 0; i < copies; ++i) {
+        recorder.PushEntryGroup();
+        recorder.AddProperty(VNameRef(vname), NodeKindID::kFunction);
+        recorder.PopEntryGroup();
+      }
+    }
+    return output;
+  };
+  MemoryHashCache sync_cache;
+  sync_cache.SetSizeLimits(0, 1 << 20);
+  MemoryHashCache batch_cache;
+  batch_cache.SetSizeLimits(0, 1 << 20);
+  batch_cache.set_batch_size(64);
+  const std::string once = write_copies(&sync_cache, 1);
+  EXPECT_FALSE(once.empty());
+  EXPECT_EQ(once, write_copies(&batch_cache, 2));
+  EXPECT_EQ(1, batch_cache.batches());
+}
+
+/// \brief Writes `nodes` nodes, skipping node `skip`, in one entry group
+/// for the whole "file", through `cache` (if it isn't null).
+std::string WriteFile(HashCache* cache, int nodes, int skip) {
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    FileOutputStream file_stream(&stream);
+    if (cache != nullptr) {
+      file_stream.UseHashCache(cache);
+    }
+    KytheGraphRecorder recorder(&file_stream);
+    recorder.PushEntryGroup();
+    proto::VName vname;
+    vname.set_path("file.h");
+    for (int i = 0; i < nodes; ++i) {
+      if (i == skip) {
+        continue;
+      }
+      vname.set_signature(absl::StrCat("node#", i));
+      recorder.AddProperty(VNameRef(vname), NodeKindID::kFunction);
+      recorder.AddEdge(VNameRef(vname), EdgeKindID::kChildOf,
+                       VNameRef(vname));
+    }
+    recorder.PopEntryGroup();
+  }
+  return output;
+}
+
+/// \brief Splits `output` into its delimited entries, in sorted order.
+std::vector<std::string> SortedEntries(const std::string& output) {
+  google::protobuf::io::CodedInputStream input(
+      reinterpret_cast<const uint8_t*>(output.data()), output.size());
+  std::vector<std::string> entries;
+  uint32_t size;
+  while (input.ReadVarint32(&size)) {
+    entries.emplace_back();
+    EXPECT_TRUE(input.ReadString(&entries.back(), size));
+  }
+  std::sort(entries.begin(), entries.end());
+  return entries;
+}
+
+TEST(FileOutputStreamChunkingTest, ContentDefinedChunksKeepEveryEntry) {
+  HashCache nested_cache;
+  nested_cache.SetSizeLimits(256, 4096);
+  HashCache content_cache;
+  content_cache.SetSizeLimits(256, 4096);
+  content_cache.set_chunking(HashCache::Chunking::kContentDefined);
+  EXPECT_EQ(SortedEntries(WriteFile(&nested_cache, 1000, -1)),
+            SortedEntries(WriteFile(&content_cache, 1000, -1)));
+}
+
+TEST(FileOutputStreamChunkingTest, ContentDefinedChunksSurviveEarlyEdits) {
+  std::string edited_output[2];
+  for (auto chunking : {HashCache::Chunking::kNested,
+                        HashCache::Chunking::kContentDefined}) {
+    MemoryHashCache cache;
+    cache.SetSizeLimits(256, 4096);
+    cache.set_chunking(chunking);
+    WriteFile(&cache, 1000, -1);
+    // Dropping an early node shifts everything after it.
+    edited_output[static_cast<int>(chunking)] = WriteFile(&cache, 1000, 3);
+  }
+  const std::string full_output = WriteFile(nullptr, 1000, 3);
+  EXPECT_GT(edited_output[0].size() * 2, full_output.size());
+  EXPECT_LT(edited_output[1].size() * 10, full_output.size());
+}
+
+/// \brief Provides three distinct hashes for `TieredHashCache` tests.
+class TieredHashCacheTest : public ::testing::Test {
+ protected:
+  TieredHashCacheTest() {
+    memset(registered_, 1, HashCache::kHashSize);
+    memset(elsewhere_, 2, HashCache::kHashSize);
+    memset(missing_, 3, HashCache::kHashSize);
+  }
+
+  HashCache::Hash registered_;
+  HashCache::Hash elsewhere_;
+  HashCache::Hash missing_;
+};
+
+TEST_F(TieredHashCacheTest, AnswersRepeatsLocally) {
+  auto remote = absl::make_unique<MemoryHashCache>();
+  MemoryHashCache* shared = remote.get();
+  // Some other process registered `elsewhere_`.
+  shared->RegisterHash(elsewhere_);
+  TieredHashCache cache(std::move(remote), 1 << 20);
+  cache.RegisterHash(registered_);
+  EXPECT_TRUE(cache.SawHash(registered_));
+  EXPECT_EQ(0, shared->lookups());
+  EXPECT_TRUE(cache.SawHash(elsewhere_));
+  EXPECT_TRUE(cache.SawHash(elsewhere_));
+  EXPECT_EQ(1, shared->lookups());
+  EXPECT_FALSE(cache.SawHash(missing_));
+  EXPECT_EQ(2, shared->lookups());
+  EXPECT_EQ(4, cache.stats().lookups);
+  EXPECT_EQ(2, cache.stats().local_hits);
+  EXPECT_EQ(2, cache.stats().remote_lookups);
+  EXPECT_EQ(1, cache.stats().remote_hits);
+}
+
+TEST_F(TieredHashCacheTest, SendsOnlyLocalMissesToRemote) {
+  auto remote = absl::make_unique<MemoryHashCache>();
+  MemoryHashCache* shared = remote.get();
+  shared->RegisterHash(elsewhere_);
+  TieredHashCache cache(std::move(remote), 1 << 20);
+  cache.RegisterHash(registered_);
+  std::vector<const HashCache::Hash*> batch = {&registered_, &missing_,
+                                               &elsewhere_};
+  std::vector<bool> seen;
+  cache.SawHashes(batch, &seen);
+  EXPECT_EQ(std::vector<bool>({true, false, true}), seen);
+  EXPECT_EQ(2, shared->lookups());
+  EXPECT_EQ(1, shared->batches());
+  cache.SawHashes(batch, &seen);
+  EXPECT_EQ(std::vector<bool>({true, false, true}), seen);
+  EXPECT_EQ(3, shared->lookups());
+}
+
+TEST_F(TieredHashCacheTest, StartsOverWhenFull) {
+  TieredHashCache cache(absl::make_unique<HashCache>(),
+                        2 * EntryFingerprintFilter::kBytesPerFingerprint);
+  cache.RegisterHash(registered_);
+  cache.RegisterHash(elsewhere_);
+  cache.RegisterHash(missing_);
+  EXPECT_FALSE(cache.SawHash(registered_));
+  EXPECT_TRUE(cache.SawHash(missing_));
+  EXPECT_EQ(1, cache.stats().local_resets);
+}
+
+TEST_F(TieredHashCacheTest, CopiesRemoteSettings) {
+  auto remote = absl::make_unique<HashCache>();
+  remote->SetSizeLimits(10, 20);
+  remote->set_algorithm(HashCache::Algorithm::kMurmur3);
+  remote->set_batch_size(8);
+  remote->set_chunking(HashCache::Chunking::kContentDefined);
+  TieredHashCache cache(std::move(remote), 1 << 20);
+  EXPECT_EQ(10, cache.min_size());
+  EXPECT_EQ(20, cache.max_size());
+  EXPECT_EQ(HashCache::Algorithm::kMurmur3, cache.algorithm());
+  EXPECT_EQ(8, cache.batch_size());
+  EXPECT_EQ(HashCache::Chunking::kContentDefined, cache.chunking());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -16,79 +16,23 @@
 
 #include "KytheGraphRecorder.h"
 
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/str_format.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
 #include "kythe/proto/storage.pb.h"
 
 namespace kythe {
 
-static const std::string* const kNodeKindSpellings[] = {
-    new std::string("anchor"),     new std::string("file"),
-    new std::string("variable"),   new std::string("talias"),
-    new std::string("tapp"),       new std::string("tnominal"),
-    new std::string("record"),     new std::string("sum"),
-    new std::string("constant"),   new std::string("abs"),
-    new std::string("absvar"),     new std::string("function"),
-    new std::string("lookup"),     new std::string("macro"),
-    new std::string("interface"),  new std::string("package"),
-    new std::string("tsigma"),     new std::string("doc"),
-    new std::string("tbuiltin"),   new std::string("meta"),
-    new std::string("diagnostic"), new std::string("clang/usr")};
-
-static const std::string* kEdgeKindSpellings[] = {
-    new std::string("/kythe/edge/defines"),
-    new std::string("/kythe/edge/typed"),
-    new std::string("/kythe/edge/ref"),
-    new std::string("/kythe/edge/ref/implicit"),
-    new std::string("/kythe/edge/ref/imports"),
-    new std::string("/kythe/edge/param"),
-    new std::string("/kythe/edge/aliases"),
-    new std::string("/kythe/edge/aliases/root"),
-    new std::string("/kythe/edge/completes/uniquely"),
-    new std::string("/kythe/edge/completes"),
-    new std::string("/kythe/edge/childof"),
-    new std::string("/kythe/edge/specializes"),
-    new std::string("/kythe/edge/ref/call"),
-    new std::string("/kythe/edge/ref/call/implicit"),
-    new std::string("/kythe/edge/ref/expands"),
-    new std::string("/kythe/edge/undefines"),
-    new std::string("/kythe/edge/ref/includes"),
-    new std::string("/kythe/edge/ref/queries"),
-    new std::string("/kythe/edge/instantiates"),
-    new std::string("/kythe/edge/ref/expands/transitive"),
-    new std::string("/kythe/edge/extends/public"),
-    new std::string("/kythe/edge/extends/protected"),
-    new std::string("/kythe/edge/extends/private"),
-    new std::string("/kythe/edge/extends"),
-    new std::string("/kythe/edge/extends/public/virtual"),
-    new std::string("/kythe/edge/extends/protected/virtual"),
-    new std::string("/kythe/edge/extends/private/virtual"),
-    new std::string("/kythe/edge/extends/virtual"),
-    new std::string("/kythe/edge/extends/category"),
-    new std::string("/kythe/edge/specializes/speculative"),
-    new std::string("/kythe/edge/instantiates/speculative"),
-    new std::string("/kythe/edge/documents"),
-    new std::string("/kythe/edge/ref/doc"),
-    new std::string("/kythe/edge/generates"),
-    new std::string("/kythe/edge/defines/binding"),
-    new std::string("/kythe/edge/overrides"),
-    new std::string("/kythe/edge/overrides/root"),
-    new std::string("/kythe/edge/childof/context"),
-    new std::string("/kythe/edge/bounded/upper"),
-    new std::string("/kythe/edge/ref/init"),
-    new std::string("/kythe/edge/ref/init/implicit"),
-    new std::string("/kythe/edge/imputes"),
-    new std::string("/kythe/edge/tagged"),
-    new std::string("/kythe/edge/property/reads"),
-    new std::string("/kythe/edge/property/writes"),
-    new std::string("/clang/usr"),
-    new std::string("/kythe/edge/ref/id"),
-    new std::string("/kythe/edge/ref/writes"),
-    new std::string("/kythe/edge/ref/writes/implicit"),
-    new std::string("/kythe/edge/influences")};
-
 bool of_spelling(absl::string_view str, EdgeKindID* edge_id) {
   size_t edge_index = 0;
-  for (auto* edge : kEdgeKindSpellings) {
-    if (*edge == str) {
+  for (absl::string_view edge : kEdgeKindSpellings) {
+    if (edge == str) {
       *edge_id = static_cast<kythe::EdgeKindID>(edge_index);
       return true;
     }
@@ -97,54 +41,154 @@ bool of_spelling(absl::string_view str, EdgeKindID* edge_id) {
   return false;
 }
 
-static const std::string* const kPropertySpellings[] = {
-    new std::string("/kythe/loc"),
-    new std::string("/kythe/loc/uri"),
-    new std::string("/kythe/loc/start"),
-    new std::string("/kythe/loc/start/row"),
-    new std::string("/kythe/loc/start"),
-    new std::string("/kythe/loc/end"),
-    new std::string("/kythe/loc/end/row"),
-    new std::string("/kythe/loc/end"),
-    new std::string("/kythe/text"),
-    new std::string("/kythe/complete"),
-    new std::string("/kythe/subkind"),
-    new std::string("/kythe/node/kind"),
-    new std::string("/kythe/code"),
-    new std::string("/kythe/variance"),
-    new std::string("/kythe/param/default"),
-    new std::string("/kythe/tag/static"),
-    new std::string("/kythe/tag/deprecated"),
-    new std::string("/kythe/message"),
-    new std::string("/kythe/details"),
-    new std::string("/kythe/context/url"),
-    new std::string("/kythe/doc/uri"),
-    new std::string("/kythe/build/config"),
-};
+bool of_spelling(absl::string_view str, NodeKindID* node_kind_id) {
+  size_t node_kind_index = 0;
+  for (absl::string_view node_kind : kNodeKindSpellings) {
+    if (node_kind == str) {
+      *node_kind_id = static_cast<kythe::NodeKindID>(node_kind_index);
+      return true;
+    }
+    ++node_kind_index;
+  }
+  return false;
+}
 
-static const std::string* const kEmptyStringSpelling = new std::string("");
+void EntryBreakdown::CountFact(PropertyID property_id,
+                               absl::string_view value, size_t bytes) {
+  NodeKindID node_kind_id;
+  Counts& counts = property_id == PropertyID::kNodeKind &&
+                           of_spelling(value, &node_kind_id)
+                       ? node_kinds_[static_cast<size_t>(node_kind_id)]
+                       : properties_[static_cast<size_t>(property_id)];
+  ++counts.entries;
+  counts.bytes += bytes;
+}
 
-static const std::string* const kRootPropertySpelling = new std::string("/");
+void EntryBreakdown::CountEdge(EdgeKindID edge_kind_id, size_t bytes) {
+  Counts& counts = edge_kinds_[static_cast<size_t>(edge_kind_id)];
+  ++counts.entries;
+  counts.bytes += bytes;
+}
 
-absl::string_view spelling_of(PropertyID property_id) {
-  const auto* str = kPropertySpellings[static_cast<ptrdiff_t>(property_id)];
-  return absl::string_view(str->data(), str->size());
+EntryBreakdown::Counts EntryBreakdown::total() const {
+  Counts total;
+  auto add = [&total](const Counts& counts) {
+    total.entries += counts.entries;
+    total.bytes += counts.bytes;
+  };
+  for (const auto& counts : node_kinds_) {
+    add(counts);
+  }
+  for (const auto& counts : properties_) {
+    add(counts);
+  }
+  for (const auto& counts : edge_kinds_) {
+    add(counts);
+  }
+  return total;
 }
 
-absl::string_view spelling_of(NodeKindID node_kind_id) {
-  const auto* str = kNodeKindSpellings[static_cast<ptrdiff_t>(node_kind_id)];
-  return absl::string_view(str->data(), str->size());
+void EntryBreakdown::Merge(const EntryBreakdown& other) {
+  auto merge = [](const Counts& from, Counts* to) {
+    to->entries += from.entries;
+    to->bytes += from.bytes;
+  };
+  for (size_t i = 0; i < node_kinds_.size(); ++i) {
+    merge(other.node_kinds_[i], &node_kinds_[i]);
+  }
+  for (size_t i = 0; i < properties_.size(); ++i) {
+    merge(other.properties_[i], &properties_[i]);
+  }
+  for (size_t i = 0; i < edge_kinds_.size(); ++i) {
+    merge(other.edge_kinds_[i], &edge_kinds_[i]);
+  }
 }
 
-absl::string_view spelling_of(EdgeKindID edge_kind_id) {
-  const auto* str = kEdgeKindSpellings[static_cast<ptrdiff_t>(edge_kind_id)];
-  return absl::string_view(str->data(), str->size());
+std::string EntryBreakdown::ToString() const {
+  std::vector<std::pair<std::string, Counts>> rows;
+  for (size_t i = 0; i < node_kinds_.size(); ++i) {
+    if (node_kinds_[i].entries != 0) {
+      rows.emplace_back(
+          absl::StrCat(spelling_of(PropertyID::kNodeKind), " ",
+                       spelling_of(static_cast<NodeKindID>(i))),
+          node_kinds_[i]);
+    }
+  }
+  for (size_t i = 0; i < properties_.size(); ++i) {
+    if (properties_[i].entries != 0) {
+      rows.emplace_back(std::string(spelling_of(static_cast<PropertyID>(i))),
+                        properties_[i]);
+    }
+  }
+  for (size_t i = 0; i < edge_kinds_.size(); ++i) {
+    if (edge_kinds_[i].entries != 0) {
+      rows.emplace_back(std::string(spelling_of(static_cast<EdgeKindID>(i))),
+                        edge_kinds_[i]);
+    }
+  }
+  std::stable_sort(rows.begin(), rows.end(),
+                   [](const std::pair<std::string, Counts>& lhs,
+                      const std::pair<std::string, Counts>& rhs) {
+                     return lhs.second.bytes > rhs.second.bytes;
+                   });
+  const Counts all = total();
+  std::string out =
+      absl::StrFormat("%10s %12s %6s  %s\n", "entries", "bytes", "bytes%",
+                      "kind");
+  for (const auto& row : rows) {
+    absl::StrAppendFormat(
+        &out, "%10d %12d %6.2f  %s\n", row.second.entries, row.second.bytes,
+        100.0 * row.second.bytes / all.bytes, row.first);
+  }
+  absl::StrAppendFormat(&out, "%10d %12d %6.2f  total\n", all.entries,
+                        all.bytes, all.bytes ? 100.0 : 0.0);
+  return out;
 }
 
+namespace {
+/// \return the size of the delimited entry for `ref`.
+template <typename Ref>
+size_t DelimitedSize(const Ref& ref) {
+  const size_t size = EntryWireFormat::ByteSize(ref);
+  return google::protobuf::io::CodedOutputStream::VarintSize32(size) + size;
+}
+
+/// \brief Encodes each of `spellings` with `encode`, once for the process.
+template <size_t N>
+const std::array<std::string, N>* EncodeAll(
+    const absl::string_view (&spellings)[N],
+    std::string (*encode)(absl::string_view)) {
+  auto* encoded = new std::array<std::string, N>();
+  for (size_t i = 0; i < N; ++i) {
+    (*encoded)[i] = encode(spellings[i]);
+  }
+  return encoded;
+}
+
+/// \return the fact name field for `property_id`, serialized.
+absl::string_view EncodedFactName(PropertyID property_id) {
+  static const auto* const encoded =
+      EncodeAll(kPropertySpellings, &EntryWireFormat::EncodeFactName);
+  return (*encoded)[static_cast<size_t>(property_id)];
+}
+
+/// \return the edge kind field for `edge_kind_id`, serialized.
+absl::string_view EncodedEdgeKind(EdgeKindID edge_kind_id) {
+  static const auto* const encoded =
+      EncodeAll(kEdgeKindSpellings, &EntryWireFormat::EncodeEdgeKind);
+  return (*encoded)[static_cast<size_t>(edge_kind_id)];
+}
+}  // anonymous namespace
+
 void KytheGraphRecorder::AddProperty(const VNameRef& node_vname,
                                      PropertyID property_id,
                                      absl::string_view property_value) {
-  stream_->Emit(FactRef{&node_vname, spelling_of(property_id), property_value});
+  FactRef fact{&node_vname, spelling_of(property_id), property_value,
+               EncodedFactName(property_id)};
+  if (breakdown_ != nullptr) {
+    breakdown_->CountFact(property_id, property_value, DelimitedSize(fact));
+  }
+  stream_->Emit(fact);
 }
 
 void KytheGraphRecorder::AddProperty(const VNameRef& node_vname,
@@ -153,33 +197,76 @@ void KytheGraphRecorder::AddProperty(const VNameRef& node_vname,
   AddProperty(node_vname, property_id, std::to_string(property_value));
 }
 
+void KytheGraphRecorder::AddProperties(const VNameRef& node_vname,
+                                       absl::Span<const Property> properties) {
+  absl::InlinedVector<FactRef, 8> facts;
+  facts.reserve(properties.size());
+  for (const auto& property : properties) {
+    facts.push_back(FactRef{&node_vname, spelling_of(property.id),
+                            property.value, EncodedFactName(property.id)});
+    if (breakdown_ != nullptr) {
+      breakdown_->CountFact(property.id, property.value,
+                            DelimitedSize(facts.back()));
+    }
+  }
+  stream_->Emit(absl::MakeConstSpan(facts));
+}
+
 void KytheGraphRecorder::AddMarkedSource(const VNameRef& node_vname,
                                          const MarkedSource& marked_source) {
-  auto size = marked_source.ByteSizeLong();
-  std::vector<char> buffer(size);
-  marked_source.SerializeToArray(buffer.data(), size);
-  stream_->Emit(FactRef{&node_vname, spelling_of(PropertyID::kCode),
-                        absl::string_view(buffer.data(), buffer.size())});
+  marked_source.SerializeToString(&marked_source_buffer_);
+  FactRef fact{&node_vname, spelling_of(PropertyID::kCode),
+               marked_source_buffer_, EncodedFactName(PropertyID::kCode)};
+  if (breakdown_ != nullptr) {
+    breakdown_->CountFact(PropertyID::kCode, fact.fact_value,
+                          DelimitedSize(fact));
+  }
+  stream_->Emit(fact);
 }
 
 void KytheGraphRecorder::AddEdge(const VNameRef& edge_from,
                                  EdgeKindID edge_kind_id,
                                  const VNameRef& edge_to) {
-  stream_->Emit(EdgeRef{&edge_from, spelling_of(edge_kind_id), &edge_to});
+  EdgeRef edge{&edge_from, spelling_of(edge_kind_id), &edge_to,
+               EncodedEdgeKind(edge_kind_id)};
+  if (breakdown_ != nullptr) {
+    breakdown_->CountEdge(edge_kind_id, DelimitedSize(edge));
+  }
+  stream_->Emit(edge);
 }
 
 void KytheGraphRecorder::AddEdge(const VNameRef& edge_from,
                                  EdgeKindID edge_kind_id,
                                  const VNameRef& edge_to, uint32_t ordinal) {
-  stream_->Emit(
-      OrdinalEdgeRef{&edge_from, spelling_of(edge_kind_id), &edge_to, ordinal});
+  OrdinalEdgeRef edge{&edge_from, spelling_of(edge_kind_id), &edge_to,
+                      ordinal};
+  if (breakdown_ != nullptr) {
+    breakdown_->CountEdge(edge_kind_id, DelimitedSize(edge));
+  }
+  stream_->Emit(edge);
+}
+
+void KytheGraphRecorder::AddEdges(const VNameRef& edge_from,
+                                  EdgeKindID edge_kind_id,
+                                  absl::Span<const VNameRef> edges_to,
+                                  uint32_t first_ordinal) {
+  absl::InlinedVector<OrdinalEdgeRef, 8> edges;
+  edges.reserve(edges_to.size());
+  for (const auto& edge_to : edges_to) {
+    edges.push_back(OrdinalEdgeRef{&edge_from, spelling_of(edge_kind_id),
+                                   &edge_to, first_ordinal++});
+    if (breakdown_ != nullptr) {
+      breakdown_->CountEdge(edge_kind_id, DelimitedSize(edges.back()));
+    }
+  }
+  stream_->Emit(absl::MakeConstSpan(edges));
 }
 
 void KytheGraphRecorder::AddFileContent(const VNameRef& file_vname,
                                         absl::string_view file_content) {
-  AddProperty(file_vname, PropertyID::kNodeKind,
-              spelling_of(NodeKindID::kFile));
-  AddProperty(file_vname, PropertyID::kText, file_content);
+  AddProperties(file_vname, {{PropertyID::kNodeKind,
+                              spelling_of(NodeKindID::kFile)},
+                             {PropertyID::kText, file_content}});
 }
 
 }  // namespace kythe
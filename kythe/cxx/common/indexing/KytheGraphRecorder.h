@@ -17,8 +17,13 @@
 #ifndef KYTHE_CXX_COMMON_INDEXING_KYTHE_GRAPH_RECORDER_H_
 #define KYTHE_CXX_COMMON_INDEXING_KYTHE_GRAPH_RECORDER_H_
 
+#include <array>
+#include <cstddef>
+#include <string>
+
 #include "KytheOutputStream.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 
 namespace kythe {
 
@@ -48,6 +53,10 @@ enum class NodeKindID {
   kClangUsr
 };
 
+/// \brief The number of `NodeKindID`s.
+constexpr size_t kNodeKindIDCount =
+    static_cast<size_t>(NodeKindID::kClangUsr) + 1;
+
 /// \brief Known properties of nodes. See the schema for details.
 enum class PropertyID {
   kLocation,
@@ -74,6 +83,10 @@ enum class PropertyID {
   kBuildConfig
 };
 
+/// \brief The number of `PropertyID`s.
+constexpr size_t kPropertyIDCount =
+    static_cast<size_t>(PropertyID::kBuildConfig) + 1;
+
 /// \brief Known edge kinds. See the schema for details.
 enum class EdgeKindID {
   kDefinesFull,
@@ -128,31 +141,207 @@ enum class EdgeKindID {
   kInfluences
 };
 
+/// \brief The number of `EdgeKindID`s.
+constexpr size_t kEdgeKindIDCount =
+    static_cast<size_t>(EdgeKindID::kInfluences) + 1;
+
+/// \brief The spelling of each `NodeKindID`, in order.
+inline constexpr absl::string_view kNodeKindSpellings[kNodeKindIDCount] = {
+    "anchor",
+    "file",
+    "variable",
+    "talias",
+    "tapp",
+    "tnominal",
+    "record",
+    "sum",
+    "constant",
+    "abs",
+    "absvar",
+    "function",
+    "lookup",
+    "macro",
+    "interface",
+    "package",
+    "tsigma",
+    "doc",
+    "tbuiltin",
+    "meta",
+    "diagnostic",
+    "clang/usr",
+};
+
+/// \brief The spelling of each `PropertyID`, in order.
+inline constexpr absl::string_view kPropertySpellings[kPropertyIDCount] = {
+    "/kythe/loc",
+    "/kythe/loc/uri",
+    "/kythe/loc/start",
+    "/kythe/loc/start/row",
+    "/kythe/loc/start",
+    "/kythe/loc/end",
+    "/kythe/loc/end/row",
+    "/kythe/loc/end",
+    "/kythe/text",
+    "/kythe/complete",
+    "/kythe/subkind",
+    "/kythe/node/kind",
+    "/kythe/code",
+    "/kythe/variance",
+    "/kythe/param/default",
+    "/kythe/tag/static",
+    "/kythe/tag/deprecated",
+    "/kythe/message",
+    "/kythe/details",
+    "/kythe/context/url",
+    "/kythe/doc/uri",
+    "/kythe/build/config",
+};
+
+/// \brief The spelling of each `EdgeKindID`, in order.
+inline constexpr absl::string_view kEdgeKindSpellings[kEdgeKindIDCount] = {
+    "/kythe/edge/defines",
+    "/kythe/edge/typed",
+    "/kythe/edge/ref",
+    "/kythe/edge/ref/implicit",
+    "/kythe/edge/ref/imports",
+    "/kythe/edge/param",
+    "/kythe/edge/aliases",
+    "/kythe/edge/aliases/root",
+    "/kythe/edge/completes/uniquely",
+    "/kythe/edge/completes",
+    "/kythe/edge/childof",
+    "/kythe/edge/specializes",
+    "/kythe/edge/ref/call",
+    "/kythe/edge/ref/call/implicit",
+    "/kythe/edge/ref/expands",
+    "/kythe/edge/undefines",
+    "/kythe/edge/ref/includes",
+    "/kythe/edge/ref/queries",
+    "/kythe/edge/instantiates",
+    "/kythe/edge/ref/expands/transitive",
+    "/kythe/edge/extends/public",
+    "/kythe/edge/extends/protected",
+    "/kythe/edge/extends/private",
+    "/kythe/edge/extends",
+    "/kythe/edge/extends/public/virtual",
+    "/kythe/edge/extends/protected/virtual",
+    "/kythe/edge/extends/private/virtual",
+    "/kythe/edge/extends/virtual",
+    "/kythe/edge/extends/category",
+    "/kythe/edge/specializes/speculative",
+    "/kythe/edge/instantiates/speculative",
+    "/kythe/edge/documents",
+    "/kythe/edge/ref/doc",
+    "/kythe/edge/generates",
+    "/kythe/edge/defines/binding",
+    "/kythe/edge/overrides",
+    "/kythe/edge/overrides/root",
+    "/kythe/edge/childof/context",
+    "/kythe/edge/bounded/upper",
+    "/kythe/edge/ref/init",
+    "/kythe/edge/ref/init/implicit",
+    "/kythe/edge/imputes",
+    "/kythe/edge/tagged",
+    "/kythe/edge/property/reads",
+    "/kythe/edge/property/writes",
+    "/clang/usr",
+    "/kythe/edge/ref/id",
+    "/kythe/edge/ref/writes",
+    "/kythe/edge/ref/writes/implicit",
+    "/kythe/edge/influences",
+};
+
+static_assert(!kNodeKindSpellings[kNodeKindIDCount - 1].empty(),
+              "kNodeKindSpellings is missing a kind");
+static_assert(!kPropertySpellings[kPropertyIDCount - 1].empty(),
+              "kPropertySpellings is missing a property");
+static_assert(!kEdgeKindSpellings[kEdgeKindIDCount - 1].empty(),
+              "kEdgeKindSpellings is missing a kind");
+
 /// \brief Returns the Kythe spelling of `node_kind_id`
 ///
 /// ~~~
 /// spelling_of(kAnchor) == "/kythe/anchor"
 /// ~~~
-absl::string_view spelling_of(NodeKindID node_kind_id);
+constexpr absl::string_view spelling_of(NodeKindID node_kind_id) {
+  return kNodeKindSpellings[static_cast<size_t>(node_kind_id)];
+}
 
 /// \brief Returns the Kythe spelling of `property_id`
 ///
 /// ~~~
 /// spelling_of(kLocationUri) == "/kythe/loc/uri"
 /// ~~~
-absl::string_view spelling_of(PropertyID property_id);
+constexpr absl::string_view spelling_of(PropertyID property_id) {
+  return kPropertySpellings[static_cast<size_t>(property_id)];
+}
 
 /// \brief Returns the Kythe spelling of `edge_kind_id`
 ///
 /// ~~~
 /// spelling_of(kDefines) == "/kythe/defines"
 /// ~~~
-absl::string_view spelling_of(EdgeKindID edge_kind_id);
+constexpr absl::string_view spelling_of(EdgeKindID edge_kind_id) {
+  return kEdgeKindSpellings[static_cast<size_t>(edge_kind_id)];
+}
 
 /// Returns true and sets `out_edge` to the enumerator corresponding to
 /// `spelling` (or returns false if there is no such correspondence).
 bool of_spelling(absl::string_view str, EdgeKindID* edge_id);
 
+/// Returns true and sets `node_kind_id` to the enumerator corresponding to
+/// `spelling` (or returns false if there is no such correspondence).
+bool of_spelling(absl::string_view str, NodeKindID* node_kind_id);
+
+/// \brief Counts the entries a `KytheGraphRecorder` records, and their
+/// delimited sizes, by node kind, property and edge kind.
+///
+/// Node kind facts are counted by the kind they set (so they count nodes)
+/// rather than as `PropertyID::kNodeKind`, unless the kind is unknown.
+/// Entries are counted as they're recorded, before any hash cache or entry
+/// filter drops them.
+class EntryBreakdown {
+ public:
+  /// \brief How many entries of some kind were recorded, and how big they
+  /// were.
+  struct Counts {
+    size_t entries = 0;
+    size_t bytes = 0;
+  };
+
+  /// \brief Counts a fact setting `property_id` to `value` that is `bytes`
+  /// long when delimited.
+  void CountFact(PropertyID property_id, absl::string_view value,
+                 size_t bytes);
+  /// \brief Counts an edge of kind `edge_kind_id` that is `bytes` long when
+  /// delimited.
+  void CountEdge(EdgeKindID edge_kind_id, size_t bytes);
+
+  const Counts& node_kind(NodeKindID id) const {
+    return node_kinds_[static_cast<size_t>(id)];
+  }
+  const Counts& property(PropertyID id) const {
+    return properties_[static_cast<size_t>(id)];
+  }
+  const Counts& edge_kind(EdgeKindID id) const {
+    return edge_kinds_[static_cast<size_t>(id)];
+  }
+  /// \return the counts of every entry recorded.
+  Counts total() const;
+
+  /// \brief Adds `other`'s counts to these.
+  void Merge(const EntryBreakdown& other);
+
+  /// \return a table of the nonzero counts, largest first, with one row
+  /// per line.
+  std::string ToString() const;
+
+ private:
+  std::array<Counts, kNodeKindIDCount> node_kinds_;
+  std::array<Counts, kPropertyIDCount> properties_;
+  std::array<Counts, kEdgeKindIDCount> edge_kinds_;
+};
+
 /// \brief Records Kythe nodes and edges to a provided `KytheOutputStream`.
 class KytheGraphRecorder {
  public:
@@ -162,6 +351,10 @@ class KytheGraphRecorder {
     assert(stream_ != nullptr);
   }
 
+  /// \brief Counts every entry recorded from now on in `breakdown`, if it's
+  /// not null.
+  void set_breakdown(EntryBreakdown* breakdown) { breakdown_ = breakdown; }
+
   /// \brief Record a property about a node.
   ///
   /// \param node_vname The vname of the node to modify.
@@ -170,6 +363,19 @@ class KytheGraphRecorder {
   void AddProperty(const VNameRef& node_vname, PropertyID property_id,
                    absl::string_view property_value);
 
+  /// \brief A property to record with `AddProperties`.
+  struct Property {
+    PropertyID id;
+    absl::string_view value;
+  };
+
+  /// \brief Record several properties about a node at once.
+  ///
+  /// \param node_vname The vname of the node to modify.
+  /// \param properties The properties to record, in order.
+  void AddProperties(const VNameRef& node_vname,
+                     absl::Span<const Property> properties);
+
   /// \brief Record a node's marked source.
   ///
   /// \param node_vname The vname of the node to modify.
@@ -206,6 +412,17 @@ class KytheGraphRecorder {
   void AddEdge(const VNameRef& edge_from, EdgeKindID edge_kind_id,
                const VNameRef& edge_to, uint32_t edge_ordinal);
 
+  /// \brief Records edges of one kind from a node to each of several nodes,
+  /// with consecutive ordinals.
+  ///
+  /// \param edge_from The `VNameRef` of the node at which the edges start.
+  /// \param edge_kind_id The `EdgeKindID` of the edges.
+  /// \param edges_to The `VNameRef`s of the nodes at which the edges
+  /// terminate.
+  /// \param first_ordinal The ordinal of the edge to `edges_to[0]`.
+  void AddEdges(const VNameRef& edge_from, EdgeKindID edge_kind_id,
+                absl::Span<const VNameRef> edges_to, uint32_t first_ordinal);
+
   /// \brief Records the content of a file that was visited during compilation.
   /// \param file_vname The file's vname.
   /// \param file_content The buffer of this file's content.
@@ -225,6 +442,11 @@ class KytheGraphRecorder {
  private:
   /// The `KytheOutputStream` to which new graph elements are written.
   KytheOutputStream* stream_;
+  /// Counts the entries we record, or null.
+  EntryBreakdown* breakdown_ = nullptr;
+  /// Holds the most recent marked source while it is emitted, so that each
+  /// one doesn't need a buffer of its own.
+  std::string marked_source_buffer_;
 };
 
 }  // namespace kythe
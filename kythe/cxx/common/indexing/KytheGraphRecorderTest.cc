@@ -0,0 +1,182 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
+
+#include <string>
+
+#include "absl/strings/match.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/indexing/RecordingOutputStream.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+TEST(KytheGraphRecorderTest, NodeKindsRoundTripThroughSpellings) {
+  for (size_t i = 0; i < kNodeKindIDCount; ++i) {
+    NodeKindID node_kind_id;
+    ASSERT_TRUE(of_spelling(spelling_of(static_cast<NodeKindID>(i)),
+                            &node_kind_id));
+    EXPECT_EQ(i, static_cast<size_t>(node_kind_id));
+  }
+  NodeKindID node_kind_id;
+  EXPECT_FALSE(of_spelling("not-a-kind", &node_kind_id));
+}
+
+static_assert(spelling_of(EdgeKindID::kRef) == "/kythe/edge/ref",
+              "spellings should be usable at compile time");
+
+TEST(KytheGraphRecorderTest, EdgesAndFactsSerializeAsTheirSpellings) {
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    FileOutputStream output(&stream);
+    KytheGraphRecorder recorder(&output);
+    proto::VName node;
+    node.set_signature("node");
+    for (size_t i = 0; i < kEdgeKindIDCount; ++i) {
+      recorder.AddEdge(VNameRef(node), static_cast<EdgeKindID>(i),
+                       VNameRef(node));
+    }
+    for (size_t i = 0; i < kPropertyIDCount; ++i) {
+      recorder.AddProperty(VNameRef(node), static_cast<PropertyID>(i),
+                           "value");
+    }
+  }
+  google::protobuf::io::ArrayInputStream input(data.data(), data.size());
+  google::protobuf::io::CodedInputStream coded(&input);
+  for (size_t i = 0; i < kEdgeKindIDCount + kPropertyIDCount; ++i) {
+    uint32_t size;
+    ASSERT_TRUE(coded.ReadVarint32(&size));
+    std::string entry_data;
+    ASSERT_TRUE(coded.ReadString(&entry_data, size));
+    proto::Entry entry;
+    ASSERT_TRUE(entry.ParseFromString(entry_data));
+    if (i < kEdgeKindIDCount) {
+      EXPECT_EQ(spelling_of(static_cast<EdgeKindID>(i)), entry.edge_kind());
+      EXPECT_EQ("/", entry.fact_name());
+    } else {
+      EXPECT_EQ(spelling_of(static_cast<PropertyID>(i - kEdgeKindIDCount)),
+                entry.fact_name());
+    }
+  }
+}
+
+TEST(KytheGraphRecorderTest, EmitsEachMarkedSource) {
+  RecordingOutputStream stream;
+  KytheGraphRecorder recorder(&stream);
+  proto::VName node;
+  node.set_signature("node");
+  MarkedSource long_source;
+  long_source.set_kind(MarkedSource::IDENTIFIER);
+  long_source.set_pre_text(std::string(100, 'x'));
+  MarkedSource short_source;
+  short_source.set_kind(MarkedSource::IDENTIFIER);
+  short_source.set_pre_text("y");
+  recorder.AddMarkedSource(VNameRef(node), long_source);
+  recorder.AddMarkedSource(VNameRef(node), short_source);
+  ASSERT_EQ(2, stream.entries().size());
+  for (const auto& entry : stream.entries()) {
+    EXPECT_EQ("/kythe/code", entry.fact_name());
+  }
+  MarkedSource parsed;
+  ASSERT_TRUE(parsed.ParseFromString(stream.entries()[0].fact_value()));
+  EXPECT_EQ(long_source.pre_text(), parsed.pre_text());
+  ASSERT_TRUE(parsed.ParseFromString(stream.entries()[1].fact_value()));
+  EXPECT_EQ("y", parsed.pre_text());
+}
+
+class EntryBreakdownTest : public ::testing::Test {
+ protected:
+  EntryBreakdownTest() {
+    node_.set_signature("node");
+    param_.set_signature("param");
+  }
+
+  /// \brief Records a small graph to `recorder`.
+  void RecordGraph(KytheGraphRecorder* recorder) {
+    VNameRef node(node_);
+    VNameRef param(param_);
+    recorder->AddProperty(node, NodeKindID::kFunction);
+    recorder->AddProperty(param, NodeKindID::kVariable);
+    recorder->AddProperty(node, PropertyID::kNodeKind, "not-a-kind");
+    recorder->AddProperties(node, {{PropertyID::kComplete, "definition"},
+                                   {PropertyID::kText, "text"}});
+    recorder->AddEdge(param, EdgeKindID::kChildOf, node);
+    recorder->AddEdge(node, EdgeKindID::kParam, param, 0);
+    recorder->AddEdges(node, EdgeKindID::kParam, {param, param}, 1);
+    recorder->AddFileContent(node, "contents");
+  }
+
+  proto::VName node_;
+  proto::VName param_;
+};
+
+TEST_F(EntryBreakdownTest, CountsEntriesByKind) {
+  EntryBreakdown breakdown;
+  NullOutputStream stream;
+  KytheGraphRecorder recorder(&stream);
+  recorder.set_breakdown(&breakdown);
+  RecordGraph(&recorder);
+  EXPECT_EQ(1, breakdown.node_kind(NodeKindID::kFunction).entries);
+  EXPECT_EQ(1, breakdown.node_kind(NodeKindID::kVariable).entries);
+  EXPECT_EQ(1, breakdown.node_kind(NodeKindID::kFile).entries);
+  EXPECT_EQ(1, breakdown.property(PropertyID::kNodeKind).entries);
+  EXPECT_EQ(1, breakdown.property(PropertyID::kComplete).entries);
+  EXPECT_EQ(2, breakdown.property(PropertyID::kText).entries);
+  EXPECT_EQ(1, breakdown.edge_kind(EdgeKindID::kChildOf).entries);
+  EXPECT_EQ(3, breakdown.edge_kind(EdgeKindID::kParam).entries);
+  EXPECT_EQ(11, breakdown.total().entries);
+}
+
+TEST_F(EntryBreakdownTest, CountsDelimitedBytes) {
+  EntryBreakdown breakdown;
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream stream(&output);
+    FileOutputStream file_stream(&stream);
+    KytheGraphRecorder recorder(&file_stream);
+    recorder.set_breakdown(&breakdown);
+    RecordGraph(&recorder);
+  }
+  EXPECT_EQ(output.size(), breakdown.total().bytes);
+}
+
+TEST_F(EntryBreakdownTest, MergesAndPrintsCounts) {
+  EntryBreakdown breakdown;
+  NullOutputStream stream;
+  KytheGraphRecorder recorder(&stream);
+  recorder.set_breakdown(&breakdown);
+  RecordGraph(&recorder);
+  EntryBreakdown merged;
+  merged.Merge(breakdown);
+  merged.Merge(breakdown);
+  EXPECT_EQ(2 * breakdown.total().entries, merged.total().entries);
+  EXPECT_EQ(2 * breakdown.total().bytes, merged.total().bytes);
+  const std::string table = breakdown.ToString();
+  EXPECT_TRUE(absl::StrContains(table, "/kythe/node/kind function\n"));
+  EXPECT_TRUE(absl::StrContains(table, "/kythe/edge/param\n"));
+  EXPECT_TRUE(absl::StrContains(table, "  total\n"));
+  EXPECT_FALSE(absl::StrContains(table, "/kythe/edge/defines"));
+}
+
+}  // namespace
+}  // namespace kythe
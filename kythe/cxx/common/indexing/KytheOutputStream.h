@@ -20,6 +20,7 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/string_view.h"
+#include "absl/types/span.h"
 #include "kythe/proto/common.pb.h"
 #include "kythe/proto/storage.pb.h"
 
@@ -72,6 +73,10 @@ struct FactRef {
   const VNameRef* source;
   absl::string_view fact_name;
   absl::string_view fact_value;
+  /// `fact_name` as `EntryWireFormat::EncodeFactName` serializes it, or
+  /// empty. Streams that serialize entries may copy this instead of
+  /// encoding the name.
+  absl::string_view encoded_fact_name = {};
   /// Overwrites all of the fields in `entry` that can differ between single
   /// facts.
   void Expand(proto::Entry* entry) const {
@@ -85,6 +90,10 @@ struct EdgeRef {
   const VNameRef* source;
   absl::string_view edge_kind;
   const VNameRef* target;
+  /// `edge_kind` as `EntryWireFormat::EncodeEdgeKind` serializes it, or
+  /// empty. Streams that serialize entries may copy this instead of
+  /// encoding the kind.
+  absl::string_view encoded_edge_kind = {};
   /// Overwrites all of the fields in `entry` that can differ between edges
   /// without ordinals.
   void Expand(proto::Entry* entry) const {
@@ -115,6 +124,26 @@ class KytheOutputStream {
   virtual void Emit(const FactRef& fact) = 0;
   virtual void Emit(const EdgeRef& edge) = 0;
   virtual void Emit(const OrdinalEdgeRef& edge) = 0;
+  /// Emit each of `facts` in order. Streams that can do better than one
+  /// call per entry (say, by reserving space for all of them at once)
+  /// should override this.
+  virtual void Emit(absl::Span<const FactRef> facts) {
+    for (const auto& fact : facts) {
+      Emit(fact);
+    }
+  }
+  /// \copydoc Emit(absl::Span<const FactRef>)
+  virtual void Emit(absl::Span<const EdgeRef> edges) {
+    for (const auto& edge : edges) {
+      Emit(edge);
+    }
+  }
+  /// \copydoc Emit(absl::Span<const FactRef>)
+  virtual void Emit(absl::Span<const OrdinalEdgeRef> edges) {
+    for (const auto& edge : edges) {
+      Emit(edge);
+    }
+  }
   /// Add a buffer to the buffer stack to group facts, edges, and buffers
   /// together.
   virtual void PushBuffer() {}
@@ -18,6 +18,7 @@
 
 #include <libmemcached-1.0/memcached.h>
 
+#include <cstring>
 #include <iostream>
 
 namespace kythe {
@@ -37,8 +38,25 @@ bool MemcachedHashCache::OpenMemcache(const std::string& spec) {
   return false;
 }
 
+bool MemcachedHashCache::UsePipelinedAdds() {
+  if (!cache_) {
+    return false;
+  }
+  if (!memcached_success(memcached_behavior_set(
+          cache_, MEMCACHED_BEHAVIOR_NOREPLY, 1)) ||
+      !memcached_success(memcached_behavior_set(
+          cache_, MEMCACHED_BEHAVIOR_BUFFER_REQUESTS, 1))) {
+    return false;
+  }
+  pipelined_ = true;
+  return true;
+}
+
 MemcachedHashCache::~MemcachedHashCache() {
   if (cache_) {
+    if (pipelined_) {
+      memcached_flush_buffers(cache_);
+    }
     memcached_free(cache_);
     cache_ = nullptr;
   }
@@ -52,7 +70,8 @@ void MemcachedHashCache::RegisterHash(const Hash& hash) {
   memcached_return_t add_result =
       memcached_add(cache_, reinterpret_cast<const char*>(hash), kHashSize,
                     &value, sizeof(value), 0, 0);
-  if (!memcached_success(add_result) && add_result != MEMCACHED_DATA_EXISTS) {
+  if (!memcached_success(add_result) && add_result != MEMCACHED_DATA_EXISTS &&
+      add_result != MEMCACHED_BUFFERED) {
     std::cerr << "memcached add failed: "
               << memcached_strerror(cache_, add_result) << "\n";
   }
@@ -62,6 +81,9 @@ bool MemcachedHashCache::SawHash(const Hash& hash) {
   if (!cache_) {
     return false;
   }
+  if (pipelined_) {
+    memcached_flush_buffers(cache_);
+  }
   memcached_return_t ex_result =
       memcached_exist(cache_, reinterpret_cast<const char*>(hash), kHashSize);
   if (ex_result == MEMCACHED_SUCCESS) {
@@ -73,4 +95,48 @@ bool MemcachedHashCache::SawHash(const Hash& hash) {
   return false;
 }
 
+void MemcachedHashCache::SawHashes(absl::Span<const Hash* const> hashes,
+                                   std::vector<bool>* seen) {
+  seen->assign(hashes.size(), false);
+  if (!cache_ || hashes.empty()) {
+    return;
+  }
+  if (pipelined_) {
+    memcached_flush_buffers(cache_);
+  }
+  keys_.clear();
+  key_lengths_.clear();
+  for (const Hash* hash : hashes) {
+    keys_.push_back(reinterpret_cast<const char*>(*hash));
+    key_lengths_.push_back(kHashSize);
+  }
+  memcached_return_t get_result =
+      memcached_mget(cache_, keys_.data(), key_lengths_.data(), keys_.size());
+  if (!memcached_success(get_result)) {
+    std::cerr << "memcached mget failed: "
+              << memcached_strerror(cache_, get_result) << "\n";
+    return;
+  }
+  memcached_result_st* result;
+  memcached_return_t fetch_result;
+  while ((result = memcached_fetch_result(cache_, nullptr, &fetch_result)) !=
+         nullptr) {
+    if (memcached_result_key_length(result) == kHashSize) {
+      const char* key = memcached_result_key_value(result);
+      // Batches are small, and the same hash may appear more than once.
+      for (size_t i = 0; i < hashes.size(); ++i) {
+        if (!memcmp(key, *hashes[i], kHashSize)) {
+          (*seen)[i] = true;
+        }
+      }
+    }
+    memcached_result_free(result);
+  }
+  if (!memcached_success(fetch_result) && fetch_result != MEMCACHED_END &&
+      fetch_result != MEMCACHED_NOTFOUND) {
+    std::cerr << "memcached fetch failed: "
+              << memcached_strerror(cache_, fetch_result) << "\n";
+  }
+}
+
 }  // namespace kythe
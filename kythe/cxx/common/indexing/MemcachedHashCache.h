@@ -18,6 +18,7 @@
 #define KYTHE_CXX_COMMON_INDEXING_MEMCACHEDHASHCACHE_H_
 
 #include <string>
+#include <vector>
 
 #include "kythe/cxx/common/indexing/KytheCachingOutput.h"
 
@@ -39,8 +40,26 @@ class MemcachedHashCache : public HashCache {
 
   bool SawHash(const Hash& hash) override;
 
+  /// \brief Looks up `hashes` with a single multi-get.
+  void SawHashes(absl::Span<const Hash* const> hashes,
+                 std::vector<bool>* seen) override;
+
+  /// \brief Sends `RegisterHash` adds without waiting for replies.
+  ///
+  /// Adds are buffered and sent with the next lookup (or when the buffer
+  /// fills), so they cost no round trips of their own. Failures are not
+  /// reported; a lost add only means a buffer may be written again.
+  /// Must be called after `OpenMemcache`.
+  /// \return false if the connection doesn't support this.
+  bool UsePipelinedAdds();
+
  private:
   ::memcached_st* cache_ = nullptr;
+  /// Whether adds are sent without waiting for replies.
+  bool pipelined_ = false;
+  /// Scratch space for multi-gets.
+  std::vector<const char*> keys_;
+  std::vector<size_t> key_lengths_;
 };
 
 }  // namespace kythe
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/Murmur3Hasher.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace kythe {
+namespace {
+
+constexpr uint64_t kC1 = 0x87c37b91114253d5ULL;
+constexpr uint64_t kC2 = 0x4cf5ad432745937fULL;
+
+inline uint64_t Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+/// \brief Loads a little-endian 64-bit word from `data`.
+inline uint64_t Load64(const unsigned char* data) {
+  uint64_t value;
+  ::memcpy(&value, data, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+/// \brief Loads `size` (<= 8) little-endian bytes from `data`.
+inline uint64_t LoadPartial(const unsigned char* data, size_t size) {
+  uint64_t value = 0;
+  for (size_t i = size; i > 0; --i) {
+    value = (value << 8) | data[i - 1];
+  }
+  return value;
+}
+
+inline void StoreLittleEndian(uint64_t value, unsigned char* out) {
+  for (size_t i = 0; i < 8; ++i) {
+    out[i] = static_cast<unsigned char>(value >> (8 * i));
+  }
+}
+
+inline uint64_t FinalMix(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+}  // anonymous namespace
+
+void Murmur3Hasher::MixBlock(const unsigned char* block) {
+  uint64_t k1 = Load64(block);
+  uint64_t k2 = Load64(block + 8);
+  k1 *= kC1;
+  k1 = Rotl(k1, 31);
+  k1 *= kC2;
+  h1_ ^= k1;
+  h1_ = Rotl(h1_, 27);
+  h1_ += h2_;
+  h1_ = h1_ * 5 + 0x52dce729;
+  k2 *= kC2;
+  k2 = Rotl(k2, 33);
+  k2 *= kC1;
+  h2_ ^= k2;
+  h2_ = Rotl(h2_, 31);
+  h2_ += h1_;
+  h2_ = h2_ * 5 + 0x38495ab5;
+}
+
+void Murmur3Hasher::Update(const void* data, size_t size) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  length_ += size;
+  if (tail_size_ != 0) {
+    size_t copied = std::min(size, sizeof(tail_) - tail_size_);
+    ::memcpy(tail_ + tail_size_, bytes, copied);
+    tail_size_ += copied;
+    bytes += copied;
+    size -= copied;
+    if (tail_size_ < sizeof(tail_)) {
+      return;
+    }
+    MixBlock(tail_);
+    tail_size_ = 0;
+  }
+  for (; size >= sizeof(tail_); bytes += sizeof(tail_), size -= sizeof(tail_)) {
+    MixBlock(bytes);
+  }
+  ::memcpy(tail_, bytes, size);
+  tail_size_ = size;
+}
+
+void Murmur3Hasher::Finish(unsigned char out[kHashSize]) {
+  if (tail_size_ > 8) {
+    uint64_t k2 = LoadPartial(tail_ + 8, tail_size_ - 8);
+    k2 *= kC2;
+    k2 = Rotl(k2, 33);
+    k2 *= kC1;
+    h2_ ^= k2;
+  }
+  if (tail_size_ > 0) {
+    uint64_t k1 = LoadPartial(tail_, std::min<size_t>(tail_size_, 8));
+    k1 *= kC1;
+    k1 = Rotl(k1, 31);
+    k1 *= kC2;
+    h1_ ^= k1;
+  }
+  h1_ ^= length_;
+  h2_ ^= length_;
+  h1_ += h2_;
+  h2_ += h1_;
+  h1_ = FinalMix(h1_);
+  h2_ = FinalMix(h2_);
+  h1_ += h2_;
+  h2_ += h1_;
+  StoreLittleEndian(h1_, out);
+  StoreLittleEndian(h2_, out + 8);
+}
+
+}  // namespace kythe
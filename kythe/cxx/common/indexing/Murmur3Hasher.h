@@ -0,0 +1,59 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_MURMUR3_HASHER_H_
+#define KYTHE_CXX_COMMON_INDEXING_MURMUR3_HASHER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace kythe {
+
+/// \brief Incrementally computes the 128-bit x64 variant of MurmurHash3.
+///
+/// Feeding data through several calls to `Update` produces the same hash as
+/// passing its concatenation to the reference `MurmurHash3_x64_128` with a
+/// seed of 0. The hash is not cryptographic, but it is stable across
+/// processes and machines.
+class Murmur3Hasher {
+ public:
+  /// The size of the hash in bytes.
+  static constexpr size_t kHashSize = 16;
+
+  /// \brief Hashes `size` more bytes at `data`.
+  void Update(const void* data, size_t size);
+
+  /// \brief Writes the hash of all the data passed to `Update` to `out` in
+  /// the reference implementation's byte order.
+  void Finish(unsigned char out[kHashSize]);
+
+ private:
+  /// \brief Mixes the 16-byte block at `block` into the state.
+  void MixBlock(const unsigned char* block);
+
+  uint64_t h1_ = 0;
+  uint64_t h2_ = 0;
+  /// The total number of bytes passed to `Update`.
+  uint64_t length_ = 0;
+  /// Bytes that haven't yet filled a block.
+  unsigned char tail_[16];
+  /// The number of bytes used in `tail_`.
+  size_t tail_size_ = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_MURMUR3_HASHER_H_
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/Murmur3Hasher.h"
+
+#include <string>
+
+#include "absl/strings/escaping.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+std::string HashInPieces(absl::string_view data, size_t piece_size) {
+  Murmur3Hasher hasher;
+  for (size_t i = 0; i < data.size(); i += piece_size) {
+    absl::string_view piece = data.substr(i, piece_size);
+    hasher.Update(piece.data(), piece.size());
+  }
+  unsigned char hash[Murmur3Hasher::kHashSize];
+  hasher.Finish(hash);
+  return absl::BytesToHexString(
+      absl::string_view(reinterpret_cast<const char*>(hash), sizeof(hash)));
+}
+
+TEST(Murmur3HasherTest, MatchesReferenceVectors) {
+  EXPECT_EQ("00000000000000000000000000000000", HashInPieces("", 1));
+  EXPECT_EQ("029bbd41b3a7d8cb191dae486a901e5b", HashInPieces("hello", 5));
+  EXPECT_EQ("6c1b07bc7bbc4be347939ac4a93c437a",
+            HashInPieces("The quick brown fox jumps over the lazy dog", 43));
+}
+
+TEST(Murmur3HasherTest, PiecesDoNotMatter) {
+  std::string data;
+  for (int i = 0; i < 768; ++i) {
+    data.push_back(static_cast<char>(i % 256));
+  }
+  for (size_t piece_size : {1, 3, 7, 15, 16, 17, 100, 768}) {
+    EXPECT_EQ("b626b903306c92cf3846f3e2e5d953fa",
+              HashInPieces(data, piece_size))
+        << piece_size;
+  }
+}
+
+}  // namespace
+}  // namespace kythe
@@ -44,6 +44,25 @@ class RecordingOutputStream : public KytheOutputStream {
     Emit(entry);
   }
 
+  void Emit(absl::Span<const FactRef> facts) override {
+    entries_.reserve(entries_.size() + facts.size());
+    for (const auto& fact : facts) {
+      Emit(fact);
+    }
+  }
+  void Emit(absl::Span<const EdgeRef> edges) override {
+    entries_.reserve(entries_.size() + edges.size());
+    for (const auto& edge : edges) {
+      Emit(edge);
+    }
+  }
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override {
+    entries_.reserve(entries_.size() + edges.size());
+    for (const auto& edge : edges) {
+      Emit(edge);
+    }
+  }
+
   /// \brief All entries that were emitted to this stream, in order.
   const std::vector<kythe::proto::Entry>& entries() const { return entries_; }
 
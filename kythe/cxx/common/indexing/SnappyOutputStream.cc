@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/SnappyOutputStream.h"
+
+#include <array>
+
+#include "glog/logging.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "snappy.h"
+
+namespace kythe {
+namespace {
+
+/// Chunk types from the framing format.
+constexpr unsigned char kCompressedChunk = 0x00;
+constexpr unsigned char kUncompressedChunk = 0x01;
+/// The stream identifier chunk that starts every stream.
+constexpr char kStreamIdentifier[] = "\xff\x06\x00\x00sNaPpY";
+
+/// \brief Builds the lookup table for the Castagnoli polynomial.
+std::array<uint32_t, 256> MakeCrc32cTable() {
+  std::array<uint32_t, 256> table;
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+}  // anonymous namespace
+
+uint32_t SnappyOutputStream::MaskedCrc32c(absl::string_view data) {
+  static const std::array<uint32_t, 256> table = MakeCrc32cTable();
+  uint32_t crc = 0xffffffff;
+  for (unsigned char c : data) {
+    crc = table[(crc ^ c) & 0xff] ^ (crc >> 8);
+  }
+  crc ^= 0xffffffff;
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8;
+}
+
+SnappyOutputStream::SnappyOutputStream(
+    google::protobuf::io::FileOutputStream* sink)
+    : SnappyOutputStream(sink, sink, nullptr) {}
+
+SnappyOutputStream::SnappyOutputStream(AsyncOutputStream* sink)
+    : SnappyOutputStream(sink, nullptr, sink) {}
+
+SnappyOutputStream::SnappyOutputStream(
+    google::protobuf::io::ZeroCopyOutputStream* sink)
+    : SnappyOutputStream(sink, nullptr, nullptr) {}
+
+SnappyOutputStream::SnappyOutputStream(
+    google::protobuf::io::ZeroCopyOutputStream* sink,
+    google::protobuf::io::FileOutputStream* file_sink,
+    AsyncOutputStream* async_sink)
+    : sink_(CHECK_NOTNULL(sink)),
+      file_sink_(file_sink),
+      async_sink_(async_sink),
+      pending_data_(new char[kMaxChunkSize]) {
+  google::protobuf::io::CodedOutputStream coded_stream(sink_);
+  coded_stream.WriteRaw(kStreamIdentifier, sizeof(kStreamIdentifier) - 1);
+}
+
+SnappyOutputStream::~SnappyOutputStream() { EndFrame(); }
+
+bool SnappyOutputStream::Next(void** data, int* size) {
+  if (pending_used_ == kMaxChunkSize) {
+    EndFrame();
+  }
+  *data = pending_data_.get() + pending_used_;
+  *size = static_cast<int>(kMaxChunkSize - pending_used_);
+  pending_used_ = kMaxChunkSize;
+  byte_count_ += *size;
+  return true;
+}
+
+void SnappyOutputStream::BackUp(int count) {
+  CHECK_LE(static_cast<size_t>(count), pending_used_);
+  pending_used_ -= count;
+  byte_count_ -= count;
+}
+
+void SnappyOutputStream::EndFrame() {
+  if (pending_used_ == 0) {
+    return;
+  }
+  absl::string_view uncompressed(pending_data_.get(), pending_used_);
+  uint32_t crc = MaskedCrc32c(uncompressed);
+  compressed_.resize(snappy::MaxCompressedLength(uncompressed.size()));
+  size_t compressed_size;
+  snappy::RawCompress(uncompressed.data(), uncompressed.size(),
+                      &compressed_[0], &compressed_size);
+  // As recommended by the framing format, store data that doesn't compress
+  // by at least 12.5% as is.
+  if (compressed_size < uncompressed.size() - uncompressed.size() / 8) {
+    WriteChunk(kCompressedChunk, crc,
+               absl::string_view(compressed_.data(), compressed_size));
+  } else {
+    WriteChunk(kUncompressedChunk, crc, uncompressed);
+  }
+  pending_used_ = 0;
+}
+
+void SnappyOutputStream::WriteChunk(unsigned char type, uint32_t crc,
+                                    absl::string_view data) {
+  uint32_t length = data.size() + sizeof(crc);
+  unsigned char header[8] = {type,
+                             static_cast<unsigned char>(length),
+                             static_cast<unsigned char>(length >> 8),
+                             static_cast<unsigned char>(length >> 16),
+                             static_cast<unsigned char>(crc),
+                             static_cast<unsigned char>(crc >> 8),
+                             static_cast<unsigned char>(crc >> 16),
+                             static_cast<unsigned char>(crc >> 24)};
+  google::protobuf::io::CodedOutputStream coded_stream(sink_);
+  coded_stream.WriteRaw(header, sizeof(header));
+  coded_stream.WriteRaw(data.data(), data.size());
+}
+
+void SnappyOutputStream::Flush() {
+  EndFrame();
+  if (file_sink_ != nullptr) {
+    file_sink_->Flush();
+  } else if (async_sink_ != nullptr) {
+    async_sink_->Sync();
+  }
+}
+
+}  // namespace kythe
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_SNAPPY_OUTPUT_STREAM_H_
+#define KYTHE_CXX_COMMON_INDEXING_SNAPPY_OUTPUT_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/indexing/AsyncOutputStream.h"
+
+namespace kythe {
+
+/// \brief A `ZeroCopyOutputStream` that compresses its output using the
+/// snappy framing format.
+///
+/// See https://github.com/google/snappy/blob/master/framing_format.txt.
+/// Data is compressed as chunks of at most 64KiB. `EndFrame` ends the
+/// current chunk early so that callers can line chunks up with their own
+/// record boundaries. The output can be read with any framed snappy reader
+/// (e.g., Go's `snappy.NewReader`).
+class SnappyOutputStream : public google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  /// \param sink The stream to write compressed chunks to.
+  explicit SnappyOutputStream(google::protobuf::io::FileOutputStream* sink);
+  /// \copydoc SnappyOutputStream(google::protobuf::io::FileOutputStream*)
+  explicit SnappyOutputStream(AsyncOutputStream* sink);
+  /// \brief Writes to an arbitrary `ZeroCopyOutputStream`, which is never
+  /// flushed.
+  explicit SnappyOutputStream(google::protobuf::io::ZeroCopyOutputStream* sink);
+  SnappyOutputStream(const SnappyOutputStream&) = delete;
+  SnappyOutputStream& operator=(const SnappyOutputStream&) = delete;
+
+  /// \brief Ends the current chunk.
+  ~SnappyOutputStream() override;
+
+  bool Next(void** data, int* size) override;
+  void BackUp(int count) override;
+  google::protobuf::int64 ByteCount() const override { return byte_count_; }
+
+  /// \brief Compresses any pending data as a chunk of its own.
+  void EndFrame();
+
+  /// \brief Ends the current chunk and flushes the sink. If the sink is an
+  /// `AsyncOutputStream`, waits for its writer to catch up.
+  void Flush();
+
+  /// \return `data`'s CRC-32C, masked as the framing format requires.
+  static uint32_t MaskedCrc32c(absl::string_view data);
+
+  /// The most uncompressed data that may be stored in one chunk.
+  static constexpr size_t kMaxChunkSize = 65536;
+
+ private:
+  SnappyOutputStream(google::protobuf::io::ZeroCopyOutputStream* sink,
+                     google::protobuf::io::FileOutputStream* file_sink,
+                     AsyncOutputStream* async_sink);
+
+  /// \brief Writes a chunk header of `type` followed by `data`.
+  void WriteChunk(unsigned char type, uint32_t crc, absl::string_view data);
+
+  /// The stream we write compressed chunks to.
+  google::protobuf::io::ZeroCopyOutputStream* sink_;
+  /// `sink_`, if it's a `FileOutputStream`; otherwise null.
+  google::protobuf::io::FileOutputStream* file_sink_;
+  /// `sink_`, if it's an `AsyncOutputStream`; otherwise null.
+  AsyncOutputStream* async_sink_;
+  /// Uncompressed data for the current chunk.
+  std::unique_ptr<char[]> pending_data_;
+  /// The bytes of `pending_data_` in use (including any last handed out
+  /// by `Next`).
+  size_t pending_used_ = 0;
+  /// Scratch space for compressed chunks.
+  std::string compressed_;
+  /// The total number of uncompressed bytes handed out by `Next` less those
+  /// returned by `BackUp`.
+  google::protobuf::int64 byte_count_ = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_SNAPPY_OUTPUT_STREAM_H_
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/indexing/SnappyOutputStream.h"
+
+#include <string>
+#include <vector>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "snappy.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Decodes a framed snappy stream into its chunks' contents.
+std::vector<std::string> DecodeChunks(const std::string& stream) {
+  std::vector<std::string> chunks;
+  const std::string kHeader("\xff\x06\x00\x00sNaPpY", 10);
+  EXPECT_EQ(kHeader, stream.substr(0, kHeader.size()));
+  size_t pos = kHeader.size();
+  while (pos + 8 <= stream.size()) {
+    auto byte = [&](size_t i) -> uint32_t {
+      return static_cast<unsigned char>(stream[pos + i]);
+    };
+    uint32_t type = byte(0);
+    uint32_t length = byte(1) | byte(2) << 8 | byte(3) << 16;
+    uint32_t crc = byte(4) | byte(5) << 8 | byte(6) << 16 | byte(7) << 24;
+    std::string data = stream.substr(pos + 8, length - 4);
+    pos += 4 + length;
+    std::string chunk;
+    if (type == 0x00) {
+      EXPECT_TRUE(snappy::Uncompress(data.data(), data.size(), &chunk));
+    } else {
+      EXPECT_EQ(0x01, type);
+      chunk = data;
+    }
+    EXPECT_LE(chunk.size(), SnappyOutputStream::kMaxChunkSize);
+    EXPECT_EQ(SnappyOutputStream::MaskedCrc32c(chunk), crc);
+    chunks.push_back(chunk);
+  }
+  EXPECT_EQ(stream.size(), pos);
+  return chunks;
+}
+
+void Write(google::protobuf::io::ZeroCopyOutputStream* stream,
+           const std::string& data) {
+  google::protobuf::io::CodedOutputStream coded_stream(stream);
+  coded_stream.WriteRaw(data.data(), data.size());
+}
+
+TEST(SnappyOutputStreamTest, MaskedCrc32c) {
+  EXPECT_EQ(0xc78ab0e5, SnappyOutputStream::MaskedCrc32c("123456789"));
+}
+
+TEST(SnappyOutputStreamTest, EmptyStreamHasOnlyIdentifier) {
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream sink(&output);
+    SnappyOutputStream stream(&sink);
+  }
+  EXPECT_TRUE(DecodeChunks(output).empty());
+}
+
+TEST(SnappyOutputStreamTest, SplitsLargeWrites) {
+  std::string data;
+  for (int i = 0; i < 20000; ++i) {
+    data += std::to_string(i * 7919 % 10007);
+  }
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream sink(&output);
+    SnappyOutputStream stream(&sink);
+    for (size_t i = 0; i < data.size(); i += 1000) {
+      Write(&stream, data.substr(i, 1000));
+    }
+    EXPECT_EQ(data.size(), stream.ByteCount());
+  }
+  auto chunks = DecodeChunks(output);
+  EXPECT_LT(1, chunks.size());
+  std::string joined;
+  for (const auto& chunk : chunks) {
+    joined += chunk;
+  }
+  EXPECT_EQ(data, joined);
+}
+
+TEST(SnappyOutputStreamTest, EndFrameEndsChunks) {
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream sink(&output);
+    SnappyOutputStream stream(&sink);
+    Write(&stream, "abc");
+    stream.EndFrame();
+    stream.EndFrame();
+    Write(&stream, "def");
+  }
+  EXPECT_EQ(std::vector<std::string>({"abc", "def"}), DecodeChunks(output));
+}
+
+TEST(SnappyOutputStreamTest, CompressesRepetitiveData) {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data += "/kythe/edge/childof";
+  }
+  std::string output;
+  {
+    google::protobuf::io::StringOutputStream sink(&output);
+    SnappyOutputStream stream(&sink);
+    Write(&stream, data);
+  }
+  EXPECT_LT(output.size(), data.size() / 4);
+  EXPECT_EQ(std::vector<std::string>({data}), DecodeChunks(output));
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/common/indexing/SortedRunOutputStream.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "absl/strings/string_view.h"
+#include "glog/logging.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "kythe/cxx/common/vname_ordering.h"
+#include "kythe/proto/sorted_run.pb.h"
+
+namespace kythe {
+
+constexpr size_t SortedRunOutputStream::kDefaultBlockSize;
+constexpr size_t SortedRunOutputStream::kTrailerSize;
+constexpr uint32_t SortedRunOutputStream::kMagic;
+
+template <typename Ref>
+void SortedRunOutputStream::Buffer(const Ref& ref) {
+  const size_t size = EntryWireFormat::ByteSize(ref);
+  const size_t offset = data_.size();
+  data_.resize(offset + size);
+  EntryWireFormat::WriteToArray(ref,
+                                reinterpret_cast<uint8_t*>(&data_[offset]));
+  entries_.push_back({offset, size});
+}
+
+template <typename Ref>
+void SortedRunOutputStream::Buffer(absl::Span<const Ref> refs) {
+  entries_.reserve(entries_.size() + refs.size());
+  for (const auto& ref : refs) {
+    Buffer(ref);
+  }
+}
+
+void SortedRunOutputStream::Emit(const FactRef& fact) { Buffer(fact); }
+
+void SortedRunOutputStream::Emit(const EdgeRef& edge) { Buffer(edge); }
+
+void SortedRunOutputStream::Emit(const OrdinalEdgeRef& edge) { Buffer(edge); }
+
+void SortedRunOutputStream::Emit(absl::Span<const FactRef> facts) {
+  Buffer(facts);
+}
+
+void SortedRunOutputStream::Emit(absl::Span<const EdgeRef> edges) {
+  Buffer(edges);
+}
+
+void SortedRunOutputStream::Emit(absl::Span<const OrdinalEdgeRef> edges) {
+  Buffer(edges);
+}
+
+bool SortedRunOutputStream::EntryLess(const EntryView& lhs,
+                                      const EntryView& rhs) {
+  if (!VNameEquals(lhs.source, rhs.source)) {
+    return VNameLess()(lhs.source, rhs.source);
+  }
+  if (lhs.edge_kind != rhs.edge_kind) {
+    return lhs.edge_kind < rhs.edge_kind;
+  }
+  if (lhs.fact_name != rhs.fact_name) {
+    return lhs.fact_name < rhs.fact_name;
+  }
+  if (!VNameEquals(lhs.target, rhs.target)) {
+    return VNameLess()(lhs.target, rhs.target);
+  }
+  return lhs.fact_value < rhs.fact_value;
+}
+
+void SortedRunOutputStream::WriteRun() {
+  if (entries_.empty()) {
+    return;
+  }
+  std::vector<EntryView> views(entries_.size());
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    CHECK(EntryWireFormat::Parse(
+        absl::string_view(data_).substr(entries_[i].offset, entries_[i].size),
+        &views[i]));
+  }
+  // Sort indices rather than the (much larger) views themselves.
+  std::vector<size_t> order(entries_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&views](size_t lhs, size_t rhs) {
+    return EntryLess(views[lhs], views[rhs]);
+  });
+  proto::SortedRunIndex index;
+  proto::SortedRunIndex::Block* block = nullptr;
+  uint64_t offset = 0;
+  {
+    google::protobuf::io::CodedOutputStream coded_stream(stream_);
+    const EntryView* last = nullptr;
+    for (size_t i : order) {
+      // Entries that compare equal are identical, since EntryLess looks at
+      // every field; keep only the first copy.
+      if (last != nullptr && !EntryLess(*last, views[i])) {
+        continue;
+      }
+      last = &views[i];
+      if (block == nullptr || block->size() >= block_size_) {
+        block = index.add_block();
+        block->set_offset(offset);
+        views[i].source.Expand(block->mutable_first_source());
+      }
+      const Span& span = entries_[i];
+      const size_t delimited_size =
+          google::protobuf::io::CodedOutputStream::VarintSize32(span.size) +
+          span.size;
+      coded_stream.WriteVarint32(span.size);
+      coded_stream.WriteRaw(data_.data() + span.offset, span.size);
+      block->set_size(block->size() + delimited_size);
+      block->set_entry_count(block->entry_count() + 1);
+      index.set_entry_count(index.entry_count() + 1);
+      offset += delimited_size;
+    }
+    const std::string serialized_index = index.SerializeAsString();
+    coded_stream.WriteRaw(serialized_index.data(), serialized_index.size());
+    coded_stream.WriteLittleEndian64(offset);
+    coded_stream.WriteLittleEndian32(serialized_index.size());
+    coded_stream.WriteLittleEndian32(kMagic);
+  }
+  data_.clear();
+  entries_.clear();
+}
+
+}  // namespace kythe
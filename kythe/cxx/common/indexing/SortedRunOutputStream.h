@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_COMMON_INDEXING_SORTED_RUN_OUTPUT_STREAM_H_
+#define KYTHE_CXX_COMMON_INDEXING_SORTED_RUN_OUTPUT_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+
+namespace kythe {
+
+/// \brief Buffers the entries emitted to it and writes them to a stream as a
+/// sorted run, as described in kythe/proto/sorted_run.proto.
+///
+/// Runs from different compilation units can be merged rather than sorted.
+/// Duplicate entries are dropped when the run is sorted, so entry groups and
+/// hash caches are ignored.
+class SortedRunOutputStream : public KytheCachingOutput {
+ public:
+  /// The size at which a block is ended (after the entry that crosses it).
+  static constexpr size_t kDefaultBlockSize = 64 * 1024;
+  /// The size of the trailer at the end of each run.
+  static constexpr size_t kTrailerSize = 16;
+  /// The last four bytes of each run, which spell "KRUN" when written in
+  /// little-endian order.
+  static constexpr uint32_t kMagic = 0x4e55524b;
+
+  /// \param stream the stream to write runs to.
+  /// \param block_size the approximate size of each block in a run.
+  explicit SortedRunOutputStream(
+      google::protobuf::io::ZeroCopyOutputStream* stream,
+      size_t block_size = kDefaultBlockSize)
+      : stream_(stream), block_size_(block_size) {}
+  SortedRunOutputStream(const SortedRunOutputStream&) = delete;
+  SortedRunOutputStream& operator=(const SortedRunOutputStream&) = delete;
+
+  /// \brief Writes any buffered entries as a final run.
+  ~SortedRunOutputStream() override { WriteRun(); }
+
+  void Emit(const FactRef& fact) override;
+  void Emit(const EdgeRef& edge) override;
+  void Emit(const OrdinalEdgeRef& edge) override;
+  void Emit(absl::Span<const FactRef> facts) override;
+  void Emit(absl::Span<const EdgeRef> edges) override;
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override;
+
+  /// \brief Sorts the entries emitted since the last run and writes them as
+  /// a new run. Does nothing if there are none.
+  void WriteRun();
+
+  /// \return the number of entries waiting for the next run.
+  size_t buffered_entries() const { return entries_.size(); }
+
+  /// \return true if `lhs` sorts before `rhs` in a run.
+  static bool EntryLess(const EntryView& lhs, const EntryView& rhs);
+
+ private:
+  /// \brief The location of a serialized entry in `data_`.
+  struct Span {
+    size_t offset;
+    size_t size;
+  };
+
+  template <typename Ref>
+  void Buffer(const Ref& ref);
+  template <typename Ref>
+  void Buffer(absl::Span<const Ref> refs);
+
+  /// The stream to write runs to.
+  google::protobuf::io::ZeroCopyOutputStream* stream_;
+  /// The approximate size of each block.
+  size_t block_size_;
+  /// The serialized entries for the next run, back to back.
+  std::string data_;
+  /// Where each entry for the next run is in `data_`.
+  std::vector<Span> entries_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_INDEXING_SORTED_RUN_OUTPUT_STREAM_H_
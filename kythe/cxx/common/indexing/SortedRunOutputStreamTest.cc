@@ -0,0 +1,212 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/common/indexing/SortedRunOutputStream.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/EntryWireFormat.h"
+#include "kythe/proto/sorted_run.pb.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+/// \brief A run read back from its serialized form.
+struct ParsedRun {
+  proto::SortedRunIndex index;
+  /// The serialized entries in the run, in order.
+  std::vector<std::string> entries;
+  /// The serialized entries in each block.
+  std::vector<std::vector<std::string>> blocks;
+};
+
+/// \brief Reads the last run in `data`, removing it from `data`.
+ParsedRun ReadLastRun(absl::string_view* data) {
+  ParsedRun run;
+  EXPECT_GE(data->size(), SortedRunOutputStream::kTrailerSize);
+  if (data->size() < SortedRunOutputStream::kTrailerSize) {
+    data->remove_prefix(data->size());
+    return run;
+  }
+  google::protobuf::io::CodedInputStream trailer(
+      reinterpret_cast<const uint8_t*>(data->data() + data->size() -
+                                       SortedRunOutputStream::kTrailerSize),
+      SortedRunOutputStream::kTrailerSize);
+  uint64_t blocks_size = 0;
+  uint32_t index_size = 0;
+  uint32_t magic = 0;
+  EXPECT_TRUE(trailer.ReadLittleEndian64(&blocks_size));
+  EXPECT_TRUE(trailer.ReadLittleEndian32(&index_size));
+  EXPECT_TRUE(trailer.ReadLittleEndian32(&magic));
+  EXPECT_EQ(SortedRunOutputStream::kMagic, magic);
+  const size_t run_size =
+      blocks_size + index_size + SortedRunOutputStream::kTrailerSize;
+  EXPECT_LE(run_size, data->size());
+  absl::string_view run_data = data->substr(data->size() - run_size);
+  data->remove_suffix(run_size);
+  EXPECT_TRUE(run.index.ParseFromArray(run_data.data() + blocks_size,
+                                       index_size));
+  for (const auto& block : run.index.block()) {
+    EXPECT_LE(block.offset() + block.size(), blocks_size);
+    google::protobuf::io::CodedInputStream stream(
+        reinterpret_cast<const uint8_t*>(run_data.data() + block.offset()),
+        block.size());
+    run.blocks.emplace_back();
+    uint32_t size;
+    while (stream.ReadVarint32(&size)) {
+      std::string entry;
+      EXPECT_TRUE(stream.ReadString(&entry, size));
+      run.blocks.back().push_back(entry);
+      run.entries.push_back(entry);
+    }
+    EXPECT_EQ(block.entry_count(), run.blocks.back().size());
+  }
+  EXPECT_EQ(run.index.entry_count(), run.entries.size());
+  return run;
+}
+
+/// \return true if the serialized entries in `entries` are strictly
+/// increasing.
+bool IsStrictlySorted(const std::vector<std::string>& entries) {
+  for (size_t i = 1; i < entries.size(); ++i) {
+    EntryView lhs, rhs;
+    if (!EntryWireFormat::Parse(entries[i - 1], &lhs) ||
+        !EntryWireFormat::Parse(entries[i], &rhs) ||
+        !SortedRunOutputStream::EntryLess(lhs, rhs)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// \return `count` distinct VNames, out of order. `count` must not be a
+/// multiple of 37.
+std::vector<proto::VName> MakeVNames(int count) {
+  std::vector<proto::VName> vnames(count);
+  for (int i = 0; i < count; ++i) {
+    vnames[i].set_signature(std::to_string((i * 37) % count));
+    vnames[i].set_corpus("corpus");
+    vnames[i].set_path(i % 2 ? "b.cc" : "a.cc");
+  }
+  return vnames;
+}
+
+TEST(SortedRunOutputStreamTest, WritesNothingWithoutEntries) {
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    SortedRunOutputStream output(&stream);
+    output.WriteRun();
+  }
+  EXPECT_TRUE(data.empty());
+}
+
+TEST(SortedRunOutputStreamTest, SortsAndDeduplicatesEntries) {
+  const auto vnames = MakeVNames(40);
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    SortedRunOutputStream output(&stream);
+    for (int pass = 0; pass < 2; ++pass) {
+      for (size_t i = vnames.size(); i-- > 0;) {
+        VNameRef source(vnames[i]);
+        VNameRef target(vnames[(i * 3) % vnames.size()]);
+        output.Emit(FactRef{&source, "/kythe/node/kind", "record"});
+        output.Emit(EdgeRef{&source, "/kythe/edge/childof", &target});
+        output.Emit(OrdinalEdgeRef{&source, "/kythe/edge/param", &target, 1});
+        output.Emit(OrdinalEdgeRef{&source, "/kythe/edge/param", &target, 0});
+      }
+    }
+    EXPECT_EQ(vnames.size() * 8, output.buffered_entries());
+  }
+  absl::string_view rest(data);
+  ParsedRun run = ReadLastRun(&rest);
+  EXPECT_TRUE(rest.empty());
+  ASSERT_EQ(1, run.index.block_size());
+  EXPECT_EQ(0, run.index.block(0).offset());
+  EXPECT_EQ(vnames.size() * 4, run.entries.size());
+  EXPECT_TRUE(IsStrictlySorted(run.entries));
+  EntryView first;
+  ASSERT_TRUE(EntryWireFormat::Parse(run.entries[0], &first));
+  proto::VName first_source;
+  first.source.Expand(&first_source);
+  EXPECT_EQ(first_source.SerializeAsString(),
+            run.index.block(0).first_source().SerializeAsString());
+}
+
+TEST(SortedRunOutputStreamTest, SplitsRunsIntoBlocks) {
+  const auto vnames = MakeVNames(200);
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    SortedRunOutputStream output(&stream, 256);
+    for (const auto& vname : vnames) {
+      VNameRef source(vname);
+      output.Emit(FactRef{&source, "/kythe/text", std::string(40, 't')});
+    }
+  }
+  absl::string_view rest(data);
+  ParsedRun run = ReadLastRun(&rest);
+  EXPECT_TRUE(rest.empty());
+  EXPECT_GT(run.index.block_size(), 10);
+  uint64_t offset = 0;
+  for (int i = 0; i < run.index.block_size(); ++i) {
+    const auto& block = run.index.block(i);
+    EXPECT_EQ(offset, block.offset());
+    offset += block.size();
+    if (i + 1 < run.index.block_size()) {
+      EXPECT_GE(block.size(), 256);
+    }
+    ASSERT_FALSE(run.blocks[i].empty());
+    EntryView first;
+    ASSERT_TRUE(EntryWireFormat::Parse(run.blocks[i][0], &first));
+    EXPECT_EQ(first.source.signature(), block.first_source().signature());
+  }
+  EXPECT_TRUE(IsStrictlySorted(run.entries));
+}
+
+TEST(SortedRunOutputStreamTest, ConcatenatesRuns) {
+  const auto vnames = MakeVNames(10);
+  std::string data;
+  {
+    google::protobuf::io::StringOutputStream stream(&data);
+    SortedRunOutputStream output(&stream);
+    for (size_t run = 0; run < 3; ++run) {
+      for (size_t i = 0; i <= run; ++i) {
+        VNameRef source(vnames[i]);
+        output.Emit(FactRef{&source, "/kythe/node/kind", "file"});
+      }
+      output.WriteRun();
+      EXPECT_EQ(0, output.buffered_entries());
+    }
+  }
+  absl::string_view rest(data);
+  for (size_t run = 3; run-- > 0;) {
+    EXPECT_EQ(run + 1, ReadLastRun(&rest).entries.size());
+  }
+  EXPECT_TRUE(rest.empty());
+}
+
+}  // namespace
+}  // namespace kythe
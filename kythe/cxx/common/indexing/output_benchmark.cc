@@ -0,0 +1,241 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for KytheGraphRecorder and the output streams it writes to.
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace {
+
+/// \brief A `HashCache` that claims to have seen every hash.
+class SawEverythingHashCache : public HashCache {
+ public:
+  bool SawHash(const Hash& hash) override { return true; }
+};
+
+/// \brief A stream that counts and then discards the bytes written to it.
+class CountingOutputStream
+    : public google::protobuf::io::CopyingOutputStream {
+ public:
+  bool Write(const void* buffer, int size) override {
+    bytes_ += size;
+    return true;
+  }
+  int64_t bytes() const { return bytes_; }
+
+ private:
+  int64_t bytes_ = 0;
+};
+
+/// \brief Returns `count` distinct VNames for use as nodes.
+std::vector<proto::VName> MakeVNames(int count) {
+  std::vector<proto::VName> vnames(count);
+  for (int i = 0; i < count; ++i) {
+    vnames[i].set_signature(absl::StrCat("signature#", i));
+    vnames[i].set_corpus("corpus");
+    vnames[i].set_path(absl::StrCat("path/to/file", i % 16, ".cc"));
+    vnames[i].set_language("c++");
+  }
+  return vnames;
+}
+
+/// \brief Records a typical mix of one node-kind fact and three edges for
+/// each of the `count` VNames starting at `vnames`.
+void RecordNodes(const proto::VName* vnames, size_t count,
+                 KytheGraphRecorder* recorder) {
+  for (size_t i = 0; i < count; ++i) {
+    VNameRef node(vnames[i]);
+    VNameRef next(vnames[(i + 1) % count]);
+    recorder->AddProperty(node, NodeKindID::kFunction);
+    recorder->AddEdge(node, EdgeKindID::kChildOf, next);
+    recorder->AddEdge(node, EdgeKindID::kHasType, next);
+    recorder->AddEdge(node, EdgeKindID::kParam, next, i % 4);
+  }
+}
+
+void BM_RecordToNullStream(benchmark::State& state) {
+  const auto vnames = MakeVNames(state.range(0));
+  NullOutputStream stream;
+  KytheGraphRecorder recorder(&stream);
+  for (auto _ : state) {
+    RecordNodes(vnames.data(), vnames.size(), &recorder);
+  }
+  state.SetItemsProcessed(state.iterations() * vnames.size() * 4);
+}
+BENCHMARK(BM_RecordToNullStream)->Arg(1 << 10)->Arg(1 << 14);
+
+/// \brief The number of nodes per entry group.
+constexpr size_t kGroupSize = 16;
+
+/// \brief Records entries through a `FileOutputStream`. If `range(1)` is
+/// nonzero, every `kGroupSize` nodes are written in their own entry group,
+/// which is hashed against a cache: if `range(1)` is 1, the cache never hits,
+/// and if it is 2, it always does (so entries are hashed but dropped). If it
+/// is 3, the cache never hits and buffers end at content-defined cut points.
+void BM_RecordToFileOutputStream(benchmark::State& state) {
+  const auto vnames = MakeVNames(state.range(0));
+  const int grouping = state.range(1);
+  HashCache missing_cache;
+  SawEverythingHashCache hitting_cache;
+  HashCache chunking_cache;
+  chunking_cache.set_chunking(HashCache::Chunking::kContentDefined);
+  CountingOutputStream sink;
+  for (auto _ : state) {
+    {
+      google::protobuf::io::CopyingOutputStreamAdaptor raw_stream(&sink);
+      FileOutputStream stream(&raw_stream);
+      if (grouping == 1) {
+        stream.UseHashCache(&missing_cache);
+      } else if (grouping == 2) {
+        stream.UseHashCache(&hitting_cache);
+      } else if (grouping == 3) {
+        stream.UseHashCache(&chunking_cache);
+      }
+      KytheGraphRecorder recorder(&stream);
+      if (grouping == 0) {
+        RecordNodes(vnames.data(), vnames.size(), &recorder);
+      } else {
+        for (size_t i = 0; i < vnames.size(); i += kGroupSize) {
+          recorder.PushEntryGroup();
+          RecordNodes(vnames.data() + i,
+                      std::min(kGroupSize, vnames.size() - i), &recorder);
+          recorder.PopEntryGroup();
+        }
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * vnames.size() * 4);
+  state.SetBytesProcessed(sink.bytes());
+}
+BENCHMARK(BM_RecordToFileOutputStream)
+    ->ArgNames({"nodes", "grouping"})
+    ->Args({1 << 10, 0})
+    ->Args({1 << 10, 1})
+    ->Args({1 << 10, 2})
+    ->Args({1 << 10, 3})
+    ->Args({1 << 14, 0})
+    ->Args({1 << 14, 1})
+    ->Args({1 << 14, 3});
+
+/// \brief Emits `range(0)` param edges from each node to a
+/// `FileOutputStream`, one at a time (if `range(1)` is 0) or all at once
+/// (if it is 1), as `KytheGraphRecorder::AddEdges` does.
+void BM_EmitParamEdges(benchmark::State& state) {
+  const auto vnames = MakeVNames(1 << 10);
+  const size_t params = state.range(0);
+  const bool batched = state.range(1) != 0;
+  std::vector<VNameRef> refs(vnames.begin(), vnames.end());
+  std::vector<OrdinalEdgeRef> edges(params);
+  CountingOutputStream sink;
+  for (auto _ : state) {
+    google::protobuf::io::CopyingOutputStreamAdaptor raw_stream(&sink);
+    FileOutputStream stream(&raw_stream);
+    for (size_t i = 0; i < refs.size(); ++i) {
+      for (size_t p = 0; p < params; ++p) {
+        edges[p] = OrdinalEdgeRef{&refs[i], "/kythe/edge/param",
+                                  &refs[(i + p + 1) % refs.size()],
+                                  static_cast<uint32_t>(p)};
+      }
+      if (batched) {
+        stream.Emit(absl::MakeConstSpan(edges));
+      } else {
+        for (const auto& edge : edges) {
+          stream.Emit(edge);
+        }
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * vnames.size() * params);
+  state.SetBytesProcessed(sink.bytes());
+}
+BENCHMARK(BM_EmitParamEdges)
+    ->ArgNames({"params", "batched"})
+    ->Args({2, 0})
+    ->Args({2, 1})
+    ->Args({8, 0})
+    ->Args({8, 1});
+
+/// \brief Pushes buffers `range(0)` deep, writing 64-byte records into each
+/// level and merging small buffers down as `FileOutputStream` does.
+void BM_BufferStackNested(benchmark::State& state) {
+  const int depth = state.range(0);
+  constexpr size_t kRecordSize = 64;
+  constexpr size_t kMinSize = 4096;
+  constexpr size_t kMaxSize = 32 * 1024;
+  BufferStack stack;
+  CountingOutputStream sink;
+  google::protobuf::io::CopyingOutputStreamAdaptor stream(&sink);
+  for (auto _ : state) {
+    stack.Push(kMaxSize);
+    for (int level = 0; level < depth; ++level) {
+      stack.Push(kMaxSize);
+      for (int i = 0; i < 4; ++i) {
+        memset(stack.WriteToTop(kRecordSize), level, kRecordSize);
+      }
+    }
+    for (int level = 0; level < depth; ++level) {
+      if (!stack.MergeDownIfTooSmall(kMinSize, kMaxSize)) {
+        stack.CopyTopToStream(&stream);
+        stack.Pop();
+      }
+    }
+    stack.CopyTopToStream(&stream);
+    stack.Pop();
+  }
+  state.SetItemsProcessed(state.iterations() * depth);
+}
+BENCHMARK(BM_BufferStackNested)->Arg(8)->Arg(64)->Arg(512);
+
+/// \brief Hashes a buffer of `range(0)` bytes using SHA-256 (if `range(1)` is
+/// 0) or MurmurHash3 (if it is 1).
+void BM_HashTop(benchmark::State& state) {
+  const size_t size = state.range(0);
+  const auto algorithm = state.range(1) == 0 ? HashCache::Algorithm::kSha256
+                                             : HashCache::Algorithm::kMurmur3;
+  BufferStack stack;
+  stack.Push(size);
+  unsigned char* data = stack.WriteToTop(size);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<unsigned char>(i * 31);
+  }
+  HashCache::Hash hash;
+  for (auto _ : state) {
+    stack.HashTop(algorithm, &hash);
+    benchmark::DoNotOptimize(hash);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_HashTop)
+    ->ArgNames({"bytes", "algorithm"})
+    ->Args({4096, 0})
+    ->Args({4096, 1})
+    ->Args({32 * 1024, 0})
+    ->Args({32 * 1024, 1});
+
+}  // anonymous namespace
+}  // namespace kythe
@@ -16,9 +16,15 @@
 
 #include "json_proto.h"
 
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/escaping.h"
+#include "absl/synchronization/mutex.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
@@ -63,9 +69,67 @@ class PermissiveTypeResolver : public TypeResolver {
   std::unique_ptr<TypeResolver> impl_;
 };
 
+/// \brief Remembers every type that another resolver produces.
+///
+/// The transcoder asks for each message and enum type it meets on every call,
+/// and building a `google::protobuf::Type` walks the descriptor's fields and
+/// their options. Types from a pool that outlives the resolver never change,
+/// so copying out a stored answer is enough.
+class CachingTypeResolver : public TypeResolver {
+ public:
+  explicit CachingTypeResolver(std::unique_ptr<TypeResolver> impl)
+      : impl_(std::move(impl)) {}
+
+  google::protobuf::util::Status ResolveMessageType(
+      const std::string& type_url,
+      google::protobuf::Type* message_type) override {
+    return Resolve(type_url, &message_types_, message_type,
+                   [&](google::protobuf::Type* type) {
+                     return impl_->ResolveMessageType(type_url, type);
+                   });
+  }
+
+  google::protobuf::util::Status ResolveEnumType(
+      const std::string& type_url, google::protobuf::Enum* enum_type) override {
+    return Resolve(type_url, &enum_types_, enum_type,
+                   [&](google::protobuf::Enum* type) {
+                     return impl_->ResolveEnumType(type_url, type);
+                   });
+  }
+
+ private:
+  template <typename T, typename F>
+  google::protobuf::util::Status Resolve(
+      const std::string& type_url, absl::flat_hash_map<std::string, T>* cache,
+      T* out, F&& resolve) ABSL_LOCKS_EXCLUDED(mu_) {
+    {
+      absl::ReaderMutexLock lock(&mu_);
+      auto found = cache->find(type_url);
+      if (found != cache->end()) {
+        *out = found->second;
+        return google::protobuf::util::Status();
+      }
+    }
+    auto status = resolve(out);
+    if (status.ok()) {
+      absl::MutexLock lock(&mu_);
+      cache->emplace(type_url, *out);
+    }
+    return status;
+  }
+
+  std::unique_ptr<TypeResolver> impl_;
+  absl::Mutex mu_;
+  absl::flat_hash_map<std::string, google::protobuf::Type> message_types_
+      ABSL_GUARDED_BY(mu_);
+  absl::flat_hash_map<std::string, google::protobuf::Enum> enum_types_
+      ABSL_GUARDED_BY(mu_);
+};
+
 TypeResolver* GetGeneratedTypeResolver() {
-  static TypeResolver* generated_resolver =
-      new PermissiveTypeResolver(DescriptorPool::generated_pool());
+  static TypeResolver* generated_resolver = new CachingTypeResolver(
+      std::make_unique<PermissiveTypeResolver>(
+          DescriptorPool::generated_pool()));
   return generated_resolver;
 }
 
@@ -87,6 +151,34 @@ std::unique_ptr<TypeResolver, MaybeDeleteResolver> MakeTypeResolverForPool(
       new PermissiveTypeResolver(pool));
 }
 
+/// \brief A per-thread buffer for the binary form of a message on its way to
+/// or from JSON, so that transcoding many messages reuses one allocation.
+class BinaryScratch {
+ public:
+  BinaryScratch() : buffer_(&Buffer()) { buffer_->clear(); }
+  ~BinaryScratch() {
+    if (buffer_->capacity() > kMaxRetainedCapacity) {
+      std::string().swap(*buffer_);
+    }
+  }
+  BinaryScratch(const BinaryScratch&) = delete;
+  BinaryScratch& operator=(const BinaryScratch&) = delete;
+
+  std::string* get() { return buffer_; }
+
+ private:
+  /// Buffers that grew past this for an unusually large message are released
+  /// rather than kept for the rest of the thread's life.
+  static constexpr size_t kMaxRetainedCapacity = 1 << 20;
+
+  static std::string& Buffer() {
+    static thread_local std::string buffer;
+    return buffer;
+  }
+
+  std::string* buffer_;
+};
+
 absl::Status WriteMessageAsJsonToStringInternal(
     const google::protobuf::Message& message, std::string* out) {
   auto resolver =
@@ -95,9 +187,13 @@ absl::Status WriteMessageAsJsonToStringInternal(
   google::protobuf::util::JsonPrintOptions options;
   options.preserve_proto_field_names = true;
 
+  BinaryScratch binary;
+  if (!message.SerializeToString(binary.get())) {
+    return absl::InvalidArgumentError("Failure serializing message");
+  }
   auto status = google::protobuf::util::BinaryToJsonString(
-      resolver.get(), message.GetDescriptor()->full_name(),
-      message.SerializeAsString(), out, options);
+      resolver.get(), message.GetDescriptor()->full_name(), *binary.get(), out,
+      options);
   if (!status.ok()) {
     return absl::Status(static_cast<absl::StatusCode>(status.error_code()),
                         std::string(status.error_message()));
@@ -176,20 +272,20 @@ bool MergeJsonWithMessage(const std::string& in, std::string* format_key,
       CHECK(document["content"].Accept(writer));
       return std::string(buffer.GetString());
     }();
-    std::string binary;
+    BinaryScratch binary;
 
     auto resolver =
         MakeTypeResolverForPool(message->GetDescriptor()->file()->pool());
 
     auto status = google::protobuf::util::JsonToBinaryString(
-        resolver.get(), message->GetDescriptor()->full_name(), content, &binary,
-        DefaultParseOptions());
+        resolver.get(), message->GetDescriptor()->full_name(), content,
+        binary.get(), DefaultParseOptions());
 
     if (!status.ok()) {
       LOG(ERROR) << status.ToString() << ": " << content;
       return false;
     }
-    return message->ParseFromString(binary);
+    return message->ParseFromString(*binary.get());
   }
   return false;
 }
@@ -200,8 +296,8 @@ absl::Status ParseFromJsonStream(
   auto resolver =
       MakeTypeResolverForPool(message->GetDescriptor()->file()->pool());
 
-  std::string binary;
-  google::protobuf::io::StringOutputStream output(&binary);
+  BinaryScratch binary;
+  google::protobuf::io::StringOutputStream output(binary.get());
   auto status = google::protobuf::util::JsonToBinaryStream(
       resolver.get(), message->GetDescriptor()->full_name(), input, &output,
       options);
@@ -210,7 +306,7 @@ absl::Status ParseFromJsonStream(
     return absl::Status(static_cast<absl::StatusCode>(status.error_code()),
                         std::string(status.error_message()));
   }
-  if (!message->ParseFromString(binary)) {
+  if (!message->ParseFromString(*binary.get())) {
     return absl::InvalidArgumentError(
         "JSON transcoder produced invalid protobuf output.");
   }
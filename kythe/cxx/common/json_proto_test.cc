@@ -16,6 +16,7 @@
 
 #include "json_proto.h"
 
+#include "absl/strings/str_cat.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 #include "kythe/proto/analysis.pb.h"
@@ -84,6 +85,23 @@ TEST(JsonProto, Deserialize) {
   EXPECT_EQ("e2", has_repeated_field.entries(1).edge_kind());
 }
 
+TEST(JsonProto, RoundTripsRepeatedly) {
+  proto::CompilationUnit unit;
+  unit.mutable_v_name()->set_language("c++");
+  unit.add_required_input()->mutable_info()->set_path("a.cc");
+  unit.add_argument("-std=c++17");
+  for (int i = 0; i < 3; ++i) {
+    auto json = WriteMessageAsJsonToString(unit);
+    ASSERT_TRUE(json.ok()) << json.status();
+    proto::CompilationUnit parsed;
+    ASSERT_TRUE(ParseFromJsonString(*json, &parsed).ok());
+    EXPECT_EQ(unit.SerializeAsString(), parsed.SerializeAsString());
+    unit.add_argument(absl::StrCat("-DN=", i));
+  }
+  proto::CompilationUnit unused;
+  EXPECT_FALSE(ParseFromJsonString("{\"no_such_field\":1}", &unused).ok());
+}
+
 }  // namespace
 }  // namespace kythe
 
@@ -16,6 +16,9 @@
 
 #include "kythe/cxx/common/kythe_metadata_file.h"
 
+#include <algorithm>
+#include <functional>
+
 #include "absl/strings/escaping.h"
 #include "absl/strings/strip.h"
 #include "absl/types/optional.h"
@@ -23,6 +26,7 @@
 #include "google/protobuf/util/json_util.h"
 #include "kythe/cxx/common/json_proto.h"
 #include "kythe/cxx/common/schema/edges.h"
+#include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/proto/metadata.pb.h"
 #include "kythe/proto/storage.pb.h"
 
@@ -47,9 +51,6 @@ absl::optional<std::string> LoadCommentMetadata(absl::string_view buf_string,
                                                 size_t comment_slash_pos,
                                                 size_t data_start_pos) {
   google::protobuf::string raw_data;
-  // Over-reserves--though we expect the comment to be the only thing in the
-  // file or the last thing in the file, so this approximation is reasonable.
-  raw_data.reserve(buf_string.size() - comment_slash_pos);
   size_t pos = data_start_pos;
   // Tolerate single-line comments as well as multi-line comments.
   // If there's a single-line comment, it should be the only thing in the
@@ -57,6 +58,11 @@ absl::optional<std::string> LoadCommentMetadata(absl::string_view buf_string,
   bool single_line = buf_string[comment_slash_pos + 1] == '/';
   auto next_term =
       single_line ? absl::string_view::npos : buf_string.find("*/", pos);
+  // Over-reserves, since whitespace is skipped, but never by more than the
+  // comment. A single-line comment is expected to end the file.
+  raw_data.reserve(
+      (next_term == absl::string_view::npos ? buf_string.size() : next_term) -
+      pos);
   for (; pos < buf_string.size();) {
     while (pos < buf_string.size() && isspace(buf_string[pos])) ++pos;
     auto next_newline = buf_string.find('\n', pos);
@@ -101,18 +107,39 @@ absl::optional<std::string> LoadHeaderMetadata(absl::string_view buffer) {
 /// \return the decoded metadata on success or absl::nullopt on failure.
 absl::optional<std::string> FindCommentMetadata(
     absl::string_view buffer, const std::string& search_string) {
-  auto comment_start = buffer.find("/* " + search_string);
-  if (comment_start == absl::string_view::npos) {
-    comment_start = buffer.find("// " + search_string);
-    if (comment_start == absl::string_view::npos) {
-      return absl::nullopt;
+  // Look for the marker alone and check how it's introduced, so that a single
+  // pass over `buffer` finds either comment style. A /* */-style comment is
+  // preferred wherever it is.
+  const std::boyer_moore_horspool_searcher<std::string::const_iterator>
+      searcher(search_string.begin(), search_string.end());
+  size_t comment_start = absl::string_view::npos;
+  for (auto next = buffer.begin();;) {
+    const auto found = std::search(next, buffer.end(), searcher);
+    if (found == buffer.end()) {
+      break;
+    }
+    const size_t marker_start = found - buffer.begin();
+    if (marker_start >= 3) {
+      const absl::string_view opener = buffer.substr(marker_start - 3, 3);
+      if (opener == "/* ") {
+        comment_start = marker_start - 3;
+        break;
+      }
+      if (opener == "// " && comment_start == absl::string_view::npos) {
+        comment_start = marker_start - 3;
+      }
     }
+    next = found + 1;
+  }
+  if (comment_start == absl::string_view::npos) {
+    return absl::nullopt;
   }
   // Data starts after the comment token, a space, and the user-provided
   // marker.
   return LoadCommentMetadata(buffer, comment_start,
                              comment_start + 3 + search_string.size());
 }
+
 }  // anonymous namespace
 
 absl::optional<MetadataFile::Rule> MetadataFile::LoadMetaElement(
@@ -198,12 +225,32 @@ std::unique_ptr<kythe::MetadataFile> KytheMetadataSupport::ParseFile(
 }
 
 void MetadataSupports::UseVNameLookup(VNameLookup lookup) const {
+  lookup_ = std::move(lookup);
   for (auto& support : supports_) {
-    support->UseVNameLookup(lookup);
+    support->UseVNameLookup([this](const std::string& path, proto::VName* out) {
+      return LookUpVName(path, out);
+    });
+  }
+}
+
+bool MetadataSupports::LookUpVName(const std::string& path,
+                                   proto::VName* out) const {
+  if (recorded_lookups_ == nullptr) {
+    return lookup_(path, out);
+  }
+  auto inserted = recorded_lookups_->try_emplace(path);
+  MetadataCache::Lookup& lookup = inserted.first->second;
+  if (inserted.second) {
+    lookup.path = path;
+    lookup.found = lookup_(path, &lookup.vname);
   }
+  if (lookup.found) {
+    out->MergeFrom(lookup.vname);
+  }
+  return lookup.found;
 }
 
-std::unique_ptr<kythe::MetadataFile> MetadataSupports::ParseFile(
+std::shared_ptr<const kythe::MetadataFile> MetadataSupports::ParseFile(
     const std::string& filename, absl::string_view buffer,
     const std::string& search_string) const {
   std::string modified_filename = filename;
@@ -226,9 +273,46 @@ std::unique_ptr<kythe::MetadataFile> MetadataSupports::ParseFile(
       modified_filename = filename.substr(0, filename.size() - 2);
     }
   }
+  if (cache_ == nullptr) {
+    return ParseDecoded(filename, modified_filename, decoded_buffer);
+  }
+  // The rest of the file doesn't affect the result, so only the metadata
+  // itself is hashed.
+  const std::string key = MetadataCache::Key(filename, decoded_buffer);
+  if (auto entry = cache_->Find(key)) {
+    // The file can only be reused if it would be parsed the same way here.
+    if (std::all_of(entry->lookups.begin(), entry->lookups.end(),
+                    [&](const MetadataCache::Lookup& lookup) {
+                      proto::VName vname;
+                      return lookup_(lookup.path, &vname) == lookup.found &&
+                             VNameEquals(vname, lookup.vname);
+                    })) {
+      return entry->file;
+    }
+    cache_->CountStale();
+  }
+  absl::flat_hash_map<std::string, MetadataCache::Lookup> lookups;
+  recorded_lookups_ = &lookups;
+  std::shared_ptr<const MetadataFile> file =
+      ParseDecoded(filename, modified_filename, decoded_buffer);
+  recorded_lookups_ = nullptr;
+  if (file != nullptr) {
+    MetadataCache::Entry entry{file, {}};
+    entry.lookups.reserve(lookups.size());
+    for (auto& lookup : lookups) {
+      entry.lookups.push_back(std::move(lookup.second));
+    }
+    cache_->Insert(key, std::move(entry));
+  }
+  return file;
+}
+
+std::unique_ptr<kythe::MetadataFile> MetadataSupports::ParseDecoded(
+    const std::string& filename, const std::string& modified_filename,
+    absl::string_view buffer) const {
   for (const auto& support : supports_) {
     if (auto metadata =
-            support->ParseFile(filename, modified_filename, decoded_buffer)) {
+            support->ParseFile(filename, modified_filename, buffer)) {
       return metadata;
     }
   }
@@ -17,12 +17,18 @@
 #ifndef KYTHE_CXX_COMMON_KYTHE_METADATA_FILE_H_
 #define KYTHE_CXX_COMMON_KYTHE_METADATA_FILE_H_
 
-#include <map>
+#include <algorithm>
+#include <functional>
 #include <memory>
+#include <tuple>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
+#include "absl/types/span.h"
+#include "kythe/cxx/common/metadata_cache.h"
 #include "kythe/proto/metadata.pb.h"
 #include "kythe/proto/storage.pb.h"
 #include "rapidjson/document.h"
@@ -58,9 +64,12 @@ class MetadataFile {
       if (rule->whole_file) {
         meta_file->file_scope_rules_.push_back(*rule);
       } else {
-        meta_file->rules_.emplace(rule->begin, *rule);
+        meta_file->rules_.push_back(*rule);
       }
     }
+    // Rules with the same range keep the order they were given in.
+    std::stable_sort(meta_file->rules_.begin(), meta_file->rules_.end(),
+                     RangeLess);
     return meta_file;
   }
 
@@ -68,8 +77,18 @@ class MetadataFile {
   static absl::optional<MetadataFile::Rule> LoadMetaElement(
       const kythe::proto::metadata::MappingRule& mapping);
 
-  /// Rules to apply keyed on `begin`.
-  const std::multimap<unsigned, Rule>& rules() const { return rules_; }
+  /// Rules to apply, sorted by `begin` and then `end`.
+  const std::vector<Rule>& rules() const { return rules_; }
+
+  /// \brief Returns the rules that match exactly the range [begin, end).
+  absl::Span<const Rule> RulesForRange(unsigned begin, unsigned end) const {
+    Rule key;
+    key.begin = begin;
+    key.end = end;
+    auto range = std::equal_range(rules_.begin(), rules_.end(), key, RangeLess);
+    return absl::MakeConstSpan(rules_.data() + (range.first - rules_.begin()),
+                               range.second - range.first);
+  }
 
   /// File-scoped rules.
   const std::vector<Rule>& file_scope_rules() const {
@@ -79,8 +98,13 @@ class MetadataFile {
   absl::string_view id() const { return id_; }
 
  private:
-  /// Rules to apply keyed on `begin`.
-  std::multimap<unsigned, Rule> rules_;
+  /// Orders rules by their ranges.
+  static bool RangeLess(const Rule& lhs, const Rule& rhs) {
+    return std::tie(lhs.begin, lhs.end) < std::tie(rhs.begin, rhs.end);
+  }
+
+  /// Rules to apply, sorted by `begin` and then `end`.
+  std::vector<Rule> rules_;
 
   std::vector<Rule> file_scope_rules_;
 
@@ -137,20 +161,44 @@ class MetadataSupport {
 ///
 /// If the comment is a //-style comment, the base64 string must be unbroken.
 /// If the comment is a /* */-style comment, newlines (\n) are permitted.
+///
+/// The supports are handed a lookup that refers back to this object, so it
+/// must not be moved once `UseVNameLookup` has been called.
 class MetadataSupports {
  public:
   void Add(std::unique_ptr<MetadataSupport> support) {
     supports_.push_back(std::move(support));
   }
 
-  std::unique_ptr<kythe::MetadataFile> ParseFile(
+  std::shared_ptr<const kythe::MetadataFile> ParseFile(
       const std::string& filename, absl::string_view buffer,
       const std::string& search_string) const;
 
   void UseVNameLookup(VNameLookup lookup) const;
 
+  /// \brief Reuse the files parsed by any user of `cache` (not owned; may be
+  /// null) and remember those parsed here.
+  void UseCache(MetadataCache* cache) { cache_ = cache; }
+
  private:
+  /// \brief Parses the decoded metadata in `buffer` with the first support
+  /// that accepts it.
+  std::unique_ptr<kythe::MetadataFile> ParseDecoded(
+      const std::string& filename, const std::string& modified_filename,
+      absl::string_view buffer) const;
+
+  /// \brief The lookup the supports use, which calls `lookup_` and records
+  /// the result in `recorded_lookups_` if that's set.
+  bool LookUpVName(const std::string& path, proto::VName* out) const;
+
   std::vector<std::unique_ptr<MetadataSupport>> supports_;
+  MetadataCache* cache_ = nullptr;
+  /// The lookup passed to `UseVNameLookup`.
+  mutable VNameLookup lookup_ = [](const std::string& path,
+                                   proto::VName* out) { return false; };
+  /// While a file is parsed for `cache_`, the lookups made so far by path.
+  mutable absl::flat_hash_map<std::string, MetadataCache::Lookup>*
+      recorded_lookups_ = nullptr;
 };
 
 /// \brief Enables support for raw JSON-encoded metadata files.
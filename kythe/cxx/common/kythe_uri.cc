@@ -16,8 +16,10 @@
 
 #include "kythe/cxx/common/kythe_uri.h"
 
+#include <array>
 #include <utility>
 
+#include "absl/strings/match.h"
 #include "absl/strings/str_split.h"
 #include "kythe/cxx/common/path_utils.h"
 
@@ -32,12 +34,26 @@ constexpr char kUriPrefix[] = "kythe:";
 /// \brief Returns whether a byte should be escaped.
 /// \param mode The escaping mode to use.
 /// \param c The byte to examine.
-bool should_escape(UriEscapeMode mode, char c) {
+constexpr bool should_escape(UriEscapeMode mode, char c) {
   return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
            (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
            c == '~' || (mode == UriEscapeMode::kEscapePaths && c == '/'));
 }
 
+/// \brief Tabulates `should_escape` for every byte in one mode.
+constexpr std::array<bool, 256> MakeEscapeTable(UriEscapeMode mode) {
+  std::array<bool, 256> table{};
+  for (int c = 0; c < 256; ++c) {
+    table[c] = should_escape(mode, static_cast<char>(c));
+  }
+  return table;
+}
+
+constexpr std::array<bool, 256> kEscapeAllTable =
+    MakeEscapeTable(UriEscapeMode::kEscapeAll);
+constexpr std::array<bool, 256> kEscapePathsTable =
+    MakeEscapeTable(UriEscapeMode::kEscapePaths);
+
 /// \brief Returns the value of a hex digit.
 /// \param digit The hex digit.
 /// \return The value of the digit, or -1 if it was not a hex digit.
@@ -57,59 +73,59 @@ std::pair<absl::string_view, absl::string_view> Split(absl::string_view input,
   return absl::StrSplit(input, absl::MaxSplits(ch, 1));
 }
 
-}  // namespace
-
-std::string UriEscape(UriEscapeMode mode, absl::string_view uri) {
-  size_t num_escapes = 0;
-  for (char c : uri) {
-    if (should_escape(mode, c)) {
-      ++num_escapes;
-    }
-  }
-  std::string result;
-  result.reserve(num_escapes * 2 + uri.size());
-  for (char c : uri) {
-    if (should_escape(mode, c)) {
-      result.push_back('%');
-      result.push_back(kHexDigits[(c >> 4) & 0xF]);
-      result.push_back(kHexDigits[c & 0xF]);
-    } else {
-      result.push_back(c);
+/// \brief Returns whether every '%' in `string` starts a complete escape.
+bool IsWellEscaped(absl::string_view string) {
+  for (size_t i = string.find('%'); i != absl::string_view::npos;
+       i = string.find('%', i + 3)) {
+    if (i + 3 > string.size() || value_for_hex_digit(string[i + 1]) < 0 ||
+        value_for_hex_digit(string[i + 2]) < 0) {
+      return false;
     }
   }
-  return result;
+  return true;
 }
 
-/// \brief URI-unescapes a string.
+/// \brief URI-unescapes a string that `IsWellEscaped` accepts.
 /// \param string The string to unescape.
-/// \return A pair of (success, error-or-unescaped-string).
-std::pair<bool, std::string> UriUnescape(absl::string_view string) {
-  size_t num_escapes = 0;
-  for (size_t i = 0, s = string.size(); i < s; ++i) {
-    if (string[i] == '%') {
-      ++num_escapes;
-      if (i + 3 > string.size()) {
-        return std::make_pair(false, "bad escape");
-      }
-      i += 2;
-    }
+/// \param out The string to append to.
+void AppendUnescaped(absl::string_view string, std::string* out) {
+  size_t start = 0;
+  for (size_t i = string.find('%'); i != absl::string_view::npos;
+       i = string.find('%', start)) {
+    out->append(string.data() + start, i - start);
+    out->push_back(static_cast<char>((value_for_hex_digit(string[i + 1]) << 4) |
+                                     value_for_hex_digit(string[i + 2])));
+    start = i + 3;
   }
-  std::string result;
-  result.reserve(string.size() - num_escapes * 2);
-  for (size_t i = 0, s = string.size(); i < s; ++i) {
-    char c = string[i];
-    if (c != '%') {
-      result.push_back(c);
+  out->append(string.data() + start, string.size() - start);
+}
+
+}  // namespace
+
+void UriEscapeTo(UriEscapeMode mode, absl::string_view uri, std::string* out) {
+  const auto& table = mode == UriEscapeMode::kEscapeAll ? kEscapeAllTable
+                                                        : kEscapePathsTable;
+  // Copy the runs between escapes whole; most components have no escapes at
+  // all and are appended in one piece.
+  size_t start = 0;
+  for (size_t i = 0, s = uri.size(); i < s; ++i) {
+    unsigned char c = uri[i];
+    if (!table[c]) {
       continue;
     }
-    int high = value_for_hex_digit(string[++i]);
-    int low = value_for_hex_digit(string[++i]);
-    if (high < 0 || low < 0) {
-      return std::make_pair(false, "bad hex digit");
-    }
-    result.push_back((high << 4) | low);
+    out->append(uri.data() + start, i - start);
+    const char escape[] = {'%', kHexDigits[c >> 4], kHexDigits[c & 0xF]};
+    out->append(escape, sizeof(escape));
+    start = i + 1;
   }
-  return std::make_pair(true, result);
+  out->append(uri.data() + start, uri.size() - start);
+}
+
+std::string UriEscape(UriEscapeMode mode, absl::string_view uri) {
+  std::string result;
+  result.reserve(uri.size());
+  UriEscapeTo(mode, uri, &result);
+  return result;
 }
 
 std::string URI::ToString() const {
@@ -126,23 +142,23 @@ std::string URI::ToString() const {
   absl::string_view root = vname_.root();
   if (!corpus.empty()) {
     result.append("//");
-    result.append(UriEscape(UriEscapeMode::kEscapePaths, corpus));
+    UriEscapeTo(UriEscapeMode::kEscapePaths, corpus, &result);
   }
   if (!language.empty()) {
     result.append("?lang=");
-    result.append(UriEscape(UriEscapeMode::kEscapeAll, language));
+    UriEscapeTo(UriEscapeMode::kEscapeAll, language, &result);
   }
   if (!path.empty()) {
     result.append("?path=");
-    result.append(UriEscape(UriEscapeMode::kEscapePaths, CleanPath(path)));
+    UriEscapeTo(UriEscapeMode::kEscapePaths, CleanPath(path), &result);
   }
   if (!root.empty()) {
     result.append("?root=");
-    result.append(UriEscape(UriEscapeMode::kEscapePaths, root));
+    UriEscapeTo(UriEscapeMode::kEscapePaths, root, &result);
   }
   if (!signature.empty()) {
     result.push_back('#');
-    result.append(UriEscape(UriEscapeMode::kEscapeAll, signature));
+    UriEscapeTo(UriEscapeMode::kEscapeAll, signature, &result);
   }
   return result;
 }
@@ -167,6 +183,15 @@ static std::pair<absl::string_view, absl::string_view> SplitScheme(
 URI::URI(const kythe::proto::VName& from_vname) : vname_(from_vname) {}
 
 bool URI::ParseString(absl::string_view uri) {
+  auto view = URIView::FromString(uri);
+  if (!view) {
+    return false;
+  }
+  view->ToVName(&vname_);
+  return true;
+}
+
+absl::optional<URIView> URIView::FromString(absl::string_view uri) {
   auto head_fragment = Split(uri, '#');
   auto head = head_fragment.first, fragment = head_fragment.second;
   auto scheme_head = SplitScheme(head);
@@ -174,54 +199,73 @@ bool URI::ParseString(absl::string_view uri) {
   head = scheme_head.second;
   if (scheme.empty()) {
     if (absl::StartsWith(head, ":")) {
-      return false;
+      return absl::nullopt;
     }
   } else if (scheme != kUriScheme) {
-    return false;
+    return absl::nullopt;
   } else if (!head.empty()) {
     head.remove_prefix(1);
   }
   auto head_attrs = Split(head, '?');
   head = head_attrs.first;
   auto attrs = head_attrs.second;
-  std::string corpus;
+  URIView result;
   if (!head.empty()) {
     if (!absl::StartsWith(head, "//")) {
-      return false;
+      return absl::nullopt;
     }
-    auto maybe_corpus = UriUnescape(head.substr(2));
-    if (!maybe_corpus.first) {
-      return false;
+    result.corpus_ = head.substr(2);
+    if (!IsWellEscaped(result.corpus_)) {
+      return absl::nullopt;
     }
-    corpus = maybe_corpus.second;
   }
-  auto maybe_sig = UriUnescape(fragment);
-  if (!maybe_sig.first) {
-    return false;
+  if (!IsWellEscaped(fragment)) {
+    return absl::nullopt;
   }
-  auto signature = maybe_sig.second;
+  result.signature_ = fragment;
   while (!attrs.empty()) {
     auto attr_rest = Split(attrs, '?');
     auto attr = attr_rest.first;
     attrs = attr_rest.second;
     auto name_value = Split(attr, '=');
-    auto maybe_value = UriUnescape(name_value.second);
-    if (!maybe_value.first || maybe_value.second.empty()) {
-      return false;
+    auto value = name_value.second;
+    if (value.empty() || !IsWellEscaped(value)) {
+      return absl::nullopt;
     }
     if (name_value.first == "lang") {
-      vname_.set_language(maybe_value.second);
+      result.language_ = value;
     } else if (name_value.first == "root") {
-      vname_.set_root(maybe_value.second);
+      result.root_ = value;
     } else if (name_value.first == "path") {
-      vname_.set_path(CleanPath(maybe_value.second));
+      result.path_ = value;
     } else {
-      return false;
+      return absl::nullopt;
     }
   }
-  vname_.set_signature(signature);
-  vname_.set_corpus(corpus);
-  return true;
+  return result;
+}
+
+absl::string_view URIView::Unescape(absl::string_view component,
+                                    std::string* scratch) {
+  if (component.find('%') == absl::string_view::npos) {
+    return component;
+  }
+  scratch->clear();
+  AppendUnescaped(component, scratch);
+  return *scratch;
+}
+
+void URIView::ToVName(kythe::proto::VName* vname) const {
+  auto unescape_into = [](absl::string_view component, std::string* field) {
+    field->clear();
+    AppendUnescaped(component, field);
+  };
+  unescape_into(corpus_, vname->mutable_corpus());
+  unescape_into(root_, vname->mutable_root());
+  unescape_into(path_, vname->mutable_path());
+  CleanPathInPlace(vname->mutable_path());
+  unescape_into(language_, vname->mutable_language());
+  unescape_into(signature_, vname->mutable_signature());
 }
 
 }  // namespace kythe
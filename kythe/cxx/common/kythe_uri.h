@@ -20,6 +20,7 @@
 #include <string>
 
 #include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/proto/storage.pb.h"
 
@@ -36,6 +37,52 @@ enum class UriEscapeMode {
 /// \param string The string to escape.
 std::string UriEscape(UriEscapeMode mode, absl::string_view uri);
 
+/// \brief URI-escapes a string, appending the result to `out`.
+/// \param mode The escaping mode to use.
+/// \param string The string to escape.
+/// \param out The string to append to.
+void UriEscapeTo(UriEscapeMode mode, absl::string_view uri, std::string* out);
+
+/// \brief A Kythe URI parsed in place.
+///
+/// The components are views into the original text and are kept escaped;
+/// nothing is copied until a component is unescaped. A URIView must not
+/// outlive the text it was parsed from.
+class URIView {
+ public:
+  /// \brief Parses `uri`, checking that each component is well-escaped.
+  /// \return the parsed URI, or nullopt if `uri` isn't a valid Kythe URI.
+  static absl::optional<URIView> FromString(absl::string_view uri);
+
+  /// The components as they appear in the URI, still escaped.
+  absl::string_view corpus() const { return corpus_; }
+  absl::string_view root() const { return root_; }
+  absl::string_view path() const { return path_; }
+  absl::string_view language() const { return language_; }
+  absl::string_view signature() const { return signature_; }
+
+  /// \brief Unescapes one of this view's components.
+  /// \param component The escaped component.
+  /// \param scratch Holds the unescaped text if `component` has any escapes.
+  /// \return `component` itself if it has no escapes; otherwise a view of
+  /// `scratch`.
+  static absl::string_view Unescape(absl::string_view component,
+                                    std::string* scratch);
+
+  /// \brief Unescapes every component into `vname`, cleaning the path as
+  /// `URI` does.
+  void ToVName(kythe::proto::VName* vname) const;
+
+ private:
+  URIView() = default;
+
+  absl::string_view corpus_;
+  absl::string_view root_;
+  absl::string_view path_;
+  absl::string_view language_;
+  absl::string_view signature_;
+};
+
 /// \brief A Kythe URI.
 ///
 /// URIs are not in 1:1 correspondence with VNames--particularly because
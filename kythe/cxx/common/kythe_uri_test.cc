@@ -291,6 +291,43 @@ TEST(KytheUri, Strings) {
   }
 }
 
+TEST(KytheUri, ViewKeepsComponentsEscaped) {
+  auto view = URIView::FromString(
+      "kythe://a%2Fb?lang=c%2B%2B?path=x/./y?root=r#sig%20nature");
+  ASSERT_TRUE(view.has_value());
+  EXPECT_EQ("a%2Fb", view->corpus());
+  EXPECT_EQ("c%2B%2B", view->language());
+  EXPECT_EQ("x/./y", view->path());
+  EXPECT_EQ("r", view->root());
+  EXPECT_EQ("sig%20nature", view->signature());
+
+  std::string scratch;
+  EXPECT_EQ("c++", URIView::Unescape(view->language(), &scratch));
+  absl::string_view root = URIView::Unescape(view->root(), &scratch);
+  EXPECT_EQ(view->root().data(), root.data());
+
+  proto::VName vname;
+  view->ToVName(&vname);
+  EXPECT_EQ("a/b", vname.corpus());
+  EXPECT_EQ("c++", vname.language());
+  EXPECT_EQ("x/y", vname.path());
+  EXPECT_EQ("r", vname.root());
+  EXPECT_EQ("sig nature", vname.signature());
+
+  EXPECT_FALSE(URIView::FromString("kythe://a%2").has_value());
+  EXPECT_FALSE(URIView::FromString("kythe:?lang=%zz").has_value());
+  EXPECT_FALSE(URIView::FromString("kythe:?path=").has_value());
+}
+
+TEST(KytheUri, EscapeTo) {
+  std::string out = "kythe:";
+  UriEscapeTo(UriEscapeMode::kEscapePaths, "a/b c", &out);
+  UriEscapeTo(UriEscapeMode::kEscapeAll, "/\xff", &out);
+  EXPECT_EQ("kythe:a/b%20c%2F%FF", out);
+  EXPECT_EQ("plain-text_1.~", UriEscape(UriEscapeMode::kEscapeAll,
+                                         "plain-text_1.~"));
+}
+
 }  // anonymous namespace
 }  // namespace kythe
 
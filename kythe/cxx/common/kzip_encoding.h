@@ -25,6 +25,13 @@ enum class KzipEncoding {
   kAll = kJson | kProto  ///< All encodings
 };
 
+/// \brief How kzip entries are compressed. Readers detect the method of each
+/// entry, so archives may mix them.
+enum class KzipCompression {
+  kDeflate,  ///< Deflated; the smallest archives.
+  kStore,    ///< Stored uncompressed; the fastest to write and read.
+};
+
 }  // namespace kythe
 
 #endif  // KYTHE_CXX_COMMON_KZIP_ENCODING_H_
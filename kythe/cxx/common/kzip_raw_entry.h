@@ -0,0 +1,42 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_KZIP_RAW_ENTRY_H_
+#define KYTHE_CXX_COMMON_KZIP_RAW_ENTRY_H_
+
+#include <zip.h>
+
+#include <cstdint>
+#include <string>
+
+namespace kythe {
+
+/// \brief A kzip entry's bytes as stored in the archive, along with what's
+/// needed to copy them into another kzip without recompressing.
+struct KzipRawEntry {
+  /// The ZIP compression method of `data`, e.g. ZIP_CM_DEFLATE.
+  zip_int32_t method = ZIP_CM_STORE;
+  /// The size of the uncompressed contents.
+  zip_uint64_t size = 0;
+  /// The CRC-32 of the uncompressed contents.
+  uint32_t crc = 0;
+  /// The compressed contents.
+  std::string data;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_KZIP_RAW_ENTRY_H_
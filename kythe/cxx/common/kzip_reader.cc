@@ -18,8 +18,14 @@
 
 #include <openssl/sha.h>
 
-#include <set>
-
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -29,6 +35,7 @@
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/zero_copy_stream.h"
@@ -42,6 +49,12 @@ namespace {
 
 constexpr absl::string_view kJsonUnitsDir = "/units/";
 constexpr absl::string_view kProtoUnitsDir = "/pbunits/";
+constexpr absl::string_view kFilesDir = "/files/";
+
+// ReadFiles uses another thread for each this many files...
+constexpr size_t kMinFilesPerThread = 64;
+// ...up to this many threads.
+constexpr size_t kMaxReadThreads = 8;
 
 struct ZipFileClose {
   void operator()(zip_file_t* file) {
@@ -97,13 +110,20 @@ class ZipFileInputStream : public google::protobuf::io::ZeroCopyInputStream {
   google::protobuf::io::CopyingInputStreamAdaptor impl_{&input_};
 };
 
+// Maps a digest to the index of its entry in the archive.
+using EntryIndex = absl::flat_hash_map<absl::string_view, zip_uint64_t>;
+
 struct KzipOptions {
-  absl::string_view root;
   KzipEncoding encoding;
+  EntryIndex files;
+  EntryIndex units;
 };
 
+// Checks the archive's layout and, in the same pass over its central
+// directory, indexes its files and units by digest.
 absl::StatusOr<KzipOptions> Validate(zip_t* archive) {
-  if (!zip_get_num_entries(archive, 0)) {
+  const zip_int64_t num_entries = zip_get_num_entries(archive, 0);
+  if (!num_entries) {
     return absl::InvalidArgumentError("Empty kzip archive");
   }
 
@@ -116,34 +136,47 @@ absl::StatusOr<KzipOptions> Validate(zip_t* archive) {
   }
   root.remove_suffix(root.size() - slashpos);
   VLOG(1) << "Using archive root: " << root;
-  std::set<absl::string_view> proto_units;
-  std::set<absl::string_view> json_units;
-  for (int i = 0; i < zip_get_num_entries(archive, 0); ++i) {
+  EntryIndex files;
+  EntryIndex proto_units;
+  EntryIndex json_units;
+  // Names returned by zip_get_name() stay valid until the archive is closed,
+  // and the reader never modifies it.
+  for (zip_int64_t i = 0; i < num_entries; ++i) {
     absl::string_view name = zip_get_name(archive, i, 0);
     if (!absl::ConsumePrefix(&name, root)) {
       return absl::InvalidArgumentError(
           absl::StrCat("Malformed kzip: invalid entry: ", name));
     }
+    EntryIndex* index = nullptr;
     if (absl::ConsumePrefix(&name, kJsonUnitsDir)) {
-      json_units.insert(name);
+      index = &json_units;
     } else if (absl::ConsumePrefix(&name, kProtoUnitsDir)) {
-      proto_units.insert(name);
+      index = &proto_units;
+    } else if (absl::ConsumePrefix(&name, kFilesDir)) {
+      index = &files;
+    }
+    // Skip the directory entries themselves.
+    if (index != nullptr && !name.empty()) {
+      index->emplace(name, i);
     }
   }
-  KzipEncoding encoding = KzipEncoding::kJson;
   if (json_units.empty()) {
-    encoding = KzipEncoding::kProto;
-  } else if (!proto_units.empty()) {
-    std::vector<absl::string_view> diff;
-    std::set_symmetric_difference(json_units.begin(), json_units.end(),
-                                  proto_units.begin(), proto_units.end(),
-                                  std::inserter(diff, diff.end()));
-    if (!diff.empty()) {
+    return KzipOptions{KzipEncoding::kProto, std::move(files),
+                       std::move(proto_units)};
+  }
+  if (!proto_units.empty()) {
+    bool same_units = json_units.size() == proto_units.size();
+    for (const auto& unit : json_units) {
+      if (!same_units) break;
+      same_units = proto_units.contains(unit.first);
+    }
+    if (!same_units) {
       return absl::InvalidArgumentError(absl::StrCat(
           "Malformed kzip: multiple unit encodings but different entries"));
     }
   }
-  return KzipOptions{root, encoding};
+  return KzipOptions{KzipEncoding::kJson, std::move(files),
+                     std::move(json_units)};
 }
 
 absl::optional<zip_uint64_t> FileSize(zip_t* archive, zip_uint64_t index) {
@@ -156,58 +189,66 @@ absl::optional<zip_uint64_t> FileSize(zip_t* archive, zip_uint64_t index) {
   return sb.size;
 }
 
-absl::StatusOr<std::string> ReadTextFile(zip_t* archive,
-                                         const std::string& path) {
-  zip_int64_t index = zip_name_locate(archive, path.c_str(), 0);
-  if (index >= 0) {
-    if (auto file = ZipFile(zip_fopen_index(archive, index, 0))) {
-      if (auto size = FileSize(archive, index)) {
-        std::string result(*size, '\0');
-        if (zip_fread(file.get(), &result.front(), *size) == *size) {
-          return result;
-        } else {
-          return libzip::ToStatus(zip_file_get_error(file.get()));
-        }
+// Returns the error from failing to open the entry at `index`.
+absl::Status OpenError(zip_t* archive, zip_uint64_t index) {
+  zip_error_t* error = zip_get_error(archive);
+  if (zip_error_code_zip(error) == ZIP_ER_COMPNOTSUPP) {
+    // libzip picks the decompressor from each entry's method; name the one
+    // it lacks.
+    zip_stat_t sb;
+    zip_stat_init(&sb);
+    if (zip_stat_index(archive, index, 0, &sb) == 0 &&
+        (sb.valid & ZIP_STAT_COMP_METHOD)) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Unsupported compression method ", sb.comp_method, " for ",
+          zip_get_name(archive, index, 0)));
+    }
+  }
+  return libzip::ToStatus(error);
+}
+
+absl::StatusOr<std::string> ReadTextFile(zip_t* archive, zip_uint64_t index) {
+  if (auto file = ZipFile(zip_fopen_index(archive, index, 0))) {
+    if (auto size = FileSize(archive, index)) {
+      std::string result(*size, '\0');
+      if (zip_fread(file.get(), &result.front(), *size) == *size) {
+        return result;
+      } else {
+        return libzip::ToStatus(zip_file_get_error(file.get()));
       }
     }
   }
-  absl::Status status = libzip::ToStatus(zip_get_error(archive));
+  absl::Status status = OpenError(archive, index);
   if (!status.ok()) {
     return status;
   }
-  return absl::UnknownError(absl::StrCat("Unable to read: ", path));
+  return absl::UnknownError(
+      absl::StrCat("Unable to read: ", zip_get_name(archive, index, 0)));
 }
 
-absl::string_view DirNameForEncoding(KzipEncoding encoding) {
-  switch (encoding) {
-    case KzipEncoding::kJson:
-      return kJsonUnitsDir;
-    case KzipEncoding::kProto:
-      return kProtoUnitsDir;
-    default:
-      LOG(FATAL) << "Unsupported encoding: " << static_cast<int>(encoding);
-  }
-  return "";
-}
+bool HasIdleArchive(std::vector<zip_t*>* idle) { return !idle->empty(); }
 
 }  // namespace
 
-absl::optional<absl::string_view> KzipReader::UnitDigest(
-    absl::string_view path) {
-  if (!absl::ConsumePrefix(&path, unit_prefix_) || path.empty()) {
-    return absl::nullopt;
+/* static */
+absl::StatusOr<IndexReader> KzipReader::Open(absl::string_view path) {
+  auto reader = OpenKzip(path);
+  if (!reader.ok()) {
+    return reader.status();
   }
-  return path;
+  return IndexReader(*std::move(reader));
 }
 
 /* static */
-absl::StatusOr<IndexReader> KzipReader::Open(absl::string_view path) {
+absl::StatusOr<std::unique_ptr<KzipReader>> KzipReader::OpenKzip(
+    absl::string_view path) {
   int error;
   if (auto archive =
           ZipHandle(zip_open(std::string(path).c_str(), ZIP_RDONLY, &error))) {
     if (auto options = Validate(archive.get()); options.ok()) {
-      return IndexReader(absl::WrapUnique(new KzipReader(
-          std::move(archive), options->root, options->encoding)));
+      return absl::WrapUnique(new KzipReader(
+          std::move(archive), std::string(path), options->encoding,
+          std::move(options->files), std::move(options->units)));
     } else {
       return options.status();
     }
@@ -222,7 +263,8 @@ absl::StatusOr<IndexReader> KzipReader::FromSource(zip_source_t* source) {
           ZipHandle(zip_open_from_source(source, ZIP_RDONLY, error.get()))) {
     if (auto options = Validate(archive.get()); options.ok()) {
       return IndexReader(absl::WrapUnique(new KzipReader(
-          std::move(archive), options->root, options->encoding)));
+          std::move(archive), "", options->encoding, std::move(options->files),
+          std::move(options->units))));
     } else {
       // Ensure source is retained when `archive` is deleted.
       // It is the callers responsitility to free it on error.
@@ -233,25 +275,97 @@ absl::StatusOr<IndexReader> KzipReader::FromSource(zip_source_t* source) {
   return error.ToStatus();
 }
 
-KzipReader::KzipReader(ZipHandle archive, absl::string_view root,
-                       KzipEncoding encoding)
+KzipReader::KzipReader(ZipHandle archive, std::string path,
+                       KzipEncoding encoding, EntryIndex files,
+                       EntryIndex units)
     : archive_(std::move(archive)),
+      path_(std::move(path)),
       encoding_(encoding),
-      files_prefix_(absl::StrCat(root, "/files/")),
-      unit_prefix_(absl::StrCat(root, DirNameForEncoding(encoding))) {}
+      files_(std::move(files)),
+      units_(std::move(units)) {
+  // Scan visits units in archive order, as it did when it walked the
+  // central directory.
+  std::vector<std::pair<zip_uint64_t, absl::string_view>> units_by_index;
+  units_by_index.reserve(units_.size());
+  for (const auto& unit : units_) {
+    units_by_index.emplace_back(unit.second, unit.first);
+  }
+  std::sort(units_by_index.begin(), units_by_index.end());
+  unit_digests_.reserve(units_by_index.size());
+  for (const auto& unit : units_by_index) {
+    unit_digests_.push_back(unit.second);
+  }
+  idle_archives_.push_back(archive_.get());
+}
+
+zip_t* KzipReader::AcquireArchive() {
+  {
+    absl::MutexLock lock(&mu_);
+    if (!idle_archives_.empty() || path_.empty() || reopen_failed_) {
+      mu_.Await(absl::Condition(HasIdleArchive, &idle_archives_));
+      zip_t* archive = idle_archives_.back();
+      idle_archives_.pop_back();
+      return archive;
+    }
+  }
+  // Every handle is busy, so open another. This parses the central directory
+  // again, which is slow for large archives; don't hold the lock meanwhile.
+  int error;
+  ZipHandle archive(zip_open(path_.c_str(), ZIP_RDONLY, &error));
+  absl::MutexLock lock(&mu_);
+  if (archive == nullptr) {
+    LOG(WARNING) << "Unable to reopen " << path_ << ": "
+                 << libzip::Error(error).ToStatus();
+    reopen_failed_ = true;
+    mu_.Await(absl::Condition(HasIdleArchive, &idle_archives_));
+    zip_t* idle = idle_archives_.back();
+    idle_archives_.pop_back();
+    return idle;
+  }
+  extra_archives_.push_back(std::move(archive));
+  return extra_archives_.back().get();
+}
+
+void KzipReader::ReleaseArchive(zip_t* archive) {
+  absl::MutexLock lock(&mu_);
+  idle_archives_.push_back(archive);
+}
 
 absl::StatusOr<proto::IndexedCompilation> KzipReader::ReadUnit(
     absl::string_view digest) {
-  std::string path = absl::StrCat(unit_prefix_, digest);
+  proto::IndexedCompilation unit;
+  absl::Status status = ReadUnitInto(digest, &unit);
+  if (!status.ok()) {
+    return status;
+  }
+  return unit;
+}
 
-  if (auto file = ZipFile(zip_fopen(archive(), path.c_str(), 0))) {
-    proto::IndexedCompilation unit;
+absl::StatusOr<proto::IndexedCompilation*> KzipReader::ReadUnit(
+    absl::string_view digest, google::protobuf::Arena* arena) {
+  auto* unit =
+      google::protobuf::Arena::CreateMessage<proto::IndexedCompilation>(arena);
+  absl::Status status = ReadUnitInto(digest, unit);
+  if (!status.ok()) {
+    return status;
+  }
+  return unit;
+}
+
+absl::Status KzipReader::ReadUnitInto(absl::string_view digest,
+                                      proto::IndexedCompilation* unit) {
+  auto found = units_.find(digest);
+  if (found == units_.end()) {
+    return absl::NotFoundError(absl::StrCat("Unit not found: ", digest));
+  }
+  ArchiveLease archive(this);
+  if (auto file = ZipFile(zip_fopen_index(archive.get(), found->second, 0))) {
     ZipFileInputStream input(file.get());
     absl::Status status;
     if (encoding_ == KzipEncoding::kJson) {
-      status = ParseFromJsonStream(&input, &unit);
+      status = ParseFromJsonStream(&input, unit);
     } else {
-      if (!unit.ParseFromZeroCopyStream(&input)) {
+      if (!unit->ParseFromZeroCopyStream(&input)) {
         status = absl::InvalidArgumentError("Failure parsing proto unit");
       }
     }
@@ -264,9 +378,9 @@ absl::StatusOr<proto::IndexedCompilation> KzipReader::ReadUnit(
       }
       return status;
     }
-    return unit;
+    return absl::OkStatus();
   }
-  absl::Status status = libzip::ToStatus(zip_get_error(archive()));
+  absl::Status status = OpenError(archive.get(), found->second);
   if (!status.ok()) {
     return status;
   }
@@ -274,16 +388,132 @@ absl::StatusOr<proto::IndexedCompilation> KzipReader::ReadUnit(
 }
 
 absl::StatusOr<std::string> KzipReader::ReadFile(absl::string_view digest) {
-  return ReadTextFile(archive(), absl::StrCat(files_prefix_, digest));
+  auto found = files_.find(digest);
+  if (found == files_.end()) {
+    return absl::NotFoundError(absl::StrCat("File not found: ", digest));
+  }
+  ArchiveLease archive(this);
+  return ReadTextFile(archive.get(), found->second);
 }
 
-absl::Status KzipReader::Scan(const ScanCallback& callback) {
-  for (int i = 0; i < zip_get_num_entries(archive(), 0); ++i) {
-    if (auto digest = UnitDigest(zip_get_name(archive(), i, 0))) {
-      if (!callback(*digest)) {
-        break;
+absl::StatusOr<KzipRawEntry> KzipReader::ReadRawFile(
+    absl::string_view digest) {
+  auto found = files_.find(digest);
+  if (found == files_.end()) {
+    return absl::NotFoundError(absl::StrCat("File not found: ", digest));
+  }
+  ArchiveLease archive(this);
+  zip_stat_t sb;
+  zip_stat_init(&sb);
+  if (zip_stat_index(archive.get(), found->second, 0, &sb) != 0) {
+    return libzip::ToStatus(zip_get_error(archive.get()));
+  }
+  constexpr zip_uint64_t kNeeded = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE |
+                                   ZIP_STAT_COMP_METHOD | ZIP_STAT_CRC;
+  if ((sb.valid & kNeeded) != kNeeded) {
+    return absl::InternalError(
+        absl::StrCat("Incomplete metadata for file ", digest));
+  }
+  if ((sb.valid & ZIP_STAT_ENCRYPTION_METHOD) &&
+      sb.encryption_method != ZIP_EM_NONE) {
+    return absl::UnimplementedError(absl::StrCat("Encrypted file ", digest));
+  }
+  KzipRawEntry raw;
+  raw.method = sb.comp_method;
+  raw.size = sb.size;
+  raw.crc = sb.crc;
+  raw.data.resize(sb.comp_size);
+  if (auto file = ZipFile(
+          zip_fopen_index(archive.get(), found->second, ZIP_FL_COMPRESSED))) {
+    if (sb.comp_size == 0 ||
+        zip_fread(file.get(), &raw.data[0], sb.comp_size) ==
+            static_cast<zip_int64_t>(sb.comp_size)) {
+      return raw;
+    }
+    return libzip::ToStatus(zip_file_get_error(file.get()));
+  }
+  return OpenError(archive.get(), found->second);
+}
+
+absl::Status KzipReader::ScanFiles(const ScanCallback& callback) {
+  std::vector<std::pair<zip_uint64_t, absl::string_view>> files;
+  files.reserve(files_.size());
+  for (const auto& file : files_) {
+    files.emplace_back(file.second, file.first);
+  }
+  std::sort(files.begin(), files.end());
+  for (const auto& file : files) {
+    if (!callback(file.second)) {
+      break;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status KzipReader::ReadFiles(absl::Span<const std::string> digests,
+                                   const ReadFilesCallback& callback) {
+  // Entries are usually stored in the order of the central directory, so
+  // reading by entry index streams through the archive rather than seeking.
+  constexpr zip_uint64_t kMissing = std::numeric_limits<zip_uint64_t>::max();
+  std::vector<zip_uint64_t> indices;
+  indices.reserve(digests.size());
+  for (const std::string& digest : digests) {
+    auto found = files_.find(digest);
+    indices.push_back(found == files_.end() ? kMissing : found->second);
+  }
+  std::vector<size_t> order(digests.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return indices[a] < indices[b]; });
+
+  std::vector<absl::StatusOr<std::string>> results(digests.size());
+  auto read_range = [&](size_t begin, size_t end) {
+    ArchiveLease archive(this);
+    for (size_t i = begin; i < end; ++i) {
+      const size_t request = order[i];
+      if (indices[request] == kMissing) {
+        results[request] = absl::NotFoundError(
+            absl::StrCat("File not found: ", digests[request]));
+      } else {
+        results[request] = ReadTextFile(archive.get(), indices[request]);
       }
     }
+  };
+  // Each thread reads a contiguous run of the sorted entries on its own
+  // handle. Only readers opened from a path can open more handles.
+  size_t threads = 1;
+  if (!path_.empty()) {
+    threads = std::min<size_t>({digests.size() / kMinFilesPerThread,
+                                std::thread::hardware_concurrency(),
+                                kMaxReadThreads});
+  }
+  if (threads <= 1) {
+    read_range(0, digests.size());
+  } else {
+    std::vector<std::thread> workers;
+    const size_t per_thread = (digests.size() + threads - 1) / threads;
+    for (size_t begin = 0; begin < digests.size(); begin += per_thread) {
+      workers.emplace_back(read_range, begin,
+                           std::min(begin + per_thread, digests.size()));
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  for (size_t i = 0; i < digests.size(); ++i) {
+    if (!callback(digests[i], std::move(results[i]))) {
+      break;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status KzipReader::Scan(const ScanCallback& callback) {
+  for (absl::string_view digest : unit_digests_) {
+    if (!callback(digest)) {
+      break;
+    }
   }
   return absl::OkStatus();
 }
@@ -20,21 +20,37 @@
 #include <zip.h>
 
 #include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
+#include "google/protobuf/arena.h"
 #include "kythe/cxx/common/index_reader.h"
 #include "kythe/cxx/common/kzip_encoding.h"
+#include "kythe/cxx/common/kzip_raw_entry.h"
 #include "kythe/proto/analysis.pb.h"
 
 namespace kythe {
 
+/// \brief Reads a kzip. Methods may be called from several threads at once.
+/// libzip handles aren't safe to share, so a reader opened from a path opens
+/// another handle on the file for each concurrent read; one opened from a
+/// source serves reads one at a time.
 class KzipReader : public IndexReaderInterface {
  public:
   static absl::StatusOr<IndexReader> Open(absl::string_view path);
 
+  /// \brief Like Open, but returns the KzipReader itself for callers that
+  /// need ReadRawFile or ScanFiles.
+  static absl::StatusOr<std::unique_ptr<KzipReader>> OpenKzip(
+      absl::string_view path);
+
   /// \brief Constructs an `IndexReader` from the provided source.
   /// `zip_source_t` is reference counted, see
   /// https://libzip.org/documentation/zip_source.html
@@ -48,8 +64,29 @@ class KzipReader : public IndexReaderInterface {
   absl::StatusOr<kythe::proto::IndexedCompilation> ReadUnit(
       absl::string_view digest) override;
 
+  /// \brief Like ReadUnit, but allocates the unit, its inputs and their
+  /// strings on `arena`. Units with many inputs otherwise make tens of
+  /// thousands of small allocations; callers that read many units can free
+  /// them all at once with the arena.
+  /// \return the unit, which is owned by `arena`.
+  absl::StatusOr<kythe::proto::IndexedCompilation*> ReadUnit(
+      absl::string_view digest, google::protobuf::Arena* arena);
+
   absl::StatusOr<std::string> ReadFile(absl::string_view digest) override;
 
+  /// \brief Reads a file's bytes as stored, without decompressing them, for
+  /// copying into another kzip with KzipWriter::WriteRawFile.
+  absl::StatusOr<KzipRawEntry> ReadRawFile(absl::string_view digest);
+
+  /// \brief Invokes `callback` for each file digest, in archive order, or
+  /// until it returns false.
+  absl::Status ScanFiles(const ScanCallback& callback);
+
+  /// \brief Reads the files in archive order, splitting large batches across
+  /// threads when the reader was opened from a path.
+  absl::Status ReadFiles(absl::Span<const std::string> digests,
+                         const ReadFilesCallback& callback) override;
+
  private:
   struct Discard {
     void operator()(zip_t* archive) {
@@ -58,17 +95,57 @@ class KzipReader : public IndexReaderInterface {
   };
   using ZipHandle = std::unique_ptr<zip_t, Discard>;
 
-  explicit KzipReader(ZipHandle archive, absl::string_view basename,
-                      KzipEncoding encoding);
-
-  zip_t* archive() { return archive_.get(); }
-
-  absl::optional<absl::string_view> UnitDigest(absl::string_view path);
+  /// \brief Maps a file or unit digest to its entry's index in the archive.
+  /// Keys point into names owned by the archive.
+  using EntryIndex = absl::flat_hash_map<absl::string_view, zip_uint64_t>;
+
+  explicit KzipReader(ZipHandle archive, std::string path,
+                      KzipEncoding encoding, EntryIndex files,
+                      EntryIndex units);
+
+  /// \brief Parses the unit with the given digest into `unit`.
+  absl::Status ReadUnitInto(absl::string_view digest,
+                            kythe::proto::IndexedCompilation* unit);
+
+  /// \brief Takes an idle archive handle, opening one if there are none and
+  /// the reader has a path; otherwise waits for one to be released.
+  zip_t* AcquireArchive();
+  void ReleaseArchive(zip_t* archive);
+
+  /// \brief Holds an archive handle for one read.
+  class ArchiveLease {
+   public:
+    explicit ArchiveLease(KzipReader* reader)
+        : reader_(reader), archive_(reader->AcquireArchive()) {}
+    ArchiveLease(const ArchiveLease&) = delete;
+    ArchiveLease& operator=(const ArchiveLease&) = delete;
+    ~ArchiveLease() { reader_->ReleaseArchive(archive_); }
+
+    zip_t* get() const { return archive_; }
+
+   private:
+    KzipReader* reader_;
+    zip_t* archive_;
+  };
 
+  /// Owns the names that `files_`, `units_` and `unit_digests_` point into.
   ZipHandle archive_;
+  /// The kzip's path, or empty if it was opened from a source.
+  const std::string path_;
   KzipEncoding encoding_;
-  std::string files_prefix_;
-  std::string unit_prefix_;
+  /// Built once at open so that lookups don't search the central directory.
+  EntryIndex files_;
+  EntryIndex units_;
+  /// Unit digests in archive order.
+  std::vector<absl::string_view> unit_digests_;
+
+  absl::Mutex mu_;
+  /// Handles opened after `archive_`.
+  std::vector<ZipHandle> extra_archives_ ABSL_GUARDED_BY(mu_);
+  /// Handles not currently in use by a read.
+  std::vector<zip_t*> idle_archives_ ABSL_GUARDED_BY(mu_);
+  /// Whether opening another handle has failed.
+  bool reopen_failed_ ABSL_GUARDED_BY(mu_) = false;
 };
 
 }  // namespace kythe
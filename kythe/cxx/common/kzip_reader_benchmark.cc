@@ -0,0 +1,108 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for KzipReader.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "benchmark/benchmark.h"
+#include "glog/logging.h"
+#include "kythe/cxx/common/index_reader.h"
+#include "kythe/cxx/common/index_writer.h"
+#include "kythe/cxx/common/kzip_reader.h"
+#include "kythe/cxx/common/kzip_writer.h"
+
+namespace kythe {
+namespace {
+
+/// \brief A kzip holding `count` distinct files of `size` bytes each,
+/// removed when the fixture is destroyed.
+class KzipFixture {
+ public:
+  KzipFixture(int count, size_t size) {
+    const char* tmpdir = std::getenv("TEST_TMPDIR");
+    path_ = absl::StrCat(
+        absl::StripSuffix(tmpdir != nullptr ? tmpdir : "/tmp", "/"),
+        "/kzip_reader_benchmark.", ::getpid(), ".", count, ".", size, ".kzip");
+    auto writer = KzipWriter::Create(path_);
+    CHECK(writer.ok()) << writer.status();
+    for (int i = 0; i < count; ++i) {
+      std::string content = absl::StrCat("// file ", i, "\n");
+      content.resize(size, 'x');
+      auto digest = writer->WriteFile(content);
+      CHECK(digest.ok()) << digest.status();
+      digests_.push_back(*digest);
+    }
+    CHECK(writer->Close().ok());
+  }
+  ~KzipFixture() { std::remove(path_.c_str()); }
+
+  const std::string& path() const { return path_; }
+  const std::vector<std::string>& digests() const { return digests_; }
+
+ private:
+  std::string path_;
+  std::vector<std::string> digests_;
+};
+
+void BM_KzipReadFile(benchmark::State& state) {
+  KzipFixture kzip(state.range(0), state.range(1));
+  auto reader = KzipReader::Open(kzip.path());
+  CHECK(reader.ok()) << reader.status();
+  size_t next = 0;
+  for (auto _ : state) {
+    auto content =
+        reader->ReadFile(kzip.digests()[next++ % kzip.digests().size()]);
+    CHECK(content.ok()) << content.status();
+    benchmark::DoNotOptimize(content);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_KzipReadFile)
+    ->ArgNames({"files", "bytes"})
+    ->ArgsProduct({{64, 1024, 16384}, {1 << 10, 1 << 16}})
+    ->Args({64, 1 << 20});
+
+void BM_KzipOpenAndScan(benchmark::State& state) {
+  KzipFixture kzip(state.range(0), 64);
+  for (auto _ : state) {
+    auto reader = KzipReader::Open(kzip.path());
+    CHECK(reader.ok()) << reader.status();
+    CHECK(reader->Scan([](absl::string_view) { return true; }).ok());
+  }
+}
+BENCHMARK(BM_KzipOpenAndScan)->RangeMultiplier(8)->Range(64, 32768);
+
+void BM_KzipOpen(benchmark::State& state) {
+  KzipFixture kzip(state.range(0), 64);
+  for (auto _ : state) {
+    auto reader = KzipReader::Open(kzip.path());
+    CHECK(reader.ok()) << reader.status();
+    benchmark::DoNotOptimize(reader);
+  }
+}
+BENCHMARK(BM_KzipOpen)->RangeMultiplier(8)->Range(64, 32768);
+
+}  // anonymous namespace
+}  // namespace kythe
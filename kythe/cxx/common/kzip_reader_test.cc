@@ -16,8 +16,11 @@
 
 #include "kythe/cxx/common/kzip_reader.h"
 
+#include <algorithm>
 #include <functional>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -125,6 +128,119 @@ TEST(KzipReaderTest, OpenAndReadSimpleKzip) {
                   .ok());
 }
 
+TEST(KzipReaderTest, ReadFailsForMissingDigest) {
+  absl::StatusOr<IndexReader> reader =
+      KzipReader::Open(TestFile("stringset.kzip"));
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  EXPECT_EQ(reader->ReadFile("0000").status().code(), StatusCode::kNotFound);
+  EXPECT_EQ(reader->ReadUnit("0000").status().code(), StatusCode::kNotFound);
+  EXPECT_EQ(reader->ReadFile("").status().code(), StatusCode::kNotFound);
+}
+
+TEST(KzipReaderTest, ReadFilesMatchesReadFile) {
+  proto::GoDetails needed_for_proto_deserialization;
+
+  absl::StatusOr<IndexReader> reader =
+      KzipReader::Open(TestFile("stringset.kzip"));
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  std::vector<std::string> digests;
+  ASSERT_TRUE(reader
+                  ->Scan([&](absl::string_view digest) {
+                    auto unit = reader->ReadUnit(digest);
+                    EXPECT_TRUE(unit.ok()) << unit.status();
+                    if (unit.ok()) {
+                      for (const auto& file : unit->unit().required_input()) {
+                        digests.push_back(file.info().digest());
+                      }
+                    }
+                    return unit.ok();
+                  })
+                  .ok());
+  // Request the files in reverse, with a missing one in the middle.
+  std::reverse(digests.begin(), digests.end());
+  digests.insert(digests.begin() + digests.size() / 2, "0000");
+
+  size_t next = 0;
+  ASSERT_TRUE(reader
+                  ->ReadFiles(digests,
+                              [&](absl::string_view digest,
+                                  absl::StatusOr<std::string> content) {
+                                EXPECT_EQ(digest, digests[next]);
+                                auto expected = reader->ReadFile(digest);
+                                EXPECT_EQ(content.status().code(),
+                                          expected.status().code());
+                                if (content.ok() && expected.ok()) {
+                                  EXPECT_EQ(*content, *expected);
+                                }
+                                ++next;
+                                return true;
+                              })
+                  .ok());
+  EXPECT_EQ(next, digests.size());
+}
+
+TEST(KzipReaderTest, ReadsUnitsOntoAnArena) {
+  proto::GoDetails needed_for_proto_deserialization;
+
+  auto reader = KzipReader::OpenKzip(TestFile("stringset.kzip"));
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  google::protobuf::Arena arena;
+  int units = 0;
+  ASSERT_TRUE((*reader)
+                  ->Scan([&](absl::string_view digest) {
+                    auto on_heap = (*reader)->ReadUnit(digest);
+                    auto on_arena = (*reader)->ReadUnit(digest, &arena);
+                    EXPECT_TRUE(on_heap.ok()) << on_heap.status();
+                    EXPECT_TRUE(on_arena.ok()) << on_arena.status();
+                    if (on_heap.ok() && on_arena.ok()) {
+                      EXPECT_EQ((*on_arena)->GetArena(), &arena);
+                      EXPECT_EQ((*on_arena)->SerializeAsString(),
+                                on_heap->SerializeAsString());
+                      ++units;
+                    }
+                    return on_heap.ok() && on_arena.ok();
+                  })
+                  .ok());
+  EXPECT_GT(units, 0);
+  EXPECT_EQ((*reader)->ReadUnit("0000", &arena).status().code(),
+            StatusCode::kNotFound);
+}
+
+TEST(KzipReaderTest, ReadsFromSeveralThreads) {
+  proto::GoDetails needed_for_proto_deserialization;
+
+  absl::StatusOr<IndexReader> reader =
+      KzipReader::Open(TestFile("stringset.kzip"));
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  std::vector<std::string> unit_digests;
+  ASSERT_TRUE(reader
+                  ->Scan([&](absl::string_view digest) {
+                    unit_digests.emplace_back(digest);
+                    return true;
+                  })
+                  .ok());
+  ASSERT_FALSE(unit_digests.empty());
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 10; ++i) {
+        for (const std::string& digest : unit_digests) {
+          auto unit = reader->ReadUnit(digest);
+          ASSERT_TRUE(unit.ok()) << unit.status();
+          for (const auto& file : unit->unit().required_input()) {
+            auto data = reader->ReadFile(file.info().digest());
+            ASSERT_TRUE(data.ok()) << data.status();
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
 TEST(KzipReaderTest, FromSourceFailsIfSourceDoes) {
   libzip::Error error;
   {
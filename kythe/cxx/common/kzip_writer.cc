@@ -17,8 +17,16 @@
 #include "kythe/cxx/common/kzip_writer.h"
 
 #include <openssl/sha.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
 
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -28,10 +36,13 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/ascii.h"
 #include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "glog/logging.h"
 #include "kythe/cxx/common/json_proto.h"
 #include "kythe/cxx/common/kzip_encoding.h"
 #include "kythe/cxx/common/libzip/error.h"
+#include "kythe/cxx/common/status.h"
 #include "kythe/proto/analysis.pb.h"
 
 namespace kythe {
@@ -44,6 +55,9 @@ constexpr absl::string_view kFileRoot = "root/files/";
 // Set all file modified times to 0 so zip file diffs only show content diffs,
 // not zip creation time diffs.
 constexpr time_t kModTime = 0;
+// How many bytes of compressed file contents to keep in memory before spilling
+// to disk, unless overridden by $KYTHE_KZIP_WRITER_BUFFER_BYTES.
+constexpr size_t kDefaultMaxBufferedBytes = 64 << 20;
 
 std::string SHA256Digest(absl::string_view content) {
   std::array<unsigned char, SHA256_DIGEST_LENGTH> buf;
@@ -53,22 +67,83 @@ std::string SHA256Digest(absl::string_view content) {
       absl::string_view(reinterpret_cast<const char*>(buf.data()), buf.size()));
 }
 
-absl::Status WriteTextFile(zip_t* archive, const std::string& path,
-                           absl::string_view content) {
-  if (auto source =
-          zip_source_buffer(archive, content.data(), content.size(), 0)) {
-    auto idx = zip_file_add(archive, path.c_str(), source, ZIP_FL_ENC_UTF_8);
-    if (idx >= 0) {
-      // If a file was added, set the last modified time.
-      if (zip_file_set_mtime(archive, idx, kModTime, 0) == 0) {
-        return absl::OkStatus();
-      }
+// Adds `source` as `path`, compressed with `method` unless it is
+// ZIP_CM_DEFAULT.
+absl::Status AddFile(zip_t* archive, const std::string& path,
+                     zip_source_t* source, zip_int32_t method) {
+  auto idx = zip_file_add(archive, path.c_str(), source, ZIP_FL_ENC_UTF_8);
+  if (idx >= 0) {
+    if (method != ZIP_CM_DEFAULT &&
+        zip_set_file_compression(archive, idx, method, 0) != 0) {
+      return libzip::ToStatus(zip_get_error(archive));
+    }
+    // If a file was added, set the last modified time.
+    if (zip_file_set_mtime(archive, idx, kModTime, 0) == 0) {
+      return absl::OkStatus();
     }
+  } else {
     zip_source_free(source);
   }
   return libzip::ToStatus(zip_get_error(archive));
 }
 
+// Writes all of `content` to `fd` at `offset`.
+bool WriteFullyAt(int fd, absl::string_view content, zip_uint64_t offset) {
+  while (!content.empty()) {
+    ssize_t written = ::pwrite(fd, content.data(), content.size(), offset);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    content.remove_prefix(written);
+    offset += written;
+  }
+  return true;
+}
+
+// Deflates `content` into `output` as a raw deflate stream, as zip expects.
+bool Deflate(absl::string_view content, std::string* output) {
+  z_stream stream{};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                   /*memLevel=*/8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  output->resize(deflateBound(&stream, content.size()));
+  // avail_in and avail_out are narrower than size_t, so feed large inputs
+  // and outputs in pieces.
+  size_t written = 0;
+  int result = Z_OK;
+  while (result == Z_OK || result == Z_BUF_ERROR) {
+    const size_t in_chunk =
+        std::min<size_t>(content.size(), std::numeric_limits<uInt>::max());
+    const size_t out_chunk = std::min<size_t>(output->size() - written,
+                                              std::numeric_limits<uInt>::max());
+    if (out_chunk == 0) break;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(content.data()));
+    stream.avail_in = in_chunk;
+    stream.next_out = reinterpret_cast<Bytef*>(&(*output)[written]);
+    stream.avail_out = out_chunk;
+    result =
+        deflate(&stream, in_chunk == content.size() ? Z_FINISH : Z_NO_FLUSH);
+    content.remove_prefix(in_chunk - stream.avail_in);
+    written += out_chunk - stream.avail_out;
+  }
+  output->resize(written);
+  deflateEnd(&stream);
+  return result == Z_STREAM_END;
+}
+
+uint32_t Crc32(absl::string_view content) {
+  uLong crc = crc32(0, Z_NULL, 0);
+  while (!content.empty()) {
+    const size_t chunk = std::min<size_t>(
+        content.size(), std::numeric_limits<uInt>::max());
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(content.data()), chunk);
+    content.remove_prefix(chunk);
+  }
+  return crc;
+}
+
 absl::string_view Basename(absl::string_view path) {
   auto pos = path.find_last_of('/');
   if (pos == absl::string_view::npos) {
@@ -84,30 +159,169 @@ bool HasEncoding(KzipEncoding lhs, KzipEncoding rhs) {
 
 }  // namespace
 
+struct KzipWriter::CompressedEntry {
+  /// \brief Blocks until the entry has been compressed.
+  void Wait() {
+    absl::MutexLock lock(&mu);
+    mu.Await(absl::Condition(&done));
+  }
+
+  /// \brief Implements a libzip source over the compressed contents. libzip
+  /// copies them into the archive as they are since their stat reports the
+  /// method they were compressed with.
+  static zip_int64_t Callback(void* state, void* data, zip_uint64_t len,
+                              zip_source_cmd_t cmd);
+
+  absl::Mutex mu;
+  bool done ABSL_GUARDED_BY(mu) = false;
+  // The rest is written before `done` is set and only read after.
+  absl::Status status;
+  zip_uint64_t size = 0;
+  uint32_t crc = 0;
+  zip_int32_t method = ZIP_CM_DEFLATE;
+  std::string compressed;  // Empty if the compressed contents were spilled.
+  zip_uint64_t compressed_size = 0;
+  int spill_fd = -1;
+  zip_uint64_t spill_offset = 0;
+  // Used only by libzip, on the thread calling zip_close.
+  zip_uint64_t read_offset = 0;
+  zip_error_t error;
+};
+
+zip_int64_t KzipWriter::CompressedEntry::Callback(void* state, void* data,
+                                                  zip_uint64_t len,
+                                                  zip_source_cmd_t cmd) {
+  auto* entry = static_cast<CompressedEntry*>(state);
+  switch (cmd) {
+    case ZIP_SOURCE_OPEN:
+      entry->Wait();
+      if (!entry->status.ok()) {
+        zip_error_set(&entry->error, ZIP_ER_INTERNAL, 0);
+        return -1;
+      }
+      entry->read_offset = 0;
+      return 0;
+    case ZIP_SOURCE_READ: {
+      const zip_uint64_t size =
+          std::min(len, entry->compressed_size - entry->read_offset);
+      if (entry->spill_fd < 0) {
+        std::memcpy(data, entry->compressed.data() + entry->read_offset, size);
+      } else {
+        zip_uint64_t read = 0;
+        while (read < size) {
+          ssize_t n = ::pread(entry->spill_fd, static_cast<char*>(data) + read,
+                              size - read,
+                              entry->spill_offset + entry->read_offset + read);
+          if (n < 0 && errno == EINTR) continue;
+          if (n <= 0) {
+            zip_error_set(&entry->error, ZIP_ER_READ, n < 0 ? errno : EIO);
+            return -1;
+          }
+          read += n;
+        }
+      }
+      entry->read_offset += size;
+      return size;
+    }
+    case ZIP_SOURCE_CLOSE:
+      return 0;
+    case ZIP_SOURCE_STAT: {
+      if (len < sizeof(zip_stat_t)) {
+        zip_error_set(&entry->error, ZIP_ER_INVAL, 0);
+        return -1;
+      }
+      entry->Wait();
+      auto* stat = static_cast<zip_stat_t*>(data);
+      zip_stat_init(stat);
+      stat->valid = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE | ZIP_STAT_COMP_METHOD |
+                    ZIP_STAT_CRC | ZIP_STAT_ENCRYPTION_METHOD;
+      stat->size = entry->size;
+      stat->comp_size = entry->compressed_size;
+      stat->comp_method = entry->method;
+      stat->crc = entry->crc;
+      stat->encryption_method = ZIP_EM_NONE;
+      return sizeof(zip_stat_t);
+    }
+    case ZIP_SOURCE_ERROR:
+      return zip_error_to_data(&entry->error, data, len);
+    case ZIP_SOURCE_FREE:
+      // Entries are owned by the KzipWriter.
+      return 0;
+    case ZIP_SOURCE_SUPPORTS:
+      return zip_source_make_command_bitmap(
+          ZIP_SOURCE_OPEN, ZIP_SOURCE_READ, ZIP_SOURCE_CLOSE, ZIP_SOURCE_STAT,
+          ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE, -1);
+    default:
+      zip_error_set(&entry->error, ZIP_ER_OPNOTSUPP, 0);
+      return -1;
+  }
+}
+
 /* static */
 absl::StatusOr<IndexWriter> KzipWriter::Create(absl::string_view path,
-                                               KzipEncoding encoding) {
+                                               KzipEncoding encoding,
+                                               KzipCompression compression) {
+  Options options;
+  options.encoding = encoding;
+  options.compression = compression;
+  return Create(path, options);
+}
+
+/* static */
+absl::StatusOr<std::unique_ptr<KzipWriter>> KzipWriter::CreateKzip(
+    absl::string_view path, KzipEncoding encoding,
+    KzipCompression compression) {
+  Options options;
+  options.encoding = encoding;
+  options.compression = compression;
+  return CreateKzip(path, options);
+}
+
+/* static */
+absl::StatusOr<IndexWriter> KzipWriter::Create(absl::string_view path,
+                                               const Options& options) {
+  auto writer = CreateKzip(path, options);
+  if (!writer.ok()) {
+    return writer.status();
+  }
+  return IndexWriter(*std::move(writer));
+}
+
+/* static */
+absl::StatusOr<std::unique_ptr<KzipWriter>> KzipWriter::CreateKzip(
+    absl::string_view path, const Options& options) {
   int error;
   if (auto archive =
           zip_open(std::string(path).c_str(), ZIP_CREATE | ZIP_EXCL, &error)) {
-    return IndexWriter(absl::WrapUnique(new KzipWriter(archive, encoding)));
+    return absl::WrapUnique(new KzipWriter(archive, options));
   }
   return libzip::Error(error).ToStatus();
 }
 
 /* static */
-absl::StatusOr<IndexWriter> KzipWriter::FromSource(zip_source_t* source,
-                                                   KzipEncoding encoding,
-                                                   const int flags) {
+absl::StatusOr<IndexWriter> KzipWriter::FromSource(
+    zip_source_t* source, KzipEncoding encoding, const int flags,
+    KzipCompression compression) {
   libzip::Error error;
   if (auto archive = zip_open_from_source(source, flags, error.get())) {
-    return IndexWriter(absl::WrapUnique(new KzipWriter(archive, encoding)));
+    Options options;
+    options.encoding = encoding;
+    options.compression = compression;
+    return IndexWriter(absl::WrapUnique(new KzipWriter(archive, options)));
   }
   return error.ToStatus();
 }
 
-KzipWriter::KzipWriter(zip_t* archive, KzipEncoding encoding)
-    : archive_(archive), encoding_(encoding) {}
+KzipWriter::KzipWriter(zip_t* archive, const Options& options)
+    : archive_(archive),
+      max_buffered_bytes_(DefaultMaxBufferedBytes()),
+      encoding_(options.encoding),
+      compression_(options.compression) {
+  if (const size_t threads = options.compression_threads; threads > 0) {
+    // Bound the contents copied into pending closures.
+    pool_ = absl::make_unique<ThreadPool>(threads, 2 * threads);
+  }
+}
 
 KzipWriter::~KzipWriter() {
   DCHECK(archive_ == nullptr) << "Disposing of open KzipWriter!";
@@ -138,8 +352,7 @@ absl::Status KzipWriter::InitializeArchive(zip_t* archive) {
   return absl::OkStatus();
 }
 
-absl::StatusOr<std::string> KzipWriter::WriteUnit(
-    const kythe::proto::IndexedCompilation& unit) {
+absl::Status KzipWriter::EnsureInitializedLocked() {
   if (!initialized_) {
     auto status = InitializeArchive(archive_);
     if (!status.ok()) {
@@ -147,71 +360,251 @@ absl::StatusOr<std::string> KzipWriter::WriteUnit(
     }
     initialized_ = true;
   }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::string> KzipWriter::WriteUnit(
+    const kythe::proto::IndexedCompilation& unit) {
+  // Render and hash the unit before taking the lock.
   auto json = WriteMessageAsJsonToString(unit);
   if (!json.ok()) {
     return json.status();
   }
   auto digest = SHA256Digest(*json);
+  std::string contents;
+  if (HasEncoding(encoding_, KzipEncoding::kProto) &&
+      !unit.SerializeToString(&contents)) {
+    return absl::InternalError("Failure serializing compilation unit");
+  }
+  absl::MutexLock lock(&mu_);
+  if (auto status = EnsureInitializedLocked(); !status.ok()) {
+    return status;
+  }
   absl::StatusOr<std::string> result =
       absl::InternalError("unsupported encoding");
   if (HasEncoding(encoding_, KzipEncoding::kJson)) {
-    result = InsertFile(absl::StrCat(kJsonUnitRoot, digest), *json);
+    result = InsertFileLocked(absl::StrCat(kJsonUnitRoot, digest),
+                              *std::move(json));
     if (!result.ok()) {
       return result;
     }
   }
   if (HasEncoding(encoding_, KzipEncoding::kProto)) {
-    std::string contents;
-    if (!unit.SerializeToString(&contents)) {
-      return absl::InternalError("Failure serializing compilation unit");
-    }
-    result = InsertFile(absl::StrCat(kProtoUnitRoot, digest), contents);
+    result = InsertFileLocked(absl::StrCat(kProtoUnitRoot, digest),
+                              std::move(contents));
   }
   return result;
 }
 
 absl::StatusOr<std::string> KzipWriter::WriteFile(absl::string_view content) {
-  if (!initialized_) {
-    auto status = InitializeArchive(archive_);
-    if (!status.ok()) {
-      return status;
-    }
-    initialized_ = true;
+  auto path = absl::StrCat(kFileRoot, SHA256Digest(content));
+  absl::MutexLock lock(&mu_);
+  if (auto status = EnsureInitializedLocked(); !status.ok()) {
+    return status;
+  }
+  // Only copy the contents if they are new.
+  if (paths_.contains(path)) {
+    return std::string(Basename(path));
   }
-  return InsertFile(absl::StrCat(kFileRoot, SHA256Digest(content)), content);
+  return InsertFileLocked(path, std::string(content));
+}
+
+absl::StatusOr<std::string> KzipWriter::WriteOwnedFile(std::string content) {
+  auto path = absl::StrCat(kFileRoot, SHA256Digest(content));
+  absl::MutexLock lock(&mu_);
+  if (auto status = EnsureInitializedLocked(); !status.ok()) {
+    return status;
+  }
+  return InsertFileLocked(path, std::move(content));
 }
 
 absl::Status KzipWriter::Close() {
+  if (pool_ != nullptr) {
+    pool_->Wait();
+  }
+  absl::MutexLock archive_lock(&mu_);
   DCHECK(archive_ != nullptr);
-
   absl::Status result = absl::OkStatus();
-  if (zip_close(archive_) != 0) {
+  for (const auto& entry : entries_) {
+    if (!entry->status.ok()) {
+      result = entry->status;
+      break;
+    }
+  }
+  if (!result.ok()) {
+    zip_discard(archive_);
+  } else if (zip_close(archive_) != 0) {
     result = libzip::ToStatus(zip_get_error(archive_));
     zip_discard(archive_);
   }
 
   archive_ = nullptr;
-  contents_.clear();
+  paths_.clear();
+  entries_.clear();
+  absl::MutexLock lock(&spill_mu_);
+  buffered_bytes_ = 0;
+  if (spill_fd_ >= 0) {
+    ::close(spill_fd_);
+    spill_fd_ = -1;
+    spill_size_ = 0;
+  }
   return result;
 }
 
-absl::StatusOr<std::string> KzipWriter::InsertFile(absl::string_view path,
-                                                   absl::string_view content) {
-  // Initially insert an empty string for the file content.
-  auto insertion = contents_.emplace(std::string(path), "");
+absl::StatusOr<zip_uint64_t> KzipWriter::ReserveSpill(size_t size) {
+  if (spill_fd_ < 0) {
+    const char* tmpdir = std::getenv("TMPDIR");
+    std::string path = absl::StrCat(
+        tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp",
+        "/kzip_writer.XXXXXX");
+    int fd = ::mkstemp(&path[0]);
+    if (fd < 0) {
+      return absl::Status(ErrnoToStatusCode(),
+                          absl::StrCat("Unable to create ", path));
+    }
+    // Only this writer needs the file, through `fd`.
+    ::unlink(path.c_str());
+    spill_fd_ = fd;
+  }
+  zip_uint64_t offset = spill_size_;
+  spill_size_ += size;
+  return offset;
+}
+
+void KzipWriter::Compress(std::string content, CompressedEntry* entry) {
+  entry->size = content.size();
+  entry->crc = Crc32(content);
+  switch (compression_) {
+    case KzipCompression::kDeflate:
+      entry->method = ZIP_CM_DEFLATE;
+      if (!Deflate(content, &entry->compressed)) {
+        entry->status = absl::InternalError("Unable to deflate kzip entry");
+      }
+      content = std::string();
+      break;
+    case KzipCompression::kStore:
+      entry->method = ZIP_CM_STORE;
+      entry->compressed = std::move(content);
+      break;
+  }
+  Retain(entry);
+}
+
+void KzipWriter::Retain(CompressedEntry* entry) {
+  entry->compressed_size = entry->compressed.size();
+  if (entry->status.ok()) {
+    bool spill = false;
+    absl::StatusOr<zip_uint64_t> offset = zip_uint64_t{0};
+    int fd = -1;
+    {
+      absl::MutexLock lock(&spill_mu_);
+      if (buffered_bytes_ + entry->compressed_size <= max_buffered_bytes_) {
+        buffered_bytes_ += entry->compressed_size;
+      } else {
+        spill = true;
+        offset = ReserveSpill(entry->compressed_size);
+        fd = spill_fd_;
+      }
+    }
+    if (!offset.ok()) {
+      entry->status = offset.status();
+    } else if (spill) {
+      // The range is reserved, so write it without holding the lock.
+      if (WriteFullyAt(fd, entry->compressed, *offset)) {
+        entry->spill_fd = fd;
+        entry->spill_offset = *offset;
+        entry->compressed = std::string();
+      } else {
+        entry->status = absl::Status(ErrnoToStatusCode(),
+                                     "Unable to write kzip spill file");
+      }
+    }
+  }
+  absl::MutexLock lock(&entry->mu);
+  entry->done = true;
+}
+
+absl::StatusOr<std::string> KzipWriter::InsertFileLocked(
+    absl::string_view path, std::string content) {
+  auto insertion = paths_.emplace(path);
   if (insertion.second) {
-    // Only copy in the real content if it was actually inserted into the map.
-    auto& entry = insertion.first;
-    entry->second = std::string(content);
-    auto status = WriteTextFile(archive_, entry->first, entry->second);
+    const std::string& name = *insertion.first;
+    // Entries deflated by Compress keep their method by default; stored
+    // ones must ask libzip not to deflate them.
+    const zip_int32_t method = compression_ == KzipCompression::kStore
+                                   ? ZIP_CM_STORE
+                                   : ZIP_CM_DEFAULT;
+    absl::Status status;
+    if (content.empty()) {
+      // There's nothing to deflate; let libzip store it.
+      status = AddSourceLocked(
+          name, zip_source_buffer(archive_, nullptr, 0, 0), method);
+    } else {
+      CompressedEntry* entry = NewEntryLocked();
+      if (pool_ != nullptr) {
+        pool_->Schedule([this, entry, content = std::move(content)]() mutable {
+          Compress(std::move(content), entry);
+        });
+      } else {
+        Compress(std::move(content), entry);
+      }
+      status = AddSourceLocked(
+          name,
+          zip_source_function(archive_, &CompressedEntry::Callback, entry),
+          method);
+    }
     if (!status.ok()) {
-      contents_.erase(entry->first);
+      paths_.erase(name);
       return status;
     }
   }
   return std::string(Basename(path));
 }
 
+KzipWriter::CompressedEntry* KzipWriter::NewEntryLocked() {
+  entries_.push_back(absl::make_unique<CompressedEntry>());
+  CompressedEntry* entry = entries_.back().get();
+  zip_error_init(&entry->error);
+  return entry;
+}
+
+absl::Status KzipWriter::AddSourceLocked(const std::string& name,
+                                         zip_source_t* source,
+                                         zip_int32_t method) {
+  if (source == nullptr) {
+    return libzip::ToStatus(zip_get_error(archive_));
+  }
+  return AddFile(archive_, name, source, method);
+}
+
+absl::StatusOr<std::string> KzipWriter::WriteRawFile(absl::string_view digest,
+                                                     KzipRawEntry raw) {
+  absl::MutexLock lock(&mu_);
+  if (auto status = EnsureInitializedLocked(); !status.ok()) {
+    return status;
+  }
+  auto insertion = paths_.emplace(absl::StrCat(kFileRoot, digest));
+  if (insertion.second) {
+    CompressedEntry* entry = NewEntryLocked();
+    entry->method = raw.method;
+    entry->size = raw.size;
+    entry->crc = raw.crc;
+    entry->compressed = std::move(raw.data);
+    Retain(entry);
+    // Name the method explicitly so that libzip copies the bytes whatever
+    // this writer's own compression is.
+    auto status = AddSourceLocked(
+        *insertion.first,
+        zip_source_function(archive_, &CompressedEntry::Callback, entry),
+        raw.method);
+    if (!status.ok()) {
+      paths_.erase(insertion.first);
+      return status;
+    }
+  }
+  return std::string(digest);
+}
+
 /* static */
 KzipEncoding KzipWriter::DefaultEncoding() {
   if (const char* env_enc = getenv("KYTHE_KZIP_ENCODING")) {
@@ -230,4 +623,33 @@ KzipEncoding KzipWriter::DefaultEncoding() {
   return KzipEncoding::kProto;
 }
 
+/* static */
+KzipCompression KzipWriter::DefaultCompression() {
+  if (const char* env_compression = getenv("KYTHE_KZIP_COMPRESSION")) {
+    std::string compression = absl::AsciiStrToUpper(env_compression);
+    if (compression == "DEFLATE") {
+      return KzipCompression::kDeflate;
+    }
+    if (compression == "STORE") {
+      return KzipCompression::kStore;
+    }
+    LOG(ERROR) << "Unknown compression '" << compression
+               << "', using DEFLATE";
+  }
+  return KzipCompression::kDeflate;
+}
+
+/* static */
+size_t KzipWriter::DefaultMaxBufferedBytes() {
+  if (const char* env_bytes = getenv("KYTHE_KZIP_WRITER_BUFFER_BYTES")) {
+    size_t bytes;
+    if (absl::SimpleAtoi(env_bytes, &bytes)) {
+      return bytes;
+    }
+    LOG(ERROR) << "Invalid KYTHE_KZIP_WRITER_BUFFER_BYTES '" << env_bytes
+               << "', using " << kDefaultMaxBufferedBytes;
+  }
+  return kDefaultMaxBufferedBytes;
+}
+
 }  // namespace kythe
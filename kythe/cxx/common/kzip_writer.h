@@ -19,34 +19,70 @@
 
 #include <zip.h>
 
-#include <unordered_map>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "kythe/cxx/common/index_writer.h"
 #include "kythe/cxx/common/kzip_encoding.h"
+#include "kythe/cxx/common/kzip_raw_entry.h"
+#include "kythe/cxx/common/thread_pool.h"
 #include "kythe/proto/analysis.pb.h"
 
 namespace kythe {
 
 /// \brief Kzip implementation of IndexWriter.
 /// see https://www.kythe.io/docs/kythe-kzip.html for format description.
+///
+/// Units and files may be written from several threads at once; contents are
+/// hashed on the calling thread, outside of the writer's lock.
 class KzipWriter : public IndexWriterInterface {
  public:
+  /// \brief How a KzipWriter encodes and compresses what it writes.
+  struct Options {
+    /// Encoding to use for compilation units.
+    KzipEncoding encoding = DefaultEncoding();
+    /// How to compress entries.
+    KzipCompression compression = DefaultCompression();
+    /// The number of threads to deflate entries on as they are written, or 0
+    /// to deflate them on the calling thread.
+    size_t compression_threads = 0;
+  };
+
   /// \brief Constructs a Kzip IndexWriter which will create and write to
   /// \param path Path to the file to create. Must not currently exist.
   /// \param encoding Encoding to use for compilation units.
+  /// \param compression How to compress entries.
   static absl::StatusOr<IndexWriter> Create(
-      absl::string_view path, KzipEncoding encoding = DefaultEncoding());
+      absl::string_view path, KzipEncoding encoding = DefaultEncoding(),
+      KzipCompression compression = DefaultCompression());
+  /// \brief Like Create, but returns the KzipWriter itself for callers that
+  /// need WriteRawFile.
+  static absl::StatusOr<std::unique_ptr<KzipWriter>> CreateKzip(
+      absl::string_view path, KzipEncoding encoding = DefaultEncoding(),
+      KzipCompression compression = DefaultCompression());
+  /// \brief Like Create, but configured by `options`.
+  static absl::StatusOr<IndexWriter> Create(absl::string_view path,
+                                            const Options& options);
+  /// \brief Like CreateKzip, but configured by `options`.
+  static absl::StatusOr<std::unique_ptr<KzipWriter>> CreateKzip(
+      absl::string_view path, const Options& options);
+
   /// \brief Constructs an IndexWriter from the libzip source pointer.
   /// \param source zip_source_t to use as backing store.
   /// See https://libzip.org/documentation/zip_source.html for ownership.
   /// \param flags Flags to use when opening `source`.
   /// \param encoding Encoding to use for compilation units.
+  /// \param compression How to compress entries.
   static absl::StatusOr<IndexWriter> FromSource(
       zip_source_t* source, KzipEncoding encoding = DefaultEncoding(),
-      int flags = ZIP_CREATE | ZIP_EXCL);
+      int flags = ZIP_CREATE | ZIP_EXCL,
+      KzipCompression compression = DefaultCompression());
 
   /// \brief Destroys the KzipWriter.
   ~KzipWriter() override;
@@ -58,32 +94,91 @@ class KzipWriter : public IndexWriterInterface {
   /// \brief Writes the file contents to the kzip file, returning their digest.
   absl::StatusOr<std::string> WriteFile(absl::string_view content) override;
 
+  /// \brief Like WriteFile, but takes ownership of `content` rather than
+  /// copying it for compression.
+  absl::StatusOr<std::string> WriteOwnedFile(std::string content);
+
+  /// \brief Writes a file's compressed bytes as read by
+  /// KzipReader::ReadRawFile, returning `digest`. The bytes are copied into
+  /// the archive as they are; `digest` is trusted to match their contents.
+  absl::StatusOr<std::string> WriteRawFile(absl::string_view digest,
+                                           KzipRawEntry raw);
+
   /// \brief Flushes accumulated writes and closes the kzip file.
   /// Close must be called before the KzipWriter is destroyed!
   absl::Status Close() override;
 
  private:
   using Path = std::string;
-  using Contents = std::string;
-  using FileMap = std::unordered_map<Path, Contents>;
 
-  explicit KzipWriter(zip_t* archive, KzipEncoding encoding);
+  /// \brief One file's contents, compressed on `pool_` and read back by
+  /// libzip at close.
+  struct CompressedEntry;
 
-  absl::StatusOr<std::string> InsertFile(absl::string_view path,
-                                         absl::string_view content);
+  explicit KzipWriter(zip_t* archive, const Options& options);
 
-  absl::Status InitializeArchive(zip_t* archive);
+  absl::StatusOr<std::string> InsertFileLocked(absl::string_view path,
+                                               std::string content)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  static KzipEncoding DefaultEncoding();
+  absl::Status InitializeArchive(zip_t* archive)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  /// \brief Creates the archive's directories unless that was already done.
+  absl::Status EnsureInitializedLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
-  bool initialized_ = false;  // Whether or not the `root` entry exists.
-  zip_t* archive_;  // Owned, but must be manually deleted via `Close`.
-  // Memory for inserted files must be retained until close and
-  // we don't want to insert identical entries multiple times.
-  // This must be a node-based container to ensure pointer stability of the file
-  // contents.
-  FileMap contents_;
+  /// \brief Returns a new entry, owned by the writer.
+  CompressedEntry* NewEntryLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  /// \brief Adds `source` to the archive as `name`, compressed with `method`
+  /// unless that is ZIP_CM_DEFAULT. Takes ownership of `source`, which may be
+  /// null if creating it failed.
+  absl::Status AddSourceLocked(const std::string& name, zip_source_t* source,
+                               zip_int32_t method)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
+  /// \brief Compresses `content` into `entry`, then retains it. Runs on
+  /// `pool_`.
+  void Compress(std::string content, CompressedEntry* entry)
+      ABSL_LOCKS_EXCLUDED(spill_mu_);
+
+  /// \brief Keeps `entry`'s compressed bytes in memory or appends them to the
+  /// spill file, then marks it done.
+  void Retain(CompressedEntry* entry) ABSL_LOCKS_EXCLUDED(spill_mu_);
+
+  /// \brief Reserves `size` bytes at the end of the spill file, creating it if
+  /// need be, and returns their offset.
+  absl::StatusOr<zip_uint64_t> ReserveSpill(size_t size)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(spill_mu_);
+
+  static KzipEncoding DefaultEncoding();
+  static KzipCompression DefaultCompression();
+  static size_t DefaultMaxBufferedBytes();
+
+  // Guards the archive and the bookkeeping for what has been added to it.
+  absl::Mutex mu_;
+  // Whether or not the `root` entry exists.
+  bool initialized_ ABSL_GUARDED_BY(mu_) = false;
+  // Owned, but must be manually deleted via `Close`.
+  zip_t* archive_ ABSL_GUARDED_BY(mu_);
+  // We don't want to insert identical entries multiple times.
+  absl::flat_hash_set<Path> paths_ ABSL_GUARDED_BY(mu_);
+  // libzip reads file contents only at close, so every entry's compressed
+  // contents are retained until then.
+  std::vector<std::unique_ptr<CompressedEntry>> entries_ ABSL_GUARDED_BY(mu_);
+  const size_t max_buffered_bytes_;
+  absl::Mutex spill_mu_;
+  // Compressed bytes are kept in memory until they total `max_buffered_bytes_`,
+  // after which they are appended to an unlinked temporary file.
+  size_t buffered_bytes_ ABSL_GUARDED_BY(spill_mu_) = 0;
+  int spill_fd_ ABSL_GUARDED_BY(spill_mu_) = -1;
+  zip_uint64_t spill_size_ ABSL_GUARDED_BY(spill_mu_) = 0;
   KzipEncoding encoding_;
+  KzipCompression compression_;
+  // Compresses entries as they are written; null to compress on the calling
+  // thread. Declared last so that it's drained before the members it uses
+  // are destroyed.
+  std::unique_ptr<ThreadPool> pool_;
 };
 
 }  // namespace kythe
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for KzipWriter.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "benchmark/benchmark.h"
+#include "glog/logging.h"
+#include "kythe/cxx/common/index_writer.h"
+#include "kythe/cxx/common/kzip_writer.h"
+
+namespace kythe {
+namespace {
+
+/// \return a path for a scratch kzip under TEST_TMPDIR, or /tmp without it.
+std::string ScratchPath() {
+  const char* tmpdir = std::getenv("TEST_TMPDIR");
+  return absl::StrCat(
+      absl::StripSuffix(tmpdir != nullptr ? tmpdir : "/tmp", "/"),
+      "/kzip_writer_benchmark.", ::getpid(), ".kzip");
+}
+
+/// \return `count` distinct contents of `size` bytes each.
+std::vector<std::string> MakeContents(int count, size_t size) {
+  std::vector<std::string> contents;
+  contents.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    std::string content = absl::StrCat("// file ", i, "\n");
+    content.resize(size, 'x');
+    contents.push_back(std::move(content));
+  }
+  return contents;
+}
+
+/// \brief Writes `range(0)` distinct files of `range(1)` bytes each to a new
+/// kzip and closes it, which is when most of the compression happens.
+void BM_KzipWriteFiles(benchmark::State& state) {
+  const std::vector<std::string> contents =
+      MakeContents(state.range(0), state.range(1));
+  const std::string path = ScratchPath();
+  for (auto _ : state) {
+    auto writer = KzipWriter::Create(path);
+    CHECK(writer.ok()) << writer.status();
+    for (const auto& content : contents) {
+      auto digest = writer->WriteFile(content);
+      CHECK(digest.ok()) << digest.status();
+    }
+    CHECK(writer->Close().ok());
+    state.PauseTiming();
+    std::remove(path.c_str());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * state.range(0) *
+                          state.range(1));
+}
+BENCHMARK(BM_KzipWriteFiles)
+    ->ArgNames({"files", "bytes"})
+    ->ArgsProduct({{16, 256, 4096}, {1 << 10, 1 << 16}})
+    ->Args({16, 1 << 20})
+    ->Unit(benchmark::kMillisecond);
+
+/// \brief Writes `range(0)` files that all have the same contents, which
+/// the writer stores once.
+void BM_KzipWriteDuplicateFiles(benchmark::State& state) {
+  const std::string content = MakeContents(1, 1 << 12).front();
+  const std::string path = ScratchPath();
+  for (auto _ : state) {
+    auto writer = KzipWriter::Create(path);
+    CHECK(writer.ok()) << writer.status();
+    for (int i = 0; i < state.range(0); ++i) {
+      auto digest = writer->WriteFile(content);
+      CHECK(digest.ok()) << digest.status();
+    }
+    CHECK(writer->Close().ok());
+    state.PauseTiming();
+    std::remove(path.c_str());
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KzipWriteDuplicateFiles)
+    ->RangeMultiplier(8)
+    ->Range(16, 4096)
+    ->Unit(benchmark::kMillisecond);
+
+}  // anonymous namespace
+}  // namespace kythe
@@ -19,17 +19,39 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "glog/logging.h"
-#include "kythe/cxx/common/index_writer.h"
 #include "kythe/cxx/common/kzip_writer.h"
+#include "kythe/cxx/common/thread_pool.h"
 #include "kythe/proto/analysis.pb.h"
 
-using kythe::IndexWriter;
 using kythe::KzipEncoding;
 
+/// \brief The writer behind the C API's opaque handle.
+struct KzipWriter {
+  explicit KzipWriter(std::unique_ptr<kythe::KzipWriter> writer)
+      : writer(std::move(writer)) {}
+
+  std::unique_ptr<kythe::KzipWriter> writer;
+  absl::Mutex mu;
+  /// The first failure among asynchronous writes since the last flush.
+  absl::Status async_status ABSL_GUARDED_BY(mu);
+  /// Runs asynchronous writes; created by the first of them. Declared last so
+  /// that it's drained before `writer` is destroyed.
+  std::unique_ptr<kythe::ThreadPool> pool ABSL_GUARDED_BY(mu);
+};
+
 namespace {
 
 KzipEncoding ToKzipEncoding(int32_t encoding) {
@@ -56,6 +78,17 @@ int32_t CodeFromStatus(const absl::Status& s) {
   return static_cast<int32_t>(code);
 }
 
+/// \brief Returns the pool for `writer`'s asynchronous writes, creating it if
+/// need be.
+kythe::ThreadPool* AsyncPool(KzipWriter* writer) {
+  absl::MutexLock lock(&writer->mu);
+  if (writer->pool == nullptr) {
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    writer->pool = absl::make_unique<kythe::ThreadPool>(threads, 2 * threads);
+  }
+  return writer->pool.get();
+}
+
 }  // namespace
 
 KzipWriter* KzipWriter_Create(const char* path, const size_t path_len,
@@ -65,23 +98,37 @@ KzipWriter* KzipWriter_Create(const char* path, const size_t path_len,
   KzipEncoding kzip_encoding = ToKzipEncoding(encoding);
   const absl::string_view path_view(path, path_len);
 
-  absl::StatusOr<IndexWriter> writer =
-      kythe::KzipWriter::Create(path_view, kzip_encoding);
+  auto writer = kythe::KzipWriter::CreateKzip(path_view, kzip_encoding);
   if (!writer.ok()) {
     *create_status = CodeFromStatus(writer.status());
     return nullptr;
   }
-  return reinterpret_cast<KzipWriter*>(
-      new kythe::IndexWriter(*std::move(writer)));
+  return new KzipWriter(*std::move(writer));
 }
 
 void KzipWriter_Delete(KzipWriter* writer) {
   // We assume that `writer` was created by `KzipWriter_Create`.
-  delete reinterpret_cast<IndexWriter*>(writer);
+  delete writer;
 }
 
 int32_t KzipWriter_Close(KzipWriter* writer) {
-  const absl::Status status = reinterpret_cast<IndexWriter*>(writer)->Close();
+  const int32_t flushed = KzipWriter_Flush(writer);
+  const absl::Status status = writer->writer->Close();
+  return status.ok() ? flushed : static_cast<int32_t>(status.code());
+}
+
+int32_t KzipWriter_Flush(KzipWriter* writer) {
+  kythe::ThreadPool* pool;
+  {
+    absl::MutexLock lock(&writer->mu);
+    pool = writer->pool.get();
+  }
+  if (pool != nullptr) {
+    pool->Wait();
+  }
+  absl::MutexLock lock(&writer->mu);
+  const absl::Status status =
+      std::exchange(writer->async_status, absl::OkStatus());
   return static_cast<int32_t>(status.code());
 }
 
@@ -90,8 +137,7 @@ int32_t KzipWriter_WriteFile(KzipWriter* writer, const char* content,
                              size_t buffer_length,
                              size_t* resulting_digest_size) {
   // We assume that `writer` was created by `KzipWriter_Create`.
-  IndexWriter* w = reinterpret_cast<IndexWriter*>(writer);
-  auto digest_or = w->WriteFile({content, content_length});
+  auto digest_or = writer->writer->WriteFile({content, content_length});
   if (!digest_or.ok()) {
     return CodeFromStatus(digest_or.status());
   }
@@ -105,19 +151,47 @@ int32_t KzipWriter_WriteFile(KzipWriter* writer, const char* content,
   return 0;
 }
 
+int32_t KzipWriter_WriteFileAsync(KzipWriter* writer, const char* content,
+                                  const size_t content_length,
+                                  KzipWriterWriteFileCallback callback,
+                                  void* context) {
+  // We assume that `writer` was created by `KzipWriter_Create`.
+  AsyncPool(writer)->Schedule(
+      [writer, content = std::string(content, content_length), callback,
+       context]() mutable {
+        auto digest = writer->writer->WriteOwnedFile(std::move(content));
+        if (!digest.ok()) {
+          const int32_t code = CodeFromStatus(digest.status());
+          {
+            absl::MutexLock lock(&writer->mu);
+            if (writer->async_status.ok()) {
+              writer->async_status = digest.status();
+            }
+          }
+          if (callback != nullptr) {
+            callback(context, code, nullptr, 0);
+          }
+          return;
+        }
+        if (callback != nullptr) {
+          callback(context, 0, digest->data(), digest->size());
+        }
+      });
+  return 0;
+}
+
 int32_t KzipWriter_WriteUnit(KzipWriter* writer, const char* proto,
                              size_t proto_length, char* digest_buffer,
                              size_t buffer_length,
                              size_t* resulting_digest_size) {
   // We assume that `writer` was created by `KzipWriter_Create`.
-  IndexWriter* w = reinterpret_cast<IndexWriter*>(writer);
   kythe::proto::IndexedCompilation unit;
   const bool success = unit.ParseFromArray(proto, proto_length);
   if (!success) {
     LOG(ERROR) << "Protobuf could not be parsed, at len: " << proto_length;
     return KZIP_WRITER_PROTO_PARSING_ERROR;
   }
-  absl::StatusOr<std::string> digest_or = w->WriteUnit(unit);
+  absl::StatusOr<std::string> digest_or = writer->writer->WriteUnit(unit);
   if (!digest_or.ok()) {
     return CodeFromStatus(digest_or.status());
   }
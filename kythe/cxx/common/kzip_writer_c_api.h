@@ -60,7 +60,9 @@ struct KzipWriter* KzipWriter_Create(const char* path, const size_t path_len,
 void KzipWriter_Delete(struct KzipWriter* writer);
 
 /// \brief Closes the writer.
-/// Must be called before destroying the object.
+/// Must be called before destroying the object. Waits for any writes started
+/// by KzipWriter_WriteFileAsync to finish first; if one of them failed since
+/// the last KzipWriter_Flush, its status is returned.
 int32_t KzipWriter_Close(struct KzipWriter* writer);
 
 /// \brief Writes a piece of content into the kzip, returning a digest.
@@ -82,6 +84,39 @@ int32_t KzipWriter_WriteFile(struct KzipWriter* writer, const char* content,
                              size_t buffer_length,
                              size_t* resulting_digest_size);
 
+/// \brief Receives the outcome of KzipWriter_WriteFileAsync.
+/// \param context The context passed to KzipWriter_WriteFileAsync.
+/// \param status Zero if the file was written, otherwise an error as for
+///        KzipWriter_WriteFile.
+/// \param digest The digest of the file, or NULL on error.  It is NOT
+///        NUL-terminated and is only valid for the duration of the call.
+/// \param digest_length The length of digest in bytes.
+typedef void (*KzipWriterWriteFileCallback)(void* context, int32_t status,
+                                            const char* digest,
+                                            size_t digest_length);
+
+/// \brief Starts writing a piece of content into the kzip.
+///
+/// The content is copied before this returns, so the caller may reuse its
+/// buffer immediately.  Hashing and compression happen on threads owned by
+/// the writer, off the caller's critical path.  Once the file has been
+/// written, `callback` (unless NULL) is called with `context` and the digest
+/// on one of those threads; callbacks may run concurrently with each other and
+/// with the caller.  Blocks while too many writes are already pending, which
+/// bounds the memory held by copied contents.
+/// \return Zero if the write was started.
+int32_t KzipWriter_WriteFileAsync(struct KzipWriter* writer,
+                                  const char* content,
+                                  const size_t content_length,
+                                  KzipWriterWriteFileCallback callback,
+                                  void* context);
+
+/// \brief Waits until every write started by KzipWriter_WriteFileAsync has
+/// finished and its callback has returned.
+/// \return Zero, or the status of the first of those writes that failed since
+///         the previous flush.
+int32_t KzipWriter_Flush(struct KzipWriter* writer);
+
 /// \brief Writes a compilation unit into the kzip, returning a digest.
 //
 /// The caller must provide a buffer to put the digest into, and a buffer size.
@@ -27,6 +27,7 @@
 #include "absl/strings/str_replace.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
 #include "glog/logging.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -116,5 +117,63 @@ TEST(KzipWriterCApiTest, CApiTest) {
           "44136fa355b3678a1146ad16f7e8649e94fb4fc21fe77e8310c060f61caaff8a"));
 }
 
+TEST(KzipWriterCApiTest, WriteFileAsync) {
+  std::string dummy_file = TestOutputFile("dummy.kzip");
+  int32_t status;
+  ::KzipWriter* w = KzipWriter_Create(dummy_file.c_str(), dummy_file.length(),
+                                      KZIP_WRITER_ENCODING_PROTO, &status);
+  ASSERT_EQ(0, status);
+  struct Digests {
+    absl::Mutex mu;
+    std::unordered_map<std::string, std::string> by_content;
+  } digests;
+  struct Write {
+    Digests* digests;
+    std::string content;
+  };
+  std::vector<Write> writes;
+  for (int i = 0; i < 64; ++i) {
+    writes.push_back({&digests, absl::StrCat("contents ", i % 16)});
+  }
+  for (auto& write : writes) {
+    // The content is copied, so it may be discarded right away.
+    std::string content = write.content;
+    ASSERT_EQ(0, KzipWriter_WriteFileAsync(
+                     w, content.data(), content.size(),
+                     [](void* context, int32_t status, const char* digest,
+                        size_t digest_length) {
+                       auto* write = static_cast<Write*>(context);
+                       ASSERT_EQ(0, status);
+                       absl::MutexLock lock(&write->digests->mu);
+                       auto inserted = write->digests->by_content.emplace(
+                           write->content, std::string(digest, digest_length));
+                       EXPECT_EQ(inserted.first->second,
+                                 std::string(digest, digest_length));
+                     },
+                     &write));
+  }
+  ASSERT_EQ(0, KzipWriter_Flush(w));
+  {
+    absl::MutexLock lock(&digests.mu);
+    EXPECT_EQ(16, digests.by_content.size());
+  }
+  // Synchronous writes of the same contents agree on their digests.
+  std::string contents("contents 3");
+  char digest[200];
+  size_t length;
+  ASSERT_EQ(0, KzipWriter_WriteFile(w, contents.c_str(), contents.length(),
+                                    digest, sizeof(digest), &length));
+  EXPECT_EQ(digests.by_content[contents], std::string(digest, length));
+  ASSERT_EQ(0, KzipWriter_WriteFileAsync(w, "late", 4, nullptr, nullptr));
+  EXPECT_EQ(0, KzipWriter_Close(w));
+  KzipWriter_Delete(w);
+
+  auto* archive = zip_open(dummy_file.c_str(), ZIP_RDONLY, nullptr);
+  ASSERT_NE(archive, nullptr);
+  // The three directories, the sixteen distinct contents, and "late".
+  EXPECT_EQ(3 + 16 + 1, zip_get_num_entries(archive, 0));
+  zip_discard(archive);
+}
+
 }  // namespace
 }  // namespace kythe
@@ -21,6 +21,7 @@
 #include <cstdlib>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -166,6 +167,173 @@ TEST_P(FullKzipWriterTest, RecapitulatesSimpleKzip) {
   EXPECT_EQ(*written_digests, *read_digests);
 }
 
+TEST(KzipWriterTest, SpillsContentsPastBufferLimit) {
+  proto::GoDetails needed_for_proto_deserialization;
+
+  absl::StatusOr<IndexReader> reader =
+      KzipReader::Open(TestFile("stringset.kzip"));
+  ASSERT_TRUE(reader.ok()) << reader.status();
+
+  // Buffer only the first few bytes so that the rest are spilled to disk.
+  ::setenv("KYTHE_KZIP_WRITER_BUFFER_BYTES", "16", 1);
+  std::string output_file = TestOutputFile("spilled.kzip");
+  absl::StatusOr<IndexWriter> writer = KzipWriter::Create(output_file);
+  ::unsetenv("KYTHE_KZIP_WRITER_BUFFER_BYTES");
+  ASSERT_TRUE(writer.ok()) << writer.status();
+  auto written_digests = CopyIndex(&*reader, &*writer);
+  ASSERT_TRUE(written_digests.ok()) << written_digests.status();
+  {
+    auto status = writer->Close();
+    ASSERT_TRUE(status.ok()) << status;
+  }
+
+  absl::StatusOr<IndexReader> spilled = KzipReader::Open(output_file);
+  ASSERT_TRUE(spilled.ok()) << spilled.status();
+  auto read_digests = ReadDigests(&*spilled);
+  ASSERT_TRUE(read_digests.ok()) << read_digests.status();
+  EXPECT_EQ(*written_digests, *read_digests);
+  for (const auto& unit : *read_digests) {
+    for (const auto& file : unit.second) {
+      auto expected = reader->ReadFile(file);
+      ASSERT_TRUE(expected.ok()) << expected.status();
+      auto actual = spilled->ReadFile(file);
+      ASSERT_TRUE(actual.ok()) << actual.status();
+      EXPECT_EQ(*expected, *actual);
+    }
+  }
+}
+
+TEST(KzipWriterTest, CompressesOnThreadPool) {
+  proto::GoDetails needed_for_proto_deserialization;
+
+  absl::StatusOr<IndexReader> reader =
+      KzipReader::Open(TestFile("stringset.kzip"));
+  ASSERT_TRUE(reader.ok()) << reader.status();
+
+  KzipWriter::Options options;
+  options.compression_threads = 4;
+  std::string output_file = TestOutputFile("pooled.kzip");
+  absl::StatusOr<IndexWriter> writer = KzipWriter::Create(output_file, options);
+  ASSERT_TRUE(writer.ok()) << writer.status();
+  auto written_digests = CopyIndex(&*reader, &*writer);
+  ASSERT_TRUE(written_digests.ok()) << written_digests.status();
+  {
+    auto status = writer->Close();
+    ASSERT_TRUE(status.ok()) << status;
+  }
+
+  absl::StatusOr<IndexReader> pooled = KzipReader::Open(output_file);
+  ASSERT_TRUE(pooled.ok()) << pooled.status();
+  auto read_digests = ReadDigests(&*pooled);
+  ASSERT_TRUE(read_digests.ok()) << read_digests.status();
+  EXPECT_EQ(*written_digests, *read_digests);
+  for (const auto& unit : *read_digests) {
+    for (const auto& file : unit.second) {
+      auto expected = reader->ReadFile(file);
+      ASSERT_TRUE(expected.ok()) << expected.status();
+      auto actual = pooled->ReadFile(file);
+      ASSERT_TRUE(actual.ok()) << actual.status();
+      EXPECT_EQ(*expected, *actual);
+    }
+  }
+}
+
+TEST(KzipWriterTest, CompressesOnCallingThread) {
+  // Without compression_threads, entries are deflated as they are written.
+  std::string output_file = TestOutputFile("inline.kzip");
+  absl::StatusOr<IndexWriter> writer = KzipWriter::Create(output_file);
+  ASSERT_TRUE(writer.ok()) << writer.status();
+  auto digest = writer->WriteFile("contents");
+  ASSERT_TRUE(digest.ok()) << digest.status();
+  auto empty_digest = writer->WriteFile("");
+  ASSERT_TRUE(empty_digest.ok()) << empty_digest.status();
+  proto::IndexedCompilation unit;
+  unit.mutable_unit()->add_required_input()->mutable_info()->set_digest(
+      *digest);
+  ASSERT_TRUE(writer->WriteUnit(unit).ok());
+  {
+    auto status = writer->Close();
+    ASSERT_TRUE(status.ok()) << status;
+  }
+
+  absl::StatusOr<IndexReader> reader = KzipReader::Open(output_file);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  auto contents = reader->ReadFile(*digest);
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_EQ(*contents, "contents");
+  auto empty = reader->ReadFile(*empty_digest);
+  ASSERT_TRUE(empty.ok()) << empty.status();
+  EXPECT_EQ(*empty, "");
+}
+
+TEST(KzipWriterTest, StoresEntriesUncompressed) {
+  std::string output_file = TestOutputFile("stored.kzip");
+  absl::StatusOr<IndexWriter> writer = KzipWriter::Create(
+      output_file, KzipEncoding::kProto, KzipCompression::kStore);
+  ASSERT_TRUE(writer.ok()) << writer.status();
+  auto digest = writer->WriteFile("contents");
+  ASSERT_TRUE(digest.ok()) << digest.status();
+  {
+    auto status = writer->Close();
+    ASSERT_TRUE(status.ok()) << status;
+  }
+
+  {
+    auto* archive = zip_open(output_file.c_str(), ZIP_RDONLY, nullptr);
+    ASSERT_NE(archive, nullptr);
+    struct Closer {
+      ~Closer() { zip_discard(a); }
+      zip_t* a;
+    } closer{archive};
+    zip_stat_t sb;
+    zip_stat_init(&sb);
+    ASSERT_EQ(zip_stat(archive, absl::StrCat("root/files/", *digest).c_str(),
+                       0, &sb),
+              0)
+        << libzip::ToStatus(zip_get_error(archive));
+    EXPECT_EQ(sb.comp_method, ZIP_CM_STORE);
+  }
+
+  absl::StatusOr<IndexReader> reader = KzipReader::Open(output_file);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  auto contents = reader->ReadFile(*digest);
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_EQ(*contents, "contents");
+}
+
+TEST(KzipWriterTest, CopiesRawEntries) {
+  auto input = KzipReader::OpenKzip(TestFile("stringset.kzip"));
+  ASSERT_TRUE(input.ok()) << input.status();
+  std::string output_file = TestOutputFile("raw.kzip");
+  auto writer = KzipWriter::CreateKzip(output_file);
+  ASSERT_TRUE(writer.ok()) << writer.status();
+
+  std::vector<std::string> digests;
+  auto status = (*input)->ScanFiles([&](absl::string_view digest) {
+    auto raw = (*input)->ReadRawFile(digest);
+    EXPECT_TRUE(raw.ok()) << raw.status();
+    if (!raw.ok()) return false;
+    auto written = (*writer)->WriteRawFile(digest, *std::move(raw));
+    EXPECT_TRUE(written.ok()) << written.status();
+    digests.emplace_back(digest);
+    return written.ok();
+  });
+  ASSERT_TRUE(status.ok()) << status;
+  ASSERT_FALSE(digests.empty());
+  status = (*writer)->Close();
+  ASSERT_TRUE(status.ok()) << status;
+
+  auto output = KzipReader::OpenKzip(output_file);
+  ASSERT_TRUE(output.ok()) << output.status();
+  for (const auto& digest : digests) {
+    auto expected = (*input)->ReadFile(digest);
+    ASSERT_TRUE(expected.ok()) << expected.status();
+    auto actual = (*output)->ReadFile(digest);
+    ASSERT_TRUE(actual.ok()) << actual.status();
+    EXPECT_EQ(*actual, *expected);
+  }
+}
+
 TEST(KzipWriterTest, IncludesDirectoryEntries) {
   std::string dummy_file = TestOutputFile("dummy.kzip");
   absl::StatusOr<IndexWriter> writer = KzipWriter::Create(dummy_file);
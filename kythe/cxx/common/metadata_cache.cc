@@ -0,0 +1,83 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/metadata_cache.h"
+
+#include <openssl/sha.h>
+
+#include <utility>
+
+namespace kythe {
+namespace {
+
+void HashWithLength(absl::string_view text, SHA256_CTX* sha) {
+  uint64_t size = text.size();
+  ::SHA256_Update(sha, &size, sizeof(size));
+  ::SHA256_Update(sha, text.data(), text.size());
+}
+
+}  // anonymous namespace
+
+std::string MetadataCache::Key(absl::string_view filename,
+                               absl::string_view contents) {
+  // Prefixing each part with its length keeps different splits of the same
+  // bytes from colliding.
+  ::SHA256_CTX sha;
+  ::SHA256_Init(&sha);
+  HashWithLength(filename, &sha);
+  HashWithLength(contents, &sha);
+  std::string key(SHA256_DIGEST_LENGTH, '\0');
+  ::SHA256_Final(reinterpret_cast<unsigned char*>(&key[0]), &sha);
+  return key;
+}
+
+std::shared_ptr<const MetadataCache::Entry> MetadataCache::Find(
+    const std::string& key) {
+  absl::MutexLock lock(&mu_);
+  ++finds_;
+  auto found = entries_.find(key);
+  if (found == entries_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  return found->second;
+}
+
+void MetadataCache::Insert(const std::string& key, Entry entry) {
+  auto shared = std::make_shared<const Entry>(std::move(entry));
+  absl::MutexLock lock(&mu_);
+  if (entries_.size() >= max_entries_ && !entries_.contains(key)) {
+    entries_.clear();
+  }
+  entries_[key] = std::move(shared);
+}
+
+void MetadataCache::CountStale() {
+  absl::MutexLock lock(&mu_);
+  ++misses_;
+}
+
+uint64_t MetadataCache::hits() const {
+  absl::MutexLock lock(&mu_);
+  return finds_ - misses_;
+}
+
+uint64_t MetadataCache::misses() const {
+  absl::MutexLock lock(&mu_);
+  return misses_;
+}
+
+}  // namespace kythe
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_METADATA_CACHE_H_
+#define KYTHE_CXX_COMMON_METADATA_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+
+class MetadataFile;
+
+/// \brief Remembers parsed metadata files so that the units in one process
+/// that include the same generated file parse its metadata once.
+///
+/// Entries are keyed by the metadata file's name and its metadata, after any
+/// comment or base64 encoding has been removed. Some formats ask for the
+/// VNames of other files while they are parsed; the answers are kept with the
+/// entry, and the entry is only reused by a unit that gets the same answers.
+/// Safe to use from several threads.
+class MetadataCache {
+ public:
+  /// \brief A VName lookup made while parsing a metadata file.
+  struct Lookup {
+    std::string path;
+    bool found = false;
+    proto::VName vname;
+  };
+
+  /// \brief A parsed metadata file.
+  struct Entry {
+    std::shared_ptr<const MetadataFile> file;
+    /// The distinct lookups made while parsing `file`.
+    std::vector<Lookup> lookups;
+  };
+
+  /// \param max_entries How many entries to keep before starting over.
+  explicit MetadataCache(size_t max_entries) : max_entries_(max_entries) {}
+  MetadataCache(const MetadataCache&) = delete;
+  MetadataCache& operator=(const MetadataCache&) = delete;
+
+  /// \return the key for the metadata file named `filename` with the
+  /// (decoded) metadata `contents`.
+  static std::string Key(absl::string_view filename,
+                         absl::string_view contents);
+
+  /// \return the entry remembered for `key` or null.
+  std::shared_ptr<const Entry> Find(const std::string& key)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Remembers `entry` for `key`, replacing any earlier entry.
+  void Insert(const std::string& key, Entry entry) ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Counts a `Find` whose entry was found but couldn't be used.
+  void CountStale() ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \return the number of entries that were found and used.
+  uint64_t hits() const ABSL_LOCKS_EXCLUDED(mu_);
+  /// \return the number of files that had to be parsed.
+  uint64_t misses() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  /// The number of entries to keep before starting over.
+  const size_t max_entries_;
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<std::string, std::shared_ptr<const Entry>> entries_
+      ABSL_GUARDED_BY(mu_);
+  uint64_t finds_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t misses_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_METADATA_CACHE_H_
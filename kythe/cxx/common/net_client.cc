@@ -18,6 +18,9 @@
 
 #include <curl/curl.h>
 
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
@@ -27,9 +30,29 @@
 #include "rapidjson/writer.h"
 
 namespace kythe {
+namespace {
+/// Marks a base URI whose requests should be sent as serialized protobufs.
+constexpr absl::string_view kProtoSchemePrefix = "proto+";
+}  // anonymous namespace
 
 JsonClient::JsonClient() : curl_(::curl_easy_init()) {
   CHECK(curl_ != nullptr);
+  // The handle keeps its connection open after each transfer, so everything
+  // that doesn't vary between requests is set up once here.
+  ::curl_easy_setopt(curl_, CURLOPT_READFUNCTION, CurlReadCallback);
+  ::curl_easy_setopt(curl_, CURLOPT_READDATA, this);
+  ::curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
+  ::curl_easy_setopt(curl_, CURLOPT_WRITEDATA, this);
+  ::curl_easy_setopt(curl_, CURLOPT_TCP_KEEPALIVE, 1L);
+  // Fails harmlessly (leaving HTTP/1.1) if curl was built without HTTP/2.
+  ::curl_easy_setopt(curl_, CURLOPT_HTTP_VERSION,
+                     static_cast<long>(CURL_HTTP_VERSION_2TLS));
+  json_headers_ =
+      ::curl_slist_append(nullptr, "Content-Type: application/json");
+  CHECK(json_headers_ != nullptr);
+  proto_headers_ =
+      ::curl_slist_append(nullptr, "Content-Type: application/x-protobuf");
+  CHECK(proto_headers_ != nullptr);
 }
 
 JsonClient::~JsonClient() {
@@ -37,6 +60,8 @@ JsonClient::~JsonClient() {
     ::curl_easy_cleanup(curl_);
     curl_ = nullptr;
   }
+  ::curl_slist_free_all(json_headers_);
+  ::curl_slist_free_all(proto_headers_);
 }
 
 void JsonClient::InitNetwork() {
@@ -55,12 +80,13 @@ size_t JsonClient::CurlWriteCallback(void* data, size_t size, size_t nmemb,
 size_t JsonClient::CurlReadCallback(void* data, size_t size, size_t nmemb,
                                     void* user) {
   JsonClient* client = static_cast<JsonClient*>(user);
-  if (client->send_head_ >= client->to_send_.size()) {
+  if (client->to_send_ == nullptr ||
+      client->send_head_ >= client->to_send_->size()) {
     return 0;
   }
   size_t bytes_to_send =
-      std::min(size * nmemb, client->to_send_.size() - client->send_head_);
-  ::memcpy(data, client->to_send_.data() + client->send_head_, bytes_to_send);
+      std::min(size * nmemb, client->to_send_->size() - client->send_head_);
+  ::memcpy(data, client->to_send_->data() + client->send_head_, bytes_to_send);
   client->send_head_ += bytes_to_send;
   return bytes_to_send;
 }
@@ -93,25 +119,31 @@ bool JsonClient::Request(const std::string& uri, bool post,
 
 bool JsonClient::Request(const std::string& uri, bool post,
                          const std::string& request, std::string* response) {
-  to_send_ = request;
+  return Perform(uri, post, post ? json_headers_ : nullptr, request, response);
+}
+
+bool JsonClient::PostProto(const std::string& uri, const std::string& request,
+                           std::string* response) {
+  return Perform(uri, true, proto_headers_, request, response);
+}
+
+bool JsonClient::Perform(const std::string& uri, bool post,
+                         ::curl_slist* headers, const std::string& request,
+                         std::string* response) {
+  to_send_ = &request;
   send_head_ = 0;
   received_.clear();
 
   ::curl_easy_setopt(curl_, CURLOPT_URL, uri.c_str());
   ::curl_easy_setopt(curl_, CURLOPT_POST, post ? 1L : 0L);
-  ::curl_easy_setopt(curl_, CURLOPT_READFUNCTION, CurlReadCallback);
-  ::curl_easy_setopt(curl_, CURLOPT_READDATA, this);
-  ::curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
-  ::curl_easy_setopt(curl_, CURLOPT_WRITEDATA, this);
-  ::curl_slist* headers = nullptr;
+  ::curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers);
   if (post) {
-    headers = ::curl_slist_append(headers, "Content-Type: application/json");
-    ::curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, headers);
-    ::curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, request.size());
+    ::curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE,
+                       static_cast<long>(request.size()));
   }
 
   ::CURLcode res = ::curl_easy_perform(curl_);
-  ::curl_slist_free_all(headers);
+  to_send_ = nullptr;
 
   if (res) {
     LOG(ERROR) << "(uri: " << uri << "): " << ::curl_easy_strerror(res);
@@ -129,24 +161,42 @@ bool JsonClient::Request(const std::string& uri, bool post,
     return false;
   }
   if (response) {
-    *response = received_;
+    response->swap(received_);
   }
   return true;
 }
 
+XrefsJsonClient::XrefsJsonClient(std::unique_ptr<JsonClient> client,
+                                 const std::string& base_uri)
+    : client_(std::move(client)) {
+  absl::string_view base = base_uri;
+  proto_requests_ = absl::ConsumePrefix(&base, kProtoSchemePrefix);
+  nodes_uri_ = absl::StrCat(base, "/nodes?proto=1");
+  edges_uri_ = absl::StrCat(base, "/edges?proto=1");
+  decorations_uri_ = absl::StrCat(base, "/decorations?proto=1");
+  documentation_uri_ = absl::StrCat(base, "/documentation?proto=1");
+}
+
 bool XrefsJsonClient::Roundtrip(const std::string& endpoint,
                                 const google::protobuf::Message& request,
                                 google::protobuf::Message* response,
                                 std::string* error_text) {
-  std::string request_json;
-  if (!WriteMessageAsJsonToString(request, &request_json)) {
+  std::string request_body;
+  bool encoded = proto_requests_
+                     ? request.SerializeToString(&request_body)
+                     : WriteMessageAsJsonToString(request, &request_body);
+  if (!encoded) {
     if (error_text) {
       *error_text = "Couldn't serialize message.";
     }
     return false;
   }
   std::string response_buffer;
-  if (!client_->Request(endpoint, true, request_json, &response_buffer)) {
+  bool sent =
+      proto_requests_
+          ? client_->PostProto(endpoint, request_body, &response_buffer)
+          : client_->Request(endpoint, true, request_body, &response_buffer);
+  if (!sent) {
     if (error_text) {
       *error_text = "Network client error.";
     }
@@ -31,12 +31,17 @@ namespace kythe {
 
 /// \brief Issues JSON-formatted RPCs.
 ///
-/// JsonClient is not thread-safe.
+/// Requests share one connection, which is kept alive between them and
+/// negotiates HTTP/2 when the server offers it over TLS. JsonClient is not
+/// thread-safe.
 class JsonClient {
  public:
   JsonClient();
   ~JsonClient();
 
+  JsonClient(const JsonClient&) = delete;
+  JsonClient& operator=(const JsonClient&) = delete;
+
   /// \brief Call once to initialize the underlying network library.
   static void InitNetwork();
 
@@ -68,7 +73,19 @@ class JsonClient {
   bool Request(const std::string& uri, bool post, const std::string& request,
                std::string* response);
 
+  /// \brief Issue a post of a serialized protobuf.
+  /// \param uri The URI to request.
+  /// \param request The serialized message to send.
+  /// \param response The raw string to fill with the response.
+  /// \return true on success and false on failure
+  bool PostProto(const std::string& uri, const std::string& request,
+                 std::string* response);
+
  private:
+  /// \brief Performs one transfer, sending `headers` (which may be null).
+  bool Perform(const std::string& uri, bool post, ::curl_slist* headers,
+               const std::string& request, std::string* response);
+
   static size_t CurlWriteCallback(void* data, size_t size, size_t nmemb,
                                   void* user);
   static size_t CurlReadCallback(void* data, size_t size, size_t nmemb,
@@ -76,10 +93,14 @@ class JsonClient {
 
   /// The network context.
   CURL* curl_;
-  /// A buffer used for communications.
-  std::string to_send_;
-  /// Where we are in the buffer.
-  size_t send_head_;
+  /// The headers sent with JSON posts.
+  ::curl_slist* json_headers_ = nullptr;
+  /// The headers sent with protobuf posts.
+  ::curl_slist* proto_headers_ = nullptr;
+  /// The body of the request in flight.
+  const std::string* to_send_ = nullptr;
+  /// Where we are in `to_send_`.
+  size_t send_head_ = 0;
   /// A buffer used for communications.
   std::string received_;
 };
@@ -144,18 +165,18 @@ class XrefsClient {
   }
 };
 
-/// \brief A client for a Kythe xrefs service that talks JSON.
+/// \brief A client for a Kythe xrefs service that talks JSON over HTTP.
+///
+/// Replies always come back as serialized protobufs. Requests are sent as
+/// JSON unless the base URI's scheme has a "proto+" prefix
+/// ("proto+http://localhost:8080"), in which case they are sent as serialized
+/// protobufs too.
 class XrefsJsonClient : public XrefsClient {
  public:
   /// \param client The JsonClient to use.
   /// \param base_uri The base URI of the service ("http://localhost:8080")
   XrefsJsonClient(std::unique_ptr<JsonClient> client,
-                  const std::string& base_uri)
-      : client_(std::move(client)),
-        nodes_uri_(base_uri + "/nodes?proto=1"),
-        edges_uri_(base_uri + "/edges?proto=1"),
-        decorations_uri_(base_uri + "/decorations?proto=1"),
-        documentation_uri_(base_uri + "/documentation?proto=1") {}
+                  const std::string& base_uri);
   bool Nodes(const proto::NodesRequest& request, proto::NodesReply* reply,
              std::string* error_text) override {
     return Roundtrip(nodes_uri_, request, reply, error_text);
@@ -181,6 +202,8 @@ class XrefsJsonClient : public XrefsClient {
                  google::protobuf::Message* response, std::string* error_text);
 
   std::unique_ptr<JsonClient> client_;
+  /// Whether requests are sent as serialized protobufs rather than JSON.
+  bool proto_requests_ = false;
   std::string nodes_uri_;
   std::string edges_uri_;
   std::string decorations_uri_;
@@ -19,27 +19,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <vector>
+#include <cstring>
 
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
-#include "absl/strings/str_join.h"
-#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
 #include "glog/logging.h"
 #include "kythe/cxx/common/status.h"
 
 namespace kythe {
 namespace {
 
-// Predicate used in CleanPath for skipping empty components
-// and components consistening of a single '.'.
-struct SkipEmptyDot {
-  bool operator()(absl::string_view sp) { return !(sp.empty() || sp == "."); }
-};
-
 // Deal with relative paths as well as '/' and '//'.
 absl::string_view PathPrefix(absl::string_view path) {
   int slash_count = 0;
@@ -95,6 +88,29 @@ absl::optional<std::string> MaybeRealPath(
   return absl::nullopt;
 }
 
+// Sets `result` to the clean, absolute version of `path`. Relative paths are
+// resolved against `working_directory`, which is looked up on first use so
+// that callers cleaning several paths need do so at most once.
+absl::Status CleanAbsolutePath(
+    absl::string_view path, absl::optional<std::string>* working_directory,
+    std::string* result) {
+  if (IsAbsolutePath(path)) {
+    result->assign(path.data(), path.size());
+  } else {
+    if (!working_directory->has_value()) {
+      absl::StatusOr<std::string> dir = GetCurrentDirectory();
+      if (!dir.ok()) {
+        return dir.status();
+      }
+      *working_directory = *std::move(dir);
+    }
+    result->clear();
+    absl::StrAppend(result, **working_directory, "/", path);
+  }
+  CleanPathInPlace(result);
+  return absl::OkStatus();
+}
+
 struct PathParts {
   absl::string_view dir, base;
 };
@@ -124,12 +140,18 @@ absl::StatusOr<PathCleaner> PathCleaner::Create(absl::string_view root) {
 
 absl::StatusOr<std::string> PathCleaner::Relativize(
     absl::string_view path) const {
-  if (absl::StatusOr<std::string> resolved = MakeCleanAbsolutePath(path);
-      resolved.ok()) {
-    return std::string(TrimPathPrefix(*std::move(resolved), root_));
-  } else {
-    return resolved.status();
+  absl::optional<std::string> working_directory;
+  std::string resolved;
+  if (absl::Status status =
+          CleanAbsolutePath(path, &working_directory, &resolved);
+      !status.ok()) {
+    return status;
   }
+  absl::string_view relative = TrimPathPrefix(resolved, root_);
+  // Trimming only ever removes a prefix, so the result can be moved into
+  // place rather than copied into a new string.
+  resolved.erase(0, relative.data() - resolved.data());
+  return resolved;
 }
 
 absl::StatusOr<PathRealizer> PathRealizer::Create(absl::string_view root) {
@@ -253,20 +275,53 @@ std::string JoinPath(absl::string_view a, absl::string_view b) {
 }
 
 std::string CleanPath(absl::string_view input) {
-  const bool is_absolute_path = absl::StartsWith(input, "/");
-  std::vector<absl::string_view> parts;
-  for (absl::string_view comp : absl::StrSplit(input, '/', SkipEmptyDot{})) {
-    if (comp == "..") {
-      if (!parts.empty() && parts.back() != "..") {
-        parts.pop_back();
+  std::string result(input);
+  CleanPathInPlace(&result);
+  return result;
+}
+
+void CleanPathInPlace(std::string* path) {
+  char* data = &(*path)[0];
+  const size_t size = path->size();
+  // Deal with leading '//' as well as '/'. The input starts with at least as
+  // many slashes as the prefix has, so the prefix is already in place.
+  const size_t prefix = PathPrefix(*path).size();
+  const bool is_absolute_path = prefix != 0;
+  // Components are copied down to `write` as they are read. Each one takes
+  // up no more room than it did in the input, so `write` never passes `read`.
+  size_t write = prefix;
+  // Components before this point in the output (the prefix and any leading
+  // ".."s) can't be removed by a later "..".
+  size_t fixed = prefix;
+  size_t read = 0;
+  while (read < size) {
+    if (data[read] == '/') {
+      ++read;
+      continue;
+    }
+    size_t end = read;
+    while (end < size && data[end] != '/') ++end;
+    absl::string_view comp(data + read, end - read);
+    read = end;
+    if (comp == ".") continue;
+    // Copying the component down may overwrite it, so look at it first.
+    const bool is_parent = comp == "..";
+    if (is_parent) {
+      if (write > fixed) {
+        // Drop the last component along with the '/' before it, if any.
+        do {
+          --write;
+        } while (write > fixed && data[write] != '/');
         continue;
       }
       if (is_absolute_path) continue;
     }
-    parts.push_back(comp);
+    if (write != prefix) data[write++] = '/';
+    std::memmove(data + write, comp.data(), comp.size());
+    write += comp.size();
+    if (is_parent) fixed = write;
   }
-  // Deal with leading '//' as well as '/'.
-  return absl::StrCat(PathPrefix(input), absl::StrJoin(parts, "/"));
+  path->resize(write);
 }
 
 bool IsAbsolutePath(absl::string_view path) {
@@ -286,14 +341,14 @@ absl::StatusOr<std::string> GetCurrentDirectory() {
 }
 
 absl::StatusOr<std::string> MakeCleanAbsolutePath(absl::string_view path) {
-  if (IsAbsolutePath(path)) {
-    return CleanPath(path);
-  }
-  if (absl::StatusOr<std::string> dir = GetCurrentDirectory(); dir.ok()) {
-    return CleanPath(JoinPath(*std::move(dir), path));
-  } else {
-    return dir.status();
+  absl::optional<std::string> working_directory;
+  std::string result;
+  if (absl::Status status =
+          CleanAbsolutePath(path, &working_directory, &result);
+      !status.ok()) {
+    return status;
   }
+  return result;
 }
 
 absl::string_view Dirname(absl::string_view path) {
@@ -306,11 +361,18 @@ absl::string_view Basename(absl::string_view path) {
 
 std::string RelativizePath(absl::string_view to_relativize,
                            absl::string_view relativize_against) {
-  absl::StatusOr<PathCleaner> cleaner = PathCleaner::Create(relativize_against);
-  if (!cleaner.ok()) {
+  // This is PathCleaner::Create(relativize_against)->Relativize(to_relativize)
+  // but looks up the working directory at most once.
+  absl::optional<std::string> working_directory;
+  std::string root;
+  std::string result;
+  if (!CleanAbsolutePath(relativize_against, &working_directory, &root).ok() ||
+      !CleanAbsolutePath(to_relativize, &working_directory, &result).ok()) {
     return "";
   }
-  return cleaner->Relativize(to_relativize).value_or("");
+  absl::string_view relative = TrimPathPrefix(result, root);
+  result.erase(0, relative.data() - result.data());
+  return result;
 }
 
 absl::StatusOr<std::string> RealPath(absl::string_view path) {
@@ -148,6 +148,10 @@ absl::string_view Basename(absl::string_view path);
 /// trailing "/".
 std::string CleanPath(absl::string_view input);
 
+/// \brief Cleans `path` as `CleanPath` would, rewriting it in place. The
+/// result is never longer than the input, so nothing is allocated.
+void CleanPathInPlace(std::string* path);
+
 // \brief Returns true if path is absolute.
 bool IsAbsolutePath(absl::string_view path);
 
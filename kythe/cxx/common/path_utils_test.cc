@@ -71,6 +71,16 @@ TEST(PathUtilsTest, CleanPath) {
   EXPECT_EQ("..", CleanPath("a/../../"));
 }
 
+TEST(PathUtilsTest, CleanPathInPlace) {
+  for (const char* input :
+       {"", ".", "/", "//", "a/./b/../../..", "//a//..", "../a/../b",
+        "bc//a.//..//a", "/../a/b/../././/c", "a/../../", "x/..y/../z/"}) {
+    std::string path = input;
+    CleanPathInPlace(&path);
+    EXPECT_EQ(CleanPath(input), path) << input;
+  }
+}
+
 TEST(PathUtilsTest, JoinPath) {
   EXPECT_EQ("a/c", JoinPath("a", "c"));
   EXPECT_EQ("a/c", JoinPath("a/", "c"));
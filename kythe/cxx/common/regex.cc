@@ -91,13 +91,17 @@ RegexSet::RegexSet() : set_(DefaultSet()) {}
 RegexSet::RegexSet(RE2::Set set)
     : set_(std::make_shared<RE2::Set>(CheckCompiled(std::move(set)))) {}
 
-RegexSet::RegexSet(RegexSet&& other) noexcept : set_(std::move(other.set_)) {
+RegexSet::RegexSet(RegexSet&& other) noexcept
+    : set_(std::move(other.set_)), patterns_(std::move(other.patterns_)) {
   other.set_ = DefaultSet();
+  other.patterns_.clear();
 }
 
 RegexSet& RegexSet::operator=(RegexSet&& other) noexcept {
   set_ = std::move(other.set_);
+  patterns_ = std::move(other.patterns_);
   other.set_ = DefaultSet();
+  other.patterns_.clear();
   return *this;
 }
 
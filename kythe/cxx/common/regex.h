@@ -15,6 +15,8 @@
  */
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
@@ -97,8 +99,13 @@ class RegexSet {
   /// did not.
   absl::StatusOr<std::vector<int>> ExplainMatch(absl::string_view value) const;
 
+  /// \brief Returns the patterns this set was built from, in order, or an
+  /// empty vector if it was constructed from an RE2::Set.
+  const std::vector<std::string>& patterns() const { return patterns_; }
+
  private:
   std::shared_ptr<const RE2::Set> set_;  // non-null.
+  std::vector<std::string> patterns_;
 };
 
 template <typename Range>
@@ -106,17 +113,21 @@ absl::StatusOr<RegexSet> RegexSet::Build(const Range& patterns,
                                          const RE2::Options& options,
                                          RE2::Anchor anchor) {
   RE2::Set set(options, anchor);
+  std::vector<std::string> sources;
   for (const auto& value : patterns) {
     std::string error;
     if (set.Add(value, &error) == -1) {
       return absl::InvalidArgumentError(error);
     }
+    sources.emplace_back(value);
   }
   if (!set.Compile()) {
     return absl::ResourceExhaustedError(
         "Out of memory attempting to compile RegexSet");
   }
-  return RegexSet(std::move(set));
+  RegexSet result(std::move(set));
+  result.patterns_ = std::move(sources);
+  return result;
 }
 
 }  // namespace kythe
@@ -92,6 +92,18 @@ TEST(RegexSetTest, ConstructsFromCompiledRE2Set) {
   EXPECT_TRUE(set.Match("hello_world"));
 }
 
+TEST(RegexSetTest, RemembersPatterns) {
+  using ::testing::ElementsAre;
+  using ::testing::IsEmpty;
+
+  RegexSet orig = RegexSet::Build({"hello", "world"}).value();
+  EXPECT_THAT(orig.patterns(), ElementsAre("hello", "world"));
+
+  RegexSet dest = std::move(orig);
+  EXPECT_THAT(dest.patterns(), ElementsAre("hello", "world"));
+  EXPECT_THAT(orig.patterns(), IsEmpty());
+}
+
 TEST(RegexSetTest, ExplainsMatch) {
   using ::testing::IsEmpty;
   using ::testing::UnorderedElementsAre;
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/thread_pool.h"
+
+#include <utility>
+
+#include "glog/logging.h"
+
+namespace kythe {
+
+ThreadPool::ThreadPool(size_t num_threads, size_t max_pending,
+                       std::function<void(size_t)> start_worker)
+    : max_pending_(max_pending == 0 ? num_threads : max_pending) {
+  CHECK_GT(num_threads, 0);
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this, i, start_worker] {
+      if (start_worker) {
+        start_worker(i);
+      }
+      WorkLoop();
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    absl::MutexLock lock(&mu_);
+    shutting_down_ = true;
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Schedule(std::function<void()> fn) {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](ThreadPool* pool) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pool->mu_) {
+        return pool->pending_.size() < pool->max_pending_;
+      },
+      this));
+  pending_.push_back(std::move(fn));
+}
+
+void ThreadPool::Wait() {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](ThreadPool* pool) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pool->mu_) {
+        return pool->pending_.empty() && pool->running_ == 0;
+      },
+      this));
+}
+
+void ThreadPool::WorkLoop() {
+  for (;;) {
+    std::function<void()> fn;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(
+          +[](ThreadPool* pool) ABSL_EXCLUSIVE_LOCKS_REQUIRED(pool->mu_) {
+            return !pool->pending_.empty() || pool->shutting_down_;
+          },
+          this));
+      if (pending_.empty()) {
+        // We only get here if we're shutting down and there's no more work.
+        return;
+      }
+      fn = std::move(pending_.front());
+      pending_.pop_front();
+      ++running_;
+    }
+    fn();
+    absl::MutexLock lock(&mu_);
+    --running_;
+  }
+}
+
+}  // namespace kythe
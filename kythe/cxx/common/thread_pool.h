@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_COMMON_THREAD_POOL_H_
+#define KYTHE_CXX_COMMON_THREAD_POOL_H_
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace kythe {
+
+/// \brief A fixed-size pool of threads that runs closures in FIFO order.
+///
+/// The queue of pending closures is bounded; `Schedule` blocks until there is
+/// room for another closure. This keeps producers (like kzip readers) from
+/// decoding arbitrarily far ahead of the workers.
+class ThreadPool {
+ public:
+  /// \param num_threads The number of worker threads to start. Must be > 0.
+  /// \param max_pending The maximum number of closures that may be waiting
+  /// to run at once. If 0, defaults to `num_threads`.
+  /// \param start_worker If set, called on each worker thread with that
+  /// worker's index (from 0) before it runs any closures, such as to pin it
+  /// to some CPUs.
+  explicit ThreadPool(size_t num_threads, size_t max_pending = 0,
+                      std::function<void(size_t)> start_worker = nullptr);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// \brief Waits for all scheduled closures to finish, then joins the
+  /// worker threads.
+  ~ThreadPool();
+
+  /// \brief Schedules `fn` to run on some worker thread. Blocks while the
+  /// pending queue is full.
+  void Schedule(std::function<void()> fn) ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Blocks until every closure scheduled so far has finished.
+  void Wait() ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \return the number of worker threads.
+  size_t size() const { return threads_.size(); }
+
+ private:
+  /// \brief The body of each worker thread.
+  void WorkLoop() ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// The maximum number of pending closures.
+  const size_t max_pending_;
+  absl::Mutex mu_;
+  /// Closures that have not yet been picked up by a worker.
+  std::deque<std::function<void()>> pending_ ABSL_GUARDED_BY(mu_);
+  /// The number of closures currently running.
+  size_t running_ ABSL_GUARDED_BY(mu_) = 0;
+  /// Set when the pool is being destroyed.
+  bool shutting_down_ ABSL_GUARDED_BY(mu_) = false;
+  /// The worker threads.
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_COMMON_THREAD_POOL_H_
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/common/thread_pool.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/mutex.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(ThreadPoolTest, RunsAllClosures) {
+  std::atomic<int> count(0);
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < 100; ++i) {
+      pool.Schedule([&count] { ++count; });
+    }
+    pool.Wait();
+    EXPECT_EQ(count, 100);
+    pool.Schedule([&count] { ++count; });
+  }
+  EXPECT_EQ(count, 101);
+}
+
+TEST(ThreadPoolTest, SingleThreadPreservesOrder) {
+  std::vector<int> order;
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i < 10; ++i) {
+      pool.Schedule([&order, i] { order.push_back(i); });
+    }
+  }
+  EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+}
+
+TEST(ThreadPoolTest, RunsConcurrently) {
+  absl::Mutex mu;
+  int arrived = 0;
+  ThreadPool pool(2);
+  // Each closure waits for the other to arrive; this deadlocks unless both
+  // run at the same time.
+  for (int i = 0; i < 2; ++i) {
+    pool.Schedule([&] {
+      absl::MutexLock lock(&mu);
+      ++arrived;
+      mu.Await(absl::Condition(
+          +[](int* arrived) { return *arrived == 2; }, &arrived));
+    });
+  }
+  pool.Wait();
+  EXPECT_EQ(arrived, 2);
+}
+
+TEST(ThreadPoolTest, StartsEachWorkerOnItsOwnThread) {
+  absl::Mutex mu;
+  std::vector<int> started(3, 0);
+  std::thread::id started_on[3];
+  {
+    ThreadPool pool(3, 0, [&](size_t worker) {
+      absl::MutexLock lock(&mu);
+      ++started[worker];
+      started_on[worker] = std::this_thread::get_id();
+    });
+  }
+  EXPECT_EQ(started, (std::vector<int>{1, 1, 1}));
+  EXPECT_NE(started_on[0], started_on[1]);
+  EXPECT_NE(started_on[1], started_on[2]);
+  EXPECT_NE(started_on[0], std::this_thread::get_id());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -16,13 +16,70 @@
 
 #include "kythe/cxx/common/utf8_line_index.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <ostream>
+#include <utility>
 
-#include "absl/algorithm/container.h"
+#include "absl/base/config.h"
+#include "absl/numeric/bits.h"
 #include "absl/strings/string_view.h"
 #include "glog/logging.h"
 
 namespace kythe {
+namespace {
+
+// Content is scanned a word at a time, treating each word as a vector of
+// bytes (SWAR).  This only works if the first byte in memory is the low
+// byte of the word; elsewhere every byte is examined on its own.
+#ifdef ABSL_IS_LITTLE_ENDIAN
+constexpr bool kScanWords = true;
+#else
+constexpr bool kScanWords = false;
+#endif
+
+constexpr uint64_t kLowBits = 0x0101010101010101;
+constexpr uint64_t kLow7Bits = 0x7f7f7f7f7f7f7f7f;
+constexpr uint64_t kHighBits = 0x8080808080808080;
+
+uint64_t LoadWord(const char* bytes) {
+  uint64_t word;
+  std::memcpy(&word, bytes, sizeof(word));
+  return word;
+}
+
+// Returns a word with the high bit set in exactly those bytes of |word| that
+// are equal to |byte|.
+uint64_t BytesEqualTo(uint64_t word, unsigned char byte) {
+  uint64_t diff = word ^ (kLowBits * byte);
+  // Adding 0x7f to the low bits of a byte carries into its high bit unless
+  // they are all zero; no carry crosses into the next byte.
+  return ~(((diff & kLow7Bits) + kLow7Bits) | diff | kLow7Bits);
+}
+
+// Returns a word with the high bit set in exactly those bytes of |word| that
+// are UTF-8 continuation bytes (10xxxxxx).
+uint64_t ContinuationBytes(uint64_t word) {
+  return word & ~(word << 1) & kHighBits;
+}
+
+// Returns the number of characters (non-continuation bytes) in
+// [begin, end).
+int CountCharacters(const char* begin, const char* end) {
+  int characters = 0;
+  if (kScanWords) {
+    for (; end - begin >= 8; begin += 8) {
+      characters += 8 - absl::popcount(ContinuationBytes(LoadWord(begin)));
+    }
+  }
+  for (; begin != end; ++begin) {
+    if (!IsUTF8ContinuationByte(*begin)) ++characters;
+  }
+  return characters;
+}
+
+}  // anonymous namespace
 
 std::ostream& operator<<(std::ostream& dest,
                          const CharacterPosition& position) {
@@ -42,28 +99,170 @@ bool IsUTF8EndOfLineByte(int byte_offset, absl::string_view content) {
                                             content[byte_offset + 1] != '\n')));
 }
 
-UTF8LineIndex::UTF8LineIndex(absl::string_view content) : content_(content) {
-  IndexContent();
+void UTF8LineIndex::OffsetTable::Append(int64_t offset) {
+  pending_.push_back(offset);
+  if (pending_.size() == kBlockSize) Flush();
+}
+
+void UTF8LineIndex::OffsetTable::Flush() {
+  if (pending_.empty()) return;
+  Block block{pending_.front(), 0, pending_.back() - pending_.front() > 0xffff};
+  if (block.wide) {
+    block.deltas = wide_.size();
+    for (size_t i = 1; i < pending_.size(); ++i) {
+      int64_t delta = pending_[i] - block.anchor;
+      CHECK_LE(delta, 0xffffffff);
+      wide_.push_back(delta);
+    }
+  } else {
+    block.deltas = narrow_.size();
+    for (size_t i = 1; i < pending_.size(); ++i) {
+      narrow_.push_back(pending_[i] - block.anchor);
+    }
+  }
+  blocks_.push_back(block);
+  size_ += pending_.size();
+  pending_.clear();
+}
+
+void UTF8LineIndex::OffsetTable::Finish() {
+  Flush();
+  blocks_.shrink_to_fit();
+  narrow_.shrink_to_fit();
+  wide_.shrink_to_fit();
+  pending_.shrink_to_fit();
+}
+
+int64_t UTF8LineIndex::OffsetTable::operator[](size_t index) const {
+  const Block& block = blocks_[index / kBlockSize];
+  size_t within = index % kBlockSize;
+  if (within == 0) return block.anchor;
+  return block.anchor + (block.wide ? wide_[block.deltas + within - 1]
+                                    : narrow_[block.deltas + within - 1]);
 }
 
-void UTF8LineIndex::IndexContent() {
+size_t UTF8LineIndex::OffsetTable::CountNotAfter(int64_t offset) const {
+  auto next_block = std::upper_bound(
+      blocks_.begin(), blocks_.end(), offset,
+      [](int64_t offset, const Block& block) { return offset < block.anchor; });
+  if (next_block == blocks_.begin()) return 0;
+  size_t block_index = next_block - blocks_.begin() - 1;
+  const Block& block = blocks_[block_index];
+  size_t deltas = std::min(kBlockSize, size_ - block_index * kBlockSize) - 1;
+  int64_t delta = offset - block.anchor;
+  size_t count;
+  if (block.wide) {
+    const uint32_t* begin = wide_.data() + block.deltas;
+    count = std::upper_bound(begin, begin + deltas,
+                             std::min<int64_t>(delta, 0xffffffff)) -
+            begin;
+  } else {
+    const uint16_t* begin = narrow_.data() + block.deltas;
+    count = std::upper_bound(begin, begin + deltas,
+                             std::min<int64_t>(delta, 0xffff)) -
+            begin;
+  }
+  // The anchor is <= offset too.
+  return block_index * kBlockSize + 1 + count;
+}
+
+bool UTF8LineIndex::FindLineEnds(absl::string_view content,
+                                 OffsetTable* byte_offsets,
+                                 OffsetTable* character_offsets) {
+  const char* data = content.data();
+  const int size = content.size();
+  // The high bits of every byte seen so far.
+  uint64_t high_bits = 0;
+  // The number of characters before |byte_offset|.
+  int characters = 0;
+  int byte_offset = 0;
+  if (kScanWords) {
+    for (; size - byte_offset >= 8; byte_offset += 8) {
+      uint64_t word = LoadWord(data + byte_offset);
+      high_bits |= word;
+      uint64_t ends = BytesEqualTo(word, '\n') | BytesEqualTo(word, '\r');
+      uint64_t continuations =
+          character_offsets != nullptr ? ContinuationBytes(word) : 0;
+      for (; ends != 0; ends &= ends - 1) {
+        // The marker for byte i is bit 8i+7.
+        int bit = absl::countr_zero(ends);
+        int end = byte_offset + bit / 8;
+        if (!IsUTF8EndOfLineByte(end, content)) continue;
+        byte_offsets->Append(end + 1);
+        if (character_offsets != nullptr) {
+          // The bits of bytes up to and including the line end.  (For the
+          // last byte the shift wraps to zero, leaving every bit set.)
+          uint64_t through = (uint64_t{2} << bit) - 1;
+          character_offsets->Append(characters + bit / 8 + 1 -
+                                    absl::popcount(continuations & through));
+        }
+      }
+      characters += 8 - absl::popcount(continuations);
+    }
+  }
+  for (; byte_offset < size; ++byte_offset) {
+    high_bits |= static_cast<unsigned char>(data[byte_offset]);
+    if (IsUTF8ContinuationByte(data[byte_offset])) continue;
+    ++characters;
+    if (IsUTF8EndOfLineByte(byte_offset, content)) {
+      byte_offsets->Append(byte_offset + 1);
+      if (character_offsets != nullptr) {
+        character_offsets->Append(characters);
+      }
+    }
+  }
+  return (high_bits & kHighBits) == 0;
+}
+
+UTF8LineIndex::UTF8LineIndex(absl::string_view content,
+                             CharacterOffsets character_offsets)
+    : content_(content),
+      line_begin_character_offsets_(
+          std::make_shared<LineBeginCharacterOffsets>()) {
+  IndexContent(character_offsets == CharacterOffsets::kEager);
+}
+
+void UTF8LineIndex::IndexContent(bool with_character_offsets) {
   CHECK_LT(content_.size(), 1LL << 32);
 
   // Line 0 starts at offset 0.  All other line start offsets are determined
   // by scanning for line ends (any of {CR, CR+LF, LF}.)
-  line_begin_byte_offsets_ = {0};
-  line_begin_character_offsets_ = {0};
-
-  int character_number = 0;
-  for (int byte_offset = 0; byte_offset < content_.size(); ++byte_offset) {
-    if (IsUTF8ContinuationByte(content_[byte_offset])) continue;
+  line_begin_byte_offsets_.Append(0);
+  if (!with_character_offsets) {
+    is_ascii_ = FindLineEnds(content_, &line_begin_byte_offsets_, nullptr);
+    line_begin_byte_offsets_.Finish();
+    return;
+  }
+  // Both kinds of offset are found in a single pass.
+  absl::call_once(line_begin_character_offsets_->once, [this] {
+    OffsetTable character_offsets;
+    character_offsets.Append(0);
+    is_ascii_ =
+        FindLineEnds(content_, &line_begin_byte_offsets_, &character_offsets);
+    line_begin_byte_offsets_.Finish();
+    if (!is_ascii_) {
+      character_offsets.Finish();
+      line_begin_character_offsets_->offsets = std::move(character_offsets);
+    }
+  });
+}
 
-    if (IsUTF8EndOfLineByte(byte_offset, content_)) {
-      line_begin_byte_offsets_.push_back(byte_offset + 1);
-      line_begin_character_offsets_.push_back(character_number + 1);
+const UTF8LineIndex::OffsetTable& UTF8LineIndex::line_begin_character_offsets()
+    const {
+  if (is_ascii_) return line_begin_byte_offsets_;
+  absl::call_once(line_begin_character_offsets_->once, [this] {
+    OffsetTable& character_offsets = line_begin_character_offsets_->offsets;
+    int64_t characters = 0;
+    character_offsets.Append(characters);
+    for (size_t line = 1; line < line_begin_byte_offsets_.size(); ++line) {
+      characters +=
+          CountCharacters(content_.data() + line_begin_byte_offsets_[line - 1],
+                          content_.data() + line_begin_byte_offsets_[line]);
+      character_offsets.Append(characters);
     }
-    ++character_number;
-  }
+    character_offsets.Finish();
+  });
+  return line_begin_character_offsets_->offsets;
 }
 
 CharacterPosition UTF8LineIndex::ComputePositionForByteOffset(
@@ -89,12 +288,12 @@ CharacterPosition UTF8LineIndex::ComputePositionForByteOffset(
     auto line_begin_byte_offset =
         line_begin_byte_offsets_[position.line_number - 1];
     // Count the characters in the line up to (and including) byte_offset.
-    position.column_number = -1;
-    for (int offset = line_begin_byte_offset; offset <= byte_offset; ++offset) {
-      if (!IsUTF8ContinuationByte(content_[offset])) ++position.column_number;
-    }
+    position.column_number =
+        CountCharacters(content_.data() + line_begin_byte_offset,
+                        content_.data() + byte_offset + 1) -
+        1;
     auto line_begin_character_offset =
-        line_begin_character_offsets_[position.line_number - 1];
+        line_begin_character_offsets()[position.line_number - 1];
     position.character_number =
         line_begin_character_offset + position.column_number;
   } else if (byte_offset == content_.size()) {
@@ -118,9 +317,7 @@ CharacterPosition UTF8LineIndex::ComputePositionForByteOffset(
 
 int UTF8LineIndex::LineNumber(int byte_offset) const {
   if (content_.empty()) return 1;
-  const auto next_line =
-      absl::c_upper_bound(line_begin_byte_offsets_, byte_offset);
-  return next_line - line_begin_byte_offsets_.begin();
+  return line_begin_byte_offsets_.CountNotAfter(byte_offset);
 }
 
 int UTF8LineIndex::line_size(int line_number) const {
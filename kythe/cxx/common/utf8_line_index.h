@@ -17,10 +17,13 @@
 #ifndef KYTHE_CXX_COMMON_UTF8_LINE_INDEX_H_
 #define KYTHE_CXX_COMMON_UTF8_LINE_INDEX_H_
 
+#include <cstdint>
 #include <iosfwd>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "absl/base/call_once.h"
 #include "absl/strings/string_view.h"
 
 namespace kythe {
@@ -70,6 +73,16 @@ std::ostream& operator<<(std::ostream& dest, const CharacterPosition& position);
 // not as part of the following line.
 class UTF8LineIndex {
  public:
+  // When to find the character number at which each line begins.  Only
+  // ComputePositionForByteOffset needs them, so indexes that are used just
+  // to find lines and byte offsets can skip that work.
+  enum class CharacterOffsets {
+    // While the index is built.
+    kEager,
+    // On the first call to ComputePositionForByteOffset.
+    kLazy,
+  };
+
   // Creates a UTF8LineIndex for a file.  The index retains a reference to
   // the file content, which must therefore remain valid (and unchanged) so
   // long as this index is in use.
@@ -77,7 +90,9 @@ class UTF8LineIndex {
   // The content must be less than 2GB long.
   //
   // Complexity: O(content.size())
-  explicit UTF8LineIndex(absl::string_view content);
+  explicit UTF8LineIndex(
+      absl::string_view content,
+      CharacterOffsets character_offsets = CharacterOffsets::kEager);
 
   // Given a (0-based) byte offset into the file, returns character-based
   // information on the position of that offset.
@@ -85,7 +100,9 @@ class UTF8LineIndex {
   // If the offset is greater than the size of the content then this returns
   // an invalid CharacterPosition().
   //
-  // Complexity: O(log(#lines) + byte-offset-within-line)
+  // Complexity: O(log(#lines) + byte-offset-within-line), plus
+  // O(content.size()) for the first call on a CharacterOffsets::kLazy index.
+  // Safe to call concurrently.
   CharacterPosition ComputePositionForByteOffset(int byte_offset) const;
 
   // Computes just a (1-based) line number for a given (0-based) byte offset.
@@ -145,14 +162,81 @@ class UTF8LineIndex {
   absl::string_view str() const { return content_; }
 
  private:
-  // Populates the index vectors based on content_.
-  void IndexContent();
+  // A nondecreasing sequence of offsets, such as the offsets at which lines
+  // begin.  Offsets are kept in blocks of kBlockSize, each of which stores
+  // its first offset in full and the rest as 16-bit deltas from it (or as
+  // 32-bit deltas if the block spans 64KB or more), so typical source files
+  // need a little over two bytes per offset.
+  class OffsetTable {
+   public:
+    // Adds |offset|, which must be no less than the last offset added.
+    void Append(int64_t offset);
+
+    // Makes every appended offset available for lookups.
+    void Finish();
+
+    // Returns the number of offsets.  Only valid after Finish().
+    size_t size() const { return size_; }
+
+    // Returns the |index|th offset.  Only valid after Finish().
+    int64_t operator[](size_t index) const;
+
+    // Returns the number of offsets that are <= |offset|.  Only valid after
+    // Finish().
+    size_t CountNotAfter(int64_t offset) const;
+
+   private:
+    static constexpr size_t kBlockSize = 64;
+
+    struct Block {
+      // The block's first offset.
+      int64_t anchor;
+      // Where the deltas for the rest of the block begin in narrow_ or wide_.
+      uint32_t deltas;
+      // Whether the deltas are in wide_.
+      bool wide;
+    };
+
+    // Stores the offsets in pending_ as a new block.
+    void Flush();
+
+    std::vector<Block> blocks_;
+    std::vector<uint16_t> narrow_;
+    std::vector<uint32_t> wide_;
+    // Offsets not yet stored in a block.
+    std::vector<int64_t> pending_;
+    size_t size_ = 0;
+  };
+
+  // The character numbers at which lines begin, found once.
+  struct LineBeginCharacterOffsets {
+    absl::once_flag once;
+    // offsets[n] stores the character number of the start of line n-1.
+    OffsetTable offsets;
+  };
+
+  // Populates the index tables based on content_, finding character
+  // offsets too if |with_character_offsets|.
+  void IndexContent(bool with_character_offsets);
+
+  // Appends the byte offset (and, if |character_offsets| isn't null, the
+  // character offset) just past each line end in |content| to the given
+  // tables.  Returns whether |content| is ASCII.
+  static bool FindLineEnds(absl::string_view content,
+                           OffsetTable* byte_offsets,
+                           OffsetTable* character_offsets);
+
+  // Returns the character numbers at which lines begin, counting them if
+  // that hasn't been done yet.  For ASCII content these are the byte
+  // offsets, which are returned instead.
+  const OffsetTable& line_begin_character_offsets() const;
 
   // Returns whether this file has trailing characters, i.e., characters that
   // are not followed by a newline.  Empty files or file that end in a newline
   // do not have trailing characters, but all other files do.
   bool has_trailing_characters() const {
-    return static_cast<size_t>(line_begin_byte_offsets_.back()) !=
+    return static_cast<size_t>(
+               line_begin_byte_offsets_[line_begin_byte_offsets_.size() - 1]) !=
            content_.size();
   }
 
@@ -160,10 +244,15 @@ class UTF8LineIndex {
   absl::string_view content_;
 
   // line_ends_byte_offsets_[n] stores the byte offset of the start of line n-1.
-  std::vector<int> line_begin_byte_offsets_;
+  OffsetTable line_begin_byte_offsets_;
+
+  // Whether the content has no multibyte characters, in which case
+  // character offsets are byte offsets and aren't stored separately.
+  bool is_ascii_ = false;
 
-  // Character offsets corresponding to line_end_byte_offsets_.
-  std::vector<int> line_begin_character_offsets_;
+  // Character offsets corresponding to line_end_byte_offsets_.  Shared so
+  // that the index stays copyable; copies index the same content.
+  std::shared_ptr<LineBeginCharacterOffsets> line_begin_character_offsets_;
 };
 
 }  // namespace kythe
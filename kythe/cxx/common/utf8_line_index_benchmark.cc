@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for UTF8LineIndex.
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "kythe/cxx/common/utf8_line_index.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Returns about `size` bytes of source-like text. Every fourth line
+/// contains multibyte characters.
+std::string MakeContent(size_t size) {
+  std::string content;
+  for (int line = 0; content.size() < size; ++line) {
+    absl::StrAppend(&content, "  int variable_", line, " = ", line * 7, ";",
+                    line % 4 == 0 ? "  // \xce\xbb\xe2\x86\x92\xf0\x9f\x98\x80"
+                                  : "",
+                    "\n");
+  }
+  return content;
+}
+
+void BM_IndexContent(benchmark::State& state) {
+  const std::string content = MakeContent(state.range(0));
+  for (auto _ : state) {
+    UTF8LineIndex index(content);
+    benchmark::DoNotOptimize(index.line_count());
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(BM_IndexContent)->Range(1 << 10, 1 << 22);
+
+void BM_IndexContentLazy(benchmark::State& state) {
+  const std::string content = MakeContent(state.range(0));
+  for (auto _ : state) {
+    UTF8LineIndex index(content, UTF8LineIndex::CharacterOffsets::kLazy);
+    benchmark::DoNotOptimize(index.line_count());
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+BENCHMARK(BM_IndexContentLazy)->Range(1 << 10, 1 << 22);
+
+void BM_ComputePositionForByteOffset(benchmark::State& state) {
+  const std::string content = MakeContent(state.range(0));
+  UTF8LineIndex index(content);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> offsets(0, content.size() - 1);
+  std::vector<int> queries(1024);
+  for (int& query : queries) {
+    query = offsets(rng);
+  }
+  size_t next = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(index.ComputePositionForByteOffset(
+        queries[next++ % queries.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ComputePositionForByteOffset)->Range(1 << 10, 1 << 22);
+
+void BM_ComputeByteOffset(benchmark::State& state) {
+  const std::string content = MakeContent(state.range(0));
+  UTF8LineIndex index(content);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> lines(1, index.line_count());
+  std::vector<CharacterPosition> queries(1024);
+  for (auto& query : queries) {
+    query.line_number = lines(rng);
+    query.column_number = 4;
+  }
+  size_t next = 0;
+  for (auto _ : state) {
+    const auto& query = queries[next++ % queries.size()];
+    benchmark::DoNotOptimize(
+        index.ComputeByteOffset(query.line_number, query.column_number));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ComputeByteOffset)->Range(1 << 10, 1 << 22);
+
+}  // anonymous namespace
+}  // namespace kythe
@@ -17,6 +17,8 @@
 #include "kythe/cxx/common/utf8_line_index.h"
 
 #include <algorithm>
+#include <string>
+#include <vector>
 
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
@@ -276,4 +278,71 @@ TEST(UTF8LineIndexTest, ComputeByteOffsetAtEndOfUnterminatedFile) {
             index.ComputeByteOffset(2, strlen("Goodbye, unterminated world.")));
 }
 
+TEST(UTF8LineIndexTest, LineEndsAreFoundAtEveryAlignment) {
+  // Content is scanned several bytes at a time, so shift line ends (and a
+  // CRLF pair) across word boundaries and compare against a byte-by-byte
+  // count.
+  const std::string tail(
+      "\xce\xbb\r\n\xe2\x86\x92\r\r\nab\xf0\x9f\x98\x80\n"
+      "0123456789abcdef\rxyz");
+  for (int shift = 0; shift < 24; ++shift) {
+    const std::string content = std::string(shift, '-') + "\xc3\xa9" + tail;
+    for (auto mode : {UTF8LineIndex::CharacterOffsets::kEager,
+                      UTF8LineIndex::CharacterOffsets::kLazy}) {
+      UTF8LineIndex index(content, mode);
+      int line_number = 1;
+      int column_number = 0;
+      int character_number = 0;
+      for (int byte_offset = 0; byte_offset < content.size(); ++byte_offset) {
+        if (IsUTF8ContinuationByte(content[byte_offset])) continue;
+        CharacterPosition position =
+            index.ComputePositionForByteOffset(byte_offset);
+        EXPECT_EQ(line_number, position.line_number) << shift;
+        EXPECT_EQ(column_number, position.column_number) << shift;
+        EXPECT_EQ(character_number, position.character_number) << shift;
+        ++character_number;
+        ++column_number;
+        if (kythe::IsUTF8EndOfLineByte(byte_offset, content)) {
+          ++line_number;
+          column_number = 0;
+        }
+      }
+      EXPECT_EQ(line_number, index.line_count());
+      CheckRoundTrips(index);
+    }
+  }
+}
+
+TEST(UTF8LineIndexTest, WorksForManyLinesOfMixedLengths) {
+  // Enough lines to fill several blocks of the line table, some of them
+  // spanning more than 64KB.
+  std::string content;
+  std::vector<int> line_begins;
+  for (int line = 0; line < 1000; ++line) {
+    line_begins.push_back(content.size());
+    const int length = line % 97 == 0 ? 70000 + line : line % 13;
+    content.append(length, line % 5 == 0 ? 'x' : 'y');
+    if (line % 7 == 0) content.append("\xce\xbb");
+    content.append(line % 3 == 0 ? "\r\n" : "\n");
+  }
+  for (auto mode : {UTF8LineIndex::CharacterOffsets::kEager,
+                    UTF8LineIndex::CharacterOffsets::kLazy}) {
+    UTF8LineIndex index(content, mode);
+    ASSERT_EQ(line_begins.size(), index.line_count());
+    int character_number = 0;
+    for (int line = 0; line < line_begins.size(); ++line) {
+      EXPECT_EQ(line_begins[line], index.ComputeByteOffset(line + 1, 0));
+      EXPECT_EQ(line + 1, index.LineNumber(line_begins[line]));
+      CharacterPosition position =
+          index.ComputePositionForByteOffset(line_begins[line]);
+      EXPECT_EQ(line + 1, position.line_number);
+      EXPECT_EQ(0, position.column_number);
+      EXPECT_EQ(character_number, position.character_number);
+      for (char c : index.GetLine(line + 1)) {
+        if (!IsUTF8ContinuationByte(c)) ++character_number;
+      }
+    }
+  }
+}
+
 }  // anonymous namespace
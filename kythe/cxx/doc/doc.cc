@@ -20,28 +20,41 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/text_format.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/kythe_uri.h"
 #include "kythe/cxx/common/net_client.h"
+#include "kythe/cxx/common/path_utils.h"
 #include "kythe/cxx/common/schema/edges.h"
 #include "kythe/cxx/common/schema/facts.h"
+#include "kythe/cxx/common/thread_pool.h"
 #include "kythe/cxx/doc/html_markup_handler.h"
 #include "kythe/cxx/doc/html_renderer.h"
 #include "kythe/cxx/doc/javadoxygen_markup_handler.h"
 #include "kythe/cxx/doc/markup_handler.h"
 
 ABSL_FLAG(std::string, xrefs, "http://localhost:8080",
-          "Base URI for xrefs service");
+          "Base URI for xrefs service; use proto+http:// to send requests as "
+          "serialized protobufs");
 ABSL_FLAG(std::string, corpus, "test", "Default corpus to use");
 ABSL_FLAG(std::string, path, "",
           "Look up this path in the xrefs service and process all "
@@ -53,6 +66,18 @@ ABSL_FLAG(std::string, css, "",
           "Include this stylesheet path in the resulting HTML.");
 ABSL_FLAG(bool, common_signatures, false,
           "Render the MarkedSource proto from standard in.");
+ABSL_FLAG(std::string, tickets, "",
+          "Render documentation for the tickets listed one per line in this "
+          "file (or on standard input if it is -) into --output_dir.");
+ABSL_FLAG(std::string, output_dir, "",
+          "With --tickets, write one HTML page per documented node to this "
+          "directory, along with an index.tsv mapping pages to tickets.");
+ABSL_FLAG(int, batch_size, 100,
+          "With --tickets, request documentation for this many tickets at "
+          "once.");
+ABSL_FLAG(int, jobs, 4,
+          "With --tickets, render this many batches concurrently while the "
+          "next batch is being fetched.");
 
 namespace kythe {
 namespace {
@@ -70,32 +95,44 @@ constexpr char kDocFooter[] = R"(
 </html>
 )";
 
-int DocumentNodesFrom(const proto::DocumentationReply& doc_reply) {
-  ::fputs(kDocHeaderPrefix, stdout);
+/// \brief Appends the start of an HTML page (up to and including <body>) to
+/// `out`.
+void AppendDocHeader(std::string* out) {
+  out->append(kDocHeaderPrefix);
   if (!absl::GetFlag(FLAGS_css).empty()) {
-    absl::FPrintF(stdout,
-                  "<link rel=\"stylesheet\" type=\"text/css\" href=\"%s\">",
-                  absl::GetFlag(FLAGS_css));
+    absl::StrAppendFormat(
+        out, "<link rel=\"stylesheet\" type=\"text/css\" href=\"%s\">",
+        absl::GetFlag(FLAGS_css));
   }
-  ::fputs(kDocHeaderSuffix, stdout);
-  DocumentHtmlRendererOptions options(doc_reply);
-  options.make_link_uri = [](const proto::Anchor& anchor) {
+  out->append(kDocHeaderSuffix);
+}
+
+/// \brief Configures `options` to link to anchors' parents and to label nodes
+/// with their kinds.
+void InitRendererOptions(DocumentHtmlRendererOptions* options) {
+  options->make_link_uri = [](const proto::Anchor& anchor) {
     return anchor.parent();
   };
-  options.kind_name = [&options](const std::string& ticket) {
-    if (const auto* node = options.node_info(ticket)) {
-      for (const auto& fact : node->facts()) {
-        if (fact.first == kythe::common::schema::kFactNodeKind) {
-          return std::string(fact.second);
-        }
+  options->kind_name = [options](const std::string& ticket) {
+    if (const auto* node = options->node_info(ticket)) {
+      auto kind = node->facts().find(kythe::common::schema::kFactNodeKind);
+      if (kind != node->facts().end()) {
+        return std::string(kind->second);
       }
     }
     return std::string();
   };
+}
+
+int DocumentNodesFrom(const proto::DocumentationReply& doc_reply) {
+  std::string html;
+  AppendDocHeader(&html);
+  ::fputs(html.c_str(), stdout);
+  DocumentHtmlRendererOptions options(doc_reply);
+  InitRendererOptions(&options);
   for (const auto& document : doc_reply.document()) {
     if (document.has_text()) {
-      auto html =
-          RenderDocument(options, {ParseJavadoxygen, ParseHtml}, document);
+      html = RenderDocument(options, {ParseJavadoxygen, ParseHtml}, document);
       ::fputs(html.c_str(), stdout);
     }
   }
@@ -103,6 +140,117 @@ int DocumentNodesFrom(const proto::DocumentationReply& doc_reply) {
   return 0;
 }
 
+/// \brief Writes `content` to the file at `path`, replacing it if it exists.
+bool WriteFile(const std::string& path, absl::string_view content) {
+  FILE* file = ::fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    absl::FPrintF(stderr, "Couldn't open %s\n", path);
+    return false;
+  }
+  bool ok = ::fwrite(content.data(), 1, content.size(), file) == content.size();
+  ok = ::fclose(file) == 0 && ok;
+  if (!ok) {
+    absl::FPrintF(stderr, "Couldn't write %s\n", path);
+  }
+  return ok;
+}
+
+/// \brief Renders each document in `doc_reply` to its own page in
+/// `output_dir`. Pages are named after `batch` and the document's position in
+/// the reply. Appends a line mapping each page to its ticket to `index`.
+bool RenderBatch(const proto::DocumentationReply& doc_reply, size_t batch,
+                 const std::string& output_dir, std::string* index) {
+  DocumentHtmlRendererOptions options(doc_reply);
+  InitRendererOptions(&options);
+  const std::vector<MarkupHandler> handlers = {ParseJavadoxygen, ParseHtml};
+  bool ok = true;
+  std::string html;
+  for (int i = 0; i < doc_reply.document_size(); ++i) {
+    const auto& document = doc_reply.document(i);
+    if (!document.has_text()) {
+      continue;
+    }
+    html.clear();
+    AppendDocHeader(&html);
+    html.append(RenderDocument(options, handlers, document));
+    html.append(kDocFooter);
+    auto page = absl::StrFormat("%06d-%04d.html", batch, i);
+    if (!WriteFile(JoinPath(output_dir, page), html)) {
+      ok = false;
+      continue;
+    }
+    absl::StrAppend(index, page, "\t", document.ticket(), "\n");
+  }
+  return ok;
+}
+
+/// \brief Renders documentation for every ticket listed in `tickets` into
+/// pages in `output_dir`.
+///
+/// Tickets are requested from `client` in batches. Each reply is rendered on
+/// a pool of threads while the next batch is fetched; the pool's bounded
+/// queue keeps fetching from running too far ahead of rendering.
+int DocumentTickets(XrefsClient* client, std::istream* tickets,
+                    const std::string& output_dir) {
+  if (::mkdir(output_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    absl::FPrintF(stderr, "Couldn't create %s\n", output_dir);
+    return 1;
+  }
+  const int batch_size = std::max(1, absl::GetFlag(FLAGS_batch_size));
+  absl::Mutex mu;
+  // Index lines for each batch, by batch number.
+  std::map<size_t, std::string> indices;  // Guarded by mu.
+  bool ok = true;                         // Guarded by mu.
+  size_t batches = 0;
+  {
+    ThreadPool pool(std::max(1, absl::GetFlag(FLAGS_jobs)));
+    proto::DocumentationRequest request;
+    auto fetch_and_schedule = [&] {
+      auto reply = std::make_shared<proto::DocumentationReply>();
+      std::string error;
+      if (!client->Documentation(request, reply.get(), &error)) {
+        absl::FPrintF(stderr, "Couldn't fetch documentation: %s\n", error);
+        absl::MutexLock lock(&mu);
+        ok = false;
+      } else {
+        const size_t batch = batches++;
+        pool.Schedule([&, reply, batch] {
+          std::string index;
+          bool rendered = RenderBatch(*reply, batch, output_dir, &index);
+          absl::MutexLock lock(&mu);
+          indices[batch] = std::move(index);
+          ok = ok && rendered;
+        });
+      }
+      request.clear_ticket();
+    };
+    std::string line;
+    while (std::getline(*tickets, line)) {
+      auto ticket = absl::StripAsciiWhitespace(line);
+      if (ticket.empty()) {
+        continue;
+      }
+      request.add_ticket(std::string(ticket));
+      if (request.ticket_size() >= batch_size) {
+        fetch_and_schedule();
+      }
+    }
+    if (request.ticket_size() != 0) {
+      fetch_and_schedule();
+    }
+  }
+  absl::MutexLock lock(&mu);
+  std::string index;
+  for (const auto& batch : indices) {
+    index.append(batch.second);
+  }
+  if (!WriteFile(JoinPath(output_dir, "index.tsv"), index)) {
+    ok = false;
+  }
+  absl::FPrintF(stderr, "Rendered %d batches into %s\n", batches, output_dir);
+  return ok ? 0 : 1;
+}
+
 int DocumentNodesFromStdin() {
   proto::DocumentationReply doc_reply;
   google::protobuf::io::FileInputStream file_input_stream(STDIN_FILENO);
@@ -186,10 +334,34 @@ doc
 doc -common_signatures
   Renders the text-format proto::common::MarkedSource message provided on standard
   input into several common forms.
+doc -tickets tickets.txt -output_dir out
+  Renders one HTML page per documented ticket listed in tickets.txt into the
+  directory out, fetching documentation in batches.
 )");
   absl::ParseCommandLine(argc, argv);
   if (absl::GetFlag(FLAGS_common_signatures)) {
     return kythe::RenderMarkedSourceFromStdin();
+  } else if (!absl::GetFlag(FLAGS_tickets).empty()) {
+    if (absl::GetFlag(FLAGS_output_dir).empty()) {
+      absl::FPrintF(stderr, "--tickets requires --output_dir\n");
+      return 1;
+    }
+    std::ifstream tickets_file;
+    std::istream* tickets = &std::cin;
+    if (absl::GetFlag(FLAGS_tickets) != "-") {
+      tickets_file.open(absl::GetFlag(FLAGS_tickets));
+      if (!tickets_file) {
+        absl::FPrintF(stderr, "Couldn't open %s\n",
+                      absl::GetFlag(FLAGS_tickets));
+        return 1;
+      }
+      tickets = &tickets_file;
+    }
+    kythe::JsonClient::InitNetwork();
+    kythe::XrefsJsonClient client(absl::make_unique<kythe::JsonClient>(),
+                                  absl::GetFlag(FLAGS_xrefs));
+    return kythe::DocumentTickets(&client, tickets,
+                                  absl::GetFlag(FLAGS_output_dir));
   } else if (absl::GetFlag(FLAGS_path).empty()) {
     return kythe::DocumentNodesFromStdin();
   } else {
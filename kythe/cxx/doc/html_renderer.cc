@@ -18,6 +18,7 @@
 
 #include <stack>
 
+#include "glog/logging.h"
 #include "kythe/cxx/doc/markup_handler.h"
 
 namespace kythe {
@@ -60,13 +61,15 @@ class CssTag {
   std::string* buffer_;
 };
 
-std::string RenderPrintable(const HtmlRendererOptions& options,
-                            const std::vector<MarkupHandler>& handlers,
-                            const proto::Printable& printable_proto,
-                            Printable::RejectPolicy filter) {
+/// \brief Marks up `printable_proto` with `handlers` and appends its HTML
+/// rendering to `text_out`.
+void RenderPrintable(const HtmlRendererOptions& options,
+                     const std::vector<MarkupHandler>& handlers,
+                     const proto::Printable& printable_proto,
+                     Printable::RejectPolicy filter, std::string* text_out) {
   Printable printable(printable_proto, filter);
-  auto markdoc = HandleMarkup(handlers, printable);
-  return RenderHtml(options, markdoc);
+  HandleMarkup(handlers, &printable);
+  RenderHtml(options, printable, text_out);
 }
 
 /// \brief Appends a representation of `c` to `buffer`, possibly using an HTML
@@ -210,7 +213,7 @@ class RenderSimpleIdentifierTarget {
   void AppendFinalListToken(const SourceString& source) {
     prepend_buffer_.append(std::string(source));
   }
-  const std::string buffer() const { return buffer_; }
+  const std::string& buffer() const { return buffer_; }
   void AppendRaw(const std::string& text) { buffer_.append(text); }
   /// \brief Make sure that there's a space between the current content of the
   /// buffer and whatever is appended to it later on.
@@ -242,36 +245,48 @@ struct RenderSimpleIdentifierState {
   bool in_type = false;
   bool in_initializer = false;
   bool linkify = false;
-  std::string base_ticket;
+  /// The ticket to link bare identifiers to. This state is copied at every
+  /// level of recursion, so it points to the caller's string rather than
+  /// owning a copy.
+  const std::string* base_ticket = nullptr;
   std::string get_link(const proto::common::MarkedSource& sig) {
     if (options == nullptr || !linkify) {
       return "";
     }
-    std::string link;
-    auto try_link = [&](const std::string& ticket) {
-      if (const auto* node_info = options->node_info(ticket)) {
-        if (const auto* anchor =
-                options->anchor_for_ticket(node_info->definition())) {
-          link = options->make_semantic_link_uri(*anchor, ticket);
-          if (link.empty()) {
-            link = options->make_link_uri(*anchor);
-          }
-        }
+    // Returns true if `ticket` resolved to an anchor, setting `link`.
+    auto try_link = [&](const std::string& ticket, std::string* link) {
+      const auto* node_info = options->node_info(ticket);
+      if (node_info == nullptr) {
+        return false;
+      }
+      const auto* anchor = options->anchor_for_ticket(node_info->definition());
+      if (anchor == nullptr) {
+        return false;
+      }
+      *link = options->make_semantic_link_uri(*anchor, ticket);
+      if (link->empty()) {
+        *link = options->make_link_uri(*anchor);
       }
+      return true;
     };
-    for (const auto& plink : sig.link()) {
-      for (const auto& ptick : plink.definition()) {
-        try_link(ptick);
+    // The last definition that resolves wins, so search from the back and
+    // stop at the first one that does.
+    std::string link;
+    bool found = false;
+    for (int i = sig.link_size() - 1; i >= 0 && !found; --i) {
+      const auto& plink = sig.link(i);
+      for (int j = plink.definition_size() - 1; j >= 0 && !found; --j) {
+        found = try_link(plink.definition(j), &link);
       }
     }
     if (link.empty() && should_infer_link()) {
-      try_link(base_ticket);
+      try_link(*base_ticket, &link);
     }
     return link;
   }
   bool should_infer_link() const {
-    return (in_identifier && !base_ticket.empty() && !in_context &&
-            !in_parameter && !in_type && !in_initializer);
+    return (in_identifier && base_ticket != nullptr && !base_ticket->empty() &&
+            !in_context && !in_parameter && !in_type && !in_initializer);
   }
   bool should_render() const {
     return (render_context && in_context) ||
@@ -283,46 +298,82 @@ struct RenderSimpleIdentifierState {
 
 void RenderSimpleIdentifier(const proto::common::MarkedSource& sig,
                             RenderSimpleIdentifierTarget* out,
-                            RenderSimpleIdentifierState state, size_t depth) {
-  if (depth >= kMaxRenderDepth) {
-    return;
+                            RenderSimpleIdentifierState state, size_t depth);
+
+/// The most views that can be rendered in one traversal.
+constexpr size_t kMaxViews = 4;
+
+/// \brief Views of a MarkedSource that are rendered in the same traversal.
+///
+/// Each view has its own state and target. A view is deactivated for the
+/// rest of a subtree wherever rendering it on its own would have stopped
+/// descending.
+struct RenderViews {
+  void Add(const RenderSimpleIdentifierState& state,
+           RenderSimpleIdentifierTarget* target) {
+    CHECK_LT(size, kMaxViews);
+    states[size] = state;
+    targets[size] = target;
+    active[size] = true;
+    ++size;
+  }
+  bool should_render(size_t view) const {
+    return active[view] && states[view].should_render();
   }
+  size_t size = 0;
+  RenderSimpleIdentifierState states[kMaxViews];
+  RenderSimpleIdentifierTarget* targets[kMaxViews];
+  bool active[kMaxViews];
+};
+
+/// \brief Updates `state` for entering `sig`.
+/// \return false if nothing in `sig` should be rendered for `state`.
+bool EnterMarkedSource(const proto::common::MarkedSource& sig,
+                       RenderSimpleIdentifierState* state) {
   switch (sig.kind()) {
     case proto::common::MarkedSource::IDENTIFIER:
-      state.in_identifier = true;
-      break;
+      state->in_identifier = true;
+      return true;
     case proto::common::MarkedSource::PARAMETER:
-      if (!state.render_parameters) {
-        return;
-      }
-      state.in_parameter = true;
-      break;
+      state->in_parameter = true;
+      return state->render_parameters;
     case proto::common::MarkedSource::TYPE:
-      if (!state.render_types) {
-        return;
-      }
-      state.in_type = true;
-      break;
+      state->in_type = true;
+      return state->render_types;
     case proto::common::MarkedSource::CONTEXT:
-      if (!state.render_context) {
-        return;
-      }
-      state.in_context = true;
-      break;
+      state->in_context = true;
+      return state->render_context;
     case proto::common::MarkedSource::INITIALIZER:
-      if (!state.render_initializer) {
-        return;
-      }
-      state.in_initializer = true;
-      break;
+      state->in_initializer = true;
+      return state->render_initializer;
     case proto::common::MarkedSource::BOX:
-      break;
+      return true;
     default:
-      return;
+      return false;
+  }
+}
+
+void RenderSimpleIdentifiers(const proto::common::MarkedSource& sig,
+                             RenderViews views, size_t depth) {
+  if (depth >= kMaxRenderDepth) {
+    return;
+  }
+  bool any_active = false;
+  for (size_t v = 0; v < views.size; ++v) {
+    views.active[v] =
+        views.active[v] && EnterMarkedSource(sig, &views.states[v]);
+    any_active = any_active || views.active[v];
+  }
+  if (!any_active) {
+    return;
   }
-  bool has_open_link = false;
-  if (state.should_render()) {
-    std::string link_text = state.get_link(sig);
+  bool has_open_link[kMaxViews] = {};
+  for (size_t v = 0; v < views.size; ++v) {
+    if (!views.should_render(v)) {
+      continue;
+    }
+    auto* out = views.targets[v];
+    std::string link_text = views.states[v].get_link(sig);
     if (!link_text.empty()) {
       out->AppendRaw("<a href=\"");
       out->AppendRaw(link_text);
@@ -337,23 +388,30 @@ void RenderSimpleIdentifier(const proto::common::MarkedSource& sig,
         out->AppendRaw(target.buffer());
       }
       out->AppendRaw("\">");
-      has_open_link = true;
+      has_open_link[v] = true;
     }
     out->Append(sig.pre_text());
   }
   for (int child = 0; child < sig.child_size(); ++child) {
-    RenderSimpleIdentifier(sig.child(child), out, state, depth + 1);
-    if (state.should_render()) {
+    RenderSimpleIdentifiers(sig.child(child), views, depth + 1);
+    for (size_t v = 0; v < views.size; ++v) {
+      if (!views.should_render(v)) {
+        continue;
+      }
       if (child + 1 != sig.child_size()) {
-        out->Append(sig.post_child_text());
+        views.targets[v]->Append(sig.post_child_text());
       } else if (sig.add_final_list_token()) {
-        out->AppendFinalListToken(sig.post_child_text());
+        views.targets[v]->AppendFinalListToken(sig.post_child_text());
       }
     }
   }
-  if (state.should_render()) {
+  for (size_t v = 0; v < views.size; ++v) {
+    if (!views.should_render(v)) {
+      continue;
+    }
+    auto* out = views.targets[v];
     out->Append(sig.post_text());
-    if (has_open_link) {
+    if (has_open_link[v]) {
       out->AppendRaw("</a>");
     }
     if (sig.kind() == proto::common::MarkedSource::TYPE) {
@@ -362,6 +420,14 @@ void RenderSimpleIdentifier(const proto::common::MarkedSource& sig,
   }
 }
 
+void RenderSimpleIdentifier(const proto::common::MarkedSource& sig,
+                            RenderSimpleIdentifierTarget* out,
+                            RenderSimpleIdentifierState state, size_t depth) {
+  RenderViews views;
+  views.Add(state, out);
+  RenderSimpleIdentifiers(sig, views, depth);
+}
+
 /// Render identifiers underneath PARAMETER nodes with no other non-BOXes in
 /// between.
 void RenderSimpleParams(const proto::common::MarkedSource& sig,
@@ -391,17 +457,28 @@ void RenderSimpleParams(const proto::common::MarkedSource& sig,
 }
 }  // anonymous namespace
 
+DocumentHtmlRendererOptions::DocumentHtmlRendererOptions(
+    const proto::DocumentationReply& document) {
+  nodes_.reserve(document.nodes().size());
+  for (const auto& node : document.nodes()) {
+    nodes_.emplace(node.first, &node.second);
+  }
+  definition_locations_.reserve(document.definition_locations().size());
+  for (const auto& anchor : document.definition_locations()) {
+    definition_locations_.emplace(anchor.first, &anchor.second);
+  }
+}
+
 const proto::common::NodeInfo* DocumentHtmlRendererOptions::node_info(
     const std::string& ticket) const {
-  auto node = document_.nodes().find(ticket);
-  return node == document_.nodes().end() ? nullptr : &node->second;
+  auto node = nodes_.find(ticket);
+  return node == nodes_.end() ? nullptr : node->second;
 }
 
 const proto::Anchor* DocumentHtmlRendererOptions::anchor_for_ticket(
     const std::string& ticket) const {
-  auto anchor = document_.definition_locations().find(ticket);
-  return anchor == document_.definition_locations().end() ? nullptr
-                                                          : &anchor->second;
+  auto anchor = definition_locations_.find(ticket);
+  return anchor == definition_locations_.end() ? nullptr : anchor->second;
 }
 
 std::string RenderSignature(const HtmlRendererOptions& options,
@@ -414,11 +491,44 @@ std::string RenderSignature(const HtmlRendererOptions& options,
   state.render_parameters = true;
   state.linkify = linkify;
   state.options = &options;
-  state.base_ticket = base_ticket;
+  state.base_ticket = &base_ticket;
   RenderSimpleIdentifier(sig, &target, state, 0);
   return target.buffer();
 }
 
+MarkedSourceRenderings RenderMarkedSource(
+    const HtmlRendererOptions& options, const proto::common::MarkedSource& sig,
+    bool linkify, const std::string& base_ticket) {
+  RenderSimpleIdentifierTarget signature, qualified_name, initializer;
+  RenderViews views;
+  {
+    RenderSimpleIdentifierState state;
+    state.render_identifier = true;
+    state.render_types = true;
+    state.render_parameters = true;
+    state.linkify = linkify;
+    state.options = &options;
+    state.base_ticket = &base_ticket;
+    views.Add(state, &signature);
+  }
+  {
+    RenderSimpleIdentifierState state;
+    state.render_context = true;
+    views.Add(state, &qualified_name);
+  }
+  {
+    RenderSimpleIdentifierState state;
+    state.render_initializer = true;
+    views.Add(state, &initializer);
+  }
+  RenderSimpleIdentifiers(sig, views, 0);
+  MarkedSourceRenderings result;
+  result.signature = signature.buffer();
+  result.qualified_name = qualified_name.buffer();
+  result.initializer = initializer.buffer();
+  return result;
+}
+
 std::string RenderSimpleIdentifier(const proto::common::MarkedSource& sig) {
   RenderSimpleIdentifierTarget target;
   RenderSimpleIdentifierState state;
@@ -454,6 +564,13 @@ std::vector<std::string> RenderSimpleParams(
 
 std::string RenderHtml(const HtmlRendererOptions& options,
                        const Printable& printable) {
+  std::string text_out;
+  RenderHtml(options, printable, &text_out);
+  return text_out;
+}
+
+void RenderHtml(const HtmlRendererOptions& options, const Printable& printable,
+                std::string* text_out) {
   struct OpenSpan {
     const PrintableSpan* span;
     bool valid;
@@ -473,7 +590,11 @@ std::string RenderHtml(const HtmlRendererOptions& options,
   // from.
   std::stack<TaggedText*> open_tags;
   std::map<std::pair<PrintableSpan::TagBlockId, size_t>, TaggedText> tag_blocks;
+  // The main text is rendered straight into the caller's buffer; it is
+  // swapped back out once rendering is done.
   TaggedText main_text;
+  main_text.buffer.swap(*text_out);
+  main_text.buffer.reserve(main_text.buffer.size() + printable.text().size());
   // `out` points to either `main_text` if `open_tags` is empty or a value of
   // `tag_blocks` (particularly, the one referenced by the top of `open_tags`)
   // if the stack is non-empty.
@@ -618,15 +739,20 @@ std::string RenderHtml(const HtmlRendererOptions& options,
       AppendEscapedHtmlCharacter(&out->buffer, c);
     }
   }
-  RenderTagBlocks(options, tag_blocks, out);
-  return out->buffer;
+  RenderTagBlocks(options, tag_blocks, &main_text);
+  main_text.buffer.swap(*text_out);
 }
 
-std::string RenderDocument(
-    const HtmlRendererOptions& options,
-    const std::vector<MarkupHandler>& handlers,
-    const proto::DocumentationReply::Document& document) {
-  std::string text_out;
+namespace {
+/// \brief Appends the HTML rendering of `document` and its children to
+/// `text_out`.
+void RenderDocument(const HtmlRendererOptions& options,
+                    const std::vector<MarkupHandler>& handlers,
+                    const proto::DocumentationReply::Document& document,
+                    std::string* text_out_ptr) {
+  std::string& text_out = *text_out_ptr;
+  auto rendered = RenderMarkedSource(options, document.marked_source(), true,
+                                     document.ticket());
   {
     CssTag root(CssTag::Kind::Div, options.doc_div, &text_out);
     {
@@ -634,8 +760,7 @@ std::string RenderDocument(
       {
         CssTag type_div(CssTag::Kind::Div, options.type_name_div, &text_out);
         CssTag type_name(CssTag::Kind::Span, options.name_span, &text_out);
-        text_out.append(RenderSignature(options, document.marked_source(), true,
-                                        document.ticket()));
+        text_out.append(rendered.signature);
       }
       text_out.append(options.make_post_signature_markup(
           document.ticket(), document.marked_source()));
@@ -646,8 +771,7 @@ std::string RenderDocument(
           AppendEscapedHtmlString(kind_name, &text_out);
           text_out.append(" ");
         }
-        auto declared_context =
-            RenderSimpleQualifiedName(document.marked_source(), false);
+        const auto& declared_context = rendered.qualified_name;
         if (declared_context.empty()) {
           if (const auto* node_info = options.node_info(document.ticket())) {
             if (const auto* anchor =
@@ -675,11 +799,11 @@ std::string RenderDocument(
         }
       }
     }
-    auto initializer = RenderInitializer(document.marked_source());
+    const auto& initializer = rendered.initializer;
     if (!initializer.empty()) {
       CssTag init_div(CssTag::Kind::Div, options.initializer_div, &text_out);
       text_out.append("Initializer: ");
-      bool multiline = initializer.find("\n") != decltype(initializer)::npos;
+      bool multiline = initializer.find('\n') != std::string::npos;
       CssTag code_div(CssTag::Kind::Pre,
                       multiline ? options.initializer_multiline_pre
                                 : options.initializer_pre,
@@ -688,13 +812,22 @@ std::string RenderDocument(
     }
     {
       CssTag content_div(CssTag::Kind::Div, options.content_div, &text_out);
-      text_out.append(RenderPrintable(options, handlers, document.text(),
-                                      Printable::IncludeAll));
+      RenderPrintable(options, handlers, document.text(),
+                      Printable::IncludeAll, &text_out);
     }
     for (const auto& child : document.children()) {
-      text_out.append(RenderDocument(options, handlers, child));
+      RenderDocument(options, handlers, child, &text_out);
     }
   }
+}
+}  // anonymous namespace
+
+std::string RenderDocument(
+    const HtmlRendererOptions& options,
+    const std::vector<MarkupHandler>& handlers,
+    const proto::DocumentationReply::Document& document) {
+  std::string text_out;
+  RenderDocument(options, handlers, document, &text_out);
   return text_out;
 }
 
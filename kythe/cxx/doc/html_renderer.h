@@ -20,6 +20,8 @@
 #include <functional>
 #include <string>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
 #include "kythe/cxx/common/kythe_uri.h"
 #include "kythe/cxx/doc/markup_handler.h"
 #include "kythe/proto/common.pb.h"
@@ -98,22 +100,37 @@ struct HtmlRendererOptions {
   std::string initializer_pre = "kythe-doc-initializer kythe-doc-pre-code";
 };
 
+/// \brief Looks up nodes and anchors in a `DocumentationReply`.
+///
+/// The reply's maps are indexed once on construction; lookups during
+/// rendering then probe flat hash maps keyed by views of the reply's own
+/// ticket strings. `document` must outlive the options and must not be
+/// modified while they are in use.
 class DocumentHtmlRendererOptions : public HtmlRendererOptions {
  public:
   explicit DocumentHtmlRendererOptions(
-      const proto::DocumentationReply& document)
-      : document_(document) {}
+      const proto::DocumentationReply& document);
   const proto::common::NodeInfo* node_info(const std::string&) const override;
   const proto::Anchor* anchor_for_ticket(const std::string&) const override;
 
  private:
-  const proto::DocumentationReply& document_;
+  /// Nodes from the reply, by ticket.
+  absl::flat_hash_map<absl::string_view, const proto::common::NodeInfo*>
+      nodes_;
+  /// Definition anchors from the reply, by ticket.
+  absl::flat_hash_map<absl::string_view, const proto::Anchor*>
+      definition_locations_;
 };
 
 /// \brief Render `printable` as HTML according to `options`.
 std::string RenderHtml(const HtmlRendererOptions& options,
                        const Printable& printable);
 
+/// \brief Render `printable` as HTML according to `options`, appending the
+/// result to `out`.
+void RenderHtml(const HtmlRendererOptions& options, const Printable& printable,
+                std::string* out);
+
 /// \brief Render `document` as HTML according to `options`, using `handlers` to
 /// process markup.
 std::string RenderDocument(const HtmlRendererOptions& options,
@@ -139,6 +156,25 @@ std::string RenderSimpleQualifiedName(const proto::common::MarkedSource& sig,
 /// \return The empty string if there is no such initializer.
 std::string RenderInitializer(const proto::common::MarkedSource& sig);
 
+/// \brief Renderings of one MarkedSource, as produced by
+/// `RenderMarkedSource`.
+struct MarkedSourceRenderings {
+  /// The full signature, as from `RenderSignature`.
+  std::string signature;
+  /// The qualified name without the identifier, as from
+  /// `RenderSimpleQualifiedName(sig, false)`.
+  std::string qualified_name;
+  /// The initializer, as from `RenderInitializer`.
+  std::string initializer;
+};
+
+/// \brief Renders the signature, qualified name, and initializer of `sig` in a
+/// single traversal.
+/// \param linkify and `base_ticket` are as for `RenderSignature`.
+MarkedSourceRenderings RenderMarkedSource(
+    const HtmlRendererOptions& options, const proto::common::MarkedSource& sig,
+    bool linkify, const std::string& base_ticket);
+
 /// \brief Render `sig` as a full signature.
 /// \param base_ticket if set and `linkify` is true, use this ticket to try
 /// and generate links over the bare `IDENTIFIER` nodes in `sig`.
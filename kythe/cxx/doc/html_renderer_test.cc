@@ -174,6 +174,17 @@ TEST_F(HtmlRendererTest, JavadocTagBlockEmbedsCodeRef) {
 @author a {@code robot}
 @author b)"));
 }
+TEST_F(HtmlRendererTest, AppendToBuffer) {
+  proto::Printable reply;
+  reply.set_raw_text("text\n@author a {@code robot}\n@see b");
+  Printable printable(reply);
+  HandleMarkup({ParseJavadoxygen, ParseHtml}, &printable);
+  std::string out = "prefix:";
+  kythe::RenderHtml(options_, printable, &out);
+  EXPECT_EQ("prefix:" + kythe::RenderHtml(options_, printable), out);
+  EXPECT_EQ(RenderJavadoc("text\n@author a {@code robot}\n@see b"),
+            out.substr(7));
+}
 TEST_F(HtmlRendererTest, EmptyTags) {
   EXPECT_EQ("", RenderHtml("<I></I>"));
   EXPECT_EQ("<i></i>", RenderHtml("<I><B></B></I>"));
@@ -331,6 +342,52 @@ TEST_F(HtmlRendererTest, RenderSimpleQualifiedName) {
   EXPECT_EQ("namespace::(anonymous namespace)::ClassContainer::FunctionName",
             kythe::RenderSimpleQualifiedName(marked, true));
 }
+TEST_F(HtmlRendererTest, RenderMarkedSourceMatchesSeparateRenderings) {
+  proto::common::MarkedSource marked;
+  ASSERT_TRUE(TextFormat::ParseFromString(kSampleMarkedSource, &marked))
+      << "(invalid ascii protobuf)";
+  auto* init = marked.add_child();
+  init->set_kind(proto::common::MarkedSource::INITIALIZER);
+  init->set_pre_text("= 0");
+  auto rendered = kythe::RenderMarkedSource(options_, marked, true, "");
+  EXPECT_EQ(kythe::RenderSignature(options_, marked, true, ""),
+            rendered.signature);
+  EXPECT_EQ("namespace::(anonymous namespace)::ClassContainer",
+            rendered.qualified_name);
+  EXPECT_EQ("= 0", rendered.initializer);
+  EXPECT_EQ(kythe::RenderInitializer(marked), rendered.initializer);
+}
+TEST_F(HtmlRendererTest, RenderSignatureWithDocumentOptions) {
+  proto::DocumentationReply reply;
+  ASSERT_TRUE(TextFormat::ParseFromString(R"(
+      nodes { key: "kythe://a" value { definition: "kythe://ad" } }
+      nodes { key: "kythe://b" value { definition: "kythe://bd" } }
+      nodes { key: "kythe://c" value { definition: "kythe://missing" } }
+      definition_locations { key: "kythe://ad" value { parent: "a.html" } }
+      definition_locations { key: "kythe://bd" value { parent: "b.html" } }
+  )",
+                                          &reply));
+  DocumentHtmlRendererOptions options(reply);
+  options.make_link_uri = [](const proto::Anchor& anchor) {
+    return anchor.parent();
+  };
+  EXPECT_EQ(nullptr, options.node_info("kythe://d"));
+  EXPECT_EQ(nullptr, options.anchor_for_ticket("kythe://missing"));
+  proto::common::MarkedSource marked;
+  ASSERT_TRUE(TextFormat::ParseFromString(R"(
+      kind: IDENTIFIER
+      pre_text: "x"
+      link { definition: "kythe://a" }
+      link { definition: "kythe://b" definition: "kythe://c" }
+  )",
+                                          &marked));
+  // The last definition that resolves to an anchor provides the link.
+  EXPECT_EQ("<a href=\"b.html\" title=\"x\">x</a>",
+            kythe::RenderSignature(options, marked, true, ""));
+  marked.clear_link();
+  EXPECT_EQ("<a href=\"a.html\" title=\"x\">x</a>",
+            kythe::RenderSignature(options, marked, true, "kythe://a"));
+}
 }  // anonymous namespace
 }  // namespace kythe
 
@@ -17,17 +17,29 @@
 #include "kythe/cxx/doc/markup_handler.h"
 
 #include <algorithm>
+#include <iterator>
 #include <stack>
 
 namespace kythe {
 
 void PrintableSpans::Merge(const PrintableSpans& o) {
-  spans_.insert(spans_.end(), o.spans_.begin(), o.spans_.end());
-  spans_.erase(
-      std::remove_if(spans_.begin(), spans_.end(),
-                     [](const PrintableSpan& s) { return !s.is_valid(); }),
-      spans_.end());
-  std::sort(spans_.begin(), spans_.end());
+  auto is_invalid = [](const PrintableSpan& s) { return !s.is_valid(); };
+  spans_.erase(std::remove_if(spans_.begin(), spans_.end(), is_invalid),
+               spans_.end());
+  // Spans that are already here are usually sorted (because a previous Merge
+  // sorted them), so only the new spans need to be sorted before merging the
+  // two runs together.
+  bool sorted = std::is_sorted(spans_.begin(), spans_.end());
+  size_t old_size = spans_.size();
+  std::remove_copy_if(o.spans_.begin(), o.spans_.end(),
+                      std::back_inserter(spans_), is_invalid);
+  if (!sorted) {
+    std::sort(spans_.begin(), spans_.end());
+    return;
+  }
+  auto middle = spans_.begin() + old_size;
+  std::sort(middle, spans_.end());
+  std::inplace_merge(spans_.begin(), middle, spans_.end());
 }
 
 namespace {
@@ -115,16 +127,19 @@ Printable::Printable(const proto::Printable& from,
 
 Printable HandleMarkup(const std::vector<MarkupHandler>& handlers,
                        const Printable& printable) {
-  if (handlers.empty()) {
-    return printable;
-  }
-  PrintableSpans spans = printable.spans();
+  Printable result = printable;
+  HandleMarkup(handlers, &result);
+  return result;
+}
+
+void HandleMarkup(const std::vector<MarkupHandler>& handlers,
+                  Printable* printable) {
+  PrintableSpans next_spans;
   for (const auto& handler : handlers) {
-    PrintableSpans next_spans;
-    handler(printable, spans, &next_spans);
-    spans.Merge(next_spans);
+    handler(*printable, printable->spans(), &next_spans);
+    printable->mutable_spans()->Merge(next_spans);
+    next_spans.Clear();
   }
-  return Printable(printable.text(), std::move(spans));
 }
 
 std::string PrintableSpans::Dump(const std::string& annotated_buffer) const {
@@ -116,12 +116,18 @@ class PrintableSpans {
  public:
   /// \brief Insert all spans from `more`.
   /// Empty or negative-length spans are discarded.
+  /// \post The list of spans is sorted.
   void Merge(const PrintableSpans& more);
   /// Construct a span and insert it.
   template <typename... T>
   void Emplace(T&&... span_args) {
     spans_.emplace_back(span_args...);
   }
+  /// \brief Removes all spans and tag block ordinals, keeping the storage.
+  void Clear() {
+    spans_.clear();
+    max_tag_block_.clear();
+  }
   /// \return the number of spans being stored.
   const size_t size() const { return spans_.size(); }
   const PrintableSpan& span(size_t index) const { return spans_[index]; }
@@ -194,6 +200,11 @@ using MarkupHandler = std::function<void(const Printable& printable,
 Printable HandleMarkup(const std::vector<MarkupHandler>& handlers,
                        const Printable& printable);
 
+/// \brief Marks up `printable` in place using the sequence of handlers in
+/// `handlers`. Every handler annotates the same text; only the spans grow.
+void HandleMarkup(const std::vector<MarkupHandler>& handlers,
+                  Printable* printable);
+
 }  // namespace kythe
 
 #endif
@@ -22,61 +22,123 @@
 #include <string.h>
 
 #include <algorithm>
-#include <mutex>
 #include <string>
 #include <vector>
 
+#include "absl/strings/match.h"
 #include "absl/strings/str_format.h"
-#include "llvm/ADT/SmallVector.h"
-#include "llvm/ADT/StringRef.h"
-#include "llvm/Support/Regex.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "re2/re2.h"
 
 namespace kythe {
 namespace common {
 namespace {
 
-/// \brief A `llvm::Regex` wrapper that only performs full matches on
+/// \brief A compiled regular expression that only performs full matches on
 /// non-empty strings.
 ///
 /// The second restriction makes it easier to write long chains of 'or'-ed
 /// regular expressions which may contain empty options without those silently
-/// matching empty strings.
+/// matching empty strings. Matching is thread-safe and takes time linear in
+/// the length of the string, so instances are built once and shared.
 class FullMatchRegex {
  public:
-  /// \param Regex an extended-syntax regex to match.
-  explicit FullMatchRegex(llvm::StringRef Regex)
-      : InnerRegex("^(" + Regex.str() + ")$", llvm::Regex::NoFlags) {
-    std::string st;
-    if (!InnerRegex.isValid(st)) {
-      absl::FPrintF(stderr, "%s (regex was %s)\n", st, Regex.str());
-      assert(0 && "!InnerRegex.isValid()");
+  /// \param Regex a regex to match, in the common subset of POSIX extended
+  /// and RE2 syntax.
+  explicit FullMatchRegex(absl::string_view Regex)
+      : InnerRegex(re2::StringPiece(Regex.data(), Regex.size())) {
+    if (!InnerRegex.ok()) {
+      absl::FPrintF(stderr, "%s (regex was %s)\n", InnerRegex.error(), Regex);
+      assert(0 && "!InnerRegex.ok()");
     }
   }
 
   /// \return true if `String` is nonempty and a full match of this regex.
-  bool FullMatch(llvm::StringRef String) const {
-    std::lock_guard<std::mutex> MutexLock(RegexMutex);
-    llvm::SmallVector<llvm::StringRef, 1> Matches;
-    return !String.empty() && InnerRegex.match(String, &Matches);
+  bool FullMatch(absl::string_view String) const {
+    return !String.empty() &&
+           RE2::FullMatch({String.data(), String.size()}, InnerRegex);
   }
 
  private:
-  mutable llvm::Regex InnerRegex;
-  /// This mutex protects `InnerRegex`, since `llvm::Regex` is not threadsafe.
-  mutable std::mutex RegexMutex;
+  RE2 InnerRegex;
 };
 
+/// \brief One step in rewriting an argument list.
+struct ArgFilter {
+  enum class Kind {
+    Omit,              ///< Drop arguments matching `Regex`.
+    OmitWithFollower,  ///< Also drop the argument after each match.
+    StripPrefix,       ///< Remove `Prefix` from arguments starting with it.
+  };
+  Kind FilterKind;
+  const FullMatchRegex* Regex = nullptr;
+  absl::string_view Prefix;
+};
+
+/// \brief Applies `Filters` to `Input` in a single pass.
+///
+/// The result is the same as applying each filter in turn to the output of
+/// the one before, so an `OmitWithFollower` filter drops the next argument
+/// that earlier filters let through.
+std::vector<std::string> ApplyFilters(const std::vector<ArgFilter>& Filters,
+                                      const std::vector<std::string>& Input) {
+  std::vector<std::string> Output;
+  Output.reserve(Input.size() + 1);
+  // Whether each filter is due to drop the next argument it sees.
+  std::vector<bool> DropNext(Filters.size(), false);
+  for (const std::string& Arg : Input) {
+    absl::string_view Current = Arg;
+    bool Keep = true;
+    for (size_t I = 0; Keep && I < Filters.size(); ++I) {
+      const ArgFilter& Filter = Filters[I];
+      if (DropNext[I]) {
+        DropNext[I] = false;
+        Keep = false;
+        continue;
+      }
+      switch (Filter.FilterKind) {
+        case ArgFilter::Kind::Omit:
+          Keep = !Filter.Regex->FullMatch(Current);
+          break;
+        case ArgFilter::Kind::OmitWithFollower:
+          Keep = !Filter.Regex->FullMatch(Current);
+          DropNext[I] = !Keep;
+          break;
+        case ArgFilter::Kind::StripPrefix:
+          absl::ConsumePrefix(&Current, Filter.Prefix);
+          break;
+      }
+    }
+    if (Keep) {
+      Output.emplace_back(Current);
+    }
+  }
+  return Output;
+}
+
+/// \brief Appends the filters in `Tail` to `Head`.
+std::vector<ArgFilter> Concat(std::vector<ArgFilter> Head,
+                              const std::vector<ArgFilter>& Tail) {
+  Head.insert(Head.end(), Tail.begin(), Tail.end());
+  return Head;
+}
+
 }  // anonymous namespace
 
 // Decide what will the driver do based on the inputs found on the command
 // line.
 DriverAction DetermineDriverAction(const std::vector<std::string>& args) {
-  const FullMatchRegex c_file_re("[^-].*\\.(c|i)");
-  const FullMatchRegex cxx_file_re("[^-].*\\.(C|c\\+\\+|cc|cp|cpp|cxx|CPP|ii)");
-  const FullMatchRegex fortran_file_re(
+  static const FullMatchRegex& c_file_re =
+      *new FullMatchRegex("[^-].*\\.(c|i)");
+  static const FullMatchRegex& cxx_file_re =
+      *new FullMatchRegex("[^-].*\\.(C|c\\+\\+|cc|cp|cpp|cxx|CPP|ii)");
+  static const FullMatchRegex& fortran_file_re = *new FullMatchRegex(
       "[^-].*\\.(f|for|ftn|F|FOR|fpp|FPP|FTN|f90|f95|f03|f08|F90|F95|F03|F08)");
-  const FullMatchRegex go_file_re("[^-].*\\.go");
-  const FullMatchRegex asm_file_re("[^-].*\\.(s|S|sx)");
+  static const FullMatchRegex& go_file_re =
+      *new FullMatchRegex("[^-].*\\.go");
+  static const FullMatchRegex& asm_file_re =
+      *new FullMatchRegex("[^-].*\\.(s|S|sx)");
 
   enum DriverAction action = UNKNOWN;
   bool is_link = true;
@@ -133,54 +195,11 @@ bool HasCxxInputInCommandLineOrArgs(
   return action == CXX_COMPILE || action == C_COMPILE;
 }
 
-// Returns a copy of the input vector with every string which matches the
-// regular expression removed.
-static std::vector<std::string> CopyOmittingMatches(
-    const FullMatchRegex& re, const std::vector<std::string>& input) {
-  std::vector<std::string> output;
-  std::remove_copy_if(
-      input.begin(), input.end(), back_inserter(output),
-      [&re](const std::string& arg) { return re.FullMatch(arg); });
-  return output;
-}
-
-// Returns a copy of the input vector after removing each string which matches
-// the regular expression and one string immediately following the matching
-// string.
-static std::vector<std::string> CopyOmittingMatchesAndFollowers(
-    const FullMatchRegex& re, const std::vector<std::string>& input) {
-  std::vector<std::string> output;
-  for (size_t i = 0; i < input.size(); ++i) {
-    if (!re.FullMatch(input[i])) {
-      output.push_back(input[i]);
-    } else {
-      ++i;  // Skip the matching string *and* the next string.
-    }
-  }
-  return output;
-}
-
-// Returns a copy of the input vector with the supplied prefix string removed
-// from any element of which it was a prefix.
-static std::vector<std::string> StripPrefix(
-    const std::string& prefix, const std::vector<std::string>& input) {
-  std::vector<std::string> output;
-  const size_t prefix_size = prefix.size();
-  for (const auto& arg : input) {
-    if (arg.compare(0, prefix_size, prefix) == 0) {
-      output.push_back(arg.substr(prefix_size));
-    } else {
-      output.push_back(arg);
-    }
-  }
-  return output;
-}
-
-std::vector<std::string> GCCArgsToClangArgs(
-    const std::vector<std::string>& gcc_args) {
+// Returns the filters that convert GCC's arguments to Clang's.
+static const std::vector<ArgFilter>& GCCToClangFilters() {
   // These are GCC-specific arguments which Clang does not yet understand or
   // support without issuing ugly warnings, and cannot otherwise be suppressed.
-  const FullMatchRegex unsupported_args_re(
+  static const FullMatchRegex& unsupported_args_re = *new FullMatchRegex(
       "-W(no-)?(error=)?coverage-mismatch"
       "|-W(no-)?(error=)?frame-larger-than.*"
       "|-W(no-)?(error=)?maybe-uninitialized"
@@ -238,29 +257,22 @@ std::vector<std::string> GCCArgsToClangArgs(
                    // but figure out what to do to make this work properly.
       "|-mapcs-frame"
       "|-pass-exit-codes");
-  const FullMatchRegex unsupported_args_with_values_re("-wrapper");
-
-  return StripPrefix("-Xclang-only=",
-                     CopyOmittingMatchesAndFollowers(
-                         unsupported_args_with_values_re,
-                         CopyOmittingMatches(unsupported_args_re, gcc_args)));
-}
-
-std::vector<std::string> GCCArgsToClangSyntaxOnlyArgs(
-    const std::vector<std::string>& gcc_args) {
-  return AdjustClangArgsForSyntaxOnly(GCCArgsToClangArgs(gcc_args));
+  static const FullMatchRegex& unsupported_args_with_values_re =
+      *new FullMatchRegex("-wrapper");
+  static const std::vector<ArgFilter>& filters = *new std::vector<ArgFilter>{
+      {ArgFilter::Kind::Omit, &unsupported_args_re},
+      {ArgFilter::Kind::OmitWithFollower, &unsupported_args_with_values_re},
+      {ArgFilter::Kind::StripPrefix, nullptr, "-Xclang-only="},
+  };
+  return filters;
 }
 
-std::vector<std::string> GCCArgsToClangAnalyzeArgs(
-    const std::vector<std::string>& gcc_args) {
-  return AdjustClangArgsForAnalyze(GCCArgsToClangArgs(gcc_args));
-}
-
-std::vector<std::string> AdjustClangArgsForSyntaxOnly(
-    const std::vector<std::string>& clang_args) {
+// Returns the filters that drop Clang arguments which don't apply to
+// '-fsyntax-only' (or '--analyze').
+static const std::vector<ArgFilter>& SyntaxOnlyFilters() {
   // These are arguments which are inapplicable to '-fsyntax-only' behavior, but
   // are applicable to regular compilation.
-  const FullMatchRegex inapplicable_args_re(
+  static const FullMatchRegex& inapplicable_args_re = *new FullMatchRegex(
       "--analyze"
       "|-CC?"
       "|-E"
@@ -283,13 +295,41 @@ std::vector<std::string> AdjustClangArgsForSyntaxOnly(
       "|-nostartfiles"
       "|-s"
       "|-shared");
-  const FullMatchRegex inapplicable_args_with_values_re("-M[FTQ]");
+  static const FullMatchRegex& inapplicable_args_with_values_re =
+      *new FullMatchRegex("-M[FTQ]");
+  static const std::vector<ArgFilter>& filters = *new std::vector<ArgFilter>{
+      {ArgFilter::Kind::Omit, &inapplicable_args_re},
+      {ArgFilter::Kind::OmitWithFollower, &inapplicable_args_with_values_re},
+  };
+  return filters;
+}
 
-  std::vector<std::string> result = CopyOmittingMatchesAndFollowers(
-      inapplicable_args_with_values_re,
-      CopyOmittingMatches(inapplicable_args_re, clang_args));
+std::vector<std::string> GCCArgsToClangArgs(
+    const std::vector<std::string>& gcc_args) {
+  return ApplyFilters(GCCToClangFilters(), gcc_args);
+}
+
+std::vector<std::string> GCCArgsToClangSyntaxOnlyArgs(
+    const std::vector<std::string>& gcc_args) {
+  // Both conversions happen in the same pass over the arguments.
+  static const std::vector<ArgFilter>& filters =
+      *new std::vector<ArgFilter>(Concat(GCCToClangFilters(),
+                                         SyntaxOnlyFilters()));
+  std::vector<std::string> result = ApplyFilters(filters, gcc_args);
   result.push_back("-fsyntax-only");
+  return result;
+}
+
+std::vector<std::string> GCCArgsToClangAnalyzeArgs(
+    const std::vector<std::string>& gcc_args) {
+  return AdjustClangArgsForAnalyze(GCCArgsToClangArgs(gcc_args));
+}
 
+std::vector<std::string> AdjustClangArgsForSyntaxOnly(
+    const std::vector<std::string>& clang_args) {
+  std::vector<std::string> result =
+      ApplyFilters(SyntaxOnlyFilters(), clang_args);
+  result.push_back("-fsyntax-only");
   return result;
 }
 
@@ -313,7 +353,7 @@ std::vector<std::string> AdjustClangArgsForAnalyze(
 std::vector<std::string> ClangArgsToGCCArgs(
     const std::vector<std::string>& clang_args) {
   // These are Clang-specific args which GCC does not understand.
-  const FullMatchRegex unsupported_args_re(
+  static const FullMatchRegex& unsupported_args_re = *new FullMatchRegex(
       "--target=.*"
       "|-W(no-)?(error=)?ambiguous-member-template"
       "|-W(no-)?(error=)?bind-to-temporary-copy"
@@ -359,32 +399,38 @@ std::vector<std::string> ClangArgsToGCCArgs(
       "|-fplugin=.*"
       "|-fplugin-arg-.*"
       "|-gline-tables-only");
-  const FullMatchRegex unsupported_args_with_values_re(
-      "-Xclang"
-      "|-target");
+  static const FullMatchRegex& unsupported_args_with_values_re =
+      *new FullMatchRegex(
+          "-Xclang"
+          "|-target");
 
   // It's important to remove the matches that have followers first -- those
   // followers might match one of the flag regular expressions, and removing
   // just the follower completely changes the semantics of the command.
-  return CopyOmittingMatches(unsupported_args_re,
-                             CopyOmittingMatchesAndFollowers(
-                                 unsupported_args_with_values_re, clang_args));
+  static const std::vector<ArgFilter>& filters = *new std::vector<ArgFilter>{
+      {ArgFilter::Kind::OmitWithFollower, &unsupported_args_with_values_re},
+      {ArgFilter::Kind::Omit, &unsupported_args_re},
+  };
+  return ApplyFilters(filters, clang_args);
 }
 
 std::vector<std::string> AdjustClangArgsForAddressSanitizer(
     const std::vector<std::string>& input) {
-  const FullMatchRegex inapplicable_flags_re("-static");
-  const FullMatchRegex inapplicable_flags_with_shared_re("-pie");
-
-  for (const auto& arg : input) {
-    if (arg == "-shared") {
-      return CopyOmittingMatches(
-          inapplicable_flags_with_shared_re,
-          CopyOmittingMatches(inapplicable_flags_re, input));
-    }
-  }
-
-  return CopyOmittingMatches(inapplicable_flags_re, input);
+  static const FullMatchRegex& inapplicable_flags_re =
+      *new FullMatchRegex("-static");
+  static const FullMatchRegex& inapplicable_flags_with_shared_re =
+      *new FullMatchRegex("-pie");
+  static const std::vector<ArgFilter>& filters = *new std::vector<ArgFilter>{
+      {ArgFilter::Kind::Omit, &inapplicable_flags_re},
+  };
+  static const std::vector<ArgFilter>& shared_filters =
+      *new std::vector<ArgFilter>{
+          {ArgFilter::Kind::Omit, &inapplicable_flags_re},
+          {ArgFilter::Kind::Omit, &inapplicable_flags_with_shared_re},
+      };
+
+  bool shared = std::find(input.begin(), input.end(), "-shared") != input.end();
+  return ApplyFilters(shared ? shared_filters : filters, input);
 }
 
 std::vector<char*> CommandLineToArgv(const std::vector<std::string>& command) {
@@ -21,6 +21,10 @@
 
 namespace {
 
+using ::kythe::common::AdjustClangArgsForSyntaxOnly;
+using ::kythe::common::ClangArgsToGCCArgs;
+using ::kythe::common::GCCArgsToClangArgs;
+using ::kythe::common::GCCArgsToClangSyntaxOnlyArgs;
 using ::kythe::common::HasCxxInputInCommandLineOrArgs;
 
 TEST(HasCxxInputInCommandLineOrArgs, GoodInputs) {
@@ -61,6 +65,32 @@ TEST(HasCxxInputInCommandLineOrArgs, BadInputs) {
       HasCxxInputInCommandLineOrArgs({"base/timestamp.cc", "-Wl,@foo"}));
 }
 
+TEST(GCCArgsToClangArgs, DropsUnsupportedArgs) {
+  EXPECT_EQ(GCCArgsToClangArgs({"-O2", "-fno-gcse", "-wrapper", "valgrind",
+                                "-Xclang-only=-Wthread-safety", "a.cc"}),
+            std::vector<std::string>({"-O2", "-Wthread-safety", "a.cc"}));
+}
+
+TEST(GCCArgsToClangSyntaxOnlyArgs, MatchesSeparateSteps) {
+  // Filters apply in order: the follower of -wrapper is the next argument
+  // that survives earlier filters, and stripped -Xclang-only= arguments are
+  // subject to the syntax-only filters.
+  const std::vector<std::string> args = {
+      "-c",  "a.cc", "-wrapper",        "-fgcse",           "valgrind",
+      "-MF", "a.d",  "-Xclang-only=-c", "-Xclang-only=-DX", "-gdwarf",
+      "-fsyntax-only"};
+  EXPECT_EQ(GCCArgsToClangSyntaxOnlyArgs(args),
+            AdjustClangArgsForSyntaxOnly(GCCArgsToClangArgs(args)));
+  EXPECT_EQ(GCCArgsToClangSyntaxOnlyArgs(args),
+            std::vector<std::string>({"a.cc", "-DX", "-fsyntax-only"}));
+}
+
+TEST(ClangArgsToGCCArgs, DropsFollowersFirst) {
+  EXPECT_EQ(ClangArgsToGCCArgs({"-Xclang", "-fcolor-diagnostics", "-target",
+                                "x86_64", "-fcolor-diagnostics", "a.cc"}),
+            std::vector<std::string>({"a.cc"}));
+}
+
 // TODO(zarko): Port additional tests.
 
 }  // namespace
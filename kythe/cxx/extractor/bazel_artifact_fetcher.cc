@@ -0,0 +1,321 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/extractor/bazel_artifact_fetcher.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "glog/logging.h"
+#include "kythe/cxx/common/kythe_uri.h"
+#include "kythe/cxx/common/path_utils.h"
+#include "kythe/cxx/common/status.h"
+#include "openssl/sha.h"
+
+namespace kythe {
+namespace {
+
+absl::Status ErrnoStatus(absl::string_view action, absl::string_view path) {
+  return absl::Status(
+      ErrnoToStatusCode(),
+      absl::StrCat("Couldn't ", action, " ", path, ": ", std::strerror(errno)));
+}
+
+absl::StatusOr<std::string> ReadFile(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return ErrnoStatus("open", path);
+  }
+  std::string content;
+  char buffer[1 << 16];
+  ssize_t count;
+  while ((count = ::read(fd, buffer, sizeof(buffer))) != 0) {
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      ::close(fd);
+      return ErrnoStatus("read", path);
+    }
+    content.append(buffer, count);
+  }
+  ::close(fd);
+  return content;
+}
+
+/// \brief Creates `path` and any missing parent directories.
+absl::Status MakeDirectories(absl::string_view path) {
+  if (path.empty() || path == "/") {
+    return absl::OkStatus();
+  }
+  std::string directory(path);
+  if (::mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST) {
+    return absl::OkStatus();
+  }
+  if (errno != ENOENT) {
+    return ErrnoStatus("create", directory);
+  }
+  if (auto status = MakeDirectories(Dirname(path)); !status.ok()) {
+    return status;
+  }
+  if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+    return ErrnoStatus("create", directory);
+  }
+  return absl::OkStatus();
+}
+
+/// \brief Writes `content` to `path` through a temporary file, so that no
+/// reader sees it partly written.
+absl::Status WriteFile(const std::string& path, absl::string_view content) {
+  if (auto status = MakeDirectories(Dirname(path)); !status.ok()) {
+    return status;
+  }
+  std::string temp_path = absl::StrCat(path, ".XXXXXX");
+  int fd = ::mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    return ErrnoStatus("create", temp_path);
+  }
+  while (!content.empty()) {
+    ssize_t count = ::write(fd, content.data(), content.size());
+    if (count < 0) {
+      if (errno == EINTR) continue;
+      absl::Status status = ErrnoStatus("write", temp_path);
+      ::close(fd);
+      ::unlink(temp_path.c_str());
+      return status;
+    }
+    content.remove_prefix(count);
+  }
+  if (::close(fd) != 0) {
+    absl::Status status = ErrnoStatus("write", temp_path);
+    ::unlink(temp_path.c_str());
+    return status;
+  }
+  if (::rename(temp_path.c_str(), path.c_str()) != 0) {
+    absl::Status status = ErrnoStatus("rename", temp_path);
+    ::unlink(temp_path.c_str());
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+/// \brief Decodes the payload of a `data:` URI (RFC 2397).
+absl::StatusOr<std::string> DecodeDataUri(absl::string_view uri) {
+  absl::string_view rest = absl::StripPrefix(uri, "data:");
+  auto comma = rest.find(',');
+  if (comma == absl::string_view::npos) {
+    return absl::InvalidArgumentError(absl::StrCat("Malformed URI: ", uri));
+  }
+  absl::string_view media_type = rest.substr(0, comma);
+  absl::string_view data = rest.substr(comma + 1);
+  std::string scratch;
+  data = URIView::Unescape(data, &scratch);
+  if (media_type == "base64" || absl::EndsWith(media_type, ";base64")) {
+    std::string content;
+    if (!absl::Base64Unescape(data, &content)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Malformed base64 in URI: ", uri));
+    }
+    return content;
+  }
+  return std::string(data);
+}
+
+/// \brief Returns the path named by a `file:` URI, which may name an empty
+/// or `localhost` authority.
+absl::StatusOr<std::string> FileUriPath(absl::string_view uri) {
+  absl::string_view path = absl::StripPrefix(uri, "file:");
+  if (absl::ConsumePrefix(&path, "//")) {
+    auto slash = path.find('/');
+    absl::string_view host = path.substr(0, slash);
+    if (slash == absl::string_view::npos ||
+        !(host.empty() || host == "localhost")) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Unsupported file URI: ", uri));
+    }
+    path.remove_prefix(slash);
+  }
+  std::string scratch;
+  return std::string(URIView::Unescape(path, &scratch));
+}
+
+/// \brief Checks `content` against the SHA-256 digest and size of a blob
+/// named `.../blobs/<sha256>/<size>`, if `uri` names one.
+absl::Status VerifyBlobDigest(absl::string_view uri,
+                              absl::string_view content) {
+  auto blobs = uri.rfind("/blobs/");
+  if (blobs == absl::string_view::npos) {
+    return absl::OkStatus();
+  }
+  std::vector<absl::string_view> parts =
+      absl::StrSplit(uri.substr(blobs + strlen("/blobs/")), '/');
+  if (parts.size() < 2) {
+    return absl::OkStatus();
+  }
+  absl::string_view digest = parts[parts.size() - 2];
+  uint64_t size;
+  if (digest.size() != 2 * SHA256_DIGEST_LENGTH ||
+      !absl::SimpleAtoi(parts.back(), &size)) {
+    // Some other hash function or naming scheme.
+    return absl::OkStatus();
+  }
+  if (content.size() != size) {
+    return absl::DataLossError(absl::StrCat("Expected ", size, " bytes from ",
+                                            uri, " but got ", content.size()));
+  }
+  unsigned char hash[SHA256_DIGEST_LENGTH];
+  ::SHA256(reinterpret_cast<const unsigned char*>(content.data()),
+           content.size(), hash);
+  if (absl::BytesToHexString(absl::string_view(
+          reinterpret_cast<const char*>(hash), sizeof(hash))) !=
+      absl::AsciiStrToLower(digest)) {
+    return absl::DataLossError(
+        absl::StrCat("Content from ", uri, " doesn't match its digest"));
+  }
+  return absl::OkStatus();
+}
+
+}  // anonymous namespace
+
+BazelArtifactFetcher::BazelArtifactFetcher(BazelArtifactReader* reader,
+                                           Options options)
+    : reader_(CHECK_NOTNULL(reader)),
+      options_(std::move(options)),
+      capacity_(options_.capacity > 0 ? options_.capacity : 1),
+      pool_(options_.parallelism > 0 ? options_.parallelism : 1),
+      thread_([this] { Schedule(); }) {
+  Next();
+}
+
+BazelArtifactFetcher::~BazelArtifactFetcher() {
+  {
+    absl::MutexLock lock(&mu_);
+    cancelled_ = true;
+  }
+  thread_.join();
+}
+
+absl::StatusOr<std::string> BazelArtifactFetcher::FetchUri(
+    absl::string_view uri, const RemoteFetch& fetch_remote) {
+  absl::StatusOr<std::string> content;
+  if (absl::StartsWith(uri, "data:")) {
+    content = DecodeDataUri(uri);
+  } else if (absl::StartsWith(uri, "file:")) {
+    absl::StatusOr<std::string> path = FileUriPath(uri);
+    if (!path.ok()) {
+      return path.status();
+    }
+    content = ReadFile(*path);
+  } else if (fetch_remote) {
+    content = fetch_remote(uri);
+  } else {
+    return absl::UnimplementedError(absl::StrCat("Can't fetch ", uri));
+  }
+  if (!content.ok()) {
+    return content.status();
+  }
+  if (auto status = VerifyBlobDigest(uri, *content); !status.ok()) {
+    return status;
+  }
+  return content;
+}
+
+absl::Status BazelArtifactFetcher::Fetch(BazelArtifact* artifact) const {
+  for (BazelArtifactFile& file : artifact->files) {
+    std::string local_path = CleanPath(
+        file.local_path.empty() ? Basename(file.uri) : file.local_path);
+    if (local_path.empty() || IsAbsolutePath(local_path) ||
+        local_path == ".." || absl::StartsWith(local_path, "../")) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Bad local path for ", file.uri, " in ", artifact->label));
+    }
+    absl::StatusOr<std::string> content =
+        FetchUri(file.uri, options_.fetch_remote);
+    if (!content.ok()) {
+      return content.status();
+    }
+    std::string path = JoinPath(options_.output_directory, local_path);
+    if (auto status = WriteFile(path, *content); !status.ok()) {
+      return status;
+    }
+    file.local_path = std::move(path);
+  }
+  return absl::OkStatus();
+}
+
+void BazelArtifactFetcher::Schedule() {
+  for (; !reader_->Done(); reader_->Next()) {
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(
+          +[](BazelArtifactFetcher* self) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+               self->mu_) {
+            return self->cancelled_ ||
+                   self->fetched_.size() + self->in_flight_ < self->capacity_;
+          },
+          this));
+      if (cancelled_) {
+        break;
+      }
+      ++in_flight_;
+    }
+    pool_.Schedule([this, artifact = std::move(reader_->Ref())]() mutable {
+      absl::Status status = Fetch(&artifact);
+      absl::MutexLock lock(&mu_);
+      --in_flight_;
+      if (status.ok()) {
+        fetched_.push_back(std::move(artifact));
+      } else if (status_.ok()) {
+        // Stop at the first error, but still return what was fetched.
+        status_ = std::move(status);
+        cancelled_ = true;
+      }
+    });
+  }
+  pool_.Wait();
+  absl::MutexLock lock(&mu_);
+  if (status_.ok() && reader_->Done()) {
+    status_ = reader_->status();
+  }
+  finished_ = true;
+}
+
+void BazelArtifactFetcher::Next() {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](BazelArtifactFetcher* self) ABSL_EXCLUSIVE_LOCKS_REQUIRED(self->mu_) {
+        return self->finished_ || !self->fetched_.empty();
+      },
+      this));
+  if (!fetched_.empty()) {
+    value_ = std::move(fetched_.front());
+    fetched_.pop_front();
+  } else {
+    value_ = status_;
+  }
+}
+
+}  // namespace kythe
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_EXTRACTOR_BAZEL_ARTIFACT_FETCHER_H_
+#define KYTHE_CXX_EXTRACTOR_BAZEL_ARTIFACT_FETCHER_H_
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/variant.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/cxx/extractor/bazel_artifact.h"
+#include "kythe/cxx/extractor/bazel_artifact_reader.h"
+
+namespace kythe {
+
+/// \brief A cursor over the artifacts selected by a BazelArtifactReader whose
+/// files have been copied into a local directory.
+///
+/// The files are fetched on a pool of threads while the reader keeps
+/// selecting artifacts, and artifacts are returned in the order their fetches
+/// finish, so that a caller can start on the first ones while the build is
+/// still running. `file:` and `data:` URIs are handled here; other schemes
+/// are passed to `Options::fetch_remote`. Content fetched from a URI that
+/// names a content-addressed blob (`.../blobs/<sha256>/<size>`, as Bazel's
+/// remote caches do) is checked against that digest and size.
+class BazelArtifactFetcher {
+ public:
+  using value_type = BazelArtifact;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+
+  /// \brief Returns the content at `uri`. Called on several threads at once.
+  using RemoteFetch =
+      std::function<absl::StatusOr<std::string>(absl::string_view uri)>;
+
+  struct Options {
+    /// The existing directory to copy files into, each under its local path.
+    std::string output_directory;
+    /// The number of artifacts to fetch at once.
+    size_t parallelism = 8;
+    /// The number of artifacts to fetch ahead of the caller.
+    size_t capacity = 64;
+    /// Fetches URIs with other schemes than `file:` and `data:`. If unset,
+    /// such URIs are an error.
+    RemoteFetch fetch_remote;
+  };
+
+  /// \brief Starts fetching the artifacts from `reader`, which must outlive
+  /// this object and must not otherwise be used while it exists.
+  BazelArtifactFetcher(BazelArtifactReader* reader, Options options);
+  ~BazelArtifactFetcher();
+
+  BazelArtifactFetcher(const BazelArtifactFetcher&) = delete;
+  BazelArtifactFetcher& operator=(const BazelArtifactFetcher&) = delete;
+
+  /// \brief Waits for the next artifact whose files are all local.
+  void Next();
+
+  /// \brief Returns true if every artifact has been returned or fetching
+  /// stopped at an error.
+  bool Done() const { return value_.index() != 0; }
+
+  /// \brief Returns a reference to the most recently fetched artifact, whose
+  /// files' `local_path`s now name their copies.
+  /// Requires: Done() == false.
+  reference Ref() { return absl::get<value_type>(value_); }
+  const_reference Ref() const { return absl::get<value_type>(value_); }
+
+  /// \brief Returns the first error from fetching a file, or else the
+  /// reader's status.
+  /// Requires: Done() == true.
+  absl::Status status() const { return absl::get<absl::Status>(value_); }
+
+  /// \brief Reads the content at a `file:` or `data:` URI, or passes it to
+  /// `fetch_remote`, and checks it against any digest in the URI.
+  static absl::StatusOr<std::string> FetchUri(
+      absl::string_view uri, const RemoteFetch& fetch_remote);
+
+ private:
+  /// \brief Schedules a fetch for each artifact from `reader_` until it is
+  /// done or fetching fails, then waits for the fetches to finish.
+  void Schedule();
+
+  /// \brief Copies each of `artifact`'s files into `output_directory`.
+  absl::Status Fetch(BazelArtifact* artifact) const;
+
+  BazelArtifactReader* const reader_;
+  const Options options_;
+  /// The number of artifacts fetched or being fetched to buffer ahead.
+  const size_t capacity_;
+  absl::variant<value_type, absl::Status> value_;
+
+  absl::Mutex mu_;
+  /// Fetched artifacts that haven't been returned yet.
+  std::deque<value_type> fetched_ ABSL_GUARDED_BY(mu_);
+  /// The number of artifacts being fetched.
+  size_t in_flight_ ABSL_GUARDED_BY(mu_) = 0;
+  /// Set once every fetch has finished; `status_` then holds the result.
+  bool finished_ ABSL_GUARDED_BY(mu_) = false;
+  absl::Status status_ ABSL_GUARDED_BY(mu_);
+  /// Set when no more artifacts should be scheduled.
+  bool cancelled_ ABSL_GUARDED_BY(mu_) = false;
+
+  ThreadPool pool_;
+  std::thread thread_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_EXTRACTOR_BAZEL_ARTIFACT_FETCHER_H_
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/extractor/bazel_artifact_fetcher.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/util/delimited_message_util.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/extractor/bazel_artifact_reader.h"
+#include "kythe/cxx/extractor/bazel_event_reader.h"
+#include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
+
+namespace kythe {
+namespace {
+using ::google::protobuf::io::IstreamInputStream;
+using ::google::protobuf::util::SerializeDelimitedToOstream;
+using ::testing::Contains;
+using ::testing::UnorderedElementsAre;
+
+/// The SHA-256 digest of "contents".
+constexpr char kContentsDigest[] =
+    "d1b2a59fbea7e20077af9f91b27e95e865061b270be03ff539ab3b73587882e8";
+
+std::string ReadTestFile(const std::string& path) {
+  std::ifstream input(path);
+  std::stringstream content;
+  content << input.rdbuf();
+  return content.str();
+}
+
+/// \brief Returns an event stream with an extra action for each of `uris`,
+/// whose output is named `out/<index>.kzip`.
+std::string MakeEvents(const std::vector<std::string>& uris) {
+  std::stringstream stream;
+  for (size_t i = 0; i < uris.size(); i++) {
+    build_event_stream::BuildEvent event;
+    auto* id = event.mutable_id()->mutable_action_completed();
+    id->set_primary_output(absl::StrCat("out/", i, ".kzip"));
+    id->set_label(absl::StrCat("//id/label:", i));
+    auto* payload = event.mutable_action();
+    payload->set_success(true);
+    payload->set_type("extra_action");
+    payload->mutable_primary_output()->set_uri(uris[i]);
+    EXPECT_TRUE(SerializeDelimitedToOstream(event, &stream));
+  }
+  return stream.str();
+}
+
+struct FetchResult {
+  std::vector<std::string> labels;
+  std::vector<std::string> contents;
+  absl::Status status;
+};
+
+FetchResult FetchAll(const std::string& events,
+                     BazelArtifactFetcher::Options options) {
+  std::stringstream stream(events);
+  IstreamInputStream input(&stream);
+  BazelEventReader event_reader(&input);
+  BazelArtifactReader reader(&event_reader);
+  FetchResult result;
+  BazelArtifactFetcher fetcher(&reader, std::move(options));
+  for (; !fetcher.Done(); fetcher.Next()) {
+    result.labels.push_back(fetcher.Ref().label);
+    for (const auto& file : fetcher.Ref().files) {
+      result.contents.push_back(ReadTestFile(file.local_path));
+    }
+  }
+  result.status = fetcher.status();
+  return result;
+}
+
+TEST(BazelArtifactFetcherTest, FetchesEveryArtifact) {
+  std::string source = absl::StrCat(::testing::TempDir(), "/source");
+  std::ofstream(source, std::ios::trunc) << "from a file";
+  std::vector<std::string> uris = {absl::StrCat("file://", source),
+                                   "data:base64,Y29udGVudHM=",
+                                   "data:text/plain,plain%20text",
+                                   "remote://cache/blobs/something"};
+  for (int i = 0; i < 20; i++) {
+    uris.push_back(absl::StrCat("file://", source));
+  }
+  BazelArtifactFetcher::Options options;
+  options.output_directory = absl::StrCat(::testing::TempDir(), "/all");
+  options.parallelism = 4;
+  options.capacity = 2;
+  options.fetch_remote = [](absl::string_view uri) {
+    return absl::StrCat("fetched ", uri);
+  };
+  FetchResult result = FetchAll(MakeEvents(uris), std::move(options));
+  ASSERT_TRUE(result.status.ok()) << result.status;
+  EXPECT_EQ(result.labels.size(), uris.size());
+  EXPECT_EQ(result.contents.size(), uris.size());
+  const auto& contents = result.contents;
+  EXPECT_THAT(contents, Contains("contents"));
+  EXPECT_THAT(contents, Contains("plain text"));
+  EXPECT_THAT(contents, Contains("fetched remote://cache/blobs/something"));
+  EXPECT_EQ(std::count(contents.begin(), contents.end(), "from a file"), 21);
+}
+
+TEST(BazelArtifactFetcherTest, ChecksBlobDigests) {
+  auto fetch = [](absl::string_view uri) -> absl::StatusOr<std::string> {
+    return std::string("contents");
+  };
+  EXPECT_TRUE(BazelArtifactFetcher::FetchUri(
+                  absl::StrCat("bytestream://cache/blobs/", kContentsDigest,
+                               "/8"),
+                  fetch)
+                  .ok());
+  EXPECT_EQ(BazelArtifactFetcher::FetchUri(
+                absl::StrCat("bytestream://cache/blobs/", kContentsDigest,
+                             "/9"),
+                fetch)
+                .status()
+                .code(),
+            absl::StatusCode::kDataLoss);
+  std::string wrong_digest(kContentsDigest);
+  wrong_digest[0] = '0';
+  EXPECT_EQ(BazelArtifactFetcher::FetchUri(
+                absl::StrCat("bytestream://cache/blobs/", wrong_digest, "/8"),
+                fetch)
+                .status()
+                .code(),
+            absl::StatusCode::kDataLoss);
+}
+
+TEST(BazelArtifactFetcherTest, StopsAtTheFirstError) {
+  BazelArtifactFetcher::Options options;
+  options.output_directory = absl::StrCat(::testing::TempDir(), "/error");
+  FetchResult result = FetchAll(
+      MakeEvents({"data:base64,Y29udGVudHM=", "remote://unsupported"}),
+      std::move(options));
+  EXPECT_EQ(result.status.code(), absl::StatusCode::kUnimplemented);
+  EXPECT_THAT(result.labels, UnorderedElementsAre("//id/label:0"));
+}
+
+}  // namespace
+}  // namespace kythe
@@ -15,6 +15,12 @@
  */
 #include "kythe/cxx/extractor/bazel_artifact_selector.h"
 
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "absl/status/status.h"
 #include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
@@ -50,18 +56,12 @@ std::string AsLocalPath(const build_event_stream::File& file) {
   return absl::StrJoin(parts, "/");
 }
 
-template <typename T>
-struct FromRange {
-  template <typename U>
-  operator U() {
-    return U(range.begin(), range.end());
-  }
-
-  const T& range;
-};
-
-template <typename T>
-FromRange(const T&) -> FromRange<T>;
+BazelArtifactFile AsArtifactFile(const build_event_stream::File& file) {
+  return {
+      .local_path = AsLocalPath(file),
+      .uri = AsUri(file),
+  };
+}
 
 template <typename T>
 const T& AsConstRef(const T& value) {
@@ -73,6 +73,29 @@ const T& AsConstRef(const T* value) {
   return *value;
 }
 
+/// The largest file set id given an even handle rather than interned. This
+/// bounds the disposed bitmap at a few megabytes.
+constexpr size_t kMaxNumberedFileSet = size_t{1} << 24;
+
+/// \brief Parses `id` if it is the canonical decimal form of a number no
+/// larger than kMaxNumberedFileSet.
+absl::optional<size_t> ParseFileSetNumber(absl::string_view id) {
+  if (id.empty() || id.size() > 9 || (id.size() > 1 && id[0] == '0')) {
+    return absl::nullopt;
+  }
+  size_t number = 0;
+  for (char c : id) {
+    if (c < '0' || c > '9') {
+      return absl::nullopt;
+    }
+    number = number * 10 + (c - '0');
+  }
+  if (number > kMaxNumberedFileSet) {
+    return absl::nullopt;
+  }
+  return number;
+}
+
 template <typename T, typename U>
 absl::Status DeserializeInternal(T& selector, const U& container) {
   absl::Status error;
@@ -108,6 +131,36 @@ absl::Status BazelArtifactSelector::Deserialize(
   return DeserializeInternal(*this, state);
 }
 
+AspectArtifactSelector::FileSetHandle
+AspectArtifactSelector::FileSetIds::Intern(absl::string_view id) {
+  if (auto handle = Find(id)) {
+    return *handle;
+  }
+  FileSetHandle handle = 2 * names_.size() + 1;
+  names_.emplace_back(id);
+  handles_.emplace(id, handle);
+  return handle;
+}
+
+absl::optional<AspectArtifactSelector::FileSetHandle>
+AspectArtifactSelector::FileSetIds::Find(absl::string_view id) const {
+  if (auto number = ParseFileSetNumber(id)) {
+    return 2 * *number;
+  }
+  if (auto iter = handles_.find(id); iter != handles_.end()) {
+    return iter->second;
+  }
+  return absl::nullopt;
+}
+
+std::string AspectArtifactSelector::FileSetIds::Name(
+    FileSetHandle handle) const {
+  if (handle % 2 == 0) {
+    return absl::StrCat(handle / 2);
+  }
+  return names_[handle / 2];
+}
+
 absl::optional<BazelArtifact> AspectArtifactSelector::Select(
     const build_event_stream::BuildEvent& event) {
   absl::optional<BazelArtifact> result = absl::nullopt;
@@ -126,9 +179,36 @@ absl::optional<BazelArtifact> AspectArtifactSelector::Select(
 
 bool AspectArtifactSelector::SerializeInto(google::protobuf::Any& state) const {
   kythe::proto::BazelAspectArtifactSelectorState raw;
-  *raw.mutable_disposed() = FromRange{state_.disposed};
-  *raw.mutable_filesets() = FromRange{state_.filesets};
-  *raw.mutable_pending() = FromRange{state_.pending};
+  // Nearly every numbered file set is eventually disposed of, so store them
+  // as runs.
+  auto& ranges = *raw.mutable_disposed_ranges();
+  state_.disposed.ForEach([&](FileSetHandle handle) {
+    if (handle % 2 != 0) {
+      raw.add_disposed(state_.ids.Name(handle));
+      return;
+    }
+    uint64_t number = handle / 2;
+    if (!ranges.empty() && ranges[ranges.size() - 1] == number) {
+      ranges.Set(ranges.size() - 1, number + 1);
+    } else {
+      ranges.Add(number);
+      ranges.Add(number + 1);
+    }
+  });
+  for (const auto& [handle, fileset] : state_.filesets) {
+    auto& raw_fileset = (*raw.mutable_filesets())[state_.ids.Name(handle)];
+    for (const auto& file : fileset.files) {
+      auto* raw_file = raw_fileset.add_files();
+      raw_file->set_name(file.local_path);
+      raw_file->set_uri(file.uri);
+    }
+    for (FileSetHandle child : fileset.children) {
+      raw_fileset.add_file_sets()->set_id(state_.ids.Name(child));
+    }
+  }
+  for (const auto& [handle, target] : state_.pending) {
+    (*raw.mutable_pending())[state_.ids.Name(handle)] = target;
+  }
 
   state.PackFrom(raw);
   return true;
@@ -138,11 +218,39 @@ absl::Status AspectArtifactSelector::DeserializeFrom(
     const google::protobuf::Any& state) {
   kythe::proto::BazelAspectArtifactSelectorState raw;
   if (state.UnpackTo(&raw)) {
-    state_ = {
-        .disposed = FromRange{raw.disposed()},
-        .filesets = FromRange{raw.filesets()},
-        .pending = FromRange{raw.pending()},
-    };
+    const auto& ranges = raw.disposed_ranges();
+    if (ranges.size() % 2 != 0) {
+      return absl::InvalidArgumentError(
+          "Malformed kythe.proto.BazelAspectArtifactSelectorState");
+    }
+    for (int i = 0; i < ranges.size(); i += 2) {
+      if (ranges[i] > ranges[i + 1] ||
+          ranges[i + 1] > kMaxNumberedFileSet + 1) {
+        return absl::InvalidArgumentError(
+            "Malformed kythe.proto.BazelAspectArtifactSelectorState");
+      }
+    }
+    state_ = {};
+    for (int i = 0; i < ranges.size(); i += 2) {
+      for (uint64_t number = ranges[i]; number < ranges[i + 1]; ++number) {
+        state_.disposed.insert(2 * number);
+      }
+    }
+    for (const auto& id : raw.disposed()) {
+      state_.disposed.insert(state_.ids.Intern(id));
+    }
+    for (const auto& [id, raw_fileset] : raw.filesets()) {
+      FileSet& fileset = state_.filesets[state_.ids.Intern(id)];
+      for (const auto& file : raw_fileset.files()) {
+        fileset.files.push_back(AsArtifactFile(file));
+      }
+      for (const auto& child : raw_fileset.file_sets()) {
+        fileset.children.push_back(state_.ids.Intern(child.id()));
+      }
+    }
+    for (const auto& [id, target] : raw.pending()) {
+      state_.pending.emplace(state_.ids.Intern(id), target);
+    }
     return absl::OkStatus();
   }
   if (state.Is<kythe::proto::BazelAspectArtifactSelectorState>()) {
@@ -155,32 +263,36 @@ absl::Status AspectArtifactSelector::DeserializeFrom(
 
 absl::optional<BazelArtifact> AspectArtifactSelector::SelectFileSet(
     absl::string_view id, const build_event_stream::NamedSetOfFiles& filesets) {
-  bool kept = false;
+  FileSetHandle handle = state_.ids.Intern(id);
+  FileSet* kept = nullptr;
+  auto keep = [&]() -> FileSet& {
+    if (kept == nullptr) kept = &state_.filesets[handle];
+    return *kept;
+  };
   for (const auto& file : filesets.files()) {
     if (options_.file_name_allowlist.Match(file.name())) {
-      kept = true;
-      *state_.filesets[id].add_files() = file;
+      keep().files.push_back(AsArtifactFile(file));
     }
   }
   for (const auto& child : filesets.file_sets()) {
-    if (!state_.disposed.contains(child.id())) {
-      kept = true;
-      *state_.filesets[id].add_file_sets() = child;
+    FileSetHandle child_handle = state_.ids.Intern(child.id());
+    if (!state_.disposed.contains(child_handle)) {
+      keep().children.push_back(child_handle);
     }
   }
   // TODO(shahms): check pending *before* doing all of the insertion.
-  if (auto iter = state_.pending.find(id); iter != state_.pending.end()) {
+  if (auto iter = state_.pending.find(handle); iter != state_.pending.end()) {
     auto node = state_.pending.extract(iter);
-    BazelArtifact result = {.label = std::string(node.mapped())};
-    ReadFilesInto(id, result.label, result.files);
+    BazelArtifact result = {.label = std::move(node.mapped())};
+    ReadFilesInto(handle, result.label, result.files);
     if (result.files.empty()) {
       return absl::nullopt;
     }
     return result;
   }
-  if (!kept) {
+  if (kept == nullptr) {
     // There were no files, no children and no previous references, skip it.
-    state_.disposed.insert(std::string(id));
+    state_.disposed.insert(handle);
   }
   return absl::nullopt;
 }
@@ -196,7 +308,8 @@ absl::optional<BazelArtifact> AspectArtifactSelector::SelectTargetCompleted(
     for (const auto& output_group : payload.output_group()) {
       if (options_.output_group_allowlist.Match(output_group.name())) {
         for (const auto& filesets : output_group.file_sets()) {
-          ReadFilesInto(filesets.id(), id.label(), result.files);
+          ReadFilesInto(state_.ids.Intern(filesets.id()), id.label(),
+                        result.files);
         }
       }
     }
@@ -208,25 +321,22 @@ absl::optional<BazelArtifact> AspectArtifactSelector::SelectTargetCompleted(
 }
 
 void AspectArtifactSelector::ReadFilesInto(
-    absl::string_view id, absl::string_view target,
+    FileSetHandle handle, absl::string_view target,
     std::vector<BazelArtifactFile>& files) {
-  if (state_.disposed.contains(id)) {
+  if (state_.disposed.contains(handle)) {
     return;
   }
 
-  if (auto iter = state_.filesets.find(id); iter != state_.filesets.end()) {
-    state_.disposed.insert(std::string(id));
+  if (auto iter = state_.filesets.find(handle);
+      iter != state_.filesets.end()) {
+    state_.disposed.insert(handle);
     auto node = state_.filesets.extract(iter);
-    const build_event_stream::NamedSetOfFiles& filesets = node.mapped();
+    FileSet& fileset = node.mapped();
 
-    for (const auto& file : filesets.files()) {
-      files.push_back({
-          .local_path = AsLocalPath(file),
-          .uri = AsUri(file),
-      });
-    }
-    for (const auto& child : filesets.file_sets()) {
-      ReadFilesInto(child.id(), target, files);
+    files.insert(files.end(), std::make_move_iterator(fileset.files.begin()),
+                 std::make_move_iterator(fileset.files.end()));
+    for (FileSetHandle child : fileset.children) {
+      ReadFilesInto(child, target, files);
     }
 
     return;
@@ -234,9 +344,9 @@ void AspectArtifactSelector::ReadFilesInto(
 
   // Files where requested, but we haven't disposed that filesets id yet. Record
   // this for future processing.
-  LOG(INFO) << "NamedSetOfFiles " << id << " requested by " << target
-            << " but not yet disposed.";
-  state_.pending.emplace(id, target);
+  LOG(INFO) << "NamedSetOfFiles " << state_.ids.Name(handle)
+            << " requested by " << target << " but not yet disposed.";
+  state_.pending.emplace(handle, target);
 }
 
 ExtraActionSelector::ExtraActionSelector(
@@ -16,9 +16,11 @@
 #ifndef KYTHE_CXX_EXTRACTOR_BAZEL_ARTIFACT_SELECTOR_H_
 #define KYTHE_CXX_EXTRACTOR_BAZEL_ARTIFACT_SELECTOR_H_
 
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
@@ -168,16 +170,68 @@ class AspectArtifactSelector final : public BazelArtifactSelector {
   absl::Status DeserializeFrom(const google::protobuf::Any& state) final;
 
  private:
+  /// \brief A dense handle for a NamedSetOfFiles id. Bazel numbers file sets
+  /// from zero, so the canonical decimal id n has the handle 2n; other ids
+  /// are interned and get odd handles.
+  using FileSetHandle = uint32_t;
+
+  /// \brief Maps NamedSetOfFiles ids to and from FileSetHandles.
+  class FileSetIds {
+   public:
+    /// \brief Returns the handle for `id`, interning it if need be.
+    FileSetHandle Intern(absl::string_view id);
+    /// \brief Returns the handle for `id` if it has one without interning.
+    absl::optional<FileSetHandle> Find(absl::string_view id) const;
+    /// \brief Returns the id for `handle`.
+    std::string Name(FileSetHandle handle) const;
+
+   private:
+    std::vector<std::string> names_;
+    absl::flat_hash_map<std::string, FileSetHandle> handles_;
+  };
+
+  /// \brief A set of FileSetHandles, one bit per handle. This holds every
+  /// file set in the stream, which can run to millions.
+  class FileSetBitmap {
+   public:
+    bool contains(FileSetHandle handle) const {
+      return handle < bits_.size() && bits_[handle];
+    }
+    void insert(FileSetHandle handle) {
+      if (handle >= bits_.size()) bits_.resize(handle + 1);
+      bits_[handle] = true;
+    }
+    /// \brief Calls `f` with each handle in the set, in increasing order.
+    template <typename F>
+    void ForEach(F&& f) const {
+      for (size_t i = 0; i < bits_.size(); ++i) {
+        if (bits_[i]) f(static_cast<FileSetHandle>(i));
+      }
+    }
+
+   private:
+    std::vector<bool> bits_;
+  };
+
+  /// \brief The parts of a NamedSetOfFiles which may still be selected.
+  struct FileSet {
+    // Files whose names matched the allowlist.
+    std::vector<BazelArtifactFile> files;
+    // Child file sets which hadn't been disposed of.
+    std::vector<FileSetHandle> children;
+  };
+
   struct State {
+    // The ids of all of the file sets referenced so far.
+    FileSetIds ids;
     // A record of all of the NamedSetOfFiles events which have been processed.
-    absl::flat_hash_set<std::string> disposed;
-    // Mapping from fileset id to NamedSetOfFiles whose file names matched the
+    FileSetBitmap disposed;
+    // Mapping from fileset to the contents whose file names matched the
     // allowlist, but have not yet been consumed by an event.
-    absl::flat_hash_map<std::string, build_event_stream::NamedSetOfFiles>
-        filesets;
-    // Mapping from fileset id to target name which required that
+    absl::flat_hash_map<FileSetHandle, FileSet> filesets;
+    // Mapping from fileset to target name which required that
     // file set when it had not yet been seen.
-    absl::flat_hash_map<std::string, std::string> pending;
+    absl::flat_hash_map<FileSetHandle, std::string> pending;
   };
   absl::optional<BazelArtifact> SelectFileSet(
       absl::string_view id, const build_event_stream::NamedSetOfFiles& fileset);
@@ -186,7 +240,7 @@ class AspectArtifactSelector final : public BazelArtifactSelector {
       const build_event_stream::BuildEventId::TargetCompletedId& id,
       const build_event_stream::TargetComplete& payload);
 
-  void ReadFilesInto(absl::string_view id, absl::string_view target,
+  void ReadFilesInto(FileSetHandle handle, absl::string_view target,
                      std::vector<BazelArtifactFile>& files);
 
   Options options_;
@@ -26,6 +26,7 @@
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 #include "kythe/cxx/extractor/bazel_artifact.h"
+#include "kythe/proto/bazel_artifact_selector.pb.h"
 #include "re2/re2.h"
 #include "src/main/java/com/google/devtools/build/lib/buildeventstream/proto/build_event_stream.pb.h"
 
@@ -131,6 +132,115 @@ TEST(AspectArtifactSelectorTest, SelectsMatchingTargetsOnce) {
               Eq(absl::nullopt));
 }
 
+// Numeric ids are tracked separately from others; make sure that ids which
+// merely parse to the same number stay distinct.
+TEST(AspectArtifactSelectorTest, DistinguishesNonCanonicalIds) {
+  AspectArtifactSelector selector(DefaultOptions());
+
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id { named_set { id: "01" } }
+    named_set_of_files {
+      files { name: "path/to/other.kzip" uri: "file:///path/to/other.kzip" }
+    })pb")),
+              Eq(absl::nullopt));
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id { named_set { id: "2" } })pb")),
+              Eq(absl::nullopt));
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id {
+      target_completed {
+        label: "//path/to/target:name"
+        aspect: "//aspect:file.bzl%name"
+      }
+    }
+    completed {
+      success: true
+      output_group {
+        name: "kythe_compilation_unit"
+        file_sets { id: "1" }
+      }
+    })pb")),
+              Eq(absl::nullopt));
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id { named_set { id: "1" } }
+    named_set_of_files {
+      files { name: "path/to/file.kzip" uri: "file:///path/to/file.kzip" }
+      file_sets { id: "2" }
+    })pb")),
+              Eq(BazelArtifact{
+                  .label = "//path/to/target:name",
+                  .files = {{
+                      .local_path = "path/to/file.kzip",
+                      .uri = "file:///path/to/file.kzip",
+                  }},
+              }));
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id {
+      target_completed {
+        label: "//path/to/other:name"
+        aspect: "//aspect:file.bzl%name"
+      }
+    }
+    completed {
+      success: true
+      output_group {
+        name: "kythe_compilation_unit"
+        file_sets { id: "01" }
+      }
+    })pb")),
+              Eq(BazelArtifact{
+                  .label = "//path/to/other:name",
+                  .files = {{
+                      .local_path = "path/to/other.kzip",
+                      .uri = "file:///path/to/other.kzip",
+                  }},
+              }));
+}
+
+TEST(AspectArtifactSelectorTest, SerializationKeepsDisposedFileSets) {
+  google::protobuf::Any state;
+  {
+    AspectArtifactSelector selector(DefaultOptions());
+    for (absl::string_view id : {"0", "1", "2", "4", "a"}) {
+      build_event_stream::BuildEvent event;
+      event.mutable_id()->mutable_named_set()->set_id(std::string(id));
+      EXPECT_THAT(selector.Select(event), Eq(absl::nullopt));
+    }
+    ASSERT_THAT(selector.SerializeInto(state), true);
+  }
+  kythe::proto::BazelAspectArtifactSelectorState raw;
+  ASSERT_TRUE(state.UnpackTo(&raw));
+  EXPECT_THAT(raw.disposed(), testing::ElementsAre("a"));
+  EXPECT_THAT(raw.disposed_ranges(), testing::ElementsAre(0u, 3u, 4u, 5u));
+
+  AspectArtifactSelector selector(DefaultOptions());
+  ASSERT_THAT(selector.Deserialize({state}), absl::OkStatus());
+  // Disposed file sets aren't left pending, so their later (duplicate)
+  // events select nothing.
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id {
+      target_completed {
+        label: "//path/to/target:name"
+        aspect: "//aspect:file.bzl%name"
+      }
+    }
+    completed {
+      success: true
+      output_group {
+        name: "kythe_compilation_unit"
+        file_sets { id: "1" }
+        file_sets { id: "a" }
+      }
+    })pb")),
+              Eq(absl::nullopt));
+  EXPECT_THAT(selector.Select(ParseEventOrDie(R"pb(
+    id { named_set { id: "1" } }
+    named_set_of_files {
+      files { name: "path/to/file.kzip" uri: "file:///path/to/file.kzip" }
+    })pb")),
+              Eq(absl::nullopt));
+}
+
 TEST(AspectArtifactSelectorTest, CompatibleWithAny) {
   // Just ensures that AspectArtifactSelector can be assigned to an Any.
   AnyArtifactSelector unused = AspectArtifactSelector(DefaultOptions());
@@ -61,4 +61,54 @@ void BazelEventReader::Next() {
   }
 }
 
+PrefetchingEventReader::PrefetchingEventReader(
+    BazelEventReaderInterface* reader, size_t capacity)
+    : reader_(CHECK_NOTNULL(reader)),
+      capacity_(capacity > 0 ? capacity : 1),
+      thread_([this] { Prefetch(); }) {
+  Next();
+}
+
+PrefetchingEventReader::~PrefetchingEventReader() {
+  {
+    absl::MutexLock lock(&mu_);
+    cancelled_ = true;
+  }
+  thread_.join();
+}
+
+void PrefetchingEventReader::Prefetch() {
+  for (; !reader_->Done(); reader_->Next()) {
+    value_type event = std::move(reader_->Ref());
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(
+        +[](PrefetchingEventReader* self) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+             self->mu_) {
+          return self->cancelled_ || self->buffer_.size() < self->capacity_;
+        },
+        this));
+    if (cancelled_) {
+      return;
+    }
+    buffer_.push_back(std::move(event));
+  }
+  absl::MutexLock lock(&mu_);
+  status_ = reader_->status();
+  finished_ = true;
+}
+
+void PrefetchingEventReader::Next() {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(
+      +[](PrefetchingEventReader* self) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+           self->mu_) { return self->finished_ || !self->buffer_.empty(); },
+      this));
+  if (!buffer_.empty()) {
+    value_ = std::move(buffer_.front());
+    buffer_.pop_front();
+  } else {
+    value_ = status_;
+  }
+}
+
 }  // namespace kythe
@@ -16,7 +16,13 @@
 #ifndef KYTHE_CXX_EXTRACTOR_BAZEL_EVENT_READER_H_
 #define KYTHE_CXX_EXTRACTOR_BAZEL_EVENT_READER_H_
 
+#include <cstddef>
+#include <deque>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
 #include "absl/status/status.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/variant.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/zero_copy_stream.h"
@@ -86,6 +92,51 @@ class BazelEventReader final : public BazelEventReaderInterface {
       stream_;
 };
 
+/// \brief Reads BazelEvent messages from another reader on a background
+/// thread, so that decoding the stream overlaps with the caller's handling of
+/// each event.
+class PrefetchingEventReader final : public BazelEventReaderInterface {
+ public:
+  /// \brief Starts reading from `reader`, which must outlive this object and
+  /// must not otherwise be used while it exists.
+  /// \param capacity The number of decoded events to buffer ahead.
+  explicit PrefetchingEventReader(BazelEventReaderInterface* reader,
+                                  size_t capacity = 64);
+  ~PrefetchingEventReader() override;
+
+  PrefetchingEventReader(const PrefetchingEventReader&) = delete;
+  PrefetchingEventReader& operator=(const PrefetchingEventReader&) = delete;
+
+  void Next() override;
+
+  bool Done() const override { return value_.index() != 0; }
+  reference Ref() override { return absl::get<value_type>(value_); }
+  const_reference Ref() const override { return absl::get<value_type>(value_); }
+  absl::Status status() const override {
+    return absl::get<absl::Status>(value_);
+  }
+
+ private:
+  /// \brief Moves events from `reader_` into `buffer_` until it is done or
+  /// this object is destroyed.
+  void Prefetch();
+
+  BazelEventReaderInterface* const reader_;
+  const size_t capacity_;
+  absl::variant<value_type, absl::Status> value_;
+
+  absl::Mutex mu_;
+  /// Decoded events that haven't been returned yet.
+  std::deque<value_type> buffer_ ABSL_GUARDED_BY(mu_);
+  /// Set once `reader_` is done; `status_` then holds its status.
+  bool finished_ ABSL_GUARDED_BY(mu_) = false;
+  absl::Status status_ ABSL_GUARDED_BY(mu_);
+  /// Set when the background thread should stop early.
+  bool cancelled_ ABSL_GUARDED_BY(mu_) = false;
+
+  std::thread thread_;
+};
+
 }  // namespace kythe
 
 #endif  // KYTHE_CXX_EXTRACTOR_BAZEL_EVENT_READER_H_
@@ -48,5 +48,39 @@ TEST(BazelEventReaderTest, ReadsExpectedEvents) {
   EXPECT_THAT(events, ElementsAre("0", "1", "2", "3", "4"));
 }
 
+TEST(PrefetchingEventReaderTest, ReadsExpectedEvents) {
+  std::stringstream stream;
+  for (int i = 0; i < 5; i++) {
+    build_event_stream::BuildEvent event;
+    event.mutable_id()->mutable_unknown()->set_details(absl::StrCat(i));
+    ASSERT_TRUE(SerializeDelimitedToOstream(event, &stream));
+  }
+  IstreamInputStream input_stream(&stream);
+
+  std::vector<std::string> events;
+  BazelEventReader base(&input_stream);
+  PrefetchingEventReader reader(&base, /*capacity=*/2);
+  for (; !reader.Done(); reader.Next()) {
+    events.push_back(reader.Ref().id().unknown().details());
+  }
+  ASSERT_TRUE(reader.status().ok()) << reader.status();
+  EXPECT_THAT(events, ElementsAre("0", "1", "2", "3", "4"));
+}
+
+TEST(PrefetchingEventReaderTest, StopsWhenDestroyedEarly) {
+  std::stringstream stream;
+  for (int i = 0; i < 100; i++) {
+    build_event_stream::BuildEvent event;
+    event.mutable_id()->mutable_unknown()->set_details(absl::StrCat(i));
+    ASSERT_TRUE(SerializeDelimitedToOstream(event, &stream));
+  }
+  IstreamInputStream input_stream(&stream);
+
+  BazelEventReader base(&input_stream);
+  PrefetchingEventReader reader(&base, /*capacity=*/1);
+  ASSERT_FALSE(reader.Done());
+  EXPECT_EQ(reader.Ref().id().unknown().details(), "0");
+}
+
 }  // namespace
 }  // namespace kythe
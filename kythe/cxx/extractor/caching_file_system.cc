@@ -0,0 +1,145 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/extractor/caching_file_system.h"
+
+#include <system_error>
+#include <utility>
+
+namespace kythe {
+namespace {
+
+/// \return true if `a` and `b` describe the same version of the same file.
+bool SameVersion(const llvm::ErrorOr<llvm::vfs::Status>& a,
+                 const llvm::ErrorOr<llvm::vfs::Status>& b) {
+  return a && b && a->getUniqueID() == b->getUniqueID() &&
+         a->getLastModificationTime() == b->getLastModificationTime() &&
+         a->getSize() == b->getSize();
+}
+
+/// \brief A `llvm::vfs::File` over cached contents.
+class CachedFile : public llvm::vfs::File {
+ public:
+  CachedFile(llvm::vfs::Status status,
+             std::shared_ptr<llvm::MemoryBuffer> contents)
+      : status_(std::move(status)), contents_(std::move(contents)) {}
+  llvm::ErrorOr<llvm::vfs::Status> status() override { return status_; }
+  std::error_code close() override { return std::error_code(); }
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(
+      const llvm::Twine& Name, int64_t FileSize, bool RequiresNullTerminator,
+      bool IsVolatile) override {
+    name_ = Name.str();
+    return llvm::MemoryBuffer::getMemBuffer(contents_->getBuffer(), name_,
+                                            RequiresNullTerminator);
+  }
+
+ private:
+  llvm::vfs::Status status_;
+  /// Kept alive here too in case the cache drops these contents first.
+  std::shared_ptr<llvm::MemoryBuffer> contents_;
+  std::string name_;
+};
+
+}  // anonymous namespace
+
+void CachingFileSystem::Revalidate() {
+  absl::MutexLock lock(&mu_);
+  ++generation_;
+}
+
+llvm::ErrorOr<llvm::vfs::Status> CachingFileSystem::status(
+    const llvm::Twine& path) {
+  std::string key = path.str();
+  uint64_t generation;
+  {
+    absl::MutexLock lock(&mu_);
+    if (auto found = entries_.find(key);
+        found != entries_.end() && found->second.generation == generation_) {
+      return found->second.status;
+    }
+    generation = generation_;
+  }
+  auto result = base_file_system_->status(key);
+  absl::MutexLock lock(&mu_);
+  Entry& entry = entries_[key];
+  if (entry.contents != nullptr && !SameVersion(entry.status, result)) {
+    entry.contents.reset();
+  }
+  entry.status = result;
+  entry.generation = generation;
+  return result;
+}
+
+llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+CachingFileSystem::openFileForRead(const llvm::Twine& path) {
+  std::string key = path.str();
+  auto file_status = status(key);
+  if (!file_status) {
+    return file_status.getError();
+  }
+  if (!file_status->isRegularFile()) {
+    // Don't hold on to devices or pipes.
+    return base_file_system_->openFileForRead(key);
+  }
+  std::shared_ptr<llvm::MemoryBuffer> contents;
+  {
+    absl::MutexLock lock(&mu_);
+    contents = entries_[key].contents;
+  }
+  if (contents == nullptr) {
+    auto file = base_file_system_->openFileForRead(key);
+    if (!file) {
+      return file.getError();
+    }
+    // Read rather than map the file, since a mapping would show any later
+    // change to it.
+    auto buffer = (*file)->getBuffer(key, file_status->getSize(),
+                                     /*RequiresNullTerminator=*/true,
+                                     /*IsVolatile=*/true);
+    if (!buffer) {
+      return buffer.getError();
+    }
+    contents = std::move(*buffer);
+    absl::MutexLock lock(&mu_);
+    Entry& entry = entries_[key];
+    if (entry.contents != nullptr) {
+      // Another thread got here first; share its copy.
+      contents = entry.contents;
+    } else if (SameVersion(entry.status, file_status)) {
+      // Only keep what we read if nobody has seen the file change since.
+      entry.contents = contents;
+    }
+  }
+  return std::unique_ptr<llvm::vfs::File>(
+      new CachedFile(*file_status, std::move(contents)));
+}
+
+llvm::vfs::directory_iterator CachingFileSystem::dir_begin(
+    const llvm::Twine& dir, std::error_code& error) {
+  return base_file_system_->dir_begin(dir, error);
+}
+
+llvm::ErrorOr<std::string> CachingFileSystem::getCurrentWorkingDirectory()
+    const {
+  return base_file_system_->getCurrentWorkingDirectory();
+}
+
+std::error_code CachingFileSystem::setCurrentWorkingDirectory(
+    const llvm::Twine& path) {
+  return std::make_error_code(std::errc::operation_not_permitted);
+}
+
+}  // namespace kythe
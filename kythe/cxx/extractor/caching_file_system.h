@@ -0,0 +1,91 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_EXTRACTOR_CACHING_FILE_SYSTEM_H_
+#define KYTHE_CXX_EXTRACTOR_CACHING_FILE_SYSTEM_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+namespace kythe {
+
+/// \brief A file system that remembers the status and contents of every
+/// path it is asked about, including the ones that don't exist, so that the
+/// include directories and headers shared by many extractions are probed and
+/// read only once.
+///
+/// Each extraction still gets its own `clang::FileManager`: those aren't
+/// thread-safe, and the extractor must see every file a compilation opens.
+/// This is the layer beneath them that they can share. Paths are cached as
+/// given, so relative paths are only safe while the process's working
+/// directory stays put; the extractor makes paths absolute when given a
+/// working directory of its own.
+///
+/// Cached results never expire on their own. Call `Revalidate` whenever the
+/// underlying files may have changed, such as between the requests a
+/// persistent worker serves.
+///
+/// This class is thread-safe.
+class CachingFileSystem : public llvm::vfs::FileSystem {
+ public:
+  explicit CachingFileSystem(
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base_file_system)
+      : base_file_system_(std::move(base_file_system)) {}
+
+  /// \brief Requires each path to be stat'd again before its cached results
+  /// are next used. Cached contents are kept if the file's identity,
+  /// modification time and size are unchanged.
+  void Revalidate() ABSL_LOCKS_EXCLUDED(mu_);
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine& path) override
+      ABSL_LOCKS_EXCLUDED(mu_);
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(
+      const llvm::Twine& path) override ABSL_LOCKS_EXCLUDED(mu_);
+  llvm::vfs::directory_iterator dir_begin(const llvm::Twine& dir,
+                                          std::error_code& error) override;
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override;
+  /// \brief Always fails: the working directory of a compilation belongs in
+  /// a file system layered over this shared one.
+  std::error_code setCurrentWorkingDirectory(const llvm::Twine& path) override;
+
+ private:
+  /// \brief What is known about one path.
+  struct Entry {
+    /// The result of the last stat.
+    llvm::ErrorOr<llvm::vfs::Status> status = std::error_code();
+    /// If the path is a regular file that has been read, its contents.
+    std::shared_ptr<llvm::MemoryBuffer> contents;
+    /// The `generation_` in which `status` was checked.
+    uint64_t generation = 0;
+  };
+
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base_file_system_;
+  absl::Mutex mu_;
+  /// Entries checked before this generation must be stat'd again.
+  uint64_t generation_ ABSL_GUARDED_BY(mu_) = 1;
+  absl::flat_hash_map<std::string, Entry> entries_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_EXTRACTOR_CACHING_FILE_SYSTEM_H_
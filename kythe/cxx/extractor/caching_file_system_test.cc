@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/extractor/caching_file_system.h"
+
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+namespace kythe {
+namespace {
+
+using ::testing::Eq;
+
+/// \brief Counts the calls made to an in-memory file system that can be
+/// swapped out to simulate changes.
+class CountingFileSystem : public llvm::vfs::FileSystem {
+ public:
+  CountingFileSystem() { Reset(); }
+
+  /// \brief Replaces every file with a new, empty file system.
+  llvm::vfs::InMemoryFileSystem* Reset() {
+    files_ = new llvm::vfs::InMemoryFileSystem();
+    return files_.get();
+  }
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine& path) override {
+    ++stats;
+    return files_->status(path);
+  }
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(
+      const llvm::Twine& path) override {
+    ++opens;
+    return files_->openFileForRead(path);
+  }
+  llvm::vfs::directory_iterator dir_begin(const llvm::Twine& dir,
+                                          std::error_code& error) override {
+    return files_->dir_begin(dir, error);
+  }
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override {
+    return files_->getCurrentWorkingDirectory();
+  }
+  std::error_code setCurrentWorkingDirectory(const llvm::Twine& path) override {
+    return files_->setCurrentWorkingDirectory(path);
+  }
+
+  int stats = 0;
+  int opens = 0;
+
+ private:
+  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> files_;
+};
+
+void AddFile(llvm::vfs::InMemoryFileSystem* files, const std::string& path,
+             const std::string& content, time_t mtime) {
+  files->addFile(path, mtime, llvm::MemoryBuffer::getMemBufferCopy(content));
+}
+
+std::string ReadFile(llvm::vfs::FileSystem* files, const std::string& path) {
+  auto file = files->openFileForRead(path);
+  if (!file) {
+    return "<error>";
+  }
+  auto buffer = (*file)->getBuffer(path);
+  return buffer ? (*buffer)->getBuffer().str() : "<error>";
+}
+
+class CachingFileSystemTest : public ::testing::Test {
+ protected:
+  CachingFileSystemTest()
+      : base_(new CountingFileSystem()), cache_(new CachingFileSystem(base_)) {}
+
+  llvm::IntrusiveRefCntPtr<CountingFileSystem> base_;
+  llvm::IntrusiveRefCntPtr<CachingFileSystem> cache_;
+};
+
+TEST_F(CachingFileSystemTest, CachesStatus) {
+  AddFile(base_->Reset(), "/a.h", "a", 1);
+  EXPECT_TRUE(cache_->exists("/a.h"));
+  EXPECT_TRUE(cache_->exists("/a.h"));
+  EXPECT_FALSE(cache_->exists("/missing.h"));
+  EXPECT_FALSE(cache_->exists("/missing.h"));
+  EXPECT_THAT(base_->stats, Eq(2));
+}
+
+TEST_F(CachingFileSystemTest, CachesContents) {
+  AddFile(base_->Reset(), "/a.h", "a", 1);
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("a"));
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("a"));
+  EXPECT_THAT(base_->stats, Eq(1));
+  EXPECT_THAT(base_->opens, Eq(1));
+}
+
+TEST_F(CachingFileSystemTest, RevalidateKeepsUnchangedContents) {
+  AddFile(base_->Reset(), "/a.h", "a", 1);
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("a"));
+  cache_->Revalidate();
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("a"));
+  EXPECT_THAT(base_->stats, Eq(2));
+  EXPECT_THAT(base_->opens, Eq(1));
+}
+
+TEST_F(CachingFileSystemTest, RevalidateRereadsChangedContents) {
+  AddFile(base_->Reset(), "/a.h", "a", 1);
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("a"));
+  AddFile(base_->Reset(), "/a.h", "changed", 2);
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("a"));
+  cache_->Revalidate();
+  EXPECT_THAT(ReadFile(cache_.get(), "/a.h"), Eq("changed"));
+}
+
+TEST_F(CachingFileSystemTest, RevalidateFindsNewFiles) {
+  llvm::vfs::InMemoryFileSystem* files = base_->Reset();
+  EXPECT_FALSE(cache_->exists("/new.h"));
+  AddFile(files, "/new.h", "new", 1);
+  EXPECT_FALSE(cache_->exists("/new.h"));
+  cache_->Revalidate();
+  EXPECT_TRUE(cache_->exists("/new.h"));
+}
+
+}  // namespace
+}  // namespace kythe
@@ -21,6 +21,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <cstring>
 #include <tuple>
 #include <type_traits>
 #include <unordered_map>
@@ -29,6 +31,7 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
@@ -176,6 +179,59 @@ std::string FindStableRoot(
   return roots.GetStableRoot();
 }
 
+/// An input with at least this many template declarations is considered
+/// template-heavy.
+constexpr size_t kTemplateHeavyDeclarations = 32;
+
+/// \brief Counts the occurrences of the `template` keyword followed by `<` in
+/// `content`. Comments and strings aren't skipped; this is only an estimate.
+size_t CountTemplateDeclarations(absl::string_view content) {
+  constexpr absl::string_view kKeyword = "template";
+  size_t count = 0;
+  for (size_t pos = content.find(kKeyword); pos != content.npos;
+       pos = content.find(kKeyword, pos + kKeyword.size())) {
+    if (pos > 0 && (absl::ascii_isalnum(content[pos - 1]) ||
+                    content[pos - 1] == '_')) {
+      continue;
+    }
+    size_t next = pos + kKeyword.size();
+    while (next < content.size() && absl::ascii_isspace(content[next])) {
+      ++next;
+    }
+    if (next < content.size() && content[next] == '<') {
+      ++count;
+    }
+  }
+  return count;
+}
+
+/// \brief Records estimates of the cost of indexing a unit with the given
+/// inputs in `details`.
+void AddCostHint(
+    const std::unordered_map<std::string, SourceFile>& source_files,
+    const std::vector<kythe::proto::FileData>& extra_data,
+    proto::CxxCompilationUnitDetails* details) {
+  auto* hint = details->mutable_cost_hint();
+  auto add_file = [hint](absl::string_view content, size_t transcripts) {
+    hint->set_input_bytes(hint->input_bytes() + content.size());
+    hint->set_input_files(hint->input_files() + 1);
+    hint->set_file_transcripts(hint->file_transcripts() + transcripts);
+    size_t templates = CountTemplateDeclarations(content);
+    hint->set_template_declarations(hint->template_declarations() +
+                                    templates);
+    if (templates >= kTemplateHeavyDeclarations) {
+      hint->set_template_heavy_files(hint->template_heavy_files() + 1);
+    }
+  };
+  for (const auto& file : source_files) {
+    add_file(file.second.file_content,
+             std::max<size_t>(1, file.second.include_history.size()));
+  }
+  for (const auto& data : extra_data) {
+    add_file(data.content(), 1);
+  }
+}
+
 /// \brief Lowercase-string-hex-encodes the array sha_buf.
 /// \param sha_buf The bytes of the hash.
 std::string LowercaseStringHexEncodeSha(
@@ -520,6 +576,11 @@ class ExtractorPPCallbacks : public clang::PPCallbacks {
   /// Non-empty if the main source file was stdin ("-") and we have chosen
   /// a new name for it.
   std::string* main_source_file_stdin_alternate_;
+  /// VNames of the files holding locations passed to
+  /// `RecordSpecificLocation`, keyed by `FileID`. Every macro expansion
+  /// records a few locations, and relativizing and mapping a path costs far
+  /// more than this lookup.
+  absl::flat_hash_map<unsigned, kythe::proto::VName> location_vnames_;
 };
 
 ExtractorPPCallbacks::ExtractorPPCallbacks(ExtractorState state)
@@ -705,25 +766,36 @@ void ExtractorPPCallbacks::Defined(
 }
 
 void ExtractorPPCallbacks::RecordSpecificLocation(clang::SourceLocation loc) {
-  if (loc.isValid() && loc.isFileID() &&
-      source_manager_->getFileID(loc) != preprocessor_->getPredefinesFileID()) {
-    history()->Update(source_manager_->getFileOffset(loc));
+  if (!loc.isValid() || !loc.isFileID()) {
+    return;
+  }
+  clang::FileID file_id = source_manager_->getFileID(loc);
+  if (file_id == preprocessor_->getPredefinesFileID()) {
+    return;
+  }
+  history()->Update(source_manager_->getFileOffset(loc));
+  auto found = location_vnames_.find(file_id.getHashValue());
+  if (found == location_vnames_.end()) {
     const auto filename_ref = source_manager_->getFilename(loc);
-    const auto* file_ref =
-        source_manager_->getFileEntryForID(source_manager_->getFileID(loc));
-    if (file_ref) {
-      auto vname = index_writer_->VNameForPath(index_writer_->RelativizePath(
-          FixStdinPath(file_ref, std::string(filename_ref))));
-      history()->Update(ToStringRef(vname.signature()));
-      history()->Update(ToStringRef(vname.corpus()));
-      history()->Update(ToStringRef(vname.root()));
-      history()->Update(ToStringRef(vname.path()));
-      history()->Update(ToStringRef(vname.language()));
-    } else {
+    const auto* file_ref = source_manager_->getFileEntryForID(file_id);
+    if (!file_ref) {
       LOG(WARNING) << "No FileRef for " << filename_ref.str() << " (location "
                    << loc.printToString(*source_manager_) << ")";
+      return;
     }
-  }
+    found = location_vnames_
+                .emplace(file_id.getHashValue(),
+                         index_writer_->VNameForPath(
+                             index_writer_->RelativizePath(FixStdinPath(
+                                 file_ref, std::string(filename_ref)))))
+                .first;
+  }
+  const kythe::proto::VName& vname = found->second;
+  history()->Update(ToStringRef(vname.signature()));
+  history()->Update(ToStringRef(vname.corpus()));
+  history()->Update(ToStringRef(vname.root()));
+  history()->Update(ToStringRef(vname.path()));
+  history()->Update(ToStringRef(vname.language()));
 }
 
 void ExtractorPPCallbacks::MacroDefined(
@@ -1009,8 +1081,52 @@ class ExtractorAction : public clang::PreprocessorFrontendAction {
 }  // anonymous namespace
 
 KzipWriterSink::KzipWriterSink(const std::string& path,
-                               OutputPathType path_type)
-    : path_(path), path_type_(path_type) {}
+                               OutputPathType path_type,
+                               std::string content_store)
+    : path_(path),
+      path_type_(path_type),
+      content_store_(std::move(content_store)) {}
+
+/// \brief Writes `content` to `store`/`digest` unless it is already there.
+/// The file is written under a temporary name and then renamed, so that
+/// concurrent extractions never observe a partial blob.
+static bool StoreContent(const std::string& store, const std::string& digest,
+                         absl::string_view content) {
+  std::string path = JoinPath(store, digest);
+  struct stat st;
+  if (::stat(path.c_str(), &st) == 0) {
+    return true;
+  }
+  std::string temp_path =
+      JoinPath(store, absl::StrCat(".", digest, ".", ::getpid()));
+  int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0444);
+  if (fd < 0) {
+    LOG(ERROR) << "Couldn't create " << temp_path << ": " << strerror(errno);
+    return false;
+  }
+  bool ok = true;
+  while (!content.empty()) {
+    ssize_t written = ::write(fd, content.data(), content.size());
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      LOG(ERROR) << "Couldn't write " << temp_path << ": " << strerror(errno);
+      ok = false;
+      break;
+    }
+    content.remove_prefix(written);
+  }
+  if (::close(fd) != 0) {
+    ok = false;
+  }
+  if (ok && ::rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG(ERROR) << "Couldn't rename " << temp_path << ": " << strerror(errno);
+    ok = false;
+  }
+  if (!ok) {
+    ::unlink(temp_path.c_str());
+  }
+  return ok;
+}
 
 void KzipWriterSink::OpenIndex(const std::string& unit_hash) {
   CHECK(!writer_.has_value()) << "OpenIndex() called twice";
@@ -1030,6 +1146,16 @@ void KzipWriterSink::WriteHeader(const kythe::proto::CompilationUnit& header) {
 }
 
 void KzipWriterSink::WriteFileContent(const kythe::proto::FileData& file) {
+  if (!content_store_.empty()) {
+    std::string digest = file.info().digest();
+    if (digest.empty()) {
+      digest = Sha256(file.content().data(), file.content().size());
+    }
+    if (!StoreContent(content_store_, digest, file.content())) {
+      LOG(ERROR) << "Error storing filedata for " << file.info().path();
+    }
+    return;
+  }
   if (auto digest = writer_->WriteFile(file.content()); digest.ok()) {
     if (!file.info().digest().empty() && file.info().digest() != *digest) {
       LOG(WARNING) << "Wrote FileData with mismatched digests: "
@@ -1073,6 +1199,12 @@ std::string CompilationWriter::RelativizePath(absl::string_view path) {
     return std::string(path);
   }
 
+  std::string resolved;
+  if (!working_directory_.empty() && !IsAbsolutePath(path)) {
+    resolved = JoinPath(working_directory_, path);
+    path = resolved;
+  }
+
   if (!canonicalizer_.has_value()) {
     if (absl::StatusOr<PathCanonicalizer> canonicalizer =
             PathCanonicalizer::Create(root_directory_, path_policy_);
@@ -1092,6 +1224,25 @@ std::string CompilationWriter::RelativizePath(absl::string_view path) {
   }
 }
 
+std::string CompilationWriter::DigestFile(const std::string& path,
+                                          absl::string_view content) {
+  if (digest_cache_ == nullptr) {
+    return Sha256(content.data(), content.size());
+  }
+  // The cache stats the file, so resolve relative paths against the unit's
+  // working directory rather than the process's.
+  const std::string resolved =
+      !working_directory_.empty() && !IsAbsolutePath(path)
+          ? JoinPath(working_directory_, path)
+          : path;
+  if (auto digest = digest_cache_->Find(resolved, content.size())) {
+    return *std::move(digest);
+  }
+  std::string digest = Sha256(content.data(), content.size());
+  digest_cache_->Insert(resolved, content.size(), digest, created_);
+  return digest;
+}
+
 void CompilationWriter::FillFileInput(
     const std::string& clang_path, const SourceFile& source_file,
     kythe::proto::CompilationUnit::FileInput* file_input) {
@@ -1106,8 +1257,7 @@ void CompilationWriter::FillFileInput(
   // it. (clang also refers to standard input as <stdin>, so we're
   // consistent there.)
   file_info->set_path(clang_path == "-" ? "<stdin>" : clang_path);
-  file_info->set_digest(Sha256(source_file.file_content.c_str(),
-                               source_file.file_content.size()));
+  file_info->set_digest(DigestFile(clang_path, source_file.file_content));
   AddFileContext(source_file, file_input);
 }
 
@@ -1138,7 +1288,8 @@ void CompilationWriter::InsertExtraIncludes(
     required_input->mutable_v_name()->CopyFrom(VNameForPath(normalized));
     required_input->mutable_info()->set_path(path);
     required_input->mutable_info()->set_digest(
-        Sha256((*buffer)->getBufferStart(), (*buffer)->getBufferSize()));
+        DigestFile(path, absl::string_view((*buffer)->getBufferStart(),
+                                           (*buffer)->getBufferSize())));
     file_content->mutable_info()->CopyFrom(required_input->info());
     file_content->mutable_content()->assign((*buffer)->getBufferStart(),
                                             (*buffer)->getBufferEnd());
@@ -1277,6 +1428,7 @@ void CompilationWriter::WriteIndex(
     header_search_info->CopyTo(&cxx_details);
   }
   InsertExtraIncludes(&unit, &cxx_details);
+  AddCostHint(source_files, extra_data_, &cxx_details);
   PackAny(cxx_details, kCxxCompilationUnitDetailsURI, unit.add_details());
   unit.set_entry_context(entry_context);
   unit.set_has_compile_errors(had_errors);
@@ -1338,12 +1490,16 @@ llvm::IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> OverlayCompilerResources(
 }
 
 llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> GetRootFileSystem(
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base_file_system,
     bool map_builtin_resources) {
+  if (base_file_system == nullptr) {
+    base_file_system = llvm::vfs::getRealFileSystem();
+  }
   if (map_builtin_resources) {
-    return OverlayCompilerResources(llvm::vfs::getRealFileSystem(),
+    return OverlayCompilerResources(std::move(base_file_system),
                                     kBuiltinResourceDirectory);
   }
-  return llvm::vfs::getRealFileSystem();
+  return base_file_system;
 }
 
 void ExtractorConfiguration::SetVNameConfig(const std::string& path) {
@@ -1422,6 +1578,13 @@ void ExtractorConfiguration::InitializeFromEnvironment() {
   if (const char* env_output_file = getenv("KYTHE_OUTPUT_FILE")) {
     SetOutputFile(env_output_file);
   }
+  if (const char* env_content_store = getenv("KYTHE_CONTENT_STORE")) {
+    SetContentStore(env_content_store);
+  }
+  if (const char* env_digest_cache = getenv("KYTHE_DIGEST_CACHE")) {
+    digest_cache_ = std::make_shared<FileDigestCache>(env_digest_cache);
+    SetDigestCache(digest_cache_.get());
+  }
   if (const char* env_exclude_empty_dirs = getenv("KYTHE_EXCLUDE_EMPTY_DIRS")) {
     index_writer_.set_exclude_empty_dirs(true);
   }
@@ -1449,39 +1612,64 @@ void ExtractorConfiguration::InitializeFromEnvironment() {
 /// record information about transcripts, as these are important for claiming.
 class RecordingFS : public llvm::vfs::FileSystem {
  public:
+  /// \param working_directory If nonempty, the directory against which
+  /// relative paths are resolved instead of the base file system's.
   RecordingFS(llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base_file_system,
-              CompilationWriter* index_writer)
-      : base_file_system_(base_file_system), index_writer_(index_writer) {}
+              CompilationWriter* index_writer,
+              std::string working_directory = "")
+      : base_file_system_(base_file_system),
+        index_writer_(index_writer),
+        working_directory_(std::move(working_directory)) {}
   llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine& path) override {
-    auto nested_result = base_file_system_->status(path);
+    std::string resolved = Resolve(path);
+    auto nested_result = base_file_system_->status(resolved);
     if (nested_result && nested_result->isDirectory()) {
-      index_writer_->DirectoryOpenedForStatus(path.str());
+      index_writer_->DirectoryOpenedForStatus(resolved);
     }
     return nested_result;
   }
   llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> openFileForRead(
       const llvm::Twine& path) override {
-    auto nested_result = base_file_system_->openFileForRead(path);
+    std::string resolved = Resolve(path);
+    auto nested_result = base_file_system_->openFileForRead(resolved);
     if (nested_result) {
       // We expect to be able to open this file at this path in the future.
-      index_writer_->OpenedForRead(path.str());
+      index_writer_->OpenedForRead(resolved);
     }
     return nested_result;
   }
   llvm::vfs::directory_iterator dir_begin(
       const llvm::Twine& dir, std::error_code& error_code) override {
-    return base_file_system_->dir_begin(dir, error_code);
+    return base_file_system_->dir_begin(Resolve(dir), error_code);
   }
   llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override {
+    if (!working_directory_.empty()) {
+      return working_directory_;
+    }
     return base_file_system_->getCurrentWorkingDirectory();
   }
   std::error_code setCurrentWorkingDirectory(const llvm::Twine& Path) override {
+    if (!working_directory_.empty()) {
+      working_directory_ = Resolve(Path);
+      return {};
+    }
     return base_file_system_->setCurrentWorkingDirectory(Path);
   }
 
  private:
+  /// \return `path`, made absolute if we have our own working directory.
+  std::string Resolve(const llvm::Twine& path) const {
+    std::string result = path.str();
+    if (working_directory_.empty() || IsAbsolutePath(result)) {
+      return result;
+    }
+    return JoinPath(working_directory_, result);
+  }
+
   llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> base_file_system_;
   CompilationWriter* index_writer_;
+  /// Kept here rather than in the base file system, which may be shared.
+  std::string working_directory_;
 };
 
 bool ExtractorConfiguration::Extract(
@@ -1490,8 +1678,9 @@ bool ExtractorConfiguration::Extract(
   llvm::IntrusiveRefCntPtr<clang::FileManager> file_manager(
       new clang::FileManager(
           file_system_options_,
-          new RecordingFS(GetRootFileSystem(map_builtin_resources_),
-                          &index_writer_)));
+          new RecordingFS(
+              GetRootFileSystem(file_system_, map_builtin_resources_),
+              &index_writer_, file_system_options_.WorkingDir)));
   index_writer_.set_target_name(target_name_);
   index_writer_.set_rule_type(rule_type_);
   index_writer_.set_build_config(build_config_);
@@ -1518,10 +1707,12 @@ bool ExtractorConfiguration::Extract(supported_language::Language lang) {
     CHECK(absl::EndsWith(output_file_, ".kzip"))
         << "Output file must have '.kzip' extension";
     sink = absl::make_unique<KzipWriterSink>(
-        output_file_, KzipWriterSink::OutputPathType::SingleFile);
+        output_file_, KzipWriterSink::OutputPathType::SingleFile,
+        content_store_);
   } else {
     sink = absl::make_unique<KzipWriterSink>(
-        output_directory_, KzipWriterSink::OutputPathType::Directory);
+        output_directory_, KzipWriterSink::OutputPathType::Directory,
+        content_store_);
   }
 
   return Extract(lang, std::move(sink));
@@ -21,6 +21,8 @@
 #include <string>
 #include <unordered_map>
 
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "absl/types/optional.h"
 #include "clang/Tooling/Tooling.h"
 #include "glog/logging.h"
@@ -32,9 +34,11 @@
 #include "kythe/cxx/common/index_writer.h"
 #include "kythe/cxx/common/path_utils.h"
 #include "kythe/cxx/extractor/cxx_details.h"
+#include "kythe/cxx/extractor/file_digest_cache.h"
 #include "kythe/cxx/extractor/language.h"
 #include "kythe/proto/analysis.pb.h"
 #include "kythe/proto/filecontext.pb.h"
+#include "llvm/Support/VirtualFileSystem.h"
 
 namespace clang {
 class FrontendAction;
@@ -129,7 +133,12 @@ class KzipWriterSink : public CompilationWriterSink {
   /// directly. Otherwise the path is interpreted as a directory and the kzip is
   /// written within it using a filename derived from an identifying hash of the
   /// compilation unit.
-  explicit KzipWriterSink(const std::string& path, OutputPathType path_type);
+  /// \param content_store If nonempty, a directory shared by many extractions
+  /// to which file contents are written, named by their digests, instead of
+  /// to the kzip. The resulting kzip holds only the compilation unit; run
+  /// kzip_merge with --content_store to assemble a complete kzip.
+  explicit KzipWriterSink(const std::string& path, OutputPathType path_type,
+                          std::string content_store = "");
   void OpenIndex(const std::string& unit_hash) override;
   void WriteHeader(const kythe::proto::CompilationUnit& header) override;
   void WriteFileContent(const kythe::proto::FileData& file) override;
@@ -138,6 +147,7 @@ class KzipWriterSink : public CompilationWriterSink {
  private:
   std::string path_;
   OutputPathType path_type_;
+  std::string content_store_;
   absl::optional<IndexWriter> writer_;
 };
 
@@ -172,12 +182,21 @@ class CompilationWriter {
   /// \brief Configure vname generation using some JSON string.
   /// \return true on success, false on failure
   bool SetVNameConfiguration(const std::string& json_string);
+  /// \brief Use an already-configured vname generator.
+  void set_vname_generator(const FileVNameGenerator& generator) {
+    vname_generator_ = generator;
+  }
   /// \brief Configure the path used for the root.
   void set_root_directory(const std::string& dir) {
     canonicalizer_.reset();
     root_directory_ = dir;
   }
   const std::string& root_directory() const { return root_directory_; }
+  /// \brief Resolve relative paths against `dir` rather than against the
+  /// process's working directory when relativizing them.
+  void set_working_directory(const std::string& dir) {
+    working_directory_ = dir;
+  }
 
   /// \brief Configure the path canonicalization configuration.
   void set_path_canonicalization_policy(PathCanonicalizer::Policy policy) {
@@ -190,6 +209,9 @@ class CompilationWriter {
   void set_exclude_autoconfiguration_files(bool exclude) {
     exclude_autoconfiguration_files_ = exclude;
   }
+  /// \brief Look up and record file digests in `cache`, which must outlive
+  /// this writer. May be null.
+  void set_digest_cache(FileDigestCache* cache) { digest_cache_ = cache; }
   /// \brief Write the index file to `sink`, consuming the sink in the process.
   void WriteIndex(
       supported_language::Language lang,
@@ -232,6 +254,9 @@ class CompilationWriter {
   /// Called to read and insert content for extra include files.
   void InsertExtraIncludes(kythe::proto::CompilationUnit* unit,
                            kythe::proto::CxxCompilationUnitDetails* details);
+  /// \return the digest of `content`, which was read from `path`, consulting
+  /// `digest_cache_` if there is one.
+  std::string DigestFile(const std::string& path, absl::string_view content);
   /// The `FileVNameGenerator` used to generate file vnames.
   FileVNameGenerator vname_generator_;
   /// The arguments used for this compilation.
@@ -242,6 +267,8 @@ class CompilationWriter {
   std::string corpus_ = "";
   /// The directory to use to generate relative paths.
   std::string root_directory_ = ".";
+  /// If nonempty, the directory relative paths are resolved against.
+  std::string working_directory_;
   /// The policy to use when generating relative paths.
   PathCanonicalizer::Policy path_policy_ =
       PathCanonicalizer::Policy::kCleanOnly;
@@ -268,6 +295,10 @@ class CompilationWriter {
   /// The canonicalizer to use when constructing relative paths.
   /// Lazily built from policy and root above.
   absl::optional<PathCanonicalizer> canonicalizer_;
+  /// If non-null, remembers digests of unchanged files.
+  FileDigestCache* digest_cache_ = nullptr;
+  /// A time before any file this writer sees was read.
+  absl::Time created_ = absl::Now();
 };
 
 /// \brief Creates a `FrontendAction` that records information about a
@@ -293,8 +324,34 @@ class ExtractorConfiguration {
   void InitializeFromEnvironment();
   /// \brief Load the VName config file from `path` or terminate.
   void SetVNameConfig(const std::string& path);
+  /// \brief Use an already-configured vname generator, such as one loaded
+  /// once and shared across several extractions.
+  void SetVNameGenerator(const FileVNameGenerator& generator) {
+    index_writer_.set_vname_generator(generator);
+  }
   /// \brief If a kzip file will be written, write it here.
   void SetOutputFile(const std::string& path) { output_file_ = path; }
+  /// \brief Look up and record file digests in `cache`, which must outlive
+  /// this configuration, instead of in one owned by this configuration.
+  void SetDigestCache(FileDigestCache* cache) {
+    index_writer_.set_digest_cache(cache);
+  }
+  /// \brief Run the compilation as though from `dir` without changing the
+  /// process's working directory, so that several extractions with different
+  /// directories may run at once. `dir` must be absolute.
+  void SetWorkingDirectory(const std::string& dir) {
+    file_system_options_.WorkingDir = dir;
+    index_writer_.set_working_directory(dir);
+  }
+  /// \brief Read files through `file_system` instead of through the real file
+  /// system. Builtin resources are still mapped over it if requested.
+  void SetFileSystem(
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> file_system) {
+    file_system_ = std::move(file_system);
+  }
+  /// \brief Write file contents to this shared directory instead of to the
+  /// kzip. See `KzipWriterSink`.
+  void SetContentStore(const std::string& path) { content_store_ = path; }
   /// \brief Record the name of the target that generated this compilation.
   void SetTargetName(const std::string& target) { target_name_ = target; }
   /// \brief Record the rule type that generated this compilation.
@@ -326,12 +383,18 @@ class ExtractorConfiguration {
   clang::FileSystemOptions file_system_options_;
   /// The CompilationWriter to use.
   CompilationWriter index_writer_;
+  /// If non-null, the file system to read from instead of the real one.
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> file_system_;
   /// True if we should use our internal system headers; false if not.
   bool map_builtin_resources_ = true;
   /// The directory to use for index files.
   std::string output_directory_ = ".";
   /// If nonempty, emit kzip files to this exact path.
   std::string output_file_;
+  /// If nonempty, write file contents to this directory.
+  std::string content_store_;
+  /// The digest cache configured from the environment, if any.
+  std::shared_ptr<FileDigestCache> digest_cache_;
   /// If nonempty, the name of the target that generated this compilation.
   std::string target_name_;
   /// If nonempty, the rule type that generated this compilation.
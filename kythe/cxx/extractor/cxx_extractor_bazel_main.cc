@@ -16,13 +16,25 @@
 
 // cxx_extractor_bazel is a C++ extractor meant to be run as a Bazel
 // extra_action.
+//
+// With --persistent_worker it instead speaks Bazel's persistent worker
+// protocol on stdin/stdout, handling one extraction per WorkRequest. Each
+// request's arguments are the same positional arguments as a one-off run;
+// flags are taken from the worker's own command line. Keeping the process
+// alive saves LLVM start-up and re-parsing the vname configuration for every
+// action, and lets actions share the contents of unchanged headers.
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/strings/match.h"
@@ -33,10 +45,16 @@
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/stubs/common.h"
+#include "google/protobuf/util/delimited_message_util.h"
+#include "kythe/cxx/common/file_vname_generator.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/path_utils.h"
+#include "kythe/cxx/extractor/caching_file_system.h"
+#include "kythe/cxx/extractor/file_digest_cache.h"
 #include "kythe/cxx/extractor/language.h"
+#include "llvm/Support/VirtualFileSystem.h"
 #include "third_party/bazel/src/main/protobuf/extra_actions_base.pb.h"
+#include "third_party/bazel/src/main/protobuf/worker_protocol.pb.h"
 
 ABSL_FLAG(std::string, build_config, "",
           "Human readable description of the build configuration.");
@@ -44,38 +62,91 @@ ABSL_FLAG(kythe::PathCanonicalizer::Policy, canonicalize_vname_paths,
           kythe::PathCanonicalizer::Policy::kCleanOnly,
           "Policy to use when canonicalization VName paths: "
           "clean-only (default), prefer-relative, prefer-real.");
+ABSL_FLAG(std::string, digest_cache, "",
+          "If set, a directory in which to share file digests with other "
+          "extractions so that unchanged files aren't rehashed.");
+ABSL_FLAG(bool, persistent_worker, false,
+          "Serve extraction requests using Bazel's persistent worker "
+          "protocol on stdin/stdout.");
 
-static void LoadExtraAction(const std::string& path,
-                            blaze::ExtraActionInfo* info,
-                            blaze::CppCompileInfo* cpp_info) {
+namespace {
+
+bool LoadExtraAction(const std::string& path, blaze::ExtraActionInfo* info,
+                     blaze::CppCompileInfo* cpp_info) {
   using namespace google::protobuf::io;
   int fd = open(path.c_str(), O_RDONLY, S_IREAD | S_IWRITE);
-  CHECK_GE(fd, 0) << "Couldn't open input file " << path;
-  FileInputStream file_input_stream(fd);
-  CodedInputStream coded_input_stream(&file_input_stream);
-  coded_input_stream.SetTotalBytesLimit(INT_MAX);
-  CHECK(info->ParseFromCodedStream(&coded_input_stream));
+  if (fd < 0) {
+    LOG(ERROR) << "Couldn't open input file " << path;
+    return false;
+  }
+  bool parsed;
+  {
+    FileInputStream file_input_stream(fd);
+    CodedInputStream coded_input_stream(&file_input_stream);
+    coded_input_stream.SetTotalBytesLimit(INT_MAX);
+    parsed = info->ParseFromCodedStream(&coded_input_stream);
+  }
   close(fd);
-  CHECK(info->HasExtension(blaze::CppCompileInfo::cpp_compile_info));
+  if (!parsed || !info->HasExtension(blaze::CppCompileInfo::cpp_compile_info)) {
+    LOG(ERROR) << "Couldn't read a CppCompileInfo from " << path;
+    return false;
+  }
   *cpp_info = info->GetExtension(blaze::CppCompileInfo::cpp_compile_info);
+  return true;
 }
 
-int main(int argc, char* argv[]) {
-  GOOGLE_PROTOBUF_VERIFY_VERSION;
-  kythe::InitializeProgram(argv[0]);
-  std::vector<char*> remain = absl::ParseCommandLine(argc, argv);
-  if (remain.size() != 4) {
-    absl::FPrintF(stderr,
-                  "Call as %s extra-action-file output-file vname-config\n",
-                  remain[0]);
+/// \brief Loads vname configurations, reusing the parse of any configuration
+/// whose contents have been seen before.
+class VNameConfigCache {
+ public:
+  /// \return the generator for the configuration at `path`, or null if it
+  /// couldn't be read or parsed.
+  const kythe::FileVNameGenerator* Load(const std::string& path) {
+    std::ifstream input(path);
+    if (!input) {
+      LOG(ERROR) << "Couldn't open vname configuration " << path;
+      return nullptr;
+    }
+    std::stringstream contents;
+    contents << input.rdbuf();
+    // Key on the contents rather than the path so that a configuration
+    // edited between builds is picked up by a long-lived worker.
+    auto [iter, inserted] = generators_.try_emplace(contents.str());
+    if (inserted) {
+      std::string error_text;
+      if (!iter->second.LoadJsonString(iter->first, &error_text)) {
+        LOG(ERROR) << "Couldn't configure vnames from " << path << ": "
+                   << error_text;
+        generators_.erase(iter);
+        return nullptr;
+      }
+    }
+    return &iter->second;
+  }
+
+ private:
+  absl::flat_hash_map<std::string, kythe::FileVNameGenerator> generators_;
+};
+
+/// \brief Extracts the compilation described by `args`, which are the
+/// extra-action file, output file and vname configuration.
+/// \param files If non-null, the file system to read through.
+/// \return the process exit code.
+int Extract(const std::vector<std::string>& args, VNameConfigCache* vnames,
+            kythe::FileDigestCache* digests,
+            llvm::IntrusiveRefCntPtr<kythe::CachingFileSystem> files) {
+  if (args.size() != 3) {
+    LOG(ERROR) << "Expected extra-action-file output-file vname-config";
     return 1;
   }
-  std::string extra_action_file = remain[1];
-  std::string output_file = remain[2];
-  std::string vname_config = remain[3];
+  const std::string& extra_action_file = args[0];
+  const std::string& output_file = args[1];
+  const std::string& vname_config = args[2];
   blaze::ExtraActionInfo info;
   blaze::CppCompileInfo cpp_info;
-  LoadExtraAction(extra_action_file, &info, &cpp_info);
+  if (!LoadExtraAction(extra_action_file, &info, &cpp_info)) {
+    return 1;
+  }
 
   const std::string& source = cpp_info.source_file();
   if (absl::EndsWith(source, ".s") || absl::EndsWith(source, ".asm")) {
@@ -86,26 +157,102 @@ int main(int argc, char* argv[]) {
     return 0;
   }
 
+  const kythe::FileVNameGenerator* generator = vnames->Load(vname_config);
+  if (generator == nullptr) {
+    return 1;
+  }
+
   kythe::ExtractorConfiguration config;
-  std::vector<std::string> args;
-  args.push_back(cpp_info.tool());
-  args.insert(args.end(), cpp_info.compiler_option().begin(),
-              cpp_info.compiler_option().end());
+  std::vector<std::string> compiler_args;
+  compiler_args.push_back(cpp_info.tool());
+  compiler_args.insert(compiler_args.end(),
+                       cpp_info.compiler_option().begin(),
+                       cpp_info.compiler_option().end());
 
   // If the command-line did not specify "-c x.cc" specifically, include the
   // primary source at the end of the argument list.
-  if (std::find(args.begin(), args.end(), "-c") == args.end()) {
-    args.push_back(cpp_info.source_file());
+  if (std::find(compiler_args.begin(), compiler_args.end(), "-c") ==
+      compiler_args.end()) {
+    compiler_args.push_back(cpp_info.source_file());
   }
   config.SetOutputFile(output_file);
-  config.SetArgs(args);
-  config.SetVNameConfig(vname_config);
+  config.SetArgs(compiler_args);
+  config.SetVNameGenerator(*generator);
+  config.SetDigestCache(digests);
+  if (files != nullptr) {
+    config.SetFileSystem(files);
+  }
   config.SetTargetName(info.owner());
   config.SetBuildConfig(absl::GetFlag(FLAGS_build_config));
   config.SetCompilationOutputPath(cpp_info.output_file());
   config.SetPathCanonizalizationPolicy(
       absl::GetFlag(FLAGS_canonicalize_vname_paths));
-  config.Extract(kythe::supported_language::Language::kCpp);
+  return config.Extract(kythe::supported_language::Language::kCpp) ? 0 : 1;
+}
+
+/// \brief Answers WorkRequests from stdin until it is closed.
+/// \return the process exit code.
+int RunWorker() {
+  google::protobuf::io::FileInputStream input(STDIN_FILENO);
+  google::protobuf::io::FileOutputStream output(STDOUT_FILENO);
+  VNameConfigCache vnames;
+  // Digests and file contents stay in memory between requests.
+  kythe::FileDigestCache digests(absl::GetFlag(FLAGS_digest_cache));
+  llvm::IntrusiveRefCntPtr<kythe::CachingFileSystem> files(
+      new kythe::CachingFileSystem(llvm::vfs::getRealFileSystem()));
+  for (;;) {
+    blaze::worker::WorkRequest request;
+    bool clean_eof = false;
+    if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream(
+            &request, &input, &clean_eof)) {
+      if (clean_eof) {
+        return 0;
+      }
+      LOG(ERROR) << "Couldn't read a WorkRequest";
+      return 1;
+    }
+    blaze::worker::WorkResponse response;
+    response.set_request_id(request.request_id());
+    // The build may have changed files since the last request, so stat
+    // everything again; contents are only reread if they changed.
+    files->Revalidate();
+    int exit_code =
+        Extract({request.arguments().begin(), request.arguments().end()},
+                &vnames, &digests, files);
+    response.set_exit_code(exit_code);
+    if (exit_code != 0) {
+      response.set_output("Extraction failed; see the worker log for details.");
+    }
+    if (!google::protobuf::util::SerializeDelimitedToZeroCopyStream(
+            response, &output) ||
+        !output.Flush()) {
+      LOG(ERROR) << "Couldn't write a WorkResponse";
+      return 1;
+    }
+  }
+}
+
+}  // anonymous namespace
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  kythe::InitializeProgram(argv[0]);
+  std::vector<char*> remain = absl::ParseCommandLine(argc, argv);
+  int exit_code;
+  if (absl::GetFlag(FLAGS_persistent_worker)) {
+    exit_code = RunWorker();
+  } else if (remain.size() != 4) {
+    absl::FPrintF(stderr,
+                  "Call as %s extra-action-file output-file vname-config\n",
+                  remain[0]);
+    exit_code = 1;
+  } else {
+    VNameConfigCache vnames;
+    kythe::FileDigestCache digests(absl::GetFlag(FLAGS_digest_cache));
+    exit_code =
+        Extract({remain.begin() + 1, remain.end()}, &vnames, &digests,
+                /*files=*/nullptr);
+  }
   google::protobuf::ShutdownProtobufLibrary();
-  return 0;
+  return exit_code;
 }
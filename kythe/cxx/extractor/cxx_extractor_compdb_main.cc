@@ -0,0 +1,189 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// cxx_extractor_compdb
+//   extracts every compilation in a compile_commands.json into one kzip,
+//   running several extractions at once in this process. Headers shared by
+//   many compilations are stat'd, read, hashed, and stored only once.
+//
+// Environment variables are read as for cxx_extractor, except that the
+// output location comes from --output. KYTHE_ROOT_DIRECTORY defaults to the
+// working directory of this process.
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "clang/Tooling/JSONCompilationDatabase.h"
+#include "glog/logging.h"
+#include "google/protobuf/stubs/common.h"
+#include "kythe/cxx/common/index_writer.h"
+#include "kythe/cxx/common/init.h"
+#include "kythe/cxx/common/kzip_writer.h"
+#include "kythe/cxx/common/path_utils.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/cxx/extractor/caching_file_system.h"
+#include "kythe/cxx/extractor/cxx_extractor.h"
+#include "kythe/cxx/extractor/language.h"
+#include "kythe/proto/analysis.pb.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+ABSL_FLAG(std::string, output, "", "Path of the kzip to create.");
+ABSL_FLAG(int, jobs, 1, "Number of compilations to extract at once.");
+
+namespace kythe {
+namespace {
+
+/// \brief The kzip all extractions write to. Thread-safe.
+class SharedKzip {
+ public:
+  explicit SharedKzip(IndexWriter writer) : writer_(std::move(writer)) {}
+
+  void WriteUnit(const proto::IndexedCompilation& compilation) {
+    absl::MutexLock lock(&mu_);
+    if (auto digest = writer_.WriteUnit(compilation); !digest.ok()) {
+      LOG(ERROR) << "Error adding compilation: " << digest.status();
+    }
+  }
+
+  /// \brief Writes `file` unless a file with the same digest was written
+  /// already.
+  void WriteFile(const proto::FileData& file) {
+    absl::MutexLock lock(&mu_);
+    const std::string& digest = file.info().digest();
+    if (!digest.empty() && !written_.insert(digest).second) {
+      return;
+    }
+    if (auto written = writer_.WriteFile(file.content()); !written.ok()) {
+      LOG(ERROR) << "Error writing filedata: " << written.status();
+    }
+  }
+
+  absl::Status Close() {
+    absl::MutexLock lock(&mu_);
+    return writer_.Close();
+  }
+
+ private:
+  absl::Mutex mu_;
+  IndexWriter writer_ ABSL_GUARDED_BY(mu_);
+  /// The digests of the files written so far.
+  absl::flat_hash_set<std::string> written_ ABSL_GUARDED_BY(mu_);
+};
+
+/// \brief A `CompilationWriterSink` that writes to a `SharedKzip`.
+class SharedKzipSink : public CompilationWriterSink {
+ public:
+  explicit SharedKzipSink(SharedKzip* kzip) : kzip_(kzip) {}
+  void OpenIndex(const std::string& unit_hash) override {}
+  void WriteHeader(const proto::CompilationUnit& header) override {
+    proto::IndexedCompilation compilation;
+    *compilation.mutable_unit() = header;
+    kzip_->WriteUnit(compilation);
+  }
+  void WriteFileContent(const proto::FileData& file) override {
+    kzip_->WriteFile(file);
+  }
+
+ private:
+  SharedKzip* kzip_;
+};
+
+}  // anonymous namespace
+}  // namespace kythe
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  kythe::InitializeProgram(argv[0]);
+  absl::SetProgramUsageMessage(
+      "cxx_extractor_compdb: extract a compilation database into one kzip\n"
+      "usage: cxx_extractor_compdb --output out.kzip compile_commands.json");
+  std::vector<char*> remain = absl::ParseCommandLine(argc, argv);
+  const std::string output = absl::GetFlag(FLAGS_output);
+  if (output.empty() || remain.size() != 2) {
+    absl::FPrintF(stderr, "Need --output and one compile_commands.json\n");
+    return 1;
+  }
+  std::string error;
+  auto database = clang::tooling::JSONCompilationDatabase::loadFromFile(
+      remain[1], error, clang::tooling::JSONCommandLineSyntax::AutoDetect);
+  if (database == nullptr) {
+    absl::FPrintF(stderr, "Couldn't load %s: %s\n", remain[1], error);
+    return 1;
+  }
+  auto writer = kythe::KzipWriter::Create(output);
+  if (!writer.ok()) {
+    absl::FPrintF(stderr, "Couldn't create %s: %s\n", output,
+                  writer.status().ToString());
+    return 1;
+  }
+  kythe::SharedKzip kzip(*std::move(writer));
+
+  // Everything but the arguments and directory is the same for every
+  // compilation, so read the environment (and any vname config) just once.
+  kythe::ExtractorConfiguration base_config;
+  base_config.InitializeFromEnvironment();
+  base_config.SetFileSystem(new kythe::CachingFileSystem(
+      llvm::vfs::getRealFileSystem()));
+
+  absl::Mutex failures_mu;
+  int failures = 0;
+  {
+    kythe::ThreadPool pool(std::max(1, absl::GetFlag(FLAGS_jobs)));
+    for (const auto& command : database->getAllCompileCommands()) {
+      // Argument processing touches global LLVM state, so do it here rather
+      // than on the workers.
+      std::string file = command.Filename;
+      auto directory = kythe::MakeCleanAbsolutePath(command.Directory);
+      if (!directory.ok()) {
+        LOG(ERROR) << "Bad directory for " << file << ": "
+                   << directory.status();
+        absl::MutexLock lock(&failures_mu);
+        ++failures;
+        continue;
+      }
+      auto config =
+          std::make_shared<kythe::ExtractorConfiguration>(base_config);
+      config->SetArgs(command.CommandLine);
+      config->SetWorkingDirectory(*directory);
+      pool.Schedule([&, config, file] {
+        if (!config->Extract(kythe::supported_language::Language::kCpp,
+                             std::make_unique<kythe::SharedKzipSink>(&kzip))) {
+          LOG(ERROR) << "Extraction failed for " << file;
+          absl::MutexLock lock(&failures_mu);
+          ++failures;
+        }
+      });
+    }
+  }
+  if (absl::Status status = kzip.Close(); !status.ok()) {
+    absl::FPrintF(stderr, "Couldn't write %s: %s\n", output,
+                  status.ToString());
+    return 1;
+  }
+  google::protobuf::ShutdownProtobufLibrary();
+  return failures == 0 ? 0 : 1;
+}
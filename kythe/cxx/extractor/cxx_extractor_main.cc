@@ -28,6 +28,12 @@
 // KYTHE_OUTPUT_DIRECTORY as an index pack. Instead of emitting kindex files,
 // it will instead follow the index pack protocol.
 //
+// If KYTHE_CONTENT_STORE names a directory, file contents are written there
+// by digest and shared among extractions rather than copied into every
+// kzip; `kzip_merge --content_store` later assembles complete kzips.
+// If KYTHE_DIGEST_CACHE names a directory, digests of unchanged files are
+// shared there so that they needn't be recomputed by every extraction.
+//
 // If the first two arguments are --with_executable /foo/bar, the extractor
 // will consider /foo/bar to be the executable it was called as for purposes
 // of argument interpretation. These arguments are then stripped.
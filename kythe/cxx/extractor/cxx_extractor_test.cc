@@ -25,6 +25,7 @@
 #include "gtest/gtest.h"
 #include "kythe/cxx/common/path_utils.h"
 #include "kythe/proto/analysis.pb.h"
+#include "kythe/proto/cxx.pb.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
 
@@ -360,6 +361,29 @@ TEST_F(CxxExtractorTest, DoesNotBreakForMissingIncludes) {
   FillAndVerifyCompilationUnit("b.cc", {}, {"./b.h", "b.cc"});
 }
 
+TEST_F(CxxExtractorTest, RecordsCostHint) {
+  const std::string header =
+      "template <typename T> struct S;\n"
+      "template<typename T> void f(T);\n"
+      "int my_template<1>;\n";
+  const std::string source = "#include \"b.h\"\nint main() { return 0; }";
+  AddSourceFile("b.cc", source);
+  AddSourceFile("./b.h", header);
+  CapturingCompilationWriterSink sink;
+  FillCompilationUnit("b.cc", {}, {}, 1, "output.o", &sink);
+  ASSERT_EQ(1, sink.units().size());
+  kythe::proto::CxxCompilationUnitDetails details;
+  for (const auto& any : sink.units().front().details()) {
+    if (any.UnpackTo(&details)) break;
+  }
+  const auto& hint = details.cost_hint();
+  EXPECT_EQ(header.size() + source.size(), hint.input_bytes());
+  EXPECT_EQ(2, hint.input_files());
+  EXPECT_EQ(2, hint.file_transcripts());
+  EXPECT_EQ(2, hint.template_declarations());
+  EXPECT_EQ(0, hint.template_heavy_files());
+}
+
 }  // anonymous namespace
 }  // namespace kythe
 
@@ -13,25 +13,50 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include <fstream>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "kythe/cxx/common/init.h"
+#include "kythe/cxx/common/net_client.h"
+#include "kythe/cxx/extractor/bazel_artifact_fetcher.h"
 #include "kythe/cxx/extractor/bazel_artifact_reader.h"
+#include "kythe/cxx/extractor/bazel_event_reader.h"
 
 ABSL_FLAG(std::string, build_event_binary_file, "",
           "Bazel event protocol file to read");
+ABSL_FLAG(std::string, fetch_directory, "",
+          "If set, an existing directory to copy the artifacts' files into "
+          "as they are found, printing their local paths instead of their "
+          "names.");
+ABSL_FLAG(int, fetch_parallelism, 8,
+          "With --fetch_directory, the number of artifacts to fetch at once.");
+ABSL_FLAG(std::string, remote_cache, "",
+          "With --fetch_directory, the base URL of an HTTP remote cache to "
+          "fetch bytestream://.../blobs/<sha256>/<size> URIs from.");
 
 namespace kythe {
 namespace {
 
+/// Build event files can be several gigabytes, so read them in large blocks.
+constexpr int kReadBufferSize = 1 << 20;
+
 absl::string_view Basename(absl::string_view path) {
   if (auto pos = path.rfind('/'); pos != path.npos) {
     return path.substr(pos + 1);
@@ -39,28 +64,75 @@ absl::string_view Basename(absl::string_view path) {
   return path;
 }
 
-int DumpArtifacts(const std::string filename) {
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    LOG(ERROR) << "Error opening " << filename << ": " << std::strerror(errno);
-    return 1;
+/// \brief Fetches `http:` and `https:` URIs, and the `bytestream:` URIs of
+/// blobs from the HTTP cache at `remote_cache` if it isn't empty.
+absl::StatusOr<std::string> FetchRemote(const std::string& remote_cache,
+                                        absl::string_view uri) {
+  std::string url(uri);
+  if (absl::StartsWith(uri, "bytestream:") && !remote_cache.empty()) {
+    // bytestream://<host>/[<instance>/]blobs/<sha256>/<size>
+    std::vector<absl::string_view> parts = absl::StrSplit(uri, '/');
+    if (parts.size() >= 3 && parts[parts.size() - 3] == "blobs") {
+      url = absl::StrCat(absl::StripSuffix(remote_cache, "/"), "/cas/",
+                         parts[parts.size() - 2]);
+    }
+  }
+  if (!absl::StartsWith(url, "http:") && !absl::StartsWith(url, "https:")) {
+    return absl::UnimplementedError(absl::StrCat("Can't fetch ", uri));
+  }
+  // Clients aren't thread-safe, but keep their connections between fetches.
+  thread_local JsonClient client;
+  std::string content;
+  if (!client.Request(url, /*post=*/false, std::string(), &content)) {
+    return absl::UnavailableError(absl::StrCat("Couldn't fetch ", url));
   }
+  return content;
+}
 
-  google::protobuf::io::IstreamInputStream input(&file);
-  BazelEventReader events(&input);
-  BazelArtifactReader artifacts(&events);
+template <typename Artifacts>
+int PrintArtifacts(Artifacts& artifacts, bool print_local_paths) {
   for (; !artifacts.Done(); artifacts.Next()) {
-    std::cout << artifacts.Ref().label << std::endl;
+    std::cout << artifacts.Ref().label << '\n';
     for (const auto& [local_path, uri] : artifacts.Ref().files) {
-      std::cout << "  " << Basename(uri) << std::endl;
+      std::cout << "  " << (print_local_paths ? local_path : Basename(uri))
+                << '\n';
     }
   }
+  std::cout.flush();
   if (!artifacts.status().ok()) {
     LOG(ERROR) << artifacts.status();
   }
-
   return !artifacts.status().ok();
 }
+
+int DumpArtifacts(const std::string filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG(ERROR) << "Error opening " << filename << ": " << std::strerror(errno);
+    return 1;
+  }
+
+  google::protobuf::io::FileInputStream input(fd, kReadBufferSize);
+  input.SetCloseOnDelete(true);
+  BazelEventReader events(&input);
+  // Decode the stream on another thread while the selectors run here.
+  PrefetchingEventReader prefetched(&events);
+  BazelArtifactReader artifacts(&prefetched);
+  if (absl::GetFlag(FLAGS_fetch_directory).empty()) {
+    return PrintArtifacts(artifacts, false);
+  }
+  BazelArtifactFetcher::Options options;
+  options.output_directory = absl::GetFlag(FLAGS_fetch_directory);
+  options.parallelism =
+      static_cast<size_t>(std::max(1, absl::GetFlag(FLAGS_fetch_parallelism)));
+  options.fetch_remote = [remote_cache = absl::GetFlag(FLAGS_remote_cache)](
+                             absl::string_view uri) {
+    return FetchRemote(remote_cache, uri);
+  };
+  JsonClient::InitNetwork();
+  BazelArtifactFetcher fetched(&artifacts, std::move(options));
+  return PrintArtifacts(fetched, true);
+}
 }  // namespace
 }  // namespace kythe
 
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/extractor/file_digest_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "absl/strings/str_cat.h"
+#include "glog/logging.h"
+#include "kythe/cxx/common/path_utils.h"
+
+namespace kythe {
+namespace {
+
+/// The length of a hex-encoded SHA-256 digest.
+constexpr size_t kDigestLength = 64;
+
+/// Slack for file systems with coarse timestamps.
+constexpr absl::Duration kTimestampGranularity = absl::Seconds(2);
+
+#if defined(__APPLE__)
+absl::Time ModifiedTime(const struct stat& st) {
+  return absl::TimeFromTimespec(st.st_mtimespec);
+}
+absl::Time ChangedTime(const struct stat& st) {
+  return absl::TimeFromTimespec(st.st_ctimespec);
+}
+#else
+absl::Time ModifiedTime(const struct stat& st) {
+  return absl::TimeFromTimespec(st.st_mtim);
+}
+absl::Time ChangedTime(const struct stat& st) {
+  return absl::TimeFromTimespec(st.st_ctim);
+}
+#endif
+
+/// \brief Reads a shared entry from `path`.
+absl::optional<std::string> ReadEntry(const std::string& path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::nullopt;
+  }
+  std::string digest(kDigestLength + 1, '\0');
+  ssize_t read;
+  do {
+    read = ::read(fd, &digest[0], digest.size());
+  } while (read < 0 && errno == EINTR);
+  ::close(fd);
+  if (read != kDigestLength) {
+    return absl::nullopt;
+  }
+  digest.resize(kDigestLength);
+  return digest;
+}
+
+/// \brief Writes a shared entry to `path`, renaming it into place so that
+/// other processes never see a partial entry.
+void WriteEntry(const std::string& path, const std::string& digest) {
+  // Every writer, including other threads in this process, gets its own
+  // temporary file.
+  std::string temp_path = absl::StrCat(path, ".XXXXXX");
+  int fd = ::mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    LOG(WARNING) << "Couldn't create " << temp_path << ": " << strerror(errno);
+    return;
+  }
+  bool ok = ::write(fd, digest.data(), digest.size()) ==
+            static_cast<ssize_t>(digest.size());
+  ok = ::fchmod(fd, 0644) == 0 && ok;
+  ok = ::close(fd) == 0 && ok;
+  if (!ok || ::rename(temp_path.c_str(), path.c_str()) != 0) {
+    LOG(WARNING) << "Couldn't write " << path << ": " << strerror(errno);
+    ::unlink(temp_path.c_str());
+  }
+}
+
+}  // anonymous namespace
+
+absl::optional<std::string> FileDigestCache::IdentityKey(
+    const std::string& path, size_t size, absl::Time* modified) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+      static_cast<size_t>(st.st_size) != size) {
+    return absl::nullopt;
+  }
+  *modified = ModifiedTime(st);
+  return absl::StrCat(st.st_dev, "-", st.st_ino, "-", st.st_size, "-",
+                      absl::ToUnixNanos(*modified), "-",
+                      absl::ToUnixNanos(ChangedTime(st)));
+}
+
+absl::optional<std::string> FileDigestCache::Find(const std::string& path,
+                                                  size_t size) {
+  absl::Time modified;
+  auto key = IdentityKey(path, size, &modified);
+  if (!key) {
+    return absl::nullopt;
+  }
+  {
+    absl::MutexLock lock(&mu_);
+    if (auto found = digests_.find(*key); found != digests_.end()) {
+      return found->second;
+    }
+  }
+  if (directory_.empty()) {
+    return absl::nullopt;
+  }
+  auto digest = ReadEntry(JoinPath(directory_, *key));
+  if (digest) {
+    absl::MutexLock lock(&mu_);
+    digests_.emplace(*std::move(key), *digest);
+  }
+  return digest;
+}
+
+void FileDigestCache::Insert(const std::string& path, size_t size,
+                             const std::string& digest,
+                             absl::Time read_start) {
+  absl::Time modified;
+  auto key = IdentityKey(path, size, &modified);
+  if (!key || digest.size() != kDigestLength ||
+      modified >= read_start - kTimestampGranularity) {
+    return;
+  }
+  if (!directory_.empty()) {
+    WriteEntry(JoinPath(directory_, *key), digest);
+  }
+  absl::MutexLock lock(&mu_);
+  digests_.insert_or_assign(*std::move(key), digest);
+}
+
+}  // namespace kythe
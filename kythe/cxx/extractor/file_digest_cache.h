@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_EXTRACTOR_FILE_DIGEST_CACHE_H_
+#define KYTHE_CXX_EXTRACTOR_FILE_DIGEST_CACHE_H_
+
+#include <string>
+#include <utility>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+
+namespace kythe {
+
+/// \brief Remembers the digests of files so that unchanged files needn't be
+/// rehashed by every extraction that reads them.
+///
+/// Entries are keyed by a file's identity: its device, inode, size and
+/// modification and change times. The path is left out so that the same file
+/// reached through different sandbox symlinks shares an entry. Entries are
+/// always kept in memory; if a directory is given they are also written
+/// there, where other extractor processes can find them.
+///
+/// This class is thread-safe.
+class FileDigestCache {
+ public:
+  /// \param directory If nonempty, an existing directory in which to share
+  /// entries with other processes.
+  explicit FileDigestCache(std::string directory = "")
+      : directory_(std::move(directory)) {}
+
+  /// \brief Looks up the digest of the file at `path`.
+  /// \param size The size of the contents the caller read from `path`.
+  /// \return the digest recorded for the file's current identity, if any.
+  absl::optional<std::string> Find(const std::string& path, size_t size)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \brief Records `digest` for the current identity of the file at
+  /// `path`.
+  /// \param size The size of the contents that `digest` was computed over.
+  /// \param read_start A time before the contents were read. Files modified
+  /// shortly before this aren't recorded, because a change made within the
+  /// file system's timestamp granularity wouldn't alter their identity.
+  void Insert(const std::string& path, size_t size, const std::string& digest,
+              absl::Time read_start) ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  /// \return the identity key for the file at `path`, or nullopt if it
+  /// can't be stat'd or doesn't have `size` bytes.
+  absl::optional<std::string> IdentityKey(const std::string& path, size_t size,
+                                          absl::Time* modified);
+
+  /// Where to share entries, or empty.
+  const std::string directory_;
+  absl::Mutex mu_;
+  /// Digests by identity key.
+  absl::flat_hash_map<std::string, std::string> digests_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_EXTRACTOR_FILE_DIGEST_CACHE_H_
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/extractor/file_digest_cache.h"
+
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <fstream>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Optional;
+
+constexpr char kDigest[] =
+    "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+/// \brief Writes `content` to a new file named `name`, last modified
+/// `age` ago.
+std::string WriteTestFile(const std::string& name, const std::string& content,
+                          absl::Duration age) {
+  std::string path = absl::StrCat(::testing::TempDir(), "/", name);
+  std::ofstream(path, std::ios::trunc) << content;
+  struct timeval times[2];
+  times[0] = times[1] = absl::ToTimeval(absl::Now() - age);
+  EXPECT_EQ(::utimes(path.c_str(), times), 0);
+  return path;
+}
+
+std::string MakeDirectory(const std::string& name) {
+  std::string path = absl::StrCat(::testing::TempDir(), "/", name);
+  ::mkdir(path.c_str(), 0755);
+  return path;
+}
+
+TEST(FileDigestCacheTest, FindsRecordedDigest) {
+  std::string path = WriteTestFile("old", "contents", absl::Hours(1));
+  FileDigestCache cache;
+  EXPECT_THAT(cache.Find(path, 8), Eq(absl::nullopt));
+  cache.Insert(path, 8, kDigest, absl::Now());
+  EXPECT_THAT(cache.Find(path, 8), Optional(std::string(kDigest)));
+  // A caller that read a different amount was reading a different version.
+  EXPECT_THAT(cache.Find(path, 9), Eq(absl::nullopt));
+}
+
+TEST(FileDigestCacheTest, IgnoresChangedFiles) {
+  std::string path = WriteTestFile("changed", "contents", absl::Hours(1));
+  FileDigestCache cache;
+  cache.Insert(path, 8, kDigest, absl::Now());
+  WriteTestFile("changed", "CONTENTS", absl::Hours(2));
+  EXPECT_THAT(cache.Find(path, 8), Eq(absl::nullopt));
+}
+
+TEST(FileDigestCacheTest, SkipsRecentlyModifiedFiles) {
+  std::string path = WriteTestFile("new", "contents", absl::ZeroDuration());
+  FileDigestCache cache;
+  cache.Insert(path, 8, kDigest, absl::Now());
+  EXPECT_THAT(cache.Find(path, 8), Eq(absl::nullopt));
+}
+
+TEST(FileDigestCacheTest, SharesEntriesThroughDirectory) {
+  std::string directory = MakeDirectory("digests");
+  std::string path = WriteTestFile("shared", "contents", absl::Hours(1));
+  FileDigestCache(directory).Insert(path, 8, kDigest, absl::Now());
+  FileDigestCache cache(directory);
+  EXPECT_THAT(cache.Find(path, 8), Optional(std::string(kDigest)));
+}
+
+}  // namespace
+}  // namespace kythe
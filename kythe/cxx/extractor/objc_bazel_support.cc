@@ -17,9 +17,19 @@
 #include "objc_bazel_support.h"
 
 #include <llvm/ADT/StringRef.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <cstdlib>
+#include <fstream>
 #include <sstream>
 
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "kythe/cxx/common/path_utils.h"
+#include "openssl/sha.h"
 #include "re2/re2.h"
 
 namespace kythe {
@@ -69,6 +79,62 @@ std::string RunScript(const std::string& cmd) {
   return std::string(llvm::StringRef(output).trim());
 }
 
+std::string ToolchainProbeCache::PathForKey(const std::string& key) const {
+  unsigned char hash[SHA256_DIGEST_LENGTH];
+  ::SHA256(reinterpret_cast<const unsigned char*>(key.data()), key.size(),
+           hash);
+  return JoinPath(directory_,
+                  absl::BytesToHexString(absl::string_view(
+                      reinterpret_cast<const char*>(hash), sizeof(hash))));
+}
+
+std::string ToolchainProbeCache::Run(const std::string& env_prefix,
+                                     const std::string& script) {
+  std::string key = absl::StrCat(env_prefix, "\n", script);
+  struct stat script_stat;
+  if (::stat(script.c_str(), &script_stat) == 0) {
+    absl::StrAppend(&key, "\n", script_stat.st_size, "\n",
+                    script_stat.st_mtime);
+  }
+  if (auto found = outputs_.find(key); found != outputs_.end()) {
+    return found->second;
+  }
+  std::string path;
+  if (!directory_.empty()) {
+    path = PathForKey(key);
+    struct stat cached_stat;
+    if (::stat(path.c_str(), &cached_stat) == 0 &&
+        absl::Now() - absl::FromTimeT(cached_stat.st_mtime) < max_age_) {
+      std::ifstream cached(path);
+      std::stringstream output;
+      output << cached.rdbuf();
+      if (cached && !output.str().empty()) {
+        return outputs_[key] = output.str();
+      }
+    }
+  }
+  std::string output = RunScript(env_prefix + script);
+  if (output.empty()) {
+    return output;
+  }
+  outputs_[key] = output;
+  if (!path.empty()) {
+    // Write through a temporary file so that concurrent readers never see
+    // part of an output.
+    std::string temp_path = absl::StrCat(path, ".XXXXXX");
+    int fd = ::mkstemp(&temp_path[0]);
+    if (fd >= 0) {
+      bool written = ::write(fd, output.data(), output.size()) ==
+                     static_cast<ssize_t>(output.size());
+      written = ::close(fd) == 0 && written;
+      if (!written || ::rename(temp_path.c_str(), path.c_str()) != 0) {
+        ::unlink(temp_path.c_str());
+      }
+    }
+  }
+  return output;
+}
+
 void FillWithFixedArgs(std::vector<std::string>& args,
                        const blaze::CppCompileInfo& ci,
                        const std::string& devdir, const std::string& sdkroot) {
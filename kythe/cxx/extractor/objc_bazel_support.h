@@ -18,8 +18,11 @@
 #define KYTHE_CXX_EXTRACTOR_OBJC_BAZEL_SUPPORT_H_
 
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/time/time.h"
 #include "third_party/bazel/src/main/protobuf/extra_actions_base.pb.h"
 
 namespace kythe {
@@ -49,6 +52,41 @@ std::string BuildEnvVarCommandPrefix(
 /// \brief Run a command and capture its (trimmed) stdout in a string.
 std::string RunScript(const std::string& cmd);
 
+/// \brief Runs the scripts that find the developer directory and SDK root
+/// through `RunScript`, remembering their output.
+///
+/// Each spawn costs tens of milliseconds on macOS, and every compile action
+/// asks the same questions. Bazel passes the Xcode version, SDK version and
+/// platform to the scripts through the action's environment, so a script's
+/// output is keyed by that environment, the script and its size and mtime.
+/// Outputs are held in memory and, if a directory is given, in one file per
+/// key there, which extractor processes running at once may share.
+class ToolchainProbeCache {
+ public:
+  /// \param directory An existing directory to share outputs through, or
+  /// empty to keep them only in memory.
+  /// \param max_age How long an output written to `directory` is trusted,
+  /// since it also depends on the Xcode installation.
+  explicit ToolchainProbeCache(std::string directory = "",
+                               absl::Duration max_age = absl::Hours(1))
+      : directory_(std::move(directory)), max_age_(max_age) {}
+
+  /// \brief Returns `RunScript(env_prefix + script)`, running it only if no
+  /// output is known. Empty outputs (from failed scripts) aren't kept.
+  /// \param env_prefix The result of `BuildEnvVarCommandPrefix`.
+  /// \param script The path to the script to run.
+  std::string Run(const std::string& env_prefix, const std::string& script);
+
+ private:
+  /// \return the path of the file that holds the output for `key`.
+  std::string PathForKey(const std::string& key) const;
+
+  const std::string directory_;
+  const absl::Duration max_age_;
+  /// Outputs by key.
+  absl::flat_hash_map<std::string, std::string> outputs_;
+};
+
 // \brief Populate args with the arguments from ci where the magic bazel strings
 // have been replaced with their actual values.
 void FillWithFixedArgs(std::vector<std::string>& args,
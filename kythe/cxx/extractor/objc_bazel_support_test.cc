@@ -16,6 +16,13 @@
 
 #include "objc_bazel_support.h"
 
+#include <sys/stat.h>
+
+#include <fstream>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
@@ -144,6 +151,59 @@ TEST(ObjcExtractorBazelMain, TestRunScriptThatFails) {
   EXPECT_EQ("", RunScript("ls --fail"));
 }
 
+/// \brief Returns the path of a new script that prints `output` and counts
+/// its runs in `<path>.runs`.
+std::string WriteCountingScript(const std::string& name,
+                                const std::string& output) {
+  std::string path = absl::StrCat(::testing::TempDir(), "/", name);
+  std::ofstream(path, std::ios::trunc)
+      << "#!/bin/sh\necho x >> '" << path << ".runs'\necho " << output
+      << "\n";
+  ::chmod(path.c_str(), 0755);
+  return path;
+}
+
+int CountRuns(const std::string& script) {
+  std::ifstream runs(script + ".runs");
+  int count = 0;
+  for (std::string line; std::getline(runs, line);) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(ObjcExtractorBazelMain, TestToolchainProbeCacheInMemory) {
+  std::string script = WriteCountingScript("probe_memory", "/sdk");
+  ToolchainProbeCache probes;
+  EXPECT_EQ("/sdk", probes.Run("A='1' ", script));
+  EXPECT_EQ("/sdk", probes.Run("A='1' ", script));
+  EXPECT_EQ(1, CountRuns(script));
+  // A different environment may select a different SDK.
+  EXPECT_EQ("/sdk", probes.Run("A='2' ", script));
+  EXPECT_EQ(2, CountRuns(script));
+}
+
+TEST(ObjcExtractorBazelMain, TestToolchainProbeCacheOnDisk) {
+  std::string script = WriteCountingScript("probe_disk", "/devdir");
+  std::string directory = absl::StrCat(::testing::TempDir(), "/probes");
+  ::mkdir(directory.c_str(), 0755);
+  EXPECT_EQ("/devdir", ToolchainProbeCache(directory).Run("", script));
+  EXPECT_EQ("/devdir", ToolchainProbeCache(directory).Run("", script));
+  EXPECT_EQ(1, CountRuns(script));
+  // Outputs older than the maximum age are ignored.
+  EXPECT_EQ("/devdir", ToolchainProbeCache(directory, absl::ZeroDuration())
+                           .Run("", script));
+  EXPECT_EQ(2, CountRuns(script));
+}
+
+TEST(ObjcExtractorBazelMain, TestToolchainProbeCacheSkipsFailures) {
+  std::string script = absl::StrCat(::testing::TempDir(), "/probe_missing");
+  ToolchainProbeCache probes;
+  EXPECT_EQ("", probes.Run("", script));
+  WriteCountingScript("probe_missing", "/found");
+  EXPECT_EQ("/found", probes.Run("", script));
+}
+
 // This test passes on linux (2016-09-09). It seems too dangerous to call out
 // to an unknown binary, so this test is commented out so it does not run
 // automatically.
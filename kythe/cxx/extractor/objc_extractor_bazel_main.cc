@@ -73,6 +73,7 @@
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/strings/str_format.h"
+#include "absl/time/time.h"
 #include "cxx_extractor.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
@@ -89,6 +90,11 @@ ABSL_FLAG(kythe::PathCanonicalizer::Policy, canonicalize_vname_paths,
           kythe::PathCanonicalizer::Policy::kCleanOnly,
           "Policy to use when canonicalization VName paths: "
           "clean-only (default), prefer-relative, prefer-real.");
+ABSL_FLAG(std::string, toolchain_cache_dir, "",
+          "If set, an existing directory in which to share the output of the "
+          "devdir and sdkroot scripts between extractor runs.");
+ABSL_FLAG(absl::Duration, toolchain_cache_max_age, absl::Hours(1),
+          "How long the outputs in --toolchain_cache_dir are trusted.");
 
 struct XAState {
   std::string extra_action_file;
@@ -96,6 +102,7 @@ struct XAState {
   std::string vname_config;
   std::string devdir_script;
   std::string sdkroot_script;
+  kythe::ToolchainProbeCache* probes = nullptr;
 };
 
 static bool ContainsUnsupportedArg(const std::vector<std::string>& args) {
@@ -123,8 +130,8 @@ static bool LoadSpawnInfo(const XAState& xa_state,
     }
   } else {
     auto cmdPrefix = kythe::BuildEnvVarCommandPrefix(spawn_info.variable());
-    auto devdir = kythe::RunScript(cmdPrefix + xa_state.devdir_script);
-    auto sdkroot = kythe::RunScript(cmdPrefix + xa_state.sdkroot_script);
+    auto devdir = xa_state.probes->Run(cmdPrefix, xa_state.devdir_script);
+    auto sdkroot = xa_state.probes->Run(cmdPrefix, xa_state.sdkroot_script);
 
     kythe::FillWithFixedArgs(args, spawn_info, devdir, sdkroot);
   }
@@ -162,8 +169,8 @@ static bool LoadCppInfo(const XAState& xa_state,
     }
   } else {
     auto cmdPrefix = kythe::BuildEnvVarCommandPrefix(cpp_info.variable());
-    auto devdir = kythe::RunScript(cmdPrefix + xa_state.devdir_script);
-    auto sdkroot = kythe::RunScript(cmdPrefix + xa_state.sdkroot_script);
+    auto devdir = xa_state.probes->Run(cmdPrefix, xa_state.devdir_script);
+    auto sdkroot = xa_state.probes->Run(cmdPrefix, xa_state.sdkroot_script);
 
     kythe::FillWithFixedArgs(args, cpp_info, devdir, sdkroot);
   }
@@ -229,6 +236,11 @@ int main(int argc, char* argv[]) {
     xa_state.sdkroot_script = "";
   }
 
+  kythe::ToolchainProbeCache probes(
+      absl::GetFlag(FLAGS_toolchain_cache_dir),
+      absl::GetFlag(FLAGS_toolchain_cache_max_age));
+  xa_state.probes = &probes;
+
   kythe::ExtractorConfiguration config;
   config.SetPathCanonizalizationPolicy(
       absl::GetFlag(FLAGS_canonicalize_vname_paths));
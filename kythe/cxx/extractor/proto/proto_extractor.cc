@@ -16,11 +16,15 @@
 
 #include "proto_extractor.h"
 
+#include <memory>
+#include <set>
 #include <string>
 
+#include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "glog/logging.h"
 #include "google/protobuf/compiler/importer.h"
+#include "google/protobuf/descriptor.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "kythe/cxx/common/file_utils.h"
 #include "kythe/cxx/common/file_vname_generator.h"
@@ -32,7 +36,9 @@ namespace kythe {
 namespace lang_proto {
 namespace {
 
+using ::google::protobuf::FileDescriptor;
 using ::google::protobuf::compiler::DiskSourceTree;
+using ::google::protobuf::compiler::Importer;
 
 // Error "collector" that just writes messages to log output.
 class LoggingMultiFileErrorCollector
@@ -75,8 +81,40 @@ class RecordingDiskSourceTree : public DiskSourceTree {
   std::set<std::string> opened_files_;
 };
 
+// Maps the current directory and `path_substitutions` into `src_tree`.
+void MapSearchPaths(
+    const std::vector<std::pair<std::string, std::string>>& path_substitutions,
+    DiskSourceTree* src_tree) {
+  src_tree->MapPath("", "");  // Add current directory to VFS.
+  for (const auto& sub : path_substitutions) {
+    src_tree->MapPath(sub.first, sub.second);
+  }
+}
+
+// Adds the paths on disk of `file` and of everything it imports to `paths`.
+void AddDiskPaths(const FileDescriptor* file, DiskSourceTree* src_tree,
+                  std::set<std::string>* paths) {
+  std::string disk_path;
+  if (!src_tree->VirtualFileToDiskFile(file->name(), &disk_path) ||
+      !paths->insert(disk_path).second) {
+    return;
+  }
+  for (int i = 0; i < file->dependency_count(); ++i) {
+    AddDiskPaths(file->dependency(i), src_tree, paths);
+  }
+}
+
 }  // namespace
 
+struct ProtoExtractionCache::SearchPath {
+  RecordingDiskSourceTree src_tree;
+  LoggingMultiFileErrorCollector err_collector;
+  std::unique_ptr<Importer> importer;
+};
+
+ProtoExtractionCache::ProtoExtractionCache() = default;
+ProtoExtractionCache::~ProtoExtractionCache() = default;
+
 proto::CompilationUnit ProtoExtractor::ExtractProtos(
     const std::vector<std::string>& proto_filenames,
     IndexWriter* index_writer) const {
@@ -90,10 +128,7 @@ proto::CompilationUnit ProtoExtractor::ExtractProtos(
 
   // Add path substitutions to src_tree.
   RecordingDiskSourceTree src_tree;
-  src_tree.MapPath("", "");  // Add current directory to VFS.
-  for (const auto& sub : path_substitutions) {
-    src_tree.MapPath(sub.first, sub.second);
-  }
+  MapSearchPaths(path_substitutions, &src_tree);
 
   // Add protoc args to output.
   if (!path_substitutions.empty()) {
@@ -103,50 +138,88 @@ proto::CompilationUnit ProtoExtractor::ExtractProtos(
     }
   }
 
-  // Import the toplevel proto(s), which will record paths of any transitive
-  // dependencies to src_tree.
+  ProtoExtractionCache::SearchPath* shared = nullptr;
+  if (cache != nullptr) {
+    auto& search_path = cache->search_paths_[path_substitutions];
+    if (search_path == nullptr) {
+      search_path = absl::make_unique<ProtoExtractionCache::SearchPath>();
+      MapSearchPaths(path_substitutions, &search_path->src_tree);
+      search_path->importer = absl::make_unique<Importer>(
+          &search_path->src_tree, &search_path->err_collector);
+    }
+    shared = search_path.get();
+  }
+
+  // Import the toplevel proto(s), recording the paths of the files they
+  // transitively depend on.
+  std::set<std::string> disk_paths;
   {
     LoggingMultiFileErrorCollector err_collector;
     for (const std::string& fname : proto_filenames) {
-      // Note that a separate importer instance is used for each top-level
-      // import to avoid double-importing any subprotos, which would happen if
-      // two top-level protos share any transitive dependencies.
-      google::protobuf::compiler::Importer importer(&src_tree, &err_collector);
-      CHECK(importer.Import(fname) != nullptr)
-          << "Failed to import file: " << fname;
+      // The shared importer keeps every file imported by earlier targets, so
+      // those aren't parsed again. It fails if one of them was imported under
+      // another name, in which case this file is imported on its own.
+      const FileDescriptor* file =
+          shared != nullptr ? shared->importer->Import(fname) : nullptr;
+      if (file != nullptr) {
+        AddDiskPaths(file, &shared->src_tree, &disk_paths);
+      } else {
+        // Note that a separate importer instance is used for each top-level
+        // import to avoid double-importing any subprotos, which would happen
+        // if two top-level protos share any transitive dependencies. The
+        // source tree records the paths of the files it opens.
+        Importer importer(&src_tree, &err_collector);
+        CHECK(importer.Import(fname) != nullptr)
+            << "Failed to import file: " << fname;
+      }
 
       unit.add_source_file(RelativizePath(fname, root_directory));
     }
   }
+  disk_paths.insert(src_tree.opened_files().begin(),
+                    src_tree.opened_files().end());
 
   // Write each toplevel proto and its transitive dependencies into the kzip.
-  for (const std::string& abspath : src_tree.opened_files()) {
+  for (const std::string& abspath : disk_paths) {
     // Resolve path relative to the proto compiler's search paths.
     std::string relpath, shadow;
     CHECK(DiskSourceTree::SUCCESS ==
           src_tree.DiskFileToVirtualFile(abspath, &relpath, &shadow));
     CHECK(shadow.empty()) << "Filepath shadows a real file: " << relpath;
-    // Read file contents
-    std::string file_contents;
-    {
-      std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> in_stream(
-          src_tree.Open(relpath));
-      CHECK(in_stream != nullptr) << "Can't open file: " << relpath;
-
-      const void* data = nullptr;
-      int size = 0;
-      while (in_stream->Next(&data, &size)) {
-        file_contents.append(static_cast<const char*>(data), size);
+    std::string digest;
+    if (cache != nullptr) {
+      auto cached = cache->digests_.find(abspath);
+      if (cached != cache->digests_.end()) {
+        digest = cached->second;
+      }
+    }
+    if (digest.empty()) {
+      // Read file contents
+      std::string file_contents;
+      {
+        std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> in_stream(
+            src_tree.Open(relpath));
+        CHECK(in_stream != nullptr) << "Can't open file: " << relpath;
+
+        const void* data = nullptr;
+        int size = 0;
+        while (in_stream->Next(&data, &size)) {
+          file_contents.append(static_cast<const char*>(data), size);
+        }
+      }
+
+      // Write file to index.
+      auto written = index_writer->WriteFile(file_contents);
+      CHECK(written.ok()) << written.status();
+      digest = *written;
+      if (cache != nullptr) {
+        cache->digests_[abspath] = digest;
       }
     }
 
     // Make path relative to KYTHE_ROOT_DIRECTORY.
     const std::string final_path = RelativizePath(abspath, root_directory);
 
-    // Write file to index.
-    auto digest = index_writer->WriteFile(file_contents);
-    CHECK(digest.ok()) << digest.status();
-
     // Record file info to compilation unit.
     proto::CompilationUnit::FileInput* file_input = unit.add_required_input();
     proto::VName vname = vname_gen.LookupVName(final_path);
@@ -155,7 +228,7 @@ proto::CompilationUnit ProtoExtractor::ExtractProtos(
     }
     *file_input->mutable_v_name() = std::move(vname);
     file_input->mutable_info()->set_path(final_path);
-    file_input->mutable_info()->set_digest(*digest);
+    file_input->mutable_info()->set_digest(digest);
   }
 
   return unit;
@@ -17,6 +17,12 @@
 #ifndef KYTHE_CXX_EXTRACTOR_PROTO_PROTO_EXTRACTOR_H_
 #define KYTHE_CXX_EXTRACTOR_PROTO_PROTO_EXTRACTOR_H_
 
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "absl/strings/string_view.h"
 #include "kythe/cxx/common/file_vname_generator.h"
 #include "kythe/cxx/common/index_writer.h"
@@ -25,6 +31,27 @@
 namespace kythe {
 namespace lang_proto {
 
+/// \brief State shared between calls to ProtoExtractor::ExtractProtos, so that
+/// a batch of targets with common imports parses and writes each file once.
+class ProtoExtractionCache {
+ public:
+  ProtoExtractionCache();
+  ~ProtoExtractionCache();
+  ProtoExtractionCache(const ProtoExtractionCache&) = delete;
+  ProtoExtractionCache& operator=(const ProtoExtractionCache&) = delete;
+
+ private:
+  friend class ProtoExtractor;
+  struct SearchPath;
+
+  /// A source tree and importer for each distinct set of path substitutions.
+  std::map<std::vector<std::pair<std::string, std::string>>,
+           std::unique_ptr<SearchPath>>
+      search_paths_;
+  /// The digests of the files written so far, by their paths on disk.
+  std::map<std::string, std::string> digests_;
+};
+
 class ProtoExtractor {
  public:
   /// Reads KYTHE_VNAMES, KYTHE_CORPUS, and KYTHE_ROOT_DIRECTORY environment
@@ -56,6 +83,11 @@ class ProtoExtractor {
   /// Any path that is not assigned a corpus by the FileVNameGenerator is given
   /// this corpus id.
   std::string corpus;
+  /// If set, parsed protos are kept here and reused by later calls with the
+  /// same path_substitutions, and files already written are not read or
+  /// written again. Every call sharing a cache must use the same
+  /// index_writer.
+  ProtoExtractionCache* cache = nullptr;
 };
 
 }  // namespace lang_proto
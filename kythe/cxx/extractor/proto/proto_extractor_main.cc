@@ -22,19 +22,31 @@
 //   proto_extractor foo.proto
 //   proto_extractor foo.proto bar.proto
 //   proto_extractor foo.proto -- --proto_path dir/with/my/deps
+//   proto_extractor --batch_file targets.txt
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
+#include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
 #include "glog/logging.h"
+#include "kythe/cxx/common/file_utils.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/kzip_writer.h"
 #include "kythe/cxx/extractor/proto/proto_extractor.h"
 #include "kythe/cxx/indexer/proto/search_path.h"
 #include "kythe/proto/analysis.pb.h"
 
+ABSL_FLAG(std::string, batch_file, "",
+          "Extract one compilation unit for each line of this file instead of "
+          "for the command line. Each line holds one target's arguments, "
+          "separated by spaces, in the same form as the command line. Files "
+          "the targets share are parsed and written to the kzip once.");
+
 namespace kythe {
 namespace lang_proto {
 namespace {
@@ -44,6 +56,30 @@ IndexWriter OpenKzipWriterOrDie(absl::string_view path) {
   CHECK(writer.ok()) << "Failed to open KzipWriter: " << writer.status();
   return std::move(*writer);
 }
+
+/// \brief Extracts the target described by `args` and writes its unit to
+/// `kzip_writer`, or dies.
+void ExtractTarget(const std::vector<std::string>& args,
+                   ProtoExtractor* extractor, IndexWriter* kzip_writer) {
+  // Parse --proto_path and -I args into a set of path substitutions (search
+  // paths). The remaining arguments should be .proto files.
+  std::vector<std::string> proto_filenames;
+  extractor->path_substitutions.clear();
+  ::kythe::lang_proto::ParsePathSubstitutions(
+      args, &extractor->path_substitutions, &proto_filenames);
+  for (const std::string& arg : proto_filenames) {
+    CHECK(absl::EndsWith(arg, ".proto"))
+        << "Invalid arg, expected a proto file: '" << arg << "'";
+  }
+  CHECK(!proto_filenames.empty()) << "Expected 1+ .proto files.";
+
+  // Extract and save the unit.
+  proto::IndexedCompilation compilation;
+  *compilation.mutable_unit() =
+      extractor->ExtractProtos(proto_filenames, kzip_writer);
+  auto digest = kzip_writer->WriteUnit(compilation);
+  CHECK(digest.ok()) << "Error writing unit to kzip: " << digest.status();
+}
 }  // namespace
 
 int main(int argc, char* argv[]) {
@@ -56,7 +92,8 @@ Examples:
   export KYTHE_OUTPUT_FILE=foo.kzip
   proto_extractor foo.proto
   proto_extractor foo.proto bar.proto
-  proto_extractor foo.proto -- --proto_path dir/with/my/deps")");
+  proto_extractor foo.proto -- --proto_path dir/with/my/deps
+  proto_extractor --batch_file targets.txt")");
   std::vector<char*> remain = absl::ParseCommandLine(argc, argv);
   std::vector<std::string> final_args(remain.begin() + 1, remain.end());
 
@@ -69,23 +106,25 @@ Examples:
          "environment variable.";
   IndexWriter kzip_writer = OpenKzipWriterOrDie(env_output_file);
 
-  // Parse --proto_path and -I args into a set of path substitutions (search
-  // paths). The remaining arguments should be .proto files.
-  std::vector<std::string> proto_filenames;
-  ::kythe::lang_proto::ParsePathSubstitutions(
-      final_args, &extractor.path_substitutions, &proto_filenames);
-  for (const std::string& arg : proto_filenames) {
-    CHECK(absl::EndsWith(arg, ".proto"))
-        << "Invalid arg, expected a proto file: '" << arg << "'";
+  const std::string batch_file = absl::GetFlag(FLAGS_batch_file);
+  if (batch_file.empty()) {
+    ExtractTarget(final_args, &extractor, &kzip_writer);
+  } else {
+    CHECK(final_args.empty())
+        << "Arguments are read from --batch_file, not the command line.";
+    ProtoExtractionCache cache;
+    extractor.cache = &cache;
+    const std::string batch = LoadFileOrDie(batch_file);
+    for (absl::string_view line :
+         absl::StrSplit(batch, '\n', absl::SkipWhitespace())) {
+      std::vector<std::string> args =
+          absl::StrSplit(line, ' ', absl::SkipWhitespace());
+      // The command line's "--" is consumed by the flag parser; drop it here.
+      args.erase(std::remove(args.begin(), args.end(), "--"), args.end());
+      ExtractTarget(args, &extractor, &kzip_writer);
+    }
+    extractor.cache = nullptr;
   }
-  CHECK(!proto_filenames.empty()) << "Expected 1+ .proto files.";
-
-  // Extract and save kzip.
-  proto::IndexedCompilation compilation;
-  *compilation.mutable_unit() =
-      extractor.ExtractProtos(proto_filenames, &kzip_writer);
-  auto digest = kzip_writer.WriteUnit(compilation);
-  CHECK(digest.ok()) << "Error writing unit to kzip: " << digest.status();
   CHECK(kzip_writer.Close().ok());
 
   return 0;
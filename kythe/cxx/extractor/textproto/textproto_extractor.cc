@@ -26,6 +26,7 @@
 #include <string>
 #include <vector>
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
@@ -33,6 +34,9 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
 #include "glog/logging.h"
+#include "google/protobuf/compiler/importer.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
 #include "kythe/cxx/common/file_utils.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/kzip_writer.h"
@@ -47,6 +51,10 @@ ABSL_FLAG(std::string, proto_message, "",
 ABSL_FLAG(std::vector<std::string>, proto_files, {},
           "A comma-separated list of proto files needed to fully define "
           "the textproto's schema.");
+ABSL_FLAG(bool, embed_schema_descriptors, false,
+          "Compile the textproto's schema and add the resulting "
+          "FileDescriptorSet to the compilation unit's details, so that the "
+          "indexer doesn't have to compile it again.");
 
 namespace kythe {
 namespace lang_textproto {
@@ -59,6 +67,54 @@ IndexWriter OpenKzipWriterOrDie(absl::string_view path) {
   return std::move(*writer);
 }
 
+/// \brief Adds `file` to `schema` after the files it imports, unless it has
+/// been added already.
+void AddWithDependencies(const google::protobuf::FileDescriptor* file,
+                         absl::flat_hash_set<std::string>* added,
+                         google::protobuf::FileDescriptorSet* schema) {
+  if (!added->insert(file->name()).second) {
+    return;
+  }
+  for (int i = 0; i < file->dependency_count(); ++i) {
+    AddWithDependencies(file->dependency(i), added, schema);
+  }
+  file->CopyTo(schema->add_file());
+}
+
+/// \brief Compiles `proto_filenames` and returns their descriptors and those
+/// of everything they import, with each file after its imports.
+///
+/// Files are named by their paths relative to the first of
+/// `path_substitutions` that contains them, which is how the indexer names
+/// them when it compiles the schema itself. The indexer ignores the
+/// descriptors if those names don't match its inputs.
+google::protobuf::FileDescriptorSet CompileSchema(
+    const std::vector<std::string>& proto_filenames,
+    const std::vector<std::pair<std::string, std::string>>&
+        path_substitutions) {
+  google::protobuf::compiler::DiskSourceTree src_tree;
+  for (const auto& sub : path_substitutions) {
+    src_tree.MapPath(sub.first, sub.second);
+  }
+  src_tree.MapPath("", "");
+  // The proto extractor has already imported these files and reported any
+  // errors.
+  google::protobuf::compiler::Importer importer(&src_tree, nullptr);
+  google::protobuf::FileDescriptorSet schema;
+  absl::flat_hash_set<std::string> added;
+  for (const std::string& fname : proto_filenames) {
+    std::string relpath, shadow;
+    if (src_tree.DiskFileToVirtualFile(fname, &relpath, &shadow) !=
+        google::protobuf::compiler::DiskSourceTree::SUCCESS) {
+      relpath = fname;
+    }
+    const google::protobuf::FileDescriptor* file = importer.Import(relpath);
+    CHECK(file != nullptr) << "Failed to import file: " << relpath;
+    AddWithDependencies(file, &added, &schema);
+  }
+  return schema;
+}
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
@@ -159,6 +215,11 @@ Examples:
     }
   }
 
+  if (absl::GetFlag(FLAGS_embed_schema_descriptors)) {
+    compilation.mutable_unit()->add_details()->PackFrom(
+        CompileSchema(proto_filenames, proto_extractor.path_substitutions));
+  }
+
   // Add textproto file to kzip.
   {
     auto digest = kzip_writer.WriteFile(textproto);
@@ -15,9 +15,10 @@
  */
 #include "kythe/cxx/indexer/cxx/DynamicClaimClient.h"
 
-#include <libmemcached-1.0/memcached.h>
 #include <openssl/sha.h>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
 #include "absl/strings/str_format.h"
 #include "kythe/cxx/common/vname_ordering.h"
 
@@ -39,29 +40,31 @@ void HashVName(const kythe::proto::VName& vname, size_t count, Hash* hash) {
 }  // namespace
 
 DynamicClaimClient::~DynamicClaimClient() {
-  if (cache_) {
-    memcached_free(cache_);
-    cache_ = nullptr;
-  }
   absl::FPrintF(
       stderr, "%8lu  %8lu claims approved/rejected (%f reject fraction)\n",
-      request_count_ - rejected_requests_, rejected_requests_,
-      request_count_ == 0 ? 0.0 : (double)rejected_requests_ / request_count_);
+      stats_.granted, stats_.denied,
+      stats_.requested == 0 ? 0.0 : (double)stats_.denied / stats_.requested);
+  if (stats_.overclaimed != 0) {
+    absl::FPrintF(stderr, "%8lu  claims approved redundantly\n",
+                  stats_.overclaimed);
+  }
 }
 
 bool DynamicClaimClient::OpenMemcache(const std::string& spec) {
-  if (cache_) {
-    memcached_free(cache_);
-    cache_ = nullptr;
-  }
-  std::string spec_amend = spec;
-  spec_amend.append(" --BINARY-PROTOCOL");
-  cache_ = memcached(spec_amend.c_str(), spec_amend.size());
-  if (cache_ != nullptr) {
-    memcached_return_t remote_version = memcached_version(cache_);
-    return memcached_success(remote_version);
+  auto backend = absl::make_unique<MemcachedClaimBackend>();
+  if (!backend->Open(spec)) {
+    backend_ = nullptr;
+    return false;
   }
-  return false;
+  backend_ = std::move(backend);
+  return true;
+}
+
+std::string DynamicClaimClient::ClaimKey(const kythe::proto::VName& vname,
+                                         size_t tries) {
+  Hash hash;
+  HashVName(vname, tries, &hash);
+  return std::string(reinterpret_cast<const char*>(hash), sizeof(hash));
 }
 
 bool DynamicClaimClient::Claim(const kythe::proto::VName& claimant,
@@ -71,46 +74,124 @@ bool DynamicClaimClient::Claim(const kythe::proto::VName& claimant,
   // vname at any point; if not, then we assume that we own that vname.
   // If a claim exists in the cache (and isn't in the local claim_table_),
   // regardless of whether it was ours, we assume that we do not own it.
-  ++request_count_;
+  ++stats_.requested;
   const auto lookup = claim_table_.find(vname);
   if (lookup == claim_table_.end()) {
-    if (!cache_) {
+    if (!backend_) {
       // Fail open.
+      ++stats_.granted;
       return true;
     }
-    Hash claimant_hash, vname_hash;
-    HashVName(claimant, 0, &claimant_hash);
+    const std::string claimant_key = ClaimKey(claimant, 0);
+    std::vector<bool> added;
     for (size_t tries = 0; tries < max_redundant_claims_; ++tries) {
-      HashVName(vname, tries, &vname_hash);
-      memcached_return_t add_result = memcached_add(
-          cache_, reinterpret_cast<const char*>(&vname_hash),
-          SHA256_DIGEST_LENGTH, reinterpret_cast<const char*>(&claimant_hash),
-          SHA256_DIGEST_LENGTH, 0, 0);
-      if (!memcached_success(add_result) &&
-          add_result != MEMCACHED_DATA_EXISTS) {
-        // We'll also pass the check below and assume we claimed the vname.
-        absl::FPrintF(stderr, "memcached add failed: %s\n",
-                      memcached_strerror(cache_, add_result));
-      }
-      if (add_result != MEMCACHED_DATA_EXISTS) {
+      const std::string key = ClaimKey(vname, tries);
+      const absl::string_view keys[] = {key};
+      const absl::string_view values[] = {claimant_key};
+      backend_->AddKeys(keys, values, &added);
+      if (added[0]) {
         claim_table_[vname] = claimant;
+        ++stats_.granted;
+        if (tries > 0) {
+          ++stats_.overclaimed;
+        }
         return true;
       }
     }
     // We failed all our tries, so assume we couldn't make a claim.
     claim_table_[vname] = kythe::proto::VName();
-    ++rejected_requests_;
+    ++stats_.denied;
     return false;
   }
 
   if (VNameEquals(lookup->second, claimant)) {
+    ++stats_.granted;
     return true;
   } else {
-    ++rejected_requests_;
+    ++stats_.denied;
     return false;
   }
 }
 
+bool DynamicClaimClient::ClaimBatch(
+    std::vector<std::pair<std::string, bool>>* tokens) {
+  if (!backend_) {
+    return KytheClaimClient::ClaimBatch(tokens);
+  }
+  // Each token claims for itself, just as `KytheClaimClient::ClaimBatch`
+  // does through `Claim`.
+  std::vector<kythe::proto::VName> vnames;
+  vnames.reserve(tokens->size());
+  // The first index of each token; later copies share its outcome.
+  absl::flat_hash_map<absl::string_view, size_t> first_index;
+  // Indices of tokens that still need an answer from the backend.
+  std::vector<size_t> unresolved;
+  for (size_t i = 0; i < tokens->size(); ++i) {
+    vnames.push_back(TokenVName((*tokens)[i].first));
+    ++stats_.requested;
+    const auto lookup = claim_table_.find(vnames[i]);
+    if (lookup != claim_table_.end()) {
+      (*tokens)[i].second = VNameEquals(lookup->second, vnames[i]);
+    } else if (first_index.emplace((*tokens)[i].first, i).second) {
+      unresolved.push_back(i);
+    }
+  }
+  std::vector<std::string> keys;
+  std::vector<absl::string_view> key_views;
+  std::vector<std::string> values;
+  std::vector<absl::string_view> value_views;
+  for (size_t i : unresolved) {
+    values.push_back(ClaimKey(vnames[i], 0));
+  }
+  std::vector<bool> added;
+  for (size_t tries = 0; tries < max_redundant_claims_ && !unresolved.empty();
+       ++tries) {
+    keys.clear();
+    for (size_t i : unresolved) {
+      keys.push_back(ClaimKey(vnames[i], tries));
+    }
+    key_views.assign(keys.begin(), keys.end());
+    value_views.assign(values.begin(), values.end());
+    backend_->AddKeys(key_views, value_views, &added);
+    size_t still_unresolved = 0;
+    for (size_t k = 0; k < unresolved.size(); ++k) {
+      const size_t i = unresolved[k];
+      if (added[k]) {
+        claim_table_[vnames[i]] = vnames[i];
+        (*tokens)[i].second = true;
+        if (tries > 0) {
+          ++stats_.overclaimed;
+        }
+      } else {
+        values[still_unresolved] = std::move(values[k]);
+        unresolved[still_unresolved++] = i;
+      }
+    }
+    unresolved.resize(still_unresolved);
+    values.resize(still_unresolved);
+  }
+  // We failed all our tries for these, so assume we couldn't claim them.
+  for (size_t i : unresolved) {
+    claim_table_[vnames[i]] = kythe::proto::VName();
+    (*tokens)[i].second = false;
+  }
+  bool success = false;
+  for (size_t i = 0; i < tokens->size(); ++i) {
+    auto& token = (*tokens)[i];
+    const auto first = first_index.find(token.first);
+    if (first != first_index.end() && first->second != i) {
+      token.second = (*tokens)[first->second].second;
+    }
+    if (token.second) {
+      ++stats_.granted;
+    } else {
+      ++stats_.denied;
+    }
+    success |= token.second;
+  }
+  return success;
+}
+
 void DynamicClaimClient::AssignClaim(const kythe::proto::VName& claimable,
                                      const kythe::proto::VName& claimant) {
   claim_table_[claimable] = claimant;
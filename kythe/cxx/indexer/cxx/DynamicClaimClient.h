@@ -17,19 +17,22 @@
 #define DYNAMIC_CXX_INDEXER_CXX_DYNAMIC_CLAIM_CLIENT_H_
 
 #include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/strings/string_view.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
+#include "kythe/cxx/indexer/cxx/claim_backend.h"
+#include "kythe/cxx/indexer/cxx/claim_stats.h"
 #include "kythe/proto/storage.pb.h"
 
-extern "C" {
-struct memcached_st;
-}
-
 namespace kythe {
 
 /// \brief A client that makes dynamic decisions about claiming by consulting
-/// an external memcache.
+/// an external store (by default, a memcache).
 ///
 /// This client is experimental and does not guarantee that entries will not be
 /// permanently dropped.
@@ -40,9 +43,18 @@ class DynamicClaimClient : public KytheClaimClient {
   /// \brief Use a memcached instance (e.g. "--SERVER=foo:1234")
   bool OpenMemcache(const std::string& spec);
 
+  /// \brief Use `backend` to make claims.
+  void UseBackend(std::unique_ptr<ClaimBackend> backend) {
+    backend_ = std::move(backend);
+  }
+
   bool Claim(const kythe::proto::VName& claimant,
              const kythe::proto::VName& vname) override;
 
+  /// \brief Claims all `tokens` together, asking the backend about every
+  /// unresolved token at once for each redundant claim allowed.
+  bool ClaimBatch(std::vector<std::pair<std::string, bool>>* tokens) override;
+
   /// Store a local override.
   void AssignClaim(const kythe::proto::VName& claimable,
                    const kythe::proto::VName& claimant) override;
@@ -52,17 +64,22 @@ class DynamicClaimClient : public KytheClaimClient {
 
   void Reset() override { claim_table_.clear(); }
 
+  /// \brief The outcomes of every claim this client has made. `bytes` is
+  /// always zero, as the client doesn't see the output.
+  const ClaimStats& stats() const { return stats_; }
+
  private:
   /// A local map from claimables to claimants.
   std::map<kythe::proto::VName, kythe::proto::VName, VNameLess> claim_table_;
+  /// \return the backend key for the `tries`th claim on `vname`.
+  static std::string ClaimKey(const kythe::proto::VName& vname, size_t tries);
+
   /// A remote map used for dynamic queries.
-  ::memcached_st* cache_ = nullptr;
+  std::unique_ptr<ClaimBackend> backend_;
   /// The maximum number of times a VName can be claimed.
   size_t max_redundant_claims_ = 1;
-  /// The number of claim requests ever made.
-  size_t request_count_ = 0;
-  /// The number of claim requests that were rejected (after all tries).
-  size_t rejected_requests_ = 0;
+  /// The outcomes of every claim request ever made.
+  ClaimStats stats_;
 };
 
 }  // namespace kythe
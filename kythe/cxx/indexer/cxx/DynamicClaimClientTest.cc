@@ -0,0 +1,143 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/DynamicClaimClient.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/indexer/cxx/claim_backend.h"
+
+namespace kythe {
+namespace {
+
+using Tokens = std::vector<std::pair<std::string, bool>>;
+
+Tokens MakeTokens(const std::vector<std::string>& names) {
+  Tokens tokens;
+  for (const auto& name : names) {
+    tokens.emplace_back(name, true);
+  }
+  return tokens;
+}
+
+/// \brief Claims `names` as a batch; if `sequential`, one at a time.
+/// \return which of `names` were claimed.
+std::vector<bool> ClaimNames(DynamicClaimClient* client,
+                             const std::vector<std::string>& names,
+                             bool sequential) {
+  Tokens tokens = MakeTokens(names);
+  if (sequential) {
+    client->KytheClaimClient::ClaimBatch(&tokens);
+  } else {
+    client->ClaimBatch(&tokens);
+  }
+  std::vector<bool> claimed;
+  for (const auto& token : tokens) {
+    claimed.push_back(token.second);
+  }
+  return claimed;
+}
+
+TEST(DynamicClaimClientTest, BatchesMatchSequentialClaims) {
+  for (size_t max_claims : {1, 2}) {
+    std::vector<std::vector<bool>> results[2];
+    size_t round_trips[2];
+    for (bool sequential : {false, true}) {
+      DynamicClaimClient client;
+      auto backend = absl::make_unique<InMemoryClaimBackend>();
+      InMemoryClaimBackend* store = backend.get();
+      client.UseBackend(std::move(backend));
+      client.set_max_redundant_claims(max_claims);
+      auto& result = results[sequential];
+      result.push_back(ClaimNames(&client, {"b"}, sequential));
+      // Forget our own claims, as another indexer would.
+      client.Reset();
+      result.push_back(ClaimNames(&client, {"a", "b", "a", "c"}, sequential));
+      client.Reset();
+      result.push_back(ClaimNames(&client, {"a", "b", "d"}, sequential));
+      round_trips[sequential] = store->round_trips();
+    }
+    EXPECT_EQ(results[1], results[0]) << max_claims;
+    EXPECT_LT(round_trips[0], round_trips[1]) << max_claims;
+  }
+}
+
+TEST(DynamicClaimClientTest, BatchesTakeOneRoundTripPerTry) {
+  DynamicClaimClient client;
+  auto backend = absl::make_unique<InMemoryClaimBackend>();
+  InMemoryClaimBackend* store = backend.get();
+  client.UseBackend(std::move(backend));
+  client.set_max_redundant_claims(2);
+  EXPECT_EQ(std::vector<bool>({true, true}),
+            ClaimNames(&client, {"a", "b"}, false));
+  EXPECT_EQ(1, store->round_trips());
+  client.Reset();
+  EXPECT_EQ(std::vector<bool>({true, true, true}),
+            ClaimNames(&client, {"a", "b", "c"}, false));
+  EXPECT_EQ(3, store->round_trips());
+  client.Reset();
+  EXPECT_EQ(std::vector<bool>({false, false, true}),
+            ClaimNames(&client, {"a", "b", "c"}, false));
+  EXPECT_EQ(5, store->round_trips());
+}
+
+TEST(DynamicClaimClientTest, RemembersBatchClaims) {
+  DynamicClaimClient client;
+  auto backend = absl::make_unique<InMemoryClaimBackend>();
+  InMemoryClaimBackend* store = backend.get();
+  client.UseBackend(std::move(backend));
+  EXPECT_EQ(std::vector<bool>({true}), ClaimNames(&client, {"a"}, false));
+  EXPECT_EQ(std::vector<bool>({true, true}),
+            ClaimNames(&client, {"a", "b"}, false));
+  EXPECT_EQ(2, store->round_trips());
+  EXPECT_EQ(std::vector<bool>({true, true}),
+            ClaimNames(&client, {"b", "a"}, false));
+  EXPECT_EQ(2, store->round_trips());
+}
+
+TEST(DynamicClaimClientTest, CountsClaimOutcomes) {
+  for (bool sequential : {false, true}) {
+    DynamicClaimClient client;
+    client.UseBackend(absl::make_unique<InMemoryClaimBackend>());
+    client.set_max_redundant_claims(2);
+    ClaimNames(&client, {"a", "b"}, sequential);
+    client.Reset();
+    EXPECT_EQ(std::vector<bool>({true, true}),
+              ClaimNames(&client, {"a", "c"}, sequential));
+    client.Reset();
+    EXPECT_EQ(std::vector<bool>({false}),
+              ClaimNames(&client, {"a"}, sequential));
+    const ClaimStats& stats = client.stats();
+    EXPECT_EQ(5, stats.requested) << sequential;
+    EXPECT_EQ(4, stats.granted) << sequential;
+    EXPECT_EQ(1, stats.denied) << sequential;
+    EXPECT_EQ(1, stats.overclaimed) << sequential;
+  }
+}
+
+TEST(DynamicClaimClientTest, FailsOpenWithoutBackend) {
+  DynamicClaimClient client;
+  EXPECT_EQ(std::vector<bool>({true, true}),
+            ClaimNames(&client, {"a", "a"}, false));
+}
+
+}  // namespace
+}  // namespace kythe
@@ -37,6 +37,16 @@ static bool SpellingLocIsImaginary(const clang::SourceManager& SM,
   return !(PLoc.isInvalid() || strcmp(PLoc.getFilename(), "<scratch space>"));
 }
 
+/// \return true if `Filename` names a googleflags header.
+static bool IsGflagsHeader(llvm::StringRef Filename) {
+  return Filename.endswith("gflags.h") || Filename.endswith("gflags_declare.h");
+}
+
+/// \return true if `MacroName` names a macro that defines a flag.
+static bool IsFlagDefinitionMacro(llvm::StringRef MacroName) {
+  return MacroName.startswith("DEFINE_") || MacroName.startswith("ABSL_FLAG");
+}
+
 /// \brief If `Decl` is a googleflags flag, returns the range covering the flag
 /// name in the DECLARE_ or DEFINE_ macro that declared it; otherwise returns an
 /// invalid range.
@@ -50,11 +60,11 @@ static bool SpellingLocIsImaginary(const clang::SourceManager& SM,
 /// These internal references are googleflags implementation details and are
 /// uninteresting to index as high-level references to flag nodes.
 ///
-/// \param LO The LangOptions used to check the input AST.
+/// \param GO The GraphObserver for the unit that declared `Decl`.
 /// \param Decl The VarDecl that may belong to a flag.
 /// \param RefLoc If valid, the location of the reference made to Decl.
 static clang::SourceRange GetVarDeclFlagDeclLoc(
-    const clang::LangOptions& LO, const clang::VarDecl* Decl,
+    const GraphObserver& GO, const clang::VarDecl* Decl,
     clang::SourceLocation RefLoc = clang::SourceLocation()) {
   // Quickly bail out if this isn't "FLAGS_foo":
   if (!Decl->getName().startswith("FLAGS_")) {
@@ -95,9 +105,7 @@ static clang::SourceRange GetVarDeclFlagDeclLoc(
     if (!MaybeFlagsFileEntry) {
       return false;
     }
-    llvm::StringRef MaybeFlagsFilename(MaybeFlagsFileEntry->getName());
-    return MaybeFlagsFilename.endswith("gflags.h") ||
-           MaybeFlagsFilename.endswith("gflags_declare.h");
+    return IsGflagsHeader(MaybeFlagsFileEntry->getName());
   };
   auto SRBegin = Decl->getSourceRange().getBegin();
   if (!SRBegin.isValid() ||
@@ -109,56 +117,23 @@ static clang::SourceRange GetVarDeclFlagDeclLoc(
   // This VarDecl's name (which starts with FLAGS_) came from a token paste
   // that was the result of a macro that was written down in a googleflags
   // include file. The last thing we'll check is that the macro that we
-  // originally expanded was one of the DEFINE_ or DECLARE_ gflags macros.
-  bool WasInvalid = false;
-  auto FileLoc = SM.getFileLoc(Loc);
-  auto FileIdOffset = SM.getDecomposedLoc(FileLoc);
-  auto FileBuf = SM.getBufferData(FileIdOffset.first, &WasInvalid);
-  if (WasInvalid) {
-    return clang::SourceLocation();
-  }
-  auto DefTokenEnd = clang::Lexer::getLocForEndOfToken(FileLoc, 0, SM, LO);
-  if (DefTokenEnd.isInvalid()) {
+  // originally expanded was one of the DEFINE_ or DECLARE_ gflags macros. The
+  // preprocessor remembered those expansions (see `InspectsMacro`).
+  const auto* Expansion = GO.findLibraryMacroExpansion(SM.getFileLoc(Loc));
+  if (Expansion == nullptr) {
     return clang::SourceLocation();
   }
-  auto FileIdEndOffset = SM.getDecomposedLoc(DefTokenEnd);
-  if (FileIdEndOffset.first != FileIdOffset.first) {
-    // These aren't in the same file somehow?
-    return clang::SourceLocation();
-  }
-  auto DefTokText = llvm::StringRef(FileBuf.substr(
-      FileIdOffset.second, FileIdEndOffset.second - FileIdOffset.second));
-  bool IsFlagDef =
-      DefTokText.startswith("DEFINE_") || DefTokText.startswith("ABSL_FLAG");
-  if (!IsFlagDef && !DefTokText.startswith("DECLARE_")) {
-    return clang::SourceLocation();
-  }
-  if (IsFlagDef && (Decl->getDefinition() != Decl)) {
+  if (IsFlagDefinitionMacro(Expansion->MacroName) &&
+      (Decl->getDefinition() != Decl)) {
     // Reject internal declarations.
     return clang::SourceLocation();
   }
-  // Note that we still get FLAGS_foo, FLAGS_nofoo, FLAGS_nonofoo. We'll lex the
-  // `(` and `id` from `DEFINE_ttt(id` and compare with the identifier name.
-  // Only when they match will we return successfully.
-  clang::Token MaybeParen;
-  bool LexBad = clang::Lexer::getRawToken(DefTokenEnd, MaybeParen, SM, LO,
-                                          /* IgnoreWhitespace */ true);
-  if (LexBad || !MaybeParen.is(clang::tok::l_paren)) {
-    return clang::SourceLocation();
-  }
-  clang::Token MaybeFlagId;
-  LexBad = clang::Lexer::getRawToken(MaybeParen.getEndLoc(), MaybeFlagId, SM,
-                                     LO, /* IgnoreWhitespace */ true);
-  if (LexBad || !MaybeFlagId.is(clang::tok::raw_identifier)) {
-    return clang::SourceLocation();
-  }
-  auto MaybeFlagName = MaybeFlagId.getRawIdentifier();
-  if (MaybeFlagName == Decl->getName().drop_front(6 /* FLAGS_ */)) {
-    // Use this negative offset in case we skipped whitespace before the
-    // raw_identifier token.
-    return clang::SourceRange(
-        MaybeFlagId.getEndLoc().getLocWithOffset(-MaybeFlagName.size()),
-        MaybeFlagId.getEndLoc());
+  // Note that we still get FLAGS_foo, FLAGS_nofoo, FLAGS_nonofoo. We compare
+  // the `id` from `DEFINE_ttt(id` with the identifier name. Only when they
+  // match will we return successfully.
+  if (!Expansion->FirstArgument.empty() &&
+      Expansion->FirstArgument == Decl->getName().drop_front(6 /* FLAGS_ */)) {
+    return Expansion->FirstArgumentRange;
   }
   return clang::SourceLocation();
 }
@@ -171,6 +146,22 @@ static GraphObserver::NodeId NodeIdForFlag(const GraphObserver::NodeId& VarId) {
                                "google/gflag#" + VarId.getRawIdentity());
 }
 
+bool GoogleFlagsLibrarySupport::AppliesTo(
+    const clang::ASTContext& Context) const {
+  const auto& SM = Context.getSourceManager();
+  for (auto File = SM.fileinfo_begin(); File != SM.fileinfo_end(); ++File) {
+    if (IsGflagsHeader(File->first->getName())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GoogleFlagsLibrarySupport::InspectsMacro(
+    llvm::StringRef MacroName) const {
+  return IsFlagDefinitionMacro(MacroName) || MacroName.startswith("DECLARE_");
+}
+
 void GoogleFlagsLibrarySupport::InspectVariable(
     IndexerASTVisitor& V, GraphObserver::NodeId& NodeId,
     GraphObserver::NodeId& DeclBodyNodeId, const clang::VarDecl* Decl,
@@ -180,7 +171,7 @@ void GoogleFlagsLibrarySupport::InspectVariable(
     return;
   }
   GraphObserver& GO = V.getGraphObserver();
-  auto Range = GetVarDeclFlagDeclLoc(*GO.getLangOptions(), Decl);
+  auto Range = GetVarDeclFlagDeclLoc(GO, Decl);
   if (Range.isValid()) {
     auto FlagName = clang::Lexer::getSourceText(
         clang::Lexer::getAsCharRange(Range,
@@ -200,8 +191,7 @@ void GoogleFlagsLibrarySupport::InspectVariable(
       // If there are any Completions, this must be a definition.
       for (const auto& C : Compls) {
         if (const auto* NextDecl = llvm::dyn_cast<clang::VarDecl>(C.Decl)) {
-          auto NextDeclRange =
-              GetVarDeclFlagDeclLoc(*GO.getLangOptions(), NextDecl);
+          auto NextDeclRange = GetVarDeclFlagDeclLoc(GO, NextDecl);
           if (NextDeclRange.isValid()) {
             clang::FileID NextDeclFile =
                 GO.getSourceManager()->getFileID(NextDeclRange.getBegin());
@@ -228,7 +218,7 @@ void GoogleFlagsLibrarySupport::InspectDeclRef(
     // We only care about VarDecls.
     return;
   }
-  auto Range = GetVarDeclFlagDeclLoc(*GO.getLangOptions(), VD, DeclRefLocation);
+  auto Range = GetVarDeclFlagDeclLoc(GO, VD, DeclRefLocation);
   if (Range.isValid()) {
     GO.recordDeclUseLocation(Ref, NodeIdForFlag(RefId),
                              GraphObserver::Claimability::Unclaimable,
@@ -32,6 +32,14 @@ class GoogleFlagsLibrarySupport : public LibrarySupport {
  public:
   GoogleFlagsLibrarySupport() {}
 
+  /// \brief Returns true if the unit includes a gflags header. Flags are
+  /// only recognized if they were declared by one of its macros.
+  bool AppliesTo(const clang::ASTContext& Context) const override;
+
+  /// \brief Returns true for the DEFINE_, DECLARE_ and ABSL_FLAG macros, so
+  /// flags can be matched to the macros that declared them without lexing.
+  bool InspectsMacro(llvm::StringRef MacroName) const override;
+
   /// \brief Emits a google/gflag node if `Decl` is a flag.
   void InspectVariable(IndexerASTVisitor& V, GraphObserver::NodeId& DeclNodeId,
                        GraphObserver::NodeId& DeclBodyNodeId,
@@ -16,31 +16,73 @@
 
 #include "kythe/cxx/indexer/cxx/GraphObserver.h"
 
-#include <openssl/sha.h>  // for SHA256
-
-#include "absl/strings/escaping.h"
+#include "kythe/cxx/common/indexing/Murmur3Hasher.h"
 
 namespace kythe {
 
-// base64 has a 4:3 overhead and SHA256_DIGEST_LENGTH is 32. 32*4/3 = 42.66666
-constexpr size_t kSha256DigestBase64MaxEncodingLength = 43;
-
-std::string CompressString(absl::string_view InString, bool Force) {
-  if (InString.size() <= kSha256DigestBase64MaxEncodingLength && !Force) {
-    return std::string(InString);
+absl::string_view CompressString(absl::string_view InString,
+                                 char (&Buffer)[kCompressedStringSize],
+                                 bool Force) {
+  if (InString.size() <= kMaxUncompressedStringLength && !Force) {
+    return InString;
   }
-  ::SHA256_CTX Sha;
-  ::SHA256_Init(&Sha);
-  ::SHA256_Update(&Sha, reinterpret_cast<const unsigned char*>(InString.data()),
-                  InString.size());
-  std::string Hash(SHA256_DIGEST_LENGTH, '\0');
-  ::SHA256_Final(reinterpret_cast<unsigned char*>(&Hash[0]), &Sha);
-  std::string Result;
-  // Use web-safe escaping because vnames are frequently URI-encoded. This
+  Murmur3Hasher Hasher;
+  Hasher.Update(InString.data(), InString.size());
+  unsigned char Hash[Murmur3Hasher::kHashSize];
+  Hasher.Finish(Hash);
+  // Use web-safe base64 because vnames are frequently URI-encoded. This
   // doesn't include padding ('=') or the characters + or /, all of which will
   // expand to three-byte sequences in such an encoding.
-  absl::WebSafeBase64Escape(Hash, &Result);
-  return Result;
+  static constexpr char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  size_t Out = 0;
+  for (size_t In = 0; In < sizeof(Hash); In += 3) {
+    uint32_t Group = Hash[In] << 16;
+    if (In + 1 < sizeof(Hash)) {
+      Group |= Hash[In + 1] << 8;
+    }
+    if (In + 2 < sizeof(Hash)) {
+      Group |= Hash[In + 2];
+    }
+    for (int Shift = 18; Shift >= 0 && Out < kCompressedStringSize;
+         Shift -= 6) {
+      Buffer[Out++] = kAlphabet[(Group >> Shift) & 0x3f];
+    }
+  }
+  return absl::string_view(Buffer, kCompressedStringSize);
+}
+
+thread_local GraphObserver::IdentityTable*
+    GraphObserver::IdentityTable::CurrentTable = nullptr;
+
+const GraphObserver::IdentityTable::Entry* GraphObserver::IdentityTable::Intern(
+    absl::string_view Bytes) {
+  auto Found = Index.find(Bytes);
+  if (Found != Index.end()) {
+    return *Found;
+  }
+  Entries.push_back(Entry{std::string(Bytes), EntryHash()(Bytes)});
+  const Entry* Added = &Entries.back();
+  Index.insert(Added);
+  return Added;
+}
+
+const GraphObserver::IdentityTable::Entry*
+GraphObserver::IdentityTable::InternCompressed(absl::string_view Bytes) {
+  char Buffer[kCompressedStringSize];
+  return Intern(CompressString(Bytes, Buffer));
+}
+
+GraphObserver::IdentityTable* GraphObserver::IdentityTable::Current() {
+  if (CurrentTable != nullptr) {
+    return CurrentTable;
+  }
+  return Fallback();
+}
+
+GraphObserver::IdentityTable* GraphObserver::IdentityTable::Fallback() {
+  static thread_local IdentityTable Table;
+  return &Table;
 }
 
 }  // namespace kythe
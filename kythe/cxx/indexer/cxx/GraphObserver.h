@@ -20,8 +20,13 @@
 /// \file
 /// \brief Defines the class kythe::GraphObserver
 
+#include <cstdint>
+#include <deque>
 #include <string>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/hash/hash.h"
 #include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "absl/types/span.h"
@@ -31,6 +36,7 @@
 #include "clang/Lex/Preprocessor.h"
 #include "glog/logging.h"
 #include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/indexer/cxx/profile_sections.h"
 #include "llvm/ADT/APSInt.h"
 #include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/StringRef.h"
@@ -41,8 +47,26 @@ namespace kythe {
 
 // TODO(zarko): Most of the documentation for this interface belongs here.
 
+/// \brief The longest string `CompressString` leaves as it is.
+constexpr size_t kMaxUncompressedStringLength = 43;
+
+/// \brief The size of the buffer `CompressString` writes its hash into: 128
+/// bits, base64-encoded without padding.
+constexpr size_t kCompressedStringSize = 22;
+
+/// \brief A one-way hash for `InString`, written into `Buffer`.
+/// \return `InString` if it is short enough to be kept as it is and `Force`
+/// is false; otherwise a view of `Buffer`.
+absl::string_view CompressString(absl::string_view InString,
+                                 char (&Buffer)[kCompressedStringSize],
+                                 bool Force = false);
+
 /// \brief A one-way hash for `InString`.
-std::string CompressString(absl::string_view InString, bool Force = false);
+inline std::string CompressString(absl::string_view InString,
+                                  bool Force = false) {
+  char Buffer[kCompressedStringSize];
+  return std::string(CompressString(InString, Buffer, Force));
+}
 
 enum class ProfilingEvent {
   Enter,  ///< A profiling section was entered.
@@ -51,26 +75,56 @@ enum class ProfilingEvent {
 
 /// \brief A callback used to report a profiling event.
 ///
-/// Profile events have labels (formatted as lowercase strings with words
-/// separated by underscores) and event types.
+/// Profile events have labels (see `ProfileSectionName`) and event types. An
+/// empty callback reports nothing.
 using ProfilingCallback = std::function<void(const char*, ProfilingEvent)>;
 
 /// \brief Ensures that Enter events are paired with Exit events.
+///
+/// Without a callback, a block costs a test of the callback on entry and
+/// exit, plus two cycle counter reads when built with section counters (and
+/// two reads of the thread's allocation counts when also built with
+/// allocation counters).
 class ProfileBlock {
  public:
   /// \param Callback reporting callback; must outlive `ProfileBlock`
-  /// \param SectionName name for the section; must outlive `ProfileBlock`
-  ProfileBlock(const ProfilingCallback& Callback, const char* SectionName)
-      : Callback(Callback), SectionName(SectionName) {
-    Callback(SectionName, ProfilingEvent::Enter);
+  /// \param Section the section being entered
+  ProfileBlock(const ProfilingCallback& Callback, ProfileSection Section)
+      : Callback(Callback), Section(Section) {
+    if constexpr (kSectionCountersEnabled) {
+      Start = ReadCycleCounter();
+      if constexpr (kAllocationCountersEnabled) {
+        StartAllocations = ThreadAllocationCounts();
+      }
+    }
+    if (Callback) {
+      Callback(ProfileSectionName(Section), ProfilingEvent::Enter);
+    }
+  }
+  ~ProfileBlock() {
+    if (Callback) {
+      Callback(ProfileSectionName(Section), ProfilingEvent::Exit);
+    }
+    if constexpr (kSectionCountersEnabled) {
+      if constexpr (kAllocationCountersEnabled) {
+        SectionCounters::ThisThread().Add(
+            Section, ReadCycleCounter() - Start,
+            ThreadAllocationCounts() - StartAllocations);
+      } else {
+        SectionCounters::ThisThread().Add(Section, ReadCycleCounter() - Start);
+      }
+    }
   }
-  ~ProfileBlock() { Callback(SectionName, ProfilingEvent::Exit); }
 
  private:
   const ProfilingCallback& Callback;
-  const char* SectionName;
+  ProfileSection Section;
+  uint64_t Start = 0;
+  AllocationCounts StartAllocations;
 };
 
+class KytheGraphObserver;
+
 /// \brief An interface for processing elements discovered as part of a
 /// compilation unit.
 ///
@@ -92,6 +146,12 @@ class GraphObserver {
     /// \brief Returns a string representation of `Identity` stamped with this
     /// token.
     virtual std::string StampIdentity(const std::string& Identity) const = 0;
+    /// \brief Appends `StampIdentity(Identity)` to `Out`. Implementations
+    /// should override this to avoid building the stamped string separately.
+    virtual void AppendStampedIdentity(const std::string& Identity,
+                                       std::string* Out) const {
+      Out->append(StampIdentity(Identity));
+    }
     /// \brief Returns a value unique to each implementation of `ClaimToken`.
     virtual void* GetClass() const = 0;
     /// \brief Checks for equality.
@@ -105,6 +165,18 @@ class GraphObserver {
   class Delimiter {
    public:
     Delimiter(GraphObserver& Self) : S(Self) { S.Delimit(); }
+    Delimiter(GraphObserver& Self, clang::SourceLocation Loc) : S(Self) {
+      S.DelimitDecl(Loc);
+    }
+    Delimiter(GraphObserver& Self, clang::SourceLocation Loc,
+              absl::string_view Key)
+        : S(Self) {
+      if (Key.empty()) {
+        S.DelimitDecl(Loc);
+      } else {
+        S.DelimitKeyedDecl(Loc, Key);
+      }
+    }
     ~Delimiter() { S.Undelimit(); }
 
    private:
@@ -114,20 +186,143 @@ class GraphObserver {
   /// \brief Push another group onto the group stack, assigning
   /// any observations that follow to it.
   virtual void Delimit() {}
+  /// \brief Push another group onto the group stack for the observations
+  /// made while traversing a declaration at `Loc`. `Loc` is invalid for
+  /// declarations that shouldn't be attributed to any one file.
+  virtual void DelimitDecl(clang::SourceLocation Loc) { Delimit(); }
+  /// \brief Returns whether `probeGroup` can ever return true, so that
+  /// callers can skip computing keys otherwise.
+  virtual bool probesGroups() const { return false; }
+  /// \brief Checks whether the group for the declaration at `Loc` identified
+  /// by `Key` was already emitted, in which case traversing the declaration
+  /// can be skipped altogether.
+  ///
+  /// `Key` need only tell apart the declarations at `Loc`; the observer adds
+  /// where `Loc` is and what it knows about the files Clang entered before
+  /// leaving its file. It is always safe to return false here.
+  virtual bool probeGroup(clang::SourceLocation Loc, absl::string_view Key) {
+    return false;
+  }
+  /// \brief Notes that the tag first declared at `FirstDecl` has just been
+  /// defined. Only called if `probesGroups`. The files left in between may
+  /// have used the tag while it was incomplete, yet traversing them later
+  /// sees its definition.
+  virtual void noteTagCompleted(clang::SourceLocation FirstDecl) {}
+  /// \brief Like `DelimitDecl`, for the declaration that `probeGroup(Loc,
+  /// Key)` didn't find, so that later probes for it will.
+  virtual void DelimitKeyedDecl(clang::SourceLocation Loc,
+                                absl::string_view Key) {
+    DelimitDecl(Loc);
+  }
   /// \brief Pop the last group from the group stack.
   virtual void Undelimit() {}
 
+  /// \brief Interns the identity strings used by `NodeId`s.
+  ///
+  /// Each distinct identity is stored once alongside its precomputed hash, so
+  /// `NodeId`s can be copied, compared, and hashed without touching the bytes.
+  /// `NodeId`s intern into the table installed on the current thread by an
+  /// `IdentityTable::Scope`; the indexer installs one per compilation unit.
+  /// Every `NodeId` made inside a scope must be destroyed before it ends.
+  class IdentityTable {
+   public:
+    /// \brief An interned identity.
+    struct Entry {
+      std::string Bytes;  ///< The identity itself.
+      size_t Hash;        ///< The hash of `Bytes`.
+    };
+
+    /// \brief Makes `Table` the current thread's table while in scope.
+    ///
+    /// Entering an outermost `Scope` (such as the one around each unit)
+    /// clears the thread's fallback table, so NodeIds interned outside of
+    /// any `Scope` must not be used once one is entered.
+    class Scope {
+     public:
+      explicit Scope(IdentityTable* Table) : Previous(CurrentTable) {
+        if (Previous == nullptr) {
+          Fallback()->Clear();
+        }
+        CurrentTable = Table;
+      }
+      ~Scope() { CurrentTable = Previous; }
+      Scope(const Scope&) = delete;
+      Scope& operator=(const Scope&) = delete;
+
+     private:
+      IdentityTable* Previous;
+    };
+
+    IdentityTable() = default;
+    IdentityTable(const IdentityTable&) = delete;
+    IdentityTable& operator=(const IdentityTable&) = delete;
+
+    /// \brief Returns the unique entry for `Bytes`, adding it if necessary.
+    const Entry* Intern(absl::string_view Bytes);
+
+    /// \brief Returns `Intern(CompressString(Bytes))` without building an
+    /// intermediate string.
+    const Entry* InternCompressed(absl::string_view Bytes);
+
+    /// \brief Returns the number of distinct identities interned.
+    size_t size() const { return Entries.size(); }
+
+    /// \brief Returns the table for the current thread.
+    ///
+    /// Outside of any `Scope`, this is a thread-local fallback table that is
+    /// cleared whenever the thread enters an outermost `Scope`.
+    static IdentityTable* Current();
+
+   private:
+    /// \brief Returns the current thread's fallback table.
+    static IdentityTable* Fallback();
+
+    /// \brief Forgets every interned entry.
+    void Clear() {
+      Index.clear();
+      Entries.clear();
+    }
+
+    struct EntryHash {
+      using is_transparent = void;
+      size_t operator()(const Entry* E) const { return E->Hash; }
+      size_t operator()(absl::string_view S) const {
+        return absl::Hash<absl::string_view>()(S);
+      }
+    };
+    struct EntryEq {
+      using is_transparent = void;
+      static absl::string_view View(const Entry* E) { return E->Bytes; }
+      static absl::string_view View(absl::string_view S) { return S; }
+      template <typename L, typename R>
+      bool operator()(const L& LHS, const R& RHS) const {
+        return View(LHS) == View(RHS);
+      }
+    };
+
+    /// Owns the entries; a deque never moves its elements.
+    std::deque<Entry> Entries;
+    /// Indexes `Entries` by their bytes.
+    absl::flat_hash_set<const Entry*, EntryHash, EntryEq> Index;
+
+    static thread_local IdentityTable* CurrentTable;
+  };
+
   /// \brief The identifier for an object in the graph being observed.
   ///
   /// A node is identified uniquely in the graph by its `Token`, which
   /// provides evidence of its provenance (and may be used to determine whether
   /// the node should be analyzed), and its `Identity`, a string of bytes
   /// determined by the `IndexerASTHooks` and `GraphObserver` override.
+  /// Identities are interned in the current `IdentityTable`, which makes
+  /// `NodeId` a pair of pointers with a precomputed hash.
   class NodeId {
    public:
     NodeId(const ClaimToken* Token, const std::string& Identity)
-        : Token(Token), Identity(CompressString(Identity)) {}
-    NodeId(const NodeId& C) { *this = C; }
+        : Token(Token),
+          Identity(IdentityTable::Current()->InternCompressed(Identity)) {}
+    NodeId(const NodeId& C) = default;
+    NodeId& operator=(const NodeId& C) = default;
     NodeId& operator=(const NodeId* C) {
       Token = C->Token;
       Identity = C->Identity;
@@ -135,35 +330,48 @@ class GraphObserver {
     }
     static NodeId CreateUncompressed(const ClaimToken* Token,
                                      const std::string& Identity) {
-      NodeId NewId(Token, "");
-      NewId.Identity = Identity;
-      return NewId;
+      return NodeId(Token, IdentityTable::Current()->Intern(Identity));
     }
     /// \brief Returns a string representation of this `NodeId`.
-    std::string ToString() const { return Identity; }
+    std::string ToString() const { return Identity->Bytes; }
     /// \brief Returns a string reference representation of this `NodeId`'s
     /// Identity.
-    /// This `NodeId` must outlive the `StringRef`.
+    /// The `IdentityTable` this `NodeId` was interned in must outlive the
+    /// `StringRef`.
     llvm::StringRef IdentityRef() const {
-      return llvm::StringRef(Identity.data(), Identity.size());
+      return llvm::StringRef(Identity->Bytes.data(), Identity->Bytes.size());
     }
     /// \brief Returns a string representation of this `NodeId`
     /// annotated by its claim token.
     std::string ToClaimedString() const {
-      return Token->StampIdentity(Identity);
+      return Token->StampIdentity(Identity->Bytes);
     }
-    bool operator==(const NodeId& RHS) const {
-      return *Token == *RHS.Token && Identity == RHS.Identity;
+    /// \brief Appends `ToClaimedString()` to `Out`.
+    void AppendClaimedString(std::string* Out) const {
+      Token->AppendStampedIdentity(Identity->Bytes, Out);
     }
-    bool operator!=(const NodeId& RHS) const {
-      return *Token != *RHS.Token || Identity != RHS.Identity;
+    bool operator==(const NodeId& RHS) const {
+      return *Token == *RHS.Token && SameIdentity(RHS);
     }
-    const std::string& getRawIdentity() const { return Identity; }
+    bool operator!=(const NodeId& RHS) const { return !(*this == RHS); }
+    const std::string& getRawIdentity() const { return Identity->Bytes; }
     const ClaimToken* getToken() const { return Token; }
+    /// \brief Returns the precomputed hash of this `NodeId`'s identity.
+    size_t getIdentityHash() const { return Identity->Hash; }
 
    private:
+    NodeId(const ClaimToken* Token, const IdentityTable::Entry* Identity)
+        : Token(Token), Identity(Identity) {}
+    /// Identities interned in the same table are equal only if they are the
+    /// same entry; those from different tables must compare their bytes.
+    bool SameIdentity(const NodeId& RHS) const {
+      return Identity == RHS.Identity ||
+             (Identity->Hash == RHS.Identity->Hash &&
+              Identity->Bytes == RHS.Identity->Bytes);
+    }
+
     const ClaimToken* Token;
-    std::string Identity;
+    const IdentityTable::Entry* Identity;
   };
 
   /// \brief A range of source text, potentially associated with a node.
@@ -307,6 +515,12 @@ class GraphObserver {
     return getDefaultClaimToken();
   }
 
+  /// \brief Returns the claim token for type nodes that aren't decls, such
+  /// as type applications and aliases.
+  virtual const ClaimToken* getTypeClaimToken() const {
+    return getDefaultClaimToken();
+  }
+
   /// \brief Returns the `NodeId` for the builtin type or type constructor named
   /// by `Spelling`.
   ///
@@ -993,9 +1207,8 @@ class GraphObserver {
   virtual bool claimBatch(std::vector<std::pair<std::string, bool>>* pairs) {
     bool claimed = false;
     for (auto& pair : *pairs) {
-      if (claimImplicitNode(pair.first)) {
+      if ((pair.second = claimImplicitNode(pair.first))) {
         claimed = true;
-        pair.second = true;
       }
     }
     return claimed;
@@ -1010,6 +1223,16 @@ class GraphObserver {
   /// redundant output instead of dropped output).
   virtual bool claimLocation(clang::SourceLocation Loc) { return true; }
 
+  /// \brief Checks whether this `GraphObserver` should emit data for
+  /// nodes anywhere in the source text spanned by `Range`, including in
+  /// files that are included from inside it.
+  ///
+  /// \param Range The range to claim.
+  ///
+  /// It is always safe to return `true` here (as this will result in
+  /// redundant output instead of dropped output).
+  virtual bool claimSourceRange(clang::SourceRange Range) { return true; }
+
   /// \brief Checks whether this `GraphObserver` should emit data for
   /// nodes contained by some `Range`.
   ///
@@ -1078,11 +1301,46 @@ class GraphObserver {
   /// Name of the platform or build configuration to emit on anchors.
   virtual absl::string_view getBuildConfig() const { return ""; }
 
+  /// \brief The first argument of an expansion of a macro that a
+  /// `LibrarySupport` asked about (see `LibrarySupport::InspectsMacro`).
+  struct LibraryMacroExpansion {
+    /// The name of the macro that was expanded.
+    llvm::StringRef MacroName;
+    /// The first token of its first argument, if that is an identifier
+    /// spelled in a file; otherwise empty.
+    llvm::StringRef FirstArgument;
+    /// The range of `FirstArgument` (if it isn't empty).
+    clang::SourceRange FirstArgumentRange;
+  };
+
+  /// \brief Remembers an expansion whose macro name is spelled at the file
+  /// location `NameLoc`.
+  void recordLibraryMacroExpansion(clang::SourceLocation NameLoc,
+                                   const LibraryMacroExpansion& Expansion) {
+    LibraryMacroExpansions[NameLoc.getRawEncoding()] = Expansion;
+  }
+
+  /// \return the expansion remembered for the macro name spelled at the file
+  /// location `NameLoc`, or null.
+  const LibraryMacroExpansion* findLibraryMacroExpansion(
+      clang::SourceLocation NameLoc) const {
+    auto Found = LibraryMacroExpansions.find(NameLoc.getRawEncoding());
+    return Found == LibraryMacroExpansions.end() ? nullptr : &Found->second;
+  }
+
+  /// \return this observer as a `KytheGraphObserver`, or null if it is some
+  /// other kind. Callers on hot paths use this once to call the Kythe
+  /// observer directly, which lets its anchor recording be inlined.
+  virtual KytheGraphObserver* AsKytheGraphObserver() { return nullptr; }
+
  protected:
   clang::SourceManager* SourceManager = nullptr;
   clang::LangOptions* LangOptions = nullptr;
   clang::Preprocessor* Preprocessor = nullptr;
-  ProfilingCallback ReportProfileEvent = [](const char*, ProfilingEvent) {};
+  ProfilingCallback ReportProfileEvent;
+  /// Expansions of the macros library supports asked about, keyed by the raw
+  /// encoding of the file location of the macro name.
+  absl::flat_hash_map<unsigned, LibraryMacroExpansion> LibraryMacroExpansions;
 };
 
 inline GraphObserver::~GraphObserver() {}
@@ -1096,6 +1354,10 @@ class NullGraphObserver : public GraphObserver {
     std::string StampIdentity(const std::string& Identity) const override {
       return Identity;
     }
+    void AppendStampedIdentity(const std::string& Identity,
+                               std::string* Out) const override {
+      Out->append(Identity);
+    }
     void* GetClass() const override { return &NullClaimTokenClass; }
     bool operator==(const ClaimToken& RHS) const override {
       return RHS.GetClass() == GetClass();
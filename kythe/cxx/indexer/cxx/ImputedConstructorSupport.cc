@@ -149,11 +149,19 @@ ImputedConstructorSupport::ImputedConstructorSupport(
     std::function<bool(absl::string_view)> allow_constructor_name)
     : allow_constructor_name_(std::move(allow_constructor_name)) {}
 
+bool ImputedConstructorSupport::AppliesTo(
+    const clang::ASTContext& context) const {
+  return context.getLangOpts().CPlusPlus;
+}
+
 void ImputedConstructorSupport::InspectCallExpr(
     IndexerASTVisitor& visitor, const clang::CallExpr* call_expr,
     const GraphObserver::Range& range, GraphObserver::NodeId& callee_id) {
   const auto* callee = call_expr->getDirectCallee();
   if (callee == nullptr) return;
+  // Only specializations have a target type; check that before building
+  // the qualified name.
+  if (!callee->isFunctionTemplateSpecialization()) return;
 
   const auto qual_name = callee->getQualifiedNameAsString();
   if (!allow_constructor_name_(qual_name)) {
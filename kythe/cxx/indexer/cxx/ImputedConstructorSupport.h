@@ -39,6 +39,10 @@ class ImputedConstructorSupport : public LibrarySupport {
   explicit ImputedConstructorSupport(
       std::function<bool(absl::string_view)> allow_constructor_name);
 
+  /// \brief Returns true for C++ units, which are the only ones with
+  /// forwarding function templates.
+  bool AppliesTo(const clang::ASTContext& context) const override;
+
   void InspectCallExpr(IndexerASTVisitor& visitor,
                        const clang::CallExpr* call_expr,
                        const GraphObserver::Range& range,
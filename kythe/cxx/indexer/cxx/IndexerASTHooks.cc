@@ -62,6 +62,12 @@ ABSL_FLAG(bool, experimental_alias_template_instantiations, false,
           "Ignore template instantation information when generating IDs.");
 ABSL_FLAG(bool, experimental_threaded_claiming, false,
           "Defer answering claims and submit them in bulk when possible.");
+ABSL_FLAG(bool, experimental_prune_unclaimed_ranges, false,
+          "Only prune a decl if its whole source range, including the files "
+          "it includes, is unclaimed.");
+ABSL_FLAG(bool, experimental_lazy_parent_map, false,
+          "Build the parent map one top-level decl at a time, as it is needed, "
+          "rather than for the whole translation unit up front.");
 ABSL_FLAG(bool, emit_anchors_on_builtins, true,
           "Emit anchors on builtin types like int and float.");
 
@@ -389,8 +395,23 @@ class PruneCheck {
     if (!visitor_->Job->UnderneathImplicitTemplateInstantiation &&
         visitor_->declDominatesPrunableSubtree(decl)) {
       // This node in the AST dominates a subtree that can be pruned.
-      if (!visitor_->Observer.claimLocation(decl->getLocation())) {
+      if (absl::GetFlag(FLAGS_experimental_prune_unclaimed_ranges)
+              ? !visitor_->Observer.claimSourceRange(decl->getSourceRange())
+              : !visitor_->Observer.claimLocation(decl->getLocation())) {
         can_prune_ = Prunability::kImmediate;
+      } else if (visitor_->Observer.probesGroups() &&
+                 llvm::isa_and_nonnull<clang::TranslationUnitDecl>(
+                     decl->getLexicalDeclContext())) {
+        // Nothing underneath depends on code outside its file, so the group
+        // for this subtree may have been emitted by an earlier unit.
+        std::string key =
+            absl::StrCat(visitor_->BuildNodeIdForDecl(decl).getRawIdentity(),
+                         "#", visitor_->getGraphObserver().getBuildConfig());
+        if (visitor_->Observer.probeGroup(decl->getLocation(), key)) {
+          can_prune_ = Prunability::kImmediate;
+        } else {
+          group_key_ = std::move(key);
+        }
       }
       return;
     }
@@ -439,6 +460,9 @@ class PruneCheck {
 
   const std::string& cleanup_id() { return cleanup_id_; }
 
+  /// \return the key to delimit the decl's group with, or an empty string.
+  const std::string& group_key() { return group_key_; }
+
  private:
   void GenerateCleanupId(const clang::Decl* decl) {
     // TODO(zarko): Check to see if non-function members of a class
@@ -477,6 +501,7 @@ class PruneCheck {
   }
   Prunability can_prune_ = Prunability::kNone;
   std::string cleanup_id_;
+  std::string group_key_;
   IndexerASTVisitor* visitor_;
 };
 
@@ -485,9 +510,13 @@ const IndexedParentMap* IndexerASTVisitor::getAllParents() {
     // We always need to run over the whole translation unit, as
     // hasAncestor can escape any subtree.
     // TODO(zarko): Is this relavant for naming?
-    ProfileBlock block(Observer.getProfilingCallback(), "build_parent_map");
+    // (The lazy map still covers the whole unit, walking subtrees on demand.)
+    ProfileBlock block(Observer.getProfilingCallback(),
+                       ProfileSection::kBuildParentMap);
     AllParents = absl::make_unique<IndexedParentMap>(
-        IndexedParentMap::Build(Context.getTranslationUnitDecl()));
+        absl::GetFlag(FLAGS_experimental_lazy_parent_map)
+            ? IndexedParentMap::BuildLazily(Context.getTranslationUnitDecl())
+            : IndexedParentMap::Build(Context.getTranslationUnitDecl()));
   }
   return AllParents.get();
 }
@@ -516,11 +545,16 @@ bool IndexerASTVisitor::IsDefinition(const clang::VarDecl* VD) {
   return VD->isThisDeclarationADefinition() != VarDecl::DeclarationOnly;
 }
 
+const ClangRangeFinder& IndexerASTVisitor::GetRangeFinder() const {
+  if (!RangeFinder) {
+    RangeFinder.emplace(Observer.getSourceManager(), Observer.getLangOptions());
+  }
+  return *RangeFinder;
+}
+
 clang::SourceRange IndexerASTVisitor::RangeForNameOfDeclaration(
     const clang::NamedDecl* Decl) const {
-  return ClangRangeFinder(Observer.getSourceManager(),
-                          Observer.getLangOptions())
-      .RangeForNameOf(Decl);
+  return GetRangeFinder().RangeForNameOf(Decl);
 }
 
 void IndexerASTVisitor::MaybeRecordDefinitionRange(
@@ -581,6 +615,32 @@ void IndexerASTVisitor::RecordBlame(const clang::Decl* Decl,
   }
 }
 
+void IndexerASTVisitor::RecordInfluencer(const clang::Decl* Decl) {
+  if (Job->InfluenceSets.empty()) return;
+  auto& Set = Job->InfluenceSets.back();
+  Set.Influencers.insert(Decl);
+  // A bounded set is flushed as it fills up. An influencer seen again after
+  // a flush has its edges recorded twice, which the output tolerates.
+  if (InfluenceSetLimit != 0 && Set.Influencers.size() >= InfluenceSetLimit) {
+    FlushInfluences();
+  }
+}
+
+void IndexerASTVisitor::FlushInfluences() {
+  auto& Set = Job->InfluenceSets.back();
+  if (!Set.Influenced.empty()) {
+    ProfileBlock block(Observer.getProfilingCallback(),
+                       ProfileSection::kRecordDataflow);
+    for (const auto* Decl : Set.Influencers) {
+      auto Influencer = BuildNodeIdForDecl(Decl);
+      for (const auto& Influenced : Set.Influenced) {
+        Observer.recordInfluences(Influencer, Influenced);
+      }
+    }
+  }
+  Set.Influencers.clear();
+}
+
 /// An in-flight possible lookup result used to approximate qualified lookup.
 struct PossibleLookup {
   clang::LookupResult Result;
@@ -963,7 +1023,9 @@ bool IndexerASTVisitor::VisitDecl(const clang::Decl* Decl) {
     // Template instantiation can't add any documentation text.
     return true;
   }
-  const auto* CommentOrNull = Context.getRawCommentForDeclNoCache(Decl);
+  const auto* CommentOrNull = DocComments.MayHaveComment(Decl)
+                                  ? Context.getRawCommentForDeclNoCache(Decl)
+                                  : nullptr;
   if (!CommentOrNull && !Decl->hasAttrs()) {
     // Fast path: if there are no attached documentation comments or attributes,
     // bail.
@@ -1125,38 +1187,66 @@ clang::SourceLocation GetImplicitlyInstantiatedTemplateLoc(
 
 bool IndexerASTVisitor::ShouldIndex(const clang::Decl* Decl) {
   // This function effectively returns true if:
-  //   - There is no TemplateInstanceExcludePathPattern specified.
+  //   - There are no TemplateInstanceExcludePathPatterns specified.
   //   - `Decl` is not a template instantiation or specialization.
   //   - `Decl` is an explicit template instantiation or partial specialization.
   //   - `Decl` is an implicit template instantiation that appears in a
   //     concrete location (not a macro) with a path that is not matched by
-  //     TemplateInstanceExcludePathPattern.
-  if (TemplateInstanceExcludePathPattern == nullptr) {
+  //     any of TemplateInstanceExcludePathPatterns.
+  if (TemplateInstanceExcludePathPatterns == nullptr) {
     return true;
   }
   auto loc = GetImplicitlyInstantiatedTemplateLoc(Decl);
-  loc = Observer.getSourceManager()->getSpellingLoc(loc);
+  const clang::SourceManager& SM = *Observer.getSourceManager();
+  loc = SM.getSpellingLoc(loc);
   if (loc.isInvalid()) {
     return true;
   }
-  auto file = Observer.getSourceManager()->getFilename(loc);
-  if (file.empty()) {
-    return true;
+  // Many instantiations share a file, so only match each file's path once.
+  auto [it, inserted] =
+      ExcludedTemplateInstanceFiles.try_emplace(SM.getFileID(loc), false);
+  if (inserted) {
+    auto file = SM.getFilename(loc);
+    it->second = !file.empty() && TemplateInstanceExcludePathPatterns->Match(
+                                      {file.data(), file.size()});
   }
-  if (re2::RE2::FullMatch({file.data(), file.size()},
-                          *TemplateInstanceExcludePathPattern)) {
-    return false;
+  return !it->second;
+}
+
+void IndexerASTVisitor::ApplyResourceBudget() {
+  BudgetLevel Level = Budget->Check();
+  if (Level == AppliedBudgetLevel) {
+    return;
   }
-  return true;
+  AppliedBudgetLevel = Level;
+  if (Level >= BudgetLevel::kNoInstantiations) {
+    TemplateMode = BehaviorOnTemplates::SkipInstantiations;
+  }
+  if (Level >= BudgetLevel::kNoDataflow) {
+    DataflowEdges = EmitDataflowEdges::No;
+  }
+  if (Level >= BudgetLevel::kNoMarkedSource) {
+    MarkedSources.set_enabled(false);
+  }
+  LOG(WARNING) << "Unit exceeded its " << Budget->exhausted_resource()
+               << " budget; now " << DescribeBudgetLevel(Level) << ".";
 }
 
 bool IndexerASTVisitor::TraverseDecl(clang::Decl* Decl) {
   if (ShouldStopIndexing()) {
     return false;
   }
+  if (Budget != nullptr) {
+    ApplyResourceBudget();
+  }
   if (Decl == nullptr || !ShouldIndex(Decl)) {
     return true;
   }
+  if (absl::GetFlag(FLAGS_experimental_lazy_parent_map) &&
+      (Decl == Job->Decl || llvm::isa_and_nonnull<clang::TranslationUnitDecl>(
+                                Decl->getLexicalDeclContext()))) {
+    getAllParents()->NoteTraversal(Decl);
+  }
 
   auto Scope = RestoreValue(Job->PruneIncompleteFunctions);
   if (Job->PruneIncompleteFunctions) {
@@ -1166,6 +1256,7 @@ bool IndexerASTVisitor::TraverseDecl(clang::Decl* Decl) {
       }
     }
   }
+  std::string GroupKey;
   if (absl::GetFlag(FLAGS_experimental_threaded_claiming)) {
     if (Decl != Job->Decl) {
       PruneCheck Prune(this, Decl);
@@ -1178,6 +1269,7 @@ bool IndexerASTVisitor::TraverseDecl(clang::Decl* Decl) {
             Prune.cleanup_id());
         return true;
       }
+      GroupKey = Prune.group_key();
     } else {
       if (Job->SetPruneIncompleteFunctions) {
         Job->PruneIncompleteFunctions = true;
@@ -1191,8 +1283,15 @@ bool IndexerASTVisitor::TraverseDecl(clang::Decl* Decl) {
     } else if (can_prune == Prunability::kDeferIncompleteFunctions) {
       Job->PruneIncompleteFunctions = true;
     }
+    GroupKey = Prune.group_key();
   }
-  GraphObserver::Delimiter Del(Observer);
+  // Implicit instantiations depend on their point of instantiation as well
+  // as on the file holding their pattern.
+  GraphObserver::Delimiter Del(Observer,
+                               Job->UnderneathImplicitTemplateInstantiation
+                                   ? clang::SourceLocation()
+                                   : Decl->getLocation(),
+                               GroupKey);
   // For clang::FunctionDecl and all subclasses thereof push blame data.
   if (auto* FD = dyn_cast_or_null<clang::FunctionDecl>(Decl)) {
     if (unsigned BuiltinID = FD->getBuiltinID()) {
@@ -1309,9 +1408,9 @@ bool IndexerASTVisitor::VisitCXXDependentScopeMemberExpr(
           E->getQualifierLoc(), E->getMember(), E->getMemberLoc(), Root)) {
     if (auto RCC =
             ExplicitRangeInCurrentContext(NormalizeRange(E->getMemberLoc()))) {
-      Observer.recordDeclUseLocation(*RCC, *DepNodeId,
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(*RCC));
+      RecordDeclUseLocation(*RCC, *DepNodeId,
+                            GraphObserver::Claimability::Claimable,
+                            IsImplicit(*RCC));
     }
     if (E->hasExplicitTemplateArgs()) {
       if (auto ArgIds = BuildTemplateArgumentList(E->template_arguments())) {
@@ -1319,9 +1418,9 @@ bool IndexerASTVisitor::VisitCXXDependentScopeMemberExpr(
         auto StmtId = BuildNodeIdForImplicitStmt(E);
         auto Range = NormalizeRange({E->getMemberLoc(), E->getEndLoc()});
         if (auto RCC = RangeInCurrentContext(StmtId, Range)) {
-          Observer.recordDeclUseLocation(
-              RCC.value(), TappNodeId, GraphObserver::Claimability::Unclaimable,
-              IsImplicit(RCC.value()));
+          RecordDeclUseLocation(RCC.value(), TappNodeId,
+                                GraphObserver::Claimability::Unclaimable,
+                                IsImplicit(RCC.value()));
         }
       }
     }
@@ -1357,8 +1456,8 @@ bool IndexerASTVisitor::VisitMemberExpr(const clang::MemberExpr* E) {
         // We still want to link the template args.
         BuildTemplateArgumentList(E->template_arguments());
       }
-      if (DataflowEdges && !Job->InfluenceSets.empty()) {
-        Job->InfluenceSets.back().insert(FieldDecl);
+      if (DataflowEdges) {
+        RecordInfluencer(FieldDecl);
       }
     }
   }
@@ -1409,9 +1508,8 @@ bool IndexerASTVisitor::IndexConstructExpr(const clang::CXXConstructExpr* E,
         TL.getTypePtr() == E->getType()->getAsAdjusted<clang::RecordType>()) {
       if (auto RCC = ExpandedRangeInCurrentContext(TL.getSourceRange())) {
         if (auto Nodes = BuildNodeSetForType(TL.getTypePtr())) {
-          Observer.recordTypeIdSpellingLocation(*RCC, Nodes.ForReference(),
-                                                Nodes.claimability(),
-                                                IsImplicit(*RCC));
+          RecordTypeIdSpellingLocation(*RCC, Nodes.ForReference(),
+                                       Nodes.claimability(), IsImplicit(*RCC));
         }
       }
     }
@@ -1534,9 +1632,9 @@ bool IndexerASTVisitor::VisitCXXNewExpr(const clang::CXXNewExpr* E) {
     if (NewLoc.isFileID()) {
       clang::SourceRange NewRange = NormalizeRange(NewLoc);
       if (auto RCC = RangeInCurrentContext(StmtId, NewRange)) {
-        Observer.recordDeclUseLocation(RCC.value(), NewId,
-                                       GraphObserver::Claimability::Unclaimable,
-                                       IsImplicit(RCC.value()));
+        RecordDeclUseLocation(RCC.value(), NewId,
+                              GraphObserver::Claimability::Unclaimable,
+                              IsImplicit(RCC.value()));
       }
     }
   }
@@ -1565,9 +1663,8 @@ bool IndexerASTVisitor::VisitCXXPseudoDestructorExpr(
                                               E->getTildeLoc(), TyId)) {
     if (auto RCC =
             ExplicitRangeInCurrentContext(NormalizeRange(E->getTildeLoc()))) {
-      Observer.recordDeclUseLocation(*RCC, *DDId,
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(*RCC));
+      RecordDeclUseLocation(*RCC, *DDId, GraphObserver::Claimability::Claimable,
+                            IsImplicit(*RCC));
     }
     clang::SourceRange SR = NormalizeRange(E->getSourceRange());
     auto StmtId = BuildNodeIdForImplicitStmt(E);
@@ -1609,7 +1706,7 @@ bool IndexerASTVisitor::VisitCallExpr(const clang::CallExpr* E) {
     if (const auto* Callee = E->getCalleeDecl()) {
       auto CalleeId = BuildNodeIdForRefToDecl(Callee);
       RecordCallEdges(RCC.value(), CalleeId);
-      for (const auto& S : Supports) {
+      for (auto* S : ActiveSupports) {
         S->InspectCallExpr(*this, E, RCC.value(), CalleeId);
       }
     } else if (const auto* CE = E->getCallee()) {
@@ -1619,8 +1716,8 @@ bool IndexerASTVisitor::VisitCallExpr(const clang::CallExpr* E) {
     }
   }
   if (DataflowEdges) {
-    if (!Job->InfluenceSets.empty() && E->getDirectCallee() != nullptr) {
-      Job->InfluenceSets.back().insert(E->getDirectCallee());
+    if (E->getDirectCallee() != nullptr) {
+      RecordInfluencer(E->getDirectCallee());
     }
   }
   return true;
@@ -1679,7 +1776,7 @@ IndexerASTVisitor::BuildNodeIdForImplicitClassTemplateInstantiation(
 absl::optional<GraphObserver::NodeId>
 IndexerASTVisitor::BuildNodeIdForImplicitFunctionTemplateInstantiation(
     const clang::FunctionDecl* FD) {
-  std::vector<GraphObserver::NodeId> NIDS;
+  NodeIdList NIDS;
   const clang::TemplateArgumentLoc* ArgsAsWritten = nullptr;
   unsigned NumArgsAsWritten = 0;
   const clang::TemplateArgumentList* Args = nullptr;
@@ -1819,8 +1916,8 @@ void IndexerASTVisitor::AddChildOfEdgeToDeclContext(
 bool IndexerASTVisitor::VisitSizeOfPackExpr(const clang::SizeOfPackExpr* Expr) {
   if (auto RCC = ExpandedRangeInCurrentContext(Expr->getPackLoc())) {
     auto NodeId = BuildNodeIdForRefToDecl(Expr->getPack());
-    Observer.recordDeclUseLocation(
-        *RCC, NodeId, GraphObserver::Claimability::Claimable, IsImplicit(*RCC));
+    RecordDeclUseLocation(*RCC, NodeId, GraphObserver::Claimability::Claimable,
+                          IsImplicit(*RCC));
   }
   return true;
 }
@@ -1875,9 +1972,9 @@ bool IndexerASTVisitor::VisitTemplateSpecializationTypePairHelper(
           }
           return TemplateName.value();
         }();
-        Observer.recordDeclUseLocation(*RCC, DeclNode,
-                                       GraphObserver::Claimability::Claimable,
-                                       IsImplicit(*RCC));
+        RecordDeclUseLocation(*RCC, DeclNode,
+                              GraphObserver::Claimability::Claimable,
+                              IsImplicit(*RCC));
       }
     }
   }
@@ -1939,9 +2036,9 @@ bool IndexerASTVisitor::VisitDependentNameTypeLoc(
   if (auto Nodes = RecordTypeLocSpellingLocation(TL)) {
     if (auto RCC =
             ExplicitRangeInCurrentContext(NormalizeRange(TL.getNameLoc()))) {
-      Observer.recordDeclUseLocation(*RCC, Nodes.ForReference(),
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(*RCC));
+      RecordDeclUseLocation(*RCC, Nodes.ForReference(),
+                            GraphObserver::Claimability::Claimable,
+                            IsImplicit(*RCC));
     }
     if (RecordParamEdgesForDependentName(Nodes.ForReference(),
                                          TL.getQualifierLoc())) {
@@ -1962,9 +2059,8 @@ bool IndexerASTVisitor::VisitPackExpansionTypeLoc(
 bool IndexerASTVisitor::VisitObjCObjectTypeLoc(clang::ObjCObjectTypeLoc TL) {
   for (unsigned i = 0; i < TL.getNumProtocols(); ++i) {
     if (auto RCC = ExpandedRangeInCurrentContext(TL.getProtocolLoc(i))) {
-      Observer.recordDeclUseLocation(*RCC,
-                                     BuildNodeIdForDecl(TL.getProtocol(i)),
-                                     Claimability::Claimable, IsImplicit(*RCC));
+      RecordDeclUseLocation(*RCC, BuildNodeIdForDecl(TL.getProtocol(i)),
+                            Claimability::Claimable, IsImplicit(*RCC));
     }
   }
 
@@ -2095,15 +2191,13 @@ bool IndexerASTVisitor::TraverseCallExpr(clang::CallExpr* CE) {
     if (!WalkUpFromCallExpr(CE)) return false;
     if (!TraverseStmt(callee_exp)) return false;
     for (unsigned arg = 0; arg < CE->getNumArgs(); ++arg) {
-      auto scope_guard = PushScope(Job->InfluenceSets, {});
+      auto scope_guard = PushScope(
+          Job->InfluenceSets,
+          {{}, {BuildNodeIdForDecl(callee->getParamDecl(arg))}});
       if (!TraverseStmt(CE->getArg(arg))) {
         return false;
       }
-      for (const auto* decl : Job->InfluenceSets.back()) {
-        Observer.recordInfluences(
-            BuildNodeIdForDecl(decl),
-            BuildNodeIdForDecl(callee->getParamDecl(arg)));
-      }
+      FlushInfluences();
     }
     return true;
   }
@@ -2117,13 +2211,10 @@ bool IndexerASTVisitor::TraverseReturnStmt(clang::ReturnStmt* RS) {
   }
   if (auto rv = RS->getRetValue(); rv != nullptr && !Job->BlameStack.empty()) {
     if (!WalkUpFromReturnStmt(RS)) return false;
-    auto scope_guard = PushScope(Job->InfluenceSets, {});
+    auto scope_guard =
+        PushScope(Job->InfluenceSets, {{}, Job->BlameStack.back()});
     if (!TraverseStmt(rv)) return false;
-    for (const auto* decl : Job->InfluenceSets.back()) {
-      for (const auto& context : Job->BlameStack.back()) {
-        Observer.recordInfluences(BuildNodeIdForDecl(decl), context);
-      }
-    }
+    FlushInfluences();
     return true;
   }
   return Base::TraverseReturnStmt(RS);
@@ -2133,14 +2224,12 @@ bool IndexerASTVisitor::TraverseVarDecl(clang::VarDecl* Decl) {
   if (!DataflowEdges) {
     return Base::TraverseVarDecl(Decl);
   }
-  auto scope_guard = PushScope(Job->InfluenceSets, {});
+  auto scope_guard =
+      PushScope(Job->InfluenceSets, {{}, {BuildNodeIdForDecl(Decl)}});
   if (!Base::TraverseVarDecl(Decl)) {
     return false;
   }
-  auto node = BuildNodeIdForDecl(Decl);
-  for (const auto* decl : Job->InfluenceSets.back()) {
-    Observer.recordInfluences(BuildNodeIdForDecl(decl), node);
-  }
+  FlushInfluences();
   return true;
 }
 
@@ -2148,16 +2237,14 @@ bool IndexerASTVisitor::TraverseFieldDecl(clang::FieldDecl* Decl) {
   if (!DataflowEdges) {
     return Base::TraverseFieldDecl(Decl);
   }
-  auto scope_guard = PushScope(Job->InfluenceSets, {});
+  auto scope_guard =
+      PushScope(Job->InfluenceSets, {{}, {BuildNodeIdForDecl(Decl)}});
   // Note that this will report a field's bitfield width as influencing that
   // field.
   if (!Base::TraverseFieldDecl(Decl)) {
     return false;
   }
-  auto node = BuildNodeIdForDecl(Decl);
-  for (const auto* decl : Job->InfluenceSets.back()) {
-    Observer.recordInfluences(BuildNodeIdForDecl(decl), node);
-  }
+  FlushInfluences();
   return true;
 }
 
@@ -2172,16 +2259,15 @@ bool IndexerASTVisitor::TraverseBinaryOperator(clang::BinaryOperator* BO) {
       lhs != nullptr && rhs != nullptr) {
     if (!WalkUpFromBinaryOperator(BO)) return false;
     if (!TraverseStmt(lhs)) return false;
-    auto scope_guard = PushScope(Job->InfluenceSets, {});
+    IndexJob::InfluenceSet influence;
+    if (auto* influenced = GetInfluencedDeclFromLExpression(lhs)) {
+      influence.Influenced.push_back(BuildNodeIdForDecl(influenced));
+    }
+    auto scope_guard = PushScope(Job->InfluenceSets, std::move(influence));
     if (!TraverseStmt(rhs)) {
       return false;
     }
-    if (auto* influenced = GetInfluencedDeclFromLExpression(lhs)) {
-      for (const auto* decl : Job->InfluenceSets.back()) {
-        Observer.recordInfluences(BuildNodeIdForDecl(decl),
-                                  BuildNodeIdForDecl(influenced));
-      }
-    }
+    FlushInfluences();
     return true;
   }
   return Base::TraverseBinaryOperator(BO);
@@ -2224,8 +2310,8 @@ NodeSet IndexerASTVisitor::RecordTypeLocSpellingLocation(
     clang::TypeLoc Written, const clang::Type* Resolved) {
   if (auto RCC = ExpandedRangeInCurrentContext(Written.getSourceRange())) {
     if (auto Nodes = BuildNodeSetForType(Resolved)) {
-      Observer.recordTypeSpellingLocation(
-          *RCC, Nodes.ForReference(), Nodes.claimability(), IsImplicit(*RCC));
+      RecordTypeSpellingLocation(*RCC, Nodes.ForReference(),
+                                 Nodes.claimability(), IsImplicit(*RCC));
       return Nodes;
     }
   }
@@ -2246,9 +2332,9 @@ bool IndexerASTVisitor::TraverseDeclarationNameInfo(
                 TSI->getTypeLoc().getSourceRange())) {
           if (auto Nodes =
                   BuildNodeSetForType(TSI->getTypeLoc().getTypePtr())) {
-            Observer.recordTypeIdSpellingLocation(*RCC, Nodes.ForReference(),
-                                                  Nodes.claimability(),
-                                                  IsImplicit(*RCC));
+            RecordTypeIdSpellingLocation(*RCC, Nodes.ForReference(),
+                                         Nodes.claimability(),
+                                         IsImplicit(*RCC));
           }
         }
         return true;
@@ -2289,16 +2375,15 @@ bool IndexerASTVisitor::VisitDeclRefOrIvarRefExpr(
                           ? GraphObserver::UseKind::kWrite
                           : GraphObserver::UseKind::kUnknown;
       if (DataflowEdges) {
-        if (!Job->InfluenceSets.empty() &&
-            (FoundDecl->getKind() == clang::Decl::Kind::Var ||
-             FoundDecl->getKind() == clang::Decl::Kind::ParmVar)) {
-          Job->InfluenceSets.back().insert(FoundDecl);
+        if (FoundDecl->getKind() == clang::Decl::Kind::Var ||
+            FoundDecl->getKind() == clang::Decl::Kind::ParmVar) {
+          RecordInfluencer(FoundDecl);
         }
       }
       Observer.recordSemanticDeclUseLocation(
           *RCC, DeclId, semantic, GraphObserver::Claimability::Unclaimable,
           this->IsImplicit(*RCC));
-      for (const auto& S : Supports) {
+      for (auto* S : ActiveSupports) {
         S->InspectDeclRef(*this, SL, *RCC, DeclId, FoundDecl);
       }
     }
@@ -2306,9 +2391,9 @@ bool IndexerASTVisitor::VisitDeclRefOrIvarRefExpr(
   return true;
 }
 
-absl::optional<std::vector<GraphObserver::NodeId>>
-IndexerASTVisitor::BuildTemplateArgumentList(ArrayRef<TemplateArgument> Args) {
-  std::vector<NodeId> result;
+absl::optional<NodeIdList> IndexerASTVisitor::BuildTemplateArgumentList(
+    ArrayRef<TemplateArgument> Args) {
+  NodeIdList result;
   result.reserve(Args.size());
   for (const auto& Arg : Args) {
     if (auto ArgId = BuildNodeIdForTemplateArgument(Arg)) {
@@ -2320,10 +2405,9 @@ IndexerASTVisitor::BuildTemplateArgumentList(ArrayRef<TemplateArgument> Args) {
   return result;
 }
 
-absl::optional<std::vector<GraphObserver::NodeId>>
-IndexerASTVisitor::BuildTemplateArgumentList(
+absl::optional<NodeIdList> IndexerASTVisitor::BuildTemplateArgumentList(
     ArrayRef<TemplateArgumentLoc> Args) {
-  std::vector<NodeId> result;
+  NodeIdList result;
   result.reserve(Args.size());
   for (const auto& ArgLoc : Args) {
     if (auto ArgId = BuildNodeIdForTemplateArgument(ArgLoc)) {
@@ -2429,7 +2513,7 @@ bool IndexerASTVisitor::VisitVarDecl(const clang::VarDecl* Decl) {
         BodyDeclNode, GraphObserver::Completeness::Incomplete,
         GraphObserver::VariableSubkind::None, absl::nullopt);
     Observer.recordMarkedSource(DeclNode, Marks.GenerateMarkedSource(DeclNode));
-    for (const auto& S : Supports) {
+    for (auto* S : ActiveSupports) {
       S->InspectVariable(*this, DeclNode, BodyDeclNode, Decl,
                          GraphObserver::Completeness::Incomplete, Completions);
     }
@@ -2468,7 +2552,7 @@ bool IndexerASTVisitor::VisitVarDecl(const clang::VarDecl* Decl) {
       BodyDeclNode, GraphObserver::Completeness::Definition,
       GraphObserver::VariableSubkind::None, absl::nullopt);
   Observer.recordMarkedSource(DeclNode, Marks.GenerateMarkedSource(DeclNode));
-  for (const auto& S : Supports) {
+  for (auto* S : ActiveSupports) {
     S->InspectVariable(*this, DeclNode, BodyDeclNode, Decl,
                        GraphObserver::Completeness::Definition, Completions);
   }
@@ -2483,9 +2567,9 @@ bool IndexerASTVisitor::VisitNamespaceDecl(const clang::NamespaceDecl* Decl) {
   // Namespaces are never defined; they are only invoked.
   if (auto RCC =
           RangeInCurrentContext(Decl->isImplicit(), DeclNode, NameRange)) {
-    Observer.recordDeclUseLocation(RCC.value(), DeclNode,
-                                   GraphObserver::Claimability::Unclaimable,
-                                   IsImplicit(RCC.value()));
+    RecordDeclUseLocation(RCC.value(), DeclNode,
+                          GraphObserver::Claimability::Unclaimable,
+                          IsImplicit(RCC.value()));
   }
   Observer.recordNamespaceNode(DeclNode, Marks.GenerateMarkedSource(DeclNode));
   AddChildOfEdgeToDeclContext(Decl, DeclNode);
@@ -2812,9 +2896,7 @@ IndexerASTVisitor::ExpandedRangeInCurrentContext(clang::SourceRange SR) {
 
 clang::SourceRange IndexerASTVisitor::NormalizeRange(
     clang::SourceRange SR) const {
-  return ClangRangeFinder(Observer.getSourceManager(),
-                          Observer.getLangOptions())
-      .NormalizeRange(SR);
+  return GetRangeFinder().NormalizeRange(SR);
 }
 
 absl::optional<GraphObserver::Range> IndexerASTVisitor::RangeInCurrentContext(
@@ -3120,7 +3202,7 @@ bool IndexerASTVisitor::VisitFunctionDecl(clang::FunctionDecl* Decl) {
                      IsImplicit);
   if (ArgsAsWritten || Args) {
     bool CouldGetAllTypes = true;
-    std::vector<GraphObserver::NodeId> NIDS;
+    NodeIdList NIDS;
     if (ArgsAsWritten) {
       NIDS.reserve(NumArgsAsWritten);
       for (unsigned I = 0; I < NumArgsAsWritten; ++I) {
@@ -3270,9 +3352,9 @@ bool IndexerASTVisitor::VisitFunctionDecl(clang::FunctionDecl* Decl) {
           }
           if (auto RCC = ExplicitRangeInCurrentContext(MemberSR)) {
             const auto& ID = BuildNodeIdForRefToDecl(M);
-            Observer.recordDeclUseLocation(
-                RCC.value(), ID, GraphObserver::Claimability::Claimable,
-                this->IsImplicit(RCC.value()));
+            RecordDeclUseLocation(RCC.value(), ID,
+                                  GraphObserver::Claimability::Claimable,
+                                  this->IsImplicit(RCC.value()));
           }
         }
       }
@@ -3459,9 +3541,10 @@ bool IndexerASTVisitor::VisitUsingShadowDecl(
     const clang::UsingShadowDecl* Decl) {
   if (auto RCC =
           ExplicitRangeInCurrentContext(RangeForNameOfDeclaration(Decl))) {
-    Observer.recordDeclUseLocation(
-        RCC.value(), BuildNodeIdForDecl(Decl->getTargetDecl()),
-        GraphObserver::Claimability::Claimable, IsImplicit(RCC.value()));
+    RecordDeclUseLocation(RCC.value(),
+                          BuildNodeIdForDecl(Decl->getTargetDecl()),
+                          GraphObserver::Claimability::Claimable,
+                          IsImplicit(RCC.value()));
   }
   return true;
 }
@@ -3583,9 +3666,16 @@ void IndexerASTVisitor::AssignUSR(const GraphObserver::NodeId& TargetNode,
   if (UsrByteSize <= 0 || Job->UnderneathImplicitTemplateInstantiation) return;
   const auto* DC = ND->getDeclContext();
   if (DC->isFunctionOrMethod()) return;
-  llvm::SmallString<128> Usr;
-  if (clang::index::generateUSRForDecl(ND, Usr)) return;
-  Observer.assignUsr(TargetNode, Usr, UsrByteSize);
+  auto [It, Inserted] =
+      CanonicalDeclUsrs.try_emplace(ND->getCanonicalDecl(), std::string());
+  if (Inserted) {
+    llvm::SmallString<128> Usr;
+    if (!clang::index::generateUSRForDecl(ND, Usr)) {
+      It->second = std::string(Usr.str());
+    }
+  }
+  if (It->second.empty()) return;
+  Observer.assignUsr(TargetNode, It->second, UsrByteSize);
 }
 
 GraphObserver::NameId IndexerASTVisitor::BuildNameIdForDecl(
@@ -3677,8 +3767,9 @@ GraphObserver::NameId IndexerASTVisitor::BuildNameIdForDecl(
 GraphObserver::NodeId IndexerASTVisitor::BuildNodeIdForDecl(
     const clang::Decl* Decl, unsigned Index) {
   GraphObserver::NodeId BaseId(BuildNodeIdForDecl(Decl));
-  return GraphObserver::NodeId(
-      BaseId.getToken(), BaseId.getRawIdentity() + "." + std::to_string(Index));
+  auto Identity = IdentityScratch.Acquire();
+  absl::StrAppend(Identity.get(), BaseId.getRawIdentity(), ".", Index);
+  return GraphObserver::NodeId(BaseId.getToken(), *Identity);
 }
 
 absl::optional<GraphObserver::NodeId>
@@ -3691,14 +3782,12 @@ IndexerASTVisitor::BuildNodeIdForImplicitStmt(const clang::Stmt* Stmt) {
   if (const clang::Decl* Decl =
           FindImplicitDeclForStmt(getAllParents(), Stmt, &StmtPath)) {
     auto DeclId = BuildNodeIdForDecl(Decl);
-    std::string NewIdent = DeclId.getRawIdentity();
-    {
-      llvm::raw_string_ostream Ostream(NewIdent);
-      for (auto& node : StmtPath) {
-        Ostream << node << ".";
-      }
+    auto NewIdent = IdentityScratch.Acquire();
+    NewIdent->append(DeclId.getRawIdentity());
+    for (auto& node : StmtPath) {
+      absl::StrAppend(NewIdent.get(), node, ".");
     }
-    return GraphObserver::NodeId(DeclId.getToken(), NewIdent);
+    return GraphObserver::NodeId(DeclId.getToken(), *NewIdent);
   }
   return absl::nullopt;
 }
@@ -3729,8 +3818,10 @@ GraphObserver::NodeId IndexerASTVisitor::BuildNodeIdForDecl(
     return Cached->second;
   }
   const auto* Token = Observer.getClaimTokenForLocation(Decl->getLocation());
-  std::string Identity;
-  llvm::raw_string_ostream Ostream(Identity);
+  // Decls' identities can include those of other decls, so each call needs
+  // its own buffer.
+  auto Identity = IdentityScratch.Acquire();
+  llvm::raw_string_ostream Ostream(*Identity);
   Ostream << BuildNameIdForDecl(Decl);
 
   // First, check to see if this thing is a builtin Decl. These things can
@@ -4027,9 +4118,8 @@ bool IndexerASTVisitor::TraverseNestedNameSpecifierLoc(
           NNS.getPrefix().getNestedNameSpecifier(),
           NNS.getNestedNameSpecifier()->getAsIdentifier());
       if (auto RCC = ExplicitRangeInCurrentContext(NNS.getLocalSourceRange())) {
-        Observer.recordDeclUseLocation(*RCC, DId,
-                                       GraphObserver::Claimability::Claimable,
-                                       IsImplicit(*RCC));
+        RecordDeclUseLocation(*RCC, DId, GraphObserver::Claimability::Claimable,
+                              IsImplicit(*RCC));
       }
     } break;
     default:
@@ -4228,9 +4318,9 @@ absl::optional<GraphObserver::NodeId> IndexerASTVisitor::BuildNodeIdForExpr(
       Observer.recordDefinitionBindingRange(RCC.value(), ResultId);
       Observer.recordLookupNode(ResultId, TOstream.str());
     } else {
-      Observer.recordDeclUseLocation(RCC.value(), ResultId,
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(RCC.value()));
+      RecordDeclUseLocation(RCC.value(), ResultId,
+                            GraphObserver::Claimability::Claimable,
+                            IsImplicit(RCC.value()));
     }
   }
   return ResultId;
@@ -4263,7 +4353,7 @@ IndexerASTVisitor::BuildNodeIdForTemplateArgument(
       CHECK(Arg.getAsExpr() != nullptr);
       return BuildNodeIdForExpr(Arg.getAsExpr(), EmitRanges::Yes);
     case TemplateArgument::Pack: {
-      std::vector<GraphObserver::NodeId> Nodes;
+      NodeIdList Nodes;
       Nodes.reserve(Arg.pack_size());
       for (const auto& Element : Arg.pack_elements()) {
         auto Id = BuildNodeIdForTemplateArgument(Element);
@@ -4319,7 +4409,7 @@ NodeSet IndexerASTVisitor::BuildNodeSetForRecord(const clang::RecordType& T) {
   if (const auto* Spec = dyn_cast<ClassTemplateSpecializationDecl>(Decl)) {
     // TODO(shahms): Simplify building template argument lists.
     const auto& TAL = Spec->getTemplateArgs();
-    std::vector<GraphObserver::NodeId> TemplateArgs;
+    NodeIdList TemplateArgs;
     TemplateArgs.reserve(TAL.size());
     for (const auto& Arg : TAL.asArray()) {
       if (auto ArgA = BuildNodeIdForTemplateArgument(Arg)) {
@@ -4464,7 +4554,7 @@ NodeSet IndexerASTVisitor::BuildNodeSetForDependentExtInt(
 
 NodeSet IndexerASTVisitor::BuildNodeSetForFunctionProto(
     const clang::FunctionProtoType& T) {
-  std::vector<GraphObserver::NodeId> NodeIds;
+  NodeIdList NodeIds;
   auto ReturnType = BuildNodeIdForType(T.getReturnType());
   if (!ReturnType) {
     return NodeSet::Empty();
@@ -4539,7 +4629,7 @@ NodeSet IndexerASTVisitor::BuildNodeSetForTemplateSpecialization(
   // or template template parameter. Non-dependent template
   // specializations appear as different types.
   if (auto TemplateName = BuildNodeIdForTemplateName(T.getTemplateName())) {
-    std::vector<GraphObserver::NodeId> TemplateArgs;
+    NodeIdList TemplateArgs;
     TemplateArgs.reserve(T.getNumArgs());
     for (const auto& arg : T.template_arguments()) {
       if (auto ArgId = BuildNodeIdForTemplateArgument(arg)) {
@@ -4608,7 +4698,7 @@ NodeSet IndexerASTVisitor::BuildNodeSetForObjCInterface(
   // Link to the implementation if we have one, otherwise link to the
   // interface. If we just have a forward declaration, link to the nominal
   // type node.
-  if (const auto* Impl = IFace->getImplementation()) {
+  if (const auto* Impl = FindObjCImplementation(IFace)) {
     return {BuildNodeIdForDecl(Impl), Claimability::Unclaimable};
   } else if (!IsObjCForwardDecl(IFace)) {
     return {BuildNodeIdForDecl(IFace), Claimability::Unclaimable};
@@ -4717,11 +4807,205 @@ NodeSet IndexerASTVisitor::BuildNodeSetForType(const clang::QualType& QT) {
   TypeKey Key(Context, QT, QT.getTypePtr());
   auto [iter, inserted] = TypeNodes.insert({Key, NodeSet::Empty()});
   if (inserted) {
-    iter->second = QT.hasLocalQualifiers()
+    ProfileBlock block(Observer.getProfilingCallback(),
+                       ProfileSection::kBuildType);
+    if (SharedTypeNodes != nullptr) {
+      iter->second = BuildNodeSetForTypeUsingCache(QT);
+    } else {
+      iter->second = QT.hasLocalQualifiers()
+                         ? BuildNodeSetForTypeInternal(QT)
+                         : BuildNodeSetForTypeInternal(*QT.getTypePtr());
+    }
+  }
+  return iter->second;
+}
+
+namespace {
+/// \brief Appends `Tag` and the claimed identity of `Id` to `Description`.
+void AppendDescribedNode(absl::string_view Tag, const NodeId& Id,
+                         std::string* Description) {
+  std::string Claimed = Id.ToClaimedString();
+  absl::StrAppend(Description, Tag, Claimed.size(), ":", Claimed);
+}
+}  // anonymous namespace
+
+NodeSet IndexerASTVisitor::BuildNodeSetForTypeUsingCache(
+    const clang::QualType& QT) {
+  std::string Description;
+  if (!AppendTypeDescription(QT, &Description)) {
+    return QT.hasLocalQualifiers()
+               ? BuildNodeSetForTypeInternal(QT)
+               : BuildNodeSetForTypeInternal(*QT.getTypePtr());
+  }
+  const GraphObserver::ClaimToken* Token = Observer.getTypeClaimToken();
+  auto Key = TypeNodeCache::Key(Description);
+  if (auto Entry = SharedTypeNodes->Find(Key)) {
+    return {NodeId::CreateUncompressed(Token, Entry->identity),
+            Entry->claimable ? Claimability::Claimable
+                             : Claimability::Unclaimable};
+  }
+  NodeSet Result = QT.hasLocalQualifiers()
                        ? BuildNodeSetForTypeInternal(QT)
                        : BuildNodeSetForTypeInternal(*QT.getTypePtr());
+  // Nodes with a separate node for references can't be rebuilt from a
+  // single identity, and nodes claimed by a file aren't shared between units.
+  if (Result && Result->getToken() == Token &&
+      &Result.ForReference() == &Result.value()) {
+    SharedTypeNodes->Insert(
+        Key, {Result->getRawIdentity(),
+              Result.claimability() == Claimability::Claimable});
+  }
+  return Result;
+}
+
+bool IndexerASTVisitor::AppendTypeDescription(const clang::QualType& QT,
+                                              std::string* Description) {
+  if (QT.isNull() || QT.hasLocalNonFastQualifiers()) {
+    return false;
+  }
+  if (QT.hasLocalQualifiers()) {
+    absl::StrAppend(Description, "q", QT.getLocalFastQualifiers());
+  }
+  const clang::Type& T = *QT.getTypePtr();
+  switch (T.getTypeClass()) {
+    case clang::Type::Builtin:
+      absl::StrAppend(
+          Description, "b",
+          clang::cast<BuiltinType>(T)
+              .getName(clang::PrintingPolicy(*Observer.getLangOptions()))
+              .str(),
+          ";");
+      return true;
+    case clang::Type::Pointer:
+      Description->append("p");
+      return AppendTypeDescription(
+          clang::cast<PointerType>(T).getPointeeType(), Description);
+    case clang::Type::LValueReference:
+      Description->append("l");
+      return AppendTypeDescription(
+          clang::cast<LValueReferenceType>(T).getPointeeType(), Description);
+    case clang::Type::RValueReference:
+      Description->append("r");
+      return AppendTypeDescription(
+          clang::cast<RValueReferenceType>(T).getPointeeType(), Description);
+    case clang::Type::Paren:
+      return AppendTypeDescription(clang::cast<ParenType>(T).getInnerType(),
+                                   Description);
+    case clang::Type::Elaborated:
+      return AppendTypeDescription(
+          clang::cast<ElaboratedType>(T).getNamedType(), Description);
+    case clang::Type::SubstTemplateTypeParm:
+      return AppendTypeDescription(
+          clang::cast<SubstTemplateTypeParmType>(T).getReplacementType(),
+          Description);
+    case clang::Type::Typedef: {
+      const auto* Decl = clang::cast<TypedefType>(T).getDecl();
+      AppendDescribedNode("t", BuildNodeIdForDecl(Decl), Description);
+      absl::StrAppend(Description, BuildNameIdForDecl(Decl).ToString(), ";");
+      return AppendTypeDescription(Decl->getUnderlyingType(), Description);
+    }
+    case clang::Type::Enum: {
+      const EnumDecl* Decl = clang::cast<EnumType>(T).getDecl();
+      if (const EnumDecl* Defn = Decl->getDefinition()) {
+        AppendDescribedNode("E", BuildNodeIdForDecl(Defn), Description);
+      } else {
+        AppendDescribedNode("e", BuildNodeIdForDecl(Decl), Description);
+      }
+      return true;
+    }
+    case clang::Type::Record:
+    case clang::Type::InjectedClassName: {
+      const RecordDecl* Decl =
+          T.getTypeClass() == clang::Type::Record
+              ? clang::cast<RecordType>(T).getDecl()
+              : clang::cast<InjectedClassNameType>(T).getDecl();
+      if (const auto* Spec = dyn_cast<ClassTemplateSpecializationDecl>(Decl);
+          Spec != nullptr && T.getTypeClass() == clang::Type::Record) {
+        const auto* SpecDecl = Spec->getSpecializedTemplate();
+        AppendDescribedNode(
+            SpecDecl->getTemplatedDecl()->getDefinition() ? "S" : "s",
+            BuildNodeIdForDecl(SpecDecl), Description);
+        for (const auto& Arg : Spec->getTemplateArgs().asArray()) {
+          if (!AppendTemplateArgumentDescription(Arg, Description)) {
+            return false;
+          }
+        }
+        Description->append(";");
+        return true;
+      }
+      if (const RecordDecl* Defn = Decl->getDefinition()) {
+        const auto* RD = dyn_cast<CXXRecordDecl>(Defn);
+        if (const auto* CTD =
+                RD != nullptr ? RD->getDescribedClassTemplate() : nullptr) {
+          AppendDescribedNode("C", BuildNodeIdForDecl(CTD), Description);
+        } else {
+          AppendDescribedNode("D", BuildNodeIdForDecl(Defn), Description);
+        }
+      } else {
+        AppendDescribedNode(Decl->isEmbeddedInDeclarator() ? "n" : "d",
+                            BuildNodeIdForDecl(Decl), Description);
+      }
+      return true;
+    }
+    case clang::Type::TemplateSpecialization: {
+      const auto& TST = clang::cast<TemplateSpecializationType>(T);
+      const TemplateName& Name = TST.getTemplateName();
+      if (Name.getKind() != TemplateName::Template) {
+        return false;
+      }
+      const auto* TD = dyn_cast<ClassTemplateDecl>(Name.getAsTemplateDecl());
+      const clang::Type* TDType =
+          TD != nullptr ? TD->getTemplatedDecl()->getTypeForDecl() : nullptr;
+      if (TDType == nullptr) {
+        return false;
+      }
+      Description->append("T");
+      if (!AppendTypeDescription(clang::QualType(TDType, 0), Description)) {
+        return false;
+      }
+      for (const auto& Arg : TST.template_arguments()) {
+        if (!AppendTemplateArgumentDescription(Arg, Description)) {
+          return false;
+        }
+      }
+      Description->append(";");
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+bool IndexerASTVisitor::AppendTemplateArgumentDescription(
+    const clang::TemplateArgument& Arg, std::string* Description) {
+  switch (Arg.getKind()) {
+    case TemplateArgument::Null:
+      Description->append("0");
+      return true;
+    case TemplateArgument::NullPtr:
+      Description->append("N");
+      return true;
+    case TemplateArgument::Type:
+      return AppendTypeDescription(Arg.getAsType(), Description);
+    case TemplateArgument::Declaration:
+      AppendDescribedNode("a", BuildNodeIdForDecl(Arg.getAsDecl()),
+                          Description);
+      return true;
+    case TemplateArgument::Integral:
+      absl::StrAppend(Description, "i", Arg.getAsIntegral().toString(10), ";");
+      return true;
+    case TemplateArgument::Pack:
+      Description->append("P");
+      for (const auto& Element : Arg.pack_elements()) {
+        if (!AppendTemplateArgumentDescription(Element, Description)) {
+          return false;
+        }
+      }
+      Description->append(";");
+      return true;
+    default:
+      return false;
   }
-  return iter->second;
 }
 
 NodeSet IndexerASTVisitor::BuildNodeSetForTypeInternal(
@@ -4869,8 +5153,12 @@ GraphObserver::NodeId IndexerASTVisitor::BuildNodeIdForObjCProtocols(
 
 // Base case where we don't have a separate BaseType to contend with
 // (BaseType is just an `id` node).
-std::vector<GraphObserver::NodeId>
+const std::vector<GraphObserver::NodeId>&
 IndexerASTVisitor::BuildNodeIdsForObjCProtocols(const ObjCObjectType& T) {
+  auto Found = ObjCProtocolIds.find(&T);
+  if (Found != ObjCProtocolIds.end()) {
+    return Found->second;
+  }
   // Use a multimap since it is sorted by key and we want our nodes sorted by
   // their (uncompressed) name. We want the items sorted by the original class
   // name because the user should be able to write down a union type
@@ -4885,14 +5173,18 @@ IndexerASTVisitor::BuildNodeIdsForObjCProtocols(const ObjCObjectType& T) {
   for (const auto& PN : ProtocolNodes) {
     ProtocolIds.push_back(PN.second);
   }
-  return ProtocolIds;
+  return ObjCProtocolIds.try_emplace(&T, std::move(ProtocolIds))
+      .first->second;
 }
 
 std::vector<GraphObserver::NodeId>
 IndexerASTVisitor::BuildNodeIdsForObjCProtocols(GraphObserver::NodeId BaseType,
                                                 const ObjCObjectType& T) {
-  auto ProtocolIds = BuildNodeIdsForObjCProtocols(T);
-  ProtocolIds.insert(ProtocolIds.begin(), BaseType);
+  const auto& Protocols = BuildNodeIdsForObjCProtocols(T);
+  std::vector<GraphObserver::NodeId> ProtocolIds;
+  ProtocolIds.reserve(Protocols.size() + 1);
+  ProtocolIds.push_back(BaseType);
+  ProtocolIds.insert(ProtocolIds.end(), Protocols.begin(), Protocols.end());
   return ProtocolIds;
 }
 
@@ -4943,9 +5235,9 @@ bool IndexerASTVisitor::VisitObjCCompatibleAliasDecl(
     if (const auto& ERCC = ExplicitRangeInCurrentContext(clang::SourceRange(
             OrigClass->getLocation(), OrigClass->getEndLoc()))) {
       const auto& ID = BuildNodeIdForDecl(Decl->getClassInterface());
-      Observer.recordDeclUseLocation(ERCC.value(), ID,
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(ERCC.value()));
+      RecordDeclUseLocation(ERCC.value(), ID,
+                            GraphObserver::Claimability::Claimable,
+                            IsImplicit(ERCC.value()));
     }
   }
 
@@ -5058,9 +5350,9 @@ bool IndexerASTVisitor::VisitObjCCategoryImplDecl(
     auto Range = NormalizeRange(ImplDecl->getCategoryNameLoc());
     if (auto RCC = ExplicitRangeInCurrentContext(Range)) {
       auto ID = BuildNodeIdForDecl(CategoryDecl);
-      Observer.recordDeclUseLocation(RCC.value(), ID,
-                                     GraphObserver::Claimability::Unclaimable,
-                                     IsImplicit(RCC.value()));
+      RecordDeclUseLocation(RCC.value(), ID,
+                            GraphObserver::Claimability::Unclaimable,
+                            IsImplicit(RCC.value()));
     }
   } else {
     LogErrorWithASTDump("Missing category decl", ImplDecl);
@@ -5075,9 +5367,9 @@ bool IndexerASTVisitor::VisitObjCCategoryImplDecl(
     // interface name.
     const SourceRange& IFaceNameRange = NormalizeRange(ImplDecl->getLocation());
     if (auto RCC = ExplicitRangeInCurrentContext(IFaceNameRange)) {
-      Observer.recordDeclUseLocation(RCC.value(), ClassInterfaceNode,
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(RCC.value()));
+      RecordDeclUseLocation(RCC.value(), ClassInterfaceNode,
+                            GraphObserver::Claimability::Claimable,
+                            IsImplicit(RCC.value()));
     }
   } else {
     LogErrorWithASTDump("Missing category impl class interface", ImplDecl);
@@ -5108,9 +5400,9 @@ void IndexerASTVisitor::ConnectToSuperClassAndProtocols(
     auto SuperRange = NormalizeRange(IFace->getSuperClassLoc());
     if (auto SCRCC = ExplicitRangeInCurrentContext(SuperRange)) {
       auto SCID = BuildNodeIdForDecl(SC);
-      Observer.recordDeclUseLocation(SCRCC.value(), SCID,
-                                     GraphObserver::Claimability::Unclaimable,
-                                     IsImplicit(SCRCC.value()));
+      RecordDeclUseLocation(SCRCC.value(), SCID,
+                            GraphObserver::Claimability::Unclaimable,
+                            IsImplicit(SCRCC.value()));
     }
   }
 
@@ -5140,9 +5432,9 @@ void IndexerASTVisitor::ConnectToProtocols(
     auto Range = NormalizeRange(*PLocIt);
     if (auto ERCC = ExplicitRangeInCurrentContext(Range)) {
       auto PID = BuildNodeIdForDecl(*PIt);
-      Observer.recordDeclUseLocation(ERCC.value(), PID,
-                                     GraphObserver::Claimability::Unclaimable,
-                                     IsImplicit(ERCC.value()));
+      RecordDeclUseLocation(ERCC.value(), PID,
+                            GraphObserver::Claimability::Unclaimable,
+                            IsImplicit(ERCC.value()));
     }
   }
 }
@@ -5227,9 +5519,9 @@ bool IndexerASTVisitor::VisitObjCCategoryDecl(
     // interface name.
     const SourceRange& IFaceNameRange = NormalizeRange(Decl->getLocation());
     if (auto RCC = ExplicitRangeInCurrentContext(IFaceNameRange)) {
-      Observer.recordDeclUseLocation(RCC.value(), ClassInterfaceNode,
-                                     GraphObserver::Claimability::Claimable,
-                                     IsImplicit(RCC.value()));
+      RecordDeclUseLocation(RCC.value(), ClassInterfaceNode,
+                            GraphObserver::Claimability::Claimable,
+                            IsImplicit(RCC.value()));
     }
   } else {
     LogErrorWithASTDump("Missing category decl class interface", Decl);
@@ -5368,11 +5660,11 @@ bool IndexerASTVisitor::VisitObjCMethodDecl(const clang::ObjCMethodDecl* Decl) {
     //    extension.
     if (auto CategoryDecl =
             dyn_cast<ObjCCategoryDecl>(Decl->getDeclContext())) {
+      const ObjCImplementationDecl* ClassImpl = nullptr;
       if (CategoryDecl->IsClassExtension() &&
           CategoryDecl->getClassInterface() != nullptr &&
-          CategoryDecl->getClassInterface()->getImplementation() != nullptr) {
-        ObjCImplementationDecl* ClassImpl =
-            CategoryDecl->getClassInterface()->getImplementation();
+          (ClassImpl = FindObjCImplementation(
+               CategoryDecl->getClassInterface())) != nullptr) {
         if (auto MethodImpl = ClassImpl->getMethod(Decl->getSelector(),
                                                    Decl->isInstanceMethod())) {
           if (MethodImpl != Decl) {
@@ -5529,9 +5821,9 @@ bool IndexerASTVisitor::VisitObjCMessageExpr(
       // If we don't have any selectors, just use the same span as the
       // ref/call.
       if (Expr->getNumSelectorLocs() == 0) {
-        Observer.recordDeclUseLocation(RCC.value(), DeclId,
-                                       GraphObserver::Claimability::Unclaimable,
-                                       IsImplicit(RCC.value()));
+        RecordDeclUseLocation(RCC.value(), DeclId,
+                              GraphObserver::Claimability::Unclaimable,
+                              IsImplicit(RCC.value()));
       } else {
         // TODO Record multiple ranges, one for each selector.
         // For now, just record the range for the first selector. This should
@@ -5540,9 +5832,9 @@ bool IndexerASTVisitor::VisitObjCMessageExpr(
         if (Loc.isValid() && Loc.isFileID()) {
           SourceRange range = NormalizeRange(Loc);
           if (auto R = ExplicitRangeInCurrentContext(range)) {
-            Observer.recordDeclUseLocation(
-                R.value(), DeclId, GraphObserver::Claimability::Unclaimable,
-                IsImplicit(R.value()));
+            RecordDeclUseLocation(R.value(), DeclId,
+                                  GraphObserver::Claimability::Unclaimable,
+                                  IsImplicit(R.value()));
           }
         }
       }
@@ -5556,17 +5848,34 @@ const ObjCMethodDecl* IndexerASTVisitor::FindMethodDefn(
   if (MD == nullptr || I == nullptr || MD->isThisDeclarationADefinition()) {
     return MD;
   }
+  auto Found = ObjCMethodDefns.find({MD, I});
+  if (Found != ObjCMethodDefns.end()) {
+    return Found->second;
+  }
   // If we can, look in the implementation, otherwise we look in the
   // interface.
-  const ObjCContainerDecl* CD = I->getImplementation();
+  const ObjCContainerDecl* CD = FindObjCImplementation(I);
   if (CD == nullptr) {
     CD = I;
   }
+  const ObjCMethodDecl* Defn = MD;
   if (const auto* MI =
           CD->getMethod(MD->getSelector(), MD->isInstanceMethod())) {
-    return MI;
+    Defn = MI;
+  }
+  ObjCMethodDefns.try_emplace({MD, I}, Defn);
+  return Defn;
+}
+
+const ObjCImplementationDecl* IndexerASTVisitor::FindObjCImplementation(
+    const ObjCInterfaceDecl* I) {
+  auto Found = ObjCImplementations.find(I);
+  if (Found != ObjCImplementations.end()) {
+    return Found->second;
   }
-  return MD;
+  const ObjCImplementationDecl* Impl = I->getImplementation();
+  ObjCImplementations.try_emplace(I, Impl);
+  return Impl;
 }
 
 bool IndexerASTVisitor::VisitObjCPropertyRefExpr(
@@ -5598,10 +5907,10 @@ bool IndexerASTVisitor::VisitObjCPropertyRefExpr(
       // Record the "field" access if this has an explicit property.
       if (PD != nullptr) {
         GraphObserver::NodeId DeclId = BuildNodeIdForDecl(PD);
-        Observer.recordDeclUseLocation(RCC.value(), DeclId,
-                                       GraphObserver::Claimability::Unclaimable,
-                                       IsImplicit(RCC.value()));
-        for (const auto& S : Supports) {
+        RecordDeclUseLocation(RCC.value(), DeclId,
+                              GraphObserver::Claimability::Unclaimable,
+                              IsImplicit(RCC.value()));
+        for (auto* S : ActiveSupports) {
           S->InspectDeclRef(*this, SL, RCC.value(), DeclId, PD);
         }
       }
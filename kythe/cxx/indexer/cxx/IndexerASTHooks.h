@@ -39,11 +39,18 @@
 #include "glog/logging.h"
 #include "indexed_parent_map.h"
 #include "indexer_worklist.h"
+#include "kythe/cxx/common/regex.h"
+#include "kythe/cxx/indexer/cxx/KytheGraphObserver.h"
+#include "kythe/cxx/indexer/cxx/clang_range_finder.h"
+#include "kythe/cxx/indexer/cxx/comment_index.h"
 #include "kythe/cxx/indexer/cxx/node_set.h"
 #include "kythe/cxx/indexer/cxx/recursive_type_visitor.h"
+#include "kythe/cxx/indexer/cxx/resource_budget.h"
+#include "kythe/cxx/indexer/cxx/scratch_string_pool.h"
 #include "kythe/cxx/indexer/cxx/semantic_hash.h"
+#include "kythe/cxx/indexer/cxx/type_node_cache.h"
+#include "llvm/ADT/SmallVector.h"
 #include "marked_source.h"
-#include "re2/re2.h"
 #include "type_map.h"
 
 namespace kythe {
@@ -71,6 +78,20 @@ enum BehaviorOnTemplates : bool {
 /// associated with forward declarations.
 enum BehaviorOnFwdDeclComments : bool { Emit = true, Ignore = false };
 
+/// \brief Specifies which function bodies clang should skip parsing.
+///
+/// The definitions of functions whose bodies are skipped are still indexed,
+/// as are their signatures, types and documentation. Nothing inside a skipped
+/// body is: no refs, calls or dataflow edges from its statements and no nodes
+/// for the local variables, lambdas and classes it declares. Bodies of
+/// constexpr functions and of functions with deduced return types are never
+/// skipped, since clang needs them to check the rest of the unit.
+enum class BehaviorOnFunctionBodies {
+  Index,          ///< Parse and index every function body.
+  SkipInHeaders,  ///< Skip bodies outside the main source file.
+  SkipAll         ///< Skip every function body.
+};
+
 /// \brief A byte range that links to some node.
 struct MiniAnchor {
   size_t Begin;
@@ -78,6 +99,9 @@ struct MiniAnchor {
   GraphObserver::NodeId AnchoredTo;
 };
 
+/// \brief A short list of NodeIds, such as those of a template's arguments.
+using NodeIdList = llvm::SmallVector<GraphObserver::NodeId, 4>;
+
 /// \brief Specifies whether dataflow edges should be emitted.
 enum EmitDataflowEdges : bool {
   No = false,  ///< Don't emit dataflow edges.
@@ -105,13 +129,14 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
                     clang::Sema& Sema, std::function<bool()> ShouldStopIndexing,
                     GraphObserver* GO = nullptr, int UsrByteSize = 0,
                     EmitDataflowEdges EDE = EmitDataflowEdges::No,
-                    std::shared_ptr<re2::RE2> TIEPP = nullptr)
+                    std::shared_ptr<const RegexSet> TIEPP = nullptr)
       : IgnoreUnimplemented(B),
         TemplateMode(T),
         Verbosity(V),
         ObjCFwdDocs(ObjC),
         CppFwdDocs(Cpp),
         Observer(GO ? *GO : NullObserver),
+        KytheObserver(Observer.AsKytheGraphObserver()),
         Context(C),
         Supports(S),
         Sema(Sema),
@@ -119,7 +144,15 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
         ShouldStopIndexing(std::move(ShouldStopIndexing)),
         UsrByteSize(UsrByteSize),
         DataflowEdges(EDE),
-        TemplateInstanceExcludePathPattern(TIEPP) {}
+        TemplateInstanceExcludePathPatterns(TIEPP),
+        DocComments(C) {
+    for (const auto& Support : Supports) {
+      if (Support->AppliesTo(Context)) {
+        ActiveSupports.push_back(Support.get());
+        SupportStates.push_back(Support->CreateUnitState(Context));
+      }
+    }
+  }
 
   bool VisitDecl(const clang::Decl* Decl);
   bool TraverseFieldDecl(clang::FieldDecl* Decl);
@@ -301,6 +334,21 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   NodeSet BuildNodeSetForTypeInternal(const clang::Type& T);
   NodeSet BuildNodeSetForTypeInternal(const clang::QualType& QT);
 
+  /// \brief Builds the NodeSet for `QT`, consulting and filling
+  /// `SharedTypeNodes` if it is set.
+  NodeSet BuildNodeSetForTypeUsingCache(const clang::QualType& QT);
+
+  /// \brief Appends a description of `QT` that determines the NodeSet
+  /// built for it to `Description`.
+  /// \return false if `QT` uses a kind of type that can't be described.
+  bool AppendTypeDescription(const clang::QualType& QT,
+                             std::string* Description);
+
+  /// \brief Appends a description of `Arg` to `Description`, as with
+  /// `AppendTypeDescription`.
+  bool AppendTemplateArgumentDescription(const clang::TemplateArgument& Arg,
+                                         std::string* Description);
+
   NodeSet BuildNodeSetForBuiltin(const clang::BuiltinType& T) const;
   NodeSet BuildNodeSetForEnum(const clang::EnumType& T);
   NodeSet BuildNodeSetForRecord(const clang::RecordType& T);
@@ -365,7 +413,10 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
 
   std::vector<GraphObserver::NodeId> BuildNodeIdsForObjCProtocols(
       GraphObserver::NodeId BaseType, const clang::ObjCObjectType& T);
-  std::vector<GraphObserver::NodeId> BuildNodeIdsForObjCProtocols(
+  /// \return the NodeIds for the protocols `T` is qualified with, sorted by
+  /// protocol name. The result is memoized per type and is valid until the
+  /// next call.
+  const std::vector<GraphObserver::NodeId>& BuildNodeIdsForObjCProtocols(
       const clang::ObjCObjectType& T);
 
   /// \brief Builds a stable node ID for `Type`.
@@ -626,6 +677,16 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   /// \brief Returns the ASTContext.
   const clang::ASTContext& getASTContext() { return Context; }
 
+  /// \brief Returns the state `Support` created for this unit, or null.
+  LibrarySupport::UnitState* getSupportState(const LibrarySupport* Support) {
+    for (size_t I = 0; I < ActiveSupports.size(); ++I) {
+      if (ActiveSupports[I] == Support) {
+        return SupportStates[I].get();
+      }
+    }
+    return nullptr;
+  }
+
   /// Returns `SR` as a `Range` in this `RecursiveASTVisitor`'s current
   /// RangeContext.
   absl::optional<GraphObserver::Range> ExplicitRangeInCurrentContext(
@@ -688,6 +749,23 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   /// from the same thread that's walking the AST.
   bool shouldStopIndexing() const { return ShouldStopIndexing(); }
 
+  /// \brief Scales back indexing as `B` is exhausted. `B` must outlive this
+  /// visitor; it may be null.
+  void setResourceBudget(ResourceBudget* B) { Budget = B; }
+
+  /// \brief Reuses marked source through `M`, which must outlive this
+  /// visitor; it may be null.
+  void setMarkedSourceMemo(MarkedSourceMemo* M) { MarkedSources.set_memo(M); }
+
+  /// \brief Reuses type nodes built by earlier units through `C`, which must
+  /// outlive this visitor; it may be null.
+  void setTypeNodeCache(TypeNodeCache* C) { SharedTypeNodes = C; }
+
+  /// \brief Records dataflow edges early once an influence set holds `Limit`
+  /// decls, so that long generated expressions are indexed in bounded
+  /// memory. 0 means unbounded.
+  void setInfluenceSetLimit(size_t Limit) { InfluenceSetLimit = Limit; }
+
   /// Blames a call to `Callee` at `Range` on everything at the top of
   /// `BlameStack` (or does nothing if there's nobody to blame).
   void RecordCallEdges(const GraphObserver::Range& Range,
@@ -698,6 +776,13 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   // blames the use on the file.
   void RecordBlame(const clang::Decl* Decl, const GraphObserver::Range& Range);
 
+  /// Adds `Decl` to the innermost influence set, if there is one.
+  void RecordInfluencer(const clang::Decl* Decl);
+
+  /// Records that everything in the innermost influence set influences the
+  /// nodes that set flows into, then empties it.
+  void FlushInfluences();
+
   /// \return whether `range` should be considered to be implicit under the
   /// current context.
   GraphObserver::Implicit IsImplicit(const GraphObserver::Range& range);
@@ -722,8 +807,52 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
 
   NullGraphObserver NullObserver;
   GraphObserver& Observer;
+  /// `Observer` if it is a `KytheGraphObserver`, or null.
+  KytheGraphObserver* const KytheObserver;
   clang::ASTContext& Context;
 
+  /// \return the range finder for this TU, which remembers the ranges it
+  /// has normalized.
+  const ClangRangeFinder& GetRangeFinder() const;
+  /// Created on first use, once `Observer` has a source manager.
+  mutable absl::optional<ClangRangeFinder> RangeFinder;
+
+  /// \brief Calls `F` with `Observer`, as a `KytheGraphObserver` when it is
+  /// one. `F` is instantiated for both types; calls on the Kythe observer are
+  /// direct and can be inlined, and other observers go through the vtable.
+  /// Used for the observer calls made for most references in a TU.
+  template <typename F>
+  void WithObserver(F&& Fn) {
+    if (KytheObserver != nullptr) {
+      Fn(*KytheObserver);
+    } else {
+      Fn(Observer);
+    }
+  }
+
+  void RecordDeclUseLocation(const GraphObserver::Range& R,
+                             const GraphObserver::NodeId& Id,
+                             GraphObserver::Claimability Cl,
+                             GraphObserver::Implicit I) {
+    WithObserver([&](auto& O) { O.recordDeclUseLocation(R, Id, Cl, I); });
+  }
+
+  void RecordTypeSpellingLocation(const GraphObserver::Range& R,
+                                  const GraphObserver::NodeId& Id,
+                                  GraphObserver::Claimability Cl,
+                                  GraphObserver::Implicit I) {
+    WithObserver(
+        [&](auto& O) { O.recordTypeSpellingLocation(R, Id, Cl, I); });
+  }
+
+  void RecordTypeIdSpellingLocation(const GraphObserver::Range& R,
+                                    const GraphObserver::NodeId& Id,
+                                    GraphObserver::Claimability Cl,
+                                    GraphObserver::Implicit I) {
+    WithObserver(
+        [&](auto& O) { O.recordTypeIdSpellingLocation(R, Id, Cl, I); });
+  }
+
   /// \brief The result of calling into the lexer.
   enum class LexerResult {
     Failure,  ///< The operation failed.
@@ -852,10 +981,10 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
       const clang::ObjCInterfaceDecl* IDecl,
       const clang::ObjCTypeParamList* TPL, const GraphObserver::NodeId& BodyId);
 
-  /// \brief Returns a vector of NodeId for each template argument.
-  absl::optional<std::vector<GraphObserver::NodeId>> BuildTemplateArgumentList(
+  /// \brief Returns the NodeId of each template argument.
+  absl::optional<NodeIdList> BuildTemplateArgumentList(
       llvm::ArrayRef<clang::TemplateArgument> Args);
-  absl::optional<std::vector<GraphObserver::NodeId>> BuildTemplateArgumentList(
+  absl::optional<NodeIdList> BuildTemplateArgumentList(
       llvm::ArrayRef<clang::TemplateArgumentLoc> Args);
 
   /// Dumps information about `TypeContext` to standard error when looking for
@@ -956,6 +1085,12 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   const clang::ObjCMethodDecl* FindMethodDefn(
       const clang::ObjCMethodDecl* MD, const clang::ObjCInterfaceDecl* I);
 
+  /// \return the implementation of the class `I` or null. Memoized, since
+  /// each lookup goes through the interface's definition and the
+  /// ASTContext.
+  const clang::ObjCImplementationDecl* FindObjCImplementation(
+      const clang::ObjCInterfaceDecl* I);
+
   void VisitObjCInterfaceDeclComment(
       const clang::ObjCInterfaceDecl* Decl, const clang::RawComment* Comment,
       const clang::DeclContext* DCxt,
@@ -972,6 +1107,29 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   /// \brief Maps known Decls to their NodeIds.
   llvm::DenseMap<const clang::Decl*, GraphObserver::NodeId> DeclToNodeId;
 
+  /// \brief Maps canonical decls to their USRs, or to an empty string if
+  /// Clang can't generate one. Every redeclaration shares its canonical
+  /// decl's USR, and generating one walks the whole DeclContext chain.
+  llvm::DenseMap<const clang::Decl*, std::string> CanonicalDeclUsrs;
+
+  /// \brief Maps ObjC object types to the sorted NodeIds of their
+  /// protocols. Types are uniqued by the ASTContext, so SDK types like
+  /// `id<NSCopying, NSObject>` are only sorted once.
+  llvm::DenseMap<const clang::ObjCObjectType*,
+                 std::vector<GraphObserver::NodeId>>
+      ObjCProtocolIds;
+
+  /// \brief Maps ObjC classes to their implementations (or null).
+  llvm::DenseMap<const clang::ObjCInterfaceDecl*,
+                 const clang::ObjCImplementationDecl*>
+      ObjCImplementations;
+
+  /// \brief Memoizes `FindMethodDefn` for (method, receiver) pairs.
+  llvm::DenseMap<std::pair<const clang::ObjCMethodDecl*,
+                           const clang::ObjCInterfaceDecl*>,
+                 const clang::ObjCMethodDecl*>
+      ObjCMethodDefns;
+
   /// \brief Used for calculating semantic hashes.
   SemanticHash Hash{
       [this](const clang::Decl* Decl) {
@@ -983,6 +1141,13 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   /// \brief Enabled library-specific callbacks.
   const LibrarySupports& Supports;
 
+  /// \brief The supports that apply to this translation unit; these are
+  /// the only ones whose hooks are called.
+  std::vector<LibrarySupport*> ActiveSupports;
+
+  /// \brief The per-unit state of each of `ActiveSupports`.
+  std::vector<std::unique_ptr<LibrarySupport::UnitState>> SupportStates;
+
   /// \brief The `Sema` instance to use.
   clang::Sema& Sema;
 
@@ -998,6 +1163,25 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   /// \brief The controlling worklist.
   std::unique_ptr<IndexerWorklist> Worklist;
 
+  /// \brief The budget this unit is held to, or null if it is unlimited.
+  ResourceBudget* Budget = nullptr;
+
+  /// \brief Type nodes shared with other units, or null.
+  TypeNodeCache* SharedTypeNodes = nullptr;
+
+  /// \brief The influence set size at which edges are flushed, or 0.
+  size_t InfluenceSetLimit = 0;
+
+  /// \brief Buffers for building decl identities, which nest when one decl's
+  /// identity includes another's.
+  ScratchStringPool IdentityScratch;
+
+  /// \brief The budget level that has already been applied.
+  BudgetLevel AppliedBudgetLevel = BudgetLevel::kFull;
+
+  /// \brief Checks `Budget` and disables features it no longer allows.
+  void ApplyResourceBudget();
+
   /// \brief Comments we've already visited.
   std::unordered_set<const clang::RawComment*> VisitedComments;
 
@@ -1008,9 +1192,17 @@ class IndexerASTVisitor : public RecursiveTypeVisitor<IndexerASTVisitor> {
   /// \brief Controls whether dataflow edges are emitted.
   EmitDataflowEdges DataflowEdges;
 
-  /// \brief if nonempty, the pattern to match a path against to see whether
+  /// \brief if nonnull, the patterns to match a path against to see whether
   /// it should be excluded from template instance indexing.
-  std::shared_ptr<re2::RE2> TemplateInstanceExcludePathPattern = nullptr;
+  std::shared_ptr<const RegexSet> TemplateInstanceExcludePathPatterns = nullptr;
+
+  /// \brief Whether each file seen by `ShouldIndex` matched
+  /// `TemplateInstanceExcludePathPatterns`.
+  llvm::DenseMap<clang::FileID, bool> ExcludedTemplateInstanceFiles;
+
+  /// \brief Rules out the decls without documentation comments before
+  /// Clang searches for them.
+  CommentIndex DocComments;
 };
 
 /// \brief An `ASTConsumer` that passes events to a `GraphObserver`.
@@ -1023,7 +1215,8 @@ class IndexerASTConsumer : public clang::SemaConsumer {
       std::function<bool()> ShouldStopIndexing,
       std::function<std::unique_ptr<IndexerWorklist>(IndexerASTVisitor*)>
           CreateWorklist,
-      int UsrByteSize, EmitDataflowEdges EDE, std::shared_ptr<re2::RE2> TIEPP)
+      int UsrByteSize, EmitDataflowEdges EDE,
+      std::shared_ptr<const RegexSet> TIEPP)
       : Observer(GO),
         IgnoreUnimplemented(B),
         TemplateMode(T),
@@ -1035,24 +1228,76 @@ class IndexerASTConsumer : public clang::SemaConsumer {
         CreateWorklist(std::move(CreateWorklist)),
         UsrByteSize(UsrByteSize),
         DataflowEdges(EDE),
-        TemplateInstanceExcludePathPattern(TIEPP) {}
+        TemplateInstanceExcludePathPatterns(TIEPP) {}
 
   void HandleTranslationUnit(clang::ASTContext& Context) override {
     CHECK(Sema != nullptr);
     IndexerASTVisitor Visitor(
         Context, IgnoreUnimplemented, TemplateMode, Verbosity, ObjCFwdDocs,
         CppFwdDocs, Supports, *Sema, ShouldStopIndexing, Observer, UsrByteSize,
-        DataflowEdges, TemplateInstanceExcludePathPattern);
+        DataflowEdges, TemplateInstanceExcludePathPatterns);
+    Visitor.setResourceBudget(Budget);
+    Visitor.setMarkedSourceMemo(Memo);
+    Visitor.setTypeNodeCache(TypeNodes);
+    Visitor.setInfluenceSetLimit(InfluenceSetLimit);
+    // The TU is traversed on this thread only. Top-level decls can't be
+    // handed to other threads even after parsing: the visitor asks `Sema`
+    // for lookups and implicit members, which adds to the AST; the
+    // `SourceManager` updates caches even in const location queries; and
+    // the observer, claim client and lazily built parent map aren't
+    // synchronized.
+    // Use --jobs to index separate units concurrently instead.
     {
-      ProfileBlock block(Observer->getProfilingCallback(), "traverse_tu");
+      ProfileBlock block(Observer->getProfilingCallback(),
+                         ProfileSection::kTraverseTu);
       Visitor.Work(Context.getTranslationUnitDecl(), CreateWorklist(&Visitor));
     }
   }
 
   void InitializeSema(clang::Sema& S) override { Sema = &S; }
 
+  /// \brief Called by clang as each tag definition is parsed.
+  void HandleTagDeclDefinition(clang::TagDecl* D) override {
+    if (Observer->probesGroups() && D->getFirstDecl() != D) {
+      Observer->noteTagCompleted(D->getFirstDecl()->getLocation());
+    }
+  }
+
+  /// \brief Called by clang to ask whether to skip parsing the body of `D`.
+  /// Only consulted if the frontend was asked to skip function bodies.
+  bool shouldSkipFunctionBody(clang::Decl* D) override {
+    switch (FunctionBodies) {
+      case BehaviorOnFunctionBodies::Index:
+        return false;
+      case BehaviorOnFunctionBodies::SkipInHeaders: {
+        const auto& SM = Sema->getSourceManager();
+        return !SM.isInMainFile(SM.getExpansionLoc(D->getLocation()));
+      }
+      case BehaviorOnFunctionBodies::SkipAll:
+        return true;
+    }
+    return false;
+  }
+
   void ForgetSema() override { Sema = nullptr; }
 
+  /// \brief Holds the visitor to `B`, which may be null.
+  void setResourceBudget(ResourceBudget* B) { Budget = B; }
+
+  /// \brief Has the visitor reuse marked source through `M`, which may be
+  /// null.
+  void setMarkedSourceMemo(MarkedSourceMemo* M) { Memo = M; }
+
+  /// \brief Has the visitor reuse type nodes through `C`, which may be null.
+  void setTypeNodeCache(TypeNodeCache* C) { TypeNodes = C; }
+
+  /// \brief Bounds the visitor's influence sets to `Limit` decls (0 for no
+  /// bound).
+  void setInfluenceSetLimit(size_t Limit) { InfluenceSetLimit = Limit; }
+
+  /// \brief Selects the function bodies to skip if the frontend skips any.
+  void setFunctionBodies(BehaviorOnFunctionBodies B) { FunctionBodies = B; }
+
  private:
   GraphObserver* const Observer;
   /// Whether we should stop on missing cases or continue on.
@@ -1079,9 +1324,19 @@ class IndexerASTConsumer : public clang::SemaConsumer {
   int UsrByteSize = 0;
   /// \brief Controls whether dataflow edges are emitted.
   EmitDataflowEdges DataflowEdges;
-  /// \brief if nonempty, the pattern to match a path against to see whether
+  /// \brief if nonnull, the patterns to match a path against to see whether
   /// it should be excluded from template instance indexing.
-  std::shared_ptr<re2::RE2> TemplateInstanceExcludePathPattern;
+  std::shared_ptr<const RegexSet> TemplateInstanceExcludePathPatterns;
+  /// \brief The budget this unit is held to, or null if it is unlimited.
+  ResourceBudget* Budget = nullptr;
+  /// \brief Marked source shared with other units, or null.
+  MarkedSourceMemo* Memo = nullptr;
+  /// \brief Type nodes shared with other units, or null.
+  TypeNodeCache* TypeNodes = nullptr;
+  /// \brief The influence set size at which edges are flushed, or 0.
+  size_t InfluenceSetLimit = 0;
+  /// \brief Which function bodies to skip.
+  BehaviorOnFunctionBodies FunctionBodies = BehaviorOnFunctionBodies::Index;
 };
 
 }  // namespace kythe
@@ -16,8 +16,10 @@
 
 #include "IndexerFrontendAction.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <unordered_set>
 #include <utility>
 
 #include "KytheGraphObserver.h"
@@ -26,6 +28,10 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Frontend/FrontendAction.h"
@@ -34,6 +40,7 @@
 #include "kythe/cxx/common/json_proto.h"
 #include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
 #include "kythe/cxx/indexer/cxx/KytheVFS.h"
+#include "kythe/cxx/indexer/cxx/incremental_store.h"
 #include "kythe/cxx/indexer/cxx/proto_conversions.h"
 #include "kythe/proto/analysis.pb.h"
 #include "kythe/proto/buildinfo.pb.h"
@@ -116,28 +123,42 @@ bool DecodeHeaderSearchInfo(const proto::CxxCompilationUnitDetails& Details,
   return true;
 }
 
+/// \brief The builtin headers, which are mapped into every unit.
+struct BuiltinHeaders {
+  std::vector<proto::FileData> files;
+  std::unordered_set<std::string> paths;
+};
+
+/// \return the builtin headers, which are only copied out of the binary
+/// once per process and then shared by every unit's VFS.
+const BuiltinHeaders& GetBuiltinHeaders() {
+  static const BuiltinHeaders* const Headers = [] {
+    auto* Headers = new BuiltinHeaders();
+    const std::string HeaderPath = "/kythe_builtins/include/";
+    for (const auto* Header = builtin_headers_create();
+         Header->name != nullptr; ++Header) {
+      auto Path = HeaderPath + Header->name;
+      proto::FileData& NewFile = Headers->files.emplace_back();
+      NewFile.mutable_info()->set_path(Path);
+      NewFile.mutable_info()->set_digest("");
+      *NewFile.mutable_content() = Header->data;
+      Headers->paths.insert(Path);
+    }
+    return Headers;
+  }();
+  return *Headers;
+}
+
+/// \brief Removes the files that the builtin headers replace from `Files`.
+/// \return the argument that points clang at the builtin headers.
 std::string ConfigureSystemHeaders(const proto::CompilationUnit& Unit,
                                    std::vector<proto::FileData>& Files) {
-  std::vector<proto::FileData> OldFiles;
-  OldFiles.swap(Files);
-  const std::string HeaderPath = "/kythe_builtins/include/";
-  std::unordered_set<std::string> NewHeaders;
-  for (const auto* Header = builtin_headers_create(); Header->name != nullptr;
-       ++Header) {
-    auto Path = HeaderPath + Header->name;
-    auto Data = Header->data;
-    proto::FileData NewFile;
-    NewFile.mutable_info()->set_path(Path);
-    NewFile.mutable_info()->set_digest("");
-    *NewFile.mutable_content() = Data;
-    Files.push_back(NewFile);
-    NewHeaders.insert(Path);
-  }
-  for (const auto& File : OldFiles) {
-    if (NewHeaders.find(File.info().path()) == NewHeaders.end()) {
-      Files.push_back(File);
-    }
-  }
+  const auto& Paths = GetBuiltinHeaders().paths;
+  Files.erase(std::remove_if(Files.begin(), Files.end(),
+                             [&Paths](const proto::FileData& File) {
+                               return Paths.count(File.info().path()) != 0;
+                             }),
+              Files.end());
   return "-resource-dir=/kythe_builtins";
 }
 
@@ -175,8 +196,168 @@ class TextErrorBuffer : public clang::DiagnosticConsumer {
  private:
   std::vector<std::string> errors_;
 };
+
+// Counts the entries written to a unit's output against its budget.
+class BudgetedOutputStream : public KytheCachingOutput {
+ public:
+  BudgetedOutputStream(KytheCachingOutput* output, ResourceBudget* budget)
+      : output_(output), budget_(budget) {}
+
+  void Emit(const FactRef& fact) override {
+    budget_->AddEntries(1);
+    output_->Emit(fact);
+  }
+  void Emit(const EdgeRef& edge) override {
+    budget_->AddEntries(1);
+    output_->Emit(edge);
+  }
+  void Emit(const OrdinalEdgeRef& edge) override {
+    budget_->AddEntries(1);
+    output_->Emit(edge);
+  }
+  void Emit(absl::Span<const FactRef> facts) override {
+    budget_->AddEntries(facts.size());
+    output_->Emit(facts);
+  }
+  void Emit(absl::Span<const EdgeRef> edges) override {
+    budget_->AddEntries(edges.size());
+    output_->Emit(edges);
+  }
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override {
+    budget_->AddEntries(edges.size());
+    output_->Emit(edges);
+  }
+  void PushBuffer() override { output_->PushBuffer(); }
+  void PopBuffer() override { output_->PopBuffer(); }
+  void UseHashCache(HashCache* cache) override { output_->UseHashCache(cache); }
+
+ private:
+  KytheCachingOutput* output_;
+  ResourceBudget* budget_;
+};
+
+// Adds the time spent writing a unit's entries to its emit time.
+class TimedOutputStream : public KytheCachingOutput {
+ public:
+  TimedOutputStream(KytheCachingOutput* output, absl::Duration* emit_time)
+      : output_(output), emit_time_(emit_time) {}
+
+  void Emit(const FactRef& fact) override {
+    Timed([&] { output_->Emit(fact); });
+  }
+  void Emit(const EdgeRef& edge) override {
+    Timed([&] { output_->Emit(edge); });
+  }
+  void Emit(const OrdinalEdgeRef& edge) override {
+    Timed([&] { output_->Emit(edge); });
+  }
+  void Emit(absl::Span<const FactRef> facts) override {
+    Timed([&] { output_->Emit(facts); });
+  }
+  void Emit(absl::Span<const EdgeRef> edges) override {
+    Timed([&] { output_->Emit(edges); });
+  }
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override {
+    Timed([&] { output_->Emit(edges); });
+  }
+  void PushBuffer() override { output_->PushBuffer(); }
+  void PopBuffer() override { Timed([&] { output_->PopBuffer(); }); }
+  void UseHashCache(HashCache* cache) override { output_->UseHashCache(cache); }
+
+ private:
+  template <typename F>
+  void Timed(F&& write) {
+    absl::Time start = absl::Now();
+    write();
+    *emit_time_ += absl::Now() - start;
+  }
+
+  KytheCachingOutput* output_;
+  absl::Duration* emit_time_;
+};
+
+// Splits the time spent running a unit's invocation into parsing and AST
+// traversal, using the sections reported to a profiling callback.
+class UnitTimer {
+ public:
+  explicit UnitTimer(UnitMetrics* metrics) : metrics_(metrics) {}
+
+  void Report(const char* section, ProfilingEvent event) {
+    absl::string_view name(section);
+    if (name == ProfileSectionName(ProfileSection::kTraverseTu)) {
+      if (event == ProfilingEvent::Enter) {
+        traversal_start_ = absl::Now();
+      } else {
+        metrics_->traversal_time += absl::Now() - traversal_start_;
+      }
+    } else if (name == ProfileSectionName(ProfileSection::kRunInvocation)) {
+      if (event == ProfilingEvent::Enter) {
+        invocation_start_ = absl::Now();
+      } else {
+        // Clang parses the whole unit before handing it over for traversal.
+        metrics_->parse_time +=
+            absl::Now() - invocation_start_ - metrics_->traversal_time;
+      }
+    }
+  }
+
+ private:
+  UnitMetrics* metrics_;
+  absl::Time invocation_start_;
+  absl::Time traversal_start_;
+};
 }  // anonymous namespace
 
+std::string IncrementalKeySeed(const proto::CompilationUnit& Unit,
+                               const IndexerOptions& Options) {
+  std::string Seed;
+  // Each value is prefixed with its name and length, so no two different
+  // configurations serialize to the same seed.
+  auto Add = [&Seed](absl::string_view Name, absl::string_view Value) {
+    absl::StrAppend(&Seed, Name, ":", Value.size(), ":", Value, "\n");
+  };
+  auto AddInt = [&Add](absl::string_view Name, int64_t Value) {
+    Add(Name, absl::StrCat(Value));
+  };
+  for (const auto& Arg : Unit.argument()) {
+    // Keys cover the main file's content instead of its name, so that units
+    // compiling different files with the same flags can share group keys.
+    if (std::find(Unit.source_file().begin(), Unit.source_file().end(),
+                  Arg) != Unit.source_file().end()) {
+      Add("source_file", "");
+    } else {
+      Add("argument", Arg);
+    }
+  }
+  Add("working_directory", Unit.working_directory());
+  Add("build_config", ExtractBuildConfig(Unit));
+  Add("EffectiveWorkingDirectory", Options.EffectiveWorkingDirectory);
+  AddInt("TemplateBehavior", static_cast<int>(Options.TemplateBehavior));
+  AddInt("UnimplementedBehavior",
+         static_cast<int>(Options.UnimplementedBehavior));
+  AddInt("Verbosity", static_cast<int>(Options.Verbosity));
+  AddInt("FunctionBodies", static_cast<int>(Options.FunctionBodies));
+  AddInt("SystemMacros", static_cast<int>(Options.SystemMacros));
+  AddInt("ObjCFwdDocs", static_cast<int>(Options.ObjCFwdDocs));
+  AddInt("CppFwdDocs", static_cast<int>(Options.CppFwdDocs));
+  AddInt("AllowFSAccess", Options.AllowFSAccess);
+  AddInt("DropInstantiationIndependentData",
+         Options.DropInstantiationIndependentData);
+  AddInt("UsrByteSize", Options.UsrByteSize);
+  AddInt("UseCompilationCorpusAsDefault",
+         Options.UseCompilationCorpusAsDefault);
+  AddInt("DataflowEdges", static_cast<int>(Options.DataflowEdges));
+  AddInt("InfluenceSetLimit", Options.InfluenceSetLimit);
+  AddInt("Preambles", Options.Preambles != nullptr);
+  if (Options.TemplateInstanceExcludePathPatterns != nullptr) {
+    for (const auto& Pattern :
+         Options.TemplateInstanceExcludePathPatterns->patterns()) {
+      Add("TemplateInstanceExcludePathPattern", Pattern);
+    }
+  }
+  return Seed;
+}
+
 std::string IndexCompilationUnit(
     const proto::CompilationUnit& Unit, std::vector<proto::FileData>& Files,
     KytheClaimClient& Client, HashCache* Cache, KytheCachingOutput& Output,
@@ -211,18 +392,76 @@ std::string IndexCompilationUnit(
     Dirs.push_back(ToStringRef(Path.path));
   }
   llvm::IntrusiveRefCntPtr<IndexVFS> VFS(
-      new IndexVFS(Options.EffectiveWorkingDirectory, Files, Dirs, Style));
-  KytheGraphRecorder Recorder(&Output);
+      new IndexVFS(Options.EffectiveWorkingDirectory, Files,
+                   GetBuiltinHeaders().files, Dirs, Style,
+                   Options.ReadFileContent));
+  ResourceBudget Budget(Options.UnitBudget);
+  BudgetedOutputStream BudgetedOutput(&Output, &Budget);
+  const bool HasBudget = Options.UnitBudget.any();
+  KytheCachingOutput* RecorderOutput = HasBudget ? &BudgetedOutput : &Output;
+  std::unique_ptr<TimedOutputStream> TimedOutput;
+  ProfilingCallback ReportProfileEvent = Options.ReportProfileEvent;
+  UnitTimer Timer(Options.Metrics);
+  if (Options.Metrics != nullptr) {
+    TimedOutput = absl::make_unique<TimedOutputStream>(
+        RecorderOutput, &Options.Metrics->emit_time);
+    RecorderOutput = TimedOutput.get();
+    ReportProfileEvent = [&Timer, Report = Options.ReportProfileEvent](
+                             const char* Section, ProfilingEvent Event) {
+      if (Report) {
+        Report(Section, Event);
+      }
+      Timer.Report(Section, Event);
+    };
+  }
+  std::unique_ptr<BlockRecordingOutput> BlockOutput;
+  if (Options.IncrementalBlocks != nullptr) {
+    BlockOutput = absl::make_unique<BlockRecordingOutput>(RecorderOutput);
+    RecorderOutput = BlockOutput.get();
+  }
+  KytheGraphRecorder Recorder(RecorderOutput);
+  Recorder.set_breakdown(Options.OutputBreakdown);
+  // NodeIds made while indexing this unit share a table that is dropped when
+  // the unit is finished.
+  GraphObserver::IdentityTable Identities;
+  GraphObserver::IdentityTable::Scope IdentityScope(&Identities);
   KytheGraphObserver Observer(&Recorder, &Client, MetaSupports, VFS,
-                              Options.ReportProfileEvent,
+                              ReportProfileEvent,
                               ExtractBuildConfig(Unit));
   if (Cache != nullptr) {
     Output.UseHashCache(Cache);
     Observer.StopDeferringNodes();
   }
+  if (BlockOutput != nullptr) {
+    // Blocks are keyed by everything that can change what is emitted while
+    // traversing a file: the files the unit entered, the unit's
+    // configuration and the options that affect the output.
+    Observer.UseIncrementalStore(Options.IncrementalBlocks, BlockOutput.get(),
+                                 IncrementalKeySeed(Unit, Options));
+    // Deferred anchors and deduplicated type nodes would only be written
+    // into the first block that needs them.
+    Observer.StopDeferringNodes();
+  }
+  // A block must hold everything its file's declarations emit, even what
+  // another unit already emitted to this output.
+  const bool ProbeGroups =
+      Cache != nullptr && Options.ProbeGroupKeys && BlockOutput == nullptr;
+  if (ProbeGroups) {
+    // Like blocks, groups are keyed by the seed and the files entered,
+    // though only by those before each group's file was left.
+    Observer.ProbeGroupKeys(Cache, IncrementalKeySeed(Unit, Options));
+  }
   if (Options.DropInstantiationIndependentData) {
     Observer.DropRedundantWraiths();
   }
+  if (Options.SharedWrittenTypes != nullptr &&
+      Options.SharedWrittenDocs != nullptr) {
+    Observer.ShareWrittenNodes(Options.SharedWrittenTypes,
+                               Options.SharedWrittenDocs);
+  }
+  if (Options.SharedIndexedInstantiations != nullptr) {
+    Observer.ShareIndexedInstantiations(Options.SharedIndexedInstantiations);
+  }
   Observer.set_claimant(Unit.v_name());
   if (Options.UseCompilationCorpusAsDefault) {
     Observer.set_default_corpus(Unit.v_name().corpus());
@@ -232,6 +471,9 @@ std::string IndexCompilationUnit(
     if (Input.has_info() && !Input.info().path().empty() &&
         Input.has_v_name()) {
       VFS->SetVName(Input.info().path(), Input.v_name());
+      if (BlockOutput != nullptr || ProbeGroups) {
+        Observer.SetInputDigest(Input.v_name(), Input.info().digest());
+      }
     }
     const std::string& FilePath = Input.info().path();
     for (const auto& Row : FileContextRows(Input)) {
@@ -260,14 +502,31 @@ std::string IndexCompilationUnit(
   Action->setIgnoreUnimplemented(Options.UnimplementedBehavior);
   Action->setTemplateMode(Options.TemplateBehavior);
   Action->setVerbosity(Options.Verbosity);
+  Action->setFunctionBodies(Options.FunctionBodies);
+  Action->setSystemMacros(Options.SystemMacros);
   Action->setObjCFwdDeclEmitDocs(Options.ObjCFwdDocs);
   Action->setCppFwdDeclEmitDocs(Options.CppFwdDocs);
   Action->setUsrByteSize(Options.UsrByteSize);
-  Action->setTemplateInstanceExcludePathPattern(
-      Options.TemplateInstanceExcludePathPattern);
+  Action->setTemplateInstanceExcludePathPatterns(
+      Options.TemplateInstanceExcludePathPatterns);
   Action->setEmitDataflowEdges(Options.DataflowEdges);
+  Action->setInfluenceSetLimit(Options.InfluenceSetLimit);
+  Action->setResourceBudget(HasBudget ? &Budget : nullptr);
+  Action->setMarkedSourceMemo(Options.SharedMarkedSource);
+  Action->setTypeNodeCache(Options.SharedTypeNodes);
   llvm::IntrusiveRefCntPtr<clang::FileManager> FileManager(
       new clang::FileManager(FSO, Options.AllowFSAccess ? nullptr : VFS));
+  // Every unit is parsed from source, headers included, even when other
+  // units share the same header prefix. Loading that prefix from a PCH or
+  // module would skip its preprocessing: IndexerPPCallbacks would see no
+  // FileChanged, InclusionDirective or MacroDefined events for it, and the
+  // observer couldn't map those files to VNames, claims or include edges.
+  // Headers can still be parsed more cheaply with
+  // --experimental_skip_function_bodies=headers. The exception is
+  // Options.Preambles, which accepts that loss in order to reindex single
+  // files quickly. It only loads a preamble already built (and indexed in
+  // full) by an earlier unit, and the observer leaves the files in it
+  // unclaimed.
   std::vector<std::string> Args(Unit.argument().begin(), Unit.argument().end());
   Args.insert(Args.begin() + 1, {"-nocudalib", "-w", "-fsyntax-only"});
   if (!FixupArgument.empty()) {
@@ -278,6 +537,14 @@ std::string IndexCompilationUnit(
   std::unique_ptr<StdinAdjustSingleFrontendActionFactory> Tool =
       absl::make_unique<StdinAdjustSingleFrontendActionFactory>(
           std::move(Action));
+  if (Options.Preambles != nullptr) {
+    Tool->usePreambles(
+        Options.Preambles,
+        absl::StrCat(Unit.working_directory(), "\n", absl::StrJoin(Args, "\n")),
+        Options.AllowFSAccess ? llvm::vfs::getRealFileSystem()
+                              : llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>(
+                                    VFS));
+  }
   // ToolInvocation doesn't take ownership of ToolActions.
   clang::tooling::ToolInvocation Invocation(
       Args, Tool.get(), FileManager.get(),
@@ -286,11 +553,23 @@ std::string IndexCompilationUnit(
   TextErrorBuffer Diags;
   Invocation.setDiagnosticConsumer(&Diags);
 
-  ProfileBlock block(Observer.getProfilingCallback(), "run_invocation");
+  ProfileBlock block(Observer.getProfilingCallback(),
+                     ProfileSection::kRunInvocation);
   if (!Invocation.run()) {
     return absl::StrCat("Errors during indexing:",
                         absl::StrJoin(Diags.errors(), "\n"));
   }
+  // Units that were cut short or scaled back didn't record whole blocks or
+  // emit whole groups.
+  if (Budget.exhausted_resource() == nullptr &&
+      !(Options.ShouldStopIndexing && Options.ShouldStopIndexing())) {
+    if (BlockOutput != nullptr) {
+      Observer.SaveIncrementalBlocks();
+    }
+    if (ProbeGroups) {
+      Observer.RegisterGroupKeys();
+    }
+  }
   return "";
 }
 
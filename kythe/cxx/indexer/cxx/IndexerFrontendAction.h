@@ -40,17 +40,26 @@
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Tooling/Tooling.h"
 #include "glog/logging.h"
+#include "kythe/cxx/common/file_content_cache.h"
 #include "kythe/cxx/common/kythe_metadata_file.h"
+#include "kythe/cxx/common/regex.h"
 #include "kythe/cxx/extractor/cxx_details.h"
+#include "kythe/cxx/indexer/cxx/marked_source_memo.h"
+#include "kythe/cxx/indexer/cxx/node_fingerprint_set.h"
+#include "kythe/cxx/indexer/cxx/preamble_cache.h"
+#include "kythe/cxx/indexer/cxx/resource_budget.h"
+#include "kythe/cxx/indexer/cxx/type_node_cache.h"
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
-#include "re2/re2.h"
 
 namespace kythe {
 namespace proto {
 class CompilationUnit;
 class FileData;
 }  // namespace proto
+class EntryBreakdown;
+class IncrementalStore;
 class KytheClaimClient;
 
 /// \brief Runs a given tool on a piece of code with a given assumed filename.
@@ -111,11 +120,34 @@ class IndexerFrontendAction : public clang::ASTFrontendAction {
   /// \brief Emit dataflow edges?
   void setEmitDataflowEdges(EmitDataflowEdges EDE) { DataflowEdges = EDE; }
 
-  /// \brief Pattern used to exclude paths from template instance indexing.
-  void setTemplateInstanceExcludePathPattern(std::shared_ptr<re2::RE2> P) {
-    TemplateInstanceExcludePathPattern = P;
+  /// \brief Patterns used to exclude paths from template instance indexing.
+  void setTemplateInstanceExcludePathPatterns(
+      std::shared_ptr<const RegexSet> P) {
+    TemplateInstanceExcludePathPatterns = P;
   }
 
+  /// \brief Scales back indexing as `B` is exhausted. `B` must outlive this
+  /// action; it may be null.
+  void setResourceBudget(ResourceBudget* B) { Budget = B; }
+
+  /// \brief Reuses marked source through `M`, which must outlive this
+  /// action; it may be null.
+  void setMarkedSourceMemo(MarkedSourceMemo* M) { Memo = M; }
+
+  /// \brief Reuses type nodes through `C`, which must outlive this action;
+  /// it may be null.
+  void setTypeNodeCache(TypeNodeCache* C) { TypeNodes = C; }
+
+  /// \brief Which function bodies clang should skip parsing.
+  void setFunctionBodies(BehaviorOnFunctionBodies B) { FunctionBodies = B; }
+
+  /// \brief Bounds each dataflow influence set to `Limit` decls (0 for no
+  /// bound).
+  void setInfluenceSetLimit(size_t Limit) { InfluenceSetLimit = Limit; }
+
+  /// \brief When to record the definitions of macros in system headers.
+  void setSystemMacros(BehaviorOnSystemMacros B) { SystemMacros = B; }
+
  private:
   std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
       clang::CompilerInstance& CI, llvm::StringRef Filename) override {
@@ -152,19 +184,31 @@ class IndexerFrontendAction : public clang::ASTFrontendAction {
       Observer->setLangOptions(&CI.getLangOpts());
       Observer->setPreprocessor(&CI.getPreprocessor());
     }
-    return absl::make_unique<IndexerASTConsumer>(
+    auto Consumer = absl::make_unique<IndexerASTConsumer>(
         Observer, IgnoreUnimplemented, TemplateMode, Verbosity, ObjCFwdDocs,
         CppFwdDocs, Supports, ShouldStopIndexing, CreateWorklist, UsrByteSize,
-        DataflowEdges, TemplateInstanceExcludePathPattern);
+        DataflowEdges, TemplateInstanceExcludePathPatterns);
+    Consumer->setResourceBudget(Budget);
+    Consumer->setMarkedSourceMemo(Memo);
+    Consumer->setTypeNodeCache(TypeNodes);
+    Consumer->setFunctionBodies(FunctionBodies);
+    Consumer->setInfluenceSetLimit(InfluenceSetLimit);
+    return Consumer;
   }
 
   bool BeginSourceFileAction(clang::CompilerInstance& CI) override {
     if (Observer) {
-      CI.getPreprocessor().addPPCallbacks(absl::make_unique<IndexerPPCallbacks>(
-          CI.getPreprocessor(), *Observer, Verbosity, UsrByteSize));
+      auto Callbacks = absl::make_unique<IndexerPPCallbacks>(
+          CI.getPreprocessor(), *Observer, Verbosity, UsrByteSize);
+      Callbacks->setSystemMacros(SystemMacros);
+      Callbacks->setLibrarySupports(&Supports);
+      CI.getPreprocessor().addPPCallbacks(std::move(Callbacks));
     }
     CI.getLangOpts().CommentOpts.ParseAllComments = true;
     CI.getLangOpts().RetainCommentsFromSystemHeaders = true;
+    // The consumer picks which bodies are skipped once clang asks.
+    CI.getFrontendOpts().SkipFunctionBodies =
+        FunctionBodies != BehaviorOnFunctionBodies::Index;
     return true;
   }
 
@@ -198,8 +242,20 @@ class IndexerFrontendAction : public clang::ASTFrontendAction {
   int UsrByteSize = 0;
   /// \brief Controls whether dataflow edges are emitted.
   EmitDataflowEdges DataflowEdges = EmitDataflowEdges::No;
-  /// \brief Pattern used to exclude paths from template instance indexing.
-  std::shared_ptr<re2::RE2> TemplateInstanceExcludePathPattern;
+  /// \brief Patterns used to exclude paths from template instance indexing.
+  std::shared_ptr<const RegexSet> TemplateInstanceExcludePathPatterns;
+  /// \brief The budget this unit is held to, or null if it is unlimited.
+  ResourceBudget* Budget = nullptr;
+  /// \brief Marked source shared with other units, or null.
+  MarkedSourceMemo* Memo = nullptr;
+  /// \brief Type nodes shared with other units, or null.
+  TypeNodeCache* TypeNodes = nullptr;
+  /// \brief Which function bodies to skip.
+  BehaviorOnFunctionBodies FunctionBodies = BehaviorOnFunctionBodies::Index;
+  /// \brief The influence set size at which edges are flushed, or 0.
+  size_t InfluenceSetLimit = 0;
+  /// \brief When to record definitions in system headers.
+  BehaviorOnSystemMacros SystemMacros = BehaviorOnSystemMacros::Define;
 };
 
 /// \brief Allows stdin to be replaced with a mapped file.
@@ -219,6 +275,17 @@ class StdinAdjustSingleFrontendActionFactory
       std::unique_ptr<clang::FrontendAction> Action)
       : Action(std::move(Action)) {}
 
+  /// \brief Loads the main file's preamble from `Cache` (see
+  /// `PreambleCache`) when the action is run.
+  /// \param Key Identifies the main file and its arguments.
+  /// \param VFS The filesystem that the action's FileManager reads from.
+  void usePreambles(PreambleCache* Cache, std::string Key,
+                    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS) {
+    Preambles = Cache;
+    PreambleKey = std::move(Key);
+    PreambleVFS = std::move(VFS);
+  }
+
   bool runInvocation(
       std::shared_ptr<clang::CompilerInvocation> Invocation,
       clang::FileManager* Files,
@@ -237,6 +304,17 @@ class StdinAdjustSingleFrontendActionFactory
     Invocation->getDependencyOutputOpts().HeaderIncludeOutputFile.clear();
     Invocation->getDependencyOutputOpts().DOTOutputFile.clear();
     Invocation->getDependencyOutputOpts().ModuleDependencyOutputDir.clear();
+    if (Preambles != nullptr) {
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> VFS = PreambleVFS;
+      if (auto Preamble = Preambles->Use(PreambleKey, Invocation.get(), &VFS,
+                                         PCHContainerOps)) {
+        // The preamble is read from an overlay on the unit's filesystem.
+        llvm::IntrusiveRefCntPtr<clang::FileManager> PreambleFiles(
+            new clang::FileManager(Files->getFileSystemOpts(), VFS));
+        return clang::tooling::FrontendActionFactory::runInvocation(
+            Invocation, PreambleFiles.get(), PCHContainerOps, DiagConsumer);
+      }
+    }
     return clang::tooling::FrontendActionFactory::runInvocation(
         Invocation, Files, PCHContainerOps, DiagConsumer);
   }
@@ -246,9 +324,20 @@ class StdinAdjustSingleFrontendActionFactory
   std::unique_ptr<clang::FrontendAction> create() override {
     return std::move(Action);
   }
+
+ private:
+  /// Preambles to load the main file's from, or null.
+  PreambleCache* Preambles = nullptr;
+  /// Identifies the main file and its arguments in `Preambles`.
+  std::string PreambleKey;
+  /// The filesystem to build and load preambles with.
+  llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> PreambleVFS;
 };
 
 /// \brief Options that control how the indexer behaves.
+///
+/// Options that change what the indexer emits must also be serialized by
+/// `IncrementalKeySeed`.
 struct IndexerOptions {
   /// \brief The directory to normalize paths against. Must be absolute.
   std::string EffectiveWorkingDirectory = "/";
@@ -260,6 +349,15 @@ struct IndexerOptions {
       BehaviorOnUnimplemented::Abort;
   /// \brief Whether to emit all data.
   enum Verbosity Verbosity = kythe::Verbosity::Classic;
+  /// \brief Which function bodies to skip. Skipping bodies limits the output
+  /// to declarations, types and the refs made outside of skipped bodies (see
+  /// `BehaviorOnFunctionBodies`); it is meant to be paired with
+  /// `Verbosity::Lite` for passes that only need the unit's interface.
+  BehaviorOnFunctionBodies FunctionBodies = BehaviorOnFunctionBodies::Index;
+  /// \brief When to record the definitions of macros in system headers.
+  /// With `DefineIfUsed`, a unit only records those its non-system code
+  /// uses, so definitions no indexed code uses are dropped.
+  BehaviorOnSystemMacros SystemMacros = BehaviorOnSystemMacros::Define;
   /// \brief Should we emit documentation for forward class decls in ObjC?
   BehaviorOnFwdDeclComments ObjCFwdDocs = BehaviorOnFwdDeclComments::Emit;
   /// \brief Should we emit documentation for forward decls in C++?
@@ -271,7 +369,7 @@ struct IndexerOptions {
   bool DropInstantiationIndependentData = false;
   /// \brief A function that is called as the indexer enters and exits various
   /// phases of execution (in strict LIFO order).
-  ProfilingCallback ReportProfileEvent = [](const char*, ProfilingEvent) {};
+  ProfilingCallback ReportProfileEvent;
   /// \brief A callback to determine whether to cancel indexing as quickly
   /// as possible.
   /// \return true if indexing should be cancelled.
@@ -284,10 +382,68 @@ struct IndexerOptions {
   bool UseCompilationCorpusAsDefault = false;
   /// \brief Whether to emit dataflow edges.
   EmitDataflowEdges DataflowEdges = EmitDataflowEdges::No;
-  /// \brief Pattern used to exclude paths from template instance indexing.
-  std::shared_ptr<re2::RE2> TemplateInstanceExcludePathPattern;
+  /// \brief If nonzero, dataflow edges are recorded as soon as this many
+  /// decls influence one value, and the set is started afresh. This bounds
+  /// the memory used on long generated expressions at the cost of some
+  /// duplicate edges.
+  size_t InfluenceSetLimit = 0;
+  /// \brief Patterns used to exclude paths from template instance indexing.
+  std::shared_ptr<const RegexSet> TemplateInstanceExcludePathPatterns;
+  /// \brief Limits on the resources each unit may use. As a unit exceeds them,
+  /// the indexer progressively stops indexing template instantiations,
+  /// emitting dataflow edges and generating marked source.
+  ResourceLimits UnitBudget;
+  /// \brief If non-null, counts the entries recorded for the unit by kind.
+  EntryBreakdown* OutputBreakdown = nullptr;
+  /// \brief If both are non-null, type and doc nodes are deduplicated against
+  /// these sets, which may be shared by all units written to one output.
+  NodeFingerprintSet* SharedWrittenTypes = nullptr;
+  NodeFingerprintSet* SharedWrittenDocs = nullptr;
+  /// \brief If non-null, a template instantiation whose cleanup id is
+  /// already in this set isn't indexed again. The set may be shared by all
+  /// units written to one output.
+  NodeFingerprintSet* SharedIndexedInstantiations = nullptr;
+  /// \brief If non-null, marked source generated from source text is reused
+  /// through this memo, which may be shared by several units.
+  MarkedSourceMemo* SharedMarkedSource = nullptr;
+  /// \brief If non-null, type nodes built by earlier units are reused
+  /// through this cache. Only set this along with `SharedWrittenTypes`, since
+  /// units that reuse a node don't write it.
+  TypeNodeCache* SharedTypeNodes = nullptr;
+  /// \brief If non-null, metadata files parsed by earlier units are reused
+  /// through this cache, which may be shared by several units.
+  MetadataCache* SharedMetadata = nullptr;
+  /// \brief If non-null, the entries emitted while traversing each claimed
+  /// file's declarations are replayed from this store when an earlier run
+  /// recorded them for the same inputs, and recorded to it otherwise.
+  IncrementalStore* IncrementalBlocks = nullptr;
+  /// \brief Whether to look each claimed top-level declaration that
+  /// depends only on its own file up in the unit's `HashCache` before
+  /// traversing it, and to skip it if an earlier unit emitted it. Has no
+  /// effect without a cache or with `IncrementalBlocks`.
+  bool ProbeGroupKeys = false;
+  /// \brief If non-null, receives the time spent parsing the unit,
+  /// traversing its AST and emitting its entries.
+  UnitMetrics* Metrics = nullptr;
+  /// \brief If set, reads the content of the files passed to
+  /// `IndexCompilationUnit` that have a digest but no content when clang
+  /// first opens them.
+  FileContentReader ReadFileContent;
+  /// \brief If non-null, a unit whose main file was indexed earlier loads its
+  /// leading #includes from a precompiled preamble kept here rather than
+  /// parsing them, and only the rest of its main file is indexed. See
+  /// `PreambleCache`.
+  PreambleCache* Preambles = nullptr;
 };
 
+/// \brief Serializes everything besides the content of the files it enters
+/// that decides what indexing `Unit` with `Options` emits: the unit's
+/// arguments (less the names of its source files), working directory and
+/// build config, and every option that affects the output. Incremental blocks
+/// and group keys are keyed by it.
+std::string IncrementalKeySeed(const proto::CompilationUnit& Unit,
+                               const IndexerOptions& Options);
+
 /// \brief Indexes `Unit`, reading from `Files` in the assumed and writing
 /// entries to `Output`.
 /// \param Unit The CompilationUnit to index
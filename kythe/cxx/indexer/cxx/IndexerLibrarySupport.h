@@ -20,6 +20,7 @@
 #define KYTHE_CXX_INDEXER_CXX_INDEXER_LIBRARY_SUPPORT_H_
 
 #include "GraphObserver.h"
+#include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/Expr.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
@@ -47,6 +48,50 @@ class LibrarySupport {
     GraphObserver::NodeId DeclId;
   };
 
+  /// \brief Called once per translation unit, after it has been parsed and
+  /// before any of the other hooks.
+  ///
+  /// Supports are shared by every unit (and thread), so this should be cheap
+  /// and must not keep per-unit state.
+  ///
+  /// \param Context The unit's ASTContext.
+  /// \return false if this support can't apply to the unit, in which case
+  /// none of its other hooks are called for it.
+  virtual bool AppliesTo(const clang::ASTContext& Context) const {
+    return true;
+  }
+
+  /// \brief State a support keeps for one translation unit.
+  class UnitState {
+   public:
+    virtual ~UnitState() {}
+  };
+
+  /// \brief Called once per translation unit for which `AppliesTo` returned
+  /// true, before any of the other hooks.
+  ///
+  /// Since supports are shared, anything a support wants to remember while
+  /// indexing one unit belongs here. The other hooks can find it with
+  /// `IndexerASTVisitor::getSupportState`.
+  ///
+  /// \return the state for the unit, or null if there is none.
+  virtual std::unique_ptr<UnitState> CreateUnitState(
+      const clang::ASTContext& Context) const {
+    return nullptr;
+  }
+
+  /// \brief Called while the unit is preprocessed for each macro expanded
+  /// directly in a file.
+  ///
+  /// Like `AppliesTo`, this is called for every unit and must be cheap and
+  /// stateless. Expansions of macros for which it returns true are
+  /// remembered by the unit's `GraphObserver`, so the other hooks can find
+  /// them with `GraphObserver::findLibraryMacroExpansion` instead of lexing
+  /// the source again.
+  ///
+  /// \param MacroName The name of the expanded macro.
+  virtual bool InspectsMacro(llvm::StringRef MacroName) const { return false; }
+
   /// \brief Called when a variable is defined or declared, including
   /// events due to template instantiations.
   ///
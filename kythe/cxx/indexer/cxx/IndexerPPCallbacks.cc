@@ -18,11 +18,14 @@
 
 #include "IndexerPPCallbacks.h"
 
+#include <algorithm>
+
 #include "GraphObserver.h"
 #include "absl/strings/str_format.h"
 #include "clang/Basic/FileManager.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Index/USRGeneration.h"
+#include "clang/Lex/MacroArgs.h"
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
 #include "glog/logging.h"
@@ -145,6 +148,17 @@ void IndexerPPCallbacks::MacroDefined(const clang::Token& Token,
     // This is a builtin macro. Ignore it.
     return;
   }
+  if (SystemMacros == BehaviorOnSystemMacros::DefineIfUsed &&
+      Observer.getSourceManager()->isInSystemHeader(Info.getDefinitionLoc())) {
+    UnusedSystemMacros.try_emplace(&Info, PendingDefinition{Token, Macro});
+    return;
+  }
+  RecordMacroDefinition(Token, *Macro);
+}
+
+void IndexerPPCallbacks::RecordMacroDefinition(
+    const clang::Token& Token, const clang::MacroDirective& Macro) {
+  const clang::MacroInfo& Info = *Macro.getMacroInfo();
   GraphObserver::NodeId MacroId = BuildNodeIdForMacro(Token, Info);
   if (Observer.claimNode(MacroId)) {
     GraphObserver::NameId MacroName = BuildNameIdForMacro(Token);
@@ -158,7 +172,7 @@ void IndexerPPCallbacks::MacroDefined(const clang::Token& Token,
     if (UsrByteSize > 0) {
       llvm::SmallString<128> Usr;
       if (!clang::index::generateUSRForMacro(
-              Token.getIdentifierInfo()->getName(), Macro->getLocation(),
+              Token.getIdentifierInfo()->getName(), Macro.getLocation(),
               *Observer.getSourceManager(), Usr)) {
         Observer.assignUsr(MacroId, Usr, UsrByteSize);
       }
@@ -168,6 +182,24 @@ void IndexerPPCallbacks::MacroDefined(const clang::Token& Token,
   // references).
 }
 
+void IndexerPPCallbacks::NoteMacroUse(const clang::MacroInfo& Info,
+                                      clang::SourceLocation Loc) {
+  if (UnusedSystemMacros.empty()) {
+    return;
+  }
+  auto Found = UnusedSystemMacros.find(&Info);
+  if (Found == UnusedSystemMacros.end()) {
+    return;
+  }
+  const auto& SM = *Observer.getSourceManager();
+  if (Loc.isInvalid() || SM.isInSystemHeader(SM.getExpansionLoc(Loc))) {
+    return;
+  }
+  PendingDefinition Definition = Found->second;
+  UnusedSystemMacros.erase(Found);
+  RecordMacroDefinition(Definition.MacroName, *Definition.Macro);
+}
+
 void IndexerPPCallbacks::MacroUndefined(const clang::Token& MacroName,
                                         const clang::MacroDefinition& Macro,
                                         const clang::MacroDirective* Undef) {
@@ -175,11 +207,39 @@ void IndexerPPCallbacks::MacroUndefined(const clang::Token& MacroName,
     return;
   }
   const clang::MacroInfo& Info = *Macro.getMacroInfo();
+  NoteMacroUse(Info, MacroName.getLocation());
   GraphObserver::NodeId MacroId = BuildNodeIdForMacro(MacroName, Info);
   Observer.recordUndefinesRange(RangeForTokenInCurrentContext(MacroName),
                                 MacroId);
 }
 
+void IndexerPPCallbacks::RecordLibraryMacroExpansion(
+    const clang::Token& Token, const clang::MacroArgs* Args) {
+  if (Supports == nullptr || !Token.getLocation().isFileID() ||
+      Token.getIdentifierInfo() == nullptr) {
+    return;
+  }
+  llvm::StringRef MacroName = Token.getIdentifierInfo()->getName();
+  if (std::none_of(Supports->begin(), Supports->end(),
+                   [&](const std::unique_ptr<LibrarySupport>& S) {
+                     return S->InspectsMacro(MacroName);
+                   })) {
+    return;
+  }
+  GraphObserver::LibraryMacroExpansion Expansion;
+  Expansion.MacroName = MacroName;
+  if (Args != nullptr && Args->getNumMacroArguments() > 0) {
+    const clang::Token* First = Args->getUnexpArgument(0);
+    if (First != nullptr && First->getIdentifierInfo() != nullptr &&
+        First->getLocation().isFileID()) {
+      Expansion.FirstArgument = First->getIdentifierInfo()->getName();
+      Expansion.FirstArgumentRange =
+          clang::SourceRange(First->getLocation(), First->getEndLoc());
+    }
+  }
+  Observer.recordLibraryMacroExpansion(Token.getLocation(), Expansion);
+}
+
 void IndexerPPCallbacks::MacroExpands(const clang::Token& Token,
                                       const clang::MacroDefinition& Macro,
                                       clang::SourceRange Range,
@@ -189,6 +249,8 @@ void IndexerPPCallbacks::MacroExpands(const clang::Token& Token,
   }
 
   const clang::MacroInfo& Info = *Macro.getMacroInfo();
+  NoteMacroUse(Info, Token.getLocation());
+  RecordLibraryMacroExpansion(Token, Args);
   GraphObserver::NodeId MacroId = BuildNodeIdForMacro(Token, Info);
   if (!Range.getBegin().isFileID() || !Range.getEnd().isFileID()) {
     if (Verbosity) {
@@ -217,6 +279,9 @@ void IndexerPPCallbacks::MacroExpands(const clang::Token& Token,
 void IndexerPPCallbacks::Defined(const clang::Token& MacroName,
                                  const clang::MacroDefinition& Macro,
                                  clang::SourceRange Range) {
+  if (Macro) {
+    NoteMacroUse(*Macro.getMacroInfo(), MacroName.getLocation());
+  }
   DeferredRecords.push_back(
       DeferredRecord{MacroName, Macro ? Macro.getLocalDirective() : nullptr,
                      Macro && Macro.getLocalDirective()->isDefined(),
@@ -283,6 +348,7 @@ void IndexerPPCallbacks::AddReferenceToMacro(const clang::Token& MacroNameToken,
                                              clang::MacroInfo const& Info,
                                              bool IsDefined) {
   llvm::StringRef MacroName(MacroNameToken.getIdentifierInfo()->getName());
+  NoteMacroUse(Info, MacroNameToken.getLocation());
   Observer.recordExpandsRange(RangeForTokenInCurrentContext(MacroNameToken),
                               BuildNodeIdForMacro(MacroNameToken, Info));
 }
@@ -302,6 +368,10 @@ GraphObserver::NodeId IndexerPPCallbacks::BuildNodeIdForMacro(
   // in source text (or are implicit). For this reason, it's safe to use
   // location information to stably unique them. However, we must be careful
   // to select canonical paths.
+  auto Found = MacroIds.find(&Info);
+  if (Found != MacroIds.end()) {
+    return Found->second;
+  }
   clang::SourceLocation Loc = Info.getDefinitionLoc();
   std::string IdString;
   llvm::raw_string_ostream Ostream(IdString);
@@ -324,8 +394,10 @@ GraphObserver::NodeId IndexerPPCallbacks::BuildNodeIdForMacro(
     // cases should contain canonical source file information).
     Ostream << "@" << SM.getFileOffset(Loc);
   }
-  return GraphObserver::NodeId(Observer.getClaimTokenForLocation(Loc),
-                               Ostream.str());
+  GraphObserver::NodeId Id(Observer.getClaimTokenForLocation(Loc),
+                           Ostream.str());
+  MacroIds.try_emplace(&Info, Id);
+  return Id;
 }
 
 void IndexerPPCallbacks::HandleKytheMetadataPragma(
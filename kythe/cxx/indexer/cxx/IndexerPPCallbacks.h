@@ -24,9 +24,18 @@
 #include "clang/Basic/SourceManager.h"
 #include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Token.h"
+#include "llvm/ADT/DenseMap.h"
 
 namespace kythe {
 
+/// \brief Specifies when the definitions of macros in system headers are
+/// recorded.
+enum class BehaviorOnSystemMacros {
+  Define,       ///< Record every definition when it is seen.
+  DefineIfUsed  ///< Record a definition only once the macro is expanded or
+                ///< tested outside of system headers.
+};
+
 /// \brief Listener for preprocessor events, handling file tracking and macro
 /// use and definition.
 class IndexerPPCallbacks : public clang::PPCallbacks {
@@ -98,6 +107,13 @@ class IndexerPPCallbacks : public clang::PPCallbacks {
 
   void EndOfMainFile() override;
 
+  /// \brief Chooses when definitions in system headers are recorded.
+  void setSystemMacros(BehaviorOnSystemMacros B) { SystemMacros = B; }
+
+  /// \brief Sets the supports whose macros should be remembered (see
+  /// `LibrarySupport::InspectsMacro`). `S` must outlive this object.
+  void setLibrarySupports(const LibrarySupports* S) { Supports = S; }
+
  private:
   /// Some heuristics (such as whether a macro is a header guard) can only
   /// be determined when a file has been fully preprocessed. A `DeferredRecord`
@@ -113,9 +129,33 @@ class IndexerPPCallbacks : public clang::PPCallbacks {
   /// heuristics.
   void FilterAndEmitDeferredRecords();
 
+  /// \brief Remembers the expansion of `Macro` named by `Token` if a
+  /// library support asked about it.
+  void RecordLibraryMacroExpansion(const clang::Token& Token,
+                                   const clang::MacroArgs* Args);
+
   /// \brief Keeps track of all DeferredRecords we've made.
   std::vector<DeferredRecord> DeferredRecords;
 
+  /// \brief A system macro definition that hasn't been recorded yet.
+  struct PendingDefinition {
+    clang::Token MacroName;              ///< The name at the definition.
+    const clang::MacroDirective* Macro;  ///< The definition itself.
+  };
+
+  /// \brief With `BehaviorOnSystemMacros::DefineIfUsed`, the system macros
+  /// whose definitions will be recorded if they are used.
+  llvm::DenseMap<const clang::MacroInfo*, PendingDefinition>
+      UnusedSystemMacros;
+
+  /// \brief Records the definition of the macro named by `Token`.
+  void RecordMacroDefinition(const clang::Token& Token,
+                             const clang::MacroDirective& Macro);
+
+  /// \brief Records a pending definition of `Info`, provided that it was
+  /// used at `Loc` from outside of a system header.
+  void NoteMacroUse(const clang::MacroInfo& Info, clang::SourceLocation Loc);
+
   /// \brief Returns `SR` as a `Range` in the `IndexerPPCallbacks`'s current
   /// RangeContext.
   GraphObserver::Range RangeInCurrentContext(const clang::SourceRange& SR) {
@@ -138,7 +178,8 @@ class IndexerPPCallbacks : public clang::PPCallbacks {
   /// \brief Returns the source range of `Token`.
   GraphObserver::Range RangeForTokenInCurrentContext(const clang::Token& Token);
 
-  /// \brief Builds a `NodeId` for some macro.
+  /// \brief Builds a `NodeId` for some macro, or returns the one already
+  /// built for `Info`.
   /// \param Spelling A token representing the macro's spelling.
   /// \param Info The `MacroInfo` representing the macro.
   GraphObserver::NodeId BuildNodeIdForMacro(const clang::Token& Spelling,
@@ -148,6 +189,11 @@ class IndexerPPCallbacks : public clang::PPCallbacks {
   /// \param Spelling A token representing the macro's spelling.
   GraphObserver::NameId BuildNameIdForMacro(const clang::Token& Spelling);
 
+  /// \brief Maps macros to their NodeIds. A `MacroInfo` lives as long as
+  /// the preprocessor, and its name and definition site (which are all its
+  /// NodeId depends on) never change.
+  llvm::DenseMap<const clang::MacroInfo*, GraphObserver::NodeId> MacroIds;
+
   /// The location of the hash for the last-seen #include.
   clang::SourceLocation LastInclusionHash;
   /// The `clang::Preprocessor` to which this `IndexerPPCallbacks` is listening.
@@ -159,6 +205,10 @@ class IndexerPPCallbacks : public clang::PPCallbacks {
   /// \brief The number of (raw) bytes to use to represent a USR. If 0,
   /// no USRs will be recorded.
   int UsrByteSize = 0;
+  /// When to record definitions in system headers.
+  BehaviorOnSystemMacros SystemMacros = BehaviorOnSystemMacros::Define;
+  /// The supports that may ask for macro expansions, or null.
+  const LibrarySupports* Supports = nullptr;
 };
 
 }  // namespace kythe
@@ -21,13 +21,18 @@ namespace {
 constexpr char kArbitraryClaimantRoot[] = "KytheClaimClient";
 }  // anonymous namespace
 
-bool KytheClaimClient::ClaimBatch(
-    std::vector<std::pair<std::string, bool>>* tokens) {
+kythe::proto::VName KytheClaimClient::TokenVName(const std::string& token) {
   kythe::proto::VName claim;
   claim.set_root(kArbitraryClaimantRoot);
+  claim.set_signature(token);
+  return claim;
+}
+
+bool KytheClaimClient::ClaimBatch(
+    std::vector<std::pair<std::string, bool>>* tokens) {
   bool success = false;
   for (auto& token : *tokens) {
-    claim.set_signature(token.first);
+    const kythe::proto::VName claim = TokenVName(token.first);
     if ((token.second = Claim(claim, claim))) {
       success = true;
     }
@@ -39,6 +44,11 @@ bool StaticClaimClient::Claim(const kythe::proto::VName& claimant,
                               const kythe::proto::VName& vname) {
   const auto lookup = claim_table_.find(vname);
   if (lookup == claim_table_.end()) {
+    if (mapped_table_ != nullptr) {
+      if (auto claimed = mapped_table_->IsClaimedBy(vname, claimant)) {
+        return *claimed;
+      }
+    }
     // We don't know who's responsible for this VName.
     return process_unknown_status_;
   }
@@ -50,4 +60,27 @@ void StaticClaimClient::AssignClaim(const kythe::proto::VName& claimable,
   claim_table_[claimable] = claimant;
 }
 
+bool SynchronizedClaimClient::Claim(const kythe::proto::VName& claimant,
+                                    const kythe::proto::VName& vname) {
+  absl::MutexLock lock(&mu_);
+  return client_->Claim(claimant, vname);
+}
+
+bool SynchronizedClaimClient::ClaimBatch(
+    std::vector<std::pair<std::string, bool>>* tokens) {
+  absl::MutexLock lock(&mu_);
+  return client_->ClaimBatch(tokens);
+}
+
+void SynchronizedClaimClient::AssignClaim(const kythe::proto::VName& claimable,
+                                          const kythe::proto::VName& claimant) {
+  absl::MutexLock lock(&mu_);
+  client_->AssignClaim(claimable, claimant);
+}
+
+void SynchronizedClaimClient::Reset() {
+  absl::MutexLock lock(&mu_);
+  client_->Reset();
+}
+
 }  // namespace kythe
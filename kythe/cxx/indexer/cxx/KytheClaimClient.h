@@ -18,7 +18,13 @@
 #define KYTHE_CXX_INDEXER_CXX_KYTHE_CLAIM_CLIENT_H_
 
 #include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "kythe/cxx/common/claim_table.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/proto/storage.pb.h"
 
@@ -58,6 +64,11 @@ class KytheClaimClient {
   /// \brief Resets any cached state, including any claims made by
   /// `AssignClaim`.
   virtual void Reset() {}
+
+ protected:
+  /// \return the VName that `ClaimBatch` claims for `token`, both as the
+  /// claimant and as the resource claimed.
+  static kythe::proto::VName TokenVName(const std::string& token);
 };
 
 /// \brief A client that makes static decisions about resources when possible.
@@ -79,13 +90,47 @@ class StaticClaimClient : public KytheClaimClient {
 
   void Reset() override { claim_table_.clear(); }
 
+  /// \brief Answers claims that weren't assigned with `AssignClaim` from
+  /// `table`, which may be shared and must outlive this client.
+  void UseClaimTable(const ClaimTable* table) { mapped_table_ = table; }
+
  private:
   /// Maps from claimables to claimants.
   std::map<kythe::proto::VName, kythe::proto::VName, VNameLess> claim_table_;
+  /// Claims for everything not in `claim_table_`, or null.
+  const ClaimTable* mapped_table_ = nullptr;
   /// Process data with unknown claim status?
   bool process_unknown_status_ = true;
 };
 
+/// \brief A client that serializes access to another client.
+///
+/// Used to share a single claim client between units that are being indexed
+/// concurrently.
+class SynchronizedClaimClient : public KytheClaimClient {
+ public:
+  /// \param client The client to forward to. Not owned; must outlive this.
+  explicit SynchronizedClaimClient(KytheClaimClient* client)
+      : client_(client) {}
+
+  bool Claim(const kythe::proto::VName& claimant,
+             const kythe::proto::VName& vname) override
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  bool ClaimBatch(std::vector<std::pair<std::string, bool>>* tokens) override
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  void AssignClaim(const kythe::proto::VName& claimable,
+                   const kythe::proto::VName& claimant) override
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  void Reset() override ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  absl::Mutex mu_;
+  KytheClaimClient* client_ ABSL_GUARDED_BY(mu_);
+};
+
 }  // namespace kythe
 
 #endif  // KYTHE_CXX_INDEXER_CXX_KYTHE_CLAIM_CLIENT_H_
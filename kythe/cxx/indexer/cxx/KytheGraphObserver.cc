@@ -16,11 +16,15 @@
 
 #include "KytheGraphObserver.h"
 
-#include "IndexerASTHooks.h"
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+#include "absl/container/inlined_vector.h"
 #include "absl/flags/flag.h"
+#include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
-#include "absl/strings/str_join.h"
 #include "clang/AST/Attr.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclCXX.h"
@@ -54,11 +58,16 @@ ABSL_FLAG(bool, fail_on_unimplemented_builtin, false,
 namespace kythe {
 namespace {
 
-struct ClaimedStringFormatter {
-  void operator()(std::string* out, const GraphObserver::NodeId& id) {
-    out->append(id.ToClaimedString());
+/// \brief Appends the claimed strings of `ids` to `out`, separated by commas.
+void AppendClaimedStrings(absl::Span<const GraphObserver::NodeId> ids,
+                          std::string* out) {
+  for (size_t i = 0; i < ids.size(); ++i) {
+    if (i != 0) {
+      out->push_back(',');
+    }
+    ids[i].AppendClaimedString(out);
   }
-};
+}
 
 absl::string_view ConvertRef(llvm::StringRef ref) {
   return absl::string_view(ref.data(), ref.size());
@@ -76,6 +85,167 @@ EdgeKindID EdgeKindForUseKind(GraphObserver::UseKind kind,
   }
 }
 
+constexpr PreprocessorContextTable::ContextId kEmptyContext =
+    PreprocessorContextTable::kEmptyContext;
+
+/// \brief Names the missing piece of a failed context lookup.
+const char* DescribeContextMiss(PreprocessorContextTable::Miss miss) {
+  switch (miss) {
+    case PreprocessorContextTable::Miss::kNone:
+      return "nothing";
+    case PreprocessorContextTable::Miss::kFile:
+      return "path";
+    case PreprocessorContextTable::Miss::kContext:
+      return "context";
+    case PreprocessorContextTable::Miss::kOffset:
+      return "offset";
+  }
+  return "unknown";
+}
+
+/// \brief Describes a builtin type node.
+struct BuiltinSpec {
+  /// The builtin's spelling, as passed to `getNodeIdForBuiltinType`.
+  std::string name;
+  /// The identity of the builtin's node.
+  std::string identity;
+  /// Marked source for the builtin.
+  MarkedSource marked_source;
+};
+
+/// \brief The builtins every `KytheGraphObserver` knows about.
+///
+/// The table doesn't depend on the unit being indexed, so it's built once per
+/// process. `NodeId`s can't be stored here, since they're interned per unit.
+struct BuiltinTable {
+  BuiltinTable();
+  std::vector<BuiltinSpec> builtins;
+  /// Maps from names to indices in `builtins`.
+  absl::flat_hash_map<absl::string_view, size_t> index;
+};
+
+BuiltinTable::BuiltinTable() {
+  auto RegisterBuiltin = [&](const std::string& name,
+                             const MarkedSource& marked_source) {
+    builtins.push_back(BuiltinSpec{name, name + "#builtin", marked_source});
+  };
+  auto RegisterTokenBuiltin = [&](const std::string& name,
+                                  const std::string& token) {
+    MarkedSource sig;
+    sig.set_kind(MarkedSource::IDENTIFIER);
+    sig.set_pre_text(token);
+    RegisterBuiltin(name, sig);
+  };
+  RegisterTokenBuiltin("void", "void");
+  RegisterTokenBuiltin("bool", "bool");
+  RegisterTokenBuiltin("_Bool", "_Bool");
+  RegisterTokenBuiltin("signed char", "signed char");
+  RegisterTokenBuiltin("char", "char");
+  RegisterTokenBuiltin("char16_t", "char16_t");
+  RegisterTokenBuiltin("char32_t", "char32_t");
+  RegisterTokenBuiltin("wchar_t", "wchar_t");
+  RegisterTokenBuiltin("short", "short");
+  RegisterTokenBuiltin("int", "int");
+  RegisterTokenBuiltin("long", "long");
+  RegisterTokenBuiltin("long long", "long long");
+  RegisterTokenBuiltin("unsigned char", "unsigned char");
+  RegisterTokenBuiltin("unsigned short", "unsigned short");
+  RegisterTokenBuiltin("unsigned int", "unsigned int");
+  RegisterTokenBuiltin("unsigned long", "unsigned long");
+  RegisterTokenBuiltin("unsigned long long", "unsigned long long");
+  RegisterTokenBuiltin("float", "float");
+  RegisterTokenBuiltin("double", "double");
+  RegisterTokenBuiltin("long double", "long double");
+  RegisterTokenBuiltin("nullptr_t", "nullptr_t");
+  RegisterTokenBuiltin("<dependent type>", "dependent");
+  RegisterTokenBuiltin("auto", "auto");
+  RegisterTokenBuiltin("knrfn", "function");
+  RegisterTokenBuiltin("__int128", "__int128");
+  RegisterTokenBuiltin("unsigned __int128", "unsigned __int128");
+  RegisterTokenBuiltin("SEL", "SEL");
+  RegisterTokenBuiltin("id", "id");
+  RegisterTokenBuiltin("TypeUnion", "TypeUnion");
+  RegisterTokenBuiltin("__float128", "__float128");
+
+  {
+    MarkedSource lhs_tycon_builtin;
+    auto* lhs_tycon = lhs_tycon_builtin.add_child();
+    auto* lookup = lhs_tycon_builtin.add_child();
+    lookup->set_kind(MarkedSource::LOOKUP_BY_PARAM);
+    lookup->set_lookup_index(1);
+    lhs_tycon->set_kind(MarkedSource::IDENTIFIER);
+    lhs_tycon->set_pre_text("const ");
+    RegisterBuiltin("const", lhs_tycon_builtin);
+    lhs_tycon->set_pre_text("volatile ");
+    RegisterBuiltin("volatile", lhs_tycon_builtin);
+    lhs_tycon->set_pre_text("restrict ");
+    RegisterBuiltin("restrict", lhs_tycon_builtin);
+  }
+
+  {
+    MarkedSource rhs_tycon_builtin;
+    auto* lookup = rhs_tycon_builtin.add_child();
+    auto* rhs_tycon = rhs_tycon_builtin.add_child();
+    lookup->set_kind(MarkedSource::LOOKUP_BY_PARAM);
+    lookup->set_lookup_index(1);
+    rhs_tycon->set_kind(MarkedSource::IDENTIFIER);
+    rhs_tycon->set_pre_text("*");
+    RegisterBuiltin("ptr", rhs_tycon_builtin);
+    rhs_tycon->set_pre_text("&");
+    RegisterBuiltin("lvr", rhs_tycon_builtin);
+    rhs_tycon->set_pre_text("&&");
+    RegisterBuiltin("rvr", rhs_tycon_builtin);
+    rhs_tycon->set_pre_text("[incomplete]");
+    RegisterBuiltin("iarr", rhs_tycon_builtin);
+    rhs_tycon->set_pre_text("[const]");
+    RegisterBuiltin("carr", rhs_tycon_builtin);
+    rhs_tycon->set_pre_text("[dependent]");
+    RegisterBuiltin("darr", rhs_tycon_builtin);
+  }
+
+  {
+    MarkedSource mem_ptr_tycon_builtin;
+    auto* pointee_type = mem_ptr_tycon_builtin.add_child();
+    pointee_type->set_kind(MarkedSource::LOOKUP_BY_PARAM);
+    pointee_type->set_lookup_index(1);
+    auto* class_type = mem_ptr_tycon_builtin.add_child();
+    class_type->set_kind(MarkedSource::LOOKUP_BY_PARAM);
+    class_type->set_lookup_index(2);
+    class_type->set_pre_text(" ");
+    class_type->set_post_text("::");
+    auto* ident = mem_ptr_tycon_builtin.add_child();
+    ident->set_kind(MarkedSource::IDENTIFIER);
+    ident->set_pre_text("*");
+    RegisterBuiltin("mptr", mem_ptr_tycon_builtin);
+  }
+
+  {
+    MarkedSource function_tycon_builtin;
+    auto* return_type = function_tycon_builtin.add_child();
+    return_type->set_kind(MarkedSource::LOOKUP_BY_PARAM);
+    return_type->set_lookup_index(1);
+    auto* args = function_tycon_builtin.add_child();
+    args->set_kind(MarkedSource::PARAMETER_LOOKUP_BY_PARAM);
+    args->set_pre_text("(");
+    args->set_post_child_text(", ");
+    args->set_post_text(")");
+    args->set_lookup_index(2);
+    RegisterBuiltin("fn", function_tycon_builtin);
+    auto* vararg_keyword = function_tycon_builtin.add_child();
+    vararg_keyword->set_kind(MarkedSource::IDENTIFIER);
+    vararg_keyword->set_pre_text("vararg");
+    RegisterBuiltin("fnvararg", function_tycon_builtin);
+  }
+  for (size_t i = 0; i < builtins.size(); ++i) {
+    index.emplace(builtins[i].name, i);
+  }
+}
+
+const BuiltinTable& GetBuiltinTable() {
+  static const BuiltinTable* const table = new BuiltinTable();
+  return *table;
+}
+
 }  // anonymous namespace
 
 using clang::SourceLocation;
@@ -111,9 +281,13 @@ static const char* FunctionSubkindToString(
   return "invalid-fn-subkind";
 }
 
-kythe::proto::VName KytheGraphObserver::VNameFromFileEntry(
+const kythe::proto::VName& KytheGraphObserver::VNameFromFileEntry(
     const clang::FileEntry* file_entry) {
-  kythe::proto::VName out_name;
+  auto [iter, inserted] = file_entry_vnames_.try_emplace(file_entry);
+  kythe::proto::VName& out_name = iter->second;
+  if (!inserted) {
+    return out_name;
+  }
   if (!vfs_->get_vname(file_entry, &out_name)) {
     llvm::StringRef working_directory = vfs_->working_directory();
     llvm::StringRef file_name(file_entry->getName());
@@ -128,23 +302,45 @@ kythe::proto::VName KytheGraphObserver::VNameFromFileEntry(
   return out_name;
 }
 
+const kythe::proto::VName* KytheGraphObserver::VNameFromFileID(
+    clang::FileID file_id) {
+  auto [iter, inserted] = file_id_vnames_.try_emplace(file_id, nullptr);
+  if (inserted) {
+    if (const clang::FileEntry* file_entry =
+            SourceManager->getFileEntryForID(file_id)) {
+      iter->second = &VNameFromFileEntry(file_entry);
+    }
+  }
+  return iter->second;
+}
+
 void KytheGraphObserver::AppendFileBufferSliceHashToStream(
     clang::SourceLocation loc, llvm::raw_ostream& Ostream) {
   // TODO(zarko): Does this mechanism produce sufficiently unique
   // identifiers? Ideally, we would hash the full buffer segment into
   // which `loc` points, then record `loc`'s offset.
+  auto [cached, inserted] = slice_hashes_.try_emplace(loc.getRawEncoding());
+  if (!inserted) {
+    Ostream << cached->second;
+    return;
+  }
   bool was_invalid = false;
   auto* buffer = SourceManager->getCharacterData(loc, &was_invalid);
   size_t offset = SourceManager->getFileOffset(loc);
   if (was_invalid) {
-    Ostream << "!invalid[" << offset << "]";
+    cached->second = absl::StrCat("!invalid[", offset, "]");
+    Ostream << cached->second;
     return;
   }
   auto loc_end = clang::Lexer::getLocForEndOfToken(
       loc, 0 /* offset from end of token */, *SourceManager, *getLangOptions());
   size_t offset_end = SourceManager->getFileOffset(loc_end);
-  Ostream << HashToString(
-      llvm::hash_value(llvm::StringRef(buffer, offset_end - offset)));
+  // Scratch buffers grow as tokens are pasted, so only the bytes up to the
+  // end of this token are known to be stable.
+  absl::string_view prefix(buffer - offset, offset_end);
+  auto& hasher = slice_hashers_[SourceManager->getFileID(loc)];
+  cached->second = HashToString(hasher.Hash(prefix, offset, offset_end));
+  Ostream << cached->second;
 }
 
 void KytheGraphObserver::AppendFullLocationToStream(
@@ -178,7 +374,7 @@ void KytheGraphObserver::AppendFullLocationToStream(
     }
     posted_fileids->push_back(file_id);
     if (file_entry) {
-      kythe::proto::VName file_vname(VNameFromFileEntry(file_entry));
+      const kythe::proto::VName& file_vname = VNameFromFileEntry(file_entry);
       if (!file_vname.corpus().empty()) {
         Ostream << file_vname.corpus() << "/";
       }
@@ -212,34 +408,6 @@ void KytheGraphObserver::AppendRangeToStream(llvm::raw_ostream& Ostream,
   }
 }
 
-/// \brief Attempt to associate a `SourceLocation` with a `FileEntry` by
-/// searching through the location's macro expansion history.
-/// \param loc The location to associate. Any `SourceLocation` is acceptable.
-/// \param source_manager The `SourceManager` that generated `loc`.
-/// \return a `FileEntry` if one was found, null otherwise.
-static const clang::FileEntry* SearchForFileEntry(
-    clang::SourceLocation loc, clang::SourceManager* source_manager) {
-  clang::FileID file_id = source_manager->getFileID(loc);
-  const clang::FileEntry* out = loc.isFileID() && loc.isValid()
-                                    ? source_manager->getFileEntryForID(file_id)
-                                    : nullptr;
-  if (out) {
-    return out;
-  }
-  auto expansion = source_manager->getExpansionLoc(loc);
-  if (expansion.isValid() && expansion != loc) {
-    out = SearchForFileEntry(expansion, source_manager);
-    if (out) {
-      return out;
-    }
-  }
-  auto spelling = source_manager->getSpellingLoc(loc);
-  if (spelling.isValid() && spelling != loc) {
-    out = SearchForFileEntry(spelling, source_manager);
-  }
-  return out;
-}
-
 kythe::proto::VName KytheGraphObserver::StampedVNameFromRange(
     const GraphObserver::Range& range, const GraphObserver::NodeId& stamp) {
   auto vname = VNameFromRange(range);
@@ -269,9 +437,11 @@ kythe::proto::VName KytheGraphObserver::VNameFromRange(
     if (end.isMacroID()) {
       end = SourceManager->getExpansionLoc(end);
     }
-    if (const clang::FileEntry* file_entry =
-            SearchForFileEntry(begin, SourceManager)) {
-      out_name.CopyFrom(VNameFromFileEntry(file_entry));
+    // `begin` is now a file location, so the only file it could be
+    // associated with is the one it's in.
+    if (const kythe::proto::VName* file_vname =
+            VNameFromFileID(SourceManager->getFileID(begin))) {
+      out_name.CopyFrom(*file_vname);
     } else if (range.Kind == GraphObserver::Range::RangeKind::Wraith) {
       VNameRefFromNodeId(range.Context).Expand(&out_name);
     }
@@ -292,18 +462,21 @@ kythe::proto::VName KytheGraphObserver::VNameFromRange(
   if (!build_config_.empty()) {
     absl::StrAppend(out_name.mutable_signature(), "%", build_config_);
   }
-  out_name.set_signature(CompressString(out_name.signature()));
+  char compressed[kCompressedStringSize];
+  absl::string_view signature =
+      CompressString(out_name.signature(), compressed);
+  if (signature.data() == compressed) {
+    out_name.set_signature(signature.data(), signature.size());
+  }
   return out_name;
 }
 
-void KytheGraphObserver::RecordSourceLocation(
-    const VNameRef& vname, clang::SourceLocation source_location,
-    PropertyID offset_id) {
+std::string KytheGraphObserver::FileOffset(
+    clang::SourceLocation source_location) const {
   if (source_location.isMacroID()) {
     source_location = SourceManager->getExpansionLoc(source_location);
   }
-  size_t offset = SourceManager->getFileOffset(source_location);
-  recorder_->AddProperty(vname, offset_id, offset);
+  return std::to_string(SourceManager->getFileOffset(source_location));
 }
 
 void KytheGraphObserver::recordMacroNode(const NodeId& macro_id) {
@@ -369,7 +542,7 @@ void KytheGraphObserver::recordVariableNode(
 void KytheGraphObserver::recordNamespaceNode(
     const NodeId& node, const absl::optional<MarkedSource>& marked_source) {
   VNameRef node_vname = VNameRefFromNodeId(node);
-  if (written_namespaces_.insert(node.ToClaimedString()).second) {
+  if (written_namespaces_.Insert(node.ToClaimedString())) {
     recorder_->AddProperty(node_vname, NodeKindID::kPackage);
     recorder_->AddProperty(node_vname, PropertyID::kSubkind, "namespace");
     AddMarkedSource(node_vname, marked_source);
@@ -378,32 +551,75 @@ void KytheGraphObserver::recordNamespaceNode(
 
 void KytheGraphObserver::RecordRange(const proto::VName& anchor_name,
                                      const GraphObserver::Range& range) {
-  if (!deferring_nodes_ || deferred_anchors_.insert(range).second) {
+  if (deferring_nodes_) {
+    deferred_anchors_.push_back(range);
+  } else {
     UnconditionalRecordRange(anchor_name, range);
   }
 }
 
+void KytheGraphObserver::FlushDeferredAnchors() {
+  // Ranges that compare equal share a key, but not every range that shares
+  // a key is equal: contexts are only compared by identity here, not by
+  // claim token. The key doesn't depend on hashes, so the order is the same
+  // from run to run.
+  auto key = [](const Range& range) {
+    return std::make_tuple(
+        static_cast<int>(range.Kind),
+        range.PhysicalRange.getBegin().getRawEncoding(),
+        range.PhysicalRange.getEnd().getRawEncoding(),
+        range.Kind == Range::RangeKind::Physical
+            ? absl::string_view()
+            : absl::string_view(range.Context.getRawIdentity()));
+  };
+  std::stable_sort(
+      deferred_anchors_.begin(), deferred_anchors_.end(),
+      [&key](const Range& a, const Range& b) { return key(a) < key(b); });
+  for (size_t run = 0; run < deferred_anchors_.size();) {
+    size_t run_end = run + 1;
+    while (run_end < deferred_anchors_.size() &&
+           key(deferred_anchors_[run_end]) == key(deferred_anchors_[run])) {
+      ++run_end;
+    }
+    for (size_t i = run; i < run_end; ++i) {
+      const Range& range = deferred_anchors_[i];
+      if (std::find(deferred_anchors_.begin() + run,
+                    deferred_anchors_.begin() + i,
+                    range) == deferred_anchors_.begin() + i) {
+        UnconditionalRecordRange(VNameFromRange(range), range);
+      }
+    }
+    run = run_end;
+  }
+  deferred_anchors_.clear();
+  deferred_anchors_.shrink_to_fit();
+}
+
 void KytheGraphObserver::UnconditionalRecordRange(
     const proto::VName& anchor_name, const GraphObserver::Range& range) {
   VNameRef anchor_name_ref(anchor_name);
-  recorder_->AddProperty(anchor_name_ref, NodeKindID::kAnchor);
+  // Record all of the anchor's facts in one batch.
+  absl::InlinedVector<KytheGraphRecorder::Property, 5> properties;
+  properties.push_back(
+      {PropertyID::kNodeKind, spelling_of(NodeKindID::kAnchor)});
   if (range.Kind == GraphObserver::Range::RangeKind::Implicit) {
-    recorder_->AddProperty(anchor_name_ref, PropertyID::kSubkind, "implicit");
+    properties.push_back({PropertyID::kSubkind, "implicit"});
   }
+  std::string start_offset, end_offset;
   if (range.PhysicalRange.getBegin().isValid()) {
-    RecordSourceLocation(anchor_name_ref, range.PhysicalRange.getBegin(),
-                         PropertyID::kLocationStartOffset);
-    RecordSourceLocation(anchor_name_ref, range.PhysicalRange.getEnd(),
-                         PropertyID::kLocationEndOffset);
+    start_offset = FileOffset(range.PhysicalRange.getBegin());
+    end_offset = FileOffset(range.PhysicalRange.getEnd());
+    properties.push_back({PropertyID::kLocationStartOffset, start_offset});
+    properties.push_back({PropertyID::kLocationEndOffset, end_offset});
+  }
+  if (!build_config_.empty()) {
+    properties.push_back({PropertyID::kBuildConfig, build_config_});
   }
+  recorder_->AddProperties(anchor_name_ref, properties);
   if (range.Kind == GraphObserver::Range::RangeKind::Wraith) {
     recorder_->AddEdge(anchor_name_ref, EdgeKindID::kChildOfContext,
                        VNameRefFromNodeId(range.Context));
   }
-  if (!build_config_.empty()) {
-    recorder_->AddProperty(anchor_name_ref, PropertyID::kBuildConfig,
-                           build_config_);
-  }
 }
 
 void KytheGraphObserver::MetaHookDefines(const MetadataFile& meta,
@@ -411,36 +627,34 @@ void KytheGraphObserver::MetaHookDefines(const MetadataFile& meta,
                                          unsigned range_begin,
                                          unsigned range_end,
                                          const VNameRef& decl) {
-  auto rules = meta.rules().equal_range(range_begin);
-  for (auto rule = rules.first; rule != rules.second; ++rule) {
-    if (rule->second.begin == range_begin && rule->second.end == range_end &&
-        (rule->second.edge_in == kythe::common::schema::kDefines ||
-         rule->second.edge_in == kythe::common::schema::kDefinesBinding)) {
-      VNameRef remote(rule->second.vname);
+  for (const auto& rule : meta.RulesForRange(range_begin, range_end)) {
+    if (rule.edge_in == kythe::common::schema::kDefines ||
+        rule.edge_in == kythe::common::schema::kDefinesBinding) {
+      VNameRef remote(rule.vname);
       EdgeKindID edge_kind;
       std::string new_signature;
-      if (rule->second.generate_anchor) {
+      if (rule.generate_anchor) {
         // Distinguish these anchors from ordinary ones for easier debugging.
         new_signature = "@@m";
-        new_signature.append(std::to_string(rule->second.anchor_begin));
+        new_signature.append(std::to_string(rule.anchor_begin));
         new_signature.append("-");
-        new_signature.append(std::to_string(rule->second.anchor_end));
+        new_signature.append(std::to_string(rule.anchor_end));
         remote.set_signature(new_signature);
         recorder_->AddProperty(remote, NodeKindID::kAnchor);
         recorder_->AddProperty(remote, PropertyID::kLocationStartOffset,
-                               rule->second.anchor_begin);
+                               rule.anchor_begin);
         recorder_->AddProperty(remote, PropertyID::kLocationEndOffset,
-                               rule->second.anchor_end);
+                               rule.anchor_end);
       }
-      if (of_spelling(rule->second.edge_out, &edge_kind)) {
-        if (rule->second.reverse_edge) {
+      if (of_spelling(rule.edge_out, &edge_kind)) {
+        if (rule.reverse_edge) {
           recorder_->AddEdge(remote, edge_kind, decl);
         } else {
           recorder_->AddEdge(decl, edge_kind, remote);
         }
       } else {
         absl::FPrintF(stderr, "Unknown edge kind %s from metadata\n",
-                      rule->second.edge_out);
+                      rule.edge_out);
       }
     }
   }
@@ -486,8 +700,8 @@ void KytheGraphObserver::ApplyMetadataRules(
     if (anchor_edge_kind == EdgeKindID::kDefinesBinding) {
       clang::FileID def_file =
           SourceManager->getFileID(source_range.PhysicalRange.getBegin());
-      const auto metas = meta_.equal_range(def_file);
-      if (metas.first != metas.second) {
+      const auto metas = meta_.find(def_file);
+      if (metas != meta_.end()) {
         auto begin = source_range.PhysicalRange.getBegin();
         if (begin.isMacroID()) {
           begin = SourceManager->getExpansionLoc(begin);
@@ -498,12 +712,12 @@ void KytheGraphObserver::ApplyMetadataRules(
         }
         unsigned range_begin = SourceManager->getFileOffset(begin);
         unsigned range_end = SourceManager->getFileOffset(end);
-        for (auto meta = metas.first; meta != metas.second; ++meta) {
-          MetaHookDefines(*meta->second, VNameRef(anchor_name), range_begin,
+        for (const auto& meta : metas->second) {
+          MetaHookDefines(*meta, VNameRef(anchor_name), range_begin,
                           range_end,
                           VNameRefFromNodeId(primary_anchored_to_decl));
           if (primary_anchored_to_def) {
-            MetaHookDefines(*meta->second, VNameRef(anchor_name), range_begin,
+            MetaHookDefines(*meta, VNameRef(anchor_name), range_begin,
                             range_end,
                             VNameRefFromNodeId(*primary_anchored_to_def));
           }
@@ -725,16 +939,17 @@ void KytheGraphObserver::recordOverridesRootEdge(const NodeId& overrider,
 
 GraphObserver::NodeId KytheGraphObserver::nodeIdForTypeAliasNode(
     const NameId& alias_name, const NodeId& aliased_type) const {
-  return NodeId(&type_token_, "talias(" + alias_name.ToString() + "," +
-                                  aliased_type.ToClaimedString() + ")");
+  std::string identity = absl::StrCat("talias(", alias_name.ToString(), ",");
+  aliased_type.AppendClaimedString(&identity);
+  identity.push_back(')');
+  return NodeId(&type_token_, identity);
 }
 
 GraphObserver::NodeId KytheGraphObserver::recordTypeAliasNode(
     const NodeId& type_id, const NodeId& aliased_type,
     const absl::optional<NodeId>& root_aliased_type,
     const absl::optional<MarkedSource>& marked_source) {
-  if (!deferring_nodes_ ||
-      written_types_.insert(type_id.ToClaimedString()).second) {
+  if (!deferring_nodes_ || written_types_->Insert(type_id.ToClaimedString())) {
     VNameRef type_vname(VNameRefFromNodeId(type_id));
     recorder_->AddProperty(type_vname, NodeKindID::kTAlias);
     AddMarkedSource(type_vname, marked_source);
@@ -762,7 +977,7 @@ void KytheGraphObserver::recordDocumentationText(
   // characters appear in VName fields.
   NodeId doc_id(node.getToken(), CompressString(signature, true));
   VNameRef doc_vname(VNameRefFromNodeId(doc_id));
-  if (written_docs_.insert(doc_id.ToClaimedString()).second) {
+  if (written_docs_->Insert(doc_id.ToClaimedString())) {
     recorder_->AddProperty(doc_vname, NodeKindID::kDoc);
     recorder_->AddProperty(doc_vname, PropertyID::kText, doc_text);
     size_t param_index = 0;
@@ -826,8 +1041,7 @@ GraphObserver::NodeId KytheGraphObserver::nodeIdForNominalTypeNode(
 GraphObserver::NodeId KytheGraphObserver::recordNominalTypeNode(
     const NodeId& name_id, const absl::optional<MarkedSource>& marked_source,
     const absl::optional<NodeId>& parent) {
-  if (!deferring_nodes_ ||
-      written_types_.insert(name_id.ToClaimedString()).second) {
+  if (!deferring_nodes_ || written_types_->Insert(name_id.ToClaimedString())) {
     VNameRef type_vname(VNameRefFromNodeId(name_id));
     AddMarkedSource(type_vname, marked_source);
     recorder_->AddProperty(type_vname, NodeKindID::kTNominal);
@@ -841,22 +1055,24 @@ GraphObserver::NodeId KytheGraphObserver::recordNominalTypeNode(
 
 GraphObserver::NodeId KytheGraphObserver::nodeIdForTsigmaNode(
     absl::Span<const NodeId> params) const {
-  return GraphObserver::NodeId(
-      &type_token_,
-      absl::StrCat("#sigma(",
-                   absl::StrJoin(params, ",", ClaimedStringFormatter{}), ")"));
+  std::string identity = "#sigma(";
+  AppendClaimedStrings(params, &identity);
+  identity.push_back(')');
+  return GraphObserver::NodeId(&type_token_, identity);
 }
 
 GraphObserver::NodeId KytheGraphObserver::recordTsigmaNode(
     const NodeId& tsigma_id, absl::Span<const NodeId> params) {
   if (!deferring_nodes_ ||
-      written_types_.insert(tsigma_id.ToClaimedString()).second) {
+      written_types_->Insert(tsigma_id.ToClaimedString())) {
     VNameRef tsigma_vname = VNameRefFromNodeId(tsigma_id);
     recorder_->AddProperty(tsigma_vname, NodeKindID::kTSigma);
-    for (uint32_t param_index = 0; param_index < params.size(); ++param_index) {
-      recorder_->AddEdge(tsigma_vname, EdgeKindID::kParam,
-                         VNameRefFromNodeId(params[param_index]), param_index);
+    absl::InlinedVector<VNameRef, 8> param_vnames;
+    param_vnames.reserve(params.size());
+    for (const auto& param : params) {
+      param_vnames.push_back(VNameRefFromNodeId(param));
     }
+    recorder_->AddEdges(tsigma_vname, EdgeKindID::kParam, param_vnames, 0);
   }
   return tsigma_id;
 }
@@ -870,31 +1086,33 @@ GraphObserver::NodeId KytheGraphObserver::nodeIdForTappNode(
   //   foo (bar baz)
   // We'll turn it into a C-style function application:
   //   foo(bar,baz) || foo(bar(baz))
-  return GraphObserver::NodeId(
-      &type_token_,
-      absl::StrCat(tycon_id.ToClaimedString(), "(",
-                   absl::StrJoin(params, ",", ClaimedStringFormatter{}), ")"));
+  std::string identity;
+  tycon_id.AppendClaimedString(&identity);
+  identity.push_back('(');
+  AppendClaimedStrings(params, &identity);
+  identity.push_back(')');
+  return GraphObserver::NodeId(&type_token_, identity);
 }
 
 GraphObserver::NodeId KytheGraphObserver::recordTappNode(
     const NodeId& tapp_id, const NodeId& tycon_id,
     absl::Span<const NodeId> params, unsigned first_default_param) {
   CHECK(first_default_param <= params.size());
-  if (!deferring_nodes_ ||
-      written_types_.insert(tapp_id.ToClaimedString()).second) {
+  if (!deferring_nodes_ || written_types_->Insert(tapp_id.ToClaimedString())) {
     VNameRef tapp_vname = VNameRefFromNodeId(tapp_id);
     recorder_->AddProperty(tapp_vname, NodeKindID::kTApp);
     if (first_default_param < params.size()) {
       recorder_->AddProperty(tapp_vname, PropertyID::kParamDefault,
                              first_default_param);
     }
-    recorder_->AddEdge(tapp_vname, EdgeKindID::kParam,
-                       VNameRefFromNodeId(tycon_id), 0);
-    for (uint32_t param_index = 0; param_index < params.size(); ++param_index) {
-      recorder_->AddEdge(tapp_vname, EdgeKindID::kParam,
-                         VNameRefFromNodeId(params[param_index]),
-                         param_index + 1);
+    // The tycon is param 0; the arguments follow it.
+    absl::InlinedVector<VNameRef, 8> param_vnames;
+    param_vnames.reserve(params.size() + 1);
+    param_vnames.push_back(VNameRefFromNodeId(tycon_id));
+    for (const auto& param : params) {
+      param_vnames.push_back(VNameRefFromNodeId(param));
     }
+    recorder_->AddEdges(tapp_vname, EdgeKindID::kParam, param_vnames, 0);
   }
   return tapp_id;
 }
@@ -1015,23 +1233,6 @@ void KytheGraphObserver::recordRecordNode(
   AddMarkedSource(node_vname, marked_source);
 }
 
-void KytheGraphObserver::recordTypeSpellingLocation(
-    const GraphObserver::Range& type_source_range, const NodeId& type_id,
-    Claimability claimability, Implicit i) {
-  RecordAnchor(type_source_range, type_id,
-               i == Implicit::Yes ? EdgeKindID::kRefImplicit : EdgeKindID::kRef,
-               claimability);
-}
-
-void KytheGraphObserver::recordTypeIdSpellingLocation(
-    const GraphObserver::Range& type_source_range, const NodeId& type_id,
-    Claimability claimability, Implicit i) {
-  RecordAnchor(
-      type_source_range, type_id,
-      i == Implicit::Yes ? EdgeKindID::kRefImplicit : EdgeKindID::kRefId,
-      claimability);
-}
-
 void KytheGraphObserver::recordCategoryExtendsEdge(const NodeId& from,
                                                    const NodeId& to) {
   recorder_->AddEdge(VNameRefFromNodeId(from), EdgeKindID::kExtendsCategory,
@@ -1075,14 +1276,6 @@ void KytheGraphObserver::recordDeclUseLocationInDocumentation(
                Claimability::Claimable);
 }
 
-void KytheGraphObserver::recordDeclUseLocation(
-    const GraphObserver::Range& source_range, const NodeId& node,
-    Claimability claimability, Implicit i) {
-  RecordAnchor(source_range, node,
-               i == Implicit::Yes ? EdgeKindID::kRefImplicit : EdgeKindID::kRef,
-               claimability);
-}
-
 void KytheGraphObserver::recordBlameLocation(
     const GraphObserver::Range& source_range, const NodeId& blame,
     Claimability claimability, Implicit i) {
@@ -1119,32 +1312,45 @@ void KytheGraphObserver::recordDeprecated(const NodeId& NodeId,
 
 GraphObserver::NodeId KytheGraphObserver::getNodeIdForBuiltinType(
     const llvm::StringRef& spelling) const {
-  const auto& info = builtins_.find(spelling.str());
-  if (info == builtins_.end()) {
-    if (absl::GetFlag(FLAGS_fail_on_unimplemented_builtin)) {
-      LOG(FATAL) << "Missing builtin " << spelling.str();
+  const BuiltinTable& table = GetBuiltinTable();
+  const absl::string_view name(spelling.data(), spelling.size());
+  const auto known = table.index.find(name);
+  if (known != table.index.end()) {
+    if (builtin_ids_.empty()) {
+      builtin_ids_.resize(table.builtins.size());
     }
-    LOG(ERROR) << "Missing builtin " << spelling.str();
-    MarkedSource sig;
-    sig.set_kind(MarkedSource::IDENTIFIER);
-    sig.set_pre_text(std::string(spelling));
-    builtins_.emplace(spelling.str(), Builtin{NodeId::CreateUncompressed(
-                                                  getDefaultClaimToken(),
-                                                  spelling.str() + "#builtin"),
-                                              sig, true});
-    auto* new_builtin = &builtins_.find(spelling.str())->second;
-    EmitBuiltin(new_builtin);
-    return new_builtin->node_id;
+    auto& node_id = builtin_ids_[known->second];
+    if (!node_id) {
+      const BuiltinSpec& builtin = table.builtins[known->second];
+      node_id =
+          NodeId::CreateUncompressed(getDefaultClaimToken(), builtin.identity);
+      EmitBuiltin(*node_id, builtin.marked_source);
+    }
+    return *node_id;
+  }
+  const auto unknown = unknown_builtin_ids_.find(name);
+  if (unknown != unknown_builtin_ids_.end()) {
+    return unknown->second;
   }
-  if (!info->second.emitted) {
-    EmitBuiltin(&info->second);
+  if (absl::GetFlag(FLAGS_fail_on_unimplemented_builtin)) {
+    LOG(FATAL) << "Missing builtin " << spelling.str();
   }
-  return info->second.node_id;
+  LOG(ERROR) << "Missing builtin " << spelling.str();
+  MarkedSource sig;
+  sig.set_kind(MarkedSource::IDENTIFIER);
+  sig.set_pre_text(std::string(spelling));
+  NodeId node_id = NodeId::CreateUncompressed(getDefaultClaimToken(),
+                                              spelling.str() + "#builtin");
+  EmitBuiltin(node_id, sig);
+  unknown_builtin_ids_.emplace(spelling.str(), node_id);
+  return node_id;
 }
 
 void KytheGraphObserver::applyMetadataFile(clang::FileID id,
                                            const clang::FileEntry* file,
                                            const std::string& search_string) {
+  ProfileBlock block(getProfilingCallback(),
+                     ProfileSection::kApplyMetadataFile);
   const llvm::Optional<llvm::MemoryBufferRef> buffer =
       SourceManager->getMemoryBufferForFileOrNone(file);
   if (!buffer) {
@@ -1157,7 +1363,7 @@ void KytheGraphObserver::applyMetadataFile(clang::FileID id,
           absl::string_view(buffer->getBuffer().data(),
                             buffer->getBufferSize()),
           search_string)) {
-    meta_.emplace(id, std::move(metadata));
+    meta_[id].push_back(std::move(metadata));
   }
 }
 
@@ -1195,7 +1401,11 @@ bool KytheGraphObserver::isMainSourceFileRelatedLocation(
 bool KytheGraphObserver::claimImplicitNode(const std::string& identifier) {
   kythe::proto::VName node_vname;
   node_vname.set_signature(identifier);
-  return client_->Claim(claimant_, node_vname);
+  if (!client_->Claim(claimant_, node_vname)) {
+    return false;
+  }
+  return indexed_instantiations_ == nullptr ||
+         indexed_instantiations_->Insert(identifier);
 }
 
 void KytheGraphObserver::finishImplicitNode(const std::string& identifier) {
@@ -1204,12 +1414,13 @@ void KytheGraphObserver::finishImplicitNode(const std::string& identifier) {
 
 bool KytheGraphObserver::claimBatch(
     std::vector<std::pair<std::string, bool>>* pairs) {
+  ProfileBlock block(getProfilingCallback(), ProfileSection::kClaimBatch);
   return client_->ClaimBatch(pairs);
 }
 
 void KytheGraphObserver::pushFile(clang::SourceLocation blame_location,
                                   clang::SourceLocation source_location) {
-  PreprocessorContext previous_context =
+  PreprocessorContextTable::ContextId previous_context =
       file_stack_.empty() ? starting_context_ : file_stack_.back().context;
   bool has_previous_uid = !file_stack_.empty();
   llvm::sys::fs::UniqueID previous_uid;
@@ -1236,6 +1447,24 @@ void KytheGraphObserver::pushFile(clang::SourceLocation blame_location,
         // An actual file.
         state.vname = state.base_vname = VNameFromFileEntry(entry);
         state.uid = entry->getUniqueID();
+        state.file = file;
+        if (incremental_keys_ || group_keys_) {
+          auto found = input_digests_.find(std::make_tuple(
+              state.base_vname.corpus(), state.base_vname.root(),
+              state.base_vname.path()));
+          absl::string_view digest =
+              found != input_digests_.end() ? found->second : "";
+          if (incremental_keys_) {
+            incremental_keys_->Enter(digest);
+          }
+          if (group_keys_) {
+            if (has_previous_uid) {
+              group_keys_->Enter(digest);
+            } else {
+              main_file_digest_ = std::string(digest);
+            }
+          }
+        }
         // TODO(zarko): If modules are enabled, check there to see whether
         // `entry` is a textual header.
         if (in_header ||
@@ -1249,42 +1478,29 @@ void KytheGraphObserver::pushFile(clang::SourceLocation blame_location,
         if (file_stack_.size() == 1) {
           // Start state.
           state.context = starting_context_;
-        } else if (has_previous_uid && !previous_context.empty() &&
+        } else if (has_previous_uid && previous_context != kEmptyContext &&
                    blame_location.isValid() && blame_location.isFileID()) {
           unsigned offset = SourceManager->getFileOffset(blame_location);
-          const auto path_info = path_to_context_data_.find(previous_uid);
-          if (path_info != path_to_context_data_.end()) {
-            const auto context_info = path_info->second.find(previous_context);
-            if (context_info != path_info->second.end()) {
-              const auto offset_info = context_info->second.find(offset);
-              if (offset_info != context_info->second.end()) {
-                state.context = offset_info->second;
-              } else {
-                absl::FPrintF(
-                    stderr,
-                    "Warning: when looking for %s[%s]:%u: missing source "
-                    "offset\n",
-                    vfs_->get_debug_uid_string(previous_uid), previous_context,
-                    offset);
-              }
-            } else {
-              absl::FPrintF(
-                  stderr,
-                  "Warning: when looking for %s[%s]:%u: missing source "
-                  "context\n",
-                  vfs_->get_debug_uid_string(previous_uid), previous_context,
-                  offset);
+          const auto file_info = context_file_ids_.find(previous_uid);
+          auto miss = PreprocessorContextTable::Miss::kFile;
+          if (file_info != context_file_ids_.end()) {
+            if (auto dest = contexts_.Lookup(file_info->second,
+                                             previous_context, offset, &miss)) {
+              state.context = *dest;
             }
-          } else {
+          }
+          if (miss != PreprocessorContextTable::Miss::kNone) {
             absl::FPrintF(
                 stderr,
-                "Warning: when looking for %s[%s]:%u: missing source path\n",
-                vfs_->get_debug_uid_string(previous_uid), previous_context,
-                offset);
+                "Warning: when looking for %s[%s]:%u: missing source %s\n",
+                vfs_->get_debug_uid_string(previous_uid),
+                contexts_.context(previous_context), offset,
+                DescribeContextMiss(miss));
           }
         }
-        state.vname.set_signature(absl::StrCat(
-            state.context, state.vname.signature(), build_config_));
+        state.vname.set_signature(absl::StrCat(contexts_.context(state.context),
+                                               state.vname.signature(),
+                                               build_config_));
         if (client_->Claim(claimant_, state.vname)) {
           if (recorded_files_.insert(entry).second) {
             const llvm::Optional<llvm::MemoryBufferRef> buf =
@@ -1300,12 +1516,12 @@ void KytheGraphObserver::pushFile(clang::SourceLocation blame_location,
           state.claimed = false;
         }
         KytheClaimToken token;
-        token.set_vname(state.vname);
+        token.set_vname(state.vname, &claim_token_table_);
         token.set_rough_claimed(state.claimed);
         claim_checked_files_.emplace(file, token);
         if (state.claimed) {
           KytheClaimToken file_token;
-          file_token.set_vname(state.vname);
+          file_token.set_vname(state.vname, &claim_token_table_);
           file_token.set_rough_claimed(state.claimed);
           file_token.set_language_independent(true);
           claimed_file_specific_tokens_.emplace(file, file_token);
@@ -1313,6 +1529,7 @@ void KytheGraphObserver::pushFile(clang::SourceLocation blame_location,
         if (!has_previous_uid) {
           main_source_file_loc_ = source_location;
           main_source_file_token_ = &claim_checked_files_[file];
+          RecordLoadedFiles();
         }
       } else {
         // A builtin location.
@@ -1325,9 +1542,227 @@ void KytheGraphObserver::popFile() {
   CHECK(!file_stack_.empty());
   FileState state = file_stack_.back();
   file_stack_.pop_back();
+  if (incremental_store_ != nullptr && state.claimed &&
+      state.file.isValid()) {
+    left_incremental_files_.emplace_back(state.file, state.vname);
+  }
+  if (group_keys_ && state.claimed && state.file.isValid()) {
+    auto token = claim_checked_files_.find(state.file);
+    if (token != claim_checked_files_.end() &&
+        token->second.rough_claimed()) {
+      GroupChain group{*group_keys_, state.vname};
+      if (file_stack_.empty()) {
+        group.chain.Enter(main_file_digest_);
+      } else {
+        // What the main file did before including this one (defining
+        // macros, say) can change it. The rest of the main file can only
+        // complete its tags, which `noteTagCompleted` accounts for.
+        group.chain.Enter(
+            absl::StrCat("main file prefix\n", MainFilePrefix(state.file)));
+      }
+      group_chains_.insert_or_assign(state.file, std::move(group));
+      left_group_files_.emplace_back(
+          state.file, SourceManager->getLocForEndOfFile(state.file));
+    }
+  }
   if (file_stack_.empty()) {
-    deferred_anchors_.clear();
+    FlushDeferredAnchors();
+    if (incremental_store_ != nullptr) {
+      LeaveIncrementalFiles();
+    }
+  }
+}
+
+void KytheGraphObserver::LeaveIncrementalFiles() {
+  // Declarations are only traversed once the whole unit is parsed, and a
+  // later file can change what an earlier one emits (say, by completing a
+  // type it forward-declares), so every key covers every file entered.
+  for (const auto& [file, vname] : left_incremental_files_) {
+    auto token = claim_checked_files_.find(file);
+    if (token == claim_checked_files_.end() ||
+        !token->second.rough_claimed()) {
+      continue;
+    }
+    std::string key = incremental_keys_->Key(vname);
+    if (key.empty()) {
+      continue;
+    }
+    std::string block;
+    if (incremental_store_->Read(key, &block)) {
+      if (ReplayBlock(block, incremental_output_)) {
+        // Leave the file as if another unit had claimed it.
+        token->second.set_rough_claimed(false);
+        claimed_file_specific_tokens_.erase(file);
+        continue;
+      }
+      LOG(WARNING) << "Ignoring malformed incremental block " << key;
+    }
+    recorded_blocks_[file].key = std::move(key);
+  }
+  left_incremental_files_.clear();
+}
+
+void KytheGraphObserver::SaveIncrementalBlocks() {
+  for (const auto& block : recorded_blocks_) {
+    if (!incremental_store_->Write(block.second.key, block.second.entries)) {
+      LOG(WARNING) << "Couldn't save incremental block " << block.second.key;
+    }
+  }
+}
+
+absl::string_view KytheGraphObserver::MainFilePrefix(
+    clang::FileID file) const {
+  const clang::FileID main_file = SourceManager->getMainFileID();
+  clang::SourceLocation include = SourceManager->getIncludeLoc(file);
+  while (include.isValid()) {
+    auto [includer, offset] = SourceManager->getDecomposedExpansionLoc(include);
+    if (includer == main_file) {
+      llvm::StringRef text = SourceManager->getBufferData(main_file);
+      return absl::string_view(text.data(),
+                               std::min<size_t>(offset, text.size()));
+    }
+    include = SourceManager->getIncludeLoc(includer);
+  }
+  return "";
+}
+
+void KytheGraphObserver::RecordLoadedFiles() {
+  for (unsigned i = 0, e = SourceManager->loaded_sloc_entry_size(); i < e;
+       ++i) {
+    bool invalid = false;
+    const clang::SrcMgr::SLocEntry& entry =
+        SourceManager->getLoadedSLocEntry(i, &invalid);
+    if (invalid || !entry.isFile()) {
+      continue;
+    }
+    clang::FileID file = SourceManager->getFileID(
+        clang::SourceLocation::getFromRawEncoding(entry.getOffset()));
+    const clang::FileEntry* file_entry =
+        SourceManager->getFileEntryForID(file);
+    if (file_entry == nullptr) {
+      continue;
+    }
+    KytheClaimToken token;
+    token.set_vname(VNameFromFileEntry(file_entry), &claim_token_table_);
+    token.set_rough_claimed(false);
+    claim_checked_files_.emplace(file, token);
+  }
+}
+
+void KytheGraphObserver::noteTagCompleted(clang::SourceLocation first_decl) {
+  if (!group_keys_ || first_decl.isInvalid()) {
+    return;
+  }
+  // The files left since the tag was first declared may have used it while
+  // it was incomplete, and traversing them will see its definition, so their
+  // groups depend on a file their keys don't cover. They end after the
+  // declaration, so they are a suffix of `left_group_files_`.
+  first_decl = SourceManager->getExpansionLoc(first_decl);
+  auto since = std::partition_point(
+      left_group_files_.begin(), left_group_files_.end(),
+      [&](const std::pair<clang::FileID, clang::SourceLocation>& left) {
+        return !SourceManager->isBeforeInTranslationUnit(first_decl,
+                                                         left.second);
+      });
+  for (auto left = since; left != left_group_files_.end(); ++left) {
+    group_chains_.erase(left->first);
+  }
+}
+
+bool KytheGraphObserver::ComputeGroupHash(clang::SourceLocation loc,
+                                          absl::string_view key,
+                                          HashCache::Hash* hash) const {
+  if (loc.isInvalid()) {
+    return false;
+  }
+  auto [file, offset] =
+      SourceManager->getDecomposedLoc(SourceManager->getExpansionLoc(loc));
+  auto found = group_chains_.find(file);
+  if (found == group_chains_.end()) {
+    return false;
+  }
+  proto::VName group = found->second.vname;
+  group.set_signature(
+      absl::StrCat(group.signature(), "\n", offset, "\n", key));
+  std::string bytes = absl::HexStringToBytes(found->second.chain.Key(group));
+  if (bytes.size() != HashCache::kHashSize) {
+    return false;
+  }
+  memcpy(*hash, bytes.data(), HashCache::kHashSize);
+  return true;
+}
+
+bool KytheGraphObserver::probeGroup(clang::SourceLocation loc,
+                                    absl::string_view key) {
+  HashCache::Hash hash;
+  return group_cache_ != nullptr && ComputeGroupHash(loc, key, &hash) &&
+         group_cache_->SawHash(hash);
+}
+
+void KytheGraphObserver::RegisterGroupKeys() {
+  for (const auto& group : emitted_groups_) {
+    group_cache_->RegisterHash(group.hash);
+  }
+}
+
+void KytheGraphObserver::PushBlock(std::string* block) {
+  block_stack_.push_back(block);
+  incremental_output_->set_block(block);
+}
+
+void KytheGraphObserver::Delimit() {
+  recorder_->PushEntryGroup();
+  if (group_cache_ != nullptr) {
+    group_stack_.emplace_back();
+  }
+  if (incremental_output_ != nullptr) {
+    PushBlock(block_stack_.empty() ? nullptr : block_stack_.back());
+  }
+}
+
+void KytheGraphObserver::DelimitDecl(clang::SourceLocation loc) {
+  recorder_->PushEntryGroup();
+  if (group_cache_ != nullptr) {
+    group_stack_.emplace_back();
+  }
+  if (incremental_output_ == nullptr) {
+    return;
+  }
+  std::string* block = nullptr;
+  if (loc.isValid()) {
+    auto found = recorded_blocks_.find(
+        SourceManager->getFileID(SourceManager->getExpansionLoc(loc)));
+    if (found != recorded_blocks_.end()) {
+      block = &found->second.entries;
+    }
+  }
+  PushBlock(block);
+}
+
+void KytheGraphObserver::DelimitKeyedDecl(clang::SourceLocation loc,
+                                          absl::string_view key) {
+  DelimitDecl(loc);
+  if (group_cache_ != nullptr) {
+    GroupKey group;
+    if (ComputeGroupHash(loc, key, &group.hash)) {
+      group_stack_.back() = group;
+    }
+  }
+}
+
+void KytheGraphObserver::Undelimit() {
+  if (group_cache_ != nullptr) {
+    if (group_stack_.back()) {
+      emitted_groups_.push_back(*group_stack_.back());
+    }
+    group_stack_.pop_back();
+  }
+  if (incremental_output_ != nullptr) {
+    block_stack_.pop_back();
+    incremental_output_->set_block(block_stack_.empty() ? nullptr
+                                                        : block_stack_.back());
   }
+  recorder_->PopEntryGroup();
 }
 
 void KytheGraphObserver::iterateOverClaimedFiles(
@@ -1362,13 +1797,63 @@ bool KytheGraphObserver::claimLocation(clang::SourceLocation source_location) {
                                              : false;
 }
 
+bool KytheGraphObserver::claimSourceRange(clang::SourceRange range) {
+  if (range.isInvalid()) {
+    return true;
+  }
+  clang::SourceLocation begin =
+      SourceManager->getExpansionLoc(range.getBegin());
+  clang::SourceLocation end = SourceManager->getExpansionLoc(range.getEnd());
+  if (claimLocation(begin) || claimLocation(end)) {
+    return true;
+  }
+  clang::FileID file = SourceManager->getFileID(begin);
+  if (file != SourceManager->getFileID(end)) {
+    return true;
+  }
+  if (!claimed_include_offsets_) {
+    // Every file has been entered by now, so we can walk each claimed file's
+    // include stack once and record where it enters its unclaimed ancestors.
+    claimed_include_offsets_.emplace();
+    for (const auto& checked : claim_checked_files_) {
+      if (!checked.second.rough_claimed()) {
+        continue;
+      }
+      clang::SourceLocation include =
+          SourceManager->getIncludeLoc(checked.first);
+      while (include.isValid()) {
+        include = SourceManager->getExpansionLoc(include);
+        auto decomposed = SourceManager->getDecomposedLoc(include);
+        (*claimed_include_offsets_)[decomposed.first].push_back(
+            decomposed.second);
+        include = SourceManager->getIncludeLoc(decomposed.first);
+      }
+    }
+    for (auto& offsets : *claimed_include_offsets_) {
+      std::sort(offsets.second.begin(), offsets.second.end());
+    }
+  }
+  auto offsets = claimed_include_offsets_->find(file);
+  if (offsets == claimed_include_offsets_->end()) {
+    return false;
+  }
+  auto first = std::lower_bound(offsets->second.begin(), offsets->second.end(),
+                                SourceManager->getFileOffset(begin));
+  return first != offsets->second.end() &&
+         *first <= SourceManager->getFileOffset(end);
+}
+
 void KytheGraphObserver::AddContextInformation(
     const std::string& path, const PreprocessorContext& context,
     unsigned offset, const PreprocessorContext& dest_context) {
   auto found_file = vfs_->status(path);
   if (found_file) {
-    path_to_context_data_[found_file->getUniqueID()][context][offset] =
-        dest_context;
+    auto file = context_file_ids_
+                    .try_emplace(found_file->getUniqueID(),
+                                 context_file_ids_.size())
+                    .first->second;
+    contexts_.Add(file, contexts_.Intern(context), offset,
+                  contexts_.Intern(dest_context));
   } else {
     absl::FPrintF(stderr,
                   "WARNING: Path %s could not be mapped to a VFS record.\n",
@@ -1421,142 +1906,25 @@ KytheGraphObserver::getNamespaceTokens(clang::SourceLocation loc) const {
     // Named namespaces belong to the same corpus as structural types due to
     // their use as extension points which may be opened from a file in any
     // corpus, but should still refer to the same node.
-    iter->second.named.mutable_vname()->set_corpus(
-        type_token_.vname().corpus());
+    iter->second.named.set_corpus(type_token_.vname().corpus(),
+                                  &claim_token_table_);
     iter->second.named.set_rough_claimed(file_token->rough_claimed());
     // Anonymous namespaces are unique to the translation in which they're
     // defined, which we approximate by using the file's corpus.
-    iter->second.anonymous.mutable_vname()->set_corpus(
-        file_token->vname().corpus());
+    iter->second.anonymous.set_corpus(file_token->vname().corpus(),
+                                      &claim_token_table_);
     iter->second.anonymous.set_rough_claimed(file_token->rough_claimed());
   }
   return iter->second;
 }
 
-void KytheGraphObserver::RegisterBuiltins() {
-  auto RegisterBuiltin = [&](const std::string& name,
-                             const MarkedSource& marked_source) {
-    builtins_.emplace(name,
-                      Builtin{NodeId::CreateUncompressed(getDefaultClaimToken(),
-                                                         name + "#builtin"),
-                              marked_source, false});
-  };
-  auto RegisterTokenBuiltin = [&](const std::string& name,
-                                  const std::string& token) {
-    MarkedSource sig;
-    sig.set_kind(MarkedSource::IDENTIFIER);
-    sig.set_pre_text(token);
-    RegisterBuiltin(name, sig);
-  };
-  RegisterTokenBuiltin("void", "void");
-  RegisterTokenBuiltin("bool", "bool");
-  RegisterTokenBuiltin("_Bool", "_Bool");
-  RegisterTokenBuiltin("signed char", "signed char");
-  RegisterTokenBuiltin("char", "char");
-  RegisterTokenBuiltin("char16_t", "char16_t");
-  RegisterTokenBuiltin("char32_t", "char32_t");
-  RegisterTokenBuiltin("wchar_t", "wchar_t");
-  RegisterTokenBuiltin("short", "short");
-  RegisterTokenBuiltin("int", "int");
-  RegisterTokenBuiltin("long", "long");
-  RegisterTokenBuiltin("long long", "long long");
-  RegisterTokenBuiltin("unsigned char", "unsigned char");
-  RegisterTokenBuiltin("unsigned short", "unsigned short");
-  RegisterTokenBuiltin("unsigned int", "unsigned int");
-  RegisterTokenBuiltin("unsigned long", "unsigned long");
-  RegisterTokenBuiltin("unsigned long long", "unsigned long long");
-  RegisterTokenBuiltin("float", "float");
-  RegisterTokenBuiltin("double", "double");
-  RegisterTokenBuiltin("long double", "long double");
-  RegisterTokenBuiltin("nullptr_t", "nullptr_t");
-  RegisterTokenBuiltin("<dependent type>", "dependent");
-  RegisterTokenBuiltin("auto", "auto");
-  RegisterTokenBuiltin("knrfn", "function");
-  RegisterTokenBuiltin("__int128", "__int128");
-  RegisterTokenBuiltin("unsigned __int128", "unsigned __int128");
-  RegisterTokenBuiltin("SEL", "SEL");
-  RegisterTokenBuiltin("id", "id");
-  RegisterTokenBuiltin("TypeUnion", "TypeUnion");
-  RegisterTokenBuiltin("__float128", "__float128");
-
-  {
-    MarkedSource lhs_tycon_builtin;
-    auto* lhs_tycon = lhs_tycon_builtin.add_child();
-    auto* lookup = lhs_tycon_builtin.add_child();
-    lookup->set_kind(MarkedSource::LOOKUP_BY_PARAM);
-    lookup->set_lookup_index(1);
-    lhs_tycon->set_kind(MarkedSource::IDENTIFIER);
-    lhs_tycon->set_pre_text("const ");
-    RegisterBuiltin("const", lhs_tycon_builtin);
-    lhs_tycon->set_pre_text("volatile ");
-    RegisterBuiltin("volatile", lhs_tycon_builtin);
-    lhs_tycon->set_pre_text("restrict ");
-    RegisterBuiltin("restrict", lhs_tycon_builtin);
-  }
-
-  {
-    MarkedSource rhs_tycon_builtin;
-    auto* lookup = rhs_tycon_builtin.add_child();
-    auto* rhs_tycon = rhs_tycon_builtin.add_child();
-    lookup->set_kind(MarkedSource::LOOKUP_BY_PARAM);
-    lookup->set_lookup_index(1);
-    rhs_tycon->set_kind(MarkedSource::IDENTIFIER);
-    rhs_tycon->set_pre_text("*");
-    RegisterBuiltin("ptr", rhs_tycon_builtin);
-    rhs_tycon->set_pre_text("&");
-    RegisterBuiltin("lvr", rhs_tycon_builtin);
-    rhs_tycon->set_pre_text("&&");
-    RegisterBuiltin("rvr", rhs_tycon_builtin);
-    rhs_tycon->set_pre_text("[incomplete]");
-    RegisterBuiltin("iarr", rhs_tycon_builtin);
-    rhs_tycon->set_pre_text("[const]");
-    RegisterBuiltin("carr", rhs_tycon_builtin);
-    rhs_tycon->set_pre_text("[dependent]");
-    RegisterBuiltin("darr", rhs_tycon_builtin);
-  }
-
-  {
-    MarkedSource mem_ptr_tycon_builtin;
-    auto* pointee_type = mem_ptr_tycon_builtin.add_child();
-    pointee_type->set_kind(MarkedSource::LOOKUP_BY_PARAM);
-    pointee_type->set_lookup_index(1);
-    auto* class_type = mem_ptr_tycon_builtin.add_child();
-    class_type->set_kind(MarkedSource::LOOKUP_BY_PARAM);
-    class_type->set_lookup_index(2);
-    class_type->set_pre_text(" ");
-    class_type->set_post_text("::");
-    auto* ident = mem_ptr_tycon_builtin.add_child();
-    ident->set_kind(MarkedSource::IDENTIFIER);
-    ident->set_pre_text("*");
-    RegisterBuiltin("mptr", mem_ptr_tycon_builtin);
-  }
-
-  {
-    MarkedSource function_tycon_builtin;
-    auto* return_type = function_tycon_builtin.add_child();
-    return_type->set_kind(MarkedSource::LOOKUP_BY_PARAM);
-    return_type->set_lookup_index(1);
-    auto* args = function_tycon_builtin.add_child();
-    args->set_kind(MarkedSource::PARAMETER_LOOKUP_BY_PARAM);
-    args->set_pre_text("(");
-    args->set_post_child_text(", ");
-    args->set_post_text(")");
-    args->set_lookup_index(2);
-    RegisterBuiltin("fn", function_tycon_builtin);
-    auto* vararg_keyword = function_tycon_builtin.add_child();
-    vararg_keyword->set_kind(MarkedSource::IDENTIFIER);
-    vararg_keyword->set_pre_text("vararg");
-    RegisterBuiltin("fnvararg", function_tycon_builtin);
-  }
-}
-
-void KytheGraphObserver::EmitBuiltin(Builtin* builtin) const {
+void KytheGraphObserver::EmitBuiltin(const NodeId& node_id,
+                                     const MarkedSource& marked_source) const {
   // TODO(shahms): We should not probably not emit anything from const member
   // functions and this is called from them.
-  builtin->emitted = true;
-  VNameRef ref(VNameRefFromNodeId(builtin->node_id));
+  VNameRef ref(VNameRefFromNodeId(node_id));
   recorder_->AddProperty(ref, NodeKindID::kTBuiltin);
-  recorder_->AddMarkedSource(ref, builtin->marked_source);
+  recorder_->AddMarkedSource(ref, marked_source);
 }
 
 void KytheGraphObserver::EmitMetaNodes() {
@@ -1581,6 +1949,34 @@ void KytheGraphObserver::EmitMetaNodes() {
   EmitNode("tapp", tapp_signature);
 }
 
+const KytheClaimTokenTable::Entry* KytheClaimTokenTable::Intern(
+    absl::string_view corpus, absl::string_view root, absl::string_view path) {
+  if (corpus.empty() && root.empty() && path.empty()) {
+    return Empty();
+  }
+  auto [iter, inserted] = entries_.try_emplace(
+      Key(std::string(corpus), std::string(root), std::string(path)));
+  Entry& entry = iter->second;
+  if (inserted) {
+    entry.table = this;
+    entry.id = entries_.size();
+    entry.vname.set_corpus(std::string(corpus));
+    entry.vname.set_root(std::string(root));
+    entry.vname.set_path(std::string(path));
+    for (absl::string_view field : {corpus, root, path}) {
+      if (!field.empty()) {
+        absl::StrAppend(&entry.stamp, "#", field);
+      }
+    }
+  }
+  return &entry;
+}
+
+const KytheClaimTokenTable::Entry* KytheClaimTokenTable::Empty() {
+  static const Entry* const kEmpty = new Entry{nullptr, 0, {}, {}};
+  return kEmpty;
+}
+
 void* KytheClaimToken::clazz_ = nullptr;
 
 }  // namespace kythe
@@ -17,27 +17,77 @@
 #ifndef KYTHE_CXX_INDEXER_CXX_KYTHE_GRAPH_OBSERVER_H_
 #define KYTHE_CXX_INDEXER_CXX_KYTHE_GRAPH_OBSERVER_H_
 
+#include <cstdint>
 #include <functional>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 
 #include "GraphObserver.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/container/node_hash_map.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/optional.h"
 #include "glog/logging.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
 #include "kythe/cxx/common/kythe_metadata_file.h"
 #include "kythe/cxx/extractor/language.h"
-#include "kythe/cxx/indexer/cxx/IndexerASTHooks.h"
 #include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
 #include "kythe/cxx/indexer/cxx/KytheVFS.h"
+#include "kythe/cxx/indexer/cxx/incremental_store.h"
+#include "kythe/cxx/indexer/cxx/node_fingerprint_set.h"
+#include "kythe/cxx/indexer/cxx/preprocessor_context_table.h"
+#include "kythe/cxx/indexer/cxx/slice_hasher.h"
 #include "kythe/proto/storage.pb.h"
 
 namespace kythe {
 
 class KytheGraphRecorder;
 
+/// \brief Interns the corpus, root, and path triples of claim tokens.
+///
+/// Each distinct triple gets one entry holding a small integer ID and the
+/// suffix that stamps identities with it, so tokens that share a table can be
+/// compared and hashed by entry and stamping doesn't rebuild the suffix.
+class KytheClaimTokenTable {
+ public:
+  struct Entry {
+    /// The table that owns this entry, or null for `Empty()`.
+    const KytheClaimTokenTable* table;
+    /// Unique among the entries of `table`; 0 for `Empty()`.
+    uint32_t id;
+    /// Holds only the corpus, root, and path.
+    kythe::proto::VName vname;
+    /// "#corpus#root#path", leaving out any empty field.
+    std::string stamp;
+  };
+
+  KytheClaimTokenTable() = default;
+  KytheClaimTokenTable(const KytheClaimTokenTable&) = delete;
+  KytheClaimTokenTable& operator=(const KytheClaimTokenTable&) = delete;
+
+  /// \brief Returns the unique entry for the triple, adding it if necessary.
+  /// The empty triple is always `Empty()`.
+  const Entry* Intern(absl::string_view corpus, absl::string_view root,
+                      absl::string_view path);
+
+  /// \brief Returns the entry with no corpus, root, or path, which is shared
+  /// by every table.
+  static const Entry* Empty();
+
+  /// \brief Returns the number of distinct nonempty triples interned.
+  size_t size() const { return entries_.size(); }
+
+ private:
+  using Key = std::tuple<std::string, std::string, std::string>;
+  /// Entries don't move once added.
+  absl::node_hash_map<Key, Entry> entries_;
+};
+
 /// \brief Provides information about the provenance and claim status of a node.
 ///
 /// Associates NodeIds with the root, path, and corpus VName fields.
@@ -47,22 +97,18 @@ class KytheGraphRecorder;
 class KytheClaimToken : public GraphObserver::ClaimToken {
  public:
   std::string StampIdentity(const std::string& identity) const override {
-    std::string stamped = identity;
-    if (!vname_.corpus().empty()) {
-      stamped.append("#");
-      stamped.append(vname_.corpus());
-    }
-    if (!vname_.root().empty()) {
-      stamped.append("#");
-      stamped.append(vname_.root());
-    }
-    if (!vname_.path().empty()) {
-      stamped.append("#");
-      stamped.append(vname_.path());
-    }
+    std::string stamped;
+    AppendStampedIdentity(identity, &stamped);
     return stamped;
   }
 
+  void AppendStampedIdentity(const std::string& identity,
+                             std::string* out) const override {
+    out->reserve(out->size() + identity.size() + entry_->stamp.size());
+    out->append(identity);
+    out->append(entry_->stamp);
+  }
+
   void* GetClass() const override { return &clazz_; }
 
   static bool classof(const ClaimToken* t) { return t->GetClass() == &clazz_; }
@@ -70,21 +116,29 @@ class KytheClaimToken : public GraphObserver::ClaimToken {
   /// \brief Marks a VNameRef as belonging to this token.
   /// This token must outlive the VNameRef.
   void DecorateVName(VNameRef* target) const {
-    target->set_corpus(vname_.corpus());
-    target->set_root(vname_.root());
-    target->set_path(vname_.path());
+    target->set_corpus(entry_->vname.corpus());
+    target->set_root(entry_->vname.root());
+    target->set_path(entry_->vname.path());
   }
 
   /// \brief Sets a VName that controls the corpus, root and path of claimed
-  /// objects.
-  void set_vname(const kythe::proto::VName& vname) {
-    vname_.set_corpus(vname.corpus());
-    vname_.set_root(vname.root());
-    vname_.set_path(vname.path());
+  /// objects, interning them in `table`, which must outlive this token.
+  void set_vname(const kythe::proto::VName& vname,
+                 KytheClaimTokenTable* table) {
+    entry_ = table->Intern(vname.corpus(), vname.root(), vname.path());
+  }
+
+  /// \brief Replaces only the corpus of claimed objects.
+  /// \sa set_vname
+  void set_corpus(absl::string_view corpus, KytheClaimTokenTable* table) {
+    entry_ = table->Intern(corpus, entry_->vname.root(), entry_->vname.path());
   }
 
-  const kythe::proto::VName& vname() const { return vname_; }
-  kythe::proto::VName* mutable_vname() { return &vname_; }
+  const kythe::proto::VName& vname() const { return entry_->vname; }
+
+  /// \brief Returns the ID of this token's corpus, root, and path in its
+  /// table.
+  uint32_t id() const { return entry_->id; }
 
   /// \sa rough_claimed
   void set_rough_claimed(bool value) { rough_claimed_ = value; }
@@ -106,34 +160,44 @@ class KytheClaimToken : public GraphObserver::ClaimToken {
     }
     if (const auto* kythe_rhs = clang::dyn_cast<KytheClaimToken>(&rhs)) {
       return kythe_rhs->rough_claimed_ == rough_claimed_ &&
-             kythe_rhs->vname_.corpus() == vname_.corpus() &&
-             kythe_rhs->vname_.path() == vname_.path() &&
-             kythe_rhs->vname_.root() == vname_.root();
+             SameEntry(*kythe_rhs);
     }
     return false;
   }
 
   bool operator!=(const ClaimToken& rhs) const override {
-    if (const auto* kythe_rhs = clang::dyn_cast<KytheClaimToken>(&rhs)) {
-      return kythe_rhs->rough_claimed_ != rough_claimed_ ||
-             kythe_rhs->vname_.corpus() != vname_.corpus() ||
-             kythe_rhs->vname_.path() != vname_.path() ||
-             kythe_rhs->vname_.root() != vname_.root();
-    }
-    return true;
+    return !(*this == rhs);
   }
 
  private:
+  /// Entries from the same table are equal only if they are the same entry;
+  /// those from different tables must compare their fields.
+  bool SameEntry(const KytheClaimToken& rhs) const {
+    if (entry_ == rhs.entry_) {
+      return true;
+    }
+    if (entry_->table == rhs.entry_->table || entry_->table == nullptr ||
+        rhs.entry_->table == nullptr) {
+      return false;
+    }
+    return entry_->vname.corpus() == rhs.entry_->vname.corpus() &&
+           entry_->vname.path() == rhs.entry_->vname.path() &&
+           entry_->vname.root() == rhs.entry_->vname.root();
+  }
+
   static void* clazz_;
-  /// The prototypical VName to use for claimed objects.
-  kythe::proto::VName vname_;
+  /// The interned prototypical VName to use for claimed objects.
+  const KytheClaimTokenTable::Entry* entry_ = KytheClaimTokenTable::Empty();
   bool rough_claimed_ = true;
   bool language_independent_ = false;
 };
 
 /// \brief Records details in the form of Kythe nodes and edges about elements
 /// discovered during indexing to the provided `KytheGraphRecorder`.
-class KytheGraphObserver : public GraphObserver {
+///
+/// The class is final so that calls made through a `KytheGraphObserver`
+/// (see `GraphObserver::AsKytheGraphObserver`) bind directly.
+class KytheGraphObserver final : public GraphObserver {
  public:
   explicit KytheGraphObserver(KytheGraphRecorder* recorder,
                               KytheClaimClient* client,
@@ -149,7 +213,6 @@ class KytheGraphObserver : public GraphObserver {
     default_token_.set_rough_claimed(true);
     type_token_.set_rough_claimed(true);
     ReportProfileEvent = std::move(ReportProfileEventCallback);
-    RegisterBuiltins();
     EmitMetaNodes();
   }
 
@@ -164,8 +227,79 @@ class KytheGraphObserver : public GraphObserver {
                          const std::string& search_string) override;
   void StopDeferringNodes() { deferring_nodes_ = false; }
   void DropRedundantWraiths() { drop_redundant_wraiths_ = true; }
-  void Delimit() override { recorder_->PushEntryGroup(); }
-  void Undelimit() override { recorder_->PopEntryGroup(); }
+  /// \brief Deduplicate type and doc nodes against `types` and `docs`
+  /// instead of against this unit's own sets.
+  ///
+  /// This lets several units written to the same output skip nodes that any
+  /// of them has already written. Not owned; both must outlive this observer.
+  void ShareWrittenNodes(NodeFingerprintSet* types, NodeFingerprintSet* docs) {
+    written_types_ = types;
+    written_docs_ = docs;
+  }
+  /// \brief Refuse claims on implicit nodes (such as template
+  /// instantiations) whose identifiers are already in `instantiations`, and
+  /// add the identifiers of those that are granted.
+  ///
+  /// This lets several units written to the same output index each
+  /// instantiation once. Not owned; must outlive this observer.
+  void ShareIndexedInstantiations(NodeFingerprintSet* instantiations) {
+    indexed_instantiations_ = instantiations;
+  }
+  /// \brief Emit the entries that earlier units recorded in `store` for the
+  /// files this unit claims instead of traversing those files' declarations
+  /// again, and record the entries for the files that aren't there yet.
+  ///
+  /// A file whose block is emitted is treated as if another unit had
+  /// claimed it. Not owned; `store` must outlive this observer.
+  /// \param output The stream that this observer's recorder writes to.
+  /// \param seed Identifies the unit's configuration (see
+  /// `IncrementalKeyChain`).
+  void UseIncrementalStore(IncrementalStore* store,
+                           BlockRecordingOutput* output,
+                           absl::string_view seed) {
+    incremental_store_ = store;
+    incremental_output_ = output;
+    incremental_keys_.emplace(seed);
+  }
+  /// \brief Notes that the file named `vname` has the content digest
+  /// `digest`. Only used with `UseIncrementalStore` and `ProbeGroupKeys`.
+  void SetInputDigest(const proto::VName& vname, const std::string& digest) {
+    input_digests_[std::make_tuple(vname.corpus(), vname.root(),
+                                   vname.path())] = digest;
+  }
+  /// \brief Write the blocks recorded for this unit to the store passed to
+  /// `UseIncrementalStore`. Only call this once the unit has been fully
+  /// indexed.
+  void SaveIncrementalBlocks();
+  /// \brief Probe `cache` for the groups of claimed top-level declarations
+  /// before they are traversed, and register the groups this unit emits in
+  /// it once `RegisterGroupKeys` is called.
+  ///
+  /// A group's key combines the declaration's own key with the digests of
+  /// the headers entered until its file was left and the part of the main
+  /// file before the `#include` that led there, as `IncrementalKeyChain`
+  /// does for whole files, so inputs must be noted with `SetInputDigest`.
+  /// Units that compile different main files can thus share the groups of
+  /// the headers they include alike. A file that leaves a tag incomplete for
+  /// a later file to define gets no keys (see `noteTagCompleted`).
+  /// Not owned; `cache` must outlive this observer.
+  /// \param seed Identifies the unit's configuration.
+  void ProbeGroupKeys(HashCache* cache, absl::string_view seed) {
+    group_cache_ = cache;
+    group_keys_.emplace(absl::StrCat("groups\n", seed));
+  }
+  /// \brief Register the keys of the groups this unit emitted with the
+  /// cache passed to `ProbeGroupKeys`. Only call this once the unit has been
+  /// fully indexed.
+  void RegisterGroupKeys();
+  void Delimit() override;
+  void DelimitDecl(clang::SourceLocation loc) override;
+  void Undelimit() override;
+  bool probesGroups() const override { return group_cache_ != nullptr; }
+  bool probeGroup(clang::SourceLocation loc, absl::string_view key) override;
+  void noteTagCompleted(clang::SourceLocation first_decl) override;
+  void DelimitKeyedDecl(clang::SourceLocation loc,
+                        absl::string_view key) override;
 
   NodeId nodeIdForTappNode(const NodeId& tycon_id,
                            absl::Span<const NodeId> params) const override;
@@ -237,7 +371,12 @@ class KytheGraphObserver : public GraphObserver {
 
   void recordDeclUseLocation(const Range& source_range, const NodeId& node,
                              GraphObserver::Claimability cl,
-                             GraphObserver::Implicit i) override;
+                             GraphObserver::Implicit i) override {
+    RecordAnchor(source_range, node,
+                 i == Implicit::Yes ? EdgeKindID::kRefImplicit
+                                    : EdgeKindID::kRef,
+                 cl);
+  }
 
   void recordBlameLocation(const Range& source_range, const NodeId& blame,
                            GraphObserver::Claimability cl,
@@ -292,12 +431,22 @@ class KytheGraphObserver : public GraphObserver {
   void recordTypeSpellingLocation(const Range& source_range,
                                   const NodeId& type_id,
                                   Claimability claimability,
-                                  Implicit i) override;
+                                  Implicit i) override {
+    RecordAnchor(source_range, type_id,
+                 i == Implicit::Yes ? EdgeKindID::kRefImplicit
+                                    : EdgeKindID::kRef,
+                 claimability);
+  }
 
   void recordTypeIdSpellingLocation(const Range& source_range,
                                     const NodeId& type_id,
                                     Claimability claimability,
-                                    Implicit i) override;
+                                    Implicit i) override {
+    RecordAnchor(source_range, type_id,
+                 i == Implicit::Yes ? EdgeKindID::kRefImplicit
+                                    : EdgeKindID::kRefId,
+                 claimability);
+  }
 
   void recordChildOfEdge(const NodeId& child_id,
                          const NodeId& parent_id) override;
@@ -367,8 +516,8 @@ class KytheGraphObserver : public GraphObserver {
   void set_claimant(const kythe::proto::VName& vname) { claimant_ = vname; }
 
   void set_default_corpus(absl::string_view corpus) {
-    default_token_.mutable_vname()->set_corpus(std::string(corpus));
-    type_token_.mutable_vname()->set_corpus(std::string(corpus));
+    default_token_.set_corpus(corpus, &claim_token_table_);
+    type_token_.set_corpus(corpus, &claim_token_table_);
   }
 
   bool claimNode(const NodeId& node_id) override {
@@ -383,6 +532,8 @@ class KytheGraphObserver : public GraphObserver {
 
   bool claimLocation(clang::SourceLocation source_location) override;
 
+  bool claimSourceRange(clang::SourceRange range) override;
+
   /// A representation of the state of the preprocessor.
   using PreprocessorContext = std::string;
 
@@ -399,7 +550,7 @@ class KytheGraphObserver : public GraphObserver {
   /// \brief Configures the starting context.
   /// \param context Context to use when the main source file is entered.
   void set_starting_context(const PreprocessorContext& context) {
-    starting_context_ = context;
+    starting_context_ = contexts_.Intern(context);
   }
 
   const KytheClaimToken* getClaimTokenForLocation(
@@ -414,6 +565,10 @@ class KytheGraphObserver : public GraphObserver {
   const KytheClaimToken* getAnonymousNamespaceClaimToken(
       clang::SourceLocation loc) const override;
 
+  const KytheClaimToken* getTypeClaimToken() const override {
+    return &type_token_;
+  }
+
   /// \brief Appends a representation of `Range` to `Ostream`.
   void AppendRangeToStream(llvm::raw_ostream& ostream,
                            const Range& range) override;
@@ -429,6 +584,8 @@ class KytheGraphObserver : public GraphObserver {
 
   absl::string_view getBuildConfig() const override { return build_config_; }
 
+  KytheGraphObserver* AsKytheGraphObserver() override { return this; }
+
  private:
   /// A pair of tokens to use for namespaces.
   struct NamespaceTokens {
@@ -445,9 +602,9 @@ class KytheGraphObserver : public GraphObserver {
     }
   }
 
-  void RecordSourceLocation(const VNameRef& vname,
-                            clang::SourceLocation source_location,
-                            PropertyID offset_id);
+  /// \return the file offset of `source_location` (or of its expansion, if
+  /// it's in a macro), as a string.
+  std::string FileOffset(clang::SourceLocation source_location) const;
 
   /// \brief Called by `AppendRangeToStream` to recur down a `SourceLocation`.
   ///
@@ -463,7 +620,13 @@ class KytheGraphObserver : public GraphObserver {
                                          llvm::raw_ostream& Ostream);
 
   VNameRef VNameRefFromNodeId(const GraphObserver::NodeId& node_id) const;
-  kythe::proto::VName VNameFromFileEntry(const clang::FileEntry* file_entry);
+  /// \brief Returns the VName for `file_entry`, computing it only the first
+  /// time it's requested.
+  const kythe::proto::VName& VNameFromFileEntry(
+      const clang::FileEntry* file_entry);
+  /// \brief Returns the VName for the file with `file_id`, or null if it
+  /// has no `FileEntry` (as for the predefines and scratch buffers).
+  const kythe::proto::VName* VNameFromFileID(clang::FileID file_id);
   kythe::proto::VName ClaimableVNameFromFileID(const clang::FileID& file_id);
   kythe::proto::VName VNameFromRange(const GraphObserver::Range& range);
   kythe::proto::VName StampedVNameFromRange(const GraphObserver::Range& range,
@@ -487,9 +650,12 @@ class KytheGraphObserver : public GraphObserver {
   void RecordAnchor(const GraphObserver::Range& source_range,
                     const kythe::proto::VName& primary_anchored_to,
                     EdgeKindID anchor_edge_kind, Claimability claimability);
-  /// Records a Range.
+  /// Records a Range. While deferring nodes, this only queues the range
+  /// for `FlushDeferredAnchors`.
   void RecordRange(const proto::VName& anchor_name,
                    const GraphObserver::Range& range);
+  /// Records every queued range once, in order of location.
+  void FlushDeferredAnchors();
   void UnconditionalRecordRange(const proto::VName& anchor_name,
                                 const GraphObserver::Range& range);
   /// Execute metadata actions for `defines` edges.
@@ -501,6 +667,19 @@ class KytheGraphObserver : public GraphObserver {
   bool MarkFileMetaEdgeEmitted(const VNameRef& file_decl,
                                const MetadataFile& meta);
 
+  struct FileIDHash {
+    size_t operator()(clang::FileID file) const {
+      return absl::Hash<unsigned>()(file.getHashValue());
+    }
+  };
+
+  struct UniqueIDHash {
+    size_t operator()(const llvm::sys::fs::UniqueID& uid) const {
+      return absl::Hash<std::pair<uint64_t, uint64_t>>()(
+          {uid.getDevice(), uid.getFile()});
+    }
+  };
+
   struct RangeHash {
     size_t operator()(const GraphObserver::Range& range) const {
       return std::hash<unsigned>()(
@@ -508,7 +687,7 @@ class KytheGraphObserver : public GraphObserver {
              (std::hash<unsigned>()(
                   range.PhysicalRange.getEnd().getRawEncoding())
               << 1) ^
-             (std::hash<std::string>()(range.Context.getRawIdentity())) ^
+             range.Context.getIdentityHash() ^
              (range.Kind == Range::RangeKind::Physical
                   ? 0
                   : (range.Kind == Range::RangeKind::Wraith ? 1 : 2));
@@ -517,8 +696,7 @@ class KytheGraphObserver : public GraphObserver {
 
   struct StampedRangeHash {
     size_t operator()(const std::pair<Range, GraphObserver::NodeId>& p) const {
-      return (std::hash<std::string>()(p.second.getRawIdentity())) << 1 ^
-             RangeHash()(p.first);
+      return p.second.getIdentityHash() << 1 ^ RangeHash()(p.first);
     }
   };
 
@@ -539,7 +717,7 @@ class KytheGraphObserver : public GraphObserver {
              (std::hash<unsigned>()(PhysicalRange.getEnd().getRawEncoding())
               << 1) ^
              (std::hash<unsigned>()(static_cast<unsigned>(EdgeKind))) ^
-             (std::hash<std::string>()(EdgeTarget.getRawIdentity()));
+             EdgeTarget.getIdentityHash();
     }
   };
 
@@ -549,26 +727,52 @@ class KytheGraphObserver : public GraphObserver {
 
   /// A file we have entered but not left.
   struct FileState {
-    PreprocessorContext context;     ///< The context for this file.
+    PreprocessorContextTable::ContextId context;  ///< This file's context.
     kythe::proto::VName vname;       ///< The file's VName.
     kythe::proto::VName base_vname;  ///< The file's VName without context.
     llvm::sys::fs::UniqueID uid;     ///< The ID Clang uses for this file.
+    clang::FileID file;              ///< The ID of this inclusion.
     bool claimed;                    ///< Whether we have claimed this file.
   };
 
   /// The files we have entered but not left.
   std::vector<FileState> file_stack_;
+  /// \brief Replays the blocks the store has for the claimed files in
+  /// `left_incremental_files_` and starts recording the rest. Called once
+  /// the unit's last file is left, since every file the unit entered can
+  /// change what traversing any one of them emits.
+  void LeaveIncrementalFiles();
+  /// \brief Opens `block` (which may be null) for a new level of `Delimit`.
+  void PushBlock(std::string* block);
+  /// \return the text of the main file before the `#include` through which
+  /// `file` was entered, or an empty string if it wasn't entered from there.
+  absl::string_view MainFilePrefix(clang::FileID file) const;
+  /// \brief Gives the files loaded from a precompiled preamble unclaimed
+  /// tokens with their own VNames. They are never entered, and would
+  /// otherwise fall back to the (claimed) default token.
+  void RecordLoadedFiles();
+  /// \brief Computes the cache key of the group for the declaration at
+  /// `loc` identified by `key`.
+  /// \return false if the group has no key, as when its file isn't claimed.
+  bool ComputeGroupHash(clang::SourceLocation loc, absl::string_view key,
+                        HashCache::Hash* hash) const;
   /// A map from FileIDs to associated metadata.
-  std::multimap<clang::FileID, std::shared_ptr<MetadataFile>> meta_;
+  absl::flat_hash_map<clang::FileID,
+                      std::vector<std::shared_ptr<const MetadataFile>>,
+                      FileIDHash>
+      meta_;
   /// The metadata file ids for which we have already emitted file metadata.
   absl::flat_hash_set<
       std::tuple<std::string, std::string, std::string, std::string>>
       file_meta_edges_emitted_;
   /// All files that were ever reached through a header file, including header
   /// files themselves.
-  std::set<llvm::sys::fs::UniqueID> transitively_reached_through_header_;
+  absl::flat_hash_set<llvm::sys::fs::UniqueID, UniqueIDHash>
+      transitively_reached_through_header_;
   /// A location in the main source file.
   clang::SourceLocation main_source_file_loc_;
+  /// Interns the corpus, root, and path of every claim token below.
+  mutable KytheClaimTokenTable claim_token_table_;
   /// A claim token in the main source file.
   KytheClaimToken* main_source_file_token_ = nullptr;
   /// Files we have previously inspected for claiming. When they refer to
@@ -576,33 +780,57 @@ class KytheGraphObserver : public GraphObserver {
   /// given include position. There will therefore be many FileIDs that map to
   /// one context + header pair; then, many context + header pairs may
   /// map to a single file's VName.
-  std::map<clang::FileID, KytheClaimToken> claim_checked_files_;
-  /// Tokens for files (independent of language) that we've claimed.
+  /// The tokens must stay put, since `NodeId`s point to them.
+  absl::node_hash_map<clang::FileID, KytheClaimToken, FileIDHash>
+      claim_checked_files_;
+  /// Tokens for files (independent of language) that we've claimed. This is
+  /// ordered so that `iterateOverClaimedFiles` visits files deterministically.
   std::map<clang::FileID, KytheClaimToken> claimed_file_specific_tokens_;
+  /// Maps from each FileID to the sorted offsets inside it at which some
+  /// rough-claimed file is (transitively) included. Built on the first call
+  /// to `claimSourceRange`, once preprocessing has seen every file.
+  absl::optional<
+      absl::flat_hash_map<clang::FileID, std::vector<unsigned>, FileIDHash>>
+      claimed_include_offsets_;
   /// Maps from claim tokens to claim tokens with path and root dropped.
   /// Used from logically const member funtions.
-  mutable std::map<const KytheClaimToken*, NamespaceTokens> namespace_tokens_;
+  mutable absl::node_hash_map<const KytheClaimToken*, NamespaceTokens>
+      namespace_tokens_;
   /// The `KytheGraphRecorder` used to record graph data. Must not be null.
   KytheGraphRecorder* recorder_;
   /// A VName representing this `GraphObserver`'s claiming authority.
   kythe::proto::VName claimant_;
   /// The starting preprocessor context.
-  PreprocessorContext starting_context_;
-  /// Maps from #include locations to the resulting preprocessor context.
-  using IncludeToContext = std::map<unsigned, PreprocessorContext>;
-  /// Maps from preprocessor contexts to context-specific records.
-  using ContextToIncludes = std::map<PreprocessorContext, IncludeToContext>;
-  /// Maps from file UID to its various context incarnations.
-  std::map<llvm::sys::fs::UniqueID, ContextToIncludes> path_to_context_data_;
+  PreprocessorContextTable::ContextId starting_context_ =
+      PreprocessorContextTable::kEmptyContext;
+  /// Caches the VNames computed by `VNameFromFileEntry`. Entries must stay put,
+  /// since `file_id_vnames_` points to them.
+  absl::node_hash_map<const clang::FileEntry*, kythe::proto::VName>
+      file_entry_vnames_;
+  /// Caches the results of `VNameFromFileID`. There are many FileIDs for each
+  /// file that is included more than once.
+  absl::flat_hash_map<clang::FileID, const kythe::proto::VName*, FileIDHash>
+      file_id_vnames_;
+  /// Hashers for the buffers that `AppendFileBufferSliceHashToStream` reads.
+  absl::flat_hash_map<clang::FileID, SliceHasher, FileIDHash> slice_hashers_;
+  /// Caches the results of `AppendFileBufferSliceHashToStream` by raw
+  /// location encoding.
+  absl::flat_hash_map<unsigned, std::string> slice_hashes_;
+  /// Maps from #include locations to the resulting preprocessor contexts.
+  PreprocessorContextTable contexts_;
+  /// Maps from file UIDs to the file indices used in `contexts_`.
+  absl::flat_hash_map<llvm::sys::fs::UniqueID, uint32_t, UniqueIDHash>
+      context_file_ids_;
   /// The `KytheClaimClient` used to reduce output redundancy. Not null.
   KytheClaimClient* client_;
   /// Contains the `FileEntry`s for files we have already recorded.
   /// These pointers are not owned by the `KytheGraphObserver`.
   std::unordered_set<const clang::FileEntry*> recorded_files_;
-  /// The set of anchor nodes with locations that have not yet been recorded.
-  /// This allows the `GraphObserver` to limit the amount of redundant range
-  /// information it emits should an anchor be the source of multiple edges.
-  std::unordered_set<Range, RangeHash> deferred_anchors_;
+  /// The anchor nodes with locations that have not yet been recorded,
+  /// possibly with duplicates. These are sorted and deduplicated once the
+  /// unit is done, so the `GraphObserver` emits the range information for
+  /// an anchor only once even if it is the source of multiple edges.
+  std::vector<Range> deferred_anchors_;
   /// A set of (source range, edge kind, target node) tuples, used if
   /// drop_redundant_wraiths_ is asserted.
   std::unordered_set<RangeEdge, ContextFreeRangeEdgeHash> range_edges_;
@@ -620,17 +848,70 @@ class KytheGraphObserver : public GraphObserver {
   /// are defined to have structure equivalent to their names (modulo
   /// non-primary types in case of aliases, which may still be stored
   /// redundantly), this will not obscure conflicting-fact errors.
-  /// The set of doc nodes we've emitted so far (identified by
-  /// `NodeId::ToString()`).
-  std::unordered_set<std::string> written_docs_;
-  /// The set of type nodes we've emitted so far (identified by
-  /// `NodeId::ToString()`).
-  std::unordered_set<std::string> written_types_;
-  /// The set of namespace nodes we've emitted so far (identified by
-  /// `NodeId::ToString()`).
-  std::unordered_set<std::string> written_namespaces_;
+  /// The sets below hold fingerprints of `NodeId::ToClaimedString()`.
+  /// The set of doc nodes this unit has emitted so far.
+  NodeFingerprintSet unit_written_docs_;
+  /// The set of type nodes this unit has emitted so far.
+  NodeFingerprintSet unit_written_types_;
+  /// The set of doc nodes we've emitted so far. Not null.
+  NodeFingerprintSet* written_docs_ = &unit_written_docs_;
+  /// The set of type nodes we've emitted so far. Not null.
+  NodeFingerprintSet* written_types_ = &unit_written_types_;
+  /// The implicit nodes claimed by any unit sharing this set, or null.
+  NodeFingerprintSet* indexed_instantiations_ = nullptr;
+  /// The set of namespace nodes we've emitted so far.
+  NodeFingerprintSet written_namespaces_;
   /// Whether to try and locally deduplicate nodes.
   bool deferring_nodes_ = true;
+  /// Where blocks for claimed files are found and saved, or null.
+  IncrementalStore* incremental_store_ = nullptr;
+  /// The stream that records blocks. Null unless `incremental_store_` isn't.
+  BlockRecordingOutput* incremental_output_ = nullptr;
+  /// Computes the keys of blocks from the files entered so far.
+  absl::optional<IncrementalKeyChain> incremental_keys_;
+  /// The claimed files left so far, by FileID and claimed VName.
+  std::vector<std::pair<clang::FileID, proto::VName>> left_incremental_files_;
+  /// The content digests of the unit's inputs by (corpus, root, path).
+  absl::flat_hash_map<std::tuple<std::string, std::string, std::string>,
+                      std::string>
+      input_digests_;
+  /// A block being recorded for a claimed file.
+  struct RecordedBlock {
+    std::string key;      ///< The key to save the block under.
+    std::string entries;  ///< The entries recorded so far.
+  };
+  /// The blocks being recorded. They must stay put, since
+  /// `incremental_output_` and `block_stack_` point to their entries.
+  absl::node_hash_map<clang::FileID, RecordedBlock, FileIDHash>
+      recorded_blocks_;
+  /// Where the keys of groups are probed and registered, or null.
+  HashCache* group_cache_ = nullptr;
+  /// Computes the keys of groups from the headers entered so far. The main
+  /// file is left out so that other main files can share the keys.
+  absl::optional<IncrementalKeyChain> group_keys_;
+  /// The content digest of the main file, which keys its own groups.
+  std::string main_file_digest_;
+  /// \brief The state of `group_keys_` as a claimed file was left.
+  struct GroupChain {
+    IncrementalKeyChain chain;  ///< The files entered until then.
+    proto::VName vname;         ///< The claimed file's VName.
+  };
+  /// The chains for the claimed files left so far whose groups have keys.
+  absl::flat_hash_map<clang::FileID, GroupChain, FileIDHash> group_chains_;
+  /// The claimed files left so far and where each ends, in the order they
+  /// were left (which is also the order of their ends).
+  std::vector<std::pair<clang::FileID, clang::SourceLocation>>
+      left_group_files_;
+  /// \brief The cache key of a group.
+  struct GroupKey {
+    HashCache::Hash hash;
+  };
+  /// The keys of the groups emitted so far, to register at the end.
+  std::vector<GroupKey> emitted_groups_;
+  /// Whether each level of `Delimit` is a keyed group, and its key if so.
+  std::vector<absl::optional<GroupKey>> group_stack_;
+  /// The block open at each level of `Delimit`, which may be null.
+  std::vector<std::string*> block_stack_;
   /// \brief Enabled metadata import support.
   const MetadataSupports* const meta_supports_;
   /// The virtual filesystem in use.
@@ -641,24 +922,16 @@ class KytheGraphObserver : public GraphObserver {
   KytheClaimToken type_token_;
   /// Name of the platform or build configuration to emit on anchors.
   const std::string build_config_;
-  /// Information about builtin nodes.
-  struct Builtin {
-    /// This Builtin's NodeId.
-    NodeId node_id;
-    /// Marked source for this Builtin.
-    MarkedSource marked_source;
-    /// Whether this Builtin has been emitted.
-    bool emitted;
-  };
-  /// Add known Builtins to builtins_.
-  void RegisterBuiltins();
-  /// Emit a particular Builtin.
-  void EmitBuiltin(Builtin* builtin) const;
+  /// Emit the builtin with `node_id` and `marked_source`.
+  void EmitBuiltin(const NodeId& node_id,
+                   const MarkedSource& marked_source) const;
   /// Emit entries for C++ meta nodes.
   void EmitMetaNodes();
-  /// Registered builtins.
-  /// Modified lazily in const member functions.
-  mutable std::map<std::string, Builtin> builtins_;
+  /// The NodeIds of the known builtins that have been emitted, indexed like
+  /// the process-wide builtin table. Filled lazily in const member functions.
+  mutable std::vector<absl::optional<NodeId>> builtin_ids_;
+  /// The NodeIds of builtins missing from the table that have been emitted.
+  mutable absl::flat_hash_map<std::string, NodeId> unknown_builtin_ids_;
 };
 
 }  // namespace kythe
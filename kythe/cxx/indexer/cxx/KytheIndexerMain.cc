@@ -23,21 +23,57 @@
 //       indexer -i foo.cc | verifier foo.cc
 //       indexer some/index.kindex
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "google/protobuf/stubs/common.h"
+#include "kythe/cxx/common/binary_metadata_file.h"
+#include "kythe/cxx/common/cpu_topology.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
+#include "kythe/cxx/common/indexing/SortedRunOutputStream.h"
 #include "kythe/cxx/common/init.h"
+#include "kythe/cxx/common/metadata_cache.h"
 #include "kythe/cxx/common/protobuf_metadata_file.h"
 #include "kythe/cxx/common/re2_flag.h"
+#include "kythe/cxx/common/regex.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/cxx/indexer/cxx/DynamicClaimClient.h"
 #include "kythe/cxx/indexer/cxx/GoogleFlagsLibrarySupport.h"
 #include "kythe/cxx/indexer/cxx/ImputedConstructorSupport.h"
 #include "kythe/cxx/indexer/cxx/IndexerFrontendAction.h"
 #include "kythe/cxx/indexer/cxx/ProtoLibrarySupport.h"
+#include "kythe/cxx/indexer/cxx/claim_stats.h"
 #include "kythe/cxx/indexer/cxx/frontend.h"
+#include "kythe/cxx/indexer/cxx/hierarchical_profiler.h"
+#include "kythe/cxx/indexer/cxx/incremental_store.h"
 #include "kythe/cxx/indexer/cxx/indexer_worklist.h"
+#include "kythe/cxx/indexer/cxx/marked_source_memo.h"
+#include "kythe/cxx/indexer/cxx/node_fingerprint_set.h"
+#include "kythe/cxx/indexer/cxx/preamble_cache.h"
+#include "kythe/cxx/indexer/cxx/profile_sections.h"
+#include "kythe/cxx/indexer/cxx/resource_budget.h"
+#include "kythe/cxx/indexer/cxx/type_node_cache.h"
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
 
 ABSL_FLAG(bool, index_template_instantiations, true,
           "Index template instantiations.");
@@ -46,8 +82,36 @@ ABSL_FLAG(bool, experimental_drop_instantiation_independent_data, false,
           "instantiation-independent.");
 ABSL_FLAG(bool, report_profiling_events, false,
           "Write profiling events to standard error.");
+ABSL_FLAG(bool, profile_summary, false,
+          "Write a table of nested profiling sections with their counts and "
+          "total and self times to standard error after each unit.");
+ABSL_FLAG(std::string, profile_trace_file, "",
+          "If nonempty, write profiling sections from every unit to this file "
+          "as Chrome trace-event JSON.");
+ABSL_FLAG(bool, profile_section_counters, false,
+          "Write the count and cycles of each profiling section to standard "
+          "error after each unit. Only available in builds that define "
+          "KYTHE_SECTION_COUNTERS, where the counters are always collected.");
+ABSL_FLAG(bool, profile_allocations, false,
+          "With --profile_summary, also record the change in allocated heap "
+          "bytes over each section. This slows profiling down unless the "
+          "indexer is built with KYTHE_COUNT_ALLOCATIONS, which also adds "
+          "the bytes allocated and retained in each section to "
+          "--profile_section_counters.");
+ABSL_FLAG(bool, experimental_entry_breakdown, false,
+          "Write a table of the number and size of the entries recorded for "
+          "each unit, by node kind, fact name and edge kind, to standard "
+          "error after each unit.");
 ABSL_FLAG(bool, experimental_index_lite, false,
           "Drop uncommonly-used data from the index.");
+ABSL_FLAG(std::string, experimental_skip_function_bodies, "",
+          "Don't parse or index function bodies. Either \"headers\" (skip "
+          "bodies outside the main source file) or \"all\". Definitions, "
+          "types and refs outside of bodies are still indexed; pair with "
+          "--experimental_index_lite for interface-only passes.");
+ABSL_FLAG(bool, experimental_lazy_system_macros, false,
+          "Only record the definition of a macro from a system header once "
+          "code outside of system headers expands or tests it.");
 ABSL_FLAG(bool, experimental_drop_objc_fwd_class_docs, false,
           "Drop comments for Objective-C forward class declarations.");
 ABSL_FLAG(bool, experimental_drop_cpp_fwd_decl_docs, false,
@@ -58,12 +122,267 @@ ABSL_FLAG(bool, use_compilation_corpus_as_default, false,
           "Use the CompilationUnit VName corpus as the default.");
 ABSL_FLAG(bool, experimental_record_dataflow_edges, false,
           "Emit experimental dataflow edges.");
+ABSL_FLAG(int, experimental_dataflow_influence_limit, 0,
+          "If nonzero, bound the memory used for dataflow edges: once this "
+          "many decls influence one value, record their edges and start "
+          "afresh. Some edges may then be emitted more than once.");
 ABSL_FLAG(kythe::RE2Flag, template_instance_exclude_path_pattern,
           kythe::RE2Flag{},
           "If nonempty, a regex that matches files to be excluded from "
           "template instance indexing.");
+ABSL_FLAG(std::string, template_instance_exclude_path_patterns_file, "",
+          "If nonempty, a file of regexes, one per line, that match files to "
+          "be excluded from template instance indexing in addition to "
+          "--template_instance_exclude_path_pattern. Blank lines and lines "
+          "starting with # are ignored.");
+ABSL_FLAG(bool, experimental_deduplicate_implicit_jobs, false,
+          "Index each deferred implicit declaration at most once per "
+          "translation unit (only affects --experimental_threaded_claiming).");
+ABSL_FLAG(int, jobs, 1,
+          "Index this many compilation units concurrently. Each unit's output "
+          "is buffered in memory until the unit is finished.");
+ABSL_FLAG(bool, experimental_ordered_output, false,
+          "With --jobs > 1, write each unit's entries in the order the units "
+          "were read rather than the order they finished. The output is then "
+          "deterministic as long as no --cache is in use.");
+ABSL_FLAG(int, experimental_ordered_output_window, 0,
+          "With --experimental_ordered_output, the most units to index or "
+          "hold back at once. A unit isn't started until the unit this many "
+          "places before it has been written, which bounds the memory held "
+          "by finished units waiting behind a slow one. 0 means 4 * --jobs.");
+ABSL_FLAG(bool, experimental_sorted_runs, false,
+          "Write each unit's entries as a sorted, deduplicated run with a "
+          "block index (see kythe/proto/sorted_run.proto) instead of as a "
+          "plain entry stream, so that the output of many units can be "
+          "merged rather than sorted.");
+ABSL_FLAG(absl::Duration, experimental_unit_time_budget, absl::ZeroDuration(),
+          "If nonzero, scale back indexing of units that take longer than "
+          "this: first skip template instantiations, then (at 125%) dataflow "
+          "edges, then (at 150%) marked source.");
+ABSL_FLAG(int64_t, experimental_unit_memory_budget_mb, 0,
+          "If nonzero, scale back indexing of units while the indexer's "
+          "resident set is larger than this many MiB. With --jobs > 1, "
+          "each unit instead gets an equal share of this and is charged for "
+          "how much the resident set grows while it is indexed, so that one "
+          "large unit doesn't scale back the units running beside it.");
+ABSL_FLAG(std::string, experimental_claim_stats_file, "",
+          "With --experimental_dynamic_claim_cache, write a record of the "
+          "claims requested, granted, denied and overclaimed for each unit, "
+          "together with the bytes of entries the unit recorded, to this "
+          "file. With --jobs > 1, one record covers every unit.");
+ABSL_FLAG(std::string, experimental_unit_metrics_file, "",
+          "Write the parse, traversal and emit times, entries, bytes and peak "
+          "resident set of each unit to this file (such as /dev/fd/3) in the "
+          "Prometheus text format as soon as the unit is done, each record "
+          "followed by an empty line. With --jobs 1, records also count the "
+          "unit's claims (given --experimental_dynamic_claim_cache) and its "
+          "lookups in shared caches.");
+ABSL_FLAG(bool, experimental_share_written_nodes, false,
+          "Remember the type and doc nodes written by every unit, so that "
+          "later units in the same run don't write them again.");
+ABSL_FLAG(bool, experimental_share_indexed_instantiations, false,
+          "Remember the implicit template instantiations indexed by every "
+          "unit, so that later units in the same run skip them. Has no "
+          "effect with --experimental_threaded_claiming, which doesn't "
+          "claim instantiations one at a time.");
+ABSL_FLAG(int64_t, experimental_marked_source_memo_entries, 0,
+          "If nonzero, remember up to this many decls' marked source so that "
+          "later units seeing the same decl with the same text reuse it.");
+ABSL_FLAG(int64_t, experimental_type_node_cache_entries, 0,
+          "With --experimental_share_written_nodes, if nonzero, remember up "
+          "to this many type nodes so that later units building the same "
+          "type reuse them.");
+ABSL_FLAG(int64_t, experimental_metadata_cache_entries, 0,
+          "If nonzero, remember up to this many parsed metadata files so that "
+          "later units including the same generated file don't parse its "
+          "metadata again.");
+ABSL_FLAG(std::string, experimental_incremental_store, "",
+          "If set, an existing directory in which to record the entries "
+          "emitted while traversing the declarations in each claimed file, "
+          "keyed by the digests of every file the unit entered. "
+          "Later runs emit a recorded block instead of traversing the file "
+          "again. Only share a directory between runs with the same flags.");
+ABSL_FLAG(bool, experimental_probe_group_keys, false,
+          "With --cache, look up each claimed top-level declaration that "
+          "no template instantiation depends on before traversing it, keyed "
+          "by the digests of the headers the unit had entered by the end of "
+          "its file and the main file's text before the #include that led "
+          "there, and skip it if an earlier unit emitted it. Ignored "
+          "with --experimental_incremental_store.");
+ABSL_FLAG(int64_t, experimental_main_file_preambles, 0,
+          "If nonzero, keep precompiled preambles for up to this many main "
+          "files (and argument lists). The first unit for a main file is "
+          "indexed in full and builds its preamble; later ones load their "
+          "leading #includes from it instead of parsing them, and only the "
+          "rest of the main file is indexed: the headers in the preamble and "
+          "the main file's own #includes produce no entries. Meant for "
+          "reindexing edited files with "
+          "--experimental_read_inputs_from_stdin.");
+ABSL_FLAG(bool, experimental_numa_placement, false,
+          "With --jobs > 1, spread the workers over the NUMA nodes, pin each "
+          "one to the CPUs of its node, and give each node its own marked "
+          "source memo and type node cache of the configured sizes. The "
+          "records of written nodes and indexed instantiations stay shared.");
+ABSL_FLAG(int64_t, experimental_unit_entry_budget, 0,
+          "If nonzero, scale back indexing of units that emit more than this "
+          "many facts and edges.");
 
 namespace kythe {
+namespace {
+
+/// The NUMA node whose caches this worker thread uses (see
+/// --experimental_numa_placement).
+thread_local size_t worker_node = 0;
+
+/// \brief Indexes a single compilation.
+/// \param job The compilation to index.
+/// \param options Options for the indexer; adjusted for `job`.
+/// \param trace If non-null, receives the unit's profile.
+/// \param bytes_recorded If non-null, receives the size of the entries
+/// recorded for the unit.
+/// \param metrics If non-null, receives the unit's times, entries, bytes and
+/// the peak resident set size.
+/// \return an empty string on success or an error message on failure.
+std::string IndexJob(IndexerJob& job, IndexerOptions options,
+                     KytheClaimClient& claim_client, HashCache* hash_cache,
+                     KytheCachingOutput& output, ChromeTraceWriter* trace,
+                     size_t* bytes_recorded, UnitMetrics* metrics) {
+  options.EffectiveWorkingDirectory = job.unit.working_directory();
+  if (job.silent) {
+    // Nodes written to the null stream were never really written.
+    options.SharedWrittenTypes = nullptr;
+    options.SharedWrittenDocs = nullptr;
+    options.SharedTypeNodes = nullptr;
+    options.SharedIndexedInstantiations = nullptr;
+  }
+
+  const bool summarize = absl::GetFlag(FLAGS_profile_summary);
+  std::unique_ptr<HierarchicalProfiler> profiler;
+  if (summarize || trace != nullptr) {
+    profiler = absl::make_unique<HierarchicalProfiler>(
+        [] { return absl::Now(); },
+        absl::GetFlag(FLAGS_profile_allocations)
+            ? &HierarchicalProfiler::CurrentAllocatedBytes
+            : std::function<int64_t()>());
+    options.ReportProfileEvent =
+        [profiler = profiler.get(), report = options.ReportProfileEvent](
+            const char* counter, ProfilingEvent event) {
+          if (report) {
+            report(counter, event);
+          }
+          if (event == ProfilingEvent::Enter) {
+            profiler->Enter(counter);
+          } else {
+            profiler->Exit(counter);
+          }
+        };
+  }
+
+  const bool show_breakdown = absl::GetFlag(FLAGS_experimental_entry_breakdown);
+  std::unique_ptr<EntryBreakdown> breakdown;
+  if (show_breakdown || bytes_recorded != nullptr || metrics != nullptr) {
+    breakdown = absl::make_unique<EntryBreakdown>();
+    options.OutputBreakdown = breakdown.get();
+  }
+
+  options.Metrics = metrics;
+  options.ReadFileContent = job.read_content;
+
+  kythe::MetadataSupports meta_supports;
+  meta_supports.Add(absl::make_unique<BinaryMetadataSupport>());
+  meta_supports.Add(absl::make_unique<ProtobufMetadataSupport>());
+  meta_supports.Add(absl::make_unique<KytheMetadataSupport>());
+  meta_supports.UseCache(options.SharedMetadata);
+
+  kythe::LibrarySupports library_supports;
+  library_supports.push_back(absl::make_unique<GoogleFlagsLibrarySupport>());
+  library_supports.push_back(absl::make_unique<GoogleProtoLibrarySupport>());
+  library_supports.push_back(absl::make_unique<ImputedConstructorSupport>());
+
+  std::string result = IndexCompilationUnit(
+      job.unit, job.virtual_files, claim_client, hash_cache, output, options,
+      &meta_supports, &library_supports, [](IndexerASTVisitor* indexer) {
+        if (absl::GetFlag(FLAGS_experimental_deduplicate_implicit_jobs)) {
+          return IndexerWorklist::CreateDeduplicatingWorklist(indexer);
+        }
+        return IndexerWorklist::CreateDefaultWorklist(indexer);
+      });
+  const std::string& label = UnitLabel(job.unit);
+  if (show_breakdown) {
+    absl::FPrintF(stderr, "Entries for %s:\n%s", label,
+                  breakdown->ToString());
+  }
+  if (bytes_recorded != nullptr) {
+    *bytes_recorded = breakdown->total().bytes;
+  }
+  if (metrics != nullptr) {
+    metrics->unit = label;
+    metrics->entries = breakdown->total().entries;
+    metrics->bytes = breakdown->total().bytes;
+    metrics->peak_rss_bytes = ResourceBudget::PeakRssBytes();
+  }
+  if (kSectionCountersEnabled) {
+    // Units are indexed on a single thread, so its counters now hold this
+    // unit's sections alone.
+    SectionCounters::Counts counts = SectionCounters::ThisThread().Take();
+    if (absl::GetFlag(FLAGS_profile_section_counters)) {
+      std::string summary = absl::StrCat("Section counters for ", label, ":\n");
+      SectionCounters::AppendSummary(counts, &summary);
+      absl::FPrintF(stderr, "%s", summary);
+    }
+  }
+  if (profiler != nullptr) {
+    if (summarize) {
+      std::string summary = absl::StrCat("Profile for ", label, ":\n");
+      profiler->AppendSummary(&summary);
+      absl::FPrintF(stderr, "%s", summary);
+    }
+    if (trace != nullptr) {
+      trace->AddUnit(label, *profiler);
+    }
+  }
+  return result;
+}
+
+/// \brief Combines --template_instance_exclude_path_pattern and the patterns
+/// listed in --template_instance_exclude_path_patterns_file into one set.
+/// \return the set, or null if there are no patterns.
+absl::StatusOr<std::shared_ptr<const RegexSet>>
+LoadTemplateInstanceExcludePathPatterns() {
+  std::vector<std::string> patterns;
+  const kythe::RE2Flag pattern =
+      absl::GetFlag(FLAGS_template_instance_exclude_path_pattern);
+  if (pattern.value != nullptr) {
+    patterns.push_back(pattern.value->pattern());
+  }
+  const std::string path =
+      absl::GetFlag(FLAGS_template_instance_exclude_path_patterns_file);
+  if (!path.empty()) {
+    std::ifstream file(path);
+    if (!file) {
+      return absl::NotFoundError(absl::StrCat("Couldn't open ", path));
+    }
+    for (std::string line; std::getline(file, line);) {
+      absl::string_view listed = absl::StripAsciiWhitespace(line);
+      if (!listed.empty() && listed[0] != '#') {
+        patterns.emplace_back(listed);
+      }
+    }
+  }
+  if (patterns.empty()) {
+    return nullptr;
+  }
+  RE2::Options options;
+  options.set_never_capture(true);
+  absl::StatusOr<RegexSet> set =
+      RegexSet::Build(patterns, options, RE2::ANCHOR_BOTH);
+  if (!set.ok()) {
+    return set.status();
+  }
+  return std::make_shared<const RegexSet>(*std::move(set));
+}
+
+}  // anonymous namespace
 
 int main(int argc, char* argv[]) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -83,6 +402,22 @@ int main(int argc, char* argv[]) {
   options.Verbosity = absl::GetFlag(FLAGS_experimental_index_lite)
                           ? kythe::Verbosity::Lite
                           : kythe::Verbosity::Classic;
+  options.SystemMacros = absl::GetFlag(FLAGS_experimental_lazy_system_macros)
+                             ? BehaviorOnSystemMacros::DefineIfUsed
+                             : BehaviorOnSystemMacros::Define;
+  const std::string skip_bodies =
+      absl::GetFlag(FLAGS_experimental_skip_function_bodies);
+  if (skip_bodies == "headers") {
+    options.FunctionBodies = BehaviorOnFunctionBodies::SkipInHeaders;
+  } else if (skip_bodies == "all") {
+    options.FunctionBodies = BehaviorOnFunctionBodies::SkipAll;
+  } else if (!skip_bodies.empty()) {
+    absl::FPrintF(stderr,
+                  "--experimental_skip_function_bodies must be \"headers\" "
+                  "or \"all\", not \"%s\"\n",
+                  skip_bodies);
+    return 1;
+  }
   options.ObjCFwdDocs =
       absl::GetFlag(FLAGS_experimental_drop_objc_fwd_class_docs)
           ? kythe::BehaviorOnFwdDeclComments::Ignore
@@ -93,17 +428,35 @@ int main(int argc, char* argv[]) {
   options.UsrByteSize = absl::GetFlag(FLAGS_experimental_usr_byte_size) <= 0
                             ? 0
                             : absl::GetFlag(FLAGS_experimental_usr_byte_size);
-  options.TemplateInstanceExcludePathPattern =
-      absl::GetFlag(FLAGS_template_instance_exclude_path_pattern).value;
+  if (auto patterns = LoadTemplateInstanceExcludePathPatterns();
+      patterns.ok()) {
+    options.TemplateInstanceExcludePathPatterns = *std::move(patterns);
+  } else {
+    absl::FPrintF(stderr, "Bad template instance exclude patterns: %s\n",
+                  patterns.status().ToString());
+    return 1;
+  }
   options.DataflowEdges =
       absl::GetFlag(FLAGS_experimental_record_dataflow_edges)
           ? kythe::EmitDataflowEdges::Yes
           : kythe::EmitDataflowEdges::No;
+  options.InfluenceSetLimit =
+      std::max(0, absl::GetFlag(FLAGS_experimental_dataflow_influence_limit));
   options.UseCompilationCorpusAsDefault =
       absl::GetFlag(FLAGS_use_compilation_corpus_as_default);
   options.DropInstantiationIndependentData =
       absl::GetFlag(FLAGS_experimental_drop_instantiation_independent_data);
+  options.ProbeGroupKeys = absl::GetFlag(FLAGS_experimental_probe_group_keys);
   options.AllowFSAccess = context.allow_filesystem_access();
+  options.UnitBudget.max_wall_time =
+      std::max(absl::ZeroDuration(),
+               absl::GetFlag(FLAGS_experimental_unit_time_budget));
+  options.UnitBudget.max_rss_bytes =
+      static_cast<size_t>(std::max<int64_t>(
+          0, absl::GetFlag(FLAGS_experimental_unit_memory_budget_mb)))
+      << 20;
+  options.UnitBudget.max_entries = static_cast<size_t>(std::max<int64_t>(
+      0, absl::GetFlag(FLAGS_experimental_unit_entry_budget)));
   if (absl::GetFlag(FLAGS_report_profiling_events)) {
     options.ReportProfileEvent = [](const char* counter, ProfilingEvent event) {
       absl::FPrintF(stderr, "%s: %s\n", counter,
@@ -111,37 +464,413 @@ int main(int argc, char* argv[]) {
     };
   }
 
-  bool had_errors = false;
+  std::unique_ptr<ChromeTraceWriter> trace;
+  if (!absl::GetFlag(FLAGS_profile_trace_file).empty()) {
+    trace = absl::make_unique<ChromeTraceWriter>();
+  }
+  // Writes the trace (if any) once every unit has been indexed.
+  auto write_trace = [&trace] {
+    if (trace == nullptr) {
+      return;
+    }
+    std::ofstream trace_file(absl::GetFlag(FLAGS_profile_trace_file));
+    trace_file << trace->Finish();
+    if (!trace_file) {
+      absl::FPrintF(stderr, "Couldn't write %s\n",
+                    absl::GetFlag(FLAGS_profile_trace_file));
+    }
+  };
+
+  std::atomic<bool> had_errors(false);
   NullOutputStream null_stream;
+  const int jobs = std::max(1, absl::GetFlag(FLAGS_jobs));
+  if (jobs > 1 && options.UnitBudget.max_rss_bytes > 0) {
+    options.UnitBudget.max_rss_bytes =
+        std::max<size_t>(1, options.UnitBudget.max_rss_bytes / jobs);
+    options.UnitBudget.charge_rss_growth = true;
+  }
+  const bool sorted_runs = absl::GetFlag(FLAGS_experimental_sorted_runs);
 
-  context.EnumerateCompilations([&](IndexerJob& job) {
-    options.EffectiveWorkingDirectory = job.unit.working_directory();
+  // Claim stats are only counted when there's somewhere to write them.
+  const DynamicClaimClient* dynamic_claims = context.dynamic_claim_client();
+  std::ofstream claim_stats_file;
+  if (!absl::GetFlag(FLAGS_experimental_claim_stats_file).empty()) {
+    if (dynamic_claims == nullptr) {
+      absl::FPrintF(stderr,
+                    "--experimental_claim_stats_file needs "
+                    "--experimental_dynamic_claim_cache\n");
+      return 1;
+    }
+    claim_stats_file.open(absl::GetFlag(FLAGS_experimental_claim_stats_file));
+    if (!claim_stats_file) {
+      absl::FPrintF(stderr, "Couldn't open %s\n",
+                    absl::GetFlag(FLAGS_experimental_claim_stats_file));
+      return 1;
+    }
+  }
+  const bool count_claims = claim_stats_file.is_open();
+  auto write_claim_stats = [&claim_stats_file](const std::string& label,
+                                               const ClaimStats& stats) {
+    claim_stats_file << FormatClaimStatsRecord({label, stats}) << "\n";
+  };
+
+  // Unit metrics go out as each unit finishes, so that a collector can
+  // forward them while the indexer is still running.
+  std::ofstream unit_metrics_file;
+  if (!absl::GetFlag(FLAGS_experimental_unit_metrics_file).empty()) {
+    unit_metrics_file.open(absl::GetFlag(FLAGS_experimental_unit_metrics_file));
+    if (!unit_metrics_file) {
+      absl::FPrintF(stderr, "Couldn't open %s\n",
+                    absl::GetFlag(FLAGS_experimental_unit_metrics_file));
+      return 1;
+    }
+  }
+  const bool record_metrics = unit_metrics_file.is_open();
+  auto write_unit_metrics = [&unit_metrics_file](const UnitMetrics& metrics) {
+    unit_metrics_file << FormatUnitMetrics(metrics) << std::flush;
+  };
+
+  std::unique_ptr<IncrementalStore> incremental_store;
+  if (!absl::GetFlag(FLAGS_experimental_incremental_store).empty()) {
+    incremental_store = absl::make_unique<IncrementalStore>(
+        absl::GetFlag(FLAGS_experimental_incremental_store));
+    options.IncrementalBlocks = incremental_store.get();
+  }
+
+  NodeFingerprintSet written_types;
+  NodeFingerprintSet written_docs;
+  // A node that an earlier unit wrote wouldn't be in the blocks recorded for
+  // later ones.
+  const bool share_written_nodes =
+      absl::GetFlag(FLAGS_experimental_share_written_nodes) &&
+      incremental_store == nullptr;
+  if (absl::GetFlag(FLAGS_experimental_share_written_nodes) &&
+      !share_written_nodes) {
+    absl::FPrintF(stderr,
+                  "--experimental_share_written_nodes has no effect with "
+                  "--experimental_incremental_store\n");
+  }
+  if (share_written_nodes) {
+    options.SharedWrittenTypes = &written_types;
+    options.SharedWrittenDocs = &written_docs;
+  }
+
+  NodeFingerprintSet indexed_instantiations;
+  const bool share_instantiations =
+      absl::GetFlag(FLAGS_experimental_share_indexed_instantiations);
+  if (share_instantiations) {
+    options.SharedIndexedInstantiations = &indexed_instantiations;
+  }
+
+  std::unique_ptr<MarkedSourceMemo> marked_source_memo;
+  if (absl::GetFlag(FLAGS_experimental_marked_source_memo_entries) > 0) {
+    marked_source_memo = absl::make_unique<MarkedSourceMemo>(
+        absl::GetFlag(FLAGS_experimental_marked_source_memo_entries));
+    options.SharedMarkedSource = marked_source_memo.get();
+  }
+
+  std::unique_ptr<TypeNodeCache> type_node_cache;
+  if (absl::GetFlag(FLAGS_experimental_type_node_cache_entries) > 0) {
+    if (share_written_nodes) {
+      type_node_cache = absl::make_unique<TypeNodeCache>(
+          absl::GetFlag(FLAGS_experimental_type_node_cache_entries));
+      options.SharedTypeNodes = type_node_cache.get();
+    } else {
+      absl::FPrintF(stderr,
+                    "--experimental_type_node_cache_entries has no effect "
+                    "without --experimental_share_written_nodes\n");
+    }
+  }
 
-    kythe::MetadataSupports meta_supports;
-    meta_supports.Add(absl::make_unique<ProtobufMetadataSupport>());
-    meta_supports.Add(absl::make_unique<KytheMetadataSupport>());
+  // The cache is safe to share among threads as it is.
+  std::unique_ptr<MetadataCache> metadata_cache;
+  if (absl::GetFlag(FLAGS_experimental_metadata_cache_entries) > 0) {
+    metadata_cache = absl::make_unique<MetadataCache>(
+        absl::GetFlag(FLAGS_experimental_metadata_cache_entries));
+    options.SharedMetadata = metadata_cache.get();
+  }
 
-    kythe::LibrarySupports library_supports;
-    library_supports.push_back(absl::make_unique<GoogleFlagsLibrarySupport>());
-    library_supports.push_back(absl::make_unique<GoogleProtoLibrarySupport>());
-    library_supports.push_back(absl::make_unique<ImputedConstructorSupport>());
+  // So is the preamble cache.
+  std::unique_ptr<PreambleCache> preamble_cache;
+  if (absl::GetFlag(FLAGS_experimental_main_file_preambles) > 0) {
+    preamble_cache = absl::make_unique<PreambleCache>(
+        absl::GetFlag(FLAGS_experimental_main_file_preambles));
+    options.Preambles = preamble_cache.get();
+  }
 
-    std::string result = IndexCompilationUnit(
-        job.unit, job.virtual_files, *context.claim_client(),
-        context.hash_cache(),
-        job.silent ? static_cast<KytheCachingOutput&>(null_stream)
-                   : static_cast<KytheCachingOutput&>(*context.output()),
-        options, &meta_supports, &library_supports,
-        [](IndexerASTVisitor* indexer) {
-          return IndexerWorklist::CreateDefaultWorklist(indexer);
-        });
+  if (jobs == 1) {
+    context.EnumerateCompilations([&](IndexerJob& job) {
+      std::string result;
+      ClaimStats claims_before;
+      size_t bytes_recorded = 0;
+      if (count_claims || (record_metrics && dynamic_claims != nullptr)) {
+        claims_before = dynamic_claims->stats();
+      }
+      CacheCounts memo_before, type_nodes_before;
+      if (marked_source_memo != nullptr) {
+        memo_before = {marked_source_memo->hits(),
+                       marked_source_memo->misses()};
+      }
+      if (type_node_cache != nullptr) {
+        type_nodes_before = {type_node_cache->hits(),
+                             type_node_cache->misses()};
+      }
+      size_t* unit_bytes =
+          count_claims && !job.silent ? &bytes_recorded : nullptr;
+      UnitMetrics metrics;
+      UnitMetrics* unit_metrics =
+          record_metrics && !job.silent ? &metrics : nullptr;
+      if (sorted_runs && !job.silent) {
+        std::string buffer;
+        {
+          StringAppendingStream appender(&buffer);
+          google::protobuf::io::CopyingOutputStreamAdaptor raw_output(
+              &appender);
+          SortedRunOutputStream run_output(&raw_output);
+          result = IndexJob(job, options, *context.claim_client(),
+                            context.hash_cache(), run_output, trace.get(),
+                            unit_bytes, unit_metrics);
+        }
+        if (!buffer.empty()) {
+          context.output()->WriteDelimitedEntries(buffer);
+        }
+      } else {
+        result = IndexJob(
+            job, options, *context.claim_client(), context.hash_cache(),
+            job.silent ? static_cast<KytheCachingOutput&>(null_stream)
+                       : static_cast<KytheCachingOutput&>(*context.output()),
+            trace.get(), unit_bytes, unit_metrics);
+      }
+      if (!result.empty()) {
+        absl::FPrintF(stderr, "Error: %s\n", result);
+        had_errors = true;
+      }
+      if (count_claims) {
+        ClaimStats claims = dynamic_claims->stats() - claims_before;
+        claims.bytes = bytes_recorded;
+        write_claim_stats(UnitLabel(job.unit), claims);
+      }
+      if (unit_metrics != nullptr) {
+        if (dynamic_claims != nullptr) {
+          metrics.claims = dynamic_claims->stats() - claims_before;
+          metrics.claims->bytes = metrics.bytes;
+        }
+        if (marked_source_memo != nullptr) {
+          metrics.marked_source_memo =
+              CacheCounts{marked_source_memo->hits() - memo_before.hits,
+                          marked_source_memo->misses() - memo_before.misses};
+        }
+        if (type_node_cache != nullptr) {
+          metrics.type_node_cache = CacheCounts{
+              type_node_cache->hits() - type_nodes_before.hits,
+              type_node_cache->misses() - type_nodes_before.misses};
+        }
+        write_unit_metrics(metrics);
+      }
+    });
+    write_trace();
+    return (had_errors ? 1 : 0);
+  }
 
-    if (!result.empty()) {
-      absl::FPrintF(stderr, "Error: %s\n", result);
-      had_errors = true;
+  // Claim clients, hash caches and entry filters aren't thread-safe, so
+  // workers share them through serializing wrappers. Each worker writes its
+  // unit to a private buffer that is copied to the real output once the unit
+  // is done; this keeps entries from different units from interleaving.
+  SynchronizedClaimClient claim_client(context.claim_client());
+  std::unique_ptr<SynchronizedHashCache> hash_cache;
+  if (context.hash_cache() != nullptr) {
+    hash_cache = absl::make_unique<SynchronizedHashCache>(context.hash_cache());
+  }
+  std::unique_ptr<SynchronizedEntryFingerprintFilter> entry_filter;
+  if (context.entry_filter() != nullptr) {
+    entry_filter = absl::make_unique<SynchronizedEntryFingerprintFilter>(
+        context.entry_filter());
+  }
+  SynchronizedNodeFingerprintSet shared_written_types(&written_types);
+  SynchronizedNodeFingerprintSet shared_written_docs(&written_docs);
+  if (share_written_nodes) {
+    options.SharedWrittenTypes = &shared_written_types;
+    options.SharedWrittenDocs = &shared_written_docs;
+  }
+  SynchronizedNodeFingerprintSet shared_indexed_instantiations(
+      &indexed_instantiations);
+  if (share_instantiations) {
+    options.SharedIndexedInstantiations = &shared_indexed_instantiations;
+  }
+  std::unique_ptr<SynchronizedMarkedSourceMemo> shared_marked_source;
+  if (marked_source_memo != nullptr) {
+    shared_marked_source = absl::make_unique<SynchronizedMarkedSourceMemo>(
+        marked_source_memo.get());
+    options.SharedMarkedSource = shared_marked_source.get();
+  }
+  std::unique_ptr<SynchronizedTypeNodeCache> shared_type_nodes;
+  if (type_node_cache != nullptr) {
+    shared_type_nodes =
+        absl::make_unique<SynchronizedTypeNodeCache>(type_node_cache.get());
+    options.SharedTypeNodes = shared_type_nodes.get();
+  }
+  // With --experimental_numa_placement, worker i runs on node i % nodes and
+  // uses that node's caches, so the entries in them are allocated by and
+  // mostly read from threads on the same node. Node 0 keeps the caches made
+  // above.
+  std::vector<std::vector<int>> numa_nodes;
+  if (absl::GetFlag(FLAGS_experimental_numa_placement)) {
+    numa_nodes = ReadNumaNodeCpus();
+    if (numa_nodes.empty()) {
+      absl::FPrintF(stderr,
+                    "--experimental_numa_placement: couldn't read the NUMA "
+                    "topology; workers won't be pinned\n");
     }
-  });
+  }
+  struct NodeCaches {
+    std::unique_ptr<MarkedSourceMemo> marked_source;
+    std::unique_ptr<SynchronizedMarkedSourceMemo> shared_marked_source;
+    std::unique_ptr<TypeNodeCache> type_nodes;
+    std::unique_ptr<SynchronizedTypeNodeCache> shared_type_nodes;
+  };
+  std::vector<NodeCaches> node_caches(numa_nodes.size());
+  std::vector<IndexerOptions> node_options(
+      std::max<size_t>(1, numa_nodes.size()), options);
+  for (size_t node = 1; node < numa_nodes.size(); ++node) {
+    NodeCaches& caches = node_caches[node];
+    if (marked_source_memo != nullptr) {
+      caches.marked_source = absl::make_unique<MarkedSourceMemo>(
+          absl::GetFlag(FLAGS_experimental_marked_source_memo_entries));
+      caches.shared_marked_source =
+          absl::make_unique<SynchronizedMarkedSourceMemo>(
+              caches.marked_source.get());
+      node_options[node].SharedMarkedSource =
+          caches.shared_marked_source.get();
+    }
+    if (type_node_cache != nullptr) {
+      caches.type_nodes = absl::make_unique<TypeNodeCache>(
+          absl::GetFlag(FLAGS_experimental_type_node_cache_entries));
+      caches.shared_type_nodes =
+          absl::make_unique<SynchronizedTypeNodeCache>(caches.type_nodes.get());
+      node_options[node].SharedTypeNodes = caches.shared_type_nodes.get();
+    }
+  }
+  auto start_worker = [&numa_nodes](size_t worker) {
+    if (numa_nodes.empty()) {
+      return;
+    }
+    worker_node = worker % numa_nodes.size();
+    if (!PinCurrentThreadToCpus(numa_nodes[worker_node])) {
+      absl::FPrintF(stderr, "Couldn't pin worker %d to NUMA node %d\n",
+                    worker, worker_node);
+    }
+  };
+  // With --experimental_ordered_output, finished units are held back until
+  // every unit enumerated before them has been written.
+  const bool ordered = absl::GetFlag(FLAGS_experimental_ordered_output);
+  const size_t ordered_window =
+      absl::GetFlag(FLAGS_experimental_ordered_output_window) > 0
+          ? absl::GetFlag(FLAGS_experimental_ordered_output_window)
+          : 4 * static_cast<size_t>(jobs);
+  absl::Mutex output_mu;
+  std::map<size_t, std::string> finished_units;  // Guarded by output_mu.
+  size_t next_unit_to_write = 0;  // Guarded by output_mu.
+  size_t next_unit = 0;
+  // Claims made by concurrent units can't be told apart, so every unit's
+  // claims and bytes are reported together.
+  std::atomic<size_t> bytes_recorded(0);
+  {
+    ThreadPool pool(jobs, 0, start_worker);
+    context.EnumerateCompilations([&](IndexerJob& job) {
+      auto shared_job = std::make_shared<IndexerJob>(std::move(job));
+      const size_t unit_index = next_unit++;
+      if (ordered && unit_index >= ordered_window) {
+        // Don't start this unit until the one `ordered_window` places before
+        // it has been written, so that finished units can't pile up without
+        // bound behind a slow one.
+        std::pair<const size_t*, size_t> wait(
+            &next_unit_to_write, unit_index + 1 - ordered_window);
+        absl::MutexLock lock(&output_mu);
+        output_mu.Await(absl::Condition(
+            +[](std::pair<const size_t*, size_t>* wait) {
+              return *wait->first >= wait->second;
+            },
+            &wait));
+      }
+      pool.Schedule([&, shared_job, unit_index] {
+        std::string buffer;
+        std::string result;
+        // Claims and cache lookups made by concurrent units can't be told
+        // apart, so these metrics leave them out.
+        UnitMetrics metrics;
+        UnitMetrics* unit_metrics =
+            record_metrics && !shared_job->silent ? &metrics : nullptr;
+        {
+          StringAppendingStream appender(&buffer);
+          google::protobuf::io::CopyingOutputStreamAdaptor raw_output(
+              &appender);
+          std::unique_ptr<KytheCachingOutput> unit_output;
+          if (sorted_runs) {
+            unit_output = absl::make_unique<SortedRunOutputStream>(&raw_output);
+          } else {
+            // Configure each unit's stream as the shared one is, so that
+            // --jobs doesn't change what is written or reported. Flushes
+            // happen when the shared stream writes the unit's buffer.
+            auto file_output = absl::make_unique<FileOutputStream>(&raw_output);
+            file_output->set_show_stats(context.output()->show_stats());
+            file_output->set_flush_after_each_entry(
+                context.output()->flush_after_each_entry());
+            file_output->set_entry_set_bundle_size(
+                context.output()->entry_set_bundle_size());
+            if (entry_filter != nullptr) {
+              file_output->UseEntryFilter(entry_filter.get());
+            }
+            unit_output = std::move(file_output);
+          }
+          size_t unit_bytes = 0;
+          result = IndexJob(
+              *shared_job, node_options[worker_node], claim_client,
+              hash_cache.get(),
+              shared_job->silent ? static_cast<KytheCachingOutput&>(null_stream)
+                                 : *unit_output,
+              trace.get(),
+              count_claims && !shared_job->silent ? &unit_bytes : nullptr,
+              unit_metrics);
+          bytes_recorded += unit_bytes;
+        }
+        absl::MutexLock lock(&output_mu);
+        if (!result.empty()) {
+          absl::FPrintF(stderr, "Error: %s\n", result);
+          had_errors = true;
+        }
+        if (unit_metrics != nullptr) {
+          write_unit_metrics(metrics);
+        }
+        if (!ordered) {
+          if (!buffer.empty()) {
+            context.output()->WriteDelimitedEntries(buffer);
+          }
+          return;
+        }
+        finished_units.emplace(unit_index, std::move(buffer));
+        while (!finished_units.empty() &&
+               finished_units.begin()->first == next_unit_to_write) {
+          if (!finished_units.begin()->second.empty()) {
+            context.output()->WriteDelimitedEntries(
+                finished_units.begin()->second);
+          }
+          finished_units.erase(finished_units.begin());
+          ++next_unit_to_write;
+        }
+      });
+    });
+  }
 
+  if (count_claims) {
+    ClaimStats claims = dynamic_claims->stats();
+    claims.bytes = bytes_recorded;
+    write_claim_stats("(all units)", claims);
+  }
+  if (preamble_cache != nullptr) {
+    absl::FPrintF(stderr, "preambles: %d hits, %d misses\n",
+                  preamble_cache->hits(), preamble_cache->misses());
+  }
+  write_trace();
   return (had_errors ? 1 : 0);
 }
 
@@ -24,9 +24,11 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "IndexerFrontendAction.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/RecursiveASTVisitor.h"
@@ -34,9 +36,14 @@
 #include "clang/Tooling/Tooling.h"
 #include "google/protobuf/stubs/common.h"
 #include "gtest/gtest.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
 #include "kythe/cxx/common/indexing/RecordingOutputStream.h"
+#include "kythe/cxx/common/kythe_metadata_file.h"
 #include "kythe/cxx/indexer/cxx/IndexerASTHooks.h"
+#include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
+#include "kythe/cxx/indexer/cxx/incremental_store.h"
+#include "kythe/proto/analysis.pb.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 
@@ -342,6 +349,26 @@ TEST(KytheIndexerUnitTest, BufferStackMergeDown) {
   ASSERT_EQ("01234", actual);
 }
 
+TEST(KytheIndexerUnitTest, BufferStackMurmur3HashIgnoresJoins) {
+  kythe::BufferStack stack;
+  stack.Push(0);
+  WriteStringToStackAndBuffer("01", &stack, nullptr);
+  stack.Push(0);
+  WriteStringToStackAndBuffer("234", &stack, nullptr);
+  ASSERT_TRUE(stack.MergeDownIfTooSmall(1024, 2048));  // 01+234
+  kythe::HashCache::Hash hash_expected = {
+      kythe::HashCache::kMurmur3KeyTag,
+      0xc1, 0x3f, 0x7f, 0x49, 0x59, 0xe4, 0x04, 0x0f,
+      0x13, 0xd6, 0x8d, 0xa2, 0x23, 0x62, 0xcc, 0xec};
+  kythe::HashCache::Hash hash_actual;
+  stack.HashTop(kythe::HashCache::Algorithm::kMurmur3, &hash_actual);
+  for (size_t i = 0; i < sizeof(hash_actual); ++i) {
+    EXPECT_EQ(hash_expected[i], hash_actual[i]) << "byte " << i;
+  }
+  stack.Pop();
+  EXPECT_TRUE(stack.empty());
+}
+
 TEST(KytheIndexerUnitTest, BufferStackMergeFailures) {
   kythe::BufferStack stack;
   google::protobuf::string actual;
@@ -456,6 +483,167 @@ TEST(KytheIndexerUnitTest, PushFilePopFileTracking) {
   ASSERT_EQ("main.cc", Observer.getAllPushedFiles()[0]);
 }
 
+TEST(KytheIndexerUnitTest, IncrementalKeySeedMissesOnChangedOptions) {
+  const char* temp_dir = std::getenv("TEST_TMPDIR");
+  IncrementalStore store(temp_dir != nullptr ? temp_dir : "/tmp");
+  proto::CompilationUnit unit;
+  unit.add_argument("-std=c++17");
+  unit.add_argument("main.cc");
+  proto::VName claim;
+  claim.set_path("main.cc");
+  auto KeyFor = [&](const IndexerOptions& options) {
+    IncrementalKeyChain chain(IncrementalKeySeed(unit, options));
+    chain.Enter("digest");
+    return chain.Key(claim);
+  };
+  IndexerOptions options;
+  const std::string key = KeyFor(options);
+  ASSERT_TRUE(store.Write(key, "block"));
+  std::string block;
+  EXPECT_TRUE(store.Read(key, &block));
+  EXPECT_EQ(key, KeyFor(options));
+
+  IndexerOptions changed = options;
+  changed.DataflowEdges = EmitDataflowEdges::Yes;
+  EXPECT_FALSE(store.Read(KeyFor(changed), &block));
+  changed = options;
+  changed.UsrByteSize = 4;
+  EXPECT_FALSE(store.Read(KeyFor(changed), &block));
+  changed = options;
+  changed.TemplateInstanceExcludePathPatterns =
+      std::make_shared<const RegexSet>(RegexSet::Build({"gen/.*"}).value());
+  EXPECT_FALSE(store.Read(KeyFor(changed), &block));
+  EXPECT_EQ(1, store.hits());
+  EXPECT_EQ(3, store.misses());
+}
+
+/// \brief Indexes a unit made of `files`, the first of which is its main
+/// file, in /src with `options` and `cache` (which may be null).
+std::string IndexTestUnit(
+    const std::vector<std::pair<std::string, std::string>>& files,
+    IndexerOptions options, HashCache* cache = nullptr) {
+  proto::CompilationUnit unit;
+  unit.set_working_directory("/src");
+  unit.add_argument("clang++");
+  unit.add_argument("-c");
+  unit.add_argument(files[0].first);
+  unit.add_source_file(files[0].first);
+  std::vector<proto::FileData> file_data;
+  for (const auto& [path, content] : files) {
+    file_data.emplace_back();
+    file_data.back().mutable_info()->set_path(path);
+    // Any string that changes along with the content serves as its digest.
+    file_data.back().mutable_info()->set_digest(content);
+    file_data.back().set_content(content);
+    auto* input = unit.add_required_input();
+    input->mutable_v_name()->set_path(path);
+    *input->mutable_info() = file_data.back().info();
+  }
+  options.EffectiveWorkingDirectory = "/src";
+  StaticClaimClient client;
+  client.set_process_unknown_status(true);
+  NullOutputStream output;
+  MetadataSupports meta_supports;
+  LibrarySupports no_supports;
+  return IndexCompilationUnit(
+      unit, file_data, client, cache, output, options, &meta_supports,
+      &no_supports, [](IndexerASTVisitor* visitor) {
+        return IndexerWorklist::CreateDefaultWorklist(visitor);
+      });
+}
+
+/// \brief Indexes a unit whose main file includes a.h and then b.h, where
+/// a.h only forward-declares the type that b.h defines, with `store`.
+std::string IndexLaterHeaderUnit(const std::string& b_content,
+                                 IncrementalStore* store) {
+  IndexerOptions options;
+  options.IncrementalBlocks = store;
+  return IndexTestUnit(
+      {{"main.cc", "#include \"a.h\"\n#include \"b.h\"\n"},
+       {"a.h", "struct S;\nS* p;\n"},
+       {"b.h", b_content}},
+      options);
+}
+
+TEST(KytheIndexerUnitTest, IncrementalBlocksMissWhenOnlyALaterHeaderChanges) {
+  const char* temp_dir = std::getenv("TEST_TMPDIR");
+  std::string directory =
+      absl::StrCat(temp_dir != nullptr ? temp_dir : "/tmp", "/blocks.XXXXXX");
+  ASSERT_NE(nullptr, ::mkdtemp(&directory[0]));
+  IncrementalStore store(directory);
+  ASSERT_EQ("", IndexLaterHeaderUnit("struct S { int x; };\n", &store));
+  EXPECT_EQ(0, store.hits());
+  const uint64_t blocks = store.misses();
+  ASSERT_LT(0, blocks);
+
+  // Nothing changed, so every block is replayed.
+  ASSERT_EQ("", IndexLaterHeaderUnit("struct S { int x; };\n", &store));
+  EXPECT_EQ(blocks, store.hits());
+
+  // a.h's declarations refer to S, which b.h completes after a.h was left,
+  // so a.h's block must not be replayed either.
+  ASSERT_EQ("", IndexLaterHeaderUnit("struct S { long x; };\n", &store));
+  EXPECT_EQ(blocks, store.hits());
+  EXPECT_EQ(2 * blocks, store.misses());
+}
+
+/// \brief A `HashCache` that keeps its hashes in memory and counts the
+/// lookups that find one.
+class CountingHashCache : public HashCache {
+ public:
+  void RegisterHash(const Hash& hash) override {
+    hashes_.emplace(reinterpret_cast<const char*>(hash), kHashSize);
+  }
+  bool SawHash(const Hash& hash) override {
+    if (hashes_.count(std::string(reinterpret_cast<const char*>(hash),
+                                  kHashSize)) == 0) {
+      return false;
+    }
+    ++hits_;
+    return true;
+  }
+  size_t hits() const { return hits_; }
+
+ private:
+  std::set<std::string> hashes_;
+  size_t hits_ = 0;
+};
+
+TEST(KytheIndexerUnitTest, GroupKeysHitAcrossMainFiles) {
+  const std::string header = "int shared();\nstruct Complete { int x; };\n";
+  IndexerOptions options;
+  options.ProbeGroupKeys = true;
+  CountingHashCache cache;
+  ASSERT_EQ("", IndexTestUnit({{"a.cc", "#include \"common.h\"\nint a;\n"},
+                               {"common.h", header}},
+                              options, &cache));
+  EXPECT_EQ(0, cache.hits());
+
+  // Another main file that includes the header the same way finds its
+  // groups.
+  ASSERT_EQ("", IndexTestUnit({{"b.cc", "#include \"common.h\"\nint b;\n"},
+                               {"common.h", header}},
+                              options, &cache));
+  const size_t hits = cache.hits();
+  EXPECT_LT(0, hits);
+
+  // Macros defined before the #include could change the header.
+  ASSERT_EQ("",
+            IndexTestUnit({{"c.cc", "#define X 1\n#include \"common.h\"\n"},
+                           {"common.h", header}},
+                          options, &cache));
+  EXPECT_EQ(hits, cache.hits());
+
+  // A header that leaves a tag for a later file to complete has no keys.
+  for (const char* main_file : {"d.cc", "e.cc"}) {
+    ASSERT_EQ("", IndexTestUnit({{main_file, "#include \"fwd.h\"\n"
+                                             "struct S { int x; };\n"},
+                                 {"fwd.h", "struct S;\nS* p;\n"}},
+                                options, &cache));
+  }
+  EXPECT_EQ(hits, cache.hits());
+}
+
 }  // anonymous namespace
 }  // namespace kythe
 
@@ -19,6 +19,7 @@
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 #include "kythe/cxx/indexer/cxx/proto_conversions.h"
 #include "llvm/Support/Errc.h"
 #include "llvm/Support/FileSystem.h"
@@ -56,21 +57,30 @@ std::string FixupPath(llvm::StringRef path, llvm::sys::path::Style style) {
 
 IndexVFS::IndexVFS(const std::string& working_directory,
                    const std::vector<proto::FileData>& virtual_files,
+                   const std::vector<proto::FileData>& shared_files,
                    const std::vector<llvm::StringRef>& virtual_dirs,
-                   llvm::sys::path::Style style)
-    : virtual_files_(virtual_files),
-      working_directory_(FixupPath(working_directory, style)) {
+                   llvm::sys::path::Style style,
+                   FileContentReader read_content)
+    : working_directory_(FixupPath(working_directory, style)),
+      read_content_(std::move(read_content)) {
   if (!llvm::sys::path::is_absolute(working_directory_,
                                     llvm::sys::path::Style::posix)) {
     absl::FPrintF(stderr, "warning: working directory %s is not absolute\n",
                   working_directory_);
   }
-  for (const auto& data : virtual_files_) {
-    std::string path = FixupPath(ToStringRef(data.info().path()), style);
-    if (auto* record = FileRecordForPath(path, BehaviorOnMissing::kCreateFile,
-                                         data.content().size())) {
-      record->data =
-          llvm::StringRef(data.content().data(), data.content().size());
+  for (const auto* files : {&shared_files, &virtual_files}) {
+    for (const auto& data : *files) {
+      std::string path = FixupPath(ToStringRef(data.info().path()), style);
+      if (auto* record = FileRecordForPath(
+              path, BehaviorOnMissing::kCreateFile, data.content().size())) {
+        record->data =
+            llvm::StringRef(data.content().data(), data.content().size());
+        if (read_content_ && files == &virtual_files &&
+            data.content().empty() && !data.info().digest().empty()) {
+          // The record's size is fixed up once the content is read.
+          record->unread_digest = data.info().digest();
+        }
+      }
     }
   }
   for (llvm::StringRef dir : virtual_dirs) {
@@ -87,9 +97,37 @@ IndexVFS::~IndexVFS() {
   }
 }
 
+bool IndexVFS::ReadContent(FileRecord* record) {
+  if (record->unread_digest.empty()) {
+    return true;
+  }
+  auto content = read_content_(record->unread_digest);
+  if (!content.ok()) {
+    absl::FPrintF(stderr, "warning: couldn't read %s: %s\n",
+                  record->status.getName().str(),
+                  content.status().ToString());
+    return false;
+  }
+  record->content = *std::move(content);
+  record->data =
+      llvm::StringRef(record->content->data(), record->content->size());
+  // Clang compares the size it was told by `status` with the size of the
+  // buffer it gets, so the size has to be right before either is returned.
+  const llvm::vfs::Status& old = record->status;
+  record->status = llvm::vfs::Status(
+      old.getName(), old.getUniqueID(), old.getLastModificationTime(),
+      old.getUser(), old.getGroup(), record->data.size(), old.getType(),
+      old.getPermissions());
+  record->unread_digest.clear();
+  return true;
+}
+
 llvm::ErrorOr<llvm::vfs::Status> IndexVFS::status(const llvm::Twine& path) {
-  if (const auto* record =
+  if (auto* record =
           FileRecordForPath(path.str(), BehaviorOnMissing::kReturnError, 0)) {
+    if (!ReadContent(record)) {
+      return make_error_code(llvm::errc::io_error);
+    }
     return record->status;
   }
   return make_error_code(llvm::errc::no_such_file_or_directory);
@@ -113,6 +151,9 @@ llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>> IndexVFS::openFileForRead(
   if (FileRecord* record =
           FileRecordForPath(path.str(), BehaviorOnMissing::kReturnError, 0)) {
     if (record->status.getType() == llvm::sys::fs::file_type::regular_file) {
+      if (!ReadContent(record)) {
+        return make_error_code(llvm::errc::io_error);
+      }
       return absl::make_unique<File>(record);
     }
   }
@@ -211,6 +252,17 @@ IndexVFS::FileRecord* IndexVFS::FileRecordForPath(llvm::StringRef path,
                                                   BehaviorOnMissing behavior,
                                                   size_t size) {
   using namespace llvm::sys::path;
+  if (behavior != BehaviorOnMissing::kReturnError) {
+    // New records may answer lookups that previously missed.
+    lookup_cache_.clear();
+  } else {
+    auto found =
+        lookup_cache_.find(absl::string_view(path.data(), path.size()));
+    if (found != lookup_cache_.end()) {
+      return found->second;
+    }
+  }
+  const llvm::StringRef lookup_path = path;
   std::vector<llvm::StringRef> path_components;
   int skip_count = 0;
 
@@ -254,6 +306,9 @@ IndexVFS::FileRecord* IndexVFS::FileRecordForPath(llvm::StringRef path,
         is_last ? eventual_type : llvm::sys::fs::file_type::directory_file,
         is_last ? eventual_size : 0);
   }
+  if (behavior == BehaviorOnMissing::kReturnError) {
+    lookup_cache_.emplace(std::string(lookup_path), current_record);
+  }
   return current_record;
 }
 
@@ -286,20 +341,21 @@ IndexVFS::FileRecord* IndexVFS::AllocOrReturnFileRecord(
     FileRecord* parent, bool create_if_missing, llvm::StringRef label,
     llvm::sys::fs::file_type type, size_t size) {
   assert(parent != nullptr);
-  for (auto& record : parent->children) {
-    if (record->label == label) {
-      if (create_if_missing && (record->status.getSize() != size ||
-                                record->status.getType() != type)) {
-        absl::FPrintF(
-            stderr,
-            "Warning: path %s/%s: defined inconsistently (%s:%d/%s:%d)\n",
-            parent->status.getName().str(), label.str(), NameOfFileType(type),
-            size, NameOfFileType(record->status.getType()),
-            record->status.getSize());
-        return nullptr;
-      }
-      return record;
+  auto found =
+      parent->children.find(absl::string_view(label.data(), label.size()));
+  if (found != parent->children.end()) {
+    FileRecord* record = found->second;
+    if (create_if_missing && (record->status.getSize() != size ||
+                              record->status.getType() != type)) {
+      absl::FPrintF(
+          stderr,
+          "Warning: path %s/%s: defined inconsistently (%s:%d/%s:%d)\n",
+          parent->status.getName().str(), label.str(), NameOfFileType(type),
+          size, NameOfFileType(record->status.getType()),
+          record->status.getSize());
+      return nullptr;
     }
+    return record;
   }
   if (!create_if_missing) {
     return nullptr;
@@ -311,7 +367,7 @@ IndexVFS::FileRecord* IndexVFS::AllocOrReturnFileRecord(
                         llvm::sys::TimePoint<>(), 0, 0, size, type,
                         llvm::sys::fs::all_read),
       false, std::string(label)};
-  parent->children.push_back(new_record);
+  parent->children.emplace(std::string(label), new_record);
   uid_to_record_map_[PairFromUid(new_record->status.getUniqueID())] =
       new_record;
   return new_record;
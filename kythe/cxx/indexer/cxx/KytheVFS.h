@@ -17,8 +17,10 @@
 #ifndef KYTHE_CXX_COMMON_INDEXING_KYTHE_VFS_H_
 #define KYTHE_CXX_COMMON_INDEXING_KYTHE_VFS_H_
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/types/optional.h"
 #include "clang/Basic/FileManager.h"
+#include "kythe/cxx/common/file_content_cache.h"
 #include "kythe/proto/analysis.pb.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/VirtualFileSystem.h"
@@ -33,14 +35,24 @@ namespace kythe {
 class IndexVFS : public llvm::vfs::FileSystem {
  public:
   /// \param working_directory The absolute path to the working directory.
-  /// \param virtual_files Files to map.
+  /// \param virtual_files Files to map. These must outlive the VFS: buffers
+  /// handed to clang alias their content rather than copying it.
+  /// \param shared_files More files to map, such as the builtin headers,
+  /// that are shared between units rather than copied into each one's
+  /// `virtual_files`. These must also outlive the VFS and must not have the
+  /// same paths as any of `virtual_files`.
   /// \param virtual_dirs Directories to map.
   /// \param style Style used to parse incoming paths. Paths are normalized
   /// to POSIX-style.
+  /// \param read_content If set, each of `virtual_files` with a digest but
+  /// no content is read through this the first time clang asks about it,
+  /// so files that clang never opens are never read.
   IndexVFS(const std::string& working_directory,
            const std::vector<proto::FileData>& virtual_files,
+           const std::vector<proto::FileData>& shared_files,
            const std::vector<llvm::StringRef>& virtual_dirs,
-           llvm::sys::path::Style style);
+           llvm::sys::path::Style style,
+           FileContentReader read_content = nullptr);
   /// \return nullopt if `awd` is not absolute or its style could not be
   /// detected; otherwise, the style of `awd`.
   static absl::optional<llvm::sys::path::Style>
@@ -75,6 +87,8 @@ class IndexVFS : public llvm::vfs::FileSystem {
   }
   std::error_code setCurrentWorkingDirectory(const llvm::Twine& Path) override {
     working_directory_ = Path.str();
+    // Relative paths may resolve differently now.
+    lookup_cache_.clear();
     return std::error_code();
   }
 
@@ -89,10 +103,15 @@ class IndexVFS : public llvm::vfs::FileSystem {
     std::string label;
     /// This file's VName, if set.
     proto::VName vname;
-    /// This directory's children.
-    std::vector<FileRecord*> children;
+    /// This directory's children, by label.
+    absl::flat_hash_map<std::string, FileRecord*> children;
     /// This file's content.
     llvm::StringRef data;
+    /// If nonempty, the digest of this file's content, which hasn't been
+    /// read yet.
+    std::string unread_digest;
+    /// This file's content, if it was read through `read_content_`.
+    std::shared_ptr<const std::string> content;
   };
 
   /// \brief A llvm::vfs::File that wraps a `FileRecord`.
@@ -116,6 +135,11 @@ class IndexVFS : public llvm::vfs::FileSystem {
     std::string name_;
   };
 
+  /// \brief Reads the content of `record` if it hasn't been read yet and
+  /// sets its size to match.
+  /// \return false if the content couldn't be read.
+  bool ReadContent(FileRecord* record);
+
   /// \brief Controls what happens when a missing path node is encountered.
   enum class BehaviorOnMissing {
     kCreateFile,       ///< Create intermediate directories and a final file.
@@ -149,15 +173,22 @@ class IndexVFS : public llvm::vfs::FileSystem {
                                       llvm::sys::fs::file_type type,
                                       size_t size);
 
-  /// The virtual files that were included in the index.
-  const std::vector<proto::FileData>& virtual_files_;
   /// The working directory. Must be absolute.
   std::string working_directory_;
+  /// Reads the content of files that were mapped without it (or null).
+  FileContentReader read_content_;
   /// Maps root names to root nodes. For indexes captured from Unix
   /// environments, there will be only one root name (the empty string).
-  std::map<std::string, FileRecord*> root_name_to_root_map_;
+  absl::flat_hash_map<std::string, FileRecord*> root_name_to_root_map_;
   /// Maps unique IDs to file records.
-  std::map<std::pair<uint64_t, uint64_t>, FileRecord*> uid_to_record_map_;
+  absl::flat_hash_map<std::pair<uint64_t, uint64_t>, FileRecord*>
+      uid_to_record_map_;
+  /// Maps paths exactly as they were looked up to their records, or to null
+  /// if they don't exist. Most lookups clang makes are misses while probing
+  /// header search paths, and it probes the same paths repeatedly. (The
+  /// unit's file contexts record which context an include leads to, not
+  /// which file, so the probes themselves can't be skipped.)
+  absl::flat_hash_map<std::string, FileRecord*> lookup_cache_;
 };
 
 }  // namespace kythe
@@ -35,8 +35,11 @@
 #include "ProtoLibrarySupport.h"
 
 #include <map>
+#include <utility>
+#include <vector>
 
 #include "absl/flags/flag.h"
+#include "absl/memory/memory.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/ExprCXX.h"
 #include "glog/logging.h"
@@ -45,6 +48,7 @@
 #include "google/protobuf/message.h"
 #include "kythe/cxx/indexer/cxx/IndexerASTHooks.h"
 #include "kythe/cxx/indexer/cxx/proto_conversions.h"
+#include "llvm/ADT/DenseMap.h"
 
 ABSL_FLAG(std::string, parseprotohelper_full_name,
           "proto2::contrib::parse_proto::internal::ParseProtoHelper",
@@ -313,27 +317,50 @@ const clang::RecordDecl* LookupRecordDecl(const clang::ASTContext& ASTContext,
   return clang::dyn_cast<clang::RecordDecl>(Context);
 }
 
+// A field found in a text proto literal.
+struct LiteralField {
+  const clang::CXXMethodDecl* AccessorDecl;
+  clang::SourceRange Range;
+};
+
+// What GoogleProtoLibrarySupport remembers about a unit.
+class ProtoUnitState : public LibrarySupport::UnitState {
+ public:
+  explicit ProtoUnitState(const clang::Decl* ParseProtoHelperDecl)
+      : ParseProtoHelperDecl(ParseProtoHelperDecl) {}
+
+  // The canonical ParseProtoHelper decl.
+  const clang::Decl* const ParseProtoHelperDecl;
+  // The fields found in each (message, literal) pair. Template instantiations
+  // share their literals, so the same pair may be parsed many times.
+  llvm::DenseMap<
+      std::pair<const clang::CXXRecordDecl*, const clang::StringLiteral*>,
+      std::vector<LiteralField>>
+      ParsedLiterals;
+};
+
 }  // namespace
 
-bool GoogleProtoLibrarySupport::CompilationUnitHasParseProtoHelperDecl(
-    const clang::ASTContext& ASTContext, const clang::CallExpr& Expr) {
-  if (!Initialized) {
-    Initialized = true;
-    // Find the root namespace.
-    const clang::DeclContext* const TranslationUnitContext =
-        Expr.getCalleeDecl()->getTranslationUnitDecl();
-    // Look for ParseProtoHelper.
-    ParseProtoHelperDecl =
-        LookupRecordDecl(ASTContext, TranslationUnitContext,
-                         absl::GetFlag(FLAGS_parseprotohelper_full_name));
-  }
-  return ParseProtoHelperDecl != nullptr;
+bool GoogleProtoLibrarySupport::AppliesTo(
+    const clang::ASTContext& ASTContext) const {
+  return LookupRecordDecl(ASTContext, ASTContext.getTranslationUnitDecl(),
+                          absl::GetFlag(FLAGS_parseprotohelper_full_name)) !=
+         nullptr;
+}
+
+std::unique_ptr<LibrarySupport::UnitState>
+GoogleProtoLibrarySupport::CreateUnitState(
+    const clang::ASTContext& ASTContext) const {
+  return absl::make_unique<ProtoUnitState>(
+      LookupRecordDecl(ASTContext, ASTContext.getTranslationUnitDecl(),
+                       absl::GetFlag(FLAGS_parseprotohelper_full_name)));
 }
 
 void GoogleProtoLibrarySupport::InspectCallExpr(
     IndexerASTVisitor& V, const clang::CallExpr* CallExpr,
     const GraphObserver::Range& Range, GraphObserver::NodeId& CalleeId) {
-  if (!CompilationUnitHasParseProtoHelperDecl(V.getASTContext(), *CallExpr)) {
+  auto* State = static_cast<ProtoUnitState*>(V.getSupportState(this));
+  if (State == nullptr || State->ParseProtoHelperDecl == nullptr) {
     // Return early if there is no ParseProtoHelper in the compilation unit.
     return;
   }
@@ -346,7 +373,8 @@ void GoogleProtoLibrarySupport::InspectCallExpr(
     return;
   }
 
-  if (Expr->getRecordDecl()->getCanonicalDecl() != ParseProtoHelperDecl) {
+  if (Expr->getRecordDecl()->getCanonicalDecl() !=
+      State->ParseProtoHelperDecl) {
     return;
   }
 
@@ -413,18 +441,27 @@ void GoogleProtoLibrarySupport::InspectCallExpr(
     return;
   }
 
-  const auto Callback = [&V](const clang::CXXMethodDecl& AccessorDecl,
-                             const clang::SourceRange& Range) {
-    if (const auto RCC = V.ExplicitRangeInCurrentContext(Range)) {
-      const auto NodeId = V.BuildNodeIdForDecl(&AccessorDecl);
+  const auto* MsgDecl = Expr->getType()->getAsCXXRecordDecl();
+  auto Inserted = State->ParsedLiterals.try_emplace({MsgDecl, Literal});
+  std::vector<LiteralField>& Fields = Inserted.first->second;
+  if (Inserted.second) {
+    // The fields found before any parse error are still referenced.
+    const auto Callback = [&Fields](const clang::CXXMethodDecl& AccessorDecl,
+                                    const clang::SourceRange& Range) {
+      Fields.push_back({&AccessorDecl, Range});
+    };
+    ParseTextProtoHandler::Parse(Callback, Literal, *MsgDecl,
+                                 V.getASTContext(),
+                                 *V.getGraphObserver().getLangOptions());
+  }
+  for (const auto& Field : Fields) {
+    if (const auto RCC = V.ExplicitRangeInCurrentContext(Field.Range)) {
+      const auto NodeId = V.BuildNodeIdForDecl(Field.AccessorDecl);
       V.getGraphObserver().recordDeclUseLocation(
           *RCC, NodeId, GraphObserver::Claimability::Unclaimable,
           V.IsImplicit(*RCC));
     }
-  };
-  ParseTextProtoHandler::Parse(
-      Callback, Literal, *Expr->getType()->getAsCXXRecordDecl(),
-      V.getASTContext(), *V.getGraphObserver().getLangOptions());
+  }
 }
 
 }  // namespace kythe
@@ -28,18 +28,17 @@ class GoogleProtoLibrarySupport : public LibrarySupport {
  public:
   GoogleProtoLibrarySupport() {}
 
+  /// \brief Returns true if the unit declares ParseProtoHelper.
+  bool AppliesTo(const clang::ASTContext& Context) const override;
+
+  /// \brief Finds the unit's ParseProtoHelper and makes room to remember
+  /// the literals it parses.
+  std::unique_ptr<UnitState> CreateUnitState(
+      const clang::ASTContext& Context) const override;
+
   void InspectCallExpr(IndexerASTVisitor& V, const clang::CallExpr* CallExpr,
                        const GraphObserver::Range& Range,
                        GraphObserver::NodeId& CalleeId) override;
-
- private:
-  // Lazily initializes ParseProtoHelperDecl, and returns true if
-  // ParseProtoHelper is available.
-  bool CompilationUnitHasParseProtoHelperDecl(
-      const clang::ASTContext& ASTContext, const clang::CallExpr& Expr);
-
-  bool Initialized = false;
-  const clang::Decl* ParseProtoHelperDecl = nullptr;
 };
 
 }  // namespace kythe
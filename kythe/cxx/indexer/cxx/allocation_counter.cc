@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/allocation_counter.h"
+
+#if defined(KYTHE_COUNT_ALLOCATIONS)
+#include <malloc.h>
+#include <stdlib.h>
+
+#include <cstddef>
+#include <new>
+#endif
+
+namespace kythe {
+namespace {
+/// The calling thread's counts. Constant-initialized so that counting needs
+/// no guard, even while the thread is starting or exiting.
+thread_local AllocationCounts thread_counts;
+}  // anonymous namespace
+
+AllocationCounts ThreadAllocationCounts() { return thread_counts; }
+
+#if defined(KYTHE_COUNT_ALLOCATIONS)
+namespace {
+/// \brief Allocates `size` bytes aligned to `alignment` (or to the default
+/// alignment if zero) and counts them, calling the new handler until the
+/// allocation succeeds or there is none.
+void* CountedAllocate(size_t size, size_t alignment) {
+  if (size == 0) {
+    size = 1;
+  }
+  for (;;) {
+    void* block = nullptr;
+    if (alignment == 0) {
+      block = ::malloc(size);
+    } else if (::posix_memalign(&block, alignment, size) != 0) {
+      block = nullptr;
+    }
+    if (block != nullptr) {
+      thread_counts.allocated += ::malloc_usable_size(block);
+      return block;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      return nullptr;
+    }
+    handler();
+  }
+}
+
+void* CountedAllocateOrThrow(size_t size, size_t alignment) {
+  void* block = CountedAllocate(size, alignment);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+void CountedFree(void* block) {
+  if (block != nullptr) {
+    thread_counts.freed += ::malloc_usable_size(block);
+    ::free(block);
+  }
+}
+}  // anonymous namespace
+#endif
+
+}  // namespace kythe
+
+#if defined(KYTHE_COUNT_ALLOCATIONS)
+// Global replacements for every allocating and deallocating form of operator
+// new and delete. The sized and aligned forms of delete all free the same way.
+void* operator new(size_t size) {
+  return kythe::CountedAllocateOrThrow(size, 0);
+}
+void* operator new[](size_t size) {
+  return kythe::CountedAllocateOrThrow(size, 0);
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return kythe::CountedAllocate(size, 0);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return kythe::CountedAllocate(size, 0);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+  return kythe::CountedAllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return kythe::CountedAllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return kythe::CountedAllocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return kythe::CountedAllocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* block) noexcept { kythe::CountedFree(block); }
+void operator delete[](void* block) noexcept { kythe::CountedFree(block); }
+void operator delete(void* block, size_t) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete[](void* block, size_t) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete(void* block, const std::nothrow_t&) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete[](void* block, const std::nothrow_t&) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete(void* block, std::align_val_t) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete[](void* block, std::align_val_t) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete(void* block, size_t, std::align_val_t) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete[](void* block, size_t, std::align_val_t) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete(void* block, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  kythe::CountedFree(block);
+}
+void operator delete[](void* block, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  kythe::CountedFree(block);
+}
+#endif
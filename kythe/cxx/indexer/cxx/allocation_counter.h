@@ -0,0 +1,58 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_ALLOCATION_COUNTER_H_
+#define KYTHE_CXX_INDEXER_CXX_ALLOCATION_COUNTER_H_
+
+#include <cstdint>
+
+namespace kythe {
+
+/// \brief Whether `operator new` and `operator delete` count the bytes each
+/// thread allocates and frees. Build with
+/// `--copt=-DKYTHE_COUNT_ALLOCATIONS` to turn counting on; otherwise the
+/// default operators are used and the counts stay at zero. Builds that link
+/// tcmalloc or jemalloc, which replace the operators themselves, should leave
+/// counting off.
+#if defined(KYTHE_COUNT_ALLOCATIONS)
+inline constexpr bool kAllocationCountersEnabled = true;
+#else
+inline constexpr bool kAllocationCountersEnabled = false;
+#endif
+
+/// \brief Heap bytes allocated and freed by one thread.
+struct AllocationCounts {
+  /// The usable size of every block the thread allocated.
+  int64_t allocated = 0;
+  /// The usable size of every block the thread freed, including blocks
+  /// other threads allocated.
+  int64_t freed = 0;
+
+  /// \return the bytes still held (or negative if more was freed).
+  int64_t retained() const { return allocated - freed; }
+
+  AllocationCounts operator-(const AllocationCounts& earlier) const {
+    return {allocated - earlier.allocated, freed - earlier.freed};
+  }
+};
+
+/// \return the bytes the calling thread has allocated and freed through
+/// `operator new` and `operator delete` since it started.
+AllocationCounts ThreadAllocationCounts();
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_ALLOCATION_COUNTER_H_
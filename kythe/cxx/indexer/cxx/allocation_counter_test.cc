@@ -0,0 +1,54 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/allocation_counter.h"
+
+#include <new>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(AllocationCounterTest, CountsThisThreadsAllocations) {
+  AllocationCounts before = ThreadAllocationCounts();
+  // Call the operators directly, since new-expressions may be elided.
+  void* kept = ::operator new(1000);
+  ::operator delete(::operator new(500));
+  AllocationCounts delta = ThreadAllocationCounts() - before;
+  ::operator delete(kept);
+  if (!kAllocationCountersEnabled) {
+    EXPECT_EQ(0, delta.allocated);
+    EXPECT_EQ(0, delta.freed);
+    return;
+  }
+  EXPECT_GE(delta.allocated, 1500);
+  EXPECT_GE(delta.freed, 500);
+  EXPECT_GE(delta.retained(), 1000);
+}
+
+TEST(AllocationCounterTest, IgnoresOtherThreads) {
+  AllocationCounts before = ThreadAllocationCounts();
+  void* block = nullptr;
+  std::thread other([&block] { block = ::operator new(1 << 20); });
+  other.join();
+  EXPECT_LT((ThreadAllocationCounts() - before).allocated, 1 << 20);
+  ::operator delete(block);
+}
+
+}  // namespace
+}  // namespace kythe
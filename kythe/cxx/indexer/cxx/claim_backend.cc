@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/claim_backend.h"
+
+#include <libmemcached-1.0/memcached.h>
+
+#include "absl/strings/str_format.h"
+
+namespace kythe {
+
+void InMemoryClaimBackend::AddKeys(
+    absl::Span<const absl::string_view> keys,
+    absl::Span<const absl::string_view> values, std::vector<bool>* added) {
+  ++round_trips_;
+  added->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    (*added)[i] = keys_.emplace(keys[i]).second;
+  }
+}
+
+MemcachedClaimBackend::~MemcachedClaimBackend() {
+  if (cache_) {
+    memcached_free(cache_);
+    cache_ = nullptr;
+  }
+}
+
+bool MemcachedClaimBackend::Open(const std::string& spec) {
+  if (cache_) {
+    memcached_free(cache_);
+    cache_ = nullptr;
+  }
+  std::string spec_amend = spec;
+  spec_amend.append(" --BINARY-PROTOCOL");
+  cache_ = memcached(spec_amend.c_str(), spec_amend.size());
+  if (cache_ != nullptr) {
+    memcached_return_t remote_version = memcached_version(cache_);
+    return memcached_success(remote_version);
+  }
+  return false;
+}
+
+void MemcachedClaimBackend::AddKeys(
+    absl::Span<const absl::string_view> keys,
+    absl::Span<const absl::string_view> values, std::vector<bool>* added) {
+  // Fail open.
+  added->assign(keys.size(), true);
+  if (!cache_ || keys.empty()) {
+    return;
+  }
+  if (keys.size() > 1) {
+    key_data_.clear();
+    key_lengths_.clear();
+    for (const auto& key : keys) {
+      key_data_.push_back(key.data());
+      key_lengths_.push_back(key.size());
+    }
+    memcached_return_t get_result = memcached_mget(
+        cache_, key_data_.data(), key_lengths_.data(), key_data_.size());
+    if (memcached_success(get_result)) {
+      memcached_result_st* result;
+      memcached_return_t fetch_result;
+      while ((result = memcached_fetch_result(cache_, nullptr,
+                                              &fetch_result)) != nullptr) {
+        absl::string_view found(memcached_result_key_value(result),
+                                memcached_result_key_length(result));
+        // Batches are small, and the same key may appear more than once.
+        for (size_t i = 0; i < keys.size(); ++i) {
+          if (keys[i] == found) {
+            (*added)[i] = false;
+          }
+        }
+        memcached_result_free(result);
+      }
+    } else {
+      absl::FPrintF(stderr, "memcached mget failed: %s\n",
+                    memcached_strerror(cache_, get_result));
+    }
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (!(*added)[i]) {
+      continue;
+    }
+    memcached_return_t add_result =
+        memcached_add(cache_, keys[i].data(), keys[i].size(),
+                      values[i].data(), values[i].size(), 0, 0);
+    if (add_result == MEMCACHED_DATA_EXISTS) {
+      (*added)[i] = false;
+    } else if (!memcached_success(add_result)) {
+      absl::FPrintF(stderr, "memcached add failed: %s\n",
+                    memcached_strerror(cache_, add_result));
+    }
+  }
+}
+
+}  // namespace kythe
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_CLAIM_BACKEND_H_
+#define KYTHE_CXX_INDEXER_CXX_CLAIM_BACKEND_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+extern "C" {
+struct memcached_st;
+}
+
+namespace kythe {
+
+/// \brief A shared store of claim keys that each key can be added to once.
+///
+/// `DynamicClaimClient` turns claims into keys and asks a backend to add
+/// them; whoever adds a key first holds that claim.
+class ClaimBackend {
+ public:
+  virtual ~ClaimBackend() {}
+  /// \brief Tries to add each of `keys` with the matching one of `values`.
+  /// \param added Set to one value per key: false if the key was already
+  /// present, true otherwise. Backends fail open, so a key whose add failed
+  /// for any other reason counts as added.
+  virtual void AddKeys(absl::Span<const absl::string_view> keys,
+                       absl::Span<const absl::string_view> values,
+                       std::vector<bool>* added) = 0;
+};
+
+/// \brief A `ClaimBackend` that keeps keys in memory. It is not thread-safe.
+class InMemoryClaimBackend : public ClaimBackend {
+ public:
+  void AddKeys(absl::Span<const absl::string_view> keys,
+               absl::Span<const absl::string_view> values,
+               std::vector<bool>* added) override;
+  /// \return how many `AddKeys` calls have been made.
+  size_t round_trips() const { return round_trips_; }
+
+ private:
+  absl::flat_hash_set<std::string> keys_;
+  size_t round_trips_ = 0;
+};
+
+/// \brief A `ClaimBackend` that uses a memcached server.
+class MemcachedClaimBackend : public ClaimBackend {
+ public:
+  ~MemcachedClaimBackend() override;
+  /// \brief Use a memcached instance (e.g. "--SERVER=foo:1234")
+  bool Open(const std::string& spec);
+  /// \brief First looks up all `keys` with one multi-get, then adds only
+  /// the ones that weren't found. Most claims on popular headers are lost,
+  /// so this usually takes one round trip for the whole batch.
+  void AddKeys(absl::Span<const absl::string_view> keys,
+               absl::Span<const absl::string_view> values,
+               std::vector<bool>* added) override;
+
+ private:
+  ::memcached_st* cache_ = nullptr;
+  /// Scratch space for multi-gets.
+  std::vector<const char*> key_data_;
+  std::vector<size_t> key_lengths_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_CLAIM_BACKEND_H_
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/claim_stats.h"
+
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+
+namespace kythe {
+namespace {
+/// The first field of every record, so that records can share a file with
+/// other output.
+constexpr absl::string_view kRecordTag = "claim_stats";
+}  // anonymous namespace
+
+ClaimStats& ClaimStats::operator+=(const ClaimStats& other) {
+  requested += other.requested;
+  granted += other.granted;
+  denied += other.denied;
+  overclaimed += other.overclaimed;
+  bytes += other.bytes;
+  return *this;
+}
+
+ClaimStats ClaimStats::operator-(const ClaimStats& earlier) const {
+  ClaimStats delta;
+  delta.requested = requested - earlier.requested;
+  delta.granted = granted - earlier.granted;
+  delta.denied = denied - earlier.denied;
+  delta.overclaimed = overclaimed - earlier.overclaimed;
+  delta.bytes = bytes - earlier.bytes;
+  return delta;
+}
+
+std::string ClaimStats::ToString() const {
+  return absl::StrFormat(
+      "%d requested %d granted %d denied %d overclaimed (%f redundant "
+      "fraction) %d bytes",
+      requested, granted, denied, overclaimed,
+      granted == 0 ? 0.0 : static_cast<double>(overclaimed) / granted, bytes);
+}
+
+std::string FormatClaimStatsRecord(const ClaimStatsRecord& record) {
+  const ClaimStats& stats = record.stats;
+  return absl::StrCat(kRecordTag, "\t", absl::CEscape(record.label), "\t",
+                      stats.requested, "\t", stats.granted, "\t", stats.denied,
+                      "\t", stats.overclaimed, "\t", stats.bytes);
+}
+
+absl::StatusOr<ClaimStatsRecord> ParseClaimStatsRecord(absl::string_view line) {
+  std::vector<absl::string_view> fields = absl::StrSplit(line, '\t');
+  if (fields.size() != 7 || fields[0] != kRecordTag) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("not a claim stats record: ", line));
+  }
+  ClaimStatsRecord record;
+  std::string error;
+  if (!absl::CUnescape(fields[1], &record.label, &error)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("bad claim stats label: ", error));
+  }
+  uint64_t* counts[] = {&record.stats.requested, &record.stats.granted,
+                        &record.stats.denied, &record.stats.overclaimed,
+                        &record.stats.bytes};
+  for (size_t i = 0; i < 5; ++i) {
+    if (!absl::SimpleAtoi(fields[i + 2], counts[i])) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("bad claim stats count: ", fields[i + 2]));
+    }
+  }
+  return record;
+}
+
+}  // namespace kythe
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_CLAIM_STATS_H_
+#define KYTHE_CXX_INDEXER_CXX_CLAIM_STATS_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace kythe {
+
+/// \brief Counts the outcomes of the claims made while indexing.
+struct ClaimStats {
+  /// How many claims were requested.
+  uint64_t requested = 0;
+  /// How many of those were granted (including redundant grants).
+  uint64_t granted = 0;
+  /// How many were denied because someone else held the claim.
+  uint64_t denied = 0;
+  /// How many grants were redundant: someone else already held the claim,
+  /// but it was allowed to be claimed more than once.
+  uint64_t overclaimed = 0;
+  /// How many bytes of output were emitted while these claims were made.
+  uint64_t bytes = 0;
+
+  ClaimStats& operator+=(const ClaimStats& other);
+  /// \return the claims made since `earlier` was recorded.
+  ClaimStats operator-(const ClaimStats& earlier) const;
+  /// \brief Return a summary of these statistics as a string.
+  std::string ToString() const;
+};
+
+/// \brief A `ClaimStats` for some unit (or other set of claims).
+struct ClaimStatsRecord {
+  /// What the claims were made for; usually a unit's main source file.
+  std::string label;
+  ClaimStats stats;
+};
+
+/// \brief Formats `record` as a single line (without a newline) that
+/// `ParseClaimStatsRecord` can read back.
+std::string FormatClaimStatsRecord(const ClaimStatsRecord& record);
+
+/// \brief Parses a line written by `FormatClaimStatsRecord`.
+absl::StatusOr<ClaimStatsRecord> ParseClaimStatsRecord(absl::string_view line);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_CLAIM_STATS_H_
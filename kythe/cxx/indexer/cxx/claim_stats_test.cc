@@ -0,0 +1,72 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/claim_stats.h"
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+ClaimStats MakeStats(uint64_t requested, uint64_t granted, uint64_t denied,
+                     uint64_t overclaimed, uint64_t bytes) {
+  ClaimStats stats;
+  stats.requested = requested;
+  stats.granted = granted;
+  stats.denied = denied;
+  stats.overclaimed = overclaimed;
+  stats.bytes = bytes;
+  return stats;
+}
+
+void ExpectStatsEq(const ClaimStats& expected, const ClaimStats& actual) {
+  EXPECT_EQ(expected.requested, actual.requested);
+  EXPECT_EQ(expected.granted, actual.granted);
+  EXPECT_EQ(expected.denied, actual.denied);
+  EXPECT_EQ(expected.overclaimed, actual.overclaimed);
+  EXPECT_EQ(expected.bytes, actual.bytes);
+}
+
+TEST(ClaimStatsTest, RecordsRoundTrip) {
+  ClaimStatsRecord record;
+  record.label = "path/with\ttab.cc";
+  record.stats = MakeStats(10, 7, 3, 2, 12345);
+  const std::string line = FormatClaimStatsRecord(record);
+  EXPECT_EQ(std::string::npos, line.find('\n'));
+  auto parsed = ParseClaimStatsRecord(line);
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  EXPECT_EQ(record.label, parsed->label);
+  ExpectStatsEq(record.stats, parsed->stats);
+}
+
+TEST(ClaimStatsTest, RejectsOtherLines) {
+  EXPECT_FALSE(ParseClaimStatsRecord("").ok());
+  EXPECT_FALSE(ParseClaimStatsRecord("done: foo.kzip").ok());
+  EXPECT_FALSE(ParseClaimStatsRecord("claim_stats\ta\t1\t2\t3\t4").ok());
+  EXPECT_FALSE(ParseClaimStatsRecord("claim_stats\ta\t1\t2\tx\t4\t5").ok());
+}
+
+TEST(ClaimStatsTest, AddsAndSubtracts) {
+  ClaimStats total = MakeStats(1, 1, 0, 0, 100);
+  const ClaimStats before = total;
+  total += MakeStats(4, 2, 2, 1, 50);
+  ExpectStatsEq(MakeStats(5, 3, 2, 1, 150), total);
+  ExpectStatsEq(MakeStats(4, 2, 2, 1, 50), total - before);
+}
+
+}  // namespace
+}  // namespace kythe
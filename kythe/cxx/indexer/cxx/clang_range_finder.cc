@@ -16,6 +16,7 @@
 #include "kythe/cxx/indexer/cxx/clang_range_finder.h"
 
 #include <string>
+#include <utility>
 
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclCXX.h"
@@ -87,16 +88,24 @@ SourceRange ClangRangeFinder::RangeForNameOf(
   if (decl == nullptr) {
     return SourceRange();
   }
+  auto inserted = name_ranges_.try_emplace(decl);
+  if (!inserted.second) {
+    return inserted.first->second;
+  }
+  SourceRange range;
   if (auto func = dyn_cast<clang::FunctionDecl>(decl)) {
-    return RangeForNameInfo(func->getNameInfo());
+    range = RangeForNameInfo(func->getNameInfo());
   } else if (auto alias = dyn_cast<clang::ObjCCompatibleAliasDecl>(decl)) {
-    return RangeForNameOfAlias(*alias);
+    range = RangeForNameOfAlias(*alias);
   } else if (auto method = dyn_cast<clang::ObjCMethodDecl>(decl)) {
-    return RangeForNameOfMethod(*method);
+    range = RangeForNameOfMethod(*method);
   } else if (auto ns = dyn_cast<clang::NamespaceDecl>(decl)) {
-    return RangeForNamespace(*ns);
+    range = RangeForNamespace(*ns);
+  } else {
+    range = NormalizeRange(decl->getLocation());
   }
-  return NormalizeRange(decl->getLocation());
+  inserted.first->second = range;
+  return range;
 }
 
 SourceRange ClangRangeFinder::RangeForNameInfo(
@@ -167,16 +176,26 @@ SourceRange ClangRangeFinder::RangeForNamespace(
 }
 
 SourceRange ClangRangeFinder::NormalizeRange(SourceLocation start) const {
-  return ToCharRange(GetFileRange(source_manager(), start));
+  return NormalizeRange(SourceRange(start, start));
 }
 
 SourceRange ClangRangeFinder::NormalizeRange(SourceLocation start,
                                              SourceLocation end) const {
-  return ToCharRange(GetFileRange(source_manager(), SourceRange(start, end)));
+  return NormalizeRange(SourceRange(start, end));
 }
 
 SourceRange ClangRangeFinder::NormalizeRange(SourceRange range) const {
-  return ToCharRange(GetFileRange(source_manager(), range));
+  auto inserted = normalized_ranges_.try_emplace(std::make_pair(
+      range.getBegin().getRawEncoding(), range.getEnd().getRawEncoding()));
+  if (inserted.second) {
+    inserted.first->second =
+        ToCharRange(GetFileRange(source_manager(), range));
+  }
+  return inserted.first->second;
+}
+
+CharSourceRange ClangRangeFinder::FileRange(SourceRange range) const {
+  return GetFileRange(source_manager(), range);
 }
 
 SourceRange ClangRangeFinder::ToCharRange(clang::CharSourceRange range) const {
@@ -24,6 +24,7 @@
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/SourceManager.h"
 #include "glog/logging.h"
+#include "llvm/ADT/DenseMap.h"
 
 namespace kythe {
 
@@ -31,6 +32,11 @@ namespace kythe {
 ///
 /// All valid ranges correspond to a concrete character-based location in a file
 /// which is most suitable location to attribute to that entity.
+///
+/// The same locations tend to be normalized many times (for redeclarations,
+/// references and macro expansions), so a finder remembers the ranges it has
+/// found. Keep one for the lifetime of the translation unit to reuse them.
+/// Finders are not safe to share between threads.
 class ClangRangeFinder {
  public:
   /// \brief Constructs a new ClangRangeFinder using the provided SourceManager
@@ -53,6 +59,12 @@ class ClangRangeFinder {
   clang::SourceRange NormalizeRange(clang::SourceLocation start,
                                     clang::SourceLocation end) const;
 
+  /// \brief Returns the range between start and end in the ultimate file,
+  /// resolving macro IDs as `NormalizeRange` does but without expanding the
+  /// end location to the end of its token. Callers that measure many tokens
+  /// can use this to supply their own token lengths.
+  clang::CharSourceRange FileRange(clang::SourceRange range) const;
+
   const clang::SourceManager& source_manager() const {
     return *source_manager_;
   }
@@ -72,6 +84,13 @@ class ClangRangeFinder {
 
   const clang::SourceManager* source_manager_;
   const clang::LangOptions* lang_options_;
+  /// Results of `NormalizeRange`, keyed by the raw encodings of the begin
+  /// and end of the range that was normalized.
+  mutable llvm::DenseMap<std::pair<unsigned, unsigned>, clang::SourceRange>
+      normalized_ranges_;
+  /// Results of `RangeForNameOf`.
+  mutable llvm::DenseMap<const clang::NamedDecl*, clang::SourceRange>
+      name_ranges_;
 };
 
 }  // namespace kythe
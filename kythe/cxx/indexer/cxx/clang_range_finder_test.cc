@@ -282,5 +282,22 @@ TEST_F(ClangRangeFinderTest, TerribleMacrosAreZeroWidth) {
                           Pair("_status_or_value25", EmptyAt(expansion)),
                           Pair("_", EmptyAt(expansion)), Pair("r", "r")));
 }
+
+TEST_F(ClangRangeFinderTest, RepeatedLookupsAgree) {
+  std::string source = absl::StrJoin(
+      {"#define DECLARE(name) int name", "DECLARE(x);", "int y;"}, "\n");
+  auto decls = FindAllNamedDecls(Parse(source));
+  ClangRangeFinder finder = range_finder();
+  for (const auto* decl : decls) {
+    const clang::SourceRange first = finder.RangeForNameOf(decl);
+    EXPECT_EQ(first, finder.RangeForNameOf(decl));
+    EXPECT_EQ(first, range_finder().RangeForNameOf(decl));
+    const clang::SourceRange normalized =
+        finder.NormalizeRange(decl->getSourceRange());
+    EXPECT_EQ(normalized, finder.NormalizeRange(decl->getSourceRange()));
+    EXPECT_EQ(normalized,
+              range_finder().NormalizeRange(decl->getSourceRange()));
+  }
+}
 }  // namespace
 }  // namespace kythe
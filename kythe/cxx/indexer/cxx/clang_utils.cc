@@ -105,7 +105,7 @@ bool IsUsedAsWrite(const IndexedParentMap& map, const clang::Stmt* stmt) {
   if (indexed_parent == nullptr) return false;
   const auto* parent_stmt = indexed_parent->parent.get<clang::Stmt>();
   while (llvm::isa_and_nonnull<clang::MemberExpr>(parent_stmt)) {
-    indexed_parent = map.GetIndexedParent(*parent_stmt);
+    indexed_parent = map.GetNextIndexedParent(*indexed_parent);
     if (indexed_parent == nullptr) return false;
     parent_stmt = indexed_parent->parent.get<clang::Stmt>();
   }
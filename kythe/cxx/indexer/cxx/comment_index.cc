@@ -0,0 +1,133 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/comment_index.h"
+
+#include <algorithm>
+#include <map>
+
+#include "clang/AST/RawCommentList.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace kythe {
+namespace {
+
+/// The number of comments the cursor steps over before falling back to a
+/// binary search.
+constexpr size_t kMaxCursorSteps = 8;
+
+}  // anonymous namespace
+
+CommentIndex::CommentIndex(const clang::ASTContext& context)
+    : context_(context), enabled_(context.getExternalSource() == nullptr) {}
+
+CommentIndex::FileComments& CommentIndex::CommentsIn(clang::FileID file) {
+  auto [found, inserted] = files_.try_emplace(file);
+  if (inserted) {
+    if (const std::map<unsigned, clang::RawComment*>* comments =
+            context_.Comments.getCommentsInFile(file)) {
+      found->second.comments.reserve(comments->size());
+      for (const auto& [offset, comment] : *comments) {
+        found->second.comments.push_back(
+            {offset, context_.Comments.getCommentEndOffset(comment),
+             comment->isTrailingComment()});
+      }
+    }
+  }
+  return found->second;
+}
+
+size_t CommentIndex::LowerBound(FileComments& file, unsigned offset) {
+  const std::vector<Comment>& comments = file.comments;
+  auto before = [](const Comment& comment, unsigned value) {
+    return comment.begin < value;
+  };
+  size_t at = std::min(file.cursor, comments.size());
+  size_t steps = 0;
+  while (at < comments.size() && comments[at].begin < offset &&
+         steps++ < kMaxCursorSteps) {
+    ++at;
+  }
+  while (at > 0 && comments[at - 1].begin >= offset &&
+         steps++ < kMaxCursorSteps) {
+    --at;
+  }
+  if (steps > kMaxCursorSteps) {
+    at = std::lower_bound(comments.begin(), comments.end(), offset, before) -
+         comments.begin();
+  }
+  file.cursor = at;
+  return at;
+}
+
+bool CommentIndex::MayHaveComment(const clang::Decl* decl) {
+  if (!enabled_) {
+    return true;
+  }
+  // Clang searches from either of these locations, depending on the kind of
+  // declaration, or from somewhere in a macro expansion.
+  clang::SourceLocation begin_loc = decl->getBeginLoc();
+  clang::SourceLocation name_loc = decl->getLocation();
+  if (begin_loc.isInvalid() && name_loc.isInvalid()) {
+    return false;
+  }
+  if (!begin_loc.isFileID() || !name_loc.isFileID()) {
+    return true;
+  }
+  const clang::SourceManager& source_manager = context_.getSourceManager();
+  auto [file, begin] = source_manager.getDecomposedLoc(begin_loc);
+  auto [name_file, name] = source_manager.getDecomposedLoc(name_loc);
+  if (file != name_file || name < begin) {
+    return true;
+  }
+  FileComments& comments = CommentsIn(file);
+  if (comments.comments.empty()) {
+    return false;
+  }
+  size_t next = LowerBound(comments, begin);
+  if (next < comments.comments.size() &&
+      comments.comments[next].begin <= name) {
+    return true;
+  }
+  bool invalid = false;
+  llvm::StringRef buffer = source_manager.getBufferData(file, &invalid);
+  if (invalid) {
+    return true;
+  }
+  if (next < comments.comments.size() && comments.comments[next].trailing) {
+    const Comment& after = comments.comments[next];
+    if (after.begin > buffer.size() ||
+        buffer.slice(name, after.begin).find_first_of("\r\n") ==
+            llvm::StringRef::npos) {
+      return true;
+    }
+  }
+  if (next > 0) {
+    const Comment& before = comments.comments[next - 1];
+    if (before.end > begin) {
+      return true;
+    }
+    if (!before.trailing &&
+        buffer.slice(before.end, begin).find_first_of(";{}#@") ==
+            llvm::StringRef::npos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace kythe
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_COMMENT_INDEX_H_
+#define KYTHE_CXX_INDEXER_CXX_COMMENT_INDEX_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/Basic/SourceLocation.h"
+#include "llvm/ADT/DenseMap.h"
+
+namespace kythe {
+
+/// \brief Rules out the declarations Clang can't attach a comment to without
+/// asking Clang, which searches the translation unit's comments afresh for
+/// every declaration.
+///
+/// Clang attaches the comment just before a declaration unless a `;`, `{`,
+/// `}`, `#` or `@` separates them, and a trailing comment that starts on the
+/// declaration's line. Each file's comments are gathered once into a vector
+/// sorted by offset. Declarations are matched against it with a cursor that
+/// moves a few places at a time while the traversal walks through the file in
+/// order. The check is conservative: it never rules out a declaration that
+/// Clang would attach a comment to.
+class CommentIndex {
+ public:
+  /// \param context The context whose comments are indexed. Must outlive
+  /// this.
+  explicit CommentIndex(const clang::ASTContext& context);
+  CommentIndex(const CommentIndex&) = delete;
+  CommentIndex& operator=(const CommentIndex&) = delete;
+
+  /// \return false if Clang certainly attaches no comment to `decl`.
+  bool MayHaveComment(const clang::Decl* decl);
+
+ private:
+  /// \brief A comment's extent in its file.
+  struct Comment {
+    unsigned begin;  ///< The offset of the comment's first character.
+    unsigned end;    ///< The offset Clang reports as the comment's end.
+    bool trailing;   ///< Whether this is a trailing (`///<`) comment.
+  };
+  /// \brief A file's comments, sorted by `begin`.
+  struct FileComments {
+    std::vector<Comment> comments;
+    /// The result of the last `LowerBound` in this file.
+    size_t cursor = 0;
+  };
+
+  /// \return the comments in `file`, gathering them on first use.
+  FileComments& CommentsIn(clang::FileID file);
+
+  /// \return the index of the first comment in `file` that begins at or
+  /// after `offset`, starting the search from the last result.
+  static size_t LowerBound(FileComments& file, unsigned offset);
+
+  const clang::ASTContext& context_;
+  /// Comments loaded from a precompiled preamble or module only reach
+  /// `context_` once Clang first searches them, so the index can't be used.
+  const bool enabled_;
+  llvm::DenseMap<clang::FileID, FileComments> files_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_COMMENT_INDEX_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/comment_index.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Tooling/Tooling.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+std::unique_ptr<clang::ASTUnit> Parse(llvm::StringRef code) {
+  return clang::tooling::buildASTFromCodeWithArgs(
+      code, {"-std=c++17", "-fparse-all-comments"}, "input.cc");
+}
+
+std::vector<const clang::NamedDecl*> FindAllNamedDecls(clang::ASTUnit& ast) {
+  struct NamedDeclCollector : clang::RecursiveASTVisitor<NamedDeclCollector> {
+    bool VisitNamedDecl(clang::NamedDecl* decl) {
+      decls.push_back(decl);
+      return true;
+    }
+
+    std::vector<const clang::NamedDecl*> decls;
+  } visitor;
+  for (auto iter = ast.top_level_begin(); iter != ast.top_level_end(); iter++) {
+    visitor.TraverseDecl(*iter);
+  }
+  return visitor.decls;
+}
+
+TEST(CommentIndexTest, NeverRulesOutAnAttachedComment) {
+  auto ast = Parse(R"(// License.
+#define VALUE 1
+
+/// A.
+class A {
+ public:
+  int field;  ///< Field.
+  // Method.
+  void Method(int param);
+};
+
+int unrelated;
+
+/** B. */ template <typename T> struct B { T t; };
+
+#define DECLARE(name) int name
+// Macro.
+DECLARE(from_macro);
+
+enum E {
+  kOne,  ///< One.
+  kTwo,
+};
+  // Function.
+  void Function();
+)");
+  ASSERT_TRUE(ast != nullptr);
+  CommentIndex index(ast->getASTContext());
+  int attached = 0;
+  for (const clang::NamedDecl* decl : FindAllNamedDecls(*ast)) {
+    if (ast->getASTContext().getRawCommentForDeclNoCache(decl) != nullptr) {
+      ++attached;
+      EXPECT_TRUE(index.MayHaveComment(decl)) << decl->getNameAsString();
+    }
+  }
+  EXPECT_GE(attached, 6);
+}
+
+TEST(CommentIndexTest, RulesOutSeparatedDecls) {
+  auto ast = Parse(R"(// License.
+int first;
+int second; int third;
+
+// Orphaned.
+;
+struct S {
+  int field;
+  int other;  // Trailing, but ordinary.
+};
+)");
+  ASSERT_TRUE(ast != nullptr);
+  CommentIndex index(ast->getASTContext());
+  for (const clang::NamedDecl* decl : FindAllNamedDecls(*ast)) {
+    const std::string name = decl->getNameAsString();
+    if (name == "second" || name == "third" || name == "S" ||
+        name == "field") {
+      EXPECT_FALSE(index.MayHaveComment(decl)) << name;
+    }
+    if (name == "first") {
+      EXPECT_TRUE(index.MayHaveComment(decl)) << name;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace kythe
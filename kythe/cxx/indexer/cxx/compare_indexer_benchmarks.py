@@ -0,0 +1,114 @@
+#
+# Copyright 2021 The Kythe Authors. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+"""Flag regressions between two runs of the indexer benchmarks.
+
+Both inputs are written by :indexer_benchmark with
+--benchmark_out=<file> --benchmark_out_format=json. Record the baseline on
+the same machine, with the same flags, as the run it is compared against;
+timings from different machines aren't comparable. With
+--benchmark_repetitions, the median of each benchmark is compared.
+
+Exits with status 1 if any metric grew by more than its threshold.
+"""
+import argparse
+import json
+import sys
+
+# The metrics compared, each with the default relative growth that counts as
+# a regression. Times are noisy; entry and byte counts should only change
+# when the output does.
+METRICS = {
+    "real_time": 0.10,
+    "parse_ms": 0.10,
+    "traversal_ms": 0.10,
+    "emit_ms": 0.10,
+    "peak_rss_mb": 0.05,
+    "entries": 0.0,
+    "output_bytes": 0.0,
+}
+
+
+def load_benchmarks(path):
+    """Returns a map from benchmark name to its results in the file at path."""
+    with open(path) as f:
+        benchmarks = json.load(f)["benchmarks"]
+    results = {}
+    for benchmark in benchmarks:
+        if benchmark.get("run_type") == "aggregate":
+            if benchmark.get("aggregate_name") != "median":
+                continue
+            name = benchmark["run_name"]
+        else:
+            name = benchmark.get("run_name", benchmark["name"])
+            if name in results:
+                # Without aggregates, keep the first repetition.
+                continue
+        results[name] = benchmark
+    return results
+
+
+def compare(baseline, current, thresholds):
+    """Returns (name, metric, old, new) for each regression and prints every
+    change."""
+    regressions = []
+    for name in sorted(baseline):
+        if name not in current:
+            print("%s: missing from the current run" % name)
+            continue
+        for metric, threshold in thresholds.items():
+            old = baseline[name].get(metric)
+            new = current[name].get(metric)
+            if old is None or new is None:
+                continue
+            change = (new - old) / old if old else (1.0 if new else 0.0)
+            flagged = change > threshold
+            if flagged:
+                regressions.append((name, metric, old, new))
+            if flagged or abs(change) > threshold:
+                print("%s %s: %.4g -> %.4g (%+.1f%%)%s" %
+                      (name, metric, old, new, change * 100,
+                       " REGRESSION" if flagged else ""))
+    for name in sorted(set(current) - set(baseline)):
+        print("%s: new in the current run" % name)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("baseline", help="benchmark JSON to compare against")
+    parser.add_argument("current", help="benchmark JSON to check")
+    parser.add_argument(
+        "--time_threshold",
+        type=float,
+        help="override the relative growth allowed in every time metric")
+    args = parser.parse_args()
+
+    thresholds = dict(METRICS)
+    if args.time_threshold is not None:
+        for metric in ("real_time", "parse_ms", "traversal_ms", "emit_ms"):
+            thresholds[metric] = args.time_threshold
+    regressions = compare(
+        load_benchmarks(args.baseline), load_benchmarks(args.current),
+        thresholds)
+    if regressions:
+        print("%d regression(s)" % len(regressions))
+        return 1
+    print("No regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
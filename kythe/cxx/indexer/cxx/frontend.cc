@@ -21,21 +21,42 @@
 #include <unistd.h>
 
 #include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/flags/flag.h"
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/file_content_cache.h"
+#include "kythe/cxx/common/indexing/FileHashCache.h"
 #include "kythe/cxx/common/indexing/MemcachedHashCache.h"
 #include "kythe/cxx/common/kzip_reader.h"
 #include "kythe/cxx/common/path_utils.h"
 #include "kythe/cxx/indexer/cxx/DynamicClaimClient.h"
 #include "kythe/cxx/indexer/cxx/proto_conversions.h"
+#include "kythe/cxx/indexer/cxx/unit_cost_model.h"
 #include "kythe/proto/buildinfo.pb.h"
 #include "kythe/proto/claim.pb.h"
 #include "llvm/ADT/STLExtras.h"
@@ -46,14 +67,34 @@ ABSL_FLAG(bool, ignore_unimplemented, true,
           "Continue indexing even if we find something we don't support.");
 ABSL_FLAG(bool, flush_after_each_entry, true,
           "Flush output after writing each entry.");
-ABSL_FLAG(std::string, static_claim, "", "Use a static claim table.");
+ABSL_FLAG(std::string, static_claim, "",
+          "Use a static claim table: either the gzipped claim stream that "
+          "static_claim writes by default or a claim table from "
+          "static_claim --table, which is mapped instead of loaded.");
 ABSL_FLAG(bool, claim_unknown, true,
           "Process files with unknown claim status.");
 ABSL_FLAG(std::string, cache, "",
-          "Use a memcache instance (ex: \"--SERVER=foo:1234\")");
+          "Use a memcache instance (ex: \"--SERVER=foo:1234\") or, for "
+          "file:/some/path, a cache kept on local disk in /some/path and "
+          "/some/path.log.");
 ABSL_FLAG(int32_t, min_size, 4096, "Minimum size of an entry bundle");
 ABSL_FLAG(int32_t, max_size, 1024 * 32, "Maximum size of an entry bundle");
 ABSL_FLAG(bool, cache_stats, false, "Show cache stats");
+ABSL_FLAG(std::string, cache_hash, "sha256",
+          "How to hash buffers for --cache: sha256 or murmur3. Indexers "
+          "sharing a cache must agree; keys from one never match the other.");
+ABSL_FLAG(std::string, experimental_cache_chunking, "nested",
+          "Where to end the buffers hashed for --cache: nested (by entry "
+          "group and size) or content (at cut points chosen by a rolling "
+          "hash, so an edit only moves nearby boundaries). Indexers sharing "
+          "a cache should agree.");
+ABSL_FLAG(int64_t, experimental_local_hash_cache_bytes, 0,
+          "If positive, answer repeat --cache lookups from an in-process set "
+          "of about this many bytes before asking the shared cache.");
+ABSL_FLAG(int32_t, experimental_cache_batch_size, 0,
+          "If greater than 1, hold back this many finished buffers and look "
+          "them up in --cache with one multi-get, and send adds without "
+          "waiting for replies. Output order is unchanged.");
 ABSL_FLAG(std::string, icorpus, "",
           "Corpus to use for files specified with -i");
 ABSL_FLAG(std::string, ibuild_config, "",
@@ -72,6 +113,48 @@ ABSL_FLAG(uint64_t, experimental_dynamic_overclaim, 1,
           "Maximum number of dynamic claims per claimable (EXPERIMENTAL)");
 ABSL_FLAG(bool, test_claim, false,
           "Use an in-memory claim database for testing.");
+ABSL_FLAG(std::string, shard, "",
+          "If set to i/N, only index the units in each .kzip whose digests "
+          "fall into shard i of N.");
+ABSL_FLAG(int, experimental_kzip_prefetch_units, 0,
+          "If positive, decode up to this many units from a .kzip on a "
+          "background thread while earlier units are being indexed.");
+ABSL_FLAG(int64_t, experimental_file_cache_bytes, 0,
+          "If positive, keep up to this many bytes of recently-read .kzip "
+          "file content in memory so that inputs shared between units are "
+          "only decompressed once.");
+ABSL_FLAG(bool, experimental_largest_units_first, false,
+          "Index the units in each .kzip in decreasing order of predicted "
+          "cost rather than in the order they are stored, so that a long unit "
+          "doesn't start last. Costs come from "
+          "--experimental_unit_cost_file or else from how many inputs each "
+          "unit has.");
+ABSL_FLAG(std::string, experimental_unit_cost_file, "",
+          "With --experimental_largest_units_first, predict the cost of each "
+          "unit from the parse and traversal times that an earlier run wrote "
+          "to its --experimental_unit_metrics_file.");
+ABSL_FLAG(bool, experimental_lazy_file_content, false,
+          "Only read the inputs of a .kzip unit that the indexer opens, when "
+          "it opens them, rather than reading all of them first.");
+ABSL_FLAG(bool, experimental_read_inputs_from_stdin, false,
+          "Read the names of .kzip or .kindex files to index from standard "
+          "input, one per line, until EOF. Claim state, caches and the output "
+          "stream are kept open between inputs.");
+ABSL_FLAG(int32_t, experimental_entryset_bundle_size, 0,
+          "If positive, write varint-delimited kythe.storage.EntrySet "
+          "messages of up to this many entries each instead of "
+          "varint-delimited kythe.proto.Entry messages.");
+ABSL_FLAG(bool, experimental_async_output, false,
+          "Write output on a background thread so that indexing does not "
+          "wait on a slow reader until several slabs of output are queued.");
+ABSL_FLAG(int32_t, experimental_entry_filter_mb, 0,
+          "If positive, drop entries that are exact duplicates of ones this "
+          "process already wrote, remembering up to about this many MiB of "
+          "fingerprints. With --jobs, which unit keeps a shared entry "
+          "depends on timing.");
+ABSL_FLAG(std::string, experimental_output_compression, "",
+          "If set to snappy, compress output using the snappy framing "
+          "format.");
 namespace kythe {
 
 namespace {
@@ -79,6 +162,9 @@ namespace {
 /// is enabled.
 constexpr char kSilentPrefix[] = "silent:";
 
+/// The prefix of --cache values that name a `FileHashCache`.
+constexpr absl::string_view kFileCachePrefix = "file:";
+
 /// The message type URI for the build details message.
 constexpr char kBuildDetailsURI[] = "kythe.io/proto/kythe.proto.BuildDetails";
 
@@ -118,6 +204,17 @@ void DecodeStaticClaimTable(const std::string& path,
   close(fd);
 }
 
+/// \return true if `path` holds a `ClaimTable` instead of a gzipped stream
+/// of claims.
+bool IsClaimTableFile(const std::string& path) {
+  char prefix[ClaimTable::kMagic.size()];
+  int fd = open(path.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Couldn't open input file " << path;
+  ssize_t size = read(fd, prefix, sizeof(prefix));
+  close(fd);
+  return size > 0 && ClaimTable::HasMagic(absl::string_view(prefix, size));
+}
+
 /// \brief Normalize input file vnames by cleaning paths and clearing
 /// signatures.
 void MaybeNormalizeFileVNames(IndexerJob* job) {
@@ -130,6 +227,9 @@ void MaybeNormalizeFileVNames(IndexerJob* job) {
   }
 }
 
+/// \brief The size of the reads made from a .kindex file.
+constexpr int kIndexFileBlockSize = 256 * 1024;
+
 /// \brief Reads data from a .kindex file into memory.
 /// \param path The path from which the file should be read.
 /// \param virtual_files A vector to be filled with FileData.
@@ -140,7 +240,8 @@ void DecodeIndexFile(const std::string& path,
   using namespace google::protobuf::io;
   int fd = open(path.c_str(), O_RDONLY, S_IREAD | S_IWRITE);
   CHECK_GE(fd, 0) << "Couldn't open input file " << path;
-  FileInputStream file_input_stream(fd);
+  // Read the compressed stream in larger blocks than the 8 KiB default.
+  FileInputStream file_input_stream(fd, kIndexFileBlockSize);
   GzipInputStream gzip_input_stream(&file_input_stream);
   google::protobuf::uint32 byte_size;
   for (;;) {
@@ -164,42 +265,278 @@ void DecodeIndexFile(const std::string& path,
   close(fd);
 }
 
+/// \brief Appends everything that can be read from `fd` to `out`.
+/// \return false if a read failed.
+bool ReadAll(int fd, std::string* out) {
+  struct stat fd_stat;
+  if (::fstat(fd, &fd_stat) == 0 && S_ISREG(fd_stat.st_mode)) {
+    // Size the buffer once and read straight into it. A regular file usually
+    // arrives in a single read.
+    size_t offset = out->size();
+    out->resize(offset + fd_stat.st_size);
+    while (offset < out->size()) {
+      ssize_t amount_read = read(fd, &(*out)[offset], out->size() - offset);
+      if (amount_read < 0) {
+        return false;
+      }
+      if (amount_read == 0) {
+        break;
+      }
+      offset += amount_read;
+    }
+    out->resize(offset);
+  }
+  // Pipes (and files that grew since the fstat) are read in chunks.
+  char buf[64 * 1024];
+  ssize_t amount_read;
+  while ((amount_read = read(fd, buf, sizeof(buf))) > 0) {
+    out->append(buf, amount_read);
+  }
+  return amount_read == 0;
+}
+
+/// \brief Selects a subset of the units in a kzip by digest.
+struct Shard {
+  /// The index of this shard, in [0, count).
+  uint64_t index = 0;
+  /// The total number of shards.
+  uint64_t count = 1;
+
+  /// \return true if the unit with digest `digest` belongs to this shard.
+  ///
+  /// The assignment depends only on the digest, so it is stable across runs
+  /// and machines.
+  bool Contains(absl::string_view digest) const {
+    if (count == 1) {
+      return true;
+    }
+    uint64_t key = 0;
+    for (char c : digest) {
+      key = key * 31 + static_cast<unsigned char>(c);
+    }
+    return key % count == index;
+  }
+};
+
+/// \return the shard selected by --shard.
+Shard GetShard() {
+  Shard shard;
+  std::string flag = absl::GetFlag(FLAGS_shard);
+  if (flag.empty()) {
+    return shard;
+  }
+  std::vector<absl::string_view> parts = absl::StrSplit(flag, '/');
+  CHECK(parts.size() == 2 && absl::SimpleAtoi(parts[0], &shard.index) &&
+        absl::SimpleAtoi(parts[1], &shard.count) && shard.count > 0 &&
+        shard.index < shard.count)
+      << "--shard must look like i/N with 0 <= i < N; got " << flag;
+  return shard;
+}
+
+/// \brief Reads a single compilation and all of its inputs from a kzip.
+/// \param reader The reader from which to read.
+/// \param digest The digest of the compilation to read.
+/// \param silent The silent flag to copy to the job.
+/// \param cache If non-null, a cache to consult before reading file content.
+IndexerJob ReadKZipJob(IndexReader* reader, absl::string_view digest,
+                       bool silent, FileContentCache* cache) {
+  IndexerJob job;
+  job.silent = silent;
+
+  auto compilation = reader->ReadUnit(digest);
+  CHECK(compilation.ok()) << "Unable to read unit with digest: " << digest
+                          << ": " << compilation.status();
+  const auto& inputs = compilation->unit().required_input();
+  if (absl::GetFlag(FLAGS_experimental_lazy_file_content)) {
+    for (const auto& file : inputs) {
+      proto::FileData file_data;
+      file_data.mutable_info()->set_path(file.info().path());
+      file_data.mutable_info()->set_digest(file.info().digest());
+      job.virtual_files.push_back(std::move(file_data));
+    }
+    job.read_content = [reader, cache](absl::string_view file_digest)
+        -> absl::StatusOr<std::shared_ptr<const std::string>> {
+      if (cache != nullptr) {
+        return cache->ReadFile(reader, file_digest);
+      }
+      auto content = reader->ReadFile(file_digest);
+      if (!content.ok()) {
+        return content.status();
+      }
+      return std::make_shared<const std::string>(*std::move(content));
+    };
+  } else if (cache != nullptr) {
+    // The content is read now, but handed to the VFS through `read_content`
+    // so that it shares the cached copy instead of copying it into the job.
+    auto contents = std::make_shared<
+        absl::flat_hash_map<std::string, std::shared_ptr<const std::string>>>();
+    for (const auto& file : inputs) {
+      auto content = cache->ReadFile(reader, file.info().digest());
+      CHECK(content.ok()) << "Unable to read file with digest: "
+                          << file.info().digest() << ": " << content.status();
+      (*contents)[file.info().digest()] = *std::move(content);
+      proto::FileData file_data;
+      file_data.mutable_info()->set_path(file.info().path());
+      file_data.mutable_info()->set_digest(file.info().digest());
+      job.virtual_files.push_back(std::move(file_data));
+    }
+    job.read_content = [contents](absl::string_view file_digest)
+        -> absl::StatusOr<std::shared_ptr<const std::string>> {
+      auto found = contents->find(file_digest);
+      if (found == contents->end()) {
+        return absl::NotFoundError(
+            absl::StrCat("No content for digest ", file_digest));
+      }
+      return found->second;
+    };
+  } else {
+    std::vector<std::string> digests;
+    digests.reserve(inputs.size());
+    for (const auto& file : inputs) {
+      digests.push_back(file.info().digest());
+    }
+    auto status = reader->ReadFiles(
+        digests, [&](absl::string_view file_digest,
+                     absl::StatusOr<std::string> content) {
+          CHECK(content.ok()) << "Unable to read file with digest: "
+                              << file_digest << ": " << content.status();
+          const auto& file = inputs[job.virtual_files.size()];
+          proto::FileData file_data;
+          file_data.set_content(*std::move(content));
+          file_data.mutable_info()->set_path(file.info().path());
+          file_data.mutable_info()->set_digest(file.info().digest());
+          job.virtual_files.push_back(std::move(file_data));
+          return true;
+        });
+    CHECK(status.ok()) << status;
+  }
+  job.unit = std::move(*compilation->mutable_unit());
+
+  MaybeNormalizeFileVNames(&job);
+  return job;
+}
+
+/// \brief A bounded queue of decoded jobs that is filled by a single
+/// producer thread and drained by a single consumer thread.
+class PrefetchedJobQueue {
+ public:
+  explicit PrefetchedJobQueue(size_t capacity) : capacity_(capacity) {}
+
+  /// \brief Adds `job` to the queue, blocking while the queue is full.
+  void Push(IndexerJob job) ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(
+        +[](PrefetchedJobQueue* queue) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+             queue->mu_) { return queue->jobs_.size() < queue->capacity_; },
+        this));
+    jobs_.push_back(std::move(job));
+  }
+
+  /// \brief Marks that no more jobs will be pushed.
+  void Close() ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    closed_ = true;
+  }
+
+  /// \brief Removes the next job from the queue, blocking until one is
+  /// available.
+  /// \return false if the queue is closed and empty.
+  bool Pop(IndexerJob* job) ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    mu_.Await(absl::Condition(
+        +[](PrefetchedJobQueue* queue) ABSL_EXCLUSIVE_LOCKS_REQUIRED(
+             queue->mu_) { return !queue->jobs_.empty() || queue->closed_; },
+        this));
+    if (jobs_.empty()) {
+      return false;
+    }
+    *job = std::move(jobs_.front());
+    jobs_.pop_front();
+    return true;
+  }
+
+ private:
+  const size_t capacity_;
+  absl::Mutex mu_;
+  std::deque<IndexerJob> jobs_ ABSL_GUARDED_BY(mu_);
+  bool closed_ ABSL_GUARDED_BY(mu_) = false;
+};
+
+/// \brief Orders `digests` so that the units predicted to cost the most
+/// come first.
+/// \param reader The reader from which to read the units.
+/// \param model Predicts the cost of each unit.
+/// \param digests The digests of the units to order.
+void OrderByPredictedCost(IndexReader* reader, const UnitCostModel& model,
+                          std::vector<std::string>* digests) {
+  std::vector<std::pair<std::string, double>> units;
+  units.reserve(digests->size());
+  for (auto& digest : *digests) {
+    auto compilation = reader->ReadUnit(digest);
+    CHECK(compilation.ok()) << "Unable to read unit with digest: " << digest
+                            << ": " << compilation.status();
+    const double cost = model.Predict(compilation->unit());
+    units.emplace_back(std::move(digest), cost);
+  }
+  SortByDecreasingCost(&units);
+  digests->clear();
+  for (auto& unit : units) {
+    digests->push_back(std::move(unit.first));
+  }
+}
+
 /// \brief Reads all compilations from a .kzip file into memory.
 /// \param path The path from which the file should be read.
 /// \param jobs A vector to add a job to for each compilation in the kzip.
 /// \param silent The silent flag is copied to each of the jobs created from the
 /// kzip file.
+/// \param cache If non-null, a cache of file content shared between units.
+/// \param cost_model If non-null, units predicted to cost more are visited
+/// first; otherwise, units are visited in the order they are stored.
 void DecodeKZipFile(const std::string& path, bool silent,
+                    FileContentCache* cache, const UnitCostModel* cost_model,
                     const IndexerContext::CompilationVisitCallback& visit) {
   absl::StatusOr<IndexReader> reader = kythe::KzipReader::Open(path);
   CHECK(reader.ok()) << "Couldn't open kzip from " << path << ": "
                      << reader.status();
   bool compilation_read = false;
+  const Shard shard = GetShard();
+  std::vector<std::string> digests;
   auto status = reader->Scan([&](absl::string_view digest) {
-    IndexerJob job;
-    job.silent = silent;
-
-    auto compilation = reader->ReadUnit(digest);
-    for (const auto& file : compilation->unit().required_input()) {
-      auto content = reader->ReadFile(file.info().digest());
-      CHECK(content.ok()) << "Unable to read file with digest: "
-                          << file.info().digest() << ": " << content.status();
-      proto::FileData file_data;
-      file_data.set_content(*content);
-      file_data.mutable_info()->set_path(file.info().path());
-      file_data.mutable_info()->set_digest(file.info().digest());
-      job.virtual_files.push_back(std::move(file_data));
-    }
-    job.unit = compilation->unit();
-
-    MaybeNormalizeFileVNames(&job);
-    visit(job);
-
     compilation_read = true;
+    if (shard.Contains(digest)) {
+      digests.emplace_back(digest);
+    }
     return true;
   });
   CHECK(status.ok()) << status.ToString();
   CHECK(compilation_read) << "Missing compilation in " << path;
+  if (cost_model != nullptr) {
+    OrderByPredictedCost(&*reader, *cost_model, &digests);
+  }
+  const int prefetch = absl::GetFlag(FLAGS_experimental_kzip_prefetch_units);
+  if (prefetch <= 0) {
+    for (const auto& digest : digests) {
+      IndexerJob job = ReadKZipJob(&*reader, digest, silent, cache);
+      visit(job);
+    }
+    return;
+  }
+
+  // The consumer (this thread) only sees decoded jobs, but it may still read
+  // their file content through the reader, which outlives them.
+  PrefetchedJobQueue queue(prefetch);
+  std::thread producer([&] {
+    for (const auto& digest : digests) {
+      queue.Push(ReadKZipJob(&*reader, digest, silent, cache));
+    }
+    queue.Close();
+  });
+  IndexerJob job;
+  while (queue.Pop(&job)) {
+    visit(job);
+  }
+  producer.join();
 }
 }  // anonymous namespace
 
@@ -221,6 +558,13 @@ If -test_claim is specified, you may specify that one or more kindex inputs
 should not produce any output by prepending the prefix "silent:" to the input's
 name.
 
+If -experimental_read_inputs_from_stdin is specified, the names of .kzip or
+.kindex inputs are read from stdin, one per line. After each input has been
+indexed and its output flushed, "done: <name>" is written to stderr. This lets
+a long-lived process amortize start-up costs over many small inputs. (Indexers
+that index units asynchronously may still be working on an input when it is
+acknowledged.)
+
 Examples:)");
   message.append(program_name + " some/index.kindex\n");
   message.append(program_name + " -i foo.cc -o foo.bin -- -DINDEXING\n");
@@ -229,6 +573,14 @@ Examples:)");
 }
 
 bool IndexerContext::HasIndexArguments() {
+  if (absl::GetFlag(FLAGS_experimental_read_inputs_from_stdin)) {
+    CHECK_EQ("-", absl::GetFlag(FLAGS_i))
+        << "No other input is allowed when reading input names from stdin.";
+    CHECK_EQ(args_.size(), 1)
+        << "No positional arguments are allowed when reading input names "
+        << "from stdin.";
+    return true;
+  }
   for (const auto& arg : args_) {
     auto path = llvm::StringRef(arg);
     if (path.endswith(".kindex") || path.endswith(".kzip")) {
@@ -249,7 +601,7 @@ void IndexerContext::LoadDataFromIndex(const std::string& file_or_cu,
     name = file_or_cu;
   }
   if (llvm::StringRef(file_or_cu).endswith(".kzip")) {
-    DecodeKZipFile(name, silent, visit);
+    DecodeKZipFile(name, silent, file_cache_.get(), cost_model_.get(), visit);
   } else {
     IndexerJob job;
     job.silent = silent;
@@ -277,22 +629,17 @@ void IndexerContext::LoadDataFromUnpackedFile(
     }
   }
   args_.push_back(source_file_name);
-  char buf[1024];
-  llvm::SmallString<1024> source_data;
-  ssize_t amount_read;
-  while ((amount_read = read(read_fd, buf, 1024)) > 0) {
-    source_data.append(llvm::StringRef(buf, amount_read));
-  }
-  if (amount_read < 0) {
-    perror("Error reading input file");
-    exit(1);
-  }
-  close(read_fd);
   // clang wants the source file to be null-terminated, but this should
   // not be in range of the StringRef. std::string ends with \0.
+  // Read straight into the proto's buffer so that the source text is only
+  // ever stored once.
   proto::FileData file_data;
   file_data.mutable_info()->set_path(source_file_name);
-  file_data.set_content(std::string(source_data.str()));
+  if (!ReadAll(read_fd, file_data.mutable_content())) {
+    perror("Error reading input file");
+    exit(1);
+  }
+  close(read_fd);
   job.virtual_files.push_back(std::move(file_data));
   job.unit.add_source_file(source_file_name);
   for (const auto& arg : args_) {
@@ -318,12 +665,20 @@ void IndexerContext::InitializeClaimClient() {
     CHECK(dynamic_claims->OpenMemcache(
         absl::GetFlag(FLAGS_experimental_dynamic_claim_cache)))
         << "Can't open memcached";
+    dynamic_claim_client_ = dynamic_claims.get();
     claim_client_ = std::move(dynamic_claims);
   } else {
     auto static_claims = absl::make_unique<kythe::StaticClaimClient>();
-    if (!absl::GetFlag(FLAGS_static_claim).empty()) {
-      DecodeStaticClaimTable(absl::GetFlag(FLAGS_static_claim),
-                             static_claims.get());
+    const std::string static_claim = absl::GetFlag(FLAGS_static_claim);
+    if (!static_claim.empty()) {
+      if (IsClaimTableFile(static_claim)) {
+        auto table = ClaimTable::Open(static_claim);
+        CHECK(table.ok()) << table.status();
+        claim_table_ = *std::move(table);
+        static_claims->UseClaimTable(claim_table_.get());
+      } else {
+        DecodeStaticClaimTable(static_claim, static_claims.get());
+      }
     }
     static_claims->set_process_unknown_status(
         absl::GetFlag(FLAGS_claim_unknown));
@@ -344,15 +699,51 @@ void IndexerContext::OpenOutputStreams() {
   }
   raw_output_ =
       absl::make_unique<google::protobuf::io::FileOutputStream>(write_fd_);
-  kythe_output_ = absl::make_unique<kythe::FileOutputStream>(raw_output_.get());
+  if (absl::GetFlag(FLAGS_experimental_async_output)) {
+    async_output_ =
+        absl::make_unique<kythe::AsyncOutputStream>(raw_output_.get());
+  }
+  const std::string compression =
+      absl::GetFlag(FLAGS_experimental_output_compression);
+  if (compression == "snappy") {
+    snappy_output_ =
+        async_output_ ? absl::make_unique<kythe::SnappyOutputStream>(
+                            async_output_.get())
+                      : absl::make_unique<kythe::SnappyOutputStream>(
+                            raw_output_.get());
+    kythe_output_ =
+        absl::make_unique<kythe::FileOutputStream>(snappy_output_.get());
+  } else if (!compression.empty()) {
+    absl::FPrintF(stderr, "Unknown --experimental_output_compression: %s\n",
+                  compression);
+    ::exit(1);
+  } else if (async_output_) {
+    kythe_output_ =
+        absl::make_unique<kythe::FileOutputStream>(async_output_.get());
+  } else {
+    kythe_output_ =
+        absl::make_unique<kythe::FileOutputStream>(raw_output_.get());
+  }
+  if (absl::GetFlag(FLAGS_experimental_entry_filter_mb) > 0) {
+    entry_filter_ = absl::make_unique<EntryFingerprintFilter>(
+        static_cast<size_t>(absl::GetFlag(FLAGS_experimental_entry_filter_mb))
+        << 20);
+    kythe_output_->UseEntryFilter(entry_filter_.get());
+  }
   kythe_output_->set_show_stats(absl::GetFlag(FLAGS_cache_stats));
   kythe_output_->set_flush_after_each_entry(
       absl::GetFlag(FLAGS_flush_after_each_entry));
+  if (absl::GetFlag(FLAGS_experimental_entryset_bundle_size) > 0) {
+    kythe_output_->set_entry_set_bundle_size(
+        absl::GetFlag(FLAGS_experimental_entryset_bundle_size));
+  }
 }
 
 void IndexerContext::CloseOutputStreams() {
   if (kythe_output_) {
     kythe_output_.reset();
+    snappy_output_.reset();
+    async_output_.reset();
     raw_output_.reset();
     if (::close(write_fd_) != 0) {
       ::perror("Error closing output file");
@@ -362,12 +753,56 @@ void IndexerContext::CloseOutputStreams() {
 }
 
 void IndexerContext::OpenHashCache() {
-  if (!absl::GetFlag(FLAGS_cache).empty()) {
+  const std::string spec = absl::GetFlag(FLAGS_cache);
+  if (spec.empty()) {
+    return;
+  }
+  const int32_t batch_size = absl::GetFlag(FLAGS_experimental_cache_batch_size);
+  std::unique_ptr<HashCache> cache;
+  if (absl::StartsWith(spec, kFileCachePrefix)) {
+    auto file_hash_cache = absl::make_unique<FileHashCache>();
+    CHECK(file_hash_cache->Open(spec.substr(kFileCachePrefix.size())))
+        << "Can't open " << spec;
+    cache = std::move(file_hash_cache);
+  } else {
     auto memcache_hash_cache = absl::make_unique<MemcachedHashCache>();
-    CHECK(memcache_hash_cache->OpenMemcache(absl::GetFlag(FLAGS_cache)));
-    memcache_hash_cache->SetSizeLimits(absl::GetFlag(FLAGS_min_size),
-                                       absl::GetFlag(FLAGS_max_size));
-    hash_cache_ = std::move(memcache_hash_cache);
+    CHECK(memcache_hash_cache->OpenMemcache(spec));
+    if (batch_size > 1) {
+      CHECK(memcache_hash_cache->UsePipelinedAdds())
+          << "Can't pipeline memcached adds";
+    }
+    cache = std::move(memcache_hash_cache);
+  }
+  cache->SetSizeLimits(absl::GetFlag(FLAGS_min_size),
+                       absl::GetFlag(FLAGS_max_size));
+  const std::string hash = absl::GetFlag(FLAGS_cache_hash);
+  if (hash == "murmur3") {
+    cache->set_algorithm(HashCache::Algorithm::kMurmur3);
+  } else if (hash != "sha256") {
+    absl::FPrintF(stderr, "Unknown --cache_hash: %s\n", hash);
+    ::exit(1);
+  }
+  const std::string chunking =
+      absl::GetFlag(FLAGS_experimental_cache_chunking);
+  if (chunking == "content") {
+    cache->set_chunking(HashCache::Chunking::kContentDefined);
+  } else if (chunking != "nested") {
+    absl::FPrintF(stderr, "Unknown --experimental_cache_chunking: %s\n",
+                  chunking);
+    ::exit(1);
+  }
+  if (batch_size > 1) {
+    cache->set_batch_size(batch_size);
+  }
+  const int64_t local_bytes =
+      absl::GetFlag(FLAGS_experimental_local_hash_cache_bytes);
+  if (local_bytes > 0) {
+    auto tiered_hash_cache =
+        absl::make_unique<TieredHashCache>(std::move(cache), local_bytes);
+    tiered_hash_cache_ = tiered_hash_cache.get();
+    hash_cache_ = std::move(tiered_hash_cache);
+  } else {
+    hash_cache_ = std::move(cache);
   }
 }
 
@@ -383,13 +818,72 @@ IndexerContext::IndexerContext(const std::vector<std::string>& args,
   InitializeClaimClient();
   OpenOutputStreams();
   OpenHashCache();
+  if (absl::GetFlag(FLAGS_experimental_file_cache_bytes) > 0) {
+    file_cache_ = absl::make_unique<FileContentCache>(
+        absl::GetFlag(FLAGS_experimental_file_cache_bytes));
+  }
+  OpenCostModel();
 }
 
-IndexerContext::~IndexerContext() { CloseOutputStreams(); }
+void IndexerContext::OpenCostModel() {
+  const std::string cost_file =
+      absl::GetFlag(FLAGS_experimental_unit_cost_file);
+  if (!absl::GetFlag(FLAGS_experimental_largest_units_first)) {
+    if (!cost_file.empty()) {
+      absl::FPrintF(stderr,
+                    "--experimental_unit_cost_file has no effect without "
+                    "--experimental_largest_units_first\n");
+    }
+    return;
+  }
+  if (cost_file.empty()) {
+    cost_model_ = absl::make_unique<InputCountCostModel>();
+    return;
+  }
+  std::ifstream file(cost_file);
+  CHECK(file) << "Couldn't open " << cost_file;
+  std::stringstream records;
+  records << file.rdbuf();
+  cost_model_ = absl::make_unique<RecordedCostModel>(
+      RecordedCostModel::FromMetrics(records.str()));
+}
+
+IndexerContext::~IndexerContext() {
+  if (file_cache_ != nullptr && absl::GetFlag(FLAGS_cache_stats)) {
+    auto stats = file_cache_->stats();
+    absl::FPrintF(stderr, "file cache: %d hits %d misses %d evictions\n",
+                  stats.hits, stats.misses, stats.evictions);
+  }
+  CloseOutputStreams();
+  // Closing the output streams finishes their last lookups.
+  if (tiered_hash_cache_ != nullptr && absl::GetFlag(FLAGS_cache_stats)) {
+    absl::FPrintF(stderr, "hash cache: %s\n",
+                  tiered_hash_cache_->stats().ToString());
+  }
+}
+
+void IndexerContext::LoadDataFromStdinNames(
+    const CompilationVisitCallback& visit) {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    absl::string_view name = absl::StripAsciiWhitespace(line);
+    if (name.empty()) {
+      continue;
+    }
+    LoadDataFromIndex(std::string(name), visit);
+    // Make sure that everything for this input is visible to the reader
+    // before we acknowledge it.
+    kythe_output_->Flush();
+    absl::FPrintF(stderr, "done: %s\n", name);
+    fflush(stderr);
+  }
+}
 
 void IndexerContext::EnumerateCompilations(
     const CompilationVisitCallback& visit) {
-  if (unpacked_inputs_) {
+  if (absl::GetFlag(FLAGS_experimental_read_inputs_from_stdin)) {
+    LoadDataFromStdinNames(visit);
+  } else if (unpacked_inputs_) {
     LoadDataFromUnpackedFile(default_filename_, visit);
   } else {
     for (size_t arg = 1; arg < args_.size(); ++arg) {
@@ -22,8 +22,14 @@
 
 #include "glog/logging.h"
 #include "google/protobuf/io/zero_copy_stream.h"
+#include "kythe/cxx/common/claim_table.h"
+#include "kythe/cxx/common/file_content_cache.h"
+#include "kythe/cxx/common/indexing/AsyncOutputStream.h"
 #include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/indexing/SnappyOutputStream.h"
+#include "kythe/cxx/indexer/cxx/DynamicClaimClient.h"
 #include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
+#include "kythe/cxx/indexer/cxx/unit_cost_model.h"
 #include "kythe/proto/analysis.pb.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Path.h"
@@ -38,6 +44,10 @@ struct IndexerJob {
   proto::CompilationUnit unit;
   /// If set, this job should not produce any output.
   bool silent = false;
+  /// If set, the `virtual_files` were left without content, which should be
+  /// read through this when it is needed. Only valid while the job is being
+  /// visited.
+  FileContentReader read_content;
 };
 
 /// \brief Handles common tasks related to invoking a Kythe indexer from the
@@ -61,6 +71,9 @@ class IndexerContext {
 
   /// \brief If non-null, the hash cache to use. Owned by `IndexerContext`.
   HashCache* hash_cache() const { return hash_cache_.get(); }
+  /// \brief If non-null, the filter for duplicate entries that `output()`
+  /// uses. Owned by `IndexerContext`.
+  EntryFingerprintFilter* entry_filter() const { return entry_filter_.get(); }
   /// \brief If true, the indexer is permitted to touch the local filesystem.
   bool allow_filesystem_access() const {
     // Only allow filesystem access for unpacked inputs. Indexes already contain
@@ -74,6 +87,10 @@ class IndexerContext {
     CHECK(claim_client_ != nullptr);
     return claim_client_.get();
   }
+  /// \brief `claim_client()`, if it makes dynamic claims (or null).
+  const DynamicClaimClient* dynamic_claim_client() const {
+    return dynamic_claim_client_;
+  }
   /// \brief The output stream to use for this compilation. Not null; owned
   /// by `IndexerContext` and closed on destruction.
   FileOutputStream* output() const {
@@ -98,6 +115,9 @@ class IndexerContext {
   /// \param visit A callback to call for each compilation unit.
   void LoadDataFromIndex(const std::string& file_or_cu,
                          const CompilationVisitCallback& visit);
+  /// \brief Loads from each .kzip or .kindex named on stdin until EOF.
+  /// \param visit A callback to call for each compilation unit.
+  void LoadDataFromStdinNames(const CompilationVisitCallback& visit);
   /// \brief Load data from an unpacked file.
   /// \param default_filename The filename to use if we're reading from stdin.
   /// \param visit A callback to call for each compilation unit.
@@ -111,6 +131,8 @@ class IndexerContext {
   void CloseOutputStreams();
   /// \brief Configure the hash cache (if one was requested).
   void OpenHashCache();
+  /// \brief Configure the unit cost model (if one was requested).
+  void OpenCostModel();
 
   /// Command-line arguments, pruned of empty strings and gflags.
   std::vector<std::string> args_;
@@ -120,12 +142,29 @@ class IndexerContext {
   int write_fd_ = -1;
   /// Wraps `write_fd_`.
   std::unique_ptr<google::protobuf::io::FileOutputStream> raw_output_;
-  /// Wraps `raw_output_`.
+  /// Writes to `raw_output_` on a background thread (or null).
+  std::unique_ptr<AsyncOutputStream> async_output_;
+  /// Compresses output to `async_output_` or `raw_output_` (or null).
+  std::unique_ptr<SnappyOutputStream> snappy_output_;
+  /// Wraps the first of `snappy_output_`, `async_output_` and `raw_output_`
+  /// that is set.
   std::unique_ptr<FileOutputStream> kythe_output_;
+  /// The mapped static claim table that `claim_client_` reads (or null).
+  std::unique_ptr<ClaimTable> claim_table_;
   /// The claim client to use during analysis.
   std::unique_ptr<kythe::KytheClaimClient> claim_client_;
+  /// `claim_client_`, if it makes dynamic claims (or null).
+  DynamicClaimClient* dynamic_claim_client_ = nullptr;
   /// The hash cache to use during analysis (or null).
   std::unique_ptr<HashCache> hash_cache_;
+  /// `hash_cache_`, if it keeps a local tier (or null).
+  TieredHashCache* tiered_hash_cache_ = nullptr;
+  /// The filter for duplicate entries (or null).
+  std::unique_ptr<EntryFingerprintFilter> entry_filter_;
+  /// File content shared between units read from kzips (or null).
+  std::unique_ptr<FileContentCache> file_cache_;
+  /// Orders the units read from each kzip (or null, to keep their order).
+  std::unique_ptr<UnitCostModel> cost_model_;
   /// Whether the args specify an unpacked input file as opposed to an index.
   bool unpacked_inputs_ = false;
   /// Whether to ignore missing cases during analysis.
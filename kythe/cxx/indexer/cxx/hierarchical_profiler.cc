@@ -0,0 +1,180 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/hierarchical_profiler.h"
+
+#include <malloc.h>
+
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "glog/logging.h"
+#include "kythe/cxx/indexer/cxx/allocation_counter.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Appends `text` to `out` as a quoted JSON string.
+void AppendJsonString(absl::string_view text, std::string* out) {
+  out->push_back('"');
+  for (char c : text) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          absl::StrAppendFormat(out, "\\u%04x", c);
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+void AppendSection(const HierarchicalProfiler::Section& section, int depth,
+                   std::string* out) {
+  absl::StrAppendFormat(
+      out, "%-48s %10d %12.3f %12.3f %14d\n",
+      absl::StrCat(std::string(depth * 2, ' '), section.name), section.count,
+      absl::ToDoubleMilliseconds(section.total_time),
+      absl::ToDoubleMilliseconds(section.self_time()),
+      section.allocated_bytes);
+  for (const auto& child : section.children) {
+    AppendSection(*child, depth + 1, out);
+  }
+}
+
+}  // anonymous namespace
+
+int64_t HierarchicalProfiler::CurrentAllocatedBytes() {
+  if (kAllocationCountersEnabled) {
+    // Only counts this thread, so concurrent units don't blur each other.
+    return ThreadAllocationCounts().retained();
+  }
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return static_cast<int64_t>(::mallinfo2().uordblks);
+#else
+  return 0;
+#endif
+}
+
+HierarchicalProfiler::HierarchicalProfiler(
+    std::function<absl::Time()> clock,
+    std::function<int64_t()> allocated_bytes, size_t max_trace_events)
+    : clock_(std::move(clock)),
+      allocated_bytes_(std::move(allocated_bytes)),
+      max_trace_events_(max_trace_events) {}
+
+void HierarchicalProfiler::Enter(absl::string_view name) {
+  Section* parent = stack_.empty() ? &root_ : stack_.back().section;
+  Section* section = nullptr;
+  for (const auto& child : parent->children) {
+    if (child->name == name) {
+      section = child.get();
+      break;
+    }
+  }
+  if (section == nullptr) {
+    parent->children.push_back(absl::make_unique<Section>());
+    section = parent->children.back().get();
+    section->name = std::string(name);
+  }
+  ++section->count;
+  stack_.push_back(
+      {section, clock_(), allocated_bytes_ ? allocated_bytes_() : 0});
+}
+
+void HierarchicalProfiler::Exit(absl::string_view name) {
+  CHECK(!stack_.empty()) << "Exited " << name << " without entering it";
+  Frame frame = stack_.back();
+  stack_.pop_back();
+  DCHECK_EQ(frame.section->name, name);
+  absl::Duration elapsed = clock_() - frame.start;
+  frame.section->total_time += elapsed;
+  if (allocated_bytes_) {
+    frame.section->allocated_bytes +=
+        allocated_bytes_() - frame.start_allocated_bytes;
+  }
+  if (!stack_.empty()) {
+    stack_.back().section->child_time += elapsed;
+  } else {
+    root_.total_time += elapsed;
+  }
+  if (events_.size() < max_trace_events_) {
+    events_.push_back({frame.section, frame.start, elapsed});
+  } else {
+    ++dropped_events_;
+  }
+}
+
+void HierarchicalProfiler::AppendSummary(std::string* out) const {
+  absl::StrAppendFormat(out, "%-48s %10s %12s %12s %14s\n", "section", "count",
+                        "total_ms", "self_ms", "alloc_bytes");
+  for (const auto& child : root_.children) {
+    AppendSection(*child, 0, out);
+  }
+  if (dropped_events_ != 0) {
+    absl::StrAppendFormat(out, "(%d trace events dropped)\n", dropped_events_);
+  }
+}
+
+void ChromeTraceWriter::AddUnit(absl::string_view unit,
+                                const HierarchicalProfiler& profile) {
+  int tid;
+  {
+    absl::MutexLock lock(&mutex_);
+    tid = next_tid_++;
+  }
+  // Format outside the lock so that units finishing together don't contend.
+  std::string events =
+      absl::StrFormat("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                      "\"tid\":%d,\"args\":{\"name\":",
+                      tid);
+  AppendJsonString(unit, &events);
+  events.append("}}");
+  for (const auto& event : profile.trace_events()) {
+    events.append(",{\"name\":");
+    AppendJsonString(event.section->name, &events);
+    absl::StrAppendFormat(
+        &events, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%d,\"dur\":%d}",
+        tid, absl::ToInt64Microseconds(event.start - epoch_),
+        absl::ToInt64Microseconds(event.duration));
+  }
+  absl::MutexLock lock(&mutex_);
+  if (!events_.empty()) {
+    events_.push_back(',');
+  }
+  events_.append(events);
+}
+
+std::string ChromeTraceWriter::Finish() const {
+  absl::MutexLock lock(&mutex_);
+  return absl::StrCat("{\"traceEvents\":[", events_,
+                      "],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+}  // namespace kythe
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_HIERARCHICAL_PROFILER_H_
+#define KYTHE_CXX_INDEXER_CXX_HIERARCHICAL_PROFILER_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace kythe {
+
+/// \brief Aggregates nested profiling sections into a tree of timers.
+///
+/// Sections are entered and left in strict LIFO order (as with
+/// `ProfileBlock`). Each distinct path of section names gets its own node,
+/// which counts how often it was entered along with its total time, the part
+/// of that time not spent in child sections, and (optionally) the change in
+/// allocated heap bytes. Completed sections are also kept as trace events,
+/// up to a limit. A profiler is not thread-safe and is meant to cover a
+/// single compilation unit.
+class HierarchicalProfiler {
+ public:
+  /// \brief A node in the section tree.
+  struct Section {
+    /// The section's label.
+    std::string name;
+    /// The number of times the section was entered.
+    size_t count = 0;
+    /// The time spent in the section, including its children.
+    absl::Duration total_time;
+    /// The time spent in the section's children.
+    absl::Duration child_time;
+    /// The net change in allocated bytes while in the section.
+    int64_t allocated_bytes = 0;
+    /// Sections entered from this one, in order of first entry.
+    std::vector<std::unique_ptr<Section>> children;
+
+    /// \return the time spent in this section but not in its children.
+    absl::Duration self_time() const { return total_time - child_time; }
+  };
+
+  /// \brief A completed section.
+  struct TraceEvent {
+    const Section* section;
+    absl::Time start;
+    absl::Duration duration;
+  };
+
+  /// \brief Returns the number of heap bytes currently allocated or 0 if
+  /// that cannot be determined. Built with allocation counters (see
+  /// allocation_counter.h), this counts the calling thread's net
+  /// allocations; otherwise it asks malloc about the whole process.
+  static int64_t CurrentAllocatedBytes();
+
+  /// \param clock Returns the current time.
+  /// \param allocated_bytes Returns the number of allocated heap bytes, or
+  /// null to skip allocation tracking.
+  /// \param max_trace_events The number of trace events to keep.
+  explicit HierarchicalProfiler(
+      std::function<absl::Time()> clock = [] { return absl::Now(); },
+      std::function<int64_t()> allocated_bytes = nullptr,
+      size_t max_trace_events = 1 << 20);
+
+  HierarchicalProfiler(const HierarchicalProfiler&) = delete;
+  HierarchicalProfiler& operator=(const HierarchicalProfiler&) = delete;
+
+  /// \brief Enters the section labeled `name` below the current one.
+  void Enter(absl::string_view name);
+
+  /// \brief Leaves the current section, which should be labeled `name`.
+  void Exit(absl::string_view name);
+
+  /// \return the (unnamed) root of the section tree.
+  const Section& root() const { return root_; }
+
+  /// \return the completed sections, in order of completion.
+  const std::vector<TraceEvent>& trace_events() const { return events_; }
+
+  /// \return the number of completed sections that were not kept.
+  size_t dropped_trace_events() const { return dropped_events_; }
+
+  /// \brief Appends an indented table of the section tree to `out`.
+  void AppendSummary(std::string* out) const;
+
+ private:
+  /// \brief An open section.
+  struct Frame {
+    Section* section;
+    absl::Time start;
+    int64_t start_allocated_bytes;
+  };
+
+  const std::function<absl::Time()> clock_;
+  const std::function<int64_t()> allocated_bytes_;
+  const size_t max_trace_events_;
+  Section root_;
+  std::vector<Frame> stack_;
+  std::vector<TraceEvent> events_;
+  size_t dropped_events_ = 0;
+};
+
+/// \brief Collects profiles from many units into one Chrome trace-event
+/// JSON document (loadable by chrome://tracing or Perfetto). Thread-safe.
+class ChromeTraceWriter {
+ public:
+  /// \param epoch The time that trace timestamps are relative to.
+  explicit ChromeTraceWriter(absl::Time epoch = absl::Now()) : epoch_(epoch) {}
+
+  /// \brief Adds the trace events from `profile`, labeling them with `unit`.
+  void AddUnit(absl::string_view unit, const HierarchicalProfiler& profile);
+
+  /// \return the complete JSON document.
+  std::string Finish() const;
+
+ private:
+  const absl::Time epoch_;
+  mutable absl::Mutex mutex_;
+  /// Comma-separated JSON objects, one per trace event.
+  std::string events_ ABSL_GUARDED_BY(mutex_);
+  /// The trace thread id to give the next unit.
+  int next_tid_ ABSL_GUARDED_BY(mutex_) = 1;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_HIERARCHICAL_PROFILER_H_
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/hierarchical_profiler.h"
+
+#include <string>
+
+#include "absl/strings/match.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+class HierarchicalProfilerTest : public ::testing::Test {
+ protected:
+  absl::Time now_ = absl::UnixEpoch();
+  int64_t allocated_ = 0;
+  HierarchicalProfiler profiler_{[this] { return now_; },
+                                 [this] { return allocated_; }, 3};
+};
+
+TEST_F(HierarchicalProfilerTest, AggregatesNestedSections) {
+  profiler_.Enter("outer");
+  now_ += absl::Milliseconds(1);
+  for (int i = 0; i < 2; ++i) {
+    profiler_.Enter("inner");
+    now_ += absl::Milliseconds(2);
+    allocated_ += 100;
+    profiler_.Exit("inner");
+  }
+  profiler_.Exit("outer");
+
+  const auto& root = profiler_.root();
+  ASSERT_EQ(root.children.size(), 1);
+  const auto& outer = *root.children[0];
+  EXPECT_EQ(outer.name, "outer");
+  EXPECT_EQ(outer.count, 1);
+  EXPECT_EQ(outer.total_time, absl::Milliseconds(5));
+  EXPECT_EQ(outer.self_time(), absl::Milliseconds(1));
+  EXPECT_EQ(outer.allocated_bytes, 200);
+  ASSERT_EQ(outer.children.size(), 1);
+  const auto& inner = *outer.children[0];
+  EXPECT_EQ(inner.count, 2);
+  EXPECT_EQ(inner.total_time, absl::Milliseconds(4));
+  EXPECT_EQ(inner.self_time(), absl::Milliseconds(4));
+  EXPECT_EQ(inner.allocated_bytes, 200);
+  EXPECT_EQ(root.total_time, absl::Milliseconds(5));
+}
+
+TEST_F(HierarchicalProfilerTest, SameNameUnderDifferentParents) {
+  profiler_.Enter("a");
+  profiler_.Enter("c");
+  profiler_.Exit("c");
+  profiler_.Exit("a");
+  profiler_.Enter("b");
+  profiler_.Enter("c");
+  profiler_.Exit("c");
+  profiler_.Exit("b");
+  const auto& root = profiler_.root();
+  ASSERT_EQ(root.children.size(), 2);
+  EXPECT_EQ(root.children[0]->children.size(), 1);
+  EXPECT_EQ(root.children[1]->children.size(), 1);
+}
+
+TEST_F(HierarchicalProfilerTest, LimitsTraceEvents) {
+  for (int i = 0; i < 5; ++i) {
+    profiler_.Enter("x");
+    profiler_.Exit("x");
+  }
+  EXPECT_EQ(profiler_.trace_events().size(), 3);
+  EXPECT_EQ(profiler_.dropped_trace_events(), 2);
+  std::string summary;
+  profiler_.AppendSummary(&summary);
+  EXPECT_TRUE(absl::StrContains(summary, "(2 trace events dropped)"));
+}
+
+TEST_F(HierarchicalProfilerTest, WritesChromeTrace) {
+  profiler_.Enter("run_invocation");
+  now_ += absl::Microseconds(7);
+  profiler_.Exit("run_invocation");
+  ChromeTraceWriter writer(absl::UnixEpoch());
+  writer.AddUnit("a\"b.cc", profiler_);
+  EXPECT_EQ(writer.Finish(),
+            "{\"traceEvents\":["
+            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+            "\"args\":{\"name\":\"a\\\"b.cc\"}},"
+            "{\"name\":\"run_invocation\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":0,\"dur\":7}"
+            "],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+}  // namespace
+}  // namespace kythe
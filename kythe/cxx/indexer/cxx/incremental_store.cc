@@ -0,0 +1,222 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/incremental_store.h"
+
+#include <openssl/sha.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+
+namespace kythe {
+namespace {
+
+void HashWithLength(absl::string_view text, SHA256_CTX* sha) {
+  uint64_t size = text.size();
+  ::SHA256_Update(sha, &size, sizeof(size));
+  ::SHA256_Update(sha, text.data(), text.size());
+}
+
+std::string FinishHash(SHA256_CTX* sha) {
+  std::string hash(SHA256_DIGEST_LENGTH, '\0');
+  ::SHA256_Final(reinterpret_cast<unsigned char*>(&hash[0]), sha);
+  return hash;
+}
+
+}  // anonymous namespace
+
+std::string IncrementalStore::PathForKey(absl::string_view key) const {
+  return absl::StrCat(directory_, "/", key);
+}
+
+bool IncrementalStore::Read(absl::string_view key, std::string* block) {
+  std::ifstream file(PathForKey(key), std::ios::binary);
+  if (!file) {
+    ++misses_;
+    return false;
+  }
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  if (file.bad()) {
+    ++misses_;
+    return false;
+  }
+  *block = contents.str();
+  ++hits_;
+  return true;
+}
+
+bool IncrementalStore::Write(absl::string_view key, absl::string_view block) {
+  // Readers must never see part of a block, so it's written elsewhere first
+  // and renamed into place.
+  const std::string path = PathForKey(key);
+  const std::string temp_path = absl::StrCat(
+      path, ".tmp.", ::getpid(), ".",
+      std::hash<std::thread::id>()(std::this_thread::get_id()));
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    file.write(block.data(), block.size());
+    if (!file) {
+      std::remove(temp_path.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+IncrementalKeyChain::IncrementalKeyChain(absl::string_view seed) {
+  ::SHA256_CTX sha;
+  ::SHA256_Init(&sha);
+  HashWithLength(kIncrementalStoreVersion, &sha);
+  HashWithLength(seed, &sha);
+  chain_ = FinishHash(&sha);
+}
+
+void IncrementalKeyChain::Enter(absl::string_view digest) {
+  if (digest.empty()) {
+    broken_ = true;
+  }
+  if (broken_) {
+    return;
+  }
+  ::SHA256_CTX sha;
+  ::SHA256_Init(&sha);
+  ::SHA256_Update(&sha, chain_.data(), chain_.size());
+  HashWithLength(digest, &sha);
+  chain_ = FinishHash(&sha);
+}
+
+std::string IncrementalKeyChain::Key(const proto::VName& claim) const {
+  if (broken_) {
+    return "";
+  }
+  ::SHA256_CTX sha;
+  ::SHA256_Init(&sha);
+  ::SHA256_Update(&sha, chain_.data(), chain_.size());
+  HashWithLength(claim.signature(), &sha);
+  HashWithLength(claim.corpus(), &sha);
+  HashWithLength(claim.root(), &sha);
+  HashWithLength(claim.path(), &sha);
+  HashWithLength(claim.language(), &sha);
+  return absl::BytesToHexString(FinishHash(&sha));
+}
+
+void BlockRecordingOutput::Record() {
+  google::protobuf::io::StringOutputStream stream(block_);
+  google::protobuf::io::CodedOutputStream output(&stream);
+  output.WriteVarint32(entry_.ByteSizeLong());
+  entry_.SerializeWithCachedSizes(&output);
+}
+
+void BlockRecordingOutput::Emit(const FactRef& fact) {
+  output_->Emit(fact);
+  if (block_ != nullptr) {
+    entry_.Clear();
+    fact.Expand(&entry_);
+    Record();
+  }
+}
+
+void BlockRecordingOutput::Emit(const EdgeRef& edge) {
+  output_->Emit(edge);
+  if (block_ != nullptr) {
+    entry_.Clear();
+    edge.Expand(&entry_);
+    Record();
+  }
+}
+
+void BlockRecordingOutput::Emit(const OrdinalEdgeRef& edge) {
+  output_->Emit(edge);
+  if (block_ != nullptr) {
+    entry_.Clear();
+    edge.Expand(&entry_);
+    Record();
+  }
+}
+
+void BlockRecordingOutput::Emit(absl::Span<const FactRef> facts) {
+  output_->Emit(facts);
+  if (block_ != nullptr) {
+    for (const auto& fact : facts) {
+      entry_.Clear();
+      fact.Expand(&entry_);
+      Record();
+    }
+  }
+}
+
+void BlockRecordingOutput::Emit(absl::Span<const EdgeRef> edges) {
+  output_->Emit(edges);
+  if (block_ != nullptr) {
+    for (const auto& edge : edges) {
+      entry_.Clear();
+      edge.Expand(&entry_);
+      Record();
+    }
+  }
+}
+
+void BlockRecordingOutput::Emit(absl::Span<const OrdinalEdgeRef> edges) {
+  output_->Emit(edges);
+  if (block_ != nullptr) {
+    for (const auto& edge : edges) {
+      entry_.Clear();
+      edge.Expand(&entry_);
+      Record();
+    }
+  }
+}
+
+bool ReplayBlock(absl::string_view block, KytheOutputStream* output) {
+  google::protobuf::io::CodedInputStream input(
+      reinterpret_cast<const uint8_t*>(block.data()), block.size());
+  proto::Entry entry;
+  uint32_t size;
+  while (input.ReadVarint32(&size)) {
+    auto limit = input.PushLimit(size);
+    if (!entry.ParseFromCodedStream(&input) ||
+        !input.ConsumedEntireMessage()) {
+      return false;
+    }
+    input.PopLimit(limit);
+    VNameRef source(entry.source());
+    if (entry.edge_kind().empty()) {
+      output->Emit(FactRef{&source, entry.fact_name(), entry.fact_value()});
+    } else {
+      // Edges with ordinals were recorded with the ordinal in their kind,
+      // which is how they are written in any case.
+      VNameRef target(entry.target());
+      output->Emit(EdgeRef{&source, entry.edge_kind(), &target});
+    }
+  }
+  return input.CurrentPosition() == static_cast<int>(block.size());
+}
+
+}  // namespace kythe
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_INCREMENTAL_STORE_H_
+#define KYTHE_CXX_INDEXER_CXX_INCREMENTAL_STORE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+
+/// \brief Identifies the format of blocks and the version of the indexer that
+/// writes them; every key depends on it. Change it whenever the indexer would
+/// emit something different for the same key or the block format changes.
+constexpr char kIncrementalStoreVersion[] = "kythe-cxx-incremental-2";
+
+/// \brief A content-addressed store of the entries that units emitted while
+/// traversing the declarations in the files they claimed.
+///
+/// Each file a unit claims gets one block, keyed (see `IncrementalKeyChain`)
+/// by the file's claimed VName, which includes its transcript, and by the
+/// digests of every file the unit entered. A later unit that arrives at a
+/// block with the same key can emit the block instead of traversing the
+/// file's declarations again. The store is a
+/// directory holding one file per block. Indexers may share it concurrently,
+/// but only if they are the same binary run with the same flags.
+class IncrementalStore {
+ public:
+  /// \param directory An existing directory to keep blocks in.
+  explicit IncrementalStore(std::string directory)
+      : directory_(std::move(directory)) {}
+  IncrementalStore(const IncrementalStore&) = delete;
+  IncrementalStore& operator=(const IncrementalStore&) = delete;
+
+  /// \brief Reads the block stored under `key` into `block`.
+  /// \return false if there is no such block.
+  bool Read(absl::string_view key, std::string* block);
+
+  /// \brief Stores `block` under `key`, replacing any earlier block.
+  /// \return false if the block couldn't be written.
+  bool Write(absl::string_view key, absl::string_view block);
+
+  /// \return the number of calls to `Read` that found a block.
+  uint64_t hits() const { return hits_; }
+  /// \return the number of calls to `Read` that didn't.
+  uint64_t misses() const { return misses_; }
+
+ private:
+  /// \return the path of the file holding the block for `key`.
+  std::string PathForKey(absl::string_view key) const;
+
+  /// The directory holding the blocks.
+  const std::string directory_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+};
+
+/// \brief Computes the keys of the blocks for the files a unit claims.
+///
+/// Declarations are only traversed once the whole unit has been parsed, so
+/// any file the unit entered, even one entered after a claimed file was left,
+/// can change what traversing that file's declarations emits: a later header
+/// may complete a type that the file only forward-declares. Blocks are
+/// therefore keyed once every file has been entered.
+class IncrementalKeyChain {
+ public:
+  /// \param seed Identifies the rest of the unit's configuration, such as
+  /// its arguments and the options that affect the output. It is combined
+  /// with `kIncrementalStoreVersion`.
+  explicit IncrementalKeyChain(absl::string_view seed);
+
+  /// \brief Records that the unit entered a file with the content digest
+  /// `digest`. If the digest isn't known (and `digest` is empty), no later
+  /// file gets a key.
+  void Enter(absl::string_view digest);
+
+  /// \return the key for the block of the file claimed as `claim`, given
+  /// the files entered so far, or an empty string if there is none.
+  std::string Key(const proto::VName& claim) const;
+
+ private:
+  /// The hash of the seed and the digests entered so far.
+  std::string chain_;
+  /// Set once a file without a digest has been entered.
+  bool broken_ = false;
+};
+
+/// \brief An output stream that forwards to another and copies the entries
+/// emitted while a block is open into that block.
+class BlockRecordingOutput : public KytheCachingOutput {
+ public:
+  /// \param output The stream to forward to. Not owned; must outlive this.
+  explicit BlockRecordingOutput(KytheCachingOutput* output)
+      : output_(output) {}
+
+  /// \brief Copies the entries emitted from now on to `block`, or stops
+  /// copying them if `block` is null.
+  void set_block(std::string* block) { block_ = block; }
+
+  void Emit(const FactRef& fact) override;
+  void Emit(const EdgeRef& edge) override;
+  void Emit(const OrdinalEdgeRef& edge) override;
+  void Emit(absl::Span<const FactRef> facts) override;
+  void Emit(absl::Span<const EdgeRef> edges) override;
+  void Emit(absl::Span<const OrdinalEdgeRef> edges) override;
+  void PushBuffer() override { output_->PushBuffer(); }
+  void PopBuffer() override { output_->PopBuffer(); }
+  void UseHashCache(HashCache* cache) override { output_->UseHashCache(cache); }
+
+ private:
+  /// \brief Appends `entry_` to `block_`.
+  void Record();
+
+  KytheCachingOutput* output_;
+  /// The open block, if any.
+  std::string* block_ = nullptr;
+  /// Reused to expand each recorded entry.
+  proto::Entry entry_;
+};
+
+/// \brief Emits each entry in `block`, as recorded by `BlockRecordingOutput`,
+/// to `output`.
+/// \return false if `block` is malformed; some of its entries may have been
+/// emitted.
+bool ReplayBlock(absl::string_view block, KytheOutputStream* output);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_INCREMENTAL_STORE_H_
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/incremental_store.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+/// \brief Remembers the entries emitted to it as strings.
+class CollectingOutput : public KytheCachingOutput {
+ public:
+  using KytheOutputStream::Emit;
+  void Emit(const FactRef& fact) override {
+    entries.push_back(absl::StrCat(fact.source->DebugString(), " ",
+                                   fact.fact_name, " ", fact.fact_value));
+  }
+  void Emit(const EdgeRef& edge) override {
+    entries.push_back(absl::StrCat(edge.source->DebugString(), " ",
+                                   edge.edge_kind, " ",
+                                   edge.target->DebugString()));
+  }
+  void Emit(const OrdinalEdgeRef& edge) override {
+    entries.push_back(absl::StrCat(edge.source->DebugString(), " ",
+                                   edge.edge_kind, ".", edge.ordinal, " ",
+                                   edge.target->DebugString()));
+  }
+
+  std::vector<std::string> entries;
+};
+
+proto::VName MakeVName(const std::string& signature) {
+  proto::VName vname;
+  vname.set_corpus("corpus");
+  vname.set_path("a.h");
+  vname.set_signature(signature);
+  return vname;
+}
+
+TEST(IncrementalKeyChainTest, KeysDependOnEveryFileEntered) {
+  const proto::VName claim = MakeVName("ctx");
+  IncrementalKeyChain chain("-std=c++17");
+  chain.Enter("main");
+  chain.Enter("a");
+  const std::string key = chain.Key(claim);
+  EXPECT_FALSE(key.empty());
+  EXPECT_NE(key, chain.Key(MakeVName("other ctx")));
+
+  IncrementalKeyChain same("-std=c++17");
+  same.Enter("main");
+  same.Enter("a");
+  EXPECT_EQ(key, same.Key(claim));
+
+  IncrementalKeyChain changed("-std=c++17");
+  changed.Enter("main2");
+  changed.Enter("a");
+  EXPECT_NE(key, changed.Key(claim));
+
+  IncrementalKeyChain other_seed("-std=c++14");
+  other_seed.Enter("main");
+  other_seed.Enter("a");
+  EXPECT_NE(key, other_seed.Key(claim));
+
+  chain.Enter("b");
+  EXPECT_NE(key, chain.Key(claim));
+  chain.Enter("");
+  EXPECT_TRUE(chain.Key(claim).empty());
+  chain.Enter("c");
+  EXPECT_TRUE(chain.Key(claim).empty());
+}
+
+TEST(BlockRecordingOutputTest, RecordsOnlyWhileABlockIsOpen) {
+  CollectingOutput direct;
+  CollectingOutput forwarded;
+  BlockRecordingOutput recording(&forwarded);
+  const proto::VName source_vname = MakeVName("s");
+  const proto::VName target_vname = MakeVName("t");
+  VNameRef source(source_vname);
+  VNameRef target(target_vname);
+
+  recording.Emit(FactRef{&source, "/kythe/node/kind", "before"});
+  std::string block;
+  recording.set_block(&block);
+  const FactRef fact{&source, "/kythe/node/kind", "record"};
+  const EdgeRef edge{&source, "/kythe/edge/ref", &target};
+  const OrdinalEdgeRef ordinal_edge{&source, "/kythe/edge/param", &target, 2};
+  recording.Emit(fact);
+  recording.Emit(absl::MakeConstSpan(&edge, 1));
+  recording.Emit(ordinal_edge);
+  direct.Emit(fact);
+  direct.Emit(edge);
+  direct.Emit(EdgeRef{&source, "/kythe/edge/param.2", &target});
+  recording.set_block(nullptr);
+  recording.Emit(FactRef{&source, "/kythe/node/kind", "after"});
+  EXPECT_EQ(5, forwarded.entries.size());
+
+  CollectingOutput replayed;
+  ASSERT_TRUE(ReplayBlock(block, &replayed));
+  EXPECT_EQ(direct.entries, replayed.entries);
+  EXPECT_FALSE(ReplayBlock(block.substr(0, block.size() - 1), &replayed));
+}
+
+TEST(IncrementalStoreTest, ReadsWrittenBlocks) {
+  const char* temp_dir = std::getenv("TEST_TMPDIR");
+  IncrementalStore store(temp_dir != nullptr ? temp_dir : "/tmp");
+  IncrementalKeyChain chain("store test");
+  chain.Enter("digest");
+  const std::string key = chain.Key(MakeVName("ctx"));
+  std::string block;
+  EXPECT_FALSE(store.Read(key, &block));
+  ASSERT_TRUE(store.Write(key, std::string("\0block", 6)));
+  ASSERT_TRUE(store.Read(key, &block));
+  EXPECT_EQ(std::string("\0block", 6), block);
+  ASSERT_TRUE(store.Write(key, ""));
+  ASSERT_TRUE(store.Read(key, &block));
+  EXPECT_TRUE(block.empty());
+  EXPECT_EQ(2, store.hits());
+  EXPECT_EQ(1, store.misses());
+}
+
+}  // namespace
+}  // namespace kythe
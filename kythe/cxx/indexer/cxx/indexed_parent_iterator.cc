@@ -46,7 +46,12 @@ RootTraversal::iterator RootTraversal::iterator::next() const {
     if (const auto* decl = GetDeclInContext(current_->decl)) {
       return iterator(parent_map_, decl);
     }
-    return iterator(parent_map_, current_->indexed_parent->parent);
+    // Follow the link to the parent's own IndexedParent rather than looking
+    // the parent up again.
+    const IndexedParent& parent = *current_->indexed_parent;
+    return iterator(parent_map_, parent.parent,
+                    parent.parent.get<clang::Decl>(),
+                    parent_map_->GetNextIndexedParent(parent));
   }
   return iterator();
 }
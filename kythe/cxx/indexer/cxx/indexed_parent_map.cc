@@ -15,6 +15,13 @@
  */
 #include "indexed_parent_map.h"
 
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "clang/AST/DeclTemplate.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "glog/logging.h"
 #include "kythe/cxx/common/scope_guard.h"
@@ -56,20 +63,142 @@ bool IsClaimableForTraverse(const clang::Decl* decl) {
 /// `stmt` has been traversed previously.
 bool IsClaimableForTraverse(const clang::Stmt* S) { return false; }
 
-template <typename MappingType>
+/// \return `true` if `decl` is traversed through some other node rather than
+/// through the DeclContext that contains it.
+bool IsTraversedElsewhere(const clang::Decl* decl) {
+  // These match RecursiveASTVisitor's
+  // canIgnoreChildDeclWhileTraversingDeclContext.
+  if (clang::isa<clang::BlockDecl>(decl) ||
+      clang::isa<clang::CapturedDecl>(decl)) {
+    return true;
+  }
+  if (const auto* record = dyn_cast<clang::CXXRecordDecl>(decl)) {
+    return record->isLambda();
+  }
+  return false;
+}
+
+/// \return a decl from which the parent map's traversal reaches `decl`, or
+/// null if there isn't an obvious one.
+const clang::Decl* GetTraversalAncestor(const clang::Decl* decl) {
+  // Templated decls and implicit instantiations are traversed through their
+  // templates.
+  if (const auto* record = dyn_cast<clang::CXXRecordDecl>(decl)) {
+    if (const auto* tmpl = record->getDescribedClassTemplate()) {
+      return tmpl;
+    }
+    if (const auto* spec =
+            dyn_cast<clang::ClassTemplateSpecializationDecl>(record)) {
+      if (!spec->isExplicitInstantiationOrSpecialization()) {
+        return spec->getSpecializedTemplate()->getCanonicalDecl();
+      }
+    }
+  } else if (const auto* function = dyn_cast<clang::FunctionDecl>(decl)) {
+    if (const auto* tmpl = function->getDescribedFunctionTemplate()) {
+      return tmpl;
+    }
+    if (const auto* info = function->getTemplateSpecializationInfo()) {
+      if (!info->isExplicitInstantiationOrSpecialization()) {
+        return info->getTemplate()->getCanonicalDecl();
+      }
+    }
+  } else if (const auto* var = dyn_cast<clang::VarDecl>(decl)) {
+    if (const auto* tmpl = var->getDescribedVarTemplate()) {
+      return tmpl;
+    }
+  }
+  const clang::DeclContext* context = decl->getLexicalDeclContext();
+  if (context == nullptr || clang::isa<clang::TranslationUnitDecl>(context)) {
+    return nullptr;
+  }
+  return clang::Decl::castFromDeclContext(context);
+}
+
+/// Finds out whether a subtree contains any node for which
+/// `IsClaimableForTraverse` holds, stopping at the first one. This is
+/// the same as the `claimable` bit the parent map computes, but doesn't
+/// record anything along the way.
+class ClaimableNodeFinder
+    : private clang::RecursiveASTVisitor<ClaimableNodeFinder> {
+ public:
+  /// \return `true` if `decl` or any node underneath it is claimable.
+  static bool SubtreeHasClaimableNode(clang::Decl* decl) {
+    ClaimableNodeFinder finder;
+    finder.TraverseDecl(decl);
+    return finder.found_;
+  }
+
+ private:
+  using VisitorBase = clang::RecursiveASTVisitor<ClaimableNodeFinder>;
+  friend class clang::RecursiveASTVisitor<ClaimableNodeFinder>;
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+  bool TraverseDecl(clang::Decl* decl) {
+    if (decl != nullptr && IsClaimableForTraverse(decl)) {
+      found_ = true;
+      return false;  // Stop the traversal.
+    }
+    return VisitorBase::TraverseDecl(decl);
+  }
+
+  bool found_ = false;
+};
+
+/// \brief Links `parent` to the IndexedParent at `up` in `storage`, which
+/// is the one for `parent.parent` (or `kNone` for the root).
+///
+/// Jump pointers follow Myers' skew-binary scheme: a node jumps past its
+/// parent's jump when that jump and the one after it cover the same
+/// distance, and to its parent otherwise. The root is taken to be at depth
+/// -1 and to jump to itself.
+template <typename StorageType>
+void LinkParent(const StorageType& storage, uint32_t up,
+                IndexedParent* parent) {
+  constexpr uint32_t kNone = IndexedParent::kNone;
+  parent->up = up;
+  if (up == kNone) {
+    parent->depth = 0;
+    parent->jump = kNone;
+    return;
+  }
+  const IndexedParent& above = storage[up];
+  parent->depth = above.depth + 1;
+  parent->jump = up;
+  if (above.jump != kNone) {
+    const IndexedParent& jump = storage[above.jump];
+    const int64_t beyond =
+        jump.jump == kNone ? -1 : int64_t{storage[jump.jump].depth};
+    if (int64_t{above.depth} - jump.depth == int64_t{jump.depth} - beyond) {
+      parent->jump = jump.jump;
+    }
+  }
+}
+
+template <typename MappingType, typename StorageType>
 class IndexedParentASTVisitor
-    : private clang::RecursiveASTVisitor<IndexedParentASTVisitor<MappingType>> {
+    : private clang::RecursiveASTVisitor<
+          IndexedParentASTVisitor<MappingType, StorageType>> {
  public:
-  static MappingType BuildIndexedParentMap(clang::TranslationUnitDecl* unit) {
-    IndexedParentASTVisitor visitor;
-    visitor.TraverseDecl(unit);
-    return std::move(visitor.parents_);
+  /// \brief Records the parents of the nodes in `root`'s subtree in
+  /// `parents` and `storage`. `root` itself is given `parent`, if not null.
+  static void AddSubtree(clang::Decl* root, const IndexedParent* parent,
+                         MappingType* parents, StorageType* storage) {
+    IndexedParentASTVisitor visitor(parents, storage);
+    if (parent != nullptr) {
+      visitor.parent_stack_.push_back(*parent);
+    }
+    visitor.TraverseDecl(root);
   }
 
  private:
   using VisitorBase = clang::RecursiveASTVisitor<IndexedParentASTVisitor>;
   friend class clang::RecursiveASTVisitor<IndexedParentASTVisitor>;
 
+  IndexedParentASTVisitor(MappingType* parents, StorageType* storage)
+      : parents_(*parents), storage_(*storage) {}
+
   bool shouldVisitTemplateInstantiations() const { return true; }
   bool shouldVisitImplicitCode() const { return true; }
   // Disables data recursion. We intercept Traverse* methods in the RAV, which
@@ -85,18 +214,24 @@ class IndexedParentASTVisitor
   bool TraverseNode(T* node, BaseTraverseFn traverse) {
     using ::clang::DynTypedNode;
     if (node == nullptr) return true;
+    // Where `node`'s own IndexedParent is stored, for its children to link
+    // to.
+    uint32_t up = IndexedParent::kNone;
     if (!parent_stack_.empty()) {
-      auto& parent = parents_[node];
-      if (parent.getPointer() == nullptr) {
-        parent.setPointer(new IndexedParent(parent_stack_.back()));
+      auto [entry, inserted] = parents_.try_emplace(node);
+      if (inserted) {
+        CHECK_LT(storage_.size(), std::numeric_limits<uint32_t>::max());
+        entry->second.parent = storage_.size();
+        storage_.push_back(parent_stack_.back());
       }
+      up = entry->second.parent;
     }
 
     bool saved_claimable = claimable_at_this_depth_;
     auto scope = MakeScopeGuard([&] {
       if (claimable_at_this_depth_ || IsClaimableForTraverse(node)) {
         claimable_at_this_depth_ = true;  // for depth
-        parents_[node].setInt(1);
+        parents_[node].claimable = true;
       } else {
         claimable_at_this_depth_ = saved_claimable;
       }
@@ -107,6 +242,7 @@ class IndexedParentASTVisitor
     });
 
     parent_stack_.push_back({DynTypedNode::create(*node), 0});
+    LinkParent(storage_, up, &parent_stack_.back());
     claimable_at_this_depth_ = false;  // for depth + 1
     return traverse(node);
     // `scope` executes.
@@ -124,38 +260,194 @@ class IndexedParentASTVisitor
     });
   }
 
-  MappingType parents_;
+  MappingType& parents_;
+  StorageType& storage_;
   llvm::SmallVector<IndexedParent, 16> parent_stack_;
   bool claimable_at_this_depth_ = false;
 };
 }  // namespace
 
+struct IndexedParentMap::LazyState {
+  /// Marks the absence of a top-level decl index.
+  static constexpr size_t kNone = std::numeric_limits<size_t>::max();
+
+  /// Returns the index of the top-level decl whose subtree holds `decl`.
+  size_t FindTopLevelDecl(const clang::Decl* decl) const {
+    for (; decl != nullptr; decl = GetTraversalAncestor(decl)) {
+      const auto found = top_level_index.find(decl);
+      if (found != top_level_index.end()) {
+        return found->second;
+      }
+    }
+    return kNone;
+  }
+
+  /// The translation unit.
+  clang::TranslationUnitDecl* unit;
+  /// The translation unit's children, in traversal order.
+  std::vector<clang::Decl*> top_level_decls;
+  /// Maps from top-level decls to their indices in `top_level_decls`.
+  llvm::DenseMap<const clang::Decl*, size_t> top_level_index;
+  /// Whether each top-level decl's subtree has been walked.
+  std::vector<bool> walked;
+  /// The number of top-level decls that have not yet been walked.
+  size_t unwalked = 0;
+  /// The top-level decl most recently passed to `NoteTraversal`, if any.
+  size_t current = kNone;
+  /// Caches `DeclDominatesPrunableSubtree` for decls that haven't been
+  /// walked.
+  llvm::DenseMap<const clang::Decl*, bool> prunable;
+};
+
+IndexedParentMap::IndexedParentMap() = default;
+IndexedParentMap::IndexedParentMap(IndexedParentMap&&) = default;
+IndexedParentMap& IndexedParentMap::operator=(IndexedParentMap&&) = default;
+IndexedParentMap::~IndexedParentMap() = default;
+
 /* static */
 IndexedParentMap IndexedParentMap::Build(clang::TranslationUnitDecl* unit) {
-  return IndexedParentMap(
-      IndexedParentASTVisitor<MappingType>::BuildIndexedParentMap(unit));
+  IndexedParentMap map;
+  IndexedParentASTVisitor<MappingType, StorageType>::AddSubtree(
+      unit, nullptr, &map.parents_, &map.storage_);
+  return map;
 }
 
-const IndexedParent* IndexedParentMap::GetIndexedParent(
+/* static */
+IndexedParentMap IndexedParentMap::BuildLazily(
+    clang::TranslationUnitDecl* unit) {
+  IndexedParentMap map;
+  map.lazy_ = absl::make_unique<LazyState>();
+  map.lazy_->unit = unit;
+  for (clang::Decl* decl : unit->decls()) {
+    if (decl != nullptr && !IsTraversedElsewhere(decl)) {
+      map.lazy_->top_level_index.try_emplace(
+          decl, map.lazy_->top_level_decls.size());
+      map.lazy_->top_level_decls.push_back(decl);
+    }
+  }
+  map.lazy_->walked.resize(map.lazy_->top_level_decls.size(), false);
+  map.lazy_->unwalked = map.lazy_->top_level_decls.size();
+  return map;
+}
+
+const IndexedParentMap::Entry* IndexedParentMap::Find(const void* key) const {
+  const auto iter = parents_.find(key);
+  return iter == parents_.end() ? nullptr : &iter->second;
+}
+
+void IndexedParentMap::WalkTopLevelDecl(size_t index) const {
+  if (lazy_->walked[index]) {
+    return;
+  }
+  lazy_->walked[index] = true;
+  --lazy_->unwalked;
+  // Top-level decls are numbered as they would be when traversing the
+  // whole translation unit.
+  IndexedParent parent{clang::DynTypedNode::create(*lazy_->unit), index};
+  IndexedParentASTVisitor<MappingType, StorageType>::AddSubtree(
+      lazy_->top_level_decls[index], &parent, &parents_, &storage_);
+}
+
+void IndexedParentMap::FaultIn(const clang::DynTypedNode& node) const {
+  const void* key = node.getMemoizationData();
+  size_t index = LazyState::kNone;
+  if (const auto* decl = node.get<clang::Decl>()) {
+    if (clang::isa<clang::TranslationUnitDecl>(decl)) {
+      return;  // The root has no parent.
+    }
+    index = lazy_->FindTopLevelDecl(decl);
+  } else {
+    // Other nodes are usually asked about while their decl is traversed.
+    index = lazy_->current;
+  }
+  if (index != LazyState::kNone) {
+    WalkTopLevelDecl(index);
+    if (Find(key) != nullptr) {
+      return;
+    }
+  }
+  // We guessed wrong; walk everything that's left.
+  for (size_t i = 0; lazy_->unwalked != 0 && i < lazy_->walked.size(); ++i) {
+    WalkTopLevelDecl(i);
+  }
+}
+
+void IndexedParentMap::NoteTraversal(const clang::Decl* decl) const {
+  if (lazy_ != nullptr) {
+    size_t index = lazy_->FindTopLevelDecl(decl);
+    if (index != LazyState::kNone) {
+      lazy_->current = index;
+    }
+  }
+}
+
+const IndexedParentMap::Entry* IndexedParentMap::Lookup(
     const clang::DynTypedNode& node) const {
   CHECK(node.getMemoizationData() != nullptr)
       << "Invariant broken: only nodes that support memoization may be "
          "used in the parent map.";
-  const auto iter = parents_.find(node.getMemoizationData());
-  if (iter == parents_.end()) {
+  const Entry* entry = Find(node.getMemoizationData());
+  if (entry == nullptr && lazy_ != nullptr) {
+    FaultIn(node);
+    entry = Find(node.getMemoizationData());
+  }
+  return entry;
+}
+
+const IndexedParent* IndexedParentMap::GetIndexedParent(
+    const clang::DynTypedNode& node) const {
+  const Entry* entry = Lookup(node);
+  if (entry == nullptr || entry->parent == kNoParent) {
     return nullptr;
   }
-  return iter->second.getPointer();
+  return &storage_[entry->parent];
+}
+
+uint32_t IndexedParentMap::AncestorAtDepth(uint32_t position,
+                                           uint32_t depth) const {
+  while (position != kNoParent && storage_[position].depth > depth) {
+    const IndexedParent& current = storage_[position];
+    const bool can_jump =
+        current.jump != kNoParent && storage_[current.jump].depth >= depth;
+    position = can_jump ? current.jump : current.up;
+  }
+  return position;
+}
+
+bool IndexedParentMap::IsUnderneath(const clang::DynTypedNode& node,
+                                    const clang::DynTypedNode& ancestor) const {
+  const Entry* entry = Lookup(node);
+  if (entry == nullptr || entry->parent == kNoParent) {
+    return false;
+  }
+  const Entry* ancestor_entry = Lookup(ancestor);
+  if (ancestor_entry == nullptr || ancestor_entry->parent == kNoParent) {
+    // Only the root has no parent, and everything else is underneath it.
+    return ancestor.get<clang::TranslationUnitDecl>() != nullptr;
+  }
+  // Each node's IndexedParent stands in for the node itself, one level up.
+  const uint32_t depth = storage_[ancestor_entry->parent].depth;
+  return storage_[entry->parent].depth > depth &&
+         AncestorAtDepth(entry->parent, depth) == ancestor_entry->parent;
 }
 
 bool IndexedParentMap::DeclDominatesPrunableSubtree(
     const clang::Decl* decl) const {
   const auto node = clang::DynTypedNode::create(*decl);
-  const auto iter = parents_.find(node.getMemoizationData());
-  if (iter == parents_.end()) {
+  if (const Entry* entry = Find(node.getMemoizationData())) {
+    return !entry->claimable;
+  }
+  if (lazy_ == nullptr) {
     return false;  // Safe default.
   }
-  return iter->second.getInt() == 0;
+  // Answering this doesn't need parents, so don't walk the subtree into the
+  // map; the decl may well be pruned.
+  auto [cached, inserted] = lazy_->prunable.try_emplace(decl, false);
+  if (inserted) {
+    cached->second = !ClaimableNodeFinder::SubtreeHasClaimableNode(
+        const_cast<clang::Decl*>(decl));
+  }
+  return cached->second;
 }
 
 }  // namespace kythe
@@ -16,10 +16,14 @@
 #ifndef KYTHE_CXX_INDEXER_CXX_INDEXED_PARENT_MAP_H_
 #define KYTHE_CXX_INDEXER_CXX_INDEXED_PARENT_MAP_H_
 
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+
 #include "clang/AST/ASTTypeTraits.h"
 #include "clang/AST/Decl.h"
 #include "llvm/ADT/DenseMap.h"
-#include "llvm/ADT/PointerIntPair.h"
 
 namespace kythe {
 
@@ -27,10 +31,22 @@ namespace kythe {
 /// parent (along some path from the AST root) and an integer index for that
 /// node in some arbitrary but consistent order defined by the parent.
 struct IndexedParent {
+  /// \brief Marks the absence of a position in the map's storage.
+  static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
   /// \brief The parent DynTypedNode associated with some key.
   clang::DynTypedNode parent;
   /// \brief The index at which some associated key appears in `Parent`.
   size_t index;
+  /// \brief Where the map that handed this out stores `parent`'s own
+  /// IndexedParent, or `kNone` if `parent` has none (it is the root).
+  uint32_t up = kNone;
+  /// \brief How many IndexedParents are above this one along `up`.
+  uint32_t depth = 0;
+  /// \brief Where the map stores some IndexedParent above this one, chosen
+  /// so that any ancestor can be reached in O(log depth) steps along `jump`
+  /// and `up`; or `kNone` if that is the root.
+  uint32_t jump = kNone;
 
   friend bool operator==(const IndexedParent& lhs, const IndexedParent& rhs) {
     // We compare IndexedParents for deduplicating memoizable DynTypedNodes
@@ -50,15 +66,29 @@ class IndexedParentMap {
   /// \brief Builds and returns the translation unit's indexed parent map.
   static IndexedParentMap Build(clang::TranslationUnitDecl* unit);
 
-  // IndexedParentMap retains ownership of the contained IndexedParents and
-  // thus is move-only.
-  IndexedParentMap(IndexedParentMap&&) = default;
-  IndexedParentMap& operator=(IndexedParentMap&&) = default;
+  /// \brief Returns a parent map for the translation unit that walks each
+  /// top-level decl only when it is first asked about that decl's subtree.
+  ///
+  /// Subtrees that are never asked about, such as those of unclaimed header
+  /// decls, are never walked. A node that can be reached from more than one
+  /// top-level decl may be given a different parent than `Build` would give
+  /// it, because subtrees are walked in the order they're needed rather than
+  /// in translation unit order.
+  static IndexedParentMap BuildLazily(clang::TranslationUnitDecl* unit);
+
+  // IndexedParentMap hands out pointers into its own storage and thus is
+  // move-only.
+  IndexedParentMap(IndexedParentMap&&);
+  IndexedParentMap& operator=(IndexedParentMap&&);
+  ~IndexedParentMap();
 
-  bool empty() const { return parents_.empty(); }
+  bool empty() const { return parents_.empty() && lazy_ == nullptr; }
 
   /// \brief Returns the parent of the given node, along with the index
   /// at which the node appears underneath each parent.
+  ///
+  /// A lazily built map walks whatever subtree it needs to answer; this
+  /// lets `RootTraversal` fault in ancestors as it climbs.
   const IndexedParent* GetIndexedParent(const clang::DynTypedNode& node) const;
 
   /// \brief Returns the parent of the given node, along with the index
@@ -71,36 +101,82 @@ class IndexedParentMap {
     return GetIndexedParent(clang::DynTypedNode::create(node));
   }
 
+  /// \brief Returns the parent of `indexed_parent.parent`, or null if that
+  /// node is the root.
+  ///
+  /// This follows the link stored in `indexed_parent` rather than looking
+  /// the node up, so walking to the root this way costs no hashing.
+  /// `indexed_parent` must have been handed out by this map.
+  const IndexedParent* GetNextIndexedParent(
+      const IndexedParent& indexed_parent) const {
+    return indexed_parent.up == IndexedParent::kNone
+               ? nullptr
+               : &storage_[indexed_parent.up];
+  }
+
+  /// \return true if `node` is strictly underneath `ancestor` along the path
+  /// from the root that the map records for `node`.
+  ///
+  /// This takes a lookup for each node and O(log depth) steps up the tree.
+  bool IsUnderneath(const clang::DynTypedNode& node,
+                    const clang::DynTypedNode& ancestor) const;
+
   /// \return true if `Decl` and all of the nodes underneath it are prunable.
   ///
   /// A subtree is prunable if it's "the same" in all possible indexer runs.
   /// This excludes, for example, certain template instantiations.
   bool DeclDominatesPrunableSubtree(const clang::Decl* decl) const;
 
+  /// \brief Tells a lazily built map that `decl`'s subtree is about to be
+  /// traversed, so that lookups for statements and other nodes that aren't
+  /// decls know which subtree to walk. Does nothing for eagerly built maps.
+  void NoteTraversal(const clang::Decl* decl) const;
+
  private:
-  // An owned, move-only, PointerIntPair.
-  struct PointerPair : llvm::PointerIntPair<IndexedParent*, 1, bool> {
-    PointerPair() = default;
-
-    PointerPair(PointerPair&& other)
-        : PointerIntPair(other.getPointer(), other.getInt()) {
-      other.setPointer(nullptr);
-    }
-
-    PointerPair& operator=(PointerPair&& other) {
-      setPointerAndInt(other.getPointer(), other.getInt());
-      other.setPointer(nullptr);
-      return *this;
-    }
-
-    ~PointerPair() { delete PointerIntPair::getPointer(); }
+  /// Marks nodes that have no parent.
+  static constexpr uint32_t kNoParent = IndexedParent::kNone;
+
+  /// \brief What the map knows about a single node.
+  struct Entry {
+    /// The index of the node's parent in `storage_`, or `kNoParent`.
+    uint32_t parent = kNoParent;
+    /// Whether the node's subtree holds a node that isn't prunable.
+    bool claimable = false;
   };
-  using MappingType = llvm::DenseMap<const void*, PointerPair>;
-
-  explicit IndexedParentMap(MappingType parents)
-      : parents_(std::move(parents)) {}
-
-  MappingType parents_;
+  using MappingType = llvm::DenseMap<const void*, Entry>;
+  using StorageType = std::deque<IndexedParent>;
+  /// \brief The bookkeeping for lazily built maps.
+  struct LazyState;
+
+  IndexedParentMap();
+
+  /// Looks up `key` without walking any more of the AST.
+  const Entry* Find(const void* key) const;
+
+  /// Looks up `node`, walking more of a lazily built map's AST if need be.
+  const Entry* Lookup(const clang::DynTypedNode& node) const;
+
+  /// Returns the position of the IndexedParent at `depth` above (or at)
+  /// the one at `position`.
+  uint32_t AncestorAtDepth(uint32_t position, uint32_t depth) const;
+
+  /// Walks subtrees of a lazily built map until `node` has been seen or the
+  /// whole translation unit has been walked.
+  void FaultIn(const clang::DynTypedNode& node) const;
+
+  /// Walks the subtree of the lazily built map's `index`th top-level decl,
+  /// unless it has already been walked.
+  void WalkTopLevelDecl(size_t index) const;
+
+  /// Maps from nodes to their entries. Lazily built maps add to this
+  /// as they walk more subtrees.
+  mutable MappingType parents_;
+  /// All parent records, in the order they were first seen. Records don't
+  /// move once added, and neither they nor the entries that point to them
+  /// need destructors, so the whole map is freed in a few deallocations.
+  mutable StorageType storage_;
+  /// Set only for lazily built maps.
+  std::unique_ptr<LazyState> lazy_;
 };
 
 }  // namespace kythe
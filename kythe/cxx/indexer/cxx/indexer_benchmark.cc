@@ -0,0 +1,412 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// End-to-end benchmarks for IndexCompilationUnit over generated translation
+// units. To check a change for regressions, save the results before and after
+// it with --benchmark_out=<file> --benchmark_out_format=json and compare them
+// with compare_indexer_benchmarks.py.
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "benchmark/benchmark.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/indexer/cxx/IndexerFrontendAction.h"
+#include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
+#include "kythe/cxx/indexer/cxx/indexer_worklist.h"
+#include "kythe/cxx/indexer/cxx/resource_budget.h"
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
+#include "kythe/proto/analysis.pb.h"
+
+namespace kythe {
+namespace {
+
+/// \brief The kinds of generated translation unit.
+enum class SourceKind : int {
+  kClasses = 0,      ///< Plain classes with members, methods and calls.
+  kTemplates = 1,    ///< Templates with many distinct instantiations.
+  kMacros = 2,       ///< Declarations generated through nested macros.
+  kProto = 3,        ///< Messages shaped like protoc's generated C++.
+  kObjCHeaders = 4,  ///< An Objective-C file importing many headers.
+};
+
+/// \brief Where the indexer's entries go.
+enum class OutputKind : int {
+  kNull = 0,  ///< Entries are counted and dropped.
+  kFile = 1,  ///< Entries are also serialized by a `FileOutputStream`.
+};
+
+/// \brief A generated translation unit and the files it reads.
+struct BenchmarkUnit {
+  proto::CompilationUnit unit;
+  std::vector<proto::FileData> files;
+  /// The total size of `files`.
+  size_t bytes = 0;
+};
+
+/// \brief Returns the main source file of kind `kind` scaled by `count`.
+/// Headers the source includes are added to `headers` as (path, content).
+std::string MakeSource(
+    SourceKind kind, int count,
+    std::vector<std::pair<std::string, std::string>>* headers) {
+  std::string source;
+  switch (kind) {
+    case SourceKind::kClasses:
+      for (int i = 0; i < count; ++i) {
+        absl::StrAppendFormat(&source,
+                              "/// Class %d.\n"
+                              "class C%d {\n"
+                              " public:\n"
+                              "  int Get() const { return value_ + %d; }\n"
+                              "  void Set(int value) { value_ = value; }\n"
+                              " private:\n"
+                              "  int value_ = 0;\n"
+                              "};\n"
+                              "int Use%d(C%d* c) { c->Set(%d); return "
+                              "c->Get(); }\n",
+                              i, i, i, i, i, i);
+      }
+      break;
+    case SourceKind::kTemplates:
+      source =
+          "template <int N> struct Fib {\n"
+          "  static constexpr int value = Fib<N - 1>::value + "
+          "Fib<N - 2>::value;\n"
+          "};\n"
+          "template <> struct Fib<0> { static constexpr int value = 0; };\n"
+          "template <> struct Fib<1> { static constexpr int value = 1; };\n"
+          "template <typename T, int N> struct Box {\n"
+          "  T items[N];\n"
+          "  T Sum() const { T s{}; for (const T& t : items) s += t; "
+          "return s; }\n"
+          "};\n";
+      for (int i = 0; i < count; ++i) {
+        absl::StrAppendFormat(&source,
+                              "int Use%d() { Box<int, %d> b{}; "
+                              "return b.Sum() + Fib<%d>::value; }\n",
+                              i, i + 1, i % 40);
+      }
+      break;
+    case SourceKind::kMacros:
+      source =
+          "#define FIELD(type, name) type name##_ = {};\n"
+          "#define ACCESSOR(type, name) \\\n"
+          "  type name() const { return name##_; } FIELD(type, name)\n"
+          "#define RECORD(name) struct name { ACCESSOR(int, a) "
+          "ACCESSOR(long, b) ACCESSOR(char, c) };\n";
+      for (int i = 0; i < count; ++i) {
+        absl::StrAppendFormat(&source, "RECORD(R%d)\n", i);
+      }
+      break;
+    case SourceKind::kProto: {
+      // A stand-in for the protobuf runtime, then one generated header with
+      // `count` messages of a few fields each.
+      headers->emplace_back(
+          "message_lite.h",
+          "#pragma once\n"
+          "namespace google { namespace protobuf {\n"
+          "class Arena;\n"
+          "class MessageLite {\n"
+          " public:\n"
+          "  virtual ~MessageLite() = default;\n"
+          "  virtual void Clear() = 0;\n"
+          "  virtual int ByteSize() const = 0;\n"
+          "  virtual bool IsInitialized() const { return true; }\n"
+          "};\n"
+          "template <typename T> class RepeatedField {\n"
+          " public:\n"
+          "  int size() const { return size_; }\n"
+          "  const T& Get(int i) const { return data_[i]; }\n"
+          "  T* Add() { return &data_[size_++]; }\n"
+          "  void Clear() { size_ = 0; }\n"
+          " private:\n"
+          "  T data_[4] = {};\n"
+          "  int size_ = 0;\n"
+          "};\n"
+          "}}  // namespace google::protobuf\n");
+      std::string generated =
+          "#pragma once\n"
+          "#include \"message_lite.h\"\n"
+          "namespace bench { namespace proto {\n";
+      for (int i = 0; i < count; ++i) {
+        absl::StrAppendFormat(
+            &generated,
+            "class M%d final : public ::google::protobuf::MessageLite {\n"
+            " public:\n"
+            "  M%d() = default;\n"
+            "  static const M%d& default_instance();\n"
+            "  void Clear() final { id_ = 0; name_len_ = 0; tags_.Clear(); "
+            "_has_bits_ = 0; }\n"
+            "  int ByteSize() const final { return 8 + name_len_ + "
+            "tags_.size() * 4; }\n"
+            "  // int64 id = 1;\n"
+            "  bool has_id() const { return (_has_bits_ & 1u) != 0; }\n"
+            "  void clear_id() { id_ = 0; _has_bits_ &= ~1u; }\n"
+            "  long long id() const { return id_; }\n"
+            "  void set_id(long long value) { _has_bits_ |= 1u; id_ = value; "
+            "}\n"
+            "  // int32 name_len = 2;\n"
+            "  int name_len() const { return name_len_; }\n"
+            "  void set_name_len(int value) { name_len_ = value; }\n"
+            "  // repeated int32 tags = 3;\n"
+            "  int tags_size() const { return tags_.size(); }\n"
+            "  int tags(int index) const { return tags_.Get(index); }\n"
+            "  void add_tags(int value) { *tags_.Add() = value; }\n"
+            "  const ::google::protobuf::RepeatedField<int>& tags() const "
+            "{ return tags_; }\n"
+            " private:\n"
+            "  ::google::protobuf::RepeatedField<int> tags_;\n"
+            "  long long id_ = 0;\n"
+            "  int name_len_ = 0;\n"
+            "  unsigned _has_bits_ = 0;\n"
+            "};\n",
+            i, i, i);
+      }
+      generated.append("}}  // namespace bench::proto\n");
+      headers->emplace_back("bench.pb.h", std::move(generated));
+      source = "#include \"bench.pb.h\"\n";
+      for (int i = 0; i < count; ++i) {
+        absl::StrAppendFormat(&source,
+                              "namespace bench { namespace proto {\n"
+                              "const M%d& M%d::default_instance() {\n"
+                              "  static const M%d instance;\n"
+                              "  return instance;\n"
+                              "}\n"
+                              "}}  // namespace bench::proto\n"
+                              "long long Read%d(const bench::proto::M%d& m) "
+                              "{\n"
+                              "  return m.has_id() ? m.id() + m.tags_size() "
+                              ": m.name_len();\n"
+                              "}\n",
+                              i, i, i, i, i);
+      }
+      break;
+    }
+    case SourceKind::kObjCHeaders: {
+      // One header per 10 classes, each importing the root header; the main
+      // file imports every header but implements only a few classes.
+      headers->emplace_back("root.h",
+                            "#pragma once\n"
+                            "@protocol Named\n"
+                            "- (const char *)name;\n"
+                            "@end\n"
+                            "__attribute__((objc_root_class))\n"
+                            "@interface Root\n"
+                            "+ (instancetype)alloc;\n"
+                            "- (instancetype)init;\n"
+                            "@end\n");
+      const int header_count = std::max(1, count / 10);
+      for (int h = 0; h < header_count; ++h) {
+        std::string header = "#import \"root.h\"\n";
+        for (int i = h * 10; i < std::min(count, (h + 1) * 10); ++i) {
+          absl::StrAppendFormat(&header,
+                                "/// Class %d.\n"
+                                "@interface O%d : Root <Named>\n"
+                                "@property(nonatomic) int count;\n"
+                                "@property(nonatomic) O%d *next;\n"
+                                "- (int)addValue:(int)value times:(int)n;\n"
+                                "+ (O%d *)make;\n"
+                                "@end\n"
+                                "@interface O%d (Extra)\n"
+                                "- (void)reset;\n"
+                                "@end\n",
+                                i, i, i, i, i);
+        }
+        std::string path = absl::StrFormat("h%d.h", h);
+        absl::StrAppendFormat(&source, "#import \"%s\"\n", path);
+        headers->emplace_back(std::move(path), std::move(header));
+      }
+      for (int i = 0; i < count; i += 10) {
+        absl::StrAppendFormat(
+            &source,
+            "@implementation O%d\n"
+            "- (const char *)name { return \"O%d\"; }\n"
+            "- (int)addValue:(int)value times:(int)n {\n"
+            "  self.count += value * n;\n"
+            "  return self.next ? [self.next addValue:value times:n] "
+            ": self.count;\n"
+            "}\n"
+            "+ (O%d *)make { return [[O%d alloc] init]; }\n"
+            "@end\n",
+            i, i, i, i);
+      }
+      break;
+    }
+  }
+  return source;
+}
+
+/// \brief Returns a unit of kind `kind` scaled by `count`.
+BenchmarkUnit MakeUnit(SourceKind kind, int count) {
+  const bool objc = kind == SourceKind::kObjCHeaders;
+  const std::string dir = "/bench/";
+  const std::string path = absl::StrCat(dir, objc ? "main.m" : "main.cc");
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string source = MakeSource(kind, count, &headers);
+  BenchmarkUnit result;
+  proto::CompilationUnit& unit = result.unit;
+  unit.set_working_directory("/bench");
+  unit.add_source_file(path);
+  if (objc) {
+    for (const char* arg : {"clang", "-x", "objective-c"}) {
+      unit.add_argument(arg);
+    }
+  } else {
+    for (const char* arg : {"clang++", "-std=c++17"}) {
+      unit.add_argument(arg);
+    }
+  }
+  unit.add_argument(path);
+  auto add_file = [&](const std::string& file_path, std::string content) {
+    proto::FileData file;
+    file.mutable_info()->set_path(file_path);
+    result.bytes += content.size();
+    *file.mutable_content() = std::move(content);
+    auto* input = unit.add_required_input();
+    *input->mutable_info() = file.info();
+    input->mutable_v_name()->set_path(file_path);
+    result.files.push_back(std::move(file));
+  };
+  add_file(path, std::move(source));
+  for (auto& header : headers) {
+    add_file(absl::StrCat(dir, header.first), std::move(header.second));
+  }
+  return result;
+}
+
+/// \brief Counts the entries that the indexer emits and passes them on to
+/// another stream, if there is one.
+class CountingOutputStream : public KytheCachingOutput {
+ public:
+  explicit CountingOutputStream(KytheCachingOutput* next) : next_(next) {}
+  using KytheOutputStream::Emit;
+  void Emit(const FactRef& fact) override {
+    ++entries_;
+    if (next_ != nullptr) {
+      next_->Emit(fact);
+    }
+  }
+  void Emit(const EdgeRef& edge) override {
+    ++entries_;
+    if (next_ != nullptr) {
+      next_->Emit(edge);
+    }
+  }
+  void Emit(const OrdinalEdgeRef& edge) override {
+    ++entries_;
+    if (next_ != nullptr) {
+      next_->Emit(edge);
+    }
+  }
+  void PushBuffer() override {
+    if (next_ != nullptr) {
+      next_->PushBuffer();
+    }
+  }
+  void PopBuffer() override {
+    if (next_ != nullptr) {
+      next_->PopBuffer();
+    }
+  }
+  int64_t entries() const { return entries_; }
+
+ private:
+  KytheCachingOutput* next_;
+  int64_t entries_ = 0;
+};
+
+/// \brief Indexes a unit of kind `range(0)` scaled by `range(1)`, writing
+/// to an output of kind `range(2)`. Besides the time per unit, reports the
+/// average time per phase, entries and serialized bytes per unit, and the
+/// process's peak resident set. The peak covers every benchmark run so far,
+/// so run one benchmark per process (with --benchmark_filter) to compare it.
+void BM_IndexCompilationUnit(benchmark::State& state) {
+  const auto kind = static_cast<SourceKind>(state.range(0));
+  const auto output_kind = static_cast<OutputKind>(state.range(2));
+  const BenchmarkUnit bench = MakeUnit(kind, state.range(1));
+  IndexerOptions options;
+  options.EffectiveWorkingDirectory = bench.unit.working_directory();
+  options.UnimplementedBehavior = BehaviorOnUnimplemented::Continue;
+  UnitMetrics metrics;
+  options.Metrics = &metrics;
+  StaticClaimClient claim_client;
+  claim_client.set_process_unknown_status(true);
+  LibrarySupports library_supports;
+  std::string buffer;
+  int64_t output_bytes = 0;
+  int64_t entries = 0;
+  for (auto _ : state) {
+    // IndexCompilationUnit may replace the contents of `files`.
+    std::vector<proto::FileData> files = bench.files;
+    buffer.clear();
+    {
+      StringAppendingStream appender(&buffer);
+      google::protobuf::io::CopyingOutputStreamAdaptor raw_output(&appender);
+      FileOutputStream file_output(&raw_output);
+      CountingOutputStream output(
+          output_kind == OutputKind::kFile ? &file_output : nullptr);
+      std::string result = IndexCompilationUnit(
+          bench.unit, files, claim_client, nullptr, output, options, nullptr,
+          &library_supports, [](IndexerASTVisitor* indexer) {
+            return IndexerWorklist::CreateDefaultWorklist(indexer);
+          });
+      CHECK(result.empty()) << result;
+      entries += output.entries();
+    }
+    output_bytes += buffer.size();
+  }
+  state.SetBytesProcessed(state.iterations() * bench.bytes);
+  auto per_unit = [&state](double value) {
+    return benchmark::Counter(value, benchmark::Counter::kAvgIterations);
+  };
+  state.counters["entries"] = per_unit(entries);
+  state.counters["output_bytes"] = per_unit(output_bytes);
+  state.counters["parse_ms"] =
+      per_unit(absl::ToDoubleMilliseconds(metrics.parse_time));
+  state.counters["traversal_ms"] =
+      per_unit(absl::ToDoubleMilliseconds(metrics.traversal_time));
+  state.counters["emit_ms"] =
+      per_unit(absl::ToDoubleMilliseconds(metrics.emit_time));
+  state.counters["peak_rss_mb"] =
+      static_cast<double>(ResourceBudget::PeakRssBytes()) / (1 << 20);
+}
+BENCHMARK(BM_IndexCompilationUnit)
+    ->ArgNames({"kind", "count", "output"})
+    ->ArgsProduct({{static_cast<int>(SourceKind::kClasses)},
+                   {1000},
+                   {static_cast<int>(OutputKind::kNull),
+                    static_cast<int>(OutputKind::kFile)}})
+    ->Args({static_cast<int>(SourceKind::kTemplates), 500,
+            static_cast<int>(OutputKind::kNull)})
+    ->Args({static_cast<int>(SourceKind::kMacros), 1000,
+            static_cast<int>(OutputKind::kNull)})
+    ->ArgsProduct({{static_cast<int>(SourceKind::kProto)},
+                   {500},
+                   {static_cast<int>(OutputKind::kNull),
+                    static_cast<int>(OutputKind::kFile)}})
+    ->Args({static_cast<int>(SourceKind::kObjCHeaders), 500,
+            static_cast<int>(OutputKind::kNull)})
+    ->Unit(benchmark::kMillisecond);
+
+}  // anonymous namespace
+}  // namespace kythe
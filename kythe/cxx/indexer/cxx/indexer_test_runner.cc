@@ -0,0 +1,562 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Indexes and verifies many single-file indexer test fixtures in one process.
+//
+// Each fixture is indexed on a pool of threads with IndexCompilationUnit and
+// its entries are checked against the goals in its source by an in-process
+// Verifier, so the suite pays for process start-up and LLVM initialization
+// once rather than twice per fixture. The manifest has one fixture per line,
+// with tab-separated fields:
+//
+//   name  source  pass|fail  indexer flags  verifier flags  compiler flags
+//
+// where each list of flags is separated by spaces. These are the flags that
+// cc_indexer_test passes to the indexer and verifier (see
+// cc_indexer_test_runner in cc_indexer_test.bzl). Fixtures that need a flag
+// this runner can't apply to a single unit are reported as skipped.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "google/protobuf/stubs/common.h"
+#include "kythe/cxx/common/binary_metadata_file.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
+#include "kythe/cxx/common/init.h"
+#include "kythe/cxx/common/kythe_metadata_file.h"
+#include "kythe/cxx/common/protobuf_metadata_file.h"
+#include "kythe/cxx/common/regex.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/cxx/indexer/cxx/GoogleFlagsLibrarySupport.h"
+#include "kythe/cxx/indexer/cxx/ImputedConstructorSupport.h"
+#include "kythe/cxx/indexer/cxx/IndexerFrontendAction.h"
+#include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
+#include "kythe/cxx/indexer/cxx/ProtoLibrarySupport.h"
+#include "kythe/cxx/indexer/cxx/indexer_worklist.h"
+#include "kythe/cxx/verifier/verifier.h"
+#include "kythe/proto/analysis.pb.h"
+#include "kythe/proto/buildinfo.pb.h"
+
+ABSL_DECLARE_FLAG(bool, fail_on_unimplemented_builtin);
+ABSL_DECLARE_FLAG(bool, experimental_alias_template_instantiations);
+
+ABSL_FLAG(std::string, manifest, "", "The fixtures to run, one per line.");
+ABSL_FLAG(int, jobs, 0,
+          "How many fixtures to index and verify at once; 0 for one per "
+          "core.");
+ABSL_FLAG(std::string, filter, "",
+          "If nonempty, only run fixtures whose names contain this string.");
+
+namespace kythe {
+namespace {
+
+constexpr char kBuildDetailsURI[] = "kythe.io/proto/kythe.proto.BuildDetails";
+
+/// \brief A fixture listed in the manifest.
+struct Fixture {
+  std::string name;
+  /// The source file to index, which also holds the goals.
+  std::string source;
+  /// False if the fixture is expected to fail verification.
+  bool expect_success = true;
+  std::vector<std::string> indexer_flags;
+  std::vector<std::string> verifier_flags;
+  std::vector<std::string> copts;
+};
+
+/// \brief How a fixture turned out.
+struct Outcome {
+  enum class Result { kPassed, kFailed, kSkipped };
+  Result result = Result::kFailed;
+  std::string message;
+  absl::Duration duration;
+};
+
+/// \brief The verifier settings a fixture asks for.
+struct VerifierSettings {
+  std::string goal_prefix = "//-";
+  bool ignore_dups = false;
+  bool check_for_singletons = false;
+  bool convert_marked_source = false;
+};
+
+/// Held while printing a fixture's diagnostics, so that they aren't
+/// interleaved with another's.
+ABSL_CONST_INIT absl::Mutex print_mu(absl::kConstInit);
+
+/// The verifier's goal lexer keeps its state in globals.
+ABSL_CONST_INIT absl::Mutex goal_parser_mu(absl::kConstInit);
+
+/// \brief Splits `--name=value` into its name and value.
+bool SplitFlag(absl::string_view flag, absl::string_view* name,
+               absl::string_view* value) {
+  if (!absl::ConsumePrefix(&flag, "--") && !absl::ConsumePrefix(&flag, "-")) {
+    return false;
+  }
+  auto equals = flag.find('=');
+  if (equals == absl::string_view::npos) {
+    return false;
+  }
+  *name = flag.substr(0, equals);
+  *value = flag.substr(equals + 1);
+  return true;
+}
+
+absl::StatusOr<bool> ParseBool(absl::string_view name,
+                               absl::string_view value) {
+  bool result;
+  if (!absl::SimpleAtob(value, &result)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Bad value for --", name, ": ", value));
+  }
+  return result;
+}
+
+absl::StatusOr<int> ParseInt(absl::string_view name, absl::string_view value) {
+  int result;
+  if (!absl::SimpleAtoi(value, &result)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Bad value for --", name, ": ", value));
+  }
+  return result;
+}
+
+/// \brief Applies one of the indexer flags that cc_indexer_test passes to
+/// `options` and `unit`.
+/// \return an UNIMPLEMENTED error for flags that can't be set per unit.
+absl::Status ApplyIndexerFlag(absl::string_view flag, IndexerOptions* options,
+                              proto::CompilationUnit* unit) {
+  absl::string_view name, value;
+  if (!SplitFlag(flag, &name, &value)) {
+    return absl::InvalidArgumentError(absl::StrCat("Bad flag: ", flag));
+  }
+  if (name == "experimental_dataflow_influence_limit" ||
+      name == "experimental_usr_byte_size") {
+    auto parsed = ParseInt(name, value);
+    if (!parsed.ok()) {
+      return parsed.status();
+    }
+    if (name == "experimental_usr_byte_size") {
+      options->UsrByteSize = std::max(0, *parsed);
+    } else {
+      options->InfluenceSetLimit = std::max(0, *parsed);
+    }
+    return absl::OkStatus();
+  }
+  if (name == "experimental_skip_function_bodies") {
+    if (value == "headers") {
+      options->FunctionBodies = BehaviorOnFunctionBodies::SkipInHeaders;
+    } else if (value == "all") {
+      options->FunctionBodies = BehaviorOnFunctionBodies::SkipAll;
+    } else if (!value.empty()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Bad value for --", name, ": ", value));
+    }
+    return absl::OkStatus();
+  }
+  if (name == "template_instance_exclude_path_pattern") {
+    if (!value.empty()) {
+      RE2::Options regex_options;
+      regex_options.set_never_capture(true);
+      auto set = RegexSet::Build({std::string(value)}, regex_options,
+                                 RE2::ANCHOR_BOTH);
+      if (!set.ok()) {
+        return set.status();
+      }
+      options->TemplateInstanceExcludePathPatterns =
+          std::make_shared<const RegexSet>(*std::move(set));
+    }
+    return absl::OkStatus();
+  }
+  if (name == "ibuild_config") {
+    if (!value.empty()) {
+      proto::BuildDetails details;
+      details.set_build_config(std::string(value));
+      auto* any = unit->add_details();
+      any->PackFrom(details);
+      any->set_type_url(kBuildDetailsURI);
+    }
+    return absl::OkStatus();
+  }
+  auto parsed = ParseBool(name, value);
+  if (!parsed.ok()) {
+    return parsed.status();
+  }
+  const bool on = *parsed;
+  if (name == "experimental_alias_template_instantiations" ||
+      name == "fail_on_unimplemented_builtin") {
+    // These are process-wide flags (see main()), so fixtures that need
+    // another value than every other fixture's are skipped.
+    const bool global =
+        name == "fail_on_unimplemented_builtin"
+            ? absl::GetFlag(FLAGS_fail_on_unimplemented_builtin)
+            : absl::GetFlag(FLAGS_experimental_alias_template_instantiations);
+    if (on != global) {
+      return absl::UnimplementedError(
+          absl::StrCat("--", name, "=", value, " applies to every unit"));
+    }
+  } else if (name == "experimental_drop_cpp_fwd_decl_docs") {
+    options->CppFwdDocs = on ? BehaviorOnFwdDeclComments::Ignore
+                             : BehaviorOnFwdDeclComments::Emit;
+  } else if (name == "experimental_drop_objc_fwd_class_docs") {
+    options->ObjCFwdDocs = on ? BehaviorOnFwdDeclComments::Ignore
+                              : BehaviorOnFwdDeclComments::Emit;
+  } else if (name == "experimental_drop_instantiation_independent_data") {
+    options->DropInstantiationIndependentData = on;
+  } else if (name == "experimental_lazy_system_macros") {
+    options->SystemMacros = on ? BehaviorOnSystemMacros::DefineIfUsed
+                               : BehaviorOnSystemMacros::Define;
+  } else if (name == "experimental_record_dataflow_edges") {
+    options->DataflowEdges =
+        on ? EmitDataflowEdges::Yes : EmitDataflowEdges::No;
+  } else if (name == "ignore_unimplemented") {
+    options->UnimplementedBehavior = on ? BehaviorOnUnimplemented::Continue
+                                        : BehaviorOnUnimplemented::Abort;
+  } else if (name == "index_template_instantiations") {
+    options->TemplateBehavior = on ? BehaviorOnTemplates::VisitInstantiations
+                                   : BehaviorOnTemplates::SkipInstantiations;
+  } else if (name == "use_compilation_corpus_as_default") {
+    options->UseCompilationCorpusAsDefault = on;
+  } else {
+    return absl::UnimplementedError(absl::StrCat("Unsupported flag: ", flag));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<VerifierSettings> ParseVerifierFlags(
+    const std::vector<std::string>& flags) {
+  VerifierSettings settings;
+  for (const auto& flag : flags) {
+    absl::string_view name, value;
+    if (!SplitFlag(flag, &name, &value)) {
+      return absl::InvalidArgumentError(absl::StrCat("Bad flag: ", flag));
+    }
+    if (name == "goal_prefix") {
+      settings.goal_prefix = std::string(value);
+      continue;
+    }
+    auto parsed = ParseBool(name, value);
+    if (!parsed.ok()) {
+      return parsed.status();
+    }
+    if (name == "ignore_dups") {
+      settings.ignore_dups = *parsed;
+    } else if (name == "check_for_singletons") {
+      settings.check_for_singletons = *parsed;
+    } else if (name == "convert_marked_source") {
+      settings.convert_marked_source = *parsed;
+    } else {
+      return absl::UnimplementedError(
+          absl::StrCat("Unsupported flag: ", flag));
+    }
+  }
+  return settings;
+}
+
+absl::StatusOr<std::string> ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("Couldn't open ", path));
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+/// \brief Indexes `fixture` the way `indexer -i <source> -- -c <copts>`
+/// would and returns the serialized entries.
+absl::StatusOr<std::vector<std::string>> IndexFixture(
+    const Fixture& fixture, const std::string& working_directory) {
+  IndexerOptions options;
+  proto::CompilationUnit unit;
+  for (const auto& flag : fixture.indexer_flags) {
+    if (auto status = ApplyIndexerFlag(flag, &options, &unit); !status.ok()) {
+      return status;
+    }
+  }
+  options.EffectiveWorkingDirectory = working_directory;
+  options.AllowFSAccess = true;
+  unit.set_working_directory(working_directory);
+  unit.add_source_file(fixture.source);
+  unit.add_argument("indexer");
+  unit.add_argument("-c");
+  for (const auto& copt : fixture.copts) {
+    unit.add_argument(copt);
+  }
+  unit.add_argument(fixture.source);
+  std::vector<proto::FileData> files(1);
+  files[0].mutable_info()->set_path(fixture.source);
+  auto content = ReadFile(fixture.source);
+  if (!content.ok()) {
+    return content.status();
+  }
+  *files[0].mutable_content() = *std::move(content);
+
+  MetadataSupports meta_supports;
+  meta_supports.Add(absl::make_unique<BinaryMetadataSupport>());
+  meta_supports.Add(absl::make_unique<ProtobufMetadataSupport>());
+  meta_supports.Add(absl::make_unique<KytheMetadataSupport>());
+  LibrarySupports library_supports;
+  library_supports.push_back(absl::make_unique<GoogleFlagsLibrarySupport>());
+  library_supports.push_back(absl::make_unique<GoogleProtoLibrarySupport>());
+  library_supports.push_back(absl::make_unique<ImputedConstructorSupport>());
+  StaticClaimClient claim_client;
+  claim_client.set_process_unknown_status(true);
+  std::string buffer;
+  {
+    StringAppendingStream appender(&buffer);
+    google::protobuf::io::CopyingOutputStreamAdaptor raw_output(&appender);
+    FileOutputStream output(&raw_output);
+    std::string error = IndexCompilationUnit(
+        unit, files, claim_client, nullptr, output, options, &meta_supports,
+        &library_supports, [](IndexerASTVisitor* indexer) {
+          return IndexerWorklist::CreateDefaultWorklist(indexer);
+        });
+    if (!error.empty()) {
+      return absl::InternalError(error);
+    }
+  }
+
+  std::vector<std::string> entries;
+  google::protobuf::io::CodedInputStream input(
+      reinterpret_cast<const uint8_t*>(buffer.data()),
+      static_cast<int>(buffer.size()));
+  input.SetTotalBytesLimit(INT_MAX);
+  google::protobuf::uint32 size;
+  while (input.ReadVarint32(&size)) {
+    entries.emplace_back();
+    if (!input.ReadString(&entries.back(), size)) {
+      return absl::DataLossError("Truncated entry stream");
+    }
+  }
+  return entries;
+}
+
+/// \brief Checks `entries` against the goals in `fixture`'s source.
+/// \return false (after printing why) if any goal couldn't be satisfied.
+absl::StatusOr<bool> VerifyFixture(const Fixture& fixture,
+                                   const std::vector<std::string>& entries) {
+  auto settings = ParseVerifierFlags(fixture.verifier_flags);
+  if (!settings.ok()) {
+    return settings.status();
+  }
+  verifier::Verifier v;
+  v.SetGoalCommentPrefix(settings->goal_prefix);
+  if (settings->ignore_dups) {
+    v.IgnoreDuplicateFacts();
+  }
+  if (settings->convert_marked_source) {
+    v.ConvertMarkedSource();
+  }
+  std::string database_name = fixture.name;
+  if (!v.AssertSerializedFacts(&database_name, 0, entries) ||
+      !v.PrepareDatabase()) {
+    return false;
+  }
+  {
+    absl::MutexLock lock(&goal_parser_mu);
+    if (!v.LoadInlineRuleFile(fixture.source)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Couldn't load goals from ", fixture.source));
+    }
+  }
+  if (settings->check_for_singletons && v.CheckForSingletonEVars()) {
+    return false;
+  }
+  if (v.VerifyAllGoals()) {
+    return true;
+  }
+  if (fixture.expect_success) {
+    absl::MutexLock lock(&print_mu);
+    absl::FPrintF(stderr, "%s: the furthest goal reached was:\n  ",
+                  fixture.name);
+    v.DumpErrorGoal(v.highest_group_reached(), v.highest_goal_reached());
+  }
+  return false;
+}
+
+Outcome RunFixture(const Fixture& fixture,
+                   const std::string& working_directory) {
+  Outcome outcome;
+  absl::Time start = absl::Now();
+  absl::StatusOr<bool> verified;
+  if (auto entries = IndexFixture(fixture, working_directory); entries.ok()) {
+    verified = VerifyFixture(fixture, *entries);
+  } else {
+    verified = entries.status();
+  }
+  outcome.duration = absl::Now() - start;
+  if (verified.ok()) {
+    if (*verified == fixture.expect_success) {
+      outcome.result = Outcome::Result::kPassed;
+    } else {
+      outcome.message = fixture.expect_success
+                            ? "couldn't verify all goals"
+                            : "verified, but was expected to fail";
+    }
+  } else if (absl::IsUnimplemented(verified.status())) {
+    outcome.result = Outcome::Result::kSkipped;
+    outcome.message = std::string(verified.status().message());
+  } else if (!fixture.expect_success) {
+    // As with verifier_test, any failure counts for these.
+    outcome.result = Outcome::Result::kPassed;
+  } else {
+    outcome.message = verified.status().ToString();
+  }
+  return outcome;
+}
+
+std::vector<std::string> SplitFlags(absl::string_view flags) {
+  std::vector<std::string> split =
+      absl::StrSplit(flags, ' ', absl::SkipEmpty());
+  return split;
+}
+
+absl::StatusOr<std::vector<Fixture>> ReadManifest(const std::string& path) {
+  auto content = ReadFile(path);
+  if (!content.ok()) {
+    return content.status();
+  }
+  std::vector<Fixture> fixtures;
+  for (absl::string_view line : absl::StrSplit(*content, '\n')) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::vector<absl::string_view> fields = absl::StrSplit(line, '\t');
+    if (fields.size() != 6 ||
+        (fields[2] != "pass" && fields[2] != "fail")) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Bad manifest line: ", line));
+    }
+    Fixture fixture;
+    fixture.name = std::string(fields[0]);
+    fixture.source = std::string(fields[1]);
+    fixture.expect_success = fields[2] == "pass";
+    fixture.indexer_flags = SplitFlags(fields[3]);
+    fixture.verifier_flags = SplitFlags(fields[4]);
+    fixture.copts = SplitFlags(fields[5]);
+    fixtures.push_back(std::move(fixture));
+  }
+  return fixtures;
+}
+
+}  // anonymous namespace
+}  // namespace kythe
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  kythe::InitializeProgram(argv[0]);
+  absl::SetProgramUsageMessage(
+      "Indexes and verifies indexer test fixtures in one process.\n"
+      "Usage: indexer_test_runner --manifest=<file> [--jobs=N]");
+  absl::ParseCommandLine(argc, argv);
+  // Every cc_indexer_test passes this; fixtures that want otherwise are
+  // skipped.
+  absl::SetFlag(&FLAGS_fail_on_unimplemented_builtin, true);
+
+  auto fixtures = kythe::ReadManifest(absl::GetFlag(FLAGS_manifest));
+  if (!fixtures.ok()) {
+    absl::FPrintF(stderr, "%s\n", fixtures.status().ToString());
+    return 1;
+  }
+  const std::string& filter = absl::GetFlag(FLAGS_filter);
+  fixtures->erase(std::remove_if(fixtures->begin(), fixtures->end(),
+                                 [&filter](const kythe::Fixture& fixture) {
+                                   return !absl::StrContains(fixture.name,
+                                                             filter);
+                                 }),
+                  fixtures->end());
+
+  char cwd[PATH_MAX];
+  if (::getcwd(cwd, sizeof(cwd)) == nullptr) {
+    perror("Couldn't get the working directory");
+    return 1;
+  }
+  const std::string working_directory(cwd);
+
+  size_t jobs = std::max(0, absl::GetFlag(FLAGS_jobs));
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  absl::Time start = absl::Now();
+  std::vector<kythe::Outcome> outcomes(fixtures->size());
+  {
+    kythe::ThreadPool pool(
+        std::min(jobs, std::max<size_t>(1, outcomes.size())));
+    for (size_t i = 0; i < fixtures->size(); ++i) {
+      pool.Schedule([&, i] {
+        outcomes[i] = kythe::RunFixture((*fixtures)[i], working_directory);
+      });
+    }
+    pool.Wait();
+  }
+
+  size_t passed = 0, failed = 0, skipped = 0;
+  for (size_t i = 0; i < fixtures->size(); ++i) {
+    const auto& outcome = outcomes[i];
+    const char* result = "PASSED";
+    switch (outcome.result) {
+      case kythe::Outcome::Result::kPassed:
+        ++passed;
+        break;
+      case kythe::Outcome::Result::kFailed:
+        result = "FAILED";
+        ++failed;
+        break;
+      case kythe::Outcome::Result::kSkipped:
+        result = "SKIPPED";
+        ++skipped;
+        break;
+    }
+    absl::PrintF("%s: %s (%s)%s%s\n", result, (*fixtures)[i].name,
+                 absl::FormatDuration(absl::Trunc(outcome.duration,
+                                                  absl::Milliseconds(1))),
+                 outcome.message.empty() ? "" : ": ", outcome.message);
+  }
+  absl::PrintF("%d passed, %d failed, %d skipped in %s on %d threads\n",
+               passed, failed, skipped,
+               absl::FormatDuration(
+                   absl::Trunc(absl::Now() - start, absl::Milliseconds(1))),
+               jobs);
+  return failed == 0 ? 0 : 1;
+}
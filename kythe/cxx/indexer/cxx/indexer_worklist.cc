@@ -16,11 +16,40 @@
 
 #include "kythe/cxx/indexer/cxx/indexer_worklist.h"
 
+#include <string>
+#include <utility>
+
+#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
+#include "glog/logging.h"
 #include "kythe/cxx/indexer/cxx/IndexerASTHooks.h"
 
 namespace kythe {
 namespace {
+/// \brief Claims every job in `jobs` that has a claim ID with a single
+/// batch claim, then drops the jobs whose claims failed.
+void ClaimJobs(IndexerASTVisitor* indexer,
+               std::vector<std::unique_ptr<IndexJob>>* jobs) {
+  std::vector<std::pair<std::string, bool>> claims;
+  for (const auto& job : *jobs) {
+    if (!job->ClaimId.empty()) {
+      claims.emplace_back(job->ClaimId, true);
+    }
+  }
+  if (claims.empty()) {
+    return;
+  }
+  indexer->getGraphObserver().claimBatch(&claims);
+  size_t claim = 0;
+  size_t kept = 0;
+  for (auto& job : *jobs) {
+    if (job->ClaimId.empty() || claims[claim++].second) {
+      (*jobs)[kept++] = std::move(job);
+    }
+  }
+  jobs->resize(kept);
+}
+
 class IndexerWorklistImpl : public IndexerWorklist {
  public:
   IndexerWorklistImpl(IndexerASTVisitor* indexer) : indexer_(indexer) {}
@@ -38,16 +67,72 @@ class IndexerWorklistImpl : public IndexerWorklist {
 
   bool DoWork() override {
     std::vector<std::unique_ptr<IndexJob>> jobs = std::move(worklist_);
+    ClaimJobs(indexer_, &jobs);
+    for (auto& job : jobs) {
+      indexer_->RunJob(std::move(job));
+    }
+    return !worklist_.empty();
+  }
+
+ private:
+  /// \brief All queued work.
+  std::vector<std::unique_ptr<IndexJob>> worklist_;
+
+  /// \brief The indexer that will execute jobs.
+  IndexerASTVisitor* indexer_;
+};
+
+class DeduplicatingIndexerWorklist : public IndexerWorklist {
+ public:
+  explicit DeduplicatingIndexerWorklist(IndexerASTVisitor* indexer)
+      : indexer_(indexer) {}
+
+  void EnqueueJobForImplicitDecl(clang::Decl* decl,
+                                 bool set_prune_incomplete_functions,
+                                 const std::string& id) override {
+    if (!id.empty() && !seen_claim_ids_.insert(id).second) {
+      ++jobs_dropped_;
+      return;
+    }
+    worklist_.emplace_back(absl::make_unique<IndexJob>(
+        indexer_->getCurrentJob(), decl, set_prune_incomplete_functions, id));
+  }
+
+  void EnqueueJob(std::unique_ptr<IndexJob> job) override {
+    if (!job->ClaimId.empty() &&
+        !seen_claim_ids_.insert(job->ClaimId).second) {
+      ++jobs_dropped_;
+      return;
+    }
+    worklist_.emplace_back(std::move(job));
+  }
+
+  bool DoWork() override {
+    std::vector<std::unique_ptr<IndexJob>> jobs = std::move(worklist_);
+    ClaimJobs(indexer_, &jobs);
     for (auto& job : jobs) {
+      if (indexer_->shouldStopIndexing()) {
+        return false;
+      }
       indexer_->RunJob(std::move(job));
     }
     return !worklist_.empty();
   }
 
+  ~DeduplicatingIndexerWorklist() override {
+    VLOG(1) << "Dropped " << jobs_dropped_ << " duplicate indexer jobs";
+  }
+
  private:
   /// \brief All queued work.
   std::vector<std::unique_ptr<IndexJob>> worklist_;
 
+  /// \brief Claim IDs for every job that has been enqueued so far.
+  absl::flat_hash_set<std::string> seen_claim_ids_;
+
+  /// \brief The number of jobs that were dropped as duplicates.
+  size_t jobs_dropped_ = 0;
+
   /// \brief The indexer that will execute jobs.
   IndexerASTVisitor* indexer_;
 };
@@ -57,4 +142,9 @@ std::unique_ptr<IndexerWorklist> IndexerWorklist::CreateDefaultWorklist(
     IndexerASTVisitor* indexer) {
   return absl::make_unique<IndexerWorklistImpl>(indexer);
 }
+
+std::unique_ptr<IndexerWorklist> IndexerWorklist::CreateDeduplicatingWorklist(
+    IndexerASTVisitor* indexer) {
+  return absl::make_unique<DeduplicatingIndexerWorklist>(indexer);
+}
 }  // namespace kythe
@@ -103,8 +103,17 @@ struct IndexJob {
   /// \brief A stack of CXXConstructExprs we've already visited.
   std::vector<const clang::CXXConstructExpr*> ConstructorStack;
 
+  /// \brief The decls that influence a value and the nodes that value
+  /// flows into.
+  struct InfluenceSet {
+    /// The decls seen so far while traversing the value.
+    absl::flat_hash_set<const clang::Decl*> Influencers;
+    /// The nodes the influencers are recorded against.
+    SomeNodes Influenced;
+  };
+
   /// \brief The current stack of influence sets.
-  std::vector<absl::flat_hash_set<const clang::Decl*>> InfluenceSets;
+  std::vector<InfluenceSet> InfluenceSets;
 };
 
 class IndexerASTVisitor;
@@ -116,6 +125,17 @@ class IndexerWorklist {
   static std::unique_ptr<IndexerWorklist> CreateDefaultWorklist(
       IndexerASTVisitor* visitor);
 
+  /// \brief Create a new worklist that runs at most one job for each distinct
+  /// claim ID.
+  ///
+  /// Template-heavy translation units tend to reach the same implicit
+  /// declaration (under the same set of template arguments) along many paths.
+  /// The default worklist indexes each of these paths; this worklist indexes
+  /// the first one and drops the rest, which shortens the serial tail of
+  /// deferred jobs. Jobs with an empty claim ID are always run.
+  static std::unique_ptr<IndexerWorklist> CreateDeduplicatingWorklist(
+      IndexerASTVisitor* visitor);
+
   /// \brief Enqueue a job to index an implicit declaration.
   /// \param decl the declaration to index.
   /// \param set_prune_incomplete_functions whether to prune incomplete
@@ -129,6 +149,10 @@ class IndexerWorklist {
   virtual void EnqueueJob(std::unique_ptr<IndexJob> job) = 0;
 
   /// \brief Perform one or more units of work.
+  ///
+  /// The claim IDs of all jobs queued for this round are claimed with one
+  /// `GraphObserver::claimBatch` call first, and jobs whose claims fail are
+  /// dropped.
   /// \return true if these is more work to be done.
   virtual bool DoWork() = 0;
 
@@ -16,13 +16,14 @@
 
 #include "kythe/cxx/indexer/cxx/marked_source.h"
 
+#include <algorithm>
+
 #include "absl/flags/flag.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/DeclVisitor.h"
 #include "clang/AST/PrettyPrinter.h"
-#include "clang/Basic/FileManager.h"
 #include "clang/Format/Format.h"
-#include "clang/Rewrite/Core/Rewriter.h"
+#include "clang/Lex/Lexer.h"
 #include "clang/Sema/Template.h"
 #include "google/protobuf/stubs/common.h"
 #include "kythe/cxx/common/scope_guard.h"
@@ -33,6 +34,9 @@ ABSL_FLAG(bool, reformat_marked_source, false,
           "Reformat source code used in MarkedSource (experimental).");
 ABSL_FLAG(bool, pretty_print_function_prototypes, false,
           "Synthesize new function prototypes (experimental).");
+ABSL_FLAG(bool, experimental_marked_source_for_claimed_decls_only, false,
+          "Only generate marked source for decls at claimed locations, "
+          "leaving the rest to the units that claim them.");
 
 namespace kythe {
 namespace {
@@ -53,12 +57,6 @@ bool IsValidRange(const clang::SourceManager& source_manager,
   return true;
 }
 
-clang::SourceRange NormalizeRange(const clang::SourceManager& source_manager,
-                                  const clang::LangOptions& lang_options,
-                                  const clang::SourceRange& range) {
-  return ClangRangeFinder(&source_manager, &lang_options).NormalizeRange(range);
-}
-
 llvm::StringRef GetTextRange(const clang::SourceManager& source_manager,
                              const clang::SourceRange& range) {
   if (!IsValidRange(source_manager, range)) {
@@ -75,45 +73,6 @@ llvm::StringRef GetTextRange(const clang::SourceManager& source_manager,
 /// \brief The filename to use to refer to code being formatted.
 constexpr char kReplacementFile[] = "x.cc";
 
-/// \brief Reformats `source_text`.
-/// \param replacements the set of transformations applied to `source_text`.
-/// \param incomplete set to true if reformatting failed.
-/// \return the reformatted text buffer (or the empty string).
-std::string Reformat(const clang::LangOptions& lang_options,
-                     llvm::StringRef source_text,
-                     clang::tooling::Replacements* replacements,
-                     bool* incomplete) {
-  clang::format::FormatStyle style =
-      clang::format::getGoogleStyle(clang::format::FormatStyle::LK_Cpp);
-  std::vector<clang::tooling::Range> ranges = {
-      clang::tooling::Range(0, source_text.size())};
-  *replacements = clang::format::reformat(style, source_text, ranges,
-                                          kReplacementFile, incomplete);
-  if (*incomplete) {
-    return "";
-  }
-  llvm::IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> InMemoryFileSystem(
-      new llvm::vfs::InMemoryFileSystem);
-  clang::FileManager Files(clang::FileSystemOptions(), InMemoryFileSystem);
-  clang::DiagnosticsEngine Diagnostics(
-      llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs>(new clang::DiagnosticIDs),
-      new clang::DiagnosticOptions);
-  clang::SourceManager Sources(Diagnostics, Files);
-  auto Source = llvm::MemoryBuffer::getMemBuffer(source_text);
-  InMemoryFileSystem->addFileNoOwn(kReplacementFile, 0, *Source);
-  clang::FileID ID =
-      Sources.createFileID(*Files.getFile(kReplacementFile),
-                           clang::SourceLocation(), clang::SrcMgr::C_User);
-  clang::Rewriter Rewrite(Sources, lang_options);
-  clang::tooling::applyAllReplacements(*replacements, Rewrite);
-  std::string result_string;
-  {
-    llvm::raw_string_ostream result_stream(result_string);
-    Rewrite.getEditBuffer(ID).write(result_stream);
-  }
-  return result_string;
-}
-
 /// \brief A span of source text with some attached properties.
 struct Annotation {
   enum Kind : unsigned char {
@@ -297,18 +256,25 @@ bool SameFileRangesOverlapOpenInterval(const clang::SourceRange& outer,
 /// \brief Walks the AST to annotate source text.
 ///
 /// The AST refers to source locations in an un-reformatted buffer, so we need
-/// to transform them (using `replacements`) to refer to offsets in the
+/// to transform them (using `formatted`) to refer to offsets in the
 /// reformatted buffer.
 class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
  public:
-  DeclAnnotator(MarkedSourceCache* cache,
-                clang::tooling::Replacements* replacements,
-                clang::SourceLocation original_begin,
+  /// \param formatted The reformatted text `formatted_range` was taken from,
+  /// or null if the source text was not reformatted.
+  /// \param original_offset The offset of `original_begin` in the text that
+  /// was reformatted.
+  DeclAnnotator(MarkedSourceCache* cache, const FormattedText* formatted,
+                clang::SourceLocation original_begin, unsigned original_offset,
                 const std::string& formatted_range, MarkedSource* marked_source,
                 const clang::SourceRange& default_name_range)
       : cache_(cache),
-        replacements_(replacements),
+        formatted_(formatted),
         original_begin_(original_begin),
+        original_offset_(original_offset),
+        formatted_begin_(formatted == nullptr
+                             ? 0
+                             : formatted->ShiftedOffset(original_offset)),
         formatted_range_(formatted_range),
         marked_source_(marked_source),
         name_range_(default_name_range) {
@@ -366,9 +332,8 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
     if (const auto* type_source_info = decl->getTypeSourceInfo()) {
       if (!ShouldSkipDecl(decl, type_source_info->getType(),
                           type_source_info->getTypeLoc().getSourceRange())) {
-        auto type_loc =
-            NormalizeRange(cache_->source_manager(), cache_->lang_options(),
-                           type_source_info->getTypeLoc().getSourceRange());
+        auto type_loc = cache_->NormalizeRange(
+            type_source_info->getTypeLoc().getSourceRange());
         InsertTypeAnnotation(type_loc, clang::SourceRange{});
       }
     }
@@ -377,9 +342,8 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
     if (const auto* type_source_info = decl->getTypeSourceInfo()) {
       if (!ShouldSkipDecl(decl, type_source_info->getType(),
                           type_source_info->getTypeLoc().getSourceRange())) {
-        auto type_loc =
-            NormalizeRange(cache_->source_manager(), cache_->lang_options(),
-                           type_source_info->getTypeLoc().getSourceRange());
+        auto type_loc = cache_->NormalizeRange(
+            type_source_info->getTypeLoc().getSourceRange());
         InsertTypeAnnotation(type_loc, clang::SourceRange{});
       }
     }
@@ -388,9 +352,8 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
     if (const auto* type_source_info = decl->getTypeSourceInfo()) {
       if (!ShouldSkipDecl(decl, type_source_info->getType(),
                           type_source_info->getTypeLoc().getSourceRange())) {
-        auto type_loc =
-            NormalizeRange(cache_->source_manager(), cache_->lang_options(),
-                           type_source_info->getTypeLoc().getSourceRange());
+        auto type_loc = cache_->NormalizeRange(
+            type_source_info->getTypeLoc().getSourceRange());
         InsertTypeAnnotation(type_loc, clang::SourceRange{});
       }
     }
@@ -403,9 +366,7 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
         if (auto function_type = type_info->getTypeLoc()
                                      .IgnoreParens()
                                      .getAs<clang::FunctionTypeLoc>()) {
-          arg_list =
-              NormalizeRange(cache_->source_manager(), cache_->lang_options(),
-                             function_type.getParensRange());
+          arg_list = cache_->NormalizeRange(function_type.getParensRange());
           InsertAnnotation(arg_list, Annotation{Annotation::ArgListWithParens});
         }
       }
@@ -417,9 +378,7 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
     }
     if (!ShouldSkipDecl(decl, decl->getReturnType(), type_range) &&
         type_range.isValid()) {
-      InsertTypeAnnotation(NormalizeRange(cache_->source_manager(),
-                                          cache_->lang_options(), type_range),
-                           arg_list);
+      InsertTypeAnnotation(cache_->NormalizeRange(type_range), arg_list);
     }
   }
 
@@ -432,8 +391,7 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
     // myFunc:withTimeout and the arguments should be something like
     // "(int)size, (int)time".
     auto ret_type_range =
-        NormalizeRange(cache_->source_manager(), cache_->lang_options(),
-                       decl->getReturnTypeSourceRange());
+        cache_->NormalizeRange(decl->getReturnTypeSourceRange());
     if (ret_type_range.isValid()) {
       InsertAnnotation(ret_type_range, Annotation{Annotation::Type});
     } else {
@@ -473,9 +431,9 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
       end_offset = original_range.getEnd().getRawEncoding() -
                    original_begin_.getRawEncoding();
     }
-    if (replacements_ != nullptr) {
-      annotation.begin = replacements_->getShiftedCodePosition(start_offset);
-      annotation.end = replacements_->getShiftedCodePosition(end_offset);
+    if (formatted_ != nullptr) {
+      annotation.begin = ShiftedOffset(start_offset);
+      annotation.end = ShiftedOffset(end_offset);
     } else {
       annotation.begin = start_offset;
       annotation.end = end_offset;
@@ -500,6 +458,14 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
     annotations_.push_back(annotation);
   }
 
+  /// \brief Maps an offset from `original_begin_` to one in
+  /// `formatted_range_`, or to `npos` if it lands before the range begins.
+  size_t ShiftedOffset(unsigned offset) const {
+    unsigned shifted = formatted_->ShiftedOffset(original_offset_ + offset);
+    return shifted < formatted_begin_ ? std::string::npos
+                                      : shifted - formatted_begin_;
+  }
+
   /// \brief determines if we should skip trying to record an annotation for
   /// this decl.
   ///
@@ -516,8 +482,10 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
   }
 
   MarkedSourceCache* cache_;
-  clang::tooling::Replacements* replacements_;
+  const FormattedText* formatted_;
   clang::SourceLocation original_begin_;
+  unsigned original_offset_;
+  unsigned formatted_begin_;
   const std::string& formatted_range_;
   MarkedSource* marked_source_;
   const clang::SourceRange& name_range_;
@@ -526,10 +494,125 @@ class DeclAnnotator : public clang::DeclVisitor<DeclAnnotator> {
 };
 }  // anonymous namespace
 
+std::unique_ptr<FormattedText> FormattedText::Format(
+    llvm::StringRef source_text) {
+  clang::format::FormatStyle style =
+      clang::format::getGoogleStyle(clang::format::FormatStyle::LK_Cpp);
+  std::vector<clang::tooling::Range> ranges = {
+      clang::tooling::Range(0, source_text.size())};
+  bool incomplete = false;
+  auto replacements = clang::format::reformat(style, source_text, ranges,
+                                              kReplacementFile, &incomplete);
+  if (incomplete) {
+    return nullptr;
+  }
+  auto text = clang::tooling::applyAllReplacements(source_text, replacements);
+  if (!text) {
+    llvm::consumeError(text.takeError());
+    return nullptr;
+  }
+  std::unique_ptr<FormattedText> formatted(new FormattedText());
+  formatted->text_ = std::move(*text);
+  formatted->edits_.reserve(replacements.size());
+  int64_t shift = 0;
+  for (const auto& replacement : replacements) {
+    unsigned replacement_length = replacement.getReplacementText().size();
+    shift += static_cast<int64_t>(replacement_length) - replacement.getLength();
+    formatted->edits_.push_back({replacement.getOffset(),
+                                 replacement.getLength(), replacement_length,
+                                 shift});
+  }
+  return formatted;
+}
+
+unsigned FormattedText::ShiftedOffset(unsigned offset) const {
+  // Replacements don't overlap, so their ends are ordered too. Find the first
+  // one that doesn't end at or before `offset`; everything before it moves
+  // `offset` along.
+  auto edit =
+      std::upper_bound(edits_.begin(), edits_.end(), offset,
+                       [](unsigned offset, const Edit& edit) {
+                         return offset < edit.offset + edit.length;
+                       });
+  int64_t shift = edit == edits_.begin() ? 0 : std::prev(edit)->shift_after;
+  if (edit != edits_.end() && edit->offset < offset &&
+      edit->offset + edit->replacement_length <= offset) {
+    // `offset` is inside a replacement; clamp it to the replacement's text.
+    offset = edit->offset + edit->replacement_length;
+    if (edit->replacement_length != 0) {
+      --offset;
+    }
+  }
+  return static_cast<unsigned>(offset + shift);
+}
+
+clang::SourceRange MarkedSourceCache::NormalizeRange(
+    const clang::SourceRange& range) {
+  ClangRangeFinder finder(&source_manager_, &lang_options_);
+  clang::CharSourceRange file_range = finder.FileRange(range);
+  if (!file_range.isTokenRange()) {
+    return file_range.getAsRange();
+  }
+  clang::SourceLocation end = file_range.getEnd();
+  if (end.isInvalid()) {
+    return clang::SourceRange();
+  }
+  if (!end.isFileID()) {
+    return finder.NormalizeRange(range);
+  }
+  return clang::SourceRange(file_range.getBegin(),
+                            end.getLocWithOffset(TokenLength(end)));
+}
+
+unsigned MarkedSourceCache::TokenLength(clang::SourceLocation loc) {
+  auto [file, offset] = source_manager_.getDecomposedLoc(loc);
+  auto [tokens, inserted] = tokens_.try_emplace(file);
+  if (inserted) {
+    bool invalid = false;
+    llvm::StringRef buffer = source_manager_.getBufferData(file, &invalid);
+    if (!invalid) {
+      clang::Lexer lexer(source_manager_.getLocForStartOfFile(file),
+                         lang_options_, buffer.begin(), buffer.begin(),
+                         buffer.end());
+      clang::Token token;
+      for (lexer.LexFromRawLexer(token); token.isNot(clang::tok::eof);
+           lexer.LexFromRawLexer(token)) {
+        tokens->second.push_back(
+            {source_manager_.getFileOffset(token.getLocation()),
+             token.getLength()});
+      }
+    }
+  }
+  const auto& spans = tokens->second;
+  auto span = std::lower_bound(
+      spans.begin(), spans.end(), offset,
+      [](const TokenSpan& span, unsigned offset) {
+        return span.offset < offset;
+      });
+  if (span != spans.end() && span->offset == offset) {
+    return span->length;
+  }
+  // `loc` isn't where the whole-file lex put a token (say, the second `>` in
+  // `>>`), so measure it on its own.
+  return clang::Lexer::MeasureTokenLength(loc, source_manager_, lang_options_);
+}
+
+const FormattedText* MarkedSourceCache::FormattedFile(clang::FileID file) {
+  auto [formatted, inserted] = formatted_files_.try_emplace(file);
+  if (inserted) {
+    bool invalid = false;
+    llvm::StringRef buffer = source_manager_.getBufferData(file, &invalid);
+    if (!invalid) {
+      formatted->second = FormattedText::Format(buffer);
+    }
+  }
+  return formatted->second.get();
+}
+
 bool MarkedSourceGenerator::WillGenerateMarkedSource() const {
   // Be conservative in which kinds of marked source we'll generate.
   // We can enable more AST node flavors as necessary.
-  if (decl_->isImplicit() || implicit_) {
+  if (decl_->isImplicit() || implicit_ || !cache_->enabled()) {
     return false;
   }
   return llvm::isa<clang::FunctionDecl>(decl_) ||
@@ -825,29 +908,55 @@ MarkedSourceGenerator::GenerateMarkedSourceUsingSource(
     }
     return absl::nullopt;
   }
+  absl::uint128 memo_key = 0;
+  if (auto* memo = cache_->memo()) {
+    memo_key = MarkedSourceMemo::Key(decl_id.ToClaimedString(),
+                                     absl::string_view(range.data(),
+                                                       range.size()));
+    if (auto found = memo->Find(memo_key)) {
+      return found;
+    }
+  }
   MarkedSource out_sig;
   if (absl::GetFlag(FLAGS_reformat_marked_source)) {
-    clang::tooling::Replacements replacements;
-    bool incomplete = false;
-    // Weirdly, Clang tooling complains if we don't make a copy of `range` here.
-    auto formatted_range = Reformat(cache_->lang_options(), range.str(),
-                                    &replacements, &incomplete);
-    if (incomplete) {
+    // Reformat the whole file once and cut this decl out of it. If the file
+    // can't be formatted as a whole, fall back to formatting just the decl.
+    auto [file, original_offset] =
+        cache_->source_manager().getDecomposedLoc(start_loc);
+    const FormattedText* formatted = cache_->FormattedFile(file);
+    std::unique_ptr<FormattedText> formatted_decl;
+    if (formatted == nullptr) {
+      original_offset = 0;
+      formatted_decl = FormattedText::Format(range);
+      formatted = formatted_decl.get();
+    }
+    if (formatted == nullptr) {
       LOG(WARNING) << "Incomplete reformatting for " << decl_id.getRawIdentity()
                    << " (" << decl_->getQualifiedNameAsString() << ")";
       return absl::nullopt;
     }
-    DeclAnnotator annotator(cache_, &replacements, start_loc, formatted_range,
-                            &out_sig, name_range_);
+    unsigned formatted_begin = formatted->ShiftedOffset(original_offset);
+    unsigned formatted_end =
+        formatted->ShiftedOffset(original_offset + range.size());
+    if (formatted_end < formatted_begin) {
+      return absl::nullopt;
+    }
+    auto formatted_range = formatted->text().substr(
+        formatted_begin, formatted_end - formatted_begin);
+    DeclAnnotator annotator(cache_, formatted, start_loc, original_offset,
+                            formatted_range, &out_sig, name_range_);
     annotator.Annotate(decl_);
     ReplaceMarkedSourceWithQualifiedName(annotator.ident_node());
   } else {
     auto range_string = range.str();
-    DeclAnnotator annotator(cache_, nullptr, start_loc, range_string, &out_sig,
-                            name_range_);
+    DeclAnnotator annotator(cache_, nullptr, start_loc, 0, range_string,
+                            &out_sig, name_range_);
     annotator.Annotate(decl_);
     ReplaceMarkedSourceWithQualifiedName(annotator.ident_node());
   }
+  if (auto* memo = cache_->memo()) {
+    memo->Insert(memo_key, out_sig);
+  }
   return out_sig;
 }
 
@@ -877,6 +986,22 @@ absl::optional<MarkedSource> MarkedSourceGenerator::GenerateMarkedSource(
   if (!WillGenerateMarkedSource()) {
     return absl::nullopt;
   }
+  if (absl::GetFlag(FLAGS_experimental_marked_source_for_claimed_decls_only) &&
+      !cache_->observer()->claimLocation(decl_->getLocation())) {
+    return absl::nullopt;
+  }
+  // Like macros, nodes whose claim token we don't hold get their marked
+  // source from the unit that does.
+  if (!cache_->observer()->claimNode(decl_id)) {
+    return absl::nullopt;
+  }
+  // Redeclarations that share a node (such as each block that reopens a
+  // namespace) would all produce the same marked source; keep the first.
+  if (!cache_->MarkGenerated(decl_id)) {
+    return absl::nullopt;
+  }
+  ProfileBlock block(cache_->observer()->getProfilingCallback(),
+                     ProfileSection::kGenerateMarkedSource);
   if (llvm::isa<clang::VarDecl>(decl_) || llvm::isa<clang::FieldDecl>(decl_)) {
     return GenerateMarkedSourceUsingSource(decl_id);
   } else if (const auto* func = llvm::dyn_cast<clang::FunctionDecl>(decl_)) {
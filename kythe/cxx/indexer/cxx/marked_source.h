@@ -17,17 +17,59 @@
 #ifndef KYTHE_CXX_INDEXER_CXX_MARKED_SOURCE_H_
 #define KYTHE_CXX_INDEXER_CXX_MARKED_SOURCE_H_
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
 #include "absl/types/optional.h"
 #include "clang/AST/Decl.h"
 #include "clang/Basic/SourceManager.h"
 #include "clang/Sema/Sema.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
 #include "kythe/cxx/indexer/cxx/GraphObserver.h"
+#include "kythe/cxx/indexer/cxx/marked_source_memo.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
 
 namespace kythe {
 class MarkedSourceCache;
 
+/// \brief Source text reformatted by clang-format, along with a map from
+/// offsets in the original text to offsets in the reformatted text.
+class FormattedText {
+ public:
+  /// \brief Reformats `source_text`.
+  /// \return null if clang-format could not format all of it.
+  static std::unique_ptr<FormattedText> Format(llvm::StringRef source_text);
+
+  /// \brief The reformatted text.
+  const std::string& text() const { return text_; }
+
+  /// \brief Maps `offset` in the original text to an offset in `text()`.
+  ///
+  /// This agrees with `clang::tooling::Replacements::getShiftedCodePosition`
+  /// but takes logarithmic rather than linear time, since a whole file may
+  /// need thousands of replacements.
+  unsigned ShiftedOffset(unsigned offset) const;
+
+ private:
+  /// \brief One replacement, in order of `offset`.
+  struct Edit {
+    unsigned offset;
+    unsigned length;
+    unsigned replacement_length;
+    /// How far this and all earlier replacements move the text after it.
+    int64_t shift_after;
+  };
+
+  FormattedText() = default;
+
+  std::string text_;
+  std::vector<Edit> edits_;
+};
+
 /// \brief Collects information about a `decl`, then possibly marks up its
 /// source for presentation as a signature in documentation. Typically this
 /// drops function and struct bodies while preserving the information in
@@ -132,10 +174,42 @@ class MarkedSourceCache {
     return MarkedSourceGenerator(this, decl);
   }
 
+  /// \brief Returns the character range in the ultimate file covering the
+  /// tokens in `range`, like `ClangRangeFinder::NormalizeRange`, but measures
+  /// the final token with `TokenLength`.
+  clang::SourceRange NormalizeRange(const clang::SourceRange& range);
+
+  /// \brief Returns the length of the token starting at the file location
+  /// `loc`, or 0 if none does.
+  ///
+  /// The first lookup in a file lexes all of it once; later lookups reuse
+  /// those tokens instead of starting a new lexer for each one.
+  unsigned TokenLength(clang::SourceLocation loc);
+
+  /// \brief Returns `file` reformatted as a whole, or null if it could not
+  /// be. Each file is formatted at most once.
+  const FormattedText* FormattedFile(clang::FileID file);
+
   const clang::SourceManager& source_manager() const { return source_manager_; }
   const clang::LangOptions& lang_options() const { return lang_options_; }
   clang::Sema* sema() { return sema_; }
   GraphObserver* observer() { return observer_; }
+
+  /// \brief Stops (or resumes) marked source generation for every decl.
+  void set_enabled(bool value) { enabled_ = value; }
+  bool enabled() const { return enabled_; }
+
+  /// \brief Records that marked source was generated for `node_id`.
+  /// \return false if it already had been.
+  bool MarkGenerated(const GraphObserver::NodeId& node_id) {
+    return generated_.insert(node_id.ToClaimedString()).second;
+  }
+
+  /// \brief Reuses marked source generated from source text through `memo`,
+  /// which may be shared with other units. Not owned; may be null.
+  void set_memo(MarkedSourceMemo* memo) { memo_ = memo; }
+  MarkedSourceMemo* memo() { return memo_; }
+
   llvm::DenseMap<const clang::ClassTemplateSpecializationDecl*, unsigned>*
   first_default_template_argument() {
     return &first_default_template_argument_;
@@ -146,11 +220,28 @@ class MarkedSourceCache {
   const clang::LangOptions& lang_options_;
   clang::Sema* sema_;
   GraphObserver* observer_;
+  /// Whether any marked source should be generated.
+  bool enabled_ = true;
+  /// Marked source generated from source text, keyed by decl and text.
+  MarkedSourceMemo* memo_ = nullptr;
+  /// The nodes that marked source was generated for.
+  absl::flat_hash_set<std::string> generated_;
 
   /// Maps from class template specializations to the first of that
   /// specialization's arguments that is default.
   llvm::DenseMap<const clang::ClassTemplateSpecializationDecl*, unsigned>
       first_default_template_argument_;
+
+  /// \brief A token's offset in its file and its length.
+  struct TokenSpan {
+    unsigned offset;
+    unsigned length;
+  };
+  /// The tokens in each file that was asked about, in order of `offset`.
+  llvm::DenseMap<clang::FileID, std::vector<TokenSpan>> tokens_;
+  /// Each file that was reformatted, or null if reformatting failed.
+  llvm::DenseMap<clang::FileID, std::unique_ptr<FormattedText>>
+      formatted_files_;
 };
 }  // namespace kythe
 
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/marked_source_memo.h"
+
+#include "kythe/cxx/common/indexing/Murmur3Hasher.h"
+
+namespace kythe {
+namespace {
+
+void HashWithLength(absl::string_view text, Murmur3Hasher* hasher) {
+  uint64_t size = text.size();
+  hasher->Update(&size, sizeof(size));
+  hasher->Update(text.data(), text.size());
+}
+
+}  // anonymous namespace
+
+absl::uint128 MarkedSourceMemo::Key(absl::string_view decl_identity,
+                                    absl::string_view source_text) {
+  // Prefixing each part with its length keeps different splits of the same
+  // bytes from colliding.
+  Murmur3Hasher hasher;
+  HashWithLength(decl_identity, &hasher);
+  HashWithLength(source_text, &hasher);
+  unsigned char hash[Murmur3Hasher::kHashSize];
+  hasher.Finish(hash);
+  uint64_t high = 0;
+  uint64_t low = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    high = (high << 8) | hash[i];
+    low = (low << 8) | hash[i + 8];
+  }
+  return absl::MakeUint128(high, low);
+}
+
+absl::optional<kythe::proto::common::MarkedSource> MarkedSourceMemo::Find(
+    absl::uint128 key) {
+  auto found = entries_.find(key);
+  if (found == entries_.end()) {
+    ++misses_;
+    return absl::nullopt;
+  }
+  ++hits_;
+  return found->second;
+}
+
+void MarkedSourceMemo::Insert(
+    absl::uint128 key,
+    const kythe::proto::common::MarkedSource& marked_source) {
+  if (entries_.size() >= max_entries_) {
+    entries_.clear();
+  }
+  entries_.insert_or_assign(key, marked_source);
+}
+
+}  // namespace kythe
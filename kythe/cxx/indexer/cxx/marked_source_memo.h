@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_MARKED_SOURCE_MEMO_H_
+#define KYTHE_CXX_INDEXER_CXX_MARKED_SOURCE_MEMO_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "kythe/proto/common.pb.h"
+
+namespace kythe {
+
+/// \brief Remembers marked source generated from decls' source text so that
+/// units that see the same decl don't have to generate it again.
+///
+/// Entries are keyed by the fingerprint of the decl's claimed identity
+/// together with the text its marked source was generated from. A decl with
+/// the same identity and the same text gets the same marked source in every
+/// unit, since that's what allows the units' facts to agree.
+class MarkedSourceMemo {
+ public:
+  /// \param max_entries How many entries to keep before starting over.
+  explicit MarkedSourceMemo(size_t max_entries) : max_entries_(max_entries) {}
+  virtual ~MarkedSourceMemo() {}
+  MarkedSourceMemo(const MarkedSourceMemo&) = delete;
+  MarkedSourceMemo& operator=(const MarkedSourceMemo&) = delete;
+
+  /// \return the key for the marked source generated for the decl with
+  /// `decl_identity` from `source_text`.
+  static absl::uint128 Key(absl::string_view decl_identity,
+                           absl::string_view source_text);
+
+  /// \return the marked source remembered for `key`, if any.
+  virtual absl::optional<kythe::proto::common::MarkedSource> Find(
+      absl::uint128 key);
+
+  /// \brief Remembers `marked_source` for `key`.
+  virtual void Insert(absl::uint128 key,
+                      const kythe::proto::common::MarkedSource& marked_source);
+
+  /// \return the number of calls to `Find` that found an entry.
+  virtual uint64_t hits() const { return hits_; }
+  /// \return the number of calls to `Find` that didn't.
+  virtual uint64_t misses() const { return misses_; }
+
+ protected:
+  MarkedSourceMemo() {}
+
+ private:
+  /// The number of entries to keep before starting over.
+  size_t max_entries_ = 0;
+  absl::flat_hash_map<absl::uint128, kythe::proto::common::MarkedSource>
+      entries_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+/// \brief A `MarkedSourceMemo` that serializes access to another.
+class SynchronizedMarkedSourceMemo : public MarkedSourceMemo {
+ public:
+  /// \param memo The memo to forward to. Not owned; must outlive this.
+  explicit SynchronizedMarkedSourceMemo(MarkedSourceMemo* memo) : memo_(memo) {}
+  absl::optional<kythe::proto::common::MarkedSource> Find(absl::uint128 key)
+      override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return memo_->Find(key);
+  }
+  void Insert(absl::uint128 key,
+              const kythe::proto::common::MarkedSource& marked_source) override
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    memo_->Insert(key, marked_source);
+  }
+  uint64_t hits() const override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return memo_->hits();
+  }
+  uint64_t misses() const override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return memo_->misses();
+  }
+
+ private:
+  mutable absl::Mutex mu_;
+  MarkedSourceMemo* memo_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_MARKED_SOURCE_MEMO_H_
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/marked_source_memo.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+using ::kythe::proto::common::MarkedSource;
+
+MarkedSource Identifier(const std::string& text) {
+  MarkedSource marked_source;
+  marked_source.set_kind(MarkedSource::IDENTIFIER);
+  marked_source.set_pre_text(text);
+  return marked_source;
+}
+
+TEST(MarkedSourceMemoTest, KeysDistinguishSplits) {
+  EXPECT_EQ(MarkedSourceMemo::Key("id", "int x"),
+            MarkedSourceMemo::Key("id", "int x"));
+  EXPECT_NE(MarkedSourceMemo::Key("id", "int x"),
+            MarkedSourceMemo::Key("id", "int y"));
+  EXPECT_NE(MarkedSourceMemo::Key("ab", "c"), MarkedSourceMemo::Key("a", "bc"));
+}
+
+TEST(MarkedSourceMemoTest, FindsInsertedEntries) {
+  MarkedSourceMemo memo(10);
+  auto key = MarkedSourceMemo::Key("id", "int x");
+  EXPECT_FALSE(memo.Find(key).has_value());
+  memo.Insert(key, Identifier("x"));
+  auto found = memo.Find(key);
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ("x", found->pre_text());
+  EXPECT_EQ(1, memo.hits());
+  EXPECT_EQ(1, memo.misses());
+}
+
+TEST(MarkedSourceMemoTest, StartsOverWhenFull) {
+  MarkedSourceMemo memo(2);
+  memo.Insert(MarkedSourceMemo::Key("a", ""), Identifier("a"));
+  memo.Insert(MarkedSourceMemo::Key("b", ""), Identifier("b"));
+  memo.Insert(MarkedSourceMemo::Key("c", ""), Identifier("c"));
+  EXPECT_FALSE(memo.Find(MarkedSourceMemo::Key("a", "")).has_value());
+  EXPECT_FALSE(memo.Find(MarkedSourceMemo::Key("b", "")).has_value());
+  EXPECT_TRUE(memo.Find(MarkedSourceMemo::Key("c", "")).has_value());
+}
+
+TEST(MarkedSourceMemoTest, SynchronizedMemoForwards) {
+  MarkedSourceMemo memo(10);
+  SynchronizedMarkedSourceMemo shared(&memo);
+  auto key = MarkedSourceMemo::Key("id", "int x");
+  shared.Insert(key, Identifier("x"));
+  EXPECT_TRUE(memo.Find(key).has_value());
+  EXPECT_TRUE(shared.Find(key).has_value());
+  EXPECT_EQ(2, shared.hits());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/node_fingerprint_set.h"
+
+#include <cstdint>
+
+#include "kythe/cxx/common/indexing/Murmur3Hasher.h"
+
+namespace kythe {
+
+absl::uint128 NodeFingerprintSet::Fingerprint(absl::string_view identity) {
+  Murmur3Hasher hasher;
+  hasher.Update(identity.data(), identity.size());
+  unsigned char hash[Murmur3Hasher::kHashSize];
+  hasher.Finish(hash);
+  uint64_t high = 0;
+  uint64_t low = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    high = (high << 8) | hash[i];
+    low = (low << 8) | hash[i + 8];
+  }
+  return absl::MakeUint128(high, low);
+}
+
+}  // namespace kythe
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_NODE_FINGERPRINT_SET_H_
+#define KYTHE_CXX_INDEXER_CXX_NODE_FINGERPRINT_SET_H_
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+
+namespace kythe {
+
+/// \brief Remembers which nodes have been written by their 128-bit
+/// fingerprints rather than by their identities.
+///
+/// At 128 bits, the chance that two different identities collide (and one of
+/// them is wrongly treated as already written) is negligible even for the
+/// largest units.
+class NodeFingerprintSet {
+ public:
+  NodeFingerprintSet() {}
+  virtual ~NodeFingerprintSet() {}
+  NodeFingerprintSet(const NodeFingerprintSet&) = delete;
+  NodeFingerprintSet& operator=(const NodeFingerprintSet&) = delete;
+
+  /// \brief Remembers `identity`.
+  /// \return false if `identity` was already remembered.
+  bool Insert(absl::string_view identity) {
+    return InsertFingerprint(Fingerprint(identity));
+  }
+
+  /// \brief Remembers an identity by its `fingerprint`.
+  /// \return false if `fingerprint` was already remembered.
+  virtual bool InsertFingerprint(absl::uint128 fingerprint) {
+    return fingerprints_.insert(fingerprint).second;
+  }
+
+  /// \return the number of identities remembered.
+  virtual size_t size() const { return fingerprints_.size(); }
+
+  /// \return the fingerprint of `identity`.
+  static absl::uint128 Fingerprint(absl::string_view identity);
+
+ private:
+  absl::flat_hash_set<absl::uint128> fingerprints_;
+};
+
+/// \brief A `NodeFingerprintSet` that serializes access to another, so that
+/// concurrently indexed units can share it. Identities are hashed before the
+/// lock is taken.
+class SynchronizedNodeFingerprintSet : public NodeFingerprintSet {
+ public:
+  /// \param set The set to forward to. Not owned; must outlive this.
+  explicit SynchronizedNodeFingerprintSet(NodeFingerprintSet* set)
+      : set_(set) {}
+  bool InsertFingerprint(absl::uint128 fingerprint) override
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return set_->InsertFingerprint(fingerprint);
+  }
+  size_t size() const override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return set_->size();
+  }
+
+ private:
+  mutable absl::Mutex mu_;
+  NodeFingerprintSet* set_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_NODE_FINGERPRINT_SET_H_
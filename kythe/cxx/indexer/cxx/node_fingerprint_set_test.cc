@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/node_fingerprint_set.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(NodeFingerprintSetTest, InsertsOnce) {
+  NodeFingerprintSet set;
+  EXPECT_TRUE(set.Insert("int#builtin"));
+  EXPECT_TRUE(set.Insert("char#builtin"));
+  EXPECT_FALSE(set.Insert("int#builtin"));
+  EXPECT_TRUE(set.Insert(""));
+  EXPECT_FALSE(set.Insert(""));
+  EXPECT_EQ(3, set.size());
+}
+
+TEST(NodeFingerprintSetTest, FingerprintsAreStable) {
+  EXPECT_EQ(NodeFingerprintSet::Fingerprint("int#builtin"),
+            NodeFingerprintSet::Fingerprint(std::string("int#builtin")));
+  EXPECT_NE(NodeFingerprintSet::Fingerprint("int#builtin"),
+            NodeFingerprintSet::Fingerprint("int#builtim"));
+  // The reference MurmurHash3_x64_128 hash of the empty string is zero.
+  EXPECT_EQ(0, NodeFingerprintSet::Fingerprint(""));
+}
+
+TEST(NodeFingerprintSetTest, SynchronizedSetIsShared) {
+  NodeFingerprintSet set;
+  SynchronizedNodeFingerprintSet shared(&set);
+  constexpr int kThreads = 4;
+  constexpr int kIdentities = 1000;
+  std::vector<int> inserted(kThreads, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&shared, &inserted, t] {
+      for (int i = 0; i < kIdentities; ++i) {
+        if (shared.Insert(absl::StrCat("node", i))) {
+          ++inserted[t];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  int total = 0;
+  for (int count : inserted) {
+    total += count;
+  }
+  EXPECT_EQ(kIdentities, total);
+  EXPECT_EQ(kIdentities, shared.size());
+  EXPECT_EQ(kIdentities, set.size());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/preamble_cache.h"
+
+#include <utility>
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendOptions.h"
+
+namespace kythe {
+
+std::shared_ptr<const clang::PrecompiledPreamble> PreambleCache::Use(
+    const std::string& key, clang::CompilerInvocation* invocation,
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>* vfs,
+    std::shared_ptr<clang::PCHContainerOperations> pch_ops) {
+  const auto& inputs = invocation->getFrontendOpts().Inputs;
+  if (inputs.size() != 1 || !inputs[0].isFile()) {
+    return nullptr;
+  }
+  auto main_file = (*vfs)->getBufferForFile(inputs[0].getFile());
+  if (!main_file) {
+    return nullptr;
+  }
+  const clang::PreambleBounds bounds = clang::ComputePreambleBounds(
+      *invocation->getLangOpts(), (*main_file)->getMemBufferRef(),
+      /*MaxLines=*/0);
+  if (bounds.Size == 0) {
+    return nullptr;
+  }
+  std::shared_ptr<const clang::PrecompiledPreamble> preamble;
+  {
+    absl::MutexLock lock(&mu_);
+    auto found = preambles_.find(key);
+    if (found != preambles_.end()) {
+      preamble = found->second;
+    }
+  }
+  if (preamble != nullptr &&
+      preamble->CanReuse(*invocation, (*main_file)->getMemBufferRef(), bounds,
+                         **vfs)) {
+    {
+      absl::MutexLock lock(&mu_);
+      ++hits_;
+    }
+    preamble->AddImplicitPreamble(*invocation, *vfs, main_file->get());
+    return preamble;
+  }
+  // Preambles are built without the indexer's callbacks; diagnostics are
+  // reported when the unit itself is parsed. The unit that builds a preamble
+  // is indexed in full so that the files it includes get their entries.
+  clang::IgnoringDiagConsumer ignore_diagnostics;
+  auto diagnostics = clang::CompilerInstance::createDiagnostics(
+      &invocation->getDiagnosticOpts(), &ignore_diagnostics,
+      /*ShouldOwnClient=*/false);
+  clang::PreambleCallbacks callbacks;
+  auto built = clang::PrecompiledPreamble::Build(
+      *invocation, main_file->get(), bounds, *diagnostics, *vfs,
+      std::move(pch_ops), /*StoreInMemory=*/true, callbacks);
+  absl::MutexLock lock(&mu_);
+  ++misses_;
+  if (built) {
+    if (preambles_.size() >= max_entries_ && !preambles_.contains(key)) {
+      preambles_.clear();
+    }
+    preambles_[key] =
+        std::make_shared<const clang::PrecompiledPreamble>(std::move(*built));
+  }
+  return nullptr;
+}
+
+uint64_t PreambleCache::hits() const {
+  absl::MutexLock lock(&mu_);
+  return hits_;
+}
+
+uint64_t PreambleCache::misses() const {
+  absl::MutexLock lock(&mu_);
+  return misses_;
+}
+
+}  // namespace kythe
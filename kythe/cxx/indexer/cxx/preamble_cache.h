@@ -0,0 +1,90 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_PREAMBLE_CACHE_H_
+#define KYTHE_CXX_INDEXER_CXX_PREAMBLE_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/PrecompiledPreamble.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/Support/VirtualFileSystem.h"
+
+namespace kythe {
+
+/// \brief Keeps a precompiled preamble (the leading #includes and other
+/// directives of a main file, compiled to an in-memory PCH) for each main
+/// file and set of arguments, so that a persistent indexer re-indexing an
+/// edited file can load its headers instead of parsing them again.
+///
+/// A preamble is only loaded once it has been built for an earlier unit, and
+/// is rebuilt when the main file's preamble region or any file it includes
+/// has changed; the unit that builds one is indexed without it. Loading a
+/// preamble skips preprocessing it, so the indexer sees no file changes,
+/// inclusions or macro definitions within it: units indexed this way produce
+/// entries only for the rest of the main file, relying on the unit that
+/// built the preamble for the rest. Safe to use from several threads.
+class PreambleCache {
+ public:
+  /// \param max_entries How many preambles to keep before starting over.
+  explicit PreambleCache(size_t max_entries) : max_entries_(max_entries) {}
+  PreambleCache(const PreambleCache&) = delete;
+  PreambleCache& operator=(const PreambleCache&) = delete;
+
+  /// \brief Makes `invocation` load the preamble kept for `key` if it still
+  /// fits its main file. Otherwise builds and keeps a new preamble for later
+  /// calls, leaving `invocation` to be indexed in full.
+  /// \param key Identifies the main file and the arguments it is compiled
+  /// with.
+  /// \param invocation The invocation to adjust.
+  /// \param vfs The filesystem the invocation reads from. If a preamble is
+  /// used, this is replaced by a filesystem that also holds the preamble.
+  /// \param pch_ops The PCH container operations to build preambles with.
+  /// \return the preamble used, which must outlive the run of `invocation`,
+  /// or null if none was used; `invocation` and `vfs` are then unchanged.
+  std::shared_ptr<const clang::PrecompiledPreamble> Use(
+      const std::string& key, clang::CompilerInvocation* invocation,
+      llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem>* vfs,
+      std::shared_ptr<clang::PCHContainerOperations> pch_ops)
+      ABSL_LOCKS_EXCLUDED(mu_);
+
+  /// \return the number of calls to `Use` that reused a preamble.
+  uint64_t hits() const ABSL_LOCKS_EXCLUDED(mu_);
+  /// \return the number of calls to `Use` that had to build one.
+  uint64_t misses() const ABSL_LOCKS_EXCLUDED(mu_);
+
+ private:
+  /// The number of preambles to keep before starting over.
+  const size_t max_entries_;
+  mutable absl::Mutex mu_;
+  absl::flat_hash_map<std::string,
+                      std::shared_ptr<const clang::PrecompiledPreamble>>
+      preambles_ ABSL_GUARDED_BY(mu_);
+  uint64_t hits_ ABSL_GUARDED_BY(mu_) = 0;
+  uint64_t misses_ ABSL_GUARDED_BY(mu_) = 0;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_PREAMBLE_CACHE_H_
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/preprocessor_context_table.h"
+
+#include <algorithm>
+
+namespace kythe {
+
+PreprocessorContextTable::ContextId PreprocessorContextTable::Intern(
+    absl::string_view context) {
+  auto found = context_ids_.find(context);
+  if (found != context_ids_.end()) {
+    return found->second;
+  }
+  context_storage_.emplace_back(context);
+  ContextId id = contexts_.size();
+  contexts_.push_back(&context_storage_.back());
+  context_ids_.emplace(context_storage_.back(), id);
+  return id;
+}
+
+void PreprocessorContextTable::Add(uint32_t file, ContextId source,
+                                   unsigned offset, ContextId dest) {
+  transitions_.push_back(Transition{file, source, offset, dest});
+  sealed_ = false;
+}
+
+void PreprocessorContextTable::Seal() {
+  if (sealed_) {
+    return;
+  }
+  std::stable_sort(transitions_.begin(), transitions_.end());
+  // Keep only the last of each run of transitions with the same key, since
+  // that's the one that was added most recently.
+  auto out = transitions_.begin();
+  for (auto in = transitions_.begin(); in != transitions_.end(); ++in) {
+    auto next = in + 1;
+    if (next == transitions_.end() || next->key() != in->key()) {
+      *out++ = *in;
+    }
+  }
+  transitions_.erase(out, transitions_.end());
+  sealed_ = true;
+}
+
+size_t PreprocessorContextTable::size() {
+  Seal();
+  return transitions_.size();
+}
+
+absl::optional<PreprocessorContextTable::ContextId>
+PreprocessorContextTable::Lookup(uint32_t file, ContextId source,
+                                 unsigned offset, Miss* miss) {
+  Seal();
+  Transition key{file, source, offset, kEmptyContext};
+  auto found = std::lower_bound(transitions_.begin(), transitions_.end(), key);
+  if (found != transitions_.end() && found->key() == key.key()) {
+    if (miss != nullptr) {
+      *miss = Miss::kNone;
+    }
+    return found->dest;
+  }
+  if (miss != nullptr) {
+    // Transitions for the same file (or file and context) form a contiguous
+    // run, so if any exist, one of them is on either side of `found`.
+    auto near = [&](bool match_source) {
+      auto matches = [&](const Transition& other) {
+        return other.file == file && (!match_source || other.source == source);
+      };
+      return (found != transitions_.end() && matches(*found)) ||
+             (found != transitions_.begin() && matches(*(found - 1)));
+    };
+    bool has_context = near(true);
+    bool has_file = has_context || near(false);
+    *miss = has_context ? Miss::kOffset
+                        : (has_file ? Miss::kContext : Miss::kFile);
+  }
+  return absl::nullopt;
+}
+
+}  // namespace kythe
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_PREPROCESSOR_CONTEXT_TABLE_H_
+#define KYTHE_CXX_INDEXER_CXX_PREPROCESSOR_CONTEXT_TABLE_H_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/optional.h"
+
+namespace kythe {
+
+/// \brief Records how `#include`s move between preprocessor contexts.
+///
+/// Contexts are interned, so callers pass small integers around instead of
+/// strings. Transitions live in a single vector sorted by (file, source
+/// context, offset) and are found by binary search. The vector is sorted
+/// the first time it is searched after a transition is added, so tables
+/// should be filled completely before they are used.
+class PreprocessorContextTable {
+ public:
+  /// Identifies an interned context.
+  using ContextId = uint32_t;
+  /// The ID of the empty context.
+  static constexpr ContextId kEmptyContext = 0;
+
+  /// Why a call to `Lookup` failed.
+  enum class Miss {
+    kNone,     ///< The lookup succeeded.
+    kFile,     ///< There are no transitions for the file.
+    kContext,  ///< The file has no transitions from the source context.
+    kOffset    ///< There is no transition at the offset.
+  };
+
+  PreprocessorContextTable() { Intern(""); }
+
+  PreprocessorContextTable(const PreprocessorContextTable&) = delete;
+  PreprocessorContextTable& operator=(const PreprocessorContextTable&) =
+      delete;
+
+  /// \brief Returns the ID for `context`, assigning one if it's new.
+  ContextId Intern(absl::string_view context);
+
+  /// \brief Returns the context with the given `id`.
+  const std::string& context(ContextId id) const { return *contexts_[id]; }
+
+  /// \brief Records that an `#include` at `offset` in `file` goes from
+  /// `source` to `dest`. Later transitions replace earlier ones for the same
+  /// file, source context and offset.
+  void Add(uint32_t file, ContextId source, unsigned offset, ContextId dest);
+
+  /// \brief Finds the context reached from `source` by the `#include` at
+  /// `offset` in `file`.
+  /// \param miss If not null, set to the reason the lookup failed.
+  absl::optional<ContextId> Lookup(uint32_t file, ContextId source,
+                                   unsigned offset, Miss* miss = nullptr);
+
+  /// \brief Returns the number of distinct transitions.
+  size_t size();
+
+ private:
+  struct Transition {
+    uint32_t file;
+    ContextId source;
+    unsigned offset;
+    ContextId dest;
+    std::tuple<uint32_t, ContextId, unsigned> key() const {
+      return std::make_tuple(file, source, offset);
+    }
+    bool operator<(const Transition& other) const {
+      return key() < other.key();
+    }
+  };
+
+  /// Sorts `transitions_` and drops replaced transitions, if needed.
+  void Seal();
+
+  /// Interned contexts, by ID.
+  std::vector<const std::string*> contexts_;
+  /// Owns the interned strings.
+  std::deque<std::string> context_storage_;
+  /// Maps from contexts to their IDs.
+  absl::flat_hash_map<absl::string_view, ContextId> context_ids_;
+  /// All transitions, sorted by (file, source, offset) when `sealed_`.
+  std::vector<Transition> transitions_;
+  /// Whether `transitions_` is sorted and free of duplicates.
+  bool sealed_ = true;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_PREPROCESSOR_CONTEXT_TABLE_H_
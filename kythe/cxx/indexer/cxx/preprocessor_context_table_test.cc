@@ -0,0 +1,91 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/preprocessor_context_table.h"
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+using Miss = PreprocessorContextTable::Miss;
+
+TEST(PreprocessorContextTableTest, InternsContexts) {
+  PreprocessorContextTable table;
+  EXPECT_EQ(PreprocessorContextTable::kEmptyContext, table.Intern(""));
+  auto a = table.Intern("a");
+  EXPECT_EQ(a, table.Intern("a"));
+  EXPECT_NE(a, table.Intern("b"));
+  EXPECT_EQ("a", table.context(a));
+  EXPECT_EQ("", table.context(PreprocessorContextTable::kEmptyContext));
+}
+
+TEST(PreprocessorContextTableTest, FindsTransitions) {
+  PreprocessorContextTable table;
+  auto a = table.Intern("a");
+  auto b = table.Intern("b");
+  auto c = table.Intern("c");
+  table.Add(1, a, 10, b);
+  table.Add(0, a, 10, c);
+  table.Add(1, b, 20, c);
+  table.Add(1, a, 5, c);
+  Miss miss = Miss::kFile;
+  EXPECT_EQ(b, table.Lookup(1, a, 10, &miss));
+  EXPECT_EQ(Miss::kNone, miss);
+  EXPECT_EQ(c, table.Lookup(0, a, 10));
+  EXPECT_EQ(c, table.Lookup(1, b, 20));
+  EXPECT_EQ(c, table.Lookup(1, a, 5));
+}
+
+TEST(PreprocessorContextTableTest, ReportsMisses) {
+  PreprocessorContextTable table;
+  auto a = table.Intern("a");
+  auto b = table.Intern("b");
+  auto c = table.Intern("c");
+  table.Add(1, b, 10, c);
+  table.Add(3, b, 10, c);
+  Miss miss = Miss::kNone;
+  EXPECT_FALSE(table.Lookup(1, b, 11, &miss));
+  EXPECT_EQ(Miss::kOffset, miss);
+  EXPECT_FALSE(table.Lookup(1, b, 9, &miss));
+  EXPECT_EQ(Miss::kOffset, miss);
+  EXPECT_FALSE(table.Lookup(1, a, 10, &miss));
+  EXPECT_EQ(Miss::kContext, miss);
+  EXPECT_FALSE(table.Lookup(1, c, 10, &miss));
+  EXPECT_EQ(Miss::kContext, miss);
+  EXPECT_FALSE(table.Lookup(2, b, 10, &miss));
+  EXPECT_EQ(Miss::kFile, miss);
+  EXPECT_FALSE(table.Lookup(4, b, 10, &miss));
+  EXPECT_EQ(Miss::kFile, miss);
+}
+
+TEST(PreprocessorContextTableTest, LaterTransitionsReplaceEarlierOnes) {
+  PreprocessorContextTable table;
+  auto a = table.Intern("a");
+  auto b = table.Intern("b");
+  auto c = table.Intern("c");
+  table.Add(0, a, 1, b);
+  table.Add(0, a, 1, c);
+  EXPECT_EQ(c, table.Lookup(0, a, 1));
+  EXPECT_EQ(1, table.size());
+  table.Add(0, a, 1, b);
+  EXPECT_EQ(b, table.Lookup(0, a, 1));
+  EXPECT_EQ(1, table.size());
+}
+
+}  // namespace
+}  // namespace kythe
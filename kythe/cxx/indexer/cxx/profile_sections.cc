@@ -0,0 +1,49 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/profile_sections.h"
+
+#include "absl/strings/str_format.h"
+
+namespace kythe {
+
+SectionCounters::Counts SectionCounters::Take() {
+  Counts counts = counts_;
+  counts_ = Counts();
+  return counts;
+}
+
+void SectionCounters::AppendSummary(const Counts& counts, std::string* out) {
+  absl::StrAppendFormat(out, "%-48s %10s %16s", "section", "count", "cycles");
+  if (kAllocationCountersEnabled) {
+    absl::StrAppendFormat(out, " %16s %16s", "alloc_bytes", "retained_bytes");
+  }
+  out->push_back('\n');
+  for (size_t i = 0; i < kProfileSectionCount; ++i) {
+    if (counts[i].count == 0) {
+      continue;
+    }
+    absl::StrAppendFormat(out, "%-48s %10d %16d", kProfileSectionNames[i],
+                          counts[i].count, counts[i].cycles);
+    if (kAllocationCountersEnabled) {
+      absl::StrAppendFormat(out, " %16d %16d", counts[i].allocated_bytes,
+                            counts[i].retained_bytes);
+    }
+    out->push_back('\n');
+  }
+}
+
+}  // namespace kythe
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_PROFILE_SECTIONS_H_
+#define KYTHE_CXX_INDEXER_CXX_PROFILE_SECTIONS_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "kythe/cxx/indexer/cxx/allocation_counter.h"
+
+namespace kythe {
+
+/// \brief The sections of the indexer that `ProfileBlock` measures.
+enum class ProfileSection : uint8_t {
+  kRunInvocation,
+  kTraverseTu,
+  kBuildParentMap,
+  kRecordDataflow,
+  kBuildType,
+  kGenerateMarkedSource,
+  kApplyMetadataFile,
+  kClaimBatch,
+};
+
+/// \brief The number of `ProfileSection`s.
+inline constexpr size_t kProfileSectionCount = 8;
+
+/// \brief The label of each `ProfileSection`, in order. Labels are lowercase
+/// words separated by underscores.
+inline constexpr const char* kProfileSectionNames[kProfileSectionCount] = {
+    "run_invocation",
+    "traverse_tu",
+    "build_parent_map",
+    "record_dataflow",
+    "build_type",
+    "generate_marked_source",
+    "apply_metadata_file",
+    "claim_batch",
+};
+
+/// \return the label of `section`.
+constexpr const char* ProfileSectionName(ProfileSection section) {
+  return kProfileSectionNames[static_cast<size_t>(section)];
+}
+
+/// \brief Whether `ProfileBlock` feeds `SectionCounters`. Build with
+/// `--copt=-DKYTHE_SECTION_COUNTERS` to turn them on; otherwise they compile
+/// away entirely.
+#if defined(KYTHE_SECTION_COUNTERS)
+inline constexpr bool kSectionCountersEnabled = true;
+#else
+inline constexpr bool kSectionCountersEnabled = false;
+#endif
+
+/// \brief Reads a cheap, monotonically increasing cycle counter. The units
+/// are only comparable with each other.
+inline uint64_t ReadCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+/// \brief How often a section was entered and how long it took.
+struct SectionCount {
+  /// The number of times the section was left.
+  uint64_t count = 0;
+  /// The cycles spent in the section, including nested sections.
+  uint64_t cycles = 0;
+  /// The heap bytes allocated in the section, including nested sections.
+  /// Only counted when `kAllocationCountersEnabled`.
+  int64_t allocated_bytes = 0;
+  /// The part of those bytes that was still allocated on leaving the
+  /// section (net of anything the section freed).
+  int64_t retained_bytes = 0;
+};
+
+/// \brief Totals for every `ProfileSection` on one thread.
+///
+/// Each thread has its own counters so that recording a section takes no
+/// locks or atomics. A unit is indexed on a single thread, so taking that
+/// thread's counts after indexing it yields the unit's counts.
+class SectionCounters {
+ public:
+  using Counts = std::array<SectionCount, kProfileSectionCount>;
+
+  /// \return the counters for the calling thread.
+  static SectionCounters& ThisThread() {
+    static thread_local SectionCounters counters;
+    return counters;
+  }
+
+  /// \brief Records that `section` was left after `cycles`, during which
+  /// the thread made `allocations`.
+  void Add(ProfileSection section, uint64_t cycles,
+           const AllocationCounts& allocations = {}) {
+    SectionCount& count = counts_[static_cast<size_t>(section)];
+    ++count.count;
+    count.cycles += cycles;
+    count.allocated_bytes += allocations.allocated;
+    count.retained_bytes += allocations.retained();
+  }
+
+  /// \return the counts recorded since the last `Take`.
+  const Counts& counts() const { return counts_; }
+
+  /// \return the counts recorded since the last `Take` and resets them.
+  Counts Take();
+
+  /// \brief Appends a table of the sections in `counts` that were entered
+  /// to `out`.
+  static void AppendSummary(const Counts& counts, std::string* out);
+
+ private:
+  Counts counts_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_PROFILE_SECTIONS_H_
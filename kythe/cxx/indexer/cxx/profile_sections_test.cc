@@ -0,0 +1,88 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/profile_sections.h"
+
+#include <string>
+#include <thread>
+
+#include "absl/strings/match.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(ProfileSectionsTest, NamesFollowSections) {
+  EXPECT_STREQ("run_invocation",
+               ProfileSectionName(ProfileSection::kRunInvocation));
+  EXPECT_STREQ("claim_batch", ProfileSectionName(ProfileSection::kClaimBatch));
+  static_assert(static_cast<size_t>(ProfileSection::kClaimBatch) + 1 ==
+                    kProfileSectionCount,
+                "every section needs a name");
+}
+
+TEST(ProfileSectionsTest, CountersAreTakenAndReset) {
+  SectionCounters& counters = SectionCounters::ThisThread();
+  counters.Take();
+  counters.Add(ProfileSection::kBuildType, 10);
+  counters.Add(ProfileSection::kBuildType, 5);
+  counters.Add(ProfileSection::kClaimBatch, 1);
+  SectionCounters::Counts counts = counters.Take();
+  const auto& build_type =
+      counts[static_cast<size_t>(ProfileSection::kBuildType)];
+  EXPECT_EQ(2, build_type.count);
+  EXPECT_EQ(15, build_type.cycles);
+  EXPECT_EQ(1, counts[static_cast<size_t>(ProfileSection::kClaimBatch)].count);
+  EXPECT_EQ(0, counters.Take()[static_cast<size_t>(ProfileSection::kBuildType)]
+                   .count);
+
+  std::string summary;
+  SectionCounters::AppendSummary(counts, &summary);
+  EXPECT_TRUE(absl::StrContains(summary, "build_type"));
+  EXPECT_TRUE(absl::StrContains(summary, "claim_batch"));
+  EXPECT_FALSE(absl::StrContains(summary, "traverse_tu"));
+}
+
+TEST(ProfileSectionsTest, CountersSumAllocations) {
+  SectionCounters& counters = SectionCounters::ThisThread();
+  counters.Take();
+  counters.Add(ProfileSection::kBuildParentMap, 1, {100, 40});
+  counters.Add(ProfileSection::kBuildParentMap, 1, {50, 0});
+  const auto& parent_map =
+      counters.Take()[static_cast<size_t>(ProfileSection::kBuildParentMap)];
+  EXPECT_EQ(150, parent_map.allocated_bytes);
+  EXPECT_EQ(110, parent_map.retained_bytes);
+}
+
+TEST(ProfileSectionsTest, ThreadsCountSeparately) {
+  SectionCounters::ThisThread().Take();
+  std::thread other([] {
+    SectionCounters::ThisThread().Add(ProfileSection::kTraverseTu, 1);
+  });
+  other.join();
+  EXPECT_EQ(0, SectionCounters::ThisThread()
+                   .counts()[static_cast<size_t>(ProfileSection::kTraverseTu)]
+                   .count);
+}
+
+TEST(ProfileSectionsTest, CycleCounterDoesNotGoBackwards) {
+  uint64_t first = ReadCycleCounter();
+  uint64_t second = ReadCycleCounter();
+  EXPECT_LE(first, second);
+}
+
+}  // namespace
+}  // namespace kythe
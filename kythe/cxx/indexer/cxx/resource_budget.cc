@@ -0,0 +1,137 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/resource_budget.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+namespace kythe {
+
+size_t ResourceBudget::CurrentRssBytes() {
+#if defined(__linux__)
+  FILE* statm = ::fopen("/proc/self/statm", "r");
+  if (statm == nullptr) {
+    return 0;
+  }
+  unsigned long size_pages = 0, rss_pages = 0;
+  int read = ::fscanf(statm, "%lu %lu", &size_pages, &rss_pages);
+  ::fclose(statm);
+  if (read != 2) {
+    return 0;
+  }
+  return static_cast<size_t>(rss_pages) * ::sysconf(_SC_PAGESIZE);
+#else
+  return 0;
+#endif
+}
+
+size_t ResourceBudget::PeakRssBytes() {
+#if defined(__linux__)
+  struct rusage usage;
+  if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  // Linux reports the high-water mark in KiB.
+  return static_cast<size_t>(usage.ru_maxrss) << 10;
+#else
+  return 0;
+#endif
+}
+
+ResourceBudget::ResourceBudget(const ResourceLimits& limits,
+                               std::function<absl::Time()> clock,
+                               std::function<size_t()> rss)
+    : limits_(limits),
+      clock_(std::move(clock)),
+      rss_(std::move(rss)),
+      start_(clock_()),
+      start_rss_(limits_.max_rss_bytes > 0 && limits_.charge_rss_growth
+                     ? rss_()
+                     : 0) {}
+
+BudgetLevel ResourceBudget::Check() {
+  if (++calls_since_check_ < kCheckInterval) {
+    return level_;
+  }
+  return CheckNow();
+}
+
+BudgetLevel ResourceBudget::CheckNow() {
+  calls_since_check_ = 0;
+  if (!limits_.any() || level_ == BudgetLevel::kNoMarkedSource) {
+    return level_;
+  }
+  // The largest fraction of any limit that has been used, along with the
+  // resource that it belongs to.
+  double used = 0.0;
+  const char* resource = nullptr;
+  auto consider = [&](double fraction, const char* name) {
+    if (fraction > used) {
+      used = fraction;
+      resource = name;
+    }
+  };
+  if (limits_.max_wall_time > absl::ZeroDuration()) {
+    consider(absl::FDivDuration(clock_() - start_, limits_.max_wall_time),
+             "time");
+  }
+  if (limits_.max_rss_bytes > 0) {
+    const size_t rss = rss_();
+    consider(static_cast<double>(rss > start_rss_ ? rss - start_rss_ : 0) /
+                 limits_.max_rss_bytes,
+             "memory");
+  }
+  if (limits_.max_entries > 0) {
+    consider(static_cast<double>(entries_) / limits_.max_entries, "entries");
+  }
+  BudgetLevel level = BudgetLevel::kFull;
+  if (used >= 1.5) {
+    level = BudgetLevel::kNoMarkedSource;
+  } else if (used >= 1.25) {
+    level = BudgetLevel::kNoDataflow;
+  } else if (used >= 1.0) {
+    level = BudgetLevel::kNoInstantiations;
+  }
+  if (level > level_) {
+    if (exhausted_resource_ == nullptr) {
+      exhausted_resource_ = resource;
+    }
+    level_ = level;
+  }
+  return level_;
+}
+
+const char* DescribeBudgetLevel(BudgetLevel level) {
+  switch (level) {
+    case BudgetLevel::kFull:
+      return "indexing everything";
+    case BudgetLevel::kNoInstantiations:
+      return "skipping template instantiations";
+    case BudgetLevel::kNoDataflow:
+      return "skipping template instantiations and dataflow edges";
+    case BudgetLevel::kNoMarkedSource:
+      return "skipping template instantiations, dataflow edges and marked "
+             "source";
+  }
+  return "unknown";
+}
+
+}  // namespace kythe
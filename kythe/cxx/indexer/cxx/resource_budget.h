@@ -0,0 +1,128 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_RESOURCE_BUDGET_H_
+#define KYTHE_CXX_INDEXER_CXX_RESOURCE_BUDGET_H_
+
+#include <cstddef>
+#include <functional>
+
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace kythe {
+
+/// \brief Limits on the resources a single compilation unit may use.
+///
+/// Zero (or a zero duration) means that a resource is unlimited.
+struct ResourceLimits {
+  /// The wall time the unit may take, measured from the budget's creation.
+  absl::Duration max_wall_time = absl::ZeroDuration();
+  /// The resident set size the process may reach, or with
+  /// `charge_rss_growth` the amount it may grow while the unit is indexed.
+  size_t max_rss_bytes = 0;
+  /// If true, the unit is charged only for the growth of the resident set
+  /// since its budget was created, rather than for all of it. Meant for
+  /// units indexed concurrently, each of which gets a share of the memory.
+  bool charge_rss_growth = false;
+  /// The number of facts and edges the unit may emit.
+  size_t max_entries = 0;
+
+  /// \return true if any resource is limited.
+  bool any() const {
+    return max_wall_time > absl::ZeroDuration() || max_rss_bytes > 0 ||
+           max_entries > 0;
+  }
+};
+
+/// \brief How much indexing has been scaled back to stay within budget.
+///
+/// Levels are cumulative: each one also implies the ones before it.
+enum class BudgetLevel : int {
+  kFull = 0,              ///< Nothing has been disabled.
+  kNoInstantiations = 1,  ///< Template instantiations are no longer indexed.
+  kNoDataflow = 2,        ///< Dataflow edges are no longer emitted.
+  kNoMarkedSource = 3,    ///< Marked source is no longer generated.
+};
+
+/// \brief Tracks a unit's resource usage against a set of `ResourceLimits`.
+///
+/// Once usage crosses 100% of any limit, the budget reports
+/// `kNoInstantiations`; at 125% it reports `kNoDataflow` and at 150%
+/// `kNoMarkedSource`. The level never decreases. ResourceBudget is not
+/// thread-safe; it belongs to the thread indexing its unit.
+class ResourceBudget {
+ public:
+  /// \brief Returns the process's current resident set size in bytes, or 0
+  /// if it cannot be determined.
+  static size_t CurrentRssBytes();
+
+  /// \brief Returns the largest resident set size the process has had so
+  /// far in bytes, or 0 if it cannot be determined.
+  static size_t PeakRssBytes();
+
+  /// \param limits The limits to enforce.
+  /// \param clock Returns the current time.
+  /// \param rss Returns the current resident set size in bytes.
+  explicit ResourceBudget(
+      const ResourceLimits& limits,
+      std::function<absl::Time()> clock = [] { return absl::Now(); },
+      std::function<size_t()> rss = &ResourceBudget::CurrentRssBytes);
+
+  /// \brief Records that `count` entries were emitted.
+  void AddEntries(size_t count) { entries_ += count; }
+
+  /// \brief Re-evaluates usage (at most once every `kCheckInterval` calls)
+  /// and returns the current level.
+  BudgetLevel Check();
+
+  /// \brief Re-evaluates usage now and returns the current level.
+  BudgetLevel CheckNow();
+
+  /// \return the current level without re-evaluating usage.
+  BudgetLevel level() const { return level_; }
+
+  /// \return the name of the resource ("time", "memory" or "entries") that
+  /// first pushed the level above `kFull`, or nullptr if none has.
+  const char* exhausted_resource() const { return exhausted_resource_; }
+
+  /// The number of `Check` calls between evaluations.
+  static constexpr size_t kCheckInterval = 1024;
+
+ private:
+  const ResourceLimits limits_;
+  const std::function<absl::Time()> clock_;
+  const std::function<size_t()> rss_;
+  /// When the budget was created.
+  const absl::Time start_;
+  /// The resident set size not charged to the unit.
+  const size_t start_rss_;
+  /// The number of entries emitted so far.
+  size_t entries_ = 0;
+  /// The number of `Check` calls since the last evaluation.
+  size_t calls_since_check_ = 0;
+  /// The current level.
+  BudgetLevel level_ = BudgetLevel::kFull;
+  /// The resource that first exceeded its limit.
+  const char* exhausted_resource_ = nullptr;
+};
+
+/// \return a description of what indexing stops doing at `level`.
+const char* DescribeBudgetLevel(BudgetLevel level);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_RESOURCE_BUDGET_H_
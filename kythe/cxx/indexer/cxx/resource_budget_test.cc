@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/resource_budget.h"
+
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(ResourceBudgetTest, UnlimitedNeverDegrades) {
+  ResourceBudget budget(ResourceLimits{});
+  budget.AddEntries(1000000);
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kFull);
+  EXPECT_EQ(budget.exhausted_resource(), nullptr);
+}
+
+TEST(ResourceBudgetTest, EntriesDegradeProgressively) {
+  ResourceLimits limits;
+  limits.max_entries = 100;
+  ResourceBudget budget(limits);
+  budget.AddEntries(99);
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kFull);
+  budget.AddEntries(1);
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kNoInstantiations);
+  EXPECT_STREQ(budget.exhausted_resource(), "entries");
+  budget.AddEntries(25);
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kNoDataflow);
+  budget.AddEntries(25);
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kNoMarkedSource);
+}
+
+TEST(ResourceBudgetTest, TimeAndMemory) {
+  absl::Time now = absl::UnixEpoch();
+  size_t rss = 0;
+  ResourceLimits limits;
+  limits.max_wall_time = absl::Seconds(10);
+  limits.max_rss_bytes = 1000;
+  ResourceBudget budget(
+      limits, [&now] { return now; }, [&rss] { return rss; });
+  now += absl::Seconds(5);
+  rss = 500;
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kFull);
+  rss = 1300;
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kNoDataflow);
+  EXPECT_STREQ(budget.exhausted_resource(), "memory");
+  // The level never goes down, and the first exhausted resource sticks.
+  rss = 0;
+  now += absl::Seconds(11);
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kNoMarkedSource);
+  EXPECT_STREQ(budget.exhausted_resource(), "memory");
+}
+
+TEST(ResourceBudgetTest, ChargesOnlyRssGrowth) {
+  size_t rss = 5000;
+  ResourceLimits limits;
+  limits.max_rss_bytes = 1000;
+  limits.charge_rss_growth = true;
+  ResourceBudget budget(
+      limits, [] { return absl::UnixEpoch(); }, [&rss] { return rss; });
+  rss = 5900;
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kFull);
+  rss = 3000;
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kFull);
+  rss = 6000;
+  EXPECT_EQ(budget.CheckNow(), BudgetLevel::kNoInstantiations);
+  EXPECT_STREQ(budget.exhausted_resource(), "memory");
+}
+
+TEST(ResourceBudgetTest, CheckIsRateLimited) {
+  ResourceLimits limits;
+  limits.max_entries = 1;
+  ResourceBudget budget(limits);
+  budget.AddEntries(10);
+  for (size_t i = 1; i < ResourceBudget::kCheckInterval; ++i) {
+    EXPECT_EQ(budget.Check(), BudgetLevel::kFull);
+  }
+  EXPECT_EQ(budget.Check(), BudgetLevel::kNoMarkedSource);
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_SCRATCH_STRING_POOL_H_
+#define KYTHE_CXX_INDEXER_CXX_SCRATCH_STRING_POOL_H_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace kythe {
+
+/// \brief Hands out empty strings that keep the capacity they grew to.
+///
+/// Code that builds many short-lived strings, such as the identities of
+/// NodeIds, stops allocating for them once the pool is warm. Leases may be
+/// held at once (for example, by recursive calls), in which case each gets
+/// its own string.
+class ScratchStringPool {
+ public:
+  /// \brief A string borrowed from a pool, returned when the lease ends.
+  class Lease {
+   public:
+    Lease(Lease&& other)
+        : pool_(other.pool_), string_(std::move(other.string_)) {
+      other.pool_ = nullptr;
+    }
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease& operator=(Lease&&) = delete;
+    ~Lease() {
+      if (pool_ != nullptr) {
+        pool_->Release(std::move(string_));
+      }
+    }
+
+    std::string& operator*() { return string_; }
+    std::string* operator->() { return &string_; }
+    std::string* get() { return &string_; }
+
+   private:
+    friend class ScratchStringPool;
+    Lease(ScratchStringPool* pool, std::string string)
+        : pool_(pool), string_(std::move(string)) {}
+
+    ScratchStringPool* pool_;
+    std::string string_;
+  };
+
+  /// \param max_capacity Strings that grew beyond this many bytes are freed
+  /// rather than kept, so one huge identity doesn't stay allocated.
+  explicit ScratchStringPool(size_t max_capacity = kDefaultMaxCapacity)
+      : max_capacity_(max_capacity) {}
+  ScratchStringPool(const ScratchStringPool&) = delete;
+  ScratchStringPool& operator=(const ScratchStringPool&) = delete;
+
+  /// \return an empty string to use until the lease ends. The pool must
+  /// outlive the lease.
+  Lease Acquire() {
+    if (free_.empty()) {
+      return Lease(this, std::string());
+    }
+    std::string string = std::move(free_.back());
+    free_.pop_back();
+    return Lease(this, std::move(string));
+  }
+
+  /// \return the number of strings waiting to be reused.
+  size_t free_count() const { return free_.size(); }
+
+  static constexpr size_t kDefaultMaxCapacity = 4096;
+
+ private:
+  void Release(std::string string) {
+    if (string.capacity() <= max_capacity_) {
+      string.clear();
+      free_.push_back(std::move(string));
+    }
+  }
+
+  /// The largest capacity of a string worth keeping.
+  size_t max_capacity_;
+  /// Strings returned by expired leases.
+  std::vector<std::string> free_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_SCRATCH_STRING_POOL_H_
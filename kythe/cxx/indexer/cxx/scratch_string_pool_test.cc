@@ -0,0 +1,77 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/scratch_string_pool.h"
+
+#include <string>
+#include <utility>
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(ScratchStringPoolTest, ReusesCapacity) {
+  ScratchStringPool pool;
+  const char* data = nullptr;
+  {
+    auto lease = pool.Acquire();
+    lease->assign(100, 'x');
+    data = lease->data();
+  }
+  EXPECT_EQ(1, pool.free_count());
+  auto lease = pool.Acquire();
+  EXPECT_TRUE(lease->empty());
+  EXPECT_GE(lease->capacity(), 100);
+  EXPECT_EQ(data, lease->data());
+  EXPECT_EQ(0, pool.free_count());
+}
+
+TEST(ScratchStringPoolTest, NestedLeasesAreDistinct) {
+  ScratchStringPool pool;
+  auto outer = pool.Acquire();
+  outer->append("outer");
+  {
+    auto inner = pool.Acquire();
+    inner->append("inner");
+    EXPECT_NE(outer.get(), inner.get());
+  }
+  EXPECT_EQ("outer", *outer);
+  EXPECT_EQ(1, pool.free_count());
+}
+
+TEST(ScratchStringPoolTest, DropsLargeStrings) {
+  ScratchStringPool pool(16);
+  {
+    auto lease = pool.Acquire();
+    lease->assign(1000, 'x');
+  }
+  EXPECT_EQ(0, pool.free_count());
+}
+
+TEST(ScratchStringPoolTest, MovedLeaseReturnsOnce) {
+  ScratchStringPool pool;
+  {
+    auto first = pool.Acquire();
+    auto second = std::move(first);
+    second->append("moved");
+  }
+  EXPECT_EQ(1, pool.free_count());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -98,35 +98,41 @@ uint64_t SemanticHash::Hash(const clang::TemplateArgument& arg) const {
 }
 
 uint64_t SemanticHash::Hash(const clang::QualType& type) const {
-  return std::hash<std::string>()(type.getCanonicalType().getAsString());
+  clang::QualType canonical = type.getCanonicalType();
+  return Memoize(canonical.getAsOpaquePtr(), [&] {
+    return std::hash<std::string>()(canonical.getAsString());
+  });
 }
 
 uint64_t SemanticHash::Hash(const clang::EnumDecl* decl) const {
-  // Memoize semantic hashes for enums, as they are also needed to create
-  // names for enum constants.
-  auto inserted = enum_cache_.insert({decl, 0});
-  if (!inserted.second) return inserted.first->second;
-
-  // TODO(zarko): Do we need a better hash function?
-  uint64_t hash = 0;
-  for (auto member : decl->enumerators()) {
-    if (member->getDeclName().isIdentifier()) {
-      hash ^= std::hash<std::string>()(std::string(member->getName()));
+  // Enum hashes are also needed to create names for enum constants.
+  return Memoize(decl, [&] {
+    // TODO(zarko): Do we need a better hash function?
+    uint64_t hash = 0;
+    for (auto member : decl->enumerators()) {
+      if (member->getDeclName().isIdentifier()) {
+        hash ^= std::hash<std::string>()(std::string(member->getName()));
+      }
     }
-  }
-  inserted.first->second = hash;
-  return hash;
+    return hash;
+  });
 }
 
 uint64_t SemanticHash::Hash(const clang::TemplateArgumentList* arg_list) const {
-  uint64_t hash = 0;
-  for (const auto& arg : arg_list->asArray()) {
-    hash ^= Hash(arg);
-  }
-  return hash;
+  return Memoize(arg_list, [&] {
+    uint64_t hash = 0;
+    for (const auto& arg : arg_list->asArray()) {
+      hash ^= Hash(arg);
+    }
+    return hash;
+  });
 }
 
 uint64_t SemanticHash::Hash(const clang::RecordDecl* decl) const {
+  return Memoize(decl, [&] { return HashRecord(decl); });
+}
+
+uint64_t SemanticHash::HashRecord(const clang::RecordDecl* decl) const {
   // TODO(zarko): Do we need a better hash function? We may need to
   // hash the type variable context all the way up to the root template.
   uint64_t hash = 0;
@@ -93,14 +93,33 @@ class SemanticHash {
   /// specialization).
   uint64_t HashTemplateDeclish(const clang::Decl* decl) const;
 
+  /// \brief Builds the (unmemoized) semantic hash of `decl`.
+  uint64_t HashRecord(const clang::RecordDecl* decl) const;
+
+  /// \brief Returns the hash remembered for `key` or, if there isn't one,
+  /// remembers and returns `compute()`.
+  template <typename F>
+  uint64_t Memoize(const void* key, F&& compute) const {
+    if (auto found = cache_.find(key); found != cache_.end()) {
+      return found->second;
+    }
+    // `compute` may recurse and grow the cache, so don't hold an iterator.
+    uint64_t hash = compute();
+    cache_[key] = hash;
+    return hash;
+  }
+
   /// \brief Whether or not to ignore unimplemented nodes.
   bool ignore_unimplemented_;
 
   /// \brief Function to call when generating strings for template Decls.
   std::function<std::string(const clang::Decl*)> decl_string_;
 
-  /// \brief Maps EnumDecls to semantic hashes.
-  mutable llvm::DenseMap<const clang::EnumDecl*, uint64_t> enum_cache_;
+  /// \brief Maps canonical types (by opaque pointer), template argument
+  /// lists, records and enums to their semantic hashes. These all live in the
+  /// ASTContext, so entries stay valid for as long as the translation unit
+  /// this hasher is used for.
+  mutable llvm::DenseMap<const void*, uint64_t> cache_;
 };
 
 }  // namespace kythe
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/slice_hasher.h"
+
+#include "glog/logging.h"
+
+namespace kythe {
+
+uint64_t SliceHasher::Hash(absl::string_view buffer, size_t begin,
+                           size_t end) {
+  CHECK_LE(begin, end);
+  CHECK_LE(end, buffer.size());
+  while (prefixes_.size() <= end) {
+    // Adding one keeps runs of zero bytes from all hashing alike.
+    unsigned char byte = buffer[prefixes_.size() - 1];
+    prefixes_.push_back(prefixes_.back() * kBase + byte + 1);
+    powers_.push_back(powers_.back() * kBase);
+  }
+  // Arithmetic is modulo 2^64.
+  return prefixes_[end] - prefixes_[begin] * powers_[end - begin];
+}
+
+}  // namespace kythe
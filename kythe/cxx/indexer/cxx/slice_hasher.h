@@ -0,0 +1,61 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_CXX_SLICE_HASHER_H_
+#define KYTHE_CXX_INDEXER_CXX_SLICE_HASHER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+
+namespace kythe {
+
+/// \brief Hashes slices of a buffer in constant time.
+///
+/// The hasher keeps a polynomial hash of every prefix of the buffer, so the
+/// hash of any slice can be computed from the hashes of two prefixes. The
+/// prefix table is extended only as far as the slices requested so far, so
+/// the buffer may grow (as Clang's scratch buffers do) between calls as long
+/// as bytes that have already been hashed don't change.
+///
+/// The hash of a slice depends only on its contents, not on where it appears
+/// in the buffer.
+class SliceHasher {
+ public:
+  SliceHasher() : prefixes_{0}, powers_{1} {}
+
+  /// \brief Returns the hash of `buffer.substr(begin, end - begin)`.
+  ///
+  /// `buffer` must start with the same bytes every time the same hasher is
+  /// used, up to the largest `end` passed so far.
+  uint64_t Hash(absl::string_view buffer, size_t begin, size_t end);
+
+ private:
+  /// The multiplier for the polynomial hash.
+  static constexpr uint64_t kBase = 0x100000001b3ULL;
+
+  /// `prefixes_[i]` is the hash of the first `i` bytes of the buffer.
+  std::vector<uint64_t> prefixes_;
+  /// `powers_[i]` is `kBase` to the `i`th power.
+  std::vector<uint64_t> powers_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_SLICE_HASHER_H_
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/slice_hasher.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(SliceHasherTest, HashDependsOnlyOnContents) {
+  SliceHasher hasher;
+  absl::string_view buffer = "abc xyz abc";
+  EXPECT_EQ(hasher.Hash(buffer, 0, 3), hasher.Hash(buffer, 8, 11));
+  EXPECT_NE(hasher.Hash(buffer, 0, 3), hasher.Hash(buffer, 4, 7));
+  EXPECT_EQ(hasher.Hash(buffer, 3, 3), hasher.Hash(buffer, 0, 0));
+}
+
+TEST(SliceHasherTest, MatchesFreshHasher) {
+  absl::string_view buffer = "int main() { return 0; }";
+  SliceHasher shared;
+  shared.Hash(buffer, 0, buffer.size());
+  for (size_t begin = 0; begin < buffer.size(); ++begin) {
+    for (size_t end = begin; end <= buffer.size(); ++end) {
+      SliceHasher fresh;
+      EXPECT_EQ(fresh.Hash(buffer.substr(begin), 0, end - begin),
+                shared.Hash(buffer, begin, end));
+    }
+  }
+}
+
+TEST(SliceHasherTest, DistinguishesZeroRuns) {
+  std::string buffer(4, '\0');
+  SliceHasher hasher;
+  EXPECT_NE(hasher.Hash(buffer, 0, 1), hasher.Hash(buffer, 0, 2));
+  EXPECT_NE(hasher.Hash(buffer, 0, 0), hasher.Hash(buffer, 0, 1));
+}
+
+TEST(SliceHasherTest, FollowsGrowingBuffer) {
+  std::string buffer = "ab";
+  SliceHasher hasher;
+  uint64_t ab = hasher.Hash(buffer, 0, 2);
+  buffer.append("ab");
+  EXPECT_EQ(ab, hasher.Hash(buffer, 2, 4));
+  EXPECT_EQ(ab, hasher.Hash(buffer, 0, 2));
+}
+
+}  // namespace
+}  // namespace kythe
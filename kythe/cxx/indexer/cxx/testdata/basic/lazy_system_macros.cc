@@ -0,0 +1,21 @@
+// Checks that system macros used outside of system headers are still
+// defined when their definitions are recorded lazily.
+#include "lazy_system_macros.h"
+
+//- @USED_IN_MAIN ref/expands MacroUsed
+//- MacroUsed.node/kind macro
+//- DefUsed defines/binding MacroUsed
+int x = USED_IN_MAIN;
+
+//- @TESTED_IN_MAIN ref/queries MacroTested
+//- MacroTested.node/kind macro
+//- DefTested defines/binding MacroTested
+#ifdef TESTED_IN_MAIN
+#endif
+
+// UNUSED_IN_MAIN (bytes 83-97 of the header) is only used in the system
+// header, so no anchor or macro node is recorded for its definition.
+//- !{ DefUnused.loc/start 83
+//-    DefUnused.loc/end 97 }
+//- !{ DefUnusedBinding defines/binding MacroUnused
+//-    DefUnusedBinding.loc/start 83 }
@@ -0,0 +1,5 @@
+#pragma GCC system_header
+
+#define USED_IN_MAIN 1
+#define TESTED_IN_MAIN 2
+#define UNUSED_IN_MAIN USED_IN_MAIN
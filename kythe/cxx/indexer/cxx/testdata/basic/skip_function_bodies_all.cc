@@ -0,0 +1,10 @@
+// Checks that skipped function bodies aren't indexed.
+//- @global defines/binding VarGlobal
+int global;
+
+//- @f defines/binding FnF
+//- FnF.complete definition
+void f() {
+  //- !{ @global ref VarGlobal }
+  global = 1;
+}
@@ -0,0 +1,14 @@
+// Checks that bodies in the main source file are still indexed when only
+// bodies in headers are skipped.
+#include "skip_function_bodies_headers.h"
+
+//- @f defines/binding FnF
+//- FnF.complete definition
+void f() {
+  //- @global ref VarGlobal
+  //- VarGlobal.node/kind variable
+  global = 1;
+  //- @g ref FnG
+  //- FnG.complete definition
+  g();
+}
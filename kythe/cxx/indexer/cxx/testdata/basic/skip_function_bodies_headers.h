@@ -0,0 +1,3 @@
+int global;
+
+inline void g() { global = 2; }
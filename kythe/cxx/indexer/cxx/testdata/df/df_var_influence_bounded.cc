@@ -0,0 +1,33 @@
+// Var to var influence is unchanged when every influence set is flushed as
+// soon as it holds a decl.
+void f() {
+  //- @x defines/binding VarX
+  //- @y defines/binding VarY
+  //- @z defines/binding VarZ
+  int x = 0, y = 1, z = 2;
+  //- VarZ influences VarY
+  //- VarY influences VarX
+  //- !{VarZ influences VarX}
+  //- !{VarY influences VarZ}
+  x = y = z;
+  //- @w defines/binding VarW
+  int w = 3;
+  //- VarX influences VarW
+  //- VarY influences VarW
+  w = x + y;
+  //- @v defines/binding VarV
+  //- @q defines/binding VarQ
+  //- VarW influences VarV
+  //- VarY influences VarQ
+  int v = w, q = y;
+}
+
+int g(int a, int b) {
+  //- @r defines/binding VarR
+  //- @a ref ParamA
+  //- @b ref ParamB
+  //- ParamA influences VarR
+  //- ParamB influences VarR
+  int r = a * b;
+  return r;
+}
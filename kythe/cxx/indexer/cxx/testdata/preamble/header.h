@@ -0,0 +1,4 @@
+#ifndef KYTHE_CXX_INDEXER_CXX_TESTDATA_PREAMBLE_HEADER_H_
+#define KYTHE_CXX_INDEXER_CXX_TESTDATA_PREAMBLE_HEADER_H_
+struct S {};
+#endif  // KYTHE_CXX_INDEXER_CXX_TESTDATA_PREAMBLE_HEADER_H_
@@ -0,0 +1,15 @@
+// Checks the entries for a unit indexed twice in one process with
+// --experimental_main_file_preambles (see test_preamble.sh). The first run
+// builds the preamble and is indexed in full; the second loads the header
+// from the preamble, and must still refer to its declarations by the
+// header's VName rather than claim them under the default one.
+//- @"\"header.h\"" ref/includes HeaderFile=vname(_,_,_,
+//-     "kythe/cxx/indexer/cxx/testdata/preamble/header.h","")
+//- HeaderFile.node/kind file
+#include "header.h"
+
+//- @S ref StructS=vname(_,_,_,
+//-     "kythe/cxx/indexer/cxx/testdata/preamble/header.h","c++")
+//- StructS.node/kind record
+//- !{@S ref vname(_,_,_,"","c++")}
+S s;
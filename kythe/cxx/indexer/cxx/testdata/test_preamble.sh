@@ -0,0 +1,21 @@
+#!/bin/bash
+# This script indexes the same unit twice with a preamble cache, so that the
+# first run misses the cache and the second loads the preamble, and checks the
+# entries of both against the goals in preamble/main.cc.
+set -e
+BASE_DIR="kythe/cxx/indexer/cxx/testdata/preamble"
+OUT_DIR="$TEST_TMPDIR"
+: ${EXTRACTOR?:missing cxx_extractor}
+: ${INDEXER?:missing indexer}
+: ${VERIFIER?:missing verifier}
+
+KYTHE_OUTPUT_FILE="${OUT_DIR}/main.kzip" \
+    "${EXTRACTOR}" --with_executable "/dummy/bin/g++" -c "${BASE_DIR}/main.cc"
+"${INDEXER}" --experimental_main_file_preambles=1 \
+    -o "${OUT_DIR}/main.entries" "${OUT_DIR}/main.kzip" "${OUT_DIR}/main.kzip" \
+    2> "${OUT_DIR}/indexer.log"
+grep -q "^preambles: 1 hits, 1 misses$" "${OUT_DIR}/indexer.log" || {
+  cat "${OUT_DIR}/indexer.log" >&2
+  exit 1
+}
+"${VERIFIER}" --ignore_dups "${BASE_DIR}/main.cc" < "${OUT_DIR}/main.entries"
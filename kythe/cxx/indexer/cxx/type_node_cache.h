@@ -0,0 +1,111 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_TYPE_NODE_CACHE_H_
+#define KYTHE_CXX_INDEXER_CXX_TYPE_NODE_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/numeric/int128.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+
+namespace kythe {
+
+/// \brief Remembers the type nodes built by earlier units so that later
+/// units building the same types don't have to build them again.
+///
+/// Entries are keyed by the fingerprint of a description of the type's
+/// structure that names every decl the type refers to by its claimed
+/// identity. Two types with the same description get the same node in every
+/// unit. Only nodes whose facts have already been written to the shared
+/// output belong here, since units that find a node skip writing them.
+class TypeNodeCache {
+ public:
+  /// \brief A remembered type node.
+  struct Entry {
+    std::string identity;  ///< The node's (already compressed) identity.
+    bool claimable;        ///< Whether references to the node are claimable.
+  };
+
+  /// \param max_entries How many entries to keep before starting over.
+  explicit TypeNodeCache(size_t max_entries) : max_entries_(max_entries) {}
+  virtual ~TypeNodeCache() {}
+  TypeNodeCache(const TypeNodeCache&) = delete;
+  TypeNodeCache& operator=(const TypeNodeCache&) = delete;
+
+  /// \return the key for the type described by `description`.
+  static absl::uint128 Key(absl::string_view description);
+
+  /// \return the entry remembered for `key`, if any.
+  virtual absl::optional<Entry> Find(absl::uint128 key);
+
+  /// \brief Remembers `entry` for `key`.
+  virtual void Insert(absl::uint128 key, const Entry& entry);
+
+  /// \return the number of calls to `Find` that found an entry.
+  virtual uint64_t hits() const { return hits_; }
+  /// \return the number of calls to `Find` that didn't.
+  virtual uint64_t misses() const { return misses_; }
+
+ protected:
+  TypeNodeCache() {}
+
+ private:
+  /// The number of entries to keep before starting over.
+  size_t max_entries_ = 0;
+  absl::flat_hash_map<absl::uint128, Entry> entries_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+/// \brief A `TypeNodeCache` that serializes access to another.
+class SynchronizedTypeNodeCache : public TypeNodeCache {
+ public:
+  /// \param cache The cache to forward to. Not owned; must outlive this.
+  explicit SynchronizedTypeNodeCache(TypeNodeCache* cache) : cache_(cache) {}
+  absl::optional<Entry> Find(absl::uint128 key) override
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return cache_->Find(key);
+  }
+  void Insert(absl::uint128 key, const Entry& entry) override
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    cache_->Insert(key, entry);
+  }
+  uint64_t hits() const override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return cache_->hits();
+  }
+  uint64_t misses() const override ABSL_LOCKS_EXCLUDED(mu_) {
+    absl::MutexLock lock(&mu_);
+    return cache_->misses();
+  }
+
+ private:
+  mutable absl::Mutex mu_;
+  TypeNodeCache* cache_ ABSL_GUARDED_BY(mu_);
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_TYPE_NODE_CACHE_H_
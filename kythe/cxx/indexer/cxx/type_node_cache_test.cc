@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/cxx/type_node_cache.h"
+
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+
+TEST(TypeNodeCacheTest, KeysDependOnDescription) {
+  EXPECT_EQ(TypeNodeCache::Key("p(b(int))"), TypeNodeCache::Key("p(b(int))"));
+  EXPECT_NE(TypeNodeCache::Key("p(b(int))"), TypeNodeCache::Key("l(b(int))"));
+}
+
+TEST(TypeNodeCacheTest, FindsInsertedEntries) {
+  TypeNodeCache cache(10);
+  auto key = TypeNodeCache::Key("p(b(int))");
+  EXPECT_FALSE(cache.Find(key).has_value());
+  cache.Insert(key, {"ptr(int#builtin)", false});
+  auto found = cache.Find(key);
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ("ptr(int#builtin)", found->identity);
+  EXPECT_FALSE(found->claimable);
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+}
+
+TEST(TypeNodeCacheTest, StartsOverWhenFull) {
+  TypeNodeCache cache(2);
+  cache.Insert(TypeNodeCache::Key("a"), {"a", true});
+  cache.Insert(TypeNodeCache::Key("b"), {"b", true});
+  cache.Insert(TypeNodeCache::Key("c"), {"c", true});
+  EXPECT_FALSE(cache.Find(TypeNodeCache::Key("a")).has_value());
+  EXPECT_FALSE(cache.Find(TypeNodeCache::Key("b")).has_value());
+  EXPECT_TRUE(cache.Find(TypeNodeCache::Key("c")).has_value());
+}
+
+TEST(TypeNodeCacheTest, SynchronizedCacheForwards) {
+  TypeNodeCache cache(10);
+  SynchronizedTypeNodeCache shared(&cache);
+  auto key = TypeNodeCache::Key("p(b(int))");
+  shared.Insert(key, {"ptr(int#builtin)", true});
+  EXPECT_TRUE(cache.Find(key).has_value());
+  EXPECT_TRUE(shared.Find(key).has_value());
+  EXPECT_EQ(2, shared.hits());
+}
+
+}  // namespace
+}  // namespace kythe
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/unit_cost_model.h"
+
+#include <algorithm>
+
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
+
+namespace kythe {
+namespace {
+/// The samples whose sum is a unit's cost. (Traversal includes emitting.)
+constexpr absl::string_view kCostSamples[] = {
+    "kythe_cxx_indexer_unit_parse_seconds{unit=\"",
+    "kythe_cxx_indexer_unit_traversal_seconds{unit=\"",
+};
+
+/// \brief Parses a sample line like `name{unit="label"} value`, where
+/// `name{unit="` is `prefix`.
+/// \return false if `line` isn't such a sample.
+bool ParseSample(absl::string_view line, absl::string_view prefix,
+                 std::string* unit, double* value) {
+  if (!absl::ConsumePrefix(&line, prefix)) {
+    return false;
+  }
+  unit->clear();
+  for (size_t i = 0; i < line.size(); ++i) {
+    if (line[i] == '\\' && i + 1 < line.size()) {
+      ++i;
+      unit->push_back(line[i] == 'n' ? '\n' : line[i]);
+    } else if (line[i] == '"') {
+      absl::string_view rest = line.substr(i + 1);
+      return absl::ConsumePrefix(&rest, "}") &&
+             absl::SimpleAtod(absl::StripAsciiWhitespace(rest), value);
+    } else {
+      unit->push_back(line[i]);
+    }
+  }
+  return false;
+}
+}  // anonymous namespace
+
+RecordedCostModel RecordedCostModel::FromMetrics(absl::string_view records) {
+  RecordedCostModel model;
+  // Each record describes one unit and ends with an empty line.
+  std::string record_unit;
+  double record_seconds = 0;
+  auto finish_record = [&] {
+    if (!record_unit.empty()) {
+      model.Add(std::move(record_unit), record_seconds);
+    }
+    record_unit.clear();
+    record_seconds = 0;
+  };
+  for (absl::string_view line : absl::StrSplit(records, '\n')) {
+    if (absl::StripAsciiWhitespace(line).empty()) {
+      finish_record();
+      continue;
+    }
+    std::string unit;
+    double value;
+    for (absl::string_view prefix : kCostSamples) {
+      if (ParseSample(line, prefix, &unit, &value)) {
+        record_unit = std::move(unit);
+        record_seconds += value;
+        break;
+      }
+    }
+  }
+  finish_record();
+  return model;
+}
+
+void RecordedCostModel::Add(std::string unit, double seconds) {
+  max_seconds_ = std::max(max_seconds_, seconds);
+  seconds_[std::move(unit)] = seconds;
+}
+
+double RecordedCostModel::Predict(const proto::CompilationUnit& unit) const {
+  auto found = seconds_.find(UnitLabel(unit));
+  if (found != seconds_.end()) {
+    return found->second;
+  }
+  return max_seconds_ + 1 + unit.required_input_size();
+}
+
+void SortByDecreasingCost(std::vector<std::pair<std::string, double>>* units) {
+  std::stable_sort(units->begin(), units->end(),
+                   [](const std::pair<std::string, double>& a,
+                      const std::pair<std::string, double>& b) {
+                     return a.second > b.second;
+                   });
+}
+
+}  // namespace kythe
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_UNIT_COST_MODEL_H_
+#define KYTHE_CXX_INDEXER_CXX_UNIT_COST_MODEL_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "kythe/proto/analysis.pb.h"
+
+namespace kythe {
+
+/// \brief Predicts how expensive a compilation unit is to index, so that a
+/// driver can start the most expensive units first and keep a long unit
+/// from being the last one running.
+class UnitCostModel {
+ public:
+  virtual ~UnitCostModel() = default;
+
+  /// \return the predicted cost of indexing `unit`. Costs are only compared
+  /// with other costs from the same model.
+  virtual double Predict(const proto::CompilationUnit& unit) const = 0;
+};
+
+/// \brief Predicts that units with more inputs cost more.
+class InputCountCostModel : public UnitCostModel {
+ public:
+  double Predict(const proto::CompilationUnit& unit) const override {
+    return unit.required_input_size();
+  }
+};
+
+/// \brief Predicts the cost of a unit to be the time an earlier run spent
+/// parsing and traversing it, as recorded by `FormatUnitMetrics`.
+///
+/// Units are matched by `UnitLabel`. A unit without a record is predicted
+/// to cost more than any recorded unit, since nothing bounds it; such units
+/// are ordered among themselves by their number of inputs.
+class RecordedCostModel : public UnitCostModel {
+ public:
+  /// \brief Reads the parse and traversal times from `records`, a stream of
+  /// records written by `FormatUnitMetrics`. Other samples are ignored.
+  /// Later records for a unit replace earlier ones.
+  static RecordedCostModel FromMetrics(absl::string_view records);
+
+  /// \brief Records that `unit` took `seconds` to index.
+  void Add(std::string unit, double seconds);
+
+  double Predict(const proto::CompilationUnit& unit) const override;
+
+  /// \return the number of units with a recorded cost.
+  size_t size() const { return seconds_.size(); }
+
+ private:
+  /// The recorded time of each unit, by label.
+  absl::flat_hash_map<std::string, double> seconds_;
+  /// The largest of `seconds_`.
+  double max_seconds_ = 0;
+};
+
+/// \brief Orders `units` (pairs of a unit digest and its predicted cost) by
+/// decreasing cost. Units with the same cost keep their relative order.
+void SortByDecreasingCost(std::vector<std::pair<std::string, double>>* units);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_UNIT_COST_MODEL_H_
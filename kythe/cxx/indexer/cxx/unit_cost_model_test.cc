@@ -0,0 +1,76 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/unit_cost_model.h"
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
+
+namespace kythe {
+namespace {
+
+proto::CompilationUnit MakeUnit(const std::string& source, int inputs) {
+  proto::CompilationUnit unit;
+  unit.add_source_file(source);
+  for (int i = 0; i < inputs; ++i) {
+    unit.add_required_input();
+  }
+  return unit;
+}
+
+std::string MakeRecord(const std::string& unit, absl::Duration parse,
+                       absl::Duration traversal) {
+  UnitMetrics metrics;
+  metrics.unit = unit;
+  metrics.parse_time = parse;
+  metrics.traversal_time = traversal;
+  metrics.emit_time = absl::Seconds(100);
+  return FormatUnitMetrics(metrics);
+}
+
+TEST(UnitCostModelTest, CountsInputs) {
+  InputCountCostModel model;
+  EXPECT_LT(model.Predict(MakeUnit("a.cc", 2)),
+            model.Predict(MakeUnit("b.cc", 3)));
+}
+
+TEST(UnitCostModelTest, ReadsRecordedMetrics) {
+  RecordedCostModel model = RecordedCostModel::FromMetrics(absl::StrCat(
+      MakeRecord("a.cc", absl::Seconds(1), absl::Seconds(2)),
+      MakeRecord("dir\\\"b\".cc", absl::Seconds(5), absl::Milliseconds(500)),
+      MakeRecord("a.cc", absl::Seconds(3), absl::Seconds(4))));
+  EXPECT_EQ(2, model.size());
+  EXPECT_DOUBLE_EQ(7, model.Predict(MakeUnit("a.cc", 100)));
+  EXPECT_DOUBLE_EQ(5.5, model.Predict(MakeUnit("dir\\\"b\".cc", 0)));
+  // Unrecorded units come before every recorded one.
+  EXPECT_GT(model.Predict(MakeUnit("c.cc", 0)), 7);
+  EXPECT_LT(model.Predict(MakeUnit("c.cc", 0)),
+            model.Predict(MakeUnit("d.cc", 1)));
+}
+
+TEST(UnitCostModelTest, SortsStablyByDecreasingCost) {
+  std::vector<std::pair<std::string, double>> units = {
+      {"a", 1}, {"b", 3}, {"c", 1}, {"d", 2}};
+  SortByDecreasingCost(&units);
+  EXPECT_EQ((std::vector<std::pair<std::string, double>>{
+                {"b", 3}, {"d", 2}, {"a", 1}, {"c", 1}}),
+            units);
+}
+
+}  // namespace
+}  // namespace kythe
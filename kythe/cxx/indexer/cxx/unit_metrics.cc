@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
+
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_replace.h"
+#include "absl/strings/string_view.h"
+
+namespace kythe {
+namespace {
+/// The prefix of every metric name.
+constexpr absl::string_view kMetricPrefix = "kythe_cxx_indexer_unit_";
+
+/// \brief Appends one metric with a single sample to a record.
+class RecordBuilder {
+ public:
+  explicit RecordBuilder(absl::string_view unit)
+      : label_(absl::StrCat("{unit=\"",
+                            absl::StrReplaceAll(unit, {{"\\", "\\\\"},
+                                                       {"\"", "\\\""},
+                                                       {"\n", "\\n"}}),
+                            "\"}")) {}
+
+  template <typename T>
+  void Add(absl::string_view name, absl::string_view help, T value) {
+    absl::StrAppend(&record_, "# HELP ", kMetricPrefix, name, " ", help, "\n",
+                    "# TYPE ", kMetricPrefix, name, " gauge\n", kMetricPrefix,
+                    name, label_, " ", value, "\n");
+  }
+
+  void AddCache(absl::string_view name, absl::string_view description,
+                const CacheCounts& counts) {
+    Add(absl::StrCat(name, "_hits"),
+        absl::StrCat("Lookups in the ", description, " that found an entry."),
+        counts.hits);
+    Add(absl::StrCat(name, "_misses"),
+        absl::StrCat("Lookups in the ", description, " that didn't."),
+        counts.misses);
+  }
+
+  std::string Finish() && {
+    record_.push_back('\n');
+    return std::move(record_);
+  }
+
+ private:
+  const std::string label_;
+  std::string record_;
+};
+}  // anonymous namespace
+
+const std::string& UnitLabel(const proto::CompilationUnit& unit) {
+  return unit.source_file().empty() ? unit.v_name().signature()
+                                    : unit.source_file(0);
+}
+
+std::string FormatUnitMetrics(const UnitMetrics& metrics) {
+  RecordBuilder record(metrics.unit);
+  record.Add("parse_seconds", "Time spent preprocessing and parsing.",
+             absl::ToDoubleSeconds(metrics.parse_time));
+  record.Add("traversal_seconds",
+             "Time spent traversing the AST, including emit time.",
+             absl::ToDoubleSeconds(metrics.traversal_time));
+  record.Add("emit_seconds", "Time spent handing entries to the output.",
+             absl::ToDoubleSeconds(metrics.emit_time));
+  record.Add("entries", "Entries recorded.", metrics.entries);
+  record.Add("bytes", "Bytes of delimited entries recorded.", metrics.bytes);
+  record.Add("peak_rss_bytes", "Largest resident set size so far.",
+             metrics.peak_rss_bytes);
+  if (metrics.claims) {
+    const ClaimStats& claims = *metrics.claims;
+    record.Add("claims_requested", "Claims requested.", claims.requested);
+    record.Add("claims_granted", "Claims granted.", claims.granted);
+    record.Add("claims_denied", "Claims denied.", claims.denied);
+    record.Add("claims_overclaimed", "Claims granted redundantly.",
+               claims.overclaimed);
+  }
+  if (metrics.marked_source_memo) {
+    record.AddCache("marked_source_memo", "marked source memo",
+                    *metrics.marked_source_memo);
+  }
+  if (metrics.type_node_cache) {
+    record.AddCache("type_node_cache", "type node cache",
+                    *metrics.type_node_cache);
+  }
+  return std::move(record).Finish();
+}
+
+}  // namespace kythe
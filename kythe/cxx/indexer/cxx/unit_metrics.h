@@ -0,0 +1,76 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef KYTHE_CXX_INDEXER_CXX_UNIT_METRICS_H_
+#define KYTHE_CXX_INDEXER_CXX_UNIT_METRICS_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "kythe/cxx/indexer/cxx/claim_stats.h"
+#include "kythe/proto/analysis.pb.h"
+
+namespace kythe {
+
+/// \brief How often a cache answered lookups.
+struct CacheCounts {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+/// \brief What indexing a single compilation unit cost.
+struct UnitMetrics {
+  /// The unit the metrics describe; usually its main source file.
+  std::string unit;
+  /// The time spent preprocessing and parsing the unit.
+  absl::Duration parse_time = absl::ZeroDuration();
+  /// The time spent traversing the unit's AST, including the time spent
+  /// emitting the entries found along the way.
+  absl::Duration traversal_time = absl::ZeroDuration();
+  /// The time spent handing entries to the output.
+  absl::Duration emit_time = absl::ZeroDuration();
+  /// The number of entries recorded for the unit.
+  uint64_t entries = 0;
+  /// The size of those entries when delimited.
+  uint64_t bytes = 0;
+  /// The largest resident set size the process had had by the end of the
+  /// unit.
+  uint64_t peak_rss_bytes = 0;
+  /// The claims made for the unit, if they were counted.
+  absl::optional<ClaimStats> claims;
+  /// Lookups in the marked source memo, if one was in use.
+  absl::optional<CacheCounts> marked_source_memo;
+  /// Lookups in the type node cache, if one was in use.
+  absl::optional<CacheCounts> type_node_cache;
+};
+
+/// \return the name used for `unit` in metrics and other reports: its
+/// first source file or, if it has none, its signature.
+const std::string& UnitLabel(const proto::CompilationUnit& unit);
+
+/// \brief Formats `metrics` in the Prometheus text exposition format, with
+/// the unit as the `unit` label of every sample.
+///
+/// Each record is complete on its own and ends with an empty line, so that
+/// a collector can split a stream of records and push each one to a
+/// Prometheus pushgateway as it arrives.
+std::string FormatUnitMetrics(const UnitMetrics& metrics);
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_CXX_UNIT_METRICS_H_
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/cxx/unit_metrics.h"
+
+#include "absl/time/time.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace kythe {
+namespace {
+using ::testing::EndsWith;
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+TEST(UnitMetricsTest, FormatsEachMetricWithTheUnitLabel) {
+  UnitMetrics metrics;
+  metrics.unit = "a.cc";
+  metrics.parse_time = absl::Milliseconds(1500);
+  metrics.traversal_time = absl::Milliseconds(250);
+  metrics.entries = 12;
+  metrics.bytes = 345;
+  metrics.peak_rss_bytes = 1 << 20;
+  std::string record = FormatUnitMetrics(metrics);
+  EXPECT_THAT(record,
+              HasSubstr("# HELP kythe_cxx_indexer_unit_parse_seconds "
+                        "Time spent preprocessing and parsing.\n"
+                        "# TYPE kythe_cxx_indexer_unit_parse_seconds gauge\n"
+                        "kythe_cxx_indexer_unit_parse_seconds{unit=\"a.cc\"} "
+                        "1.5\n"));
+  EXPECT_THAT(record, HasSubstr("traversal_seconds{unit=\"a.cc\"} 0.25\n"));
+  EXPECT_THAT(record, HasSubstr("emit_seconds{unit=\"a.cc\"} 0\n"));
+  EXPECT_THAT(record, HasSubstr("_entries{unit=\"a.cc\"} 12\n"));
+  EXPECT_THAT(record, HasSubstr("_bytes{unit=\"a.cc\"} 345\n"));
+  EXPECT_THAT(record, HasSubstr("peak_rss_bytes{unit=\"a.cc\"} 1048576\n"));
+  EXPECT_THAT(record, Not(HasSubstr("claims")));
+  EXPECT_THAT(record, Not(HasSubstr("hits")));
+  EXPECT_THAT(record, EndsWith("\n\n"));
+}
+
+TEST(UnitMetricsTest, FormatsOptionalMetrics) {
+  UnitMetrics metrics;
+  metrics.unit = "a.cc";
+  metrics.claims = ClaimStats();
+  metrics.claims->requested = 4;
+  metrics.claims->denied = 3;
+  metrics.type_node_cache = CacheCounts{7, 2};
+  std::string record = FormatUnitMetrics(metrics);
+  EXPECT_THAT(record, HasSubstr("claims_requested{unit=\"a.cc\"} 4\n"));
+  EXPECT_THAT(record, HasSubstr("claims_denied{unit=\"a.cc\"} 3\n"));
+  EXPECT_THAT(record, HasSubstr("type_node_cache_hits{unit=\"a.cc\"} 7\n"));
+  EXPECT_THAT(record, HasSubstr("type_node_cache_misses{unit=\"a.cc\"} 2\n"));
+  EXPECT_THAT(record, Not(HasSubstr("marked_source_memo")));
+}
+
+TEST(UnitMetricsTest, EscapesTheUnitLabel) {
+  UnitMetrics metrics;
+  metrics.unit = "dir\\\"a\".cc\n";
+  EXPECT_THAT(FormatUnitMetrics(metrics),
+              HasSubstr("_entries{unit=\"dir\\\\\\\"a\\\".cc\\n\"} 0\n"));
+}
+
+}  // namespace
+}  // namespace kythe
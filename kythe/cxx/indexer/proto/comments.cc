@@ -16,39 +16,128 @@
 
 #include "kythe/cxx/indexer/proto/comments.h"
 
-#include <vector>
-
-#include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/strip.h"
 
 namespace kythe {
+namespace {
+
+// Matches RE2's \s, which (unlike absl::ascii_isspace) excludes \v.
+bool IsRe2Space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\f' || c == '\r';
+}
+
+size_t CountLeadingSpace(absl::string_view text) {
+  size_t count = 0;
+  while (count < text.size() && IsRe2Space(text[count])) {
+    ++count;
+  }
+  return count;
+}
+
+absl::string_view SkipSpace(absl::string_view text) {
+  text.remove_prefix(CountLeadingSpace(text));
+  return text;
+}
+
+// Returns whether some prefix of `line` of at most `max_skip` bytes (all
+// whitespace) can be dropped so that what remains starts with `text` and,
+// if `full` is set, continues with nothing but \s*(?:\*/)?\s*.
+bool MatchesAfterSpace(absl::string_view line, size_t max_skip,
+                       absl::string_view text, bool full) {
+  for (size_t skip = 0; skip <= max_skip; ++skip) {
+    absl::string_view rest = line.substr(skip);
+    if (!absl::ConsumePrefix(&rest, text)) {
+      continue;
+    }
+    if (!full) {
+      return true;
+    }
+    rest = SkipSpace(rest);
+    absl::ConsumePrefix(&rest, "*/");
+    if (SkipSpace(rest).empty()) {
+      return true;
+    }
+  }
+  return false;
+}
 
-std::string StripCommentMarkers(const std::string& source) {
+}  // namespace
+
+std::string StripCommentMarkers(absl::string_view source) {
   absl::string_view stripped = absl::StripAsciiWhitespace(source);
 
-  // Handle block comments, of the form "/* ... */".
-  if (absl::ConsumePrefix(&stripped, "/*")) {
+  // Handle block comments, of the form "/* ... */", and otherwise
+  // line-ending comments, of the form "// ...".
+  const bool block = absl::ConsumePrefix(&stripped, "/*");
+  if (block) {
     absl::ConsumeSuffix(&stripped, "*/");
-    std::vector<absl::string_view> lines = absl::StrSplit(stripped, '\n');
-    for (auto& line : lines) {
-      line = absl::StripAsciiWhitespace(line);
+  }
+  std::string result;
+  result.reserve(stripped.size());
+  bool first = true;
+  for (absl::string_view line : absl::StrSplit(stripped, '\n')) {
+    if (!first) {
+      result.push_back('\n');
+    }
+    first = false;
+    line = absl::StripAsciiWhitespace(line);
+    if (block) {
       if (!absl::ConsumePrefix(&line, "* ")) {
         absl::ConsumePrefix(&line, "*");  // fallback
       }
+    } else if (!absl::ConsumePrefix(&line, "// ")) {
+      absl::ConsumePrefix(&line, "//");  // fallback
     }
-    return absl::StrJoin(lines, "\n");
+    result.append(line.data(), line.size());
   }
+  return result;
+}
 
-  // Handle line-ending comments, of the form "// ...".
-  std::vector<absl::string_view> lines = absl::StrSplit(stripped, '\n');
-  for (auto& line : lines) {
-    line = absl::StripAsciiWhitespace(line);
-    if (!absl::ConsumePrefix(&line, "// ")) {
-      absl::ConsumePrefix(&line, "//");  // fallback
+bool IsCommentLine(absl::string_view line, absl::string_view text) {
+  line = SkipSpace(line);
+  if (absl::ConsumePrefix(&line, "//")) {
+    return MatchesAfterSpace(line, 0, text, true);
+  }
+  absl::ConsumePrefix(&line, "/");
+  if (!absl::ConsumePrefix(&line, "*")) {
+    return false;
+  }
+  return MatchesAfterSpace(line, CountLeadingSpace(line), text, true);
+}
+
+bool IsBlockCommentFiller(absl::string_view line) {
+  line = SkipSpace(line);
+  if (!absl::ConsumePrefix(&line, "*")) {
+    return false;
+  }
+  absl::ConsumePrefix(&line, "/");
+  return SkipSpace(line).empty();
+}
+
+size_t FindCommentStart(absl::string_view line) {
+  for (size_t i = 0; i + 1 < line.size(); ++i) {
+    if (line[i] == '/' && (line[i + 1] == '*' || line[i + 1] == '/')) {
+      size_t start = i;
+      while (start > 0 && IsRe2Space(line[start - 1])) {
+        --start;
+      }
+      return start;
+    }
+  }
+  return absl::string_view::npos;
+}
+
+bool StartsCommentWith(absl::string_view line, absl::string_view text) {
+  for (size_t i = 0; i + 1 < line.size(); ++i) {
+    if (line[i] == '/' && (line[i + 1] == '*' || line[i + 1] == '/')) {
+      absl::string_view rest = line.substr(i + 2);
+      if (MatchesAfterSpace(rest, CountLeadingSpace(rest), text, false)) {
+        return true;
+      }
     }
   }
-  return absl::StrJoin(lines, "\n");
+  return false;
 }
 
 }  // namespace kythe
@@ -17,13 +17,37 @@
 #ifndef KYTHE_CXX_INDEXER_PROTO_COMMENTS_H_
 #define KYTHE_CXX_INDEXER_PROTO_COMMENTS_H_
 
+#include <cstddef>
 #include <string>
 
+#include "absl/strings/string_view.h"
+
 namespace kythe {
 
 // Strips protobuf comment markers and leading/trailing whitespace from each
 // line of `source`, and returns the stripped result.
-std::string StripCommentMarkers(const std::string& source);
+std::string StripCommentMarkers(absl::string_view source);
+
+// The matchers below locate comments that protoc reported in
+// SourceCodeInfo within the source lines they came from. Each is equivalent
+// to the RE2 pattern in its comment, where <text> stands for the quoted
+// `text`, but avoids compiling a pattern per comment line.
+
+// Returns whether `line` fully matches \s*(?://|/?\*\s*)<text>\s*(?:\*/)?\s*,
+// i.e., is a line of a comment whose protoc-reported content is `text`.
+bool IsCommentLine(absl::string_view line, absl::string_view text);
+
+// Returns whether `line` fully matches \s*\*/?\s*, i.e., holds nothing but
+// the decoration of a block comment.
+bool IsBlockCommentFiller(absl::string_view line);
+
+// Returns the offset of the leftmost partial match of \s*(?:/\*|//) in
+// `line`, or absl::string_view::npos if no comment starts on `line`.
+size_t FindCommentStart(absl::string_view line);
+
+// Returns whether `line` partially matches \s*(?:/\*|//)\s*<text>, i.e.,
+// starts a comment whose first line of content is `text`.
+bool StartsCommentWith(absl::string_view line, absl::string_view text);
 
 }  // namespace kythe
 
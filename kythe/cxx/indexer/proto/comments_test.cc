@@ -75,5 +75,38 @@ TEST(CommentsTest, BlockComment) {
                  "to us\n"));
 }
 
+TEST(CommentsTest, IsCommentLine) {
+  EXPECT_TRUE(IsCommentLine("  // foo", " foo"));
+  EXPECT_TRUE(IsCommentLine("// foo  ", " foo"));
+  EXPECT_TRUE(IsCommentLine(" * foo", "foo"));
+  EXPECT_TRUE(IsCommentLine(" * foo", " foo"));
+  EXPECT_TRUE(IsCommentLine("/* foo */", "foo"));
+  EXPECT_TRUE(IsCommentLine("// a.b", " a.b"));
+  EXPECT_FALSE(IsCommentLine("// a.b", " axb"));
+  EXPECT_FALSE(IsCommentLine("//  foo", "foo"));
+  EXPECT_FALSE(IsCommentLine("foo", "foo"));
+  EXPECT_FALSE(IsCommentLine("// foo bar", " foo"));
+}
+
+TEST(CommentsTest, IsBlockCommentFiller) {
+  EXPECT_TRUE(IsBlockCommentFiller(" *"));
+  EXPECT_TRUE(IsBlockCommentFiller(" */\n"));
+  EXPECT_FALSE(IsBlockCommentFiller(" * x"));
+  EXPECT_FALSE(IsBlockCommentFiller(""));
+}
+
+TEST(CommentsTest, FindCommentStart) {
+  EXPECT_THAT(FindCommentStart("int32 x = 1;  // foo"), Eq(12u));
+  EXPECT_THAT(FindCommentStart("/* foo */"), Eq(0u));
+  EXPECT_THAT(FindCommentStart("int32 x = 1;"), Eq(absl::string_view::npos));
+}
+
+TEST(CommentsTest, StartsCommentWith) {
+  EXPECT_TRUE(StartsCommentWith("int32 x = 1;  // foo", "foo"));
+  EXPECT_TRUE(StartsCommentWith("x; /* foo */", " foo"));
+  EXPECT_FALSE(StartsCommentWith("int32 x = 1;  // foo", "bar"));
+  EXPECT_FALSE(StartsCommentWith("int32 x = 1;", ""));
+}
+
 }  // namespace
 }  // namespace kythe
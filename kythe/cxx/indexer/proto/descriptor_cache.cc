@@ -0,0 +1,60 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "kythe/cxx/indexer/proto/descriptor_cache.h"
+
+#include "glog/logging.h"
+
+namespace kythe {
+
+const google::protobuf::FileDescriptorProto* ProtoParseCache::Find(
+    const std::string& name, const std::string& digest) const {
+  auto found = entries_.find(std::make_pair(name, digest));
+  return found == entries_.end() ? nullptr : &found->second;
+}
+
+void ProtoParseCache::Insert(
+    const std::string& name, const std::string& digest,
+    const google::protobuf::FileDescriptorProto& file) {
+  if (entries_.size() >= max_entries_) {
+    return;
+  }
+  entries_.emplace(std::make_pair(name, digest), file);
+}
+
+bool CachingDescriptorDatabase::FindFileByName(
+    const std::string& filename,
+    google::protobuf::FileDescriptorProto* output) {
+  // Resolving the name also records its path substitution, which later
+  // VName lookups rely on, so this must happen even on a cache hit.
+  const std::string* digest = tree_->FindDigest(filename);
+  if (digest == nullptr) {
+    return base_->FindFileByName(filename, output);
+  }
+  if (const auto* cached = cache_->Find(filename, *digest)) {
+    VLOG(1) << "Reusing parse of " << filename << " (" << *digest << ")";
+    *output = *cached;
+    return true;
+  }
+  if (!base_->FindFileByName(filename, output)) {
+    return false;
+  }
+  cache_->Insert(filename, *digest, *output);
+  return true;
+}
+
+}  // namespace kythe
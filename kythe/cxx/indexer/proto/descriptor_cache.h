@@ -0,0 +1,101 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef KYTHE_CXX_INDEXER_PROTO_DESCRIPTOR_CACHE_H_
+#define KYTHE_CXX_INDEXER_PROTO_DESCRIPTOR_CACHE_H_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "absl/container/node_hash_map.h"
+#include "google/protobuf/descriptor.pb.h"
+#include "google/protobuf/descriptor_database.h"
+#include "kythe/cxx/indexer/proto/source_tree.h"
+
+namespace kythe {
+
+// Parsed FileDescriptorProtos keyed by the name under which they were looked
+// up and the digest of their contents. Parsing a .proto file depends only on
+// its own text (imports are recorded, not resolved), so an entry can be
+// reused by any compilation unit that supplies the same file under the same
+// name. Meant to outlive individual units, e.g. across a multi-unit .kzip.
+class ProtoParseCache {
+ public:
+  // Holds at most `max_entries` parses; further inserts are dropped.
+  explicit ProtoParseCache(size_t max_entries) : max_entries_(max_entries) {}
+
+  // disallow copy and assign
+  ProtoParseCache(const ProtoParseCache&) = delete;
+  void operator=(const ProtoParseCache&) = delete;
+
+  // Returns the parse of `name` with contents `digest`, or nullptr.
+  const google::protobuf::FileDescriptorProto* Find(
+      const std::string& name, const std::string& digest) const;
+
+  // Records `file` as the parse of `name` with contents `digest`.
+  void Insert(const std::string& name, const std::string& digest,
+              const google::protobuf::FileDescriptorProto& file);
+
+ private:
+  size_t max_entries_;
+
+  // (name, digest) -> parsed file.
+  absl::node_hash_map<std::pair<std::string, std::string>,
+                      google::protobuf::FileDescriptorProto>
+      entries_;
+};
+
+// A DescriptorDatabase that serves FindFileByName from a ProtoParseCache for
+// files `tree` has a digest for, and otherwise defers to (and fills the cache
+// from) `base`, which should be a SourceTreeDescriptorDatabase over `tree`.
+class CachingDescriptorDatabase : public google::protobuf::DescriptorDatabase {
+ public:
+  CachingDescriptorDatabase(google::protobuf::DescriptorDatabase* base,
+                            PreloadedProtoFileTree* tree,
+                            ProtoParseCache* cache)
+      : base_(base), tree_(tree), cache_(cache) {}
+
+  // disallow copy and assign
+  CachingDescriptorDatabase(const CachingDescriptorDatabase&) = delete;
+  void operator=(const CachingDescriptorDatabase&) = delete;
+
+  bool FindFileByName(const std::string& filename,
+                      google::protobuf::FileDescriptorProto* output) override;
+
+  bool FindFileContainingSymbol(
+      const std::string& symbol_name,
+      google::protobuf::FileDescriptorProto* output) override {
+    return base_->FindFileContainingSymbol(symbol_name, output);
+  }
+
+  bool FindFileContainingExtension(
+      const std::string& containing_type, int field_number,
+      google::protobuf::FileDescriptorProto* output) override {
+    return base_->FindFileContainingExtension(containing_type, field_number,
+                                              output);
+  }
+
+ private:
+  google::protobuf::DescriptorDatabase* base_;
+  PreloadedProtoFileTree* tree_;
+  ProtoParseCache* cache_;
+};
+
+}  // namespace kythe
+
+#endif  // KYTHE_CXX_INDEXER_PROTO_DESCRIPTOR_CACHE_H_
@@ -25,6 +25,7 @@
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/repeated_field.h"
 #include "google/protobuf/stubs/map_util.h"
+#include "kythe/cxx/indexer/proto/comments.h"
 #include "kythe/cxx/indexer/proto/marked_source.h"
 #include "kythe/cxx/indexer/proto/offset_util.h"
 #include "kythe/cxx/indexer/proto/proto_graph_builder.h"
@@ -124,22 +125,19 @@ Location FileDescriptorWalker::LocationOfLeadingComments(
   comment_location.end = entity_location.begin - line_offset_of_entity - 1;
   int next_line_number = entity_start_line - 1;
   absl::string_view bottom_line = line_index_.GetLine(next_line_number);
-  while (RE2::FullMatch(ToStringPiece(bottom_line), R"(\s*\*/?\s*)")) {
+  while (IsBlockCommentFiller(bottom_line)) {
     comment_location.begin -= bottom_line.size();
     --next_line_number;
     bottom_line = line_index_.GetLine(next_line_number);
   }
-  std::vector<std::string> comment_lines = absl::StrSplit(comments, '\n');
+  std::vector<absl::string_view> comment_lines = absl::StrSplit(comments, '\n');
   while (!comment_lines.empty() && comment_lines.back().empty()) {
     comment_lines.pop_back();
   }
   while (!comment_lines.empty()) {
-    const std::string& comment_line = comment_lines.back();
+    absl::string_view comment_line = comment_lines.back();
     absl::string_view actual_line = line_index_.GetLine(next_line_number);
-    std::string comment_re =
-        absl::StrCat(R"(\s*(?://|/?\*\s*))", RE2::QuoteMeta(comment_line),
-                     R"(\s*(?:\*/)?\s*)");
-    if (!RE2::FullMatch(ToStringPiece(actual_line), comment_re)) {
+    if (!IsCommentLine(actual_line, comment_line)) {
       LOG(ERROR) << "Leading comment line mismatch: [" << comment_line
                  << "] vs. [" << actual_line << "]"
                  << "(line " << next_line_number << ")";
@@ -157,7 +155,7 @@ Location FileDescriptorWalker::LocationOfTrailingComments(
     int entity_start_column, const std::string& comments) const {
   Location comment_location;
   comment_location.file = entity_location.file;
-  std::vector<std::string> comment_lines = absl::StrSplit(comments, '\n');
+  std::vector<absl::string_view> comment_lines = absl::StrSplit(comments, '\n');
   while (!comment_lines.empty() && comment_lines.back().empty()) {
     comment_lines.pop_back();
   }
@@ -165,19 +163,16 @@ Location FileDescriptorWalker::LocationOfTrailingComments(
     LOG(ERROR) << "Trailing comment listed as present but was empty.";
     return entity_location;
   }
-  std::string top_comment_line_re = absl::StrCat(
-      R"(\s*(?:/\*|//)\s*)", RE2::QuoteMeta(comment_lines.front()));
   int line_number = entity_start_line;
   for (; line_number <= line_index_.line_count(); ++line_number) {
     absl::string_view entity_line = line_index_.GetLine(line_number);
-    re2::StringPiece comment_start;
-    if (RE2::PartialMatch(ToStringPiece(entity_line), R"((\s*(?:/\*|//)))",
-                          &comment_start)) {
-      comment_location.begin = line_index_.ComputeByteOffset(line_number, 0) +
-                               (comment_start.data() - entity_line.data());
+    size_t comment_start = FindCommentStart(entity_line);
+    if (comment_start != absl::string_view::npos) {
+      comment_location.begin =
+          line_index_.ComputeByteOffset(line_number, 0) + comment_start;
       comment_location.end =
           line_index_.ComputeByteOffset(line_number + 1, 0) - 1;
-      if (RE2::PartialMatch(ToStringPiece(entity_line), top_comment_line_re)) {
+      if (StartsCommentWith(entity_line, comment_lines.front())) {
         comment_lines.erase(comment_lines.begin());
       }
       break;
@@ -188,12 +183,9 @@ Location FileDescriptorWalker::LocationOfTrailingComments(
     return entity_location;
   }
   ++line_number;
-  for (const std::string& comment_line : comment_lines) {
+  for (absl::string_view comment_line : comment_lines) {
     absl::string_view actual_line = line_index_.GetLine(line_number);
-    std::string comment_re =
-        absl::StrCat(R"(\s*(?://|/?\*\s*))", RE2::QuoteMeta(comment_line),
-                     R"(\s*(?:\*/)?\s*)");
-    if (!RE2::FullMatch(ToStringPiece(actual_line), comment_re)) {
+    if (!IsCommentLine(actual_line, comment_line)) {
       LOG(ERROR) << "Trailing comment line mismatch: [" << comment_line
                  << "] vs. [" << actual_line << "]"
                  << "(line " << line_number << ")";
@@ -204,7 +196,7 @@ Location FileDescriptorWalker::LocationOfTrailingComments(
   }
 
   absl::string_view bottom_line = line_index_.GetLine(line_number);
-  while (RE2::FullMatch(ToStringPiece(bottom_line), R"(\s*\*/?\s*)")) {
+  while (IsBlockCommentFiller(bottom_line)) {
     comment_location.end += bottom_line.size();
     ++line_number;
     bottom_line = line_index_.GetLine(line_number);
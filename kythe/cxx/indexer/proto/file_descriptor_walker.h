@@ -74,7 +74,8 @@ class FileDescriptorWalker {
         source_code_info_(&source_code_info),
         file_name_(file_name),
         content_(content),
-        line_index_(kythe::UTF8LineIndex(content_)),
+        // Only lines and byte offsets are looked up.
+        line_index_(content_, UTF8LineIndex::CharacterOffsets::kLazy),
         builder_(builder),
         uri_(file_name_) {}
 
@@ -218,7 +219,10 @@ class FileDescriptorWalker {
   const google::protobuf::FileDescriptor* file_descriptor_;
   const google::protobuf::SourceCodeInfo* source_code_info_;
   const proto::VName file_name_;
-  const std::string content_;
+  // A view of the caller's buffer, which must outlive the walker.
+  const absl::string_view content_;
+  // Line starts within content_, computed once so that converting each span
+  // in source_code_info_ to byte offsets does not rescan the file.
   const kythe::UTF8LineIndex line_index_;
   ProtoGraphBuilder* builder_;
   URI uri_;
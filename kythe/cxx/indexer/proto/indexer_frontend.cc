@@ -17,6 +17,7 @@
 #include "kythe/cxx/indexer/proto/indexer_frontend.h"
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/types/optional.h"
 #include "kythe/cxx/common/file_vname_generator.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
 #include "kythe/cxx/common/path_utils.h"
@@ -29,7 +30,8 @@ namespace kythe {
 
 std::string IndexProtoCompilationUnit(const proto::CompilationUnit& unit,
                                       const std::vector<proto::FileData>& files,
-                                      KytheOutputStream* output) {
+                                      KytheOutputStream* output,
+                                      ProtoParseCache* parse_cache) {
   KytheGraphRecorder recorder(output);
 
   std::vector<std::string> unprocessed_args;
@@ -43,12 +45,19 @@ std::string IndexProtoCompilationUnit(const proto::CompilationUnit& unit,
   absl::flat_hash_map<std::string, std::string> file_substitution_cache;
   PreloadedProtoFileTree file_reader(&path_substitutions,
                                      &file_substitution_cache);
-  google::protobuf::compiler::SourceTreeDescriptorDatabase descriptor_db(
+  google::protobuf::compiler::SourceTreeDescriptorDatabase source_tree_db(
       &file_reader);
   for (const auto& file_data : files) {
-    file_reader.AddFile(file_data.info().path(), file_data.content());
+    file_reader.AddFile(file_data.info().path(), file_data.content(),
+                        file_data.info().digest());
   }
-  lang_proto::ProtoAnalyzer analyzer(&unit, &descriptor_db, &recorder,
+  google::protobuf::DescriptorDatabase* descriptor_db = &source_tree_db;
+  absl::optional<CachingDescriptorDatabase> caching_db;
+  if (parse_cache != nullptr) {
+    caching_db.emplace(&source_tree_db, &file_reader, parse_cache);
+    descriptor_db = &*caching_db;
+  }
+  lang_proto::ProtoAnalyzer analyzer(&unit, descriptor_db, &recorder,
                                      &file_substitution_cache);
   if (unit.source_file().empty()) {
     return "Error: no source_files in CompilationUnit.";
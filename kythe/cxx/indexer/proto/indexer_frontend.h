@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "kythe/cxx/common/indexing/KytheOutputStream.h"
+#include "kythe/cxx/indexer/proto/descriptor_cache.h"
 
 namespace kythe {
 namespace proto {
@@ -30,10 +31,13 @@ class FileData;
 
 // Indexes `unit`, reading file paths and content from `files` and writing
 // Kythe artifacts to `output`. Returns an empty string if OK; otherwise,
-// an error description.
+// an error description. If `parse_cache` is non-null, files in `files` that
+// carry a digest are parsed through it, so that parses can be shared with
+// other units indexed against the same cache.
 std::string IndexProtoCompilationUnit(const proto::CompilationUnit& unit,
                                       const std::vector<proto::FileData>& files,
-                                      KytheOutputStream* output);
+                                      KytheOutputStream* output,
+                                      ProtoParseCache* parse_cache = nullptr);
 
 }  // namespace kythe
 
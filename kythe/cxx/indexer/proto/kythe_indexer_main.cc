@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <memory>
 #include <string>
 
 #include "absl/flags/flag.h"
@@ -59,6 +60,9 @@ ABSL_FLAG(std::string, index_file, "",
           ".kzip file containing compilation unit.");
 ABSL_FLAG(std::string, default_corpus, "", "Default corpus for VNames.");
 ABSL_FLAG(std::string, default_root, "", "Default root for VNames.");
+ABSL_FLAG(int64_t, parse_cache_entries, 4096,
+          "Maximum number of parsed .proto files to reuse across the "
+          "compilation units of an index file; 0 disables the cache.");
 
 namespace kythe {
 namespace {
@@ -87,16 +91,26 @@ void DecodeKzipFile(const std::string& path,
     std::vector<proto::FileData> virtual_files;
     auto compilation = reader->ReadUnit(digest);
     CHECK(compilation.ok()) << compilation.status();
-    for (const auto& file : compilation->unit().required_input()) {
-      auto content = reader->ReadFile(file.info().digest());
-      CHECK(content.ok()) << "Unable to read file with digest: "
-                          << file.info().digest() << ": " << content.status();
-      proto::FileData file_data;
-      file_data.set_content(*content);
-      file_data.mutable_info()->set_path(file.info().path());
-      file_data.mutable_info()->set_digest(file.info().digest());
-      virtual_files.push_back(std::move(file_data));
+    const auto& inputs = compilation->unit().required_input();
+    std::vector<std::string> digests;
+    digests.reserve(inputs.size());
+    for (const auto& file : inputs) {
+      digests.push_back(file.info().digest());
     }
+    auto read_status = reader->ReadFiles(
+        digests, [&](absl::string_view file_digest,
+                     absl::StatusOr<std::string> content) {
+          CHECK(content.ok()) << "Unable to read file with digest: "
+                              << file_digest << ": " << content.status();
+          const auto& file = inputs[virtual_files.size()];
+          proto::FileData file_data;
+          file_data.set_content(*std::move(content));
+          file_data.mutable_info()->set_path(file.info().path());
+          file_data.mutable_info()->set_digest(file.info().digest());
+          virtual_files.push_back(std::move(file_data));
+          return true;
+        });
+    CHECK(read_status.ok()) << read_status;
 
     visit(compilation->unit(), std::move(virtual_files));
 
@@ -187,10 +201,15 @@ Examples:
         absl::GetFlag(FLAGS_flush_after_each_entry));
 
     if (!kzip_file.empty()) {
+      const int64_t cache_entries = absl::GetFlag(FLAGS_parse_cache_entries);
+      std::unique_ptr<ProtoParseCache> parse_cache;
+      if (cache_entries > 0) {
+        parse_cache = std::make_unique<ProtoParseCache>(cache_entries);
+      }
       DecodeKzipFile(kzip_file, [&](const proto::CompilationUnit& unit,
                                     std::vector<proto::FileData> file_data) {
-        std::string err =
-            IndexProtoCompilationUnit(unit, file_data, &kythe_output);
+        std::string err = IndexProtoCompilationUnit(
+            unit, file_data, &kythe_output, parse_cache.get());
         if (!err.empty()) {
           had_error = true;
           LOG(ERROR) << "Error: " << err;
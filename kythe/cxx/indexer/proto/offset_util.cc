@@ -16,12 +16,21 @@
 
 #include "offset_util.h"
 
+#include <cstring>
+
 #include "glog/logging.h"
 
 namespace kythe {
 namespace lang_proto {
 
 int ByteOffsetOfTabularColumn(absl::string_view line_text, int column_number) {
+  // Every byte but a tab advances the column by one, so without a tab before
+  // the column the offset is the column itself.
+  if (column_number >= 0 && column_number <= line_text.size() &&
+      (column_number == 0 ||
+       std::memchr(line_text.data(), '\t', column_number) == nullptr)) {
+    return column_number;
+  }
   int computed_column = 0;
   int offset = 0;
   while (computed_column < column_number && offset < line_text.size()) {
@@ -44,12 +44,12 @@ ProtoAnalyzer::ProtoAnalyzer(
     : unit_(unit),
       recorder_(recorder),
       path_substitution_cache_(path_substitution_cache),
-      descriptor_db_(descriptor_db) {}
+      descriptor_db_(descriptor_db),
+      pool_(descriptor_db) {}
 
 bool ProtoAnalyzer::AnalyzeFile(const std::string& rel_path,
                                 const VName& v_name,
                                 const std::string& content) {
-  google::protobuf::DescriptorPool pool(descriptor_db_);
   ProtoGraphBuilder builder(recorder_, [&](const std::string& path) {
     return VNameFromRelPath(path);
   });
@@ -74,7 +74,7 @@ bool ProtoAnalyzer::AnalyzeFile(const std::string& rel_path,
   // TODO: If FileDescriptor surfaced the source code info, then we
   // wouldn't need to look up the proto as well.
   const google::protobuf::FileDescriptor* descriptor =
-      pool.FindFileByName(rel_path);
+      pool_.FindFileByName(rel_path);
   google::protobuf::FileDescriptorProto descriptor_proto;
   if ((descriptor == nullptr) ||
       !descriptor_db_->FindFileByName(rel_path, &descriptor_proto)) {
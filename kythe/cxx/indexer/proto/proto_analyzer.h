@@ -88,6 +88,10 @@ class ProtoAnalyzer {
   // Gives us properly linked together descriptors for proto files and their
   // contents.
   google::protobuf::DescriptorDatabase* descriptor_db_;
+
+  // Builds descriptors from descriptor_db_. It is shared by every file the
+  // analyzer visits, so that imports common to many files are built once.
+  google::protobuf::DescriptorPool pool_;
 };
 
 }  // namespace lang_proto
@@ -17,6 +17,7 @@
 #include "kythe/cxx/indexer/proto/proto_graph_builder.h"
 
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "glog/logging.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/cxx/indexer/proto/comments.h"
@@ -91,8 +92,8 @@ VName ProtoGraphBuilder::CreateAndAddDocNode(const Location& location,
   // Adjust the text to splice out comment markers, as per
   // http://www.kythe.io/docs/schema/#doc
   AddNode(doc, NodeKindID::kDoc);
-  std::string comment = StripCommentMarkers(current_file_contents_.substr(
-      location.begin, location.end - location.begin));
+  std::string comment = StripCommentMarkers(absl::ClippedSubstr(
+      current_file_contents_, location.begin, location.end - location.begin));
   recorder_->AddProperty(VNameRef(doc), PropertyID::kText, comment);
   return doc;
 }
@@ -23,6 +23,7 @@
 #include <utility>
 #include <vector>
 
+#include "absl/strings/string_view.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/printer.h"
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
@@ -74,7 +75,7 @@ class ProtoGraphBuilder {
                                                    vname_for_rel_path_);
   }
 
-  // Sets the source text for this file.
+  // Sets the source text for this file. `content` must outlive the builder.
   void SetText(const proto::VName& node_name, const std::string& content);
 
   // Records a node with the given VName and kind in the graph.
@@ -160,8 +161,9 @@ class ProtoGraphBuilder {
   // A function to resolve relative paths to VNames.
   std::function<proto::VName(const std::string&)> vname_for_rel_path_;
 
-  // The text of the current file being analyzed.
-  std::string current_file_contents_;
+  // The text of the current file being analyzed. This views the buffer passed
+  // to SetText(), which must outlive any later CreateAndAddDocNode() call.
+  absl::string_view current_file_contents_;
 };
 
 }  // namespace kythe
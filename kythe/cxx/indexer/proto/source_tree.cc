@@ -51,13 +51,25 @@ bool PreloadedProtoFileTree::AddFile(const std::string& filename,
   return InsertIfNotPresent(&file_map_, filename, contents);
 }
 
-google::protobuf::io::ZeroCopyInputStream* PreloadedProtoFileTree::Open(
-    const std::string& filename) {
+bool PreloadedProtoFileTree::AddFile(const std::string& filename,
+                                     const std::string& contents,
+                                     const std::string& digest) {
+  if (!AddFile(filename, contents)) {
+    return false;
+  }
+  if (!digest.empty()) {
+    digest_map_[filename] = digest;
+  }
+  return true;
+}
+
+const std::string* PreloadedProtoFileTree::Resolve(const std::string& filename,
+                                                   std::string* full_path) {
   last_error_ = "";
 
   const std::string* cached_path = FindOrNull(*file_mapping_cache_, filename);
   if (cached_path != nullptr) {
-    std::string* stored_contents = FindOrNull(file_map_, *cached_path);
+    const std::string* stored_contents = FindOrNull(file_map_, *cached_path);
     if (stored_contents == nullptr) {
       last_error_ = "Proto file Open(" + filename +
                     ") failed:" + " cached mapping to " + *cached_path +
@@ -65,8 +77,8 @@ google::protobuf::io::ZeroCopyInputStream* PreloadedProtoFileTree::Open(
       LOG(ERROR) << last_error_;
       return nullptr;
     }
-    return new google::protobuf::io::ArrayInputStream(stored_contents->data(),
-                                                      stored_contents->size());
+    *full_path = *cached_path;
+    return stored_contents;
   }
   for (auto& substitution : *substitutions_) {
     std::string found_path;
@@ -78,7 +90,7 @@ google::protobuf::io::ZeroCopyInputStream* PreloadedProtoFileTree::Open(
       found_path = CleanPath(StringReplaceFirst(filename, substitution.first,
                                                 substitution.second));
     }
-    std::string* stored_contents =
+    const std::string* stored_contents =
         found_path.empty() ? nullptr : FindOrNull(file_map_, found_path);
     if (stored_contents != nullptr) {
       VLOG(1) << "Proto file Open(" << filename << ") under ["
@@ -90,15 +102,15 @@ google::protobuf::io::ZeroCopyInputStream* PreloadedProtoFileTree::Open(
                    << "\" and now to \"" << found_path << "\".  Aborting "
                    << "new remapping...";
       }
-      return new google::protobuf::io::ArrayInputStream(
-          stored_contents->data(), stored_contents->size());
+      *full_path = std::move(found_path);
+      return stored_contents;
     }
   }
-  std::string* stored_contents = FindOrNull(file_map_, filename);
+  const std::string* stored_contents = FindOrNull(file_map_, filename);
   if (stored_contents != nullptr) {
     VLOG(1) << "Proto file Open(" << filename << ") at root";
-    return new google::protobuf::io::ArrayInputStream(stored_contents->data(),
-                                                      stored_contents->size());
+    *full_path = filename;
+    return stored_contents;
   }
   last_error_ = "Proto file Open(" + filename + ") failed because '" +
                 filename + "' not recognized by indexer";
@@ -106,6 +118,26 @@ google::protobuf::io::ZeroCopyInputStream* PreloadedProtoFileTree::Open(
   return nullptr;
 }
 
+google::protobuf::io::ZeroCopyInputStream* PreloadedProtoFileTree::Open(
+    const std::string& filename) {
+  std::string full_path;
+  const std::string* stored_contents = Resolve(filename, &full_path);
+  if (stored_contents == nullptr) {
+    return nullptr;
+  }
+  return new google::protobuf::io::ArrayInputStream(stored_contents->data(),
+                                                    stored_contents->size());
+}
+
+const std::string* PreloadedProtoFileTree::FindDigest(
+    const std::string& filename) {
+  std::string full_path;
+  if (Resolve(filename, &full_path) == nullptr) {
+    return nullptr;
+  }
+  return FindOrNull(digest_map_, full_path);
+}
+
 bool PreloadedProtoFileTree::Read(absl::string_view file_path,
                                   std::string* out) {
   std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> in_stream(
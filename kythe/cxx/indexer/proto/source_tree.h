@@ -63,6 +63,11 @@ class PreloadedProtoFileTree : public google::protobuf::compiler::SourceTree {
   // Returns false if `filename` was already added.
   bool AddFile(const std::string& filename, const std::string& contents);
 
+  // As above, but also records `digest` as the digest of `contents`, so that
+  // FindDigest() can identify the file independently of this tree.
+  bool AddFile(const std::string& filename, const std::string& contents,
+               const std::string& digest);
+
   // Load the full contents of `filename` into `contents`, if possible, and
   // return whether this was successful.
   // Note that ProtoFileParser passes the literal argument to import statements
@@ -78,7 +83,18 @@ class PreloadedProtoFileTree : public google::protobuf::compiler::SourceTree {
   // A wrapper around Open(), that reads the proto file contents into a buffer.
   bool Read(absl::string_view file_path, std::string* out);
 
+  // Returns the digest recorded for the file that `filename` resolves to, or
+  // nullptr if it does not resolve or was added without a digest. Resolution
+  // is the same as for Open().
+  const std::string* FindDigest(const std::string& filename);
+
  private:
+  // Applies substitutions to `filename` and returns the stored contents of the
+  // file it names, setting `full_path` to its post-substitution name. Returns
+  // nullptr (and sets last_error_) if there is no such file.
+  const std::string* Resolve(const std::string& filename,
+                             std::string* full_path);
+
   // All path prefix substitutions to consider.
   const std::vector<std::pair<std::string, std::string>>* const substitutions_;
 
@@ -89,6 +105,9 @@ class PreloadedProtoFileTree : public google::protobuf::compiler::SourceTree {
   // Path (post-substitution) -> file contents.
   absl::flat_hash_map<std::string, std::string> file_map_;
 
+  // Path (post-substitution) -> digest, for files added with one.
+  absl::flat_hash_map<std::string, std::string> digest_map_;
+
   // A description of the error from the last call to Open() (if any).
   std::string last_error_;
 };
@@ -16,11 +16,15 @@
 
 #include "analyzer.h"
 
+#include <openssl/sha.h>
+
 #include <algorithm>
+#include <cstdint>
 #include <memory>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/match.h"
@@ -28,15 +32,19 @@
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/strip.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/optional.h"
 #include "google/protobuf/descriptor.h"
+#include "google/protobuf/descriptor.pb.h"
 #include "google/protobuf/descriptor_database.h"
 #include "google/protobuf/dynamic_message.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
 #include "google/protobuf/text_format.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
 #include "kythe/cxx/common/path_utils.h"
+#include "kythe/cxx/common/thread_pool.h"
 #include "kythe/cxx/common/utf8_line_index.h"
 #include "kythe/cxx/extractor/textproto/textproto_schema.h"
 #include "kythe/cxx/indexer/proto/offset_util.h"
@@ -64,6 +72,23 @@ using ::google::protobuf::TextFormat;
 // Repeated fields have an actual index, non-repeated fields are always -1.
 constexpr int kNonRepeatedFieldIndex = -1;
 
+// Patterns used to find spans in the textproto source. They are matched once
+// per field value, so they are compiled once rather than at each use.
+const LazyRE2 kAnyFieldOpenPattern = {R"(^[a-zA-Z0-9_]+:?\s*\{\s*)"};
+const LazyRE2 kAnyCommentPattern = {R"(\s*#.*\n*)"};
+const LazyRE2 kAnyTypeUrlPattern = {R"(^\s*\[\s*[^/]+/([^\s\]]+)\s*\])"};
+const LazyRE2 kWhitespacePattern = {R"((\s+|#[^\n]*)*)"};
+const LazyRE2 kEnumValuePattern = {R"(^([_\w\d]+))"};
+
+// Consumes `c` if it is the first character of `sp`.
+bool ConsumeChar(re2::StringPiece* sp, char c) {
+  if (sp->empty() || (*sp)[0] != c) {
+    return false;
+  }
+  sp->remove_prefix(1);
+  return true;
+}
+
 // Error "collector" that just writes messages to log output.
 class LoggingMultiFileErrorCollector
     : public google::protobuf::compiler::MultiFileErrorCollector {
@@ -141,7 +166,8 @@ class TextprotoAnalyzer : public PluginApi {
   absl::Status AnalyzeStringValue(const proto::VName& file_vname,
                                   const Message& proto,
                                   const FieldDescriptor& field,
-                                  int start_offset);
+                                  int start_offset,
+                                  const std::vector<Plugin*>& plugins);
 
   absl::Status AnalyzeSchemaComments(const proto::VName& file_vname,
                                      const Descriptor& msg_descriptor);
@@ -161,8 +187,9 @@ class TextprotoAnalyzer : public PluginApi {
   proto::VName VNameForRelPath(
       absl::string_view simplified_path) const override;
 
-  void SetPlugins(std::vector<std::unique_ptr<Plugin>> p) {
+  void SetPlugins(std::vector<std::shared_ptr<Plugin>> p) {
     plugins_ = std::move(p);
+    field_plugins_.clear();
   }
 
   // Convenience method for constructing proto descriptor vnames.
@@ -186,7 +213,15 @@ class TextprotoAnalyzer : public PluginApi {
 
   int ComputeByteOffset(int line_number, int column_number) const;
 
-  std::vector<std::unique_ptr<Plugin>> plugins_;
+  // Returns the plugins that handle values of the string field `field`,
+  // asking each plugin the first time the field is seen.
+  const std::vector<Plugin*>& PluginsForField(const FieldDescriptor& field);
+
+  std::vector<std::shared_ptr<Plugin>> plugins_;
+  // The plugins that handle each string field seen so far, so that a field
+  // only reaches the plugins that asked for it.
+  absl::flat_hash_map<const FieldDescriptor*, std::vector<Plugin*>>
+      field_plugins_;
 
   const proto::CompilationUnit* unit_;
   KytheGraphRecorder* recorder_;
@@ -198,6 +233,9 @@ class TextprotoAnalyzer : public PluginApi {
   // DescriptorPool is used to lookup descriptors for messages inside
   // protobuf.Any types.
   const DescriptorPool* descriptor_pool_;
+  // Creates the messages that Any payloads are parsed into. Shared across
+  // AnalyzeAny() calls so each payload type's prototype is only built once.
+  google::protobuf::DynamicMessageFactory any_message_factory_;
 };
 
 // Converts from a proto line/column (both 0 based, and where column counts
@@ -314,17 +352,16 @@ absl::StatusOr<proto::VName> TextprotoAnalyzer::AnalyzeAnyTypeUrl(
   sp = sp.substr(search_from);
 
   // Consume rest of field name, colon (optional) and open brace.
-  if (!re2::RE2::Consume(&sp, R"(^[a-zA-Z0-9_]+:?\s*\{\s*)")) {
+  if (!re2::RE2::Consume(&sp, *kAnyFieldOpenPattern)) {
     return absl::UnknownError("");
   }
   // consume any extra comments before "[type_url]".
-  while (re2::RE2::Consume(&sp, R"(\s*#.*\n*)")) {
+  while (re2::RE2::Consume(&sp, *kAnyCommentPattern)) {
   }
   // Regex for Any type url enclosed by square brackets, capturing just the
   // message name.
   re2::StringPiece match;
-  if (!re2::RE2::PartialMatch(sp, R"(^\s*\[\s*[^/]+/([^\s\]]+)\s*\])",
-                              &match)) {
+  if (!re2::RE2::PartialMatch(sp, *kAnyTypeUrlPattern, &match)) {
     return absl::UnknownError("Unable to find type_url span for Any");
   }
 
@@ -365,7 +402,9 @@ absl::Status TextprotoAnalyzer::AnalyzeAny(
 
   const Reflection* reflection = proto.GetReflection();
 
-  std::string type_url = reflection->GetString(proto, type_url_desc);
+  std::string type_url_scratch;
+  const std::string& type_url =
+      reflection->GetStringReference(proto, type_url_desc, &type_url_scratch);
   std::string msg_name = ProtoMessageNameFromAnyTypeUrl(type_url);
   const Descriptor* msg_desc =
       descriptor_pool_->FindMessageTypeByName(msg_name);
@@ -382,16 +421,17 @@ absl::Status TextprotoAnalyzer::AnalyzeAny(
                      VNameRef(msg_vname));
 
   // Deserialize Any value into the appropriate message type.
-  std::string value_bytes = reflection->GetString(proto, value_desc);
+  std::string value_scratch;
+  const std::string& value_bytes =
+      reflection->GetStringReference(proto, value_desc, &value_scratch);
   if (value_bytes.size() == 0) {
     // Any value is empty, nothing to index
     return absl::OkStatus();
   }
   google::protobuf::io::ArrayInputStream array_stream(value_bytes.data(),
                                                       value_bytes.size());
-  google::protobuf::DynamicMessageFactory msg_factory;
   std::unique_ptr<Message> value_proto(
-      msg_factory.GetPrototype(msg_desc)->New());
+      any_message_factory_.GetPrototype(msg_desc)->New());
   google::protobuf::io::CodedInputStream coded_stream(&array_stream);
   if (!value_proto->ParseFromCodedStream(&coded_stream)) {
     return absl::UnknownError(absl::StrFormat(
@@ -405,7 +445,7 @@ absl::Status TextprotoAnalyzer::AnalyzeAny(
 // Trims whitespace (including newlines) and comments from the start of the
 // input.
 void ConsumeTextprotoWhitespace(re2::StringPiece* sp) {
-  re2::RE2::Consume(sp, R"((\s+|#[^\n]*)*)");
+  re2::RE2::Consume(sp, *kWhitespacePattern);
 }
 
 // Adds an anchor and ref edge for usage of enum values. For example, in
@@ -419,20 +459,20 @@ absl::Status TextprotoAnalyzer::AnalyzeEnumValue(const proto::VName& file_vname,
 
   // Consume whitespace and colon after field name.
   ConsumeTextprotoWhitespace(&input);
-  if (!re2::RE2::Consume(&input, ":")) {
+  if (!ConsumeChar(&input, ':')) {
     return absl::UnknownError("Failed to find ':' when analyzing enum value");
   }
   ConsumeTextprotoWhitespace(&input);
 
   // Detect 'array format' for repeated fields and trim the leading '['.
   const bool array_format =
-      field.is_repeated() && re2::RE2::Consume(&input, "\\[");
+      field.is_repeated() && ConsumeChar(&input, '[');
   if (array_format) ConsumeTextprotoWhitespace(&input);
 
   while (true) {
     // Match the enum value, which may be an identifier or an integer.
     re2::StringPiece match;
-    if (!re2::RE2::PartialMatch(input, R"(^([_\w\d]+))", &match)) {
+    if (!re2::RE2::PartialMatch(input, *kEnumValuePattern, &match)) {
       return absl::UnknownError("Failed to find text span for enum value: " +
                                 field.full_name());
     }
@@ -468,7 +508,7 @@ absl::Status TextprotoAnalyzer::AnalyzeEnumValue(const proto::VName& file_vname,
 
     // Consume trailing comma and whitespace; exit if there's no comma.
     ConsumeTextprotoWhitespace(&input);
-    if (!re2::RE2::Consume(&input, ",")) {
+    if (!ConsumeChar(&input, ',')) {
       break;
     }
     ConsumeTextprotoWhitespace(&input);
@@ -479,84 +519,58 @@ absl::Status TextprotoAnalyzer::AnalyzeEnumValue(const proto::VName& file_vname,
 
 std::vector<StringToken> TextprotoAnalyzer::ReadStringTokens(
     absl::string_view input) {
-  // Create a tokenizer for the input.
-  google::protobuf::io::ArrayInputStream array_stream(input.data(),
-                                                      input.size());
-  google::protobuf::io::Tokenizer tokenizer(&array_stream, nullptr);
-  // '#' starts a comment.
-  tokenizer.set_comment_style(
-      google::protobuf::io::Tokenizer::SH_COMMENT_STYLE);
-  tokenizer.set_require_space_after_number(false);
-  tokenizer.set_allow_multiline_strings(true);
-
-  if (!tokenizer.Next() || tokenizer.current().type !=
-                               google::protobuf::io::Tokenizer::TYPE_STRING) {
-    return {};  // We require at least one string token.
-  }
-
-  // NOTE: the proto tokenizer uses 0-indexed line numbers, while UTF8LineIndex
-  // expects them 1-indexed. Both use zero-indexed column numbers.
-  const size_t start_offset = input.data() - textproto_content_.data();
-  const size_t start_line = line_index_.LineNumber(start_offset);
-  CharacterPosition start_pos =
-      line_index_.ComputePositionForByteOffset(start_offset);
-  CHECK(start_pos.line_number != -1);
-  absl::string_view start_line_content =
-      line_index_.GetLine(start_pos.line_number);
-  const int start_col = start_pos.column_number;
-
-  // Account for proto's tab behavior and its effect on what 'column number'
-  // means :(.
-  int proto_start_col = 0;
-  for (int i = 0; i < start_col; ++i) {
-    if (start_line_content[i] == '\t') {
-      // tabs advance to the nearest 8th column
-      proto_start_col += 8 - (proto_start_col % 8);
-    } else {
-      proto_start_col += 1;
+  // The parser has already checked the literals, so they are found by
+  // scanning the source directly rather than by running a second tokenizer
+  // and mapping its line and column numbers back to byte offsets. Values are
+  // only unescaped if a plugin asks for them.
+  std::vector<StringToken> tokens;
+  re2::StringPiece rest(input.data(), input.size());
+  while (!rest.empty() && (rest[0] == '"' || rest[0] == '\'')) {
+    const char quote = rest[0];
+    size_t end = 1;
+    while (end < rest.size() && rest[end] != quote) {
+      end += rest[end] == '\\' ? 2 : 1;
+    }
+    if (end >= rest.size()) {
+      break;  // Unterminated literal.
     }
+    tokens.emplace_back(absl::string_view(rest.data() + 1, end - 1));
+    rest.remove_prefix(end + 1);
+    ConsumeTextprotoWhitespace(&rest);
   }
-
-  // Read all TYPE_STRING tokens.
-  std::vector<StringToken> tokens;
-  do {
-    auto t = tokenizer.current();
-
-    // adjust token line/col according to where we started the tokenizer.
-    int column = t.column + (t.line == 0 ? proto_start_col : 0);
-    int line = t.line + start_line;
-
-    StringToken st;
-    tokenizer.ParseStringAppend(t.text, &st.parsed_value);
-    size_t token_offset = ComputeByteOffset(line, column);
-    // create the string_view, trimming the first and last character, which are
-    // quotes.
-    st.source_text = absl::string_view(
-        textproto_content_.data() + token_offset + 1, t.text.size() - 2);
-    tokens.push_back(st);
-  } while (tokenizer.Next() &&
-           tokenizer.current().type ==
-               google::protobuf::io::Tokenizer::TYPE_STRING);
-
   return tokens;
 }
 
+const std::vector<Plugin*>& TextprotoAnalyzer::PluginsForField(
+    const FieldDescriptor& field) {
+  auto inserted = field_plugins_.try_emplace(&field);
+  if (inserted.second) {
+    for (const auto& p : plugins_) {
+      if (p->HandlesField(field)) {
+        inserted.first->second.push_back(p.get());
+      }
+    }
+  }
+  return inserted.first->second;
+}
+
 absl::Status TextprotoAnalyzer::AnalyzeStringValue(
     const proto::VName& file_vname, const Message& proto,
-    const FieldDescriptor& field, int start_offset) {
+    const FieldDescriptor& field, int start_offset,
+    const std::vector<Plugin*>& plugins) {
   // Start after the last character of the field name.
   re2::StringPiece input(textproto_content_.data(), textproto_content_.size());
   input = input.substr(start_offset);
 
   // Consume rest of field name, colon (optional).
   ConsumeTextprotoWhitespace(&input);
-  if (!re2::RE2::Consume(&input, ":")) {
+  if (!ConsumeChar(&input, ':')) {
     return absl::UnknownError("Failed to find ':' when analyzing string value");
   }
   ConsumeTextprotoWhitespace(&input);
 
   const bool array_format =
-      field.is_repeated() && re2::RE2::Consume(&input, "\\[");
+      field.is_repeated() && ConsumeChar(&input, '[');
   if (array_format) ConsumeTextprotoWhitespace(&input);
 
   while (!input.empty()) {
@@ -571,7 +585,7 @@ absl::Status TextprotoAnalyzer::AnalyzeStringValue(
       return absl::UnknownError("Unable to find a string value for field: " +
                                 field.name());
     }
-    for (auto& p : plugins_) {
+    for (Plugin* p : plugins) {
       auto s = p->AnalyzeStringField(this, file_vname, field, tokens);
       if (!s.ok()) {
         LOG(ERROR) << "Plugin error: " << s;
@@ -586,7 +600,7 @@ absl::Status TextprotoAnalyzer::AnalyzeStringValue(
 
     // Consume trailing comma and whitespace; exit if there's no comma.
     ConsumeTextprotoWhitespace(&input);
-    if (!re2::RE2::Consume(&input, ",")) {
+    if (!ConsumeChar(&input, ',')) {
       break;
     }
     ConsumeTextprotoWhitespace(&input);
@@ -663,9 +677,12 @@ absl::Status TextprotoAnalyzer::AnalyzeField(
       }
     } else if (field.type() == FieldDescriptor::TYPE_STRING &&
                !plugins_.empty()) {
-      auto s = AnalyzeStringValue(file_vname, proto, field, end);
-      if (!s.ok()) {
-        LOG(ERROR) << "Error analyzing string value: " << s;
+      const std::vector<Plugin*>& plugins = PluginsForField(field);
+      if (!plugins.empty()) {
+        auto s = AnalyzeStringValue(file_vname, proto, field, end, plugins);
+        if (!s.ok()) {
+          LOG(ERROR) << "Error analyzing string value: " << s;
+        }
       }
     }
   }
@@ -825,20 +842,169 @@ std::string FullPathToRelative(
   return std::string(full_path);
 }
 
-}  // namespace
+// Builds `pool` from the schema descriptors that the extractor compiled into
+// `unit`'s details, if it did. Each file is opened in `file_reader` as the
+// importer would open it, so that the paths its name resolves to are
+// recorded. Returns false if there are no such descriptors or they don't
+// match the unit's inputs, in which case the schema must be compiled from the
+// .proto files instead.
+bool BuildPrecompiledSchemaPool(const proto::CompilationUnit& unit,
+                                PreloadedProtoFileTree* file_reader,
+                                DescriptorPool* pool) {
+  google::protobuf::FileDescriptorSet schema;
+  bool found = false;
+  for (const auto& detail : unit.details()) {
+    if (detail.Is<google::protobuf::FileDescriptorSet>()) {
+      found = detail.UnpackTo(&schema);
+      break;
+    }
+  }
+  if (!found) {
+    return false;
+  }
+  for (const auto& file : schema.file()) {
+    std::unique_ptr<google::protobuf::io::ZeroCopyInputStream> stream(
+        file_reader->Open(file.name()));
+    if (stream == nullptr) {
+      LOG(WARNING) << "Precompiled schema file is not an input: "
+                   << file.name();
+      return false;
+    }
+    if (pool->BuildFile(file) == nullptr) {
+      LOG(WARNING) << "Unable to build precompiled schema file: "
+                   << file.name();
+      return false;
+    }
+  }
+  return true;
+}
 
-absl::Status AnalyzeCompilationUnit(const proto::CompilationUnit& unit,
-                                    const std::vector<proto::FileData>& files,
-                                    KytheGraphRecorder* recorder) {
-  PluginLoadCallback nil_loader = [](const google::protobuf::Message& proto)
-      -> std::vector<std::unique_ptr<Plugin>> { return {}; };
-  return AnalyzeCompilationUnit(nil_loader, unit, files, recorder);
+// Parses the textproto `content`, found at `path`, as a `descriptor` message
+// and analyzes it. If `plugin_mu` is non-null, other files may be analyzed
+// at the same time, so the analysis holds `plugin_mu` if any plugin loaded for
+// this file is not thread-safe.
+absl::Status AnalyzeTextprotoFile(
+    PluginLoadCallback plugin_loader, const proto::CompilationUnit& unit,
+    const std::string& path, const std::string& content,
+    const Descriptor& descriptor,
+    const absl::flat_hash_map<std::string, std::string>&
+        file_substitution_cache,
+    absl::Mutex* plugin_mu, KytheGraphRecorder* recorder) {
+  // Use reflection to create an instance of the top-level proto message.
+  // note: msg_factory must outlive any protos created from it.
+  google::protobuf::DynamicMessageFactory msg_factory;
+  std::unique_ptr<Message> proto(msg_factory.GetPrototype(&descriptor)->New());
+
+  // Parse textproto into @proto, recording input locations to @parse_tree.
+  TextFormat::ParseInfoTree parse_tree;
+  {
+    TextFormat::Parser parser;
+    parser.WriteLocationsTo(&parse_tree);
+    // Relax parser restrictions - even if the proto is partially ill-defined,
+    // we'd like to analyze the parts that are good.
+    parser.AllowPartialMessage(true);
+    parser.AllowUnknownExtension(true);
+    if (!parser.ParseFromString(content, proto.get())) {
+      return absl::UnknownError("Failed to parse text proto");
+    }
+  }
+
+  // Emit file node.
+  proto::VName file_vname = LookupVNameForFullPath(path, unit);
+  recorder->AddProperty(VNameRef(file_vname), NodeKindID::kFile);
+  // Record source text as a fact.
+  recorder->AddProperty(VNameRef(file_vname), PropertyID::kText, content);
+
+  TextprotoAnalyzer analyzer(&unit, content, &file_substitution_cache,
+                             recorder, descriptor.file()->pool());
+
+  // Load plugins
+  std::vector<std::shared_ptr<Plugin>> plugins = plugin_loader(*proto);
+  std::unique_ptr<absl::MutexLock> plugin_lock;
+  if (plugin_mu != nullptr &&
+      !std::all_of(plugins.begin(), plugins.end(),
+                   [](const std::shared_ptr<Plugin>& plugin) {
+                     return plugin->IsThreadSafe();
+                   })) {
+    plugin_lock = absl::make_unique<absl::MutexLock>(plugin_mu);
+  }
+  analyzer.SetPlugins(std::move(plugins));
+
+  absl::Status status = analyzer.AnalyzeSchemaComments(file_vname, descriptor);
+  if (!status.ok()) {
+    std::string msg =
+        absl::StrCat("Error analyzing schema comments: ", status.ToString());
+    LOG(ERROR) << msg << status;
+    analyzer.EmitDiagnostic(file_vname, "schema_comments", msg);
+  }
+
+  return analyzer.AnalyzeMessage(file_vname, *proto, descriptor, parse_tree);
 }
 
-absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
-                                    const proto::CompilationUnit& unit,
-                                    const std::vector<proto::FileData>& files,
-                                    KytheGraphRecorder* recorder) {
+// Hashes `data` into `sha`, preceded by its size so that consecutive fields
+// can't run together.
+void HashField(SHA256_CTX* sha, absl::string_view data) {
+  const uint64_t size = data.size();
+  ::SHA256_Update(sha, &size, sizeof(size));
+  ::SHA256_Update(sha, data.data(), data.size());
+}
+
+// Returns a digest of everything but a textproto's own path and content that
+// determines the entries emitted for it.
+std::string SchemaDigest(
+    const proto::CompilationUnit& unit,
+    const absl::flat_hash_set<std::string>& textproto_filenames,
+    const std::vector<proto::FileData>& files,
+    absl::string_view plugin_fingerprint) {
+  SHA256_CTX sha;
+  ::SHA256_Init(&sha);
+  HashField(&sha, plugin_fingerprint);
+  for (const std::string& arg : unit.argument()) {
+    HashField(&sha, arg);
+  }
+  for (const auto& input : unit.required_input()) {
+    HashField(&sha, input.info().path());
+    HashField(&sha, input.v_name().SerializeAsString());
+  }
+  for (const auto& file : files) {
+    if (!textproto_filenames.contains(file.info().path())) {
+      HashField(&sha, file.info().path());
+      HashField(&sha, file.content());
+    }
+  }
+  std::string digest(SHA256_DIGEST_LENGTH, '\0');
+  ::SHA256_Final(reinterpret_cast<unsigned char*>(&digest[0]), &sha);
+  return digest;
+}
+
+// The key under which a textproto's analysis is recorded in a file cache.
+struct FileCacheKey {
+  HashCache::Hash hash;
+};
+
+FileCacheKey FileCacheKeyFor(absl::string_view schema_digest,
+                             const proto::FileData& file) {
+  SHA256_CTX sha;
+  ::SHA256_Init(&sha);
+  HashField(&sha, "textproto-file");
+  HashField(&sha, schema_digest);
+  HashField(&sha, file.info().path());
+  HashField(&sha, file.content());
+  FileCacheKey key;
+  ::SHA256_Final(key.hash, &sha);
+  return key;
+}
+
+// Analyzes `unit`'s textprotos on up to `options.jobs` threads. Files
+// analyzed one at a time are written to `recorder`. Files analyzed in
+// parallel have their entries buffered separately and then written to
+// `output`.
+absl::Status AnalyzeUnit(PluginLoadCallback plugin_loader,
+                         const proto::CompilationUnit& unit,
+                         const std::vector<proto::FileData>& files,
+                         const AnalysisOptions& options,
+                         KytheGraphRecorder* recorder,
+                         FileOutputStream* output) {
   if (unit.source_file().empty()) {
     return absl::FailedPreconditionError(
         "Expected Unit to contain 1+ source files");
@@ -897,10 +1063,17 @@ absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
         "Couldn't find all textproto sources in file data.");
   }
 
-  // Build proto descriptor pool with top-level protos.
+  // Build proto descriptor pool with top-level protos, unless the extractor
+  // has already compiled them.
   LoggingMultiFileErrorCollector error_collector;
-  google::protobuf::compiler::Importer proto_importer(&file_reader,
-                                                      &error_collector);
+  std::unique_ptr<google::protobuf::compiler::Importer> proto_importer;
+  DescriptorPool precompiled_pool;
+  const DescriptorPool* descriptor_pool = &precompiled_pool;
+  if (!BuildPrecompiledSchemaPool(unit, &file_reader, &precompiled_pool)) {
+    proto_importer = absl::make_unique<google::protobuf::compiler::Importer>(
+        &file_reader, &error_collector);
+    descriptor_pool = proto_importer->pool();
+  }
   for (const std::string& fname : proto_filenames) {
     // The proto importer gets confused if the same proto file is Import()'d
     // under two different file paths. For example, if subdir/some.proto is
@@ -912,12 +1085,14 @@ absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
     // file twice under two different names.
     std::string relpath =
         FullPathToRelative(fname, path_substitutions, &file_substitution_cache);
-    if (!proto_importer.Import(relpath)) {
+    if (proto_importer == nullptr) {
+      continue;
+    }
+    if (!proto_importer->Import(relpath)) {
       return absl::UnknownError("Error importing proto file: " + relpath);
     }
     VLOG(1) << "Added proto to descriptor pool: " << relpath;
   }
-  const DescriptorPool* descriptor_pool = proto_importer.pool();
 
   // Get a descriptor for the top-level Message.
   const Descriptor* descriptor =
@@ -927,58 +1102,108 @@ absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
         "Unable to find proto message in descriptor pool: ", message_name));
   }
 
-  for (auto& source : file_data_by_path) {
-    // Use reflection to create an instance of the top-level proto message.
-    // note: msg_factory must outlive any protos created from it.
-    google::protobuf::DynamicMessageFactory msg_factory;
-    std::unique_ptr<Message> proto(msg_factory.GetPrototype(descriptor)->New());
-
-    // Parse textproto into @proto, recording input locations to @parse_tree.
-    TextFormat::ParseInfoTree parse_tree;
-    {
-      TextFormat::Parser parser;
-      parser.WriteLocationsTo(&parse_tree);
-      // Relax parser restrictions - even if the proto is partially ill-defined,
-      // we'd like to analyze the parts that are good.
-      parser.AllowPartialMessage(true);
-      parser.AllowUnknownExtension(true);
-      if (!parser.ParseFromString(source.second->content(), proto.get())) {
-        return absl::UnknownError("Failed to parse text proto");
+  // Every textproto is analyzed against the same pool. The pool is fully
+  // built by now: its fallback database can't answer symbol or extension
+  // queries, so lookups made while analyzing never reach `file_reader` and
+  // `file_substitution_cache` is only read from here on. Files whose analysis
+  // is already in the file cache are dropped.
+  std::vector<const proto::FileData*> sources;
+  std::vector<FileCacheKey> cache_keys;
+  std::string schema_digest;
+  if (options.file_cache != nullptr) {
+    schema_digest = SchemaDigest(unit, textproto_filenames, files,
+                                 options.plugin_fingerprint);
+  }
+  for (const auto& source : file_data_by_path) {
+    if (options.file_cache != nullptr) {
+      FileCacheKey key = FileCacheKeyFor(schema_digest, *source.second);
+      if (options.file_cache->SawHash(key.hash)) {
+        VLOG(1) << "Skipping unchanged textproto: " << source.first;
+        continue;
       }
+      cache_keys.push_back(key);
     }
-
-    // Emit file node.
-    proto::VName file_vname = LookupVNameForFullPath(source.first, unit);
-    recorder->AddProperty(VNameRef(file_vname), NodeKindID::kFile);
-    // Record source text as a fact.
-    recorder->AddProperty(VNameRef(file_vname), PropertyID::kText,
-                          source.second->content());
-
-    TextprotoAnalyzer analyzer(&unit, source.second->content(),
-                               &file_substitution_cache, recorder,
-                               descriptor_pool);
-
-    // Load plugins
-    analyzer.SetPlugins(plugin_loader(*proto));
-
-    absl::Status status =
-        analyzer.AnalyzeSchemaComments(file_vname, *descriptor);
-    if (!status.ok()) {
-      std::string msg =
-          absl::StrCat("Error analyzing schema comments: ", status.ToString());
-      LOG(ERROR) << msg << status;
-      analyzer.EmitDiagnostic(file_vname, "schema_comments", msg);
+    sources.push_back(source.second);
+  }
+  // Notes that the `i`th file in `sources` has been written.
+  auto register_source = [&](size_t i) {
+    if (options.file_cache != nullptr) {
+      options.file_cache->RegisterHash(cache_keys[i].hash);
     }
-
-    auto s =
-        analyzer.AnalyzeMessage(file_vname, *proto, *descriptor, parse_tree);
-    if (!s.ok()) {
-      return s;
+  };
+  if (options.jobs <= 1 || sources.size() < 2) {
+    for (size_t i = 0; i < sources.size(); ++i) {
+      auto s = AnalyzeTextprotoFile(
+          plugin_loader, unit, sources[i]->info().path(),
+          sources[i]->content(), *descriptor, file_substitution_cache,
+          nullptr, recorder);
+      if (!s.ok()) {
+        return s;
+      }
+      register_source(i);
     }
+    return absl::OkStatus();
   }
 
+  // Each file is written to its own buffer, and the buffers are copied to
+  // `output` in the order the files would have been analyzed sequentially.
+  std::vector<std::string> buffers(sources.size());
+  std::vector<absl::Status> statuses(sources.size());
+  absl::Mutex plugin_mu;
+  {
+    ThreadPool pool(std::min<size_t>(options.jobs, sources.size()));
+    for (size_t i = 0; i < sources.size(); ++i) {
+      pool.Schedule([&, i] {
+        StringAppendingStream appender(&buffers[i]);
+        google::protobuf::io::CopyingOutputStreamAdaptor raw_output(&appender);
+        FileOutputStream file_output(&raw_output);
+        file_output.set_entry_set_bundle_size(output->entry_set_bundle_size());
+        KytheGraphRecorder file_recorder(&file_output);
+        statuses[i] = AnalyzeTextprotoFile(
+            plugin_loader, unit, sources[i]->info().path(),
+            sources[i]->content(), *descriptor, file_substitution_cache,
+            &plugin_mu, &file_recorder);
+      });
+    }
+  }
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (!statuses[i].ok()) {
+      return statuses[i];
+    }
+    if (!buffers[i].empty()) {
+      output->WriteDelimitedEntries(buffers[i]);
+    }
+    register_source(i);
+  }
   return absl::OkStatus();
 }
 
+}  // namespace
+
+absl::Status AnalyzeCompilationUnit(const proto::CompilationUnit& unit,
+                                    const std::vector<proto::FileData>& files,
+                                    KytheGraphRecorder* recorder) {
+  PluginLoadCallback nil_loader = [](const google::protobuf::Message& proto)
+      -> std::vector<std::shared_ptr<Plugin>> { return {}; };
+  return AnalyzeCompilationUnit(nil_loader, unit, files, recorder);
+}
+
+absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
+                                    const proto::CompilationUnit& unit,
+                                    const std::vector<proto::FileData>& files,
+                                    KytheGraphRecorder* recorder) {
+  return AnalyzeUnit(plugin_loader, unit, files, AnalysisOptions(), recorder,
+                     nullptr);
+}
+
+absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
+                                    const proto::CompilationUnit& unit,
+                                    const std::vector<proto::FileData>& files,
+                                    FileOutputStream* output,
+                                    const AnalysisOptions& options) {
+  KytheGraphRecorder recorder(output);
+  return AnalyzeUnit(plugin_loader, unit, files, options, &recorder, output);
+}
+
 }  // namespace lang_textproto
 }  // namespace kythe
@@ -18,10 +18,13 @@
 #define KYTHE_CXX_INDEXER_TEXTPROTO_ANALYZER_H_
 
 #include <cstdio>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/functional/function_ref.h"
 #include "absl/status/status.h"
+#include "kythe/cxx/common/indexing/KytheCachingOutput.h"
 #include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
 #include "kythe/proto/analysis.pb.h"
 #include "plugin.h"
@@ -56,9 +59,10 @@ absl::Status AnalyzeCompilationUnit(const proto::CompilationUnit& unit,
                                     const std::vector<proto::FileData>& files,
                                     KytheGraphRecorder* recorder);
 
-// Callback function to instantiate plugins for a given proto message.
+// Callback function to instantiate plugins for a given proto message. Plugins
+// that are Plugin::IsShareable() may be returned for more than one message.
 using PluginLoadCallback =
-    absl::FunctionRef<std::vector<std::unique_ptr<Plugin>>(
+    absl::FunctionRef<std::vector<std::shared_ptr<Plugin>>(
         const google::protobuf::Message& proto)>;
 
 // Override for AnalyzeCompilationUnit() that accepts a PluginLoadCallback for
@@ -68,6 +72,32 @@ absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
                                     const std::vector<proto::FileData>& files,
                                     KytheGraphRecorder* recorder);
 
+// Options for the AnalyzeCompilationUnit() override that writes to a
+// FileOutputStream.
+struct AnalysisOptions {
+  // How many of a unit's textprotos to analyze at once.
+  int jobs = 1;
+  // If non-null, remembers which textprotos have been indexed. A textproto
+  // is skipped if its content has been indexed before under the same schema
+  // (the unit's arguments, input paths and VNames, and .proto contents) and
+  // `plugin_fingerprint`, on the assumption that its entries were written
+  // where this run's output is going. Only used from the calling thread.
+  HashCache* file_cache = nullptr;
+  // Identifies the plugins that may run and their versions.
+  std::string plugin_fingerprint;
+};
+
+// Override for AnalyzeCompilationUnit() that analyzes the unit's textprotos on
+// up to `options.jobs` threads, sharing one DescriptorPool between them. Each
+// file's entries are buffered and written to `output` in the same order as a
+// sequential run. `plugin_loader` may be called concurrently; files whose
+// plugins are not all Plugin::IsThreadSafe() are analyzed one at a time.
+absl::Status AnalyzeCompilationUnit(PluginLoadCallback plugin_loader,
+                                    const proto::CompilationUnit& unit,
+                                    const std::vector<proto::FileData>& files,
+                                    FileOutputStream* output,
+                                    const AnalysisOptions& options);
+
 }  // namespace lang_textproto
 }  // namespace kythe
 
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "kythe/cxx/indexer/textproto/plugin.h"
+
+#include "absl/strings/str_cat.h"
+#include "google/protobuf/io/tokenizer.h"
+
+namespace kythe {
+namespace lang_textproto {
+
+std::string StringToken::parsed_value() const {
+  if (source_text.find('\\') == absl::string_view::npos) {
+    return std::string(source_text);
+  }
+  // The tokenizer expects the literal's quotes. A double quote works for
+  // either kind of literal, since the only unescaped quotes inside it are
+  // ones that didn't end it.
+  std::string value;
+  google::protobuf::io::Tokenizer::ParseStringAppend(
+      absl::StrCat("\"", source_text, "\""), &value);
+  return value;
+}
+
+}  // namespace lang_textproto
+}  // namespace kythe
@@ -62,28 +62,35 @@ class PluginApi {
 };
 
 struct StringToken {
-  // Parsed string value with escape codes resolved.
-  std::string parsed_value;
-  // The span of source text in the input. The underlying string that the view
-  // references is owned by the `PluginApi`.
+  StringToken() = default;
+  explicit StringToken(absl::string_view source_text)
+      : source_text(source_text) {}
+
+  // Returns the parsed string value with escape codes resolved. The value is
+  // unescaped on each call, so plugins that only need the span should use
+  // `source_text` instead.
+  std::string parsed_value() const;
+
+  // The span of source text in the input, between the quotes. The underlying
+  // string that the view references is owned by the `PluginApi`.
   absl::string_view source_text;
 };
 
 // Superclass for all plugins. A new plugin is instantated for each textproto
-// handled by the indexer.
+// handled by the indexer, unless the plugin IsShareable().
 class Plugin {
  public:
   Plugin() = default;
   virtual ~Plugin() = default;
 
   // Main entrypoint for plugins. In the common case, `tokens` will contain a
-  // single entry with the `parsed_value` and `source_text` fields equal in
+  // single entry whose `parsed_value()` and `source_text` are equal in
   // string value. If string concatenation syntax is used, for example:
   //
   //   my_field: "abc" "def"
   //
   // There will be one StringToken per string "piece" ("abc" and "def" here). If
-  // the string value contains escape codes, the parsed_value may be shorter
+  // the string value contains escape codes, the parsed_value() may be shorter
   // than the source_text as the multi-character escape code is replaced by a
   // single character.
   //
@@ -94,6 +101,24 @@ class Plugin {
       const google::protobuf::FieldDescriptor& field,
       std::vector<StringToken> tokens) = 0;
 
+  // Returns whether this plugin may run while plugins for other textprotos in
+  // the same compilation unit run on other threads. Plugins that share
+  // mutable state between instances must return false.
+  virtual bool IsThreadSafe() const { return false; }
+
+  // Returns whether AnalyzeStringField() should be called for values of the
+  // string field `field`. The indexer asks once per field and textproto, and
+  // skips fields that no plugin handles without reading their values.
+  virtual bool HandlesField(
+      const google::protobuf::FieldDescriptor& field) const {
+    return true;
+  }
+
+  // Returns whether this plugin keeps no state between calls, so that a
+  // single instance may analyze every textproto, including several at once.
+  // Shareable plugins must also be IsThreadSafe().
+  virtual bool IsShareable() const { return false; }
+
  protected:
   Plugin(const Plugin&) = delete;
   Plugin& operator=(const Plugin&) = delete;
@@ -24,18 +24,39 @@ ABSL_FLAG(bool, enable_example_plugin, false,
 
 namespace kythe {
 namespace lang_textproto {
+namespace {
 
-std::vector<std::unique_ptr<Plugin>> LoadRegisteredPlugins(
+// Returns the instance of the shareable plugin `T` used for every textproto,
+// constructing it on first use.
+template <typename T>
+std::shared_ptr<Plugin> SharedPlugin() {
+  static const auto* const plugin =
+      new std::shared_ptr<Plugin>(std::make_shared<T>());
+  return *plugin;
+}
+
+}  // namespace
+
+std::vector<std::shared_ptr<Plugin>> LoadRegisteredPlugins(
     const google::protobuf::Message& proto) {
-  std::vector<std::unique_ptr<Plugin>> plugins;
+  std::vector<std::shared_ptr<Plugin>> plugins;
   std::string msg_name = proto.GetDescriptor()->full_name();
   if (absl::GetFlag(FLAGS_enable_example_plugin) &&
       msg_name == "kythe_plugin_example.Person") {
-    plugins.push_back(
-        std::make_unique<kythe::lang_textproto::ExamplePlugin>(proto));
+    plugins.push_back(SharedPlugin<kythe::lang_textproto::ExamplePlugin>());
   }
   return plugins;
 }
 
+std::string RegisteredPluginsFingerprint() {
+  // Bump a plugin's version whenever the entries it emits change, so that
+  // cached analyses from the old version are not reused.
+  std::string fingerprint;
+  if (absl::GetFlag(FLAGS_enable_example_plugin)) {
+    fingerprint += "example/1;";
+  }
+  return fingerprint;
+}
+
 }  // namespace lang_textproto
 }  // namespace kythe
@@ -17,6 +17,10 @@
 #ifndef KYTHE_CXX_INDEXER_TEXTPROTO_PLUGIN_REGISTRY_H_
 #define KYTHE_CXX_INDEXER_TEXTPROTO_PLUGIN_REGISTRY_H_
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "absl/strings/string_view.h"
 #include "google/protobuf/descriptor.h"
 #include "kythe/cxx/indexer/textproto/plugin.h"
@@ -26,10 +30,15 @@ namespace lang_textproto {
 
 // Simple PluginLoadCallback function that loads plugins relevant to the given
 // proto message. New plugins should be added to the implementation of this
-// function.
-std::vector<std::unique_ptr<Plugin>> LoadRegisteredPlugins(
+// function. Plugins that are Plugin::IsShareable() are constructed once and
+// returned for every message.
+std::vector<std::shared_ptr<Plugin>> LoadRegisteredPlugins(
     const google::protobuf::Message& proto);
 
+// Returns a string identifying the plugins LoadRegisteredPlugins() may load,
+// for use as AnalysisOptions::plugin_fingerprint.
+std::string RegisteredPluginsFingerprint();
+
 }  // namespace lang_textproto
 }  // namespace kythe
 
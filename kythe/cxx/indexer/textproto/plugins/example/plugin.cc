@@ -34,7 +34,7 @@ absl::Status ExamplePlugin::AnalyzeStringField(
 
   std::string full_value;
   for (const auto& t : tokens) {
-    full_value += t.parsed_value;
+    full_value += t.parsed_value();
   }
 
   LOG(ERROR) << "[Example Plugin] String value:" << full_value;
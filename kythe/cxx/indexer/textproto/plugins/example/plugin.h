@@ -34,12 +34,22 @@ namespace lang_textproto {
 // "textproto".
 class ExamplePlugin : public Plugin {
  public:
-  ExamplePlugin(const google::protobuf::Message& proto) {}
+  ExamplePlugin() = default;
 
   absl::Status AnalyzeStringField(
       PluginApi* api, const proto::VName& file_vname,
       const google::protobuf::FieldDescriptor& field,
       std::vector<StringToken> tokens) override;
+
+  bool IsThreadSafe() const override { return true; }
+
+  // Only the `name` and `friend` fields of `Person` refer to people.
+  bool HandlesField(
+      const google::protobuf::FieldDescriptor& field) const override {
+    return field.name() == "name" || field.name() == "friend";
+  }
+
+  bool IsShareable() const override { return true; }
 };
 
 }  // namespace lang_textproto
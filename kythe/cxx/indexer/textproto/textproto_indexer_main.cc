@@ -19,16 +19,19 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <memory>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/match.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/indexing/FileHashCache.h"
 #include "kythe/cxx/common/indexing/KytheCachingOutput.h"
-#include "kythe/cxx/common/indexing/KytheGraphRecorder.h"
+#include "kythe/cxx/common/indexing/MemcachedHashCache.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/kzip_reader.h"
 #include "kythe/cxx/indexer/textproto/analyzer.h"
@@ -40,10 +43,22 @@ ABSL_FLAG(std::string, o, "-", "Output filename.");
 ABSL_FLAG(bool, flush_after_each_entry, true,
           "Flush output after writing each entry.");
 ABSL_FLAG(std::string, index_file, "", "Path to a KZip file to index.");
+ABSL_FLAG(int, jobs, 1,
+          "Number of textprotos within a compilation unit to analyze at once.");
+ABSL_FLAG(std::string, cache, "",
+          "Skip textprotos already indexed with the same schema and content, "
+          "as recorded in a memcache instance (ex: \"--SERVER=foo:1234\") "
+          "or, for file:/some/path, a cache kept on local disk in /some/path "
+          "and /some/path.log. Entries for skipped files are not written, so "
+          "every run sharing a cache should write to the same destination.");
 
 namespace kythe {
 namespace lang_textproto {
 namespace {
+
+/// The prefix of --cache values that name a `FileHashCache`.
+constexpr absl::string_view kFileCachePrefix = "file:";
+
 /// Callback function to process a single compilation unit.
 using CompilationVisitCallback = std::function<void(
     const proto::CompilationUnit&, std::vector<proto::FileData> file_data)>;
@@ -68,16 +83,26 @@ void DecodeKzipFile(const std::string& path,
     std::vector<proto::FileData> virtual_files;
     auto compilation = reader->ReadUnit(digest);
     CHECK(compilation.ok()) << compilation.status();
-    for (const auto& file : compilation->unit().required_input()) {
-      auto content = reader->ReadFile(file.info().digest());
-      CHECK(content.ok()) << "Unable to read file with digest: "
-                          << file.info().digest() << ": " << content.status();
-      proto::FileData file_data;
-      file_data.set_content(*content);
-      file_data.mutable_info()->set_path(file.info().path());
-      file_data.mutable_info()->set_digest(file.info().digest());
-      virtual_files.push_back(std::move(file_data));
+    const auto& inputs = compilation->unit().required_input();
+    std::vector<std::string> digests;
+    digests.reserve(inputs.size());
+    for (const auto& file : inputs) {
+      digests.push_back(file.info().digest());
     }
+    auto read_status = reader->ReadFiles(
+        digests, [&](absl::string_view file_digest,
+                     absl::StatusOr<std::string> content) {
+          CHECK(content.ok()) << "Unable to read file with digest: "
+                              << file_digest << ": " << content.status();
+          const auto& file = inputs[virtual_files.size()];
+          proto::FileData file_data;
+          file_data.set_content(*std::move(content));
+          file_data.mutable_info()->set_path(file.info().path());
+          file_data.mutable_info()->set_digest(file.info().digest());
+          virtual_files.push_back(std::move(file_data));
+          return true;
+        });
+    CHECK(read_status.ok()) << read_status;
 
     visit(compilation->unit(), std::move(virtual_files));
 
@@ -88,6 +113,23 @@ void DecodeKzipFile(const std::string& path,
   CHECK(compilation_read) << "Missing compilation in " << path;
 }
 
+/// \brief Opens the cache named by `spec`, a --cache value.
+/// \return null if `spec` is empty.
+std::unique_ptr<HashCache> OpenFileCache(const std::string& spec) {
+  if (spec.empty()) {
+    return nullptr;
+  }
+  if (absl::StartsWith(spec, kFileCachePrefix)) {
+    auto file_hash_cache = std::make_unique<FileHashCache>();
+    CHECK(file_hash_cache->Open(spec.substr(kFileCachePrefix.size())))
+        << "Can't open " << spec;
+    return file_hash_cache;
+  }
+  auto memcache_hash_cache = std::make_unique<MemcachedHashCache>();
+  CHECK(memcache_hash_cache->OpenMemcache(spec)) << "Can't open " << spec;
+  return memcache_hash_cache;
+}
+
 int main(int argc, char* argv[]) {
   kythe::InitializeProgram(argv[0]);
   absl::SetProgramUsageMessage(
@@ -114,14 +156,19 @@ Example:
   FileOutputStream kythe_output(&raw_output);
   kythe_output.set_flush_after_each_entry(
       absl::GetFlag(FLAGS_flush_after_each_entry));
-  KytheGraphRecorder recorder(&kythe_output);
+
+  AnalysisOptions options;
+  options.jobs = absl::GetFlag(FLAGS_jobs);
+  std::unique_ptr<HashCache> cache = OpenFileCache(absl::GetFlag(FLAGS_cache));
+  options.file_cache = cache.get();
+  options.plugin_fingerprint = RegisteredPluginsFingerprint();
 
   DecodeKzipFile(absl::GetFlag(FLAGS_index_file),
                  [&](const proto::CompilationUnit& unit,
                      std::vector<proto::FileData> file_data) {
                    absl::Status status = lang_textproto::AnalyzeCompilationUnit(
                        kythe::lang_textproto::LoadRegisteredPlugins, unit,
-                       file_data, &recorder);
+                       file_data, &kythe_output, options);
                    CHECK(status.ok()) << status;
                  });
 
@@ -0,0 +1,403 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// changed_units
+//   reads the names of .kzip files from standard input and prints the
+//   digests of the units in them that need to be indexed again: those that
+//   are new or that claim an input that has changed since the run that
+//   wrote --previous_manifest.
+//
+// A unit is only indexed again when a file (and transcript) that it claims
+// under the static claim assignment has new content, a new claimant, or a
+// new transcript, or when the unit's own arguments or set of inputs change.
+// Entries for a claimed file can also depend on the files it includes, so
+// a header changing without changing any transcripts leaves the units that
+// claim its includers alone; pair this tool with periodic full runs.
+
+#include <fcntl.h>
+#include <openssl/sha.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "glog/logging.h"
+#include "google/protobuf/arena.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/gzip_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "kythe/cxx/common/claim_table.h"
+#include "kythe/cxx/common/init.h"
+#include "kythe/cxx/common/kzip_reader.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/cxx/indexer/cxx/KytheClaimClient.h"
+#include "kythe/proto/analysis.pb.h"
+#include "kythe/proto/claim.pb.h"
+#include "kythe/proto/filecontext.pb.h"
+
+using kythe::proto::CompilationUnit;
+using kythe::proto::VName;
+
+ABSL_FLAG(std::string, static_claim, "",
+          "The claim assignment to evaluate claims with: the gzipped "
+          "stream static_claim writes by default or a claim table from "
+          "static_claim --table.");
+ABSL_FLAG(bool, claim_unknown, true,
+          "Whether units claim the inputs the claim assignment doesn't "
+          "mention (as the indexer's --claim_unknown).");
+ABSL_FLAG(std::string, previous_manifest, "",
+          "The manifest written by --manifest_out for the last run. If "
+          "empty, every unit is printed.");
+ABSL_FLAG(std::string, manifest_out, "",
+          "If set, write the manifest for these units here, to be passed as "
+          "--previous_manifest once the printed units have been indexed.");
+ABSL_FLAG(int, jobs, 0,
+          "The number of threads to read units with. If 0, use one per "
+          "hardware thread.");
+ABSL_FLAG(bool, show_stats, false,
+          "Show some statistics on standard error.");
+
+namespace kythe {
+namespace {
+
+/// \brief Range wrapper around unpacked ContextDependentVersion rows.
+class FileContextRows {
+ public:
+  using iterator = decltype(
+      std::declval<kythe::proto::ContextDependentVersion>().row().begin());
+
+  explicit FileContextRows(
+      const kythe::proto::CompilationUnit::FileInput& file_input) {
+    for (const google::protobuf::Any& detail : file_input.details()) {
+      if (detail.UnpackTo(&context_)) break;
+    }
+  }
+
+  iterator begin() const { return context_.row().begin(); }
+  iterator end() const { return context_.row().end(); }
+  bool empty() const { return context_.row().empty(); }
+
+ private:
+  kythe::proto::ContextDependentVersion context_;
+};
+
+/// \brief Builds the manifest fingerprint of a sequence of strings.
+class Fingerprinter {
+ public:
+  Fingerprinter() { ::SHA256_Init(&sha_); }
+
+  void Add(absl::string_view text) {
+    // Prefixing each part with its length keeps different splits of the
+    // same bytes from colliding.
+    uint64_t size = text.size();
+    ::SHA256_Update(&sha_, &size, sizeof(size));
+    ::SHA256_Update(&sha_, text.data(), text.size());
+  }
+
+  void Add(const VName& vname) {
+    Add(vname.signature());
+    Add(vname.corpus());
+    Add(vname.root());
+    Add(vname.path());
+    Add(vname.language());
+  }
+
+  /// \return the fingerprint, in hex.
+  std::string Finish() {
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    ::SHA256_Final(hash, &sha_);
+    // Half of the hash is plenty to tell the manifest's entries apart.
+    return absl::BytesToHexString(
+        absl::string_view(reinterpret_cast<const char*>(hash), 16));
+  }
+
+ private:
+  ::SHA256_CTX sha_;
+};
+
+/// \return the fingerprint of everything about `unit` other than the
+/// contents and transcripts of its inputs.
+std::string FingerprintUnitShape(const CompilationUnit& unit) {
+  CompilationUnit shape = unit;
+  for (auto& input : *shape.mutable_required_input()) {
+    input.mutable_info()->clear_digest();
+    input.clear_details();
+  }
+  std::string bytes;
+  {
+    google::protobuf::io::StringOutputStream stream(&bytes);
+    google::protobuf::io::CodedOutputStream output(&stream);
+    output.SetSerializationDeterministic(true);
+    shape.SerializeToCodedStream(&output);
+  }
+  Fingerprinter fingerprint;
+  fingerprint.Add("unit");
+  fingerprint.Add(bytes);
+  return fingerprint.Finish();
+}
+
+/// \return the fingerprint of `claimant` claiming `claimable` with the
+/// content digest `digest`.
+std::string FingerprintClaim(const VName& claimant, const VName& claimable,
+                             absl::string_view digest) {
+  Fingerprinter fingerprint;
+  fingerprint.Add("claim");
+  fingerprint.Add(claimant);
+  fingerprint.Add(claimable);
+  fingerprint.Add(digest);
+  return fingerprint.Finish();
+}
+
+/// \brief The manifest entries for one unit.
+struct UnitFingerprints {
+  std::string shape;
+  /// One for each input (and transcript) the unit claims.
+  std::vector<std::string> claims;
+};
+
+/// \return the manifest entries for `unit`. `claims` is only read.
+UnitFingerprints FingerprintUnit(const CompilationUnit& unit,
+                                 StaticClaimClient* claims) {
+  UnitFingerprints result;
+  result.shape = FingerprintUnitShape(unit);
+  auto add_claimable = [&](const VName& claimable, const std::string& digest) {
+    if (claims->Claim(unit.v_name(), claimable)) {
+      result.claims.push_back(
+          FingerprintClaim(unit.v_name(), claimable, digest));
+    }
+  };
+  // These are the claimables that static_claim assigns.
+  for (const auto& input : unit.required_input()) {
+    FileContextRows context_rows(input);
+    if (context_rows.empty()) {
+      add_claimable(input.v_name(), input.info().digest());
+      continue;
+    }
+    for (const auto& row : context_rows) {
+      VName context_vname = input.v_name();
+      context_vname.set_signature(row.source_context() +
+                                  input.v_name().signature());
+      add_claimable(context_vname, input.info().digest());
+    }
+  }
+  return result;
+}
+
+/// \brief Loads the claim assignment at `path` into `client`, mapping it
+/// into `table` if it's a claim table.
+void LoadStaticClaims(const std::string& path, StaticClaimClient* client,
+                      std::unique_ptr<ClaimTable>* table) {
+  {
+    std::ifstream file(path, std::ios::binary);
+    CHECK(file) << "Couldn't open " << path;
+    char prefix[ClaimTable::kMagic.size()];
+    file.read(prefix, sizeof(prefix));
+    if (ClaimTable::HasMagic(absl::string_view(prefix, file.gcount()))) {
+      auto opened = ClaimTable::Open(path);
+      CHECK(opened.ok()) << opened.status();
+      *table = *std::move(opened);
+      client->UseClaimTable(table->get());
+      return;
+    }
+  }
+  namespace io = google::protobuf::io;
+  int fd = ::open(path.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Couldn't open " << path;
+  io::FileInputStream file_input_stream(fd);
+  io::GzipInputStream gzip_input_stream(&file_input_stream);
+  for (;;) {
+    io::CodedInputStream coded_input_stream(&gzip_input_stream);
+    coded_input_stream.SetTotalBytesLimit(INT_MAX);
+    uint32_t byte_size;
+    if (!coded_input_stream.ReadVarint32(&byte_size)) {
+      break;
+    }
+    coded_input_stream.PushLimit(byte_size);
+    proto::ClaimAssignment claim;
+    CHECK(claim.ParseFromCodedStream(&coded_input_stream));
+    client->AssignClaim(claim.dependency_v_name(), claim.compilation_v_name());
+  }
+  ::close(fd);
+}
+
+/// \brief Reads a manifest written by `WriteManifest`.
+absl::flat_hash_set<std::string> ReadManifest(const std::string& path) {
+  std::ifstream file(path);
+  CHECK(file) << "Couldn't open " << path;
+  absl::flat_hash_set<std::string> manifest;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) {
+      manifest.insert(std::move(line));
+    }
+  }
+  CHECK(file.eof()) << "Couldn't read " << path;
+  return manifest;
+}
+
+/// \brief Writes `manifest` to `path`, one fingerprint per line in sorted
+/// order.
+void WriteManifest(const std::string& path,
+                   const absl::flat_hash_set<std::string>& manifest) {
+  std::vector<absl::string_view> sorted(manifest.begin(), manifest.end());
+  std::sort(sorted.begin(), sorted.end());
+  std::ofstream file(path);
+  for (absl::string_view fingerprint : sorted) {
+    file << fingerprint << "\n";
+  }
+  CHECK(file) << "Couldn't write " << path;
+}
+
+/// \brief Decides which units need to be indexed again.
+class ChangedUnitFinder {
+ public:
+  /// \param previous The previous run's manifest, or null if there isn't
+  /// one.
+  ChangedUnitFinder(ThreadPool* pool, StaticClaimClient* claims,
+                    const absl::flat_hash_set<std::string>* previous)
+      : pool_(pool), claims_(claims), previous_(previous) {}
+
+  /// \brief Prints the digests of the units in the kzip at `path` that
+  /// need to be indexed again.
+  void AddKzip(const std::string& path) {
+    auto reader = KzipReader::OpenKzip(path);
+    CHECK(reader.ok()) << path << ": " << reader.status();
+    std::vector<std::string> digests;
+    // Units are listed from the kzip's central directory without reading
+    // anything else.
+    const auto status = (*reader)->Scan([&](absl::string_view digest) {
+      digests.emplace_back(digest);
+      return true;
+    });
+    CHECK(status.ok()) << path << ": " << status;
+    for (size_t begin = 0; begin < digests.size(); begin += kBatchSize) {
+      const size_t end = std::min(digests.size(), begin + kBatchSize);
+      std::vector<UnitFingerprints> units(end - begin);
+      // Units are only needed until they're fingerprinted, so they're freed
+      // with the batch.
+      google::protobuf::Arena arena;
+      for (size_t i = begin; i < end; ++i) {
+        pool_->Schedule([&, i] {
+          auto compilation = (*reader)->ReadUnit(digests[i], &arena);
+          CHECK(compilation.ok()) << digests[i] << ": "
+                                  << compilation.status();
+          units[i - begin] = FingerprintUnit((*compilation)->unit(), claims_);
+        });
+      }
+      pool_->Wait();
+      for (size_t i = begin; i < end; ++i) {
+        HandleUnit(digests[i], units[i - begin]);
+      }
+    }
+  }
+
+  /// \return the manifest for every unit added so far.
+  const absl::flat_hash_set<std::string>& manifest() const {
+    return manifest_;
+  }
+  size_t unit_count() const { return unit_count_; }
+  size_t changed_count() const { return changed_count_; }
+
+ private:
+  /// The number of units read at once.
+  static constexpr size_t kBatchSize = 4096;
+
+  void HandleUnit(const std::string& digest, const UnitFingerprints& unit) {
+    ++unit_count_;
+    bool changed = previous_ == nullptr || !previous_->contains(unit.shape);
+    manifest_.insert(unit.shape);
+    for (const auto& claim : unit.claims) {
+      changed = changed || !previous_->contains(claim);
+      manifest_.insert(claim);
+    }
+    if (changed) {
+      ++changed_count_;
+      absl::PrintF("%s\n", digest);
+    }
+  }
+
+  ThreadPool* const pool_;
+  StaticClaimClient* const claims_;
+  const absl::flat_hash_set<std::string>* const previous_;
+  absl::flat_hash_set<std::string> manifest_;
+  size_t unit_count_ = 0;
+  size_t changed_count_ = 0;
+};
+
+}  // anonymous namespace
+}  // namespace kythe
+
+int main(int argc, char* argv[]) {
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  kythe::InitializeProgram(argv[0]);
+  absl::SetProgramUsageMessage(
+      "changed_units: list the units whose claimed inputs changed");
+  absl::ParseCommandLine(argc, argv);
+  kythe::StaticClaimClient claims;
+  std::unique_ptr<kythe::ClaimTable> claim_table;
+  if (!absl::GetFlag(FLAGS_static_claim).empty()) {
+    kythe::LoadStaticClaims(absl::GetFlag(FLAGS_static_claim), &claims,
+                            &claim_table);
+  }
+  claims.set_process_unknown_status(absl::GetFlag(FLAGS_claim_unknown));
+  absl::flat_hash_set<std::string> previous;
+  const bool has_previous = !absl::GetFlag(FLAGS_previous_manifest).empty();
+  if (has_previous) {
+    previous = kythe::ReadManifest(absl::GetFlag(FLAGS_previous_manifest));
+  }
+  int jobs = absl::GetFlag(FLAGS_jobs);
+  if (jobs <= 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  kythe::ThreadPool pool(jobs);
+  kythe::ChangedUnitFinder finder(&pool, &claims,
+                                  has_previous ? &previous : nullptr);
+  std::string next_index_file;
+  while (std::getline(std::cin, next_index_file)) {
+    if (next_index_file.empty()) {
+      continue;
+    }
+    finder.AddKzip(next_index_file);
+  }
+  if (!std::cin.eof()) {
+    absl::FPrintF(stderr, "Error reading from standard input.\n");
+    return 1;
+  }
+  if (!absl::GetFlag(FLAGS_manifest_out).empty()) {
+    kythe::WriteManifest(absl::GetFlag(FLAGS_manifest_out), finder.manifest());
+  }
+  if (absl::GetFlag(FLAGS_show_stats)) {
+    absl::FPrintF(stderr, "         Units: %lu\n", finder.unit_count());
+    absl::FPrintF(stderr, " Changed units: %lu\n", finder.changed_count());
+    absl::FPrintF(stderr, "Manifest lines: %lu\n", finder.manifest().size());
+  }
+  return 0;
+}
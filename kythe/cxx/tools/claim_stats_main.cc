@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+//
+// claim_stats
+//   reads the files of claim stats records that indexers write with
+//   --experimental_claim_stats_file and summarizes them
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/strings/str_format.h"
+#include "kythe/cxx/common/init.h"
+#include "kythe/cxx/indexer/cxx/claim_stats.h"
+
+ABSL_FLAG(int, top, 10,
+          "List this many units with the most overclaimed claims.");
+
+namespace kythe {
+namespace {
+
+/// \brief Adds the records in `input` to `records`.
+/// \return false if `input` holds anything that isn't a record.
+bool ReadRecords(std::istream& input, const std::string& name,
+                 std::vector<ClaimStatsRecord>* records) {
+  std::string line;
+  size_t line_number = 0;
+  while (std::getline(input, line)) {
+    ++line_number;
+    if (line.empty()) {
+      continue;
+    }
+    auto record = ParseClaimStatsRecord(line);
+    if (!record.ok()) {
+      absl::FPrintF(stderr, "%s:%d: %s\n", name, line_number,
+                    record.status().ToString());
+      return false;
+    }
+    records->push_back(*std::move(record));
+  }
+  return input.eof();
+}
+
+}  // anonymous namespace
+}  // namespace kythe
+
+int main(int argc, char* argv[]) {
+  kythe::InitializeProgram(argv[0]);
+  absl::SetProgramUsageMessage(
+      "claim_stats: summarize claim stats records\n"
+      "usage: claim_stats [record-file...]  (or records on standard input)");
+  std::vector<char*> files = absl::ParseCommandLine(argc, argv);
+  std::vector<kythe::ClaimStatsRecord> records;
+  if (files.size() <= 1) {
+    if (!kythe::ReadRecords(std::cin, "<stdin>", &records)) {
+      return 1;
+    }
+  }
+  for (size_t i = 1; i < files.size(); ++i) {
+    std::ifstream input(files[i]);
+    if (!input) {
+      absl::FPrintF(stderr, "Couldn't open %s\n", files[i]);
+      return 1;
+    }
+    if (!kythe::ReadRecords(input, files[i], &records)) {
+      return 1;
+    }
+  }
+  kythe::ClaimStats total;
+  for (const auto& record : records) {
+    total += record.stats;
+  }
+  absl::PrintF("%d records\n%s\n", records.size(), total.ToString());
+  if (total.granted != 0) {
+    // Assume that every granted claim is worth about as many bytes as any
+    // other, so overclaimed grants account for their share of the output.
+    absl::PrintF("~%d bytes from overclaimed grants\n",
+                 static_cast<uint64_t>(static_cast<double>(total.bytes) *
+                                       total.overclaimed / total.granted));
+  }
+  const size_t top = std::min<size_t>(
+      records.size(), std::max(0, absl::GetFlag(FLAGS_top)));
+  std::partial_sort(records.begin(), records.begin() + top, records.end(),
+                    [](const kythe::ClaimStatsRecord& lhs,
+                       const kythe::ClaimStatsRecord& rhs) {
+                      return lhs.stats.overclaimed > rhs.stats.overclaimed;
+                    });
+  for (size_t i = 0; i < top && records[i].stats.overclaimed != 0; ++i) {
+    absl::PrintF("%s: %s\n", records[i].label, records[i].stats.ToString());
+  }
+  return 0;
+}
@@ -16,6 +16,9 @@
 
 #include "kythe/cxx/tools/fyi/fyi.h"
 
+#include <set>
+#include <string>
+
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
@@ -113,12 +116,15 @@ class FileTracker {
       return false;
     }
     if (!untried_.empty()) {
-      auto to_try = *untried_.begin();
-      untried_.erase(untried_.begin());
-      tried_.insert(to_try);
+      // Try every candidate at once, so that one reparse can check them all.
+      std::string includes = "\n";
+      for (const auto& to_try : untried_) {
+        includes += "#include \"" + to_try + "\"\n";
+        tried_.insert(to_try);
+      }
+      untried_.clear();
       rewriter->InsertTextAfter(
-          file_begin_.getLocWithOffset(last_include_offset_),
-          "\n#include \"" + to_try + "\"\n");
+          file_begin_.getLocWithOffset(last_include_offset_), includes);
       return true;
     }
     // We have nothing to do, so abort.
@@ -353,6 +359,7 @@ class Action : public clang::ASTFrontendAction,
 
     clang::ParseAST(compiler->getSema(), compiler->getFrontendOpts().ShowStats,
                     compiler->getFrontendOpts().SkipFunctionBodies);
+    ResolveTypos();
   }
 
   /// \brief Copies the tickets from `reply.edge_set` to `request.ticket`.
@@ -401,13 +408,28 @@ class Action : public clang::ASTFrontendAction,
     // Conservatively assume that something went wrong if we had to invoke
     // typo correction.
     tracker_->pass_had_errors_ = true;
+    // The name is looked up once the parse is over, together with every
+    // other name that needed correcting.
+    typos_.insert(typo.getAsString());
+    return clang::TypoCorrection();
+  }
+
+  /// \brief Finds the files that define the names collected by `CorrectTypo`
+  /// and adds them to the tracker's includes to try. Each step of the search
+  /// is a single request covering every name.
+  void ResolveTypos() {
+    if (typos_.empty()) {
+      return;
+    }
     // Look for any name nodes that could help.
-    proto::VName name_node;
-    name_node.set_signature(typo.getAsString() + "#n");
-    name_node.set_language("c++");
     proto::EdgesRequest named_edges_request;
-    auto name_uri = URI(name_node).ToString();
-    named_edges_request.add_ticket(name_uri);
+    for (const auto& typo : typos_) {
+      proto::VName name_node;
+      name_node.set_signature(typo + "#n");
+      name_node.set_language("c++");
+      named_edges_request.add_ticket(URI(name_node).ToString());
+    }
+    typos_.clear();
     // We've found at least one interesting name in the graph. Now we need
     // to figure out which nodes those names are bound to.
     named_edges_request.add_kind(
@@ -417,37 +439,36 @@ class Action : public clang::ASTFrontendAction,
     if (!factory_.xrefs_->Edges(named_edges_request, &named_edges_reply,
                                 &error_text)) {
       absl::FPrintF(stderr, "Xrefs error (named): %s\n", error_text);
-      return clang::TypoCorrection();
+      return;
     }
     // Get information about the places where those nodes were defined.
     proto::EdgesRequest defined_edges_request;
     proto::EdgesReply defined_edges_reply;
     if (!CopyTicketsFromEdgeSets(named_edges_reply, &defined_edges_request)) {
-      return clang::TypoCorrection();
+      return;
     }
     defined_edges_request.add_kind(
         absl::StrCat("%", kythe::common::schema::kDefines));
     if (!factory_.xrefs_->Edges(defined_edges_request, &defined_edges_reply,
                                 &error_text)) {
       absl::FPrintF(stderr, "Xrefs error (defines): %s\n", error_text);
-      return clang::TypoCorrection();
+      return;
     }
     // Finally, figure out whether we can make those definition sites visible
     // to the site of the typo by adding an include.
     proto::EdgesRequest childof_request;
     proto::EdgesReply childof_reply;
     if (!CopyTicketsFromEdgeSets(defined_edges_reply, &childof_request)) {
-      return clang::TypoCorrection();
+      return;
     }
     childof_request.add_filter(kythe::common::schema::kFactNodeKind);
     childof_request.add_kind(kythe::common::schema::kChildOf);
     if (!factory_.xrefs_->Edges(childof_request, &childof_reply, &error_text)) {
       absl::FPrintF(stderr, "Xrefs error (childof): %s\n", error_text);
-      return clang::TypoCorrection();
+      return;
     }
     // Add those files to the set of includes to try out.
     AddFileNodesToTracker(childof_reply);
-    return clang::TypoCorrection();
   }
 
   FileTracker* tracker() { return tracker_; }
@@ -458,6 +479,9 @@ class Action : public clang::ASTFrontendAction,
 
   /// The `FileTracker` keeping track of the file being processed.
   FileTracker* tracker_ = nullptr;
+
+  /// Names that needed typo correction during the current parse.
+  std::set<std::string> typos_;
 };
 
 void PreprocessorHooks::FileChanged(clang::SourceLocation loc,
@@ -19,6 +19,7 @@
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 #include "glog/logging.h"
+#include "kythe/cxx/common/caching_xrefs_client.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/net_client.h"
 #include "kythe/cxx/tools/fyi/fyi.h"
@@ -31,7 +32,9 @@ static cl::extrahelp common_help(
     clang::tooling::CommonOptionsParser::HelpMessage);
 static cl::OptionCategory fyi_options("Tool options");
 static cl::opt<std::string> xrefs("xrefs",
-                                  cl::desc("Base URI for xrefs service"),
+                                  cl::desc("Base URI for xrefs service "
+                                           "(proto+http:// sends requests as "
+                                           "serialized protobufs)"),
                                   cl::init("http://localhost:8080"));
 
 int main(int argc, const char** argv) {
@@ -45,8 +48,11 @@ int main(int argc, const char** argv) {
     return 1;
   }
   kythe::JsonClient::InitNetwork();
-  auto xrefs_db = absl::make_unique<kythe::XrefsJsonClient>(
-      absl::make_unique<kythe::JsonClient>(), xrefs);
+  // Typo correction asks about the same names in every pass over a file.
+  auto xrefs_db = absl::make_unique<kythe::CachingXrefsClient>(
+      absl::make_unique<kythe::XrefsJsonClient>(
+          absl::make_unique<kythe::JsonClient>(), xrefs),
+      kythe::CachingXrefsClient::Options{});
   clang::tooling::ClangTool tool(options->getCompilations(),
                                  options->getSourcePathList());
   kythe::fyi::ActionFactory factory(std::move(xrefs_db), 5);
@@ -0,0 +1,7 @@
+#include <stdio.h>
+
+int main() {
+  foo();
+  bar();
+  return 0;
+}
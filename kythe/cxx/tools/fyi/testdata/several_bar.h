@@ -0,0 +1,6 @@
+#ifndef SEVERAL_BAR_H
+#define SEVERAL_BAR_H
+
+void bar();
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef SEVERAL_FOO_H
+#define SEVERAL_FOO_H
+
+void foo();
+
+#endif
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// kzip_merge
+//   merges kzip files into one, copying each distinct file's compressed bytes
+//   without recompressing them. With --content_store it also assembles
+//   complete kzips from extractor output that left file contents in a
+//   shared content store.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/synchronization/mutex.h"
+#include "kythe/cxx/common/init.h"
+#include "kythe/cxx/common/kzip_reader.h"
+#include "kythe/cxx/common/kzip_writer.h"
+#include "kythe/cxx/common/path_utils.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/proto/analysis.pb.h"
+
+ABSL_FLAG(std::string, output, "", "Path of the kzip to create.");
+ABSL_FLAG(std::string, content_store, "",
+          "If set, a directory of file contents named by digest. Files that "
+          "units require but that their kzips lack are copied from here.");
+ABSL_FLAG(int, jobs, 1,
+          "Number of input kzips to read at once. With more than one, the "
+          "order of entries in the output depends on scheduling.");
+
+namespace kythe {
+namespace {
+
+/// \brief Merges input kzips into one writer. Safe to call from several
+/// threads at once.
+class KzipMerger {
+ public:
+  /// \param content_store If nonempty, the directory from which to fill in
+  /// required inputs missing from the merged kzips.
+  KzipMerger(KzipWriter* writer, std::string content_store)
+      : content_store_(std::move(content_store)), writer_(writer) {}
+
+  /// \brief Copies the units and files of the kzip at `path` that haven't
+  /// been copied already.
+  absl::Status Merge(const std::string& path) {
+    auto reader = KzipReader::OpenKzip(path);
+    if (!reader.ok()) {
+      return reader.status();
+    }
+    absl::Status status;
+    auto scan = (*reader)->ScanFiles([&](absl::string_view digest) {
+      if (!Claim(digest)) {
+        return true;
+      }
+      // Read outside the writer's lock so that inputs load in parallel.
+      auto raw = (*reader)->ReadRawFile(digest);
+      if (!raw.ok()) {
+        status = raw.status();
+        return false;
+      }
+      absl::MutexLock lock(&writer_mu_);
+      auto written = writer_->WriteRawFile(digest, *std::move(raw));
+      status = written.status();
+      return status.ok();
+    });
+    if (status.ok()) status = scan;
+    if (!status.ok()) {
+      return status;
+    }
+    scan = (*reader)->Scan([&](absl::string_view digest) {
+      auto unit = (*reader)->ReadUnit(digest);
+      if (!unit.ok()) {
+        status = unit.status();
+        return false;
+      }
+      if (!content_store_.empty()) {
+        status = CopyFromStore(*unit);
+        if (!status.ok()) {
+          return false;
+        }
+      }
+      // The writer skips units it has already written.
+      absl::MutexLock lock(&writer_mu_);
+      auto written = writer_->WriteUnit(*unit);
+      status = written.status();
+      return status.ok();
+    });
+    if (status.ok()) status = scan;
+    return status;
+  }
+
+ private:
+  /// \brief Copies the required inputs of `unit` that haven't been claimed
+  /// yet from the content store.
+  absl::Status CopyFromStore(const proto::IndexedCompilation& unit) {
+    for (const auto& input : unit.unit().required_input()) {
+      const std::string& digest = input.info().digest();
+      if (digest.empty() || !Claim(digest)) {
+        continue;
+      }
+      std::string path = JoinPath(content_store_, digest);
+      std::ifstream file(path, std::ios::binary);
+      if (!file) {
+        return absl::NotFoundError(
+            absl::StrCat("Couldn't open ", path, " for ", input.info().path()));
+      }
+      std::stringstream content;
+      content << file.rdbuf();
+      absl::MutexLock lock(&writer_mu_);
+      auto written = writer_->WriteFile(content.str());
+      if (!written.ok()) {
+        return written.status();
+      }
+      if (*written != digest) {
+        return absl::DataLossError(
+            absl::StrCat(path, " has digest ", *written));
+      }
+    }
+    return absl::OkStatus();
+  }
+
+  /// \return true if `digest` hadn't been claimed before.
+  bool Claim(absl::string_view digest) ABSL_LOCKS_EXCLUDED(seen_mu_) {
+    absl::MutexLock lock(&seen_mu_);
+    return seen_.emplace(digest).second;
+  }
+
+  const std::string content_store_;
+  absl::Mutex seen_mu_;
+  /// Digests of the files copied or being copied.
+  absl::flat_hash_set<std::string> seen_ ABSL_GUARDED_BY(seen_mu_);
+  absl::Mutex writer_mu_;
+  KzipWriter* writer_ ABSL_PT_GUARDED_BY(writer_mu_);
+};
+
+}  // anonymous namespace
+}  // namespace kythe
+
+int main(int argc, char* argv[]) {
+  kythe::InitializeProgram(argv[0]);
+  absl::SetProgramUsageMessage(
+      "kzip_merge: merge kzip files, skipping duplicate files\n"
+      "usage: kzip_merge --output merged.kzip input.kzip...");
+  std::vector<char*> inputs = absl::ParseCommandLine(argc, argv);
+  const std::string output = absl::GetFlag(FLAGS_output);
+  if (output.empty() || inputs.size() <= 1) {
+    absl::FPrintF(stderr, "Need --output and at least one input kzip\n");
+    return 1;
+  }
+  // Write into a fresh directory beside the output and rename the kzip into
+  // place only once every input merged, so that a failed merge never leaves a
+  // partial kzip at --output.
+  std::string temp_dir = absl::StrCat(output, ".XXXXXX");
+  if (::mkdtemp(&temp_dir[0]) == nullptr) {
+    absl::FPrintF(stderr, "Couldn't create %s: %s\n", temp_dir,
+                  std::strerror(errno));
+    return 1;
+  }
+  const std::string temp_output = kythe::JoinPath(temp_dir, "merged.kzip");
+  auto writer = kythe::KzipWriter::CreateKzip(temp_output);
+  if (!writer.ok()) {
+    absl::FPrintF(stderr, "Couldn't create %s: %s\n", temp_output,
+                  writer.status().ToString());
+    ::rmdir(temp_dir.c_str());
+    return 1;
+  }
+  kythe::KzipMerger merger(writer->get(), absl::GetFlag(FLAGS_content_store));
+  absl::Mutex errors_mu;
+  std::vector<std::string> errors;
+  {
+    kythe::ThreadPool pool(std::max(1, absl::GetFlag(FLAGS_jobs)));
+    for (size_t i = 1; i < inputs.size(); ++i) {
+      const std::string input = inputs[i];
+      pool.Schedule([&, input] {
+        absl::Status status = merger.Merge(input);
+        if (!status.ok()) {
+          absl::MutexLock lock(&errors_mu);
+          errors.push_back(absl::StrCat(input, ": ", status.ToString()));
+        }
+      });
+    }
+  }
+  absl::Status status = (*writer)->Close();
+  if (!status.ok()) {
+    errors.push_back(absl::StrCat(output, ": ", status.ToString()));
+  }
+  if (errors.empty() && ::rename(temp_output.c_str(), output.c_str()) != 0) {
+    errors.push_back(absl::StrCat("Couldn't rename ", temp_output, " to ",
+                                  output, ": ", std::strerror(errno)));
+  }
+  ::unlink(temp_output.c_str());
+  ::rmdir(temp_dir.c_str());
+  for (const std::string& error : errors) {
+    absl::FPrintF(stderr, "%s\n", error);
+  }
+  return errors.empty() ? 0 : 1;
+}
@@ -21,23 +21,40 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
 #include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/node_hash_map.h"
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
+#include "absl/hash/hash.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/strip.h"
 #include "glog/logging.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/io/coded_stream.h"
 #include "google/protobuf/io/gzip_stream.h"
 #include "google/protobuf/io/zero_copy_stream_impl.h"
+#include "kythe/cxx/common/claim_table.h"
 #include "kythe/cxx/common/init.h"
 #include "kythe/cxx/common/kzip_reader.h"
+#include "kythe/cxx/common/thread_pool.h"
 #include "kythe/cxx/common/vname_ordering.h"
 #include "kythe/proto/analysis.pb.h"
 #include "kythe/proto/claim.pb.h"
@@ -48,7 +65,21 @@ using kythe::proto::CompilationUnit;
 using kythe::proto::VName;
 
 ABSL_FLAG(bool, text, false, "Dump output as text instead of protobuf.");
+ABSL_FLAG(bool, table, false,
+          "Write a claim table that indexers map into memory instead of a "
+          "gzipped stream of claims.");
 ABSL_FLAG(bool, show_stats, false, "Show some statistics.");
+ABSL_FLAG(std::string, weight_by, "count",
+          "How to weigh claimables when balancing claimants: count (every "
+          "claimable weighs the same), size (by file size), or cost (by "
+          "--cost_file).");
+ABSL_FLAG(std::string, cost_file, "",
+          "For --weight_by=cost, a file of lines `path cost`, giving the cost "
+          "(say, seconds spent indexing) of each file in a prior run. Files "
+          "that aren't listed cost the mean of those that are.");
+ABSL_FLAG(int, jobs, 0,
+          "How many threads read units and assign claims; 0 uses one per "
+          "hardware thread. The output is the same for any value.");
 
 struct Claimable;
 
@@ -59,6 +90,11 @@ struct Claimant {
   VName vname;
   /// \brief The set of confirmed claims that this Claimant has. Non-owning.
   std::set<Claimable*> claims;
+  /// \brief The total weight of `claims`.
+  double load = 0;
+  /// \brief Links this Claimant towards the representative of the claimants
+  /// it shares claimables with, or null for a representative. Non-owning.
+  Claimant* group_parent = nullptr;
 };
 
 /// \brief Stably compares `Claimants` by vname.
@@ -77,33 +113,175 @@ struct Claimable {
   Claimant* elected_claimant;
   /// \brief All of the Claimants that can possibly be given responsibility.
   std::set<Claimant*, ClaimantPointerLess> claimants;
+  /// \brief The digest of this Claimable's file content.
+  std::string digest;
+  /// \brief How much this Claimable adds to its claimant's load.
+  double weight = 1;
 };
 
-/// \brief Populates the compilation units from a kzip.
-/// \param path Path to the .kzip file.
-/// \return Vector of collected CompilationUnits.
-static std::vector<CompilationUnit> ReadCompilationUnits(
-    const std::string& path) {
-  kythe::IndexReader reader = kythe::KzipReader::Open(path).value();
-  std::vector<CompilationUnit> result;
-  auto status = reader.Scan([&](const auto digest) {
-    const auto compilation = reader.ReadUnit(digest);
-    CHECK(compilation.ok()) << compilation.status();
-    result.push_back(compilation->unit());
-    return true;
-  });
-  return result;
+/// \brief Maps from file digests to file sizes.
+using FileSizeMap = std::map<std::string, size_t>;
+
+/// \brief Reads the compilation units from kzips on a thread pool and hands
+/// them to a callback in the order they'd be read one at a time: kzips in
+/// the order they're added, and units in the order each kzip lists them.
+class UnitReader {
+ public:
+  /// \param pool The pool that reads and parses units.
+  /// \param file_sizes If non-null, the sizes of the units' required inputs
+  /// are added here.
+  /// \param handle Called with each unit, on the calling thread.
+  UnitReader(kythe::ThreadPool* pool, FileSizeMap* file_sizes,
+             std::function<void(const CompilationUnit&)> handle)
+      : pool_(pool), file_sizes_(file_sizes), handle_(std::move(handle)) {}
+
+  /// \brief Queues the units in the kzip at `path`, handling queued units
+  /// once there are enough of them to share among the pool.
+  void AddKzip(const std::string& path) {
+    auto reader = kythe::KzipReader::OpenKzip(path);
+    CHECK(reader.ok()) << path << ": " << reader.status();
+    readers_.push_back(*std::move(reader));
+    kythe::KzipReader* kzip = readers_.back().get();
+    const auto status = kzip->Scan([&](absl::string_view digest) {
+      pending_.push_back({kzip, std::string(digest)});
+      return true;
+    });
+    CHECK(status.ok()) << path << ": " << status;
+    if (pending_.size() >= kBatchSize) {
+      Flush();
+    }
+  }
+
+  /// \brief Handles every queued unit.
+  void Flush() {
+    // The batch's units are freed together with the arena, rather than one
+    // small string at a time.
+    google::protobuf::Arena arena;
+    std::vector<const CompilationUnit*> units(pending_.size());
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      pool_->Schedule([this, &arena, &units, i] {
+        auto compilation =
+            pending_[i].kzip->ReadUnit(pending_[i].digest, &arena);
+        CHECK(compilation.ok()) << compilation.status();
+        units[i] = &(*compilation)->unit();
+      });
+    }
+    pool_->Wait();
+    if (file_sizes_ != nullptr) {
+      ReadFileSizes(units);
+    }
+    for (const CompilationUnit* unit : units) {
+      handle_(*unit);
+    }
+    pending_.clear();
+    // Every queued unit came from one of these.
+    readers_.clear();
+  }
+
+ private:
+  /// The number of units read at once. Bounds how many parsed units (and
+  /// open kzips) are held in memory.
+  static constexpr size_t kBatchSize = 4096;
+
+  /// \brief A unit waiting to be read.
+  struct PendingUnit {
+    kythe::KzipReader* kzip;
+    std::string digest;
+  };
+
+  /// \brief Adds the sizes of the inputs of `units` that aren't in
+  /// `file_sizes_` yet. A digest names the same content in every kzip, so
+  /// any kzip that holds it will do.
+  void ReadFileSizes(const std::vector<const CompilationUnit*>& units) {
+    std::vector<std::pair<kythe::KzipReader*, std::string>> missing;
+    absl::flat_hash_set<absl::string_view> queued;
+    for (size_t i = 0; i < units.size(); ++i) {
+      for (const auto& input : units[i]->required_input()) {
+        const std::string& digest = input.info().digest();
+        if (file_sizes_->count(digest) == 0 && queued.insert(digest).second) {
+          missing.emplace_back(pending_[i].kzip, digest);
+        }
+      }
+    }
+    std::vector<size_t> sizes(missing.size());
+    for (size_t i = 0; i < missing.size(); ++i) {
+      pool_->Schedule([&missing, &sizes, i] {
+        // The raw entry records the uncompressed size, so there is no need
+        // to inflate the file.
+        const auto entry = missing[i].first->ReadRawFile(missing[i].second);
+        CHECK(entry.ok()) << entry.status();
+        sizes[i] = entry->size;
+      });
+    }
+    pool_->Wait();
+    for (size_t i = 0; i < missing.size(); ++i) {
+      (*file_sizes_)[missing[i].second] = sizes[i];
+    }
+  }
+
+  kythe::ThreadPool* const pool_;
+  FileSizeMap* const file_sizes_;
+  const std::function<void(const CompilationUnit&)> handle_;
+  /// The kzips that `pending_` units come from.
+  std::vector<std::unique_ptr<kythe::KzipReader>> readers_;
+  /// Units to read, in the order they're handled.
+  std::vector<PendingUnit> pending_;
+};
+
+/// \brief Reads a cost file for `--weight_by=cost`.
+/// \return a map from file paths to costs.
+static std::map<std::string, double> ReadCostFile(const std::string& path) {
+  std::ifstream stream(path);
+  CHECK(stream) << "Couldn't open " << path;
+  std::map<std::string, double> costs;
+  std::string line;
+  while (std::getline(stream, line)) {
+    absl::string_view row = absl::StripAsciiWhitespace(line);
+    if (row.empty()) {
+      continue;
+    }
+    // Paths may contain spaces, so the cost is whatever follows the last.
+    const size_t space = row.rfind(' ');
+    double cost;
+    CHECK(space != absl::string_view::npos &&
+          absl::SimpleAtod(row.substr(space + 1), &cost) && cost >= 0)
+        << "Bad line in " << path << ": " << line;
+    costs[std::string(absl::StripTrailingAsciiWhitespace(
+        row.substr(0, space)))] = cost;
+  }
+  return costs;
 }
 
 /// \brief Maps from vnames to claimants (like compilation units).
 using ClaimantMap = std::map<VName, Claimant, kythe::VNameLess>;
 
-/// \brief Maps from vnames to claimables.
+/// \brief Hashes VNames by all of their components.
+struct VNameHash {
+  size_t operator()(const VName& vname) const {
+    using Components =
+        std::tuple<absl::string_view, absl::string_view, absl::string_view,
+                   absl::string_view, absl::string_view>;
+    return absl::Hash<Components>()(Components(vname.signature(),
+                                               vname.corpus(), vname.root(),
+                                               vname.path(), vname.language()));
+  }
+};
+
+/// \brief Compares VNames by all of their components.
+struct VNameEqual {
+  bool operator()(const VName& lhs, const VName& rhs) const {
+    return kythe::VNameEquals(lhs, rhs);
+  }
+};
+
+/// \brief Maps from vnames to claimables. Claimables stay where they are as
+/// the map grows.
 ///
 /// The vname for a claimable with a transcript (like a header file)
 /// is formed from the underlying vname with its signature changed to
 /// include the transcript as a prefix.
-using ClaimableMap = std::map<VName, Claimable, kythe::VNameLess>;
+using ClaimableMap =
+    absl::node_hash_map<VName, Claimable, VNameHash, VNameEqual>;
 
 /// \brief Range wrapper around unpacked ContextDependentVersion rows.
 class FileContextRows {
@@ -129,42 +307,113 @@ class FileContextRows {
 /// \brief Generates and exports a mapping from claimants to claimables.
 class ClaimTool {
  public:
-  /// \brief Selects a claimant for every claimable.
-  ///
-  /// We apply a simple heuristic: for every claimable, for every possible
-  /// claimant, we choose the claimant with the fewest claimables assigned to
-  /// it when trying to assign a new claimable.
-  void AssignClaims() {
-    // claimables_ is sorted by VName.
+  /// \brief Sets the weight of every claimable to `weigh(claimable)`.
+  void WeighClaimables(const std::function<double(const Claimable&)>& weigh) {
     for (auto& claimable : claimables_) {
-      CHECK(!claimable.second.claimants.empty());
-      Claimant* emptiest_claimant = *claimable.second.claimants.begin();
-      // claimants is also sorted by VName, so this assignment should be stable.
-      for (auto& claimant : claimable.second.claimants) {
-        if (claimant->claims.size() < emptiest_claimant->claims.size()) {
-          emptiest_claimant = claimant;
+      claimable.second.weight = weigh(claimable.second);
+    }
+  }
+
+  /// \brief Selects a claimant for every claimable, using `pool`.
+  ///
+  /// We apply a greedy heuristic: we visit claimables from heaviest to
+  /// lightest, and give each to whichever of its possible claimants has the
+  /// least total weight so far. Visiting the heavy claimables first keeps a
+  /// big header from landing on a claimant that is already loaded. This
+  /// takes time proportional to the number of (claimable, possible claimant)
+  /// pairs, plus a sort of the claimables. When every claimable weighs the
+  /// same, it reduces to giving each claimable, in VName order, to the
+  /// claimant with the fewest claims.
+  ///
+  /// A claimable's choice only depends on the claimables before it that
+  /// share a claimant with it. Claimables are split into groups that share
+  /// no claimants, and the groups are assigned concurrently, each in the
+  /// order above, so the result is the same as one pass.
+  void AssignClaims(kythe::ThreadPool* pool) {
+    SortClaimables();
+    std::vector<Claimable*> order = sorted_claimables_;
+    // sorted_claimables_ is sorted by VName, and the sort is stable.
+    std::stable_sort(order.begin(), order.end(),
+                     [](const Claimable* lhs, const Claimable* rhs) {
+                       return lhs->weight > rhs->weight;
+                     });
+    for (Claimable* claimable : order) {
+      CHECK(!claimable->claimants.empty());
+      Claimant* first = FindGroup(*claimable->claimants.begin());
+      for (Claimant* claimant : claimable->claimants) {
+        Claimant* group = FindGroup(claimant);
+        if (group != first) {
+          group->group_parent = first;
+        }
+      }
+    }
+    absl::flat_hash_map<Claimant*, std::vector<Claimable*>> groups;
+    for (Claimable* claimable : order) {
+      groups[FindGroup(*claimable->claimants.begin())].push_back(claimable);
+    }
+    // Hand the pool batches of whole groups; most groups are tiny.
+    constexpr size_t kMinBatchSize = 1024;
+    std::vector<const std::vector<Claimable*>*> batch;
+    size_t batch_size = 0;
+    auto schedule_batch = [&] {
+      pool->Schedule([batch] {
+        for (const auto* group : batch) {
+          for (Claimable* claimable : *group) {
+            AssignClaim(claimable);
+          }
         }
+      });
+      batch.clear();
+      batch_size = 0;
+    };
+    for (const auto& group : groups) {
+      batch.push_back(&group.second);
+      batch_size += group.second.size();
+      if (batch_size >= kMinBatchSize) {
+        schedule_batch();
       }
-      emptiest_claimant->claims.insert(&claimable.second);
-      claimable.second.elected_claimant = emptiest_claimant;
     }
+    if (!batch.empty()) {
+      schedule_batch();
+    }
+    pool->Wait();
   }
 
   /// \brief Export claim data to `out_fd` in the format specified by
-  /// `FLAGS_text`.
+  /// `FLAGS_text` and `FLAGS_table`.
   void WriteClaimFile(int out_fd) {
+    SortClaimables();
     if (absl::GetFlag(FLAGS_text)) {
-      for (auto& claimable : claimables_) {
-        if (claimable.second.elected_claimant) {
+      for (const Claimable* claimable : sorted_claimables_) {
+        if (claimable->elected_claimant) {
           ClaimAssignment claim;
           claim.mutable_compilation_v_name()->CopyFrom(
-              claimable.second.elected_claimant->vname);
-          claim.mutable_dependency_v_name()->CopyFrom(claimable.second.vname);
+              claimable->elected_claimant->vname);
+          claim.mutable_dependency_v_name()->CopyFrom(claimable->vname);
           absl::PrintF("%s", claim.DebugString());
         }
       }
       return;
     }
+    if (absl::GetFlag(FLAGS_table)) {
+      kythe::ClaimTableWriter writer;
+      for (const Claimable* claimable : sorted_claimables_) {
+        if (claimable->elected_claimant) {
+          writer.Add(claimable->vname, claimable->elected_claimant->vname);
+        }
+      }
+      const std::string table = writer.Finish();
+      for (size_t written = 0; written < table.size();) {
+        ssize_t result =
+            ::write(out_fd, table.data() + written, table.size() - written);
+        CHECK(result > 0 || errno == EINTR) << "errno was: " << errno;
+        if (result > 0) {
+          written += result;
+        }
+      }
+      CHECK(::close(out_fd) == 0) << "errno was: " << errno;
+      return;
+    }
     {
       namespace io = google::protobuf::io;
       io::FileOutputStream file_output_stream(out_fd);
@@ -172,12 +421,12 @@ class ClaimTool {
       options.format = io::GzipOutputStream::GZIP;
       io::GzipOutputStream gzip_stream(&file_output_stream, options);
       io::CodedOutputStream coded_stream(&gzip_stream);
-      for (auto& claimable : claimables_) {
-        const auto& elected_claimant = claimable.second.elected_claimant;
+      for (const Claimable* claimable : sorted_claimables_) {
+        const auto& elected_claimant = claimable->elected_claimant;
         if (elected_claimant) {
           ClaimAssignment claim;
           claim.mutable_compilation_v_name()->CopyFrom(elected_claimant->vname);
-          claim.mutable_dependency_v_name()->CopyFrom(claimable.second.vname);
+          claim.mutable_dependency_v_name()->CopyFrom(claimable->vname);
           coded_stream.WriteVarint32(claim.ByteSizeLong());
           CHECK(claim.SerializeToCodedStream(&coded_stream));
         }
@@ -219,15 +468,17 @@ class ClaimTool {
           VName cxt_vname = input_vname;
           cxt_vname.set_signature(row.source_context() +
                                   input_vname.signature());
-          auto input_insert_result =
-              claimables_.emplace(cxt_vname, Claimable{cxt_vname, nullptr});
+          auto input_insert_result = claimables_.emplace(
+              cxt_vname,
+              Claimable{cxt_vname, nullptr, {}, input.info().digest()});
           input_insert_result.first->second.claimants.insert(
               &insert_result.first->second);
         }
       } else {
         ++total_include_count_;
         auto input_insert_result = claimables_.emplace(
-            input.v_name(), Claimable{input.v_name(), nullptr});
+            input.v_name(),
+            Claimable{input.v_name(), nullptr, {}, input.info().digest()});
         input_insert_result.first->second.claimants.insert(
             &insert_result.first->second);
       }
@@ -240,10 +491,54 @@ class ClaimTool {
   size_t total_input_count() const { return total_input_count_; }
 
  private:
+  /// \brief Fills `sorted_claimables_` if it's out of date.
+  void SortClaimables() {
+    if (sorted_claimables_.size() == claimables_.size()) {
+      return;
+    }
+    sorted_claimables_.clear();
+    sorted_claimables_.reserve(claimables_.size());
+    for (auto& claimable : claimables_) {
+      sorted_claimables_.push_back(&claimable.second);
+    }
+    std::sort(sorted_claimables_.begin(), sorted_claimables_.end(),
+              [](const Claimable* lhs, const Claimable* rhs) {
+                return kythe::VNameLess()(lhs->vname, rhs->vname);
+              });
+  }
+
+  /// \return the representative of the group `claimant` is in.
+  static Claimant* FindGroup(Claimant* claimant) {
+    while (claimant->group_parent != nullptr) {
+      if (claimant->group_parent->group_parent != nullptr) {
+        claimant->group_parent = claimant->group_parent->group_parent;
+      }
+      claimant = claimant->group_parent;
+    }
+    return claimant;
+  }
+
+  /// \brief Gives `claimable` to whichever of its claimants has the least
+  /// load, preferring the first in VName order.
+  static void AssignClaim(Claimable* claimable) {
+    Claimant* emptiest_claimant = *claimable->claimants.begin();
+    // claimants is also sorted by VName, so this assignment should be stable.
+    for (auto& claimant : claimable->claimants) {
+      if (claimant->load < emptiest_claimant->load) {
+        emptiest_claimant = claimant;
+      }
+    }
+    emptiest_claimant->claims.insert(claimable);
+    emptiest_claimant->load += claimable->weight;
+    claimable->elected_claimant = emptiest_claimant;
+  }
+
   /// Objects that may claim resources.
   ClaimantMap claimants_;
   /// Resources that may be claimed.
   ClaimableMap claimables_;
+  /// `claimables_` in VName order, once they've all been added.
+  std::vector<Claimable*> sorted_claimables_;
   /// Number of required inputs.
   size_t total_include_count_ = 0;
   /// Number of #includes.
@@ -255,21 +550,59 @@ int main(int argc, char* argv[]) {
   kythe::InitializeProgram(argv[0]);
   absl::SetProgramUsageMessage("static_claim: assign ownership for analysis");
   absl::ParseCommandLine(argc, argv);
+  const std::string weight_by = absl::GetFlag(FLAGS_weight_by);
+  if (weight_by != "count" && weight_by != "size" && weight_by != "cost") {
+    absl::FPrintF(stderr, "Unknown --weight_by: %s\n", weight_by);
+    return 1;
+  }
+  if (weight_by == "cost" && absl::GetFlag(FLAGS_cost_file).empty()) {
+    absl::FPrintF(stderr, "--weight_by=cost needs a --cost_file.\n");
+    return 1;
+  }
+  int jobs = absl::GetFlag(FLAGS_jobs);
+  if (jobs <= 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  kythe::ThreadPool pool(jobs);
   std::string next_index_file;
   ClaimTool tool;
+  FileSizeMap file_sizes;
+  UnitReader reader(&pool, weight_by == "size" ? &file_sizes : nullptr,
+                    [&tool](const CompilationUnit& unit) {
+                      tool.HandleCompilationUnit(unit);
+                    });
   while (std::getline(std::cin, next_index_file)) {
     if (next_index_file.empty()) {
       continue;
     }
-    for (CompilationUnit unit : ReadCompilationUnits(next_index_file)) {
-      tool.HandleCompilationUnit(unit);
-    }
+    reader.AddKzip(next_index_file);
   }
+  reader.Flush();
   if (!std::cin.eof()) {
     absl::FPrintF(stderr, "Error reading from standard input.\n");
     return 1;
   }
-  tool.AssignClaims();
+  if (weight_by == "size") {
+    tool.WeighClaimables([&file_sizes](const Claimable& claimable) {
+      const auto size = file_sizes.find(claimable.digest);
+      return size == file_sizes.end() ? 0.0 : size->second;
+    });
+  } else if (weight_by == "cost") {
+    const auto costs = ReadCostFile(absl::GetFlag(FLAGS_cost_file));
+    double mean_cost = 1;
+    if (!costs.empty()) {
+      double total_cost = 0;
+      for (const auto& cost : costs) {
+        total_cost += cost.second;
+      }
+      mean_cost = total_cost / costs.size();
+    }
+    tool.WeighClaimables([&costs, mean_cost](const Claimable& claimable) {
+      const auto cost = costs.find(claimable.vname.path());
+      return cost == costs.end() ? mean_cost : cost->second;
+    });
+  }
+  tool.AssignClaims(&pool);
   tool.WriteClaimFile(STDOUT_FILENO);
   if (absl::GetFlag(FLAGS_show_stats)) {
     absl::PrintF("Number of claimables: %lu\n", tool.claimables().size());
@@ -278,6 +611,16 @@ int main(int argc, char* argv[]) {
     absl::PrintF(" Total include count: %lu\n", tool.total_include_count());
     absl::PrintF("%%claimables/includes: %f\n",
                  tool.claimables().size() * 100.0 / tool.total_include_count());
+    double max_load = 0;
+    double total_load = 0;
+    for (const auto& claimant : tool.claimants()) {
+      max_load = std::max(max_load, claimant.second.load);
+      total_load += claimant.second.load;
+    }
+    absl::PrintF("  Max/mean load (%s): %f\n", weight_by,
+                 total_load == 0 ? 0.0
+                                 : max_load * tool.claimants().size() /
+                                       total_load);
   }
   return 0;
 }
@@ -0,0 +1,33 @@
+#!/bin/bash
+# This script checks that changed_units only lists the units whose claimed
+# inputs changed since the previous manifest was written.
+set -e
+BASE_DIR="$PWD/kythe/cxx/tools/testdata"
+OUT_DIR="$TEST_TMPDIR"
+: ${CHANGED_UNITS_BIN?:missing changed_units}
+: ${CLAIM_TOOL_BIN?:missing static_claim}
+
+mkdir -p "${OUT_DIR}/tmp/units"
+cp "${BASE_DIR}"/claim_test_{1,2}.kzip_UNIT.json "${OUT_DIR}/tmp/units"
+(cd "${OUT_DIR}"; zip -r before.kzip tmp)
+# Only the second unit claims b.h.
+sed -i 's|"path":"b.h"|"path":"b.h"},"info":{"digest":"changed"|' \
+    "${OUT_DIR}/tmp/units/claim_test_2.kzip_UNIT.json"
+(cd "${OUT_DIR}"; zip -r after.kzip tmp)
+ls "${OUT_DIR}/before.kzip" | "${CLAIM_TOOL_BIN}" -table \
+    > "${OUT_DIR}/claims.table"
+
+changed_units() {
+  local kzip="$1"
+  shift
+  ls "${OUT_DIR}/${kzip}" | "${CHANGED_UNITS_BIN}" \
+      -static_claim="${OUT_DIR}/claims.table" "$@" | wc -l
+}
+
+# Without a manifest, every unit is listed.
+[[ "$(changed_units before.kzip -manifest_out="${OUT_DIR}/manifest")" -eq 2 ]]
+# Nothing changed since the manifest was written.
+[[ "$(changed_units before.kzip -previous_manifest="${OUT_DIR}/manifest" \
+    -jobs=4)" -eq 0 ]]
+[[ "$(changed_units after.kzip -previous_manifest="${OUT_DIR}/manifest")" \
+    -eq 1 ]]
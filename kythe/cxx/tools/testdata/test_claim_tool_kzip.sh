@@ -8,5 +8,8 @@ OUT_DIR="$TEST_TMPDIR"
 mkdir -p "${OUT_DIR}/tmp/units" "${OUT_DIR}/tmp/files"
 cp "${BASE_DIR}"/claim_test_{1,2}.kzip_UNIT.json "${OUT_DIR}/tmp/units"
 (cd "${OUT_DIR}"; zip -r claim_test.kzip tmp)
-ls "${OUT_DIR}"/claim_test.kzip | "${CLAIM_TOOL_BIN}" -text \
-    | diff "${BASE_DIR}/claim_test.expected" -
+# The claims don't depend on how many threads compute them.
+for jobs in 1 4; do
+  ls "${OUT_DIR}"/claim_test.kzip | "${CLAIM_TOOL_BIN}" -text -jobs="${jobs}" \
+      | diff "${BASE_DIR}/claim_test.expected" -
+done
@@ -0,0 +1,30 @@
+#!/bin/bash
+# This script checks that kzip_merge combines kzips, skipping duplicates, and
+# leaves no output behind when a merge fails.
+set -e
+BASE_DIR="$PWD/kythe/cxx/tools/testdata"
+OUT_DIR="$TEST_TMPDIR"
+: ${KZIP_MERGE_BIN?:missing kzip_merge}
+: ${CLAIM_TOOL_BIN?:missing static_claim}
+
+for unit in 1 2; do
+  rm -rf "${OUT_DIR}/tmp"
+  mkdir -p "${OUT_DIR}/tmp/units" "${OUT_DIR}/tmp/files"
+  cp "${BASE_DIR}/claim_test_${unit}.kzip_UNIT.json" "${OUT_DIR}/tmp/units"
+  (cd "${OUT_DIR}"; zip -r "claim_test_${unit}.kzip" tmp)
+done
+
+# Merging the same units twice yields the claims of merging them once.
+"${KZIP_MERGE_BIN}" --output="${OUT_DIR}/merged.kzip" --jobs=2 \
+    "${OUT_DIR}"/claim_test_{1,2,1}.kzip
+ls "${OUT_DIR}/merged.kzip" | "${CLAIM_TOOL_BIN}" -text \
+    | diff "${BASE_DIR}/claim_test.expected" -
+
+# A failed merge leaves neither the output nor its temporary files.
+mkdir "${OUT_DIR}/failed"
+if "${KZIP_MERGE_BIN}" --output="${OUT_DIR}/failed/merged.kzip" \
+    "${OUT_DIR}/claim_test_1.kzip" "${OUT_DIR}/missing.kzip"; then
+  echo "Merging a missing kzip succeeded" >&2
+  exit 1
+fi
+[[ -z "$(ls -A "${OUT_DIR}/failed")" ]]
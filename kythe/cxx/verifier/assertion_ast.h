@@ -20,11 +20,18 @@
 #include <ctype.h>
 
 #include <algorithm>
+#include <deque>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/hash/hash.h"
 #include "absl/strings/escaping.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "glog/logging.h"
 #include "kythe/cxx/verifier/location.hh"
 #include "pretty_printer.h"
@@ -38,31 +45,42 @@ namespace verifier {
 typedef size_t Symbol;
 
 /// \brief Maps strings to `Symbol`s.
+///
+/// All members may be called from multiple threads. Strings are interned in
+/// shards chosen by their hash, so threads interning different strings rarely
+/// wait on one another; `Symbol`s are numbered in the order they were first
+/// handed out.
 class SymbolTable {
  public:
   explicit SymbolTable() : id_regex_("[%#]?[_a-zA-Z/][a-zA-Z_0-9/]*") {}
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
 
   /// \brief Returns the `Symbol` associated with `string`, or makes a new one.
-  Symbol intern(const std::string& string) {
-    const auto old = symbols_.find(string);
-    if (old != symbols_.end()) {
+  Symbol intern(absl::string_view string) {
+    size_t hash = absl::Hash<absl::string_view>{}(string);
+    // Use the high bits so that shards don't all share the low bits the
+    // shard's own hash table uses.
+    Shard& shard = shards_[hash >> (sizeof(size_t) * 8 - kShardBits)];
+    absl::MutexLock lock(&shard.mu);
+    const auto old = shard.symbols.find(string);
+    if (old != shard.symbols.end()) {
       return old->second;
     }
-    Symbol next_symbol = reverse_map_.size();
-    symbols_[string] = next_symbol;
-    // Note that references to elements of `unordered_map` are not invalidated
-    // upon insert (really, upon rehash), so keeping around pointers in
-    // `reverse_map_` is safe.
-    reverse_map_.push_back(&symbols_.find(string)->first);
+    // Elements of a `deque` don't move when it grows, so both the key and
+    // `reverse_map_` may point into it.
+    const std::string* text = &shard.text.emplace_back(string);
+    Symbol next_symbol = Publish(text);
+    shard.symbols.emplace(*text, next_symbol);
     return next_symbol;
   }
   /// \brief Returns the text associated with `symbol`.
-  const std::string& text(Symbol symbol) const { return *reverse_map_[symbol]; }
+  const std::string& text(Symbol symbol) const { return *Lookup(symbol); }
 
   /// \brief Returns a string associated with `symbol` that disambiguates
   /// nonces.
   std::string PrettyText(Symbol symbol) const {
-    auto* text = reverse_map_[symbol];
+    auto* text = Lookup(symbol);
     if (text == &unique_symbol_) {
       return absl::StrCat("(unique#", std::to_string(symbol), ")");
     } else if (!text->empty() && RE2::FullMatch(*text, id_regex_)) {
@@ -74,16 +92,39 @@ class SymbolTable {
 
   /// \brief Returns a `Symbol` that can never be spelled (but which still has
   /// a printable name).
-  Symbol unique() {
-    reverse_map_.push_back(&unique_symbol_);
+  Symbol unique() { return Publish(&unique_symbol_); }
+
+ private:
+  /// Strings are spread over `1 << kShardBits` shards.
+  static constexpr size_t kShardBits = 4;
+
+  /// \brief Part of the map from text to `Symbol`s.
+  struct Shard {
+    absl::Mutex mu;
+    /// Maps text to unique `Symbol`s; keys point into `text`.
+    absl::flat_hash_map<absl::string_view, Symbol> symbols ABSL_GUARDED_BY(mu);
+    /// Storage for the text of this shard's symbols.
+    std::deque<std::string> text ABSL_GUARDED_BY(mu);
+  };
+
+  /// \brief Assigns the next `Symbol` to `text`.
+  Symbol Publish(const std::string* text) ABSL_LOCKS_EXCLUDED(reverse_mu_) {
+    absl::MutexLock lock(&reverse_mu_);
+    reverse_map_.push_back(text);
     return reverse_map_.size() - 1;
   }
 
- private:
-  /// Maps text to unique `Symbol`s.
-  std::unordered_map<std::string, Symbol> symbols_;
+  /// \brief Returns the text of `symbol`.
+  const std::string* Lookup(Symbol symbol) const
+      ABSL_LOCKS_EXCLUDED(reverse_mu_) {
+    absl::ReaderMutexLock lock(&reverse_mu_);
+    return reverse_map_[symbol];
+  }
+
+  Shard shards_[1 << kShardBits];
+  mutable absl::Mutex reverse_mu_;
   /// Maps `Symbol`s back to their original text.
-  std::vector<const std::string*> reverse_map_;
+  std::vector<const std::string*> reverse_map_ ABSL_GUARDED_BY(reverse_mu_);
   /// The text to use for unique() symbols.
   std::string unique_symbol_ = "(unique)";
   /// Used for quoting strings - see assertions.lex:
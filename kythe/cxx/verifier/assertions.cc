@@ -18,6 +18,10 @@
 
 #include <sstream>
 
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "kythe/cxx/common/file_utils.h"
 #include "verifier.h"
 
@@ -506,6 +510,45 @@ void AssertionParser::ExitGoalGroup(const yy::location& location) {
   inside_goal_group_ = false;
 }
 
+/// \brief Finds the literal prefix that every goal line must start with
+/// (after any whitespace) when `goal_comment_regex` has the form that
+/// `Verifier::SetGoalCommentPrefix` builds, `\s*<quoted literal>(.*)`.
+/// \return false if the regex has some other form.
+static bool GoalCommentPrefixLiteral(const RE2& goal_comment_regex,
+                                     std::string* literal) {
+  absl::string_view pattern = goal_comment_regex.pattern();
+  if (!absl::ConsumePrefix(&pattern, "\\s*") ||
+      !absl::ConsumeSuffix(&pattern, "(.*)")) {
+    return false;
+  }
+  literal->clear();
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    unsigned char c = pattern[i];
+    if (c == '\\') {
+      // Escaped punctuation stands for itself; escapes like \x00 don't.
+      if (++i == pattern.size() ||
+          absl::ascii_isalnum(static_cast<unsigned char>(pattern[i]))) {
+        return false;
+      }
+      literal->push_back(pattern[i]);
+    } else if (absl::ascii_isalnum(c) || c == '_' || c >= 0x80) {
+      literal->push_back(c);
+    } else {
+      return false;
+    }
+  }
+  return !literal->empty();
+}
+
+/// \return true if `line` starts with `prefix` after any characters that
+/// RE2's `\s` matches.
+static bool HasGoalCommentPrefix(absl::string_view line,
+                                 absl::string_view prefix) {
+  size_t start = line.find_first_not_of(" \t\n\f\r");
+  return start != absl::string_view::npos &&
+         absl::StartsWith(line.substr(start), prefix);
+}
+
 void AssertionParser::ScanBeginString(const RE2& goal_comment_regex,
                                       const std::string& data,
                                       bool trace_scanning) {
@@ -515,15 +558,25 @@ void AssertionParser::ScanBeginString(const RE2& goal_comment_regex,
   // that we don't have to push RE2 deeper into the lexer; it also preserves
   // file locations for diagnostics (after taking into account the constant
   // 1 offset).
+  // When goals are marked by a plain prefix, lines without it can't match,
+  // so the regex only runs on the few candidate lines.
+  std::string prefix;
+  bool has_prefix = GoalCommentPrefixLiteral(goal_comment_regex, &prefix);
   std::string yy_buf;
+  yy_buf.reserve(data.size() + data.size() / 16 + 1);
   size_t next_line_begin = 0;
   auto append_line = [&](size_t line_end) {
     re2::StringPiece match_region;
     size_t line_length = line_end - next_line_begin;
-    auto is_goal = RE2::FullMatch(
-        re2::StringPiece(data.data() + next_line_begin, line_length),
-        goal_comment_regex, &match_region);
-    if (is_goal == 1) {
+    bool is_goal =
+        (!has_prefix ||
+         HasGoalCommentPrefix(
+             absl::string_view(data.data() + next_line_begin, line_length),
+             prefix)) &&
+        RE2::FullMatch(
+            re2::StringPiece(data.data() + next_line_begin, line_length),
+            goal_comment_regex, &match_region);
+    if (is_goal) {
       yy_buf.push_back('-');
       size_t pre_pad = match_region.data() - data.data() - next_line_begin;
       for (size_t s = 0; s < pre_pad; ++s) {
@@ -16,6 +16,8 @@
 
 #include "kythe/cxx/verifier/assertions_to_souffle.h"
 
+#include "absl/strings/substitute.h"
+
 namespace kythe::verifier {
 
 /// \brief Turns `goal_groups` into a Souffle program.
@@ -26,4 +28,30 @@ std::string LowerGoalsToSouffle(const SymbolTable& symbol_table,
   return "(unimplemented)";
 }
 
+std::string DeclareSouffleDatabase(size_t fact_input, size_t edge_input) {
+  // Souffle builds one index per distinct set of bound columns that the
+  // program searches on, and each index is a full copy of its relation.
+  // Goals almost always bind an edge's source and kind or its kind and
+  // target, and a fact's vname and name or its name and value (as in
+  // `anchor.loc/start 12`). Keeping node facts apart from edges means that
+  // neither relation carries columns that are constant for all its tuples,
+  // so those four patterns stay the only searches and the indexes stay
+  // narrow. Bound columns are listed first so that the default order already
+  // serves the most common pattern.
+  return absl::Substitute(R"(
+      .decl fact(signature:number, corpus:number, root:number, path:number,
+                 language:number, name:number, value:number) btree
+      .input fact(IO=kythe, id=$0)
+
+      .decl edge(source_signature:number, source_corpus:number,
+                 source_root:number, source_path:number,
+                 source_language:number, kind:number,
+                 target_signature:number, target_corpus:number,
+                 target_root:number, target_path:number,
+                 target_language:number, name:number, value:number) btree
+      .input edge(IO=kythe, id=$1)
+  )",
+                          fact_input, edge_input);
+}
+
 }  // namespace kythe::verifier
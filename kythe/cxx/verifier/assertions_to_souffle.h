@@ -29,6 +29,16 @@ namespace kythe::verifier {
 std::string LowerGoalsToSouffle(const SymbolTable& symbol_table,
                                 const std::vector<GoalGroup>& goal_groups);
 
+/// \brief Declares the relations that lowered goals are solved against.
+///
+/// Node facts are read into `fact(vname, name, value)` and edges (with their
+/// ordinal facts) into `edge(source, kind, target, name, value)`, where each
+/// vname is spread over five columns (signature, corpus, root, path and
+/// language) and every column holds a `Symbol`.
+/// \param fact_input the `id` of the `kythe` input stream holding node facts.
+/// \param edge_input the `id` of the `kythe` input stream holding edges.
+std::string DeclareSouffleDatabase(size_t fact_input, size_t edge_input);
+
 }  // namespace kythe::verifier
 
 #endif  // defined(KYTHE_CXX_VERIFIER_ASSERTIONS_TO_SOUFFLE_)
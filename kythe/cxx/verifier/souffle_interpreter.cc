@@ -16,14 +16,31 @@
 
 #include "kythe/cxx/verifier/souffle_interpreter.h"
 
+#include <openssl/sha.h>
+
+#include <algorithm>
 #include <array>
+#include <deque>
 #include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
+#include "Global.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 #include "glog/logging.h"
 #include "interpreter/Engine.h"
+#include "interpreter/ProgInterface.h"
+#include "kythe/cxx/verifier/assertions_to_souffle.h"
 #include "souffle/RamTypes.h"
+#include "souffle/SouffleInterface.h"
 #include "souffle/io/IOSystem.h"
 #include "third_party/souffle/parse_transform.h"
 
@@ -40,26 +57,84 @@ namespace kythe::verifier {
 namespace {
 constexpr std::array<int, 4> kInputData = {1, 2, 2, 3};
 
+/// The arity of the `fact` relation: the vname spread over five columns, the
+/// fact name and the fact value.
+constexpr size_t kFactArity = 7;
+
+/// The arity of the `edge` relation: the source vname, edge kind, target
+/// vname, fact name and fact value, with each vname spread over five columns.
+constexpr size_t kEdgeArity = 13;
+
+/// \brief A relation's contents, stored row-major.
+struct KytheInput {
+  size_t arity;
+  std::vector<souffle::RamDomain> rows;
+};
+
+/// \return the column value for an identifier: its interned symbol, so no
+/// strings are copied into Souffle's own symbol table.
+souffle::RamDomain SymbolColumn(AstNode* node) {
+  return static_cast<souffle::RamDomain>(node->AsIdentifier()->symbol());
+}
+
+/// \brief Appends the five columns for `vname`.
+void AppendVNameColumns(AstNode* vname, std::vector<souffle::RamDomain>* rows) {
+  auto* fields = vname->AsApp()->rhs()->AsTuple();
+  for (size_t i = 0; i < 5; ++i) {
+    rows->push_back(SymbolColumn(fields->element(i)));
+  }
+}
+
+/// \brief The facts in a database, laid out as the `fact` and `edge`
+/// relations declared by `DeclareSouffleDatabase`.
+struct KytheInputs {
+  KytheInput facts;
+  KytheInput edges;
+};
+
+KytheInputs EncodeEntries(const Database& database) {
+  KytheInputs inputs{{kFactArity, {}}, {kEdgeArity, {}}};
+  for (AstNode* fact : database) {
+    auto* tuple = fact->AsApp()->rhs()->AsTuple();
+    // Node facts have an identifier (the empty string) in place of a target.
+    if (tuple->element(2)->AsApp() == nullptr) {
+      AppendVNameColumns(tuple->element(0), &inputs.facts.rows);
+      inputs.facts.rows.push_back(SymbolColumn(tuple->element(3)));
+      inputs.facts.rows.push_back(SymbolColumn(tuple->element(4)));
+    } else {
+      AppendVNameColumns(tuple->element(0), &inputs.edges.rows);
+      inputs.edges.rows.push_back(SymbolColumn(tuple->element(1)));
+      AppendVNameColumns(tuple->element(2), &inputs.edges.rows);
+      inputs.edges.rows.push_back(SymbolColumn(tuple->element(3)));
+      inputs.edges.rows.push_back(SymbolColumn(tuple->element(4)));
+    }
+  }
+  return inputs;
+}
+
 class KytheReadStream : public souffle::ReadStream {
  public:
   explicit KytheReadStream(
       const std::map<std::string, std::string>& rw_operation,
-      souffle::SymbolTable& symbol_table, souffle::RecordTable& record_table)
-      : souffle::ReadStream(rw_operation, symbol_table, record_table) {}
+      souffle::SymbolTable& symbol_table, souffle::RecordTable& record_table,
+      const KytheInput* input)
+      : souffle::ReadStream(rw_operation, symbol_table, record_table),
+        input_(input) {}
 
  protected:
   souffle::Own<souffle::RamDomain[]> readNextTuple() override {
-    if (pos_ >= kInputData.size()) {
+    if (pos_ + input_->arity > input_->rows.size()) {
       return nullptr;
     }
-    auto tuple = std::make_unique<souffle::RamDomain[]>(2);
-    tuple[0] = kInputData[pos_++];
-    tuple[1] = kInputData[pos_++];
+    auto tuple = std::make_unique<souffle::RamDomain[]>(input_->arity);
+    std::copy_n(input_->rows.data() + pos_, input_->arity, tuple.get());
+    pos_ += input_->arity;
     return tuple;
   }
 
  private:
-  int pos_ = 0;
+  const KytheInput* input_;
+  size_t pos_ = 0;
 };
 
 class KytheReadStreamFactory : public souffle::ReadStreamFactory {
@@ -68,14 +143,27 @@ class KytheReadStreamFactory : public souffle::ReadStreamFactory {
       const std::map<std::string, std::string>& rw_operation,
       souffle::SymbolTable& symbol_table,
       souffle::RecordTable& record_table) override {
+    auto input = rw_operation.find("id");
+    CHECK(input != rw_operation.end());
+    size_t input_id;
+    CHECK(absl::SimpleAtoi(input->second, &input_id));
+    CHECK(input_id < inputs_.size());
     return souffle::mk<KytheReadStream>(rw_operation, symbol_table,
-                                        record_table);
+                                        record_table, &inputs_[input_id]);
   }
 
   const std::string& getName() const override {
     static const std::string name = "kythe";
     return name;
   }
+
+  size_t NewInput(KytheInput input) {
+    inputs_.push_back(std::move(input));
+    return inputs_.size() - 1;
+  }
+
+ private:
+  std::deque<KytheInput> inputs_;
 };
 
 class KytheWriteStream : public souffle::WriteStream {
@@ -131,43 +219,125 @@ class KytheWriteStreamFactory : public souffle::WriteStreamFactory {
  private:
   std::vector<std::vector<std::pair<int, int>>> outputs_;
 };
+
+/// \brief Datalog programs that have already been parsed and translated to
+/// RAM, keyed by the SHA-256 digest of their source and whether they were
+/// planned for parallel evaluation. Running the same goals against many
+/// databases then only pays for parsing and translation once.
+class RamProgramCache {
+ public:
+  /// \return the translation unit for `code`, parsing and translating it for
+  /// `jobs` threads the first time it is seen, or null if it doesn't parse.
+  /// The result lives as long as the cache.
+  souffle::ram::TranslationUnit* Get(const std::string& code, size_t jobs)
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    std::array<unsigned char, SHA256_DIGEST_LENGTH> buf;
+    ::SHA256(reinterpret_cast<const unsigned char*>(code.data()), code.size(),
+             buf.data());
+    // Only the choice between serial and parallel plans depends on `jobs`.
+    std::string digest = absl::StrCat(
+        absl::BytesToHexString(absl::string_view(
+            reinterpret_cast<const char*>(buf.data()), buf.size())),
+        jobs == 1 ? "" : "-parallel");
+    absl::MutexLock lock(&mu_);
+    auto found = programs_.find(digest);
+    if (found != programs_.end()) {
+      VLOG(1) << "Reusing Souffle program " << digest;
+      return found->second.get();
+    }
+    auto inserted =
+        programs_.emplace(digest, souffle::ParseTransform(code, jobs));
+    return inserted.first->second.get();
+  }
+
+  /// \return an interpreter for `ram_tu` that evaluates on `jobs` threads.
+  souffle::Own<souffle::interpreter::Engine> NewEngine(
+      souffle::ram::TranslationUnit* ram_tu, size_t jobs)
+      ABSL_LOCKS_EXCLUDED(mu_) {
+    // The engine takes its thread count from Souffle's global configuration,
+    // which translation also uses.
+    absl::MutexLock lock(&mu_);
+    souffle::Global::config().set("jobs", std::to_string(jobs));
+    return souffle::mk<souffle::interpreter::Engine>(*ram_tu);
+  }
+
+  /// \return the process-wide cache.
+  static RamProgramCache* Global() {
+    static RamProgramCache* cache = new RamProgramCache();
+    return cache;
+  }
+
+ private:
+  /// Also guards `souffle::Global::config()`.
+  absl::Mutex mu_;
+  /// Translated programs by digest; failed parses are kept as null so they
+  /// aren't retried.
+  absl::flat_hash_map<std::string,
+                      std::unique_ptr<souffle::ram::TranslationUnit>>
+      programs_ ABSL_GUARDED_BY(mu_);
+};
 }  // anonymous namespace
 
 // TODO(zarko): This is a temporary hack that only demonstrates that the
-// Souffle library is working. It bakes in the inputs and outputs for a
-// simple example program and checks that the interpreter calculates the
-// correct result. `Kythe{Write,Read}StreamFactory` will need to be moved
-// to separate files and updated to accept the Datalog relations that the
-// verifier -> datalog compiler produces.
+// Souffle library is working. The fact database is offered as the `fact`
+// and `edge` relations, but until goals are lowered to Datalog nothing reads
+// them; the result comes from a simple example program with baked-in inputs.
+// `Kythe{Write,Read}StreamFactory` will need to be moved to separate files
+// and updated to accept the relations that the verifier -> datalog compiler
+// produces.
 SouffleResult RunSouffle(
     const SymbolTable& symbol_table, const std::vector<GoalGroup>& goal_groups,
     const Database& database,
     const std::vector<AssertionParser::Inspection>& inspections,
-    std::function<bool(const AssertionParser::Inspection&)> inspect) {
+    std::function<bool(const AssertionParser::Inspection&)> inspect,
+    const SouffleOptions& options) {
   SouffleResult result{};
   auto write_stream_factory = std::make_shared<KytheWriteStreamFactory>();
   size_t output_id = write_stream_factory->NewOutput();
   souffle::IOSystem::getInstance().registerWriteStreamFactory(
       write_stream_factory);
+  auto read_stream_factory = std::make_shared<KytheReadStreamFactory>();
+  size_t example_id = read_stream_factory->NewInput(
+      {2, std::vector<souffle::RamDomain>(kInputData.begin(),
+                                          kInputData.end())});
+  KytheInputs inputs = EncodeEntries(database);
+  size_t fact_id = read_stream_factory->NewInput(std::move(inputs.facts));
+  size_t edge_id = read_stream_factory->NewInput(std::move(inputs.edges));
   souffle::IOSystem::getInstance().registerReadStreamFactory(
-      std::make_shared<KytheReadStreamFactory>());
-  auto ram_tu = souffle::ParseTransform(absl::StrCat(R"(
-        .decl edge(x:number, y:number)
-        .input edge(IO=kythe)
-
-        .decl path(x:number, y:number)
-        .output path(IO=kythe, id=)",
-                                                     output_id, R"()
-
-        path(x, y) :- edge(x, y).
-        path(x, y) :- path(x, z), edge(z, y).
-    )"));
+      read_stream_factory);
+  absl::Time start = absl::Now();
+  auto* ram_tu = RamProgramCache::Global()->Get(
+      absl::StrCat(DeclareSouffleDatabase(fact_id, edge_id), R"(
+        .decl example_edge(x:number, y:number)
+        .input example_edge(IO=kythe, id=)",
+                   example_id, R"()
+
+        .decl example_path(x:number, y:number)
+        .output example_path(IO=kythe, id=)",
+                   output_id, R"()
+
+        example_path(x, y) :- example_edge(x, y).
+        example_path(x, y) :- example_path(x, z), example_edge(z, y).
+    )"),
+      options.jobs);
+  result.translation_time = absl::Now() - start;
   if (ram_tu == nullptr) {
     return result;
   }
-  souffle::Own<souffle::interpreter::Engine> interpreter(
-      souffle::mk<souffle::interpreter::Engine>(*ram_tu));
+  auto interpreter = RamProgramCache::Global()->NewEngine(ram_tu, options.jobs);
+  start = absl::Now();
   interpreter->executeMain();
+  result.evaluation_time = absl::Now() - start;
+  if (options.profile) {
+    souffle::interpreter::ProgInterface program(*interpreter);
+    for (const souffle::Relation* relation : program.getAllRelations()) {
+      // Skip the delta and new relations that semi-naive evaluation adds.
+      if (!absl::StartsWith(relation->getName(), "@")) {
+        result.relation_sizes.push_back(
+            {relation->getName(), relation->size()});
+      }
+    }
+  }
   std::set<std::pair<int, int>> expected = {{1, 2}, {1, 3}, {2, 3}};
   const auto& actual = write_stream_factory->GetOutput(output_id);
   std::set<std::pair<int, int>> actual_set(actual.begin(), actual.end());
@@ -17,13 +17,39 @@
 #ifndef KYTHE_CXX_VERIFIER_SOUFFLE_INTERPRETER_H_
 #define KYTHE_CXX_VERIFIER_SOUFFLE_INTERPRETER_H_
 
+#include <string>
+#include <vector>
+
+#include "absl/time/time.h"
 #include "kythe/cxx/verifier/assertions.h"
 
 namespace kythe::verifier {
+/// \brief The number of tuples in a relation once evaluation finished.
+struct SouffleRelationSize {
+  std::string name;
+  size_t size;
+};
+
 struct SouffleResult {
   bool success;
   size_t highest_goal_reached;
   size_t highest_group_reached;
+  /// Time spent parsing and translating the program; zero if it was cached.
+  absl::Duration translation_time;
+  /// Time spent evaluating the program.
+  absl::Duration evaluation_time;
+  /// The size of each relation in the program, if `SouffleOptions::profile`
+  /// was set.
+  std::vector<SouffleRelationSize> relation_sizes;
+};
+
+struct SouffleOptions {
+  /// The number of threads to evaluate relations on; 0 uses every core.
+  /// Parallel evaluation requires Souffle to be built with OpenMP (see
+  /// `--define=souffle_openmp=1`); otherwise this only changes the plan.
+  size_t jobs = 1;
+  /// Whether to fill in `SouffleResult::relation_sizes`.
+  bool profile = false;
 };
 
 /// \brief Runs the Souffle interpreter on parsed facts and goal groups.
@@ -35,12 +61,14 @@ struct SouffleResult {
 /// \param inspect the inspection callback that will be used against the
 /// provided list of inspections; a false return value stops iterating through
 /// inspection results and fails the solution, while a true result continues.
+/// \param options how to evaluate the program.
 /// \return a `SouffleResult` describing how the run went.
 SouffleResult RunSouffle(
     const SymbolTable& symbol_table, const std::vector<GoalGroup>& goal_groups,
     const Database& database,
     const std::vector<AssertionParser::Inspection>& inspections,
-    std::function<bool(const AssertionParser::Inspection&)> inspect);
+    std::function<bool(const AssertionParser::Inspection&)> inspect,
+    const SouffleOptions& options = {});
 }  // namespace kythe::verifier
 
 #endif  // defined(KYTHE_CXX_VERIFIER_SOUFFLE_INTERPRETER_H_)
@@ -16,6 +16,8 @@
 
 #include "kythe/cxx/verifier/souffle_interpreter.h"
 
+#include <algorithm>
+
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
@@ -30,4 +32,37 @@ TEST(SouffleInterpreterTest, SmokeTest) {
                  [](const AssertionParser::Inspection&) { return true; });
   ASSERT_TRUE(result.success);
 }
+
+TEST(SouffleInterpreterTest, RepeatedRunsReuseProgram) {
+  SymbolTable symbols;
+  Database db;
+  std::vector<GoalGroup> groups;
+  std::vector<AssertionParser::Inspection> inspections;
+  for (int run = 0; run < 3; ++run) {
+    auto result =
+        RunSouffle(symbols, groups, db, inspections,
+                   [](const AssertionParser::Inspection&) { return true; });
+    ASSERT_TRUE(result.success) << "run " << run;
+  }
+}
+
+TEST(SouffleInterpreterTest, ParallelRunReportsRelationSizes) {
+  SymbolTable symbols;
+  Database db;
+  std::vector<GoalGroup> groups;
+  std::vector<AssertionParser::Inspection> inspections;
+  SouffleOptions options;
+  options.jobs = 2;
+  options.profile = true;
+  auto result =
+      RunSouffle(symbols, groups, db, inspections,
+                 [](const AssertionParser::Inspection&) { return true; },
+                 options);
+  ASSERT_TRUE(result.success);
+  auto path = std::find_if(
+      result.relation_sizes.begin(), result.relation_sizes.end(),
+      [](const SouffleRelationSize& r) { return r.name == "example_path"; });
+  ASSERT_NE(path, result.relation_sizes.end());
+  EXPECT_EQ(path->size, 3);
+}
 }  // namespace kythe::verifier
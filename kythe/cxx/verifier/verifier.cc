@@ -21,12 +21,27 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <memory>
+#include <set>
+#include <tuple>
+
+#include "absl/base/call_once.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "assertions.h"
 #include "glog/logging.h"
 #include "google/protobuf/text_format.h"
 #include "kythe/cxx/common/kythe_uri.h"
 #include "kythe/cxx/common/scope_guard.h"
+#include "kythe/cxx/common/thread_pool.h"
 #include "kythe/cxx/verifier/souffle_interpreter.h"
 #include "kythe/proto/common.pb.h"
 #include "kythe/proto/storage.pb.h"
@@ -35,7 +50,7 @@ namespace kythe {
 namespace verifier {
 namespace {
 
-/// \brief The return code from a verifier thunk.
+/// \brief The result of solving a goal, group or program.
 using ThunkRet = size_t;
 /// \brief The operation failed normally.
 static ThunkRet kNoException = {0};
@@ -45,11 +60,16 @@ static ThunkRet kSolved = {1};
 static ThunkRet kInvalidProgram = {2};
 /// \brief The goal group is known to be impossible to solve.
 static ThunkRet kImpossible = {3};
-/// \brief ThunkRets >= kFirstCut should unwind to the frame
-/// establishing that cut without changing assignments.
-static ThunkRet kFirstCut = {4};
 
-typedef const std::function<ThunkRet()>& Thunk;
+/// \brief The outcome of unifying two terms.
+enum class UnifyResult {
+  /// The terms unified.
+  kUnified,
+  /// The terms can't be unified.
+  kFailed,
+  /// Unifying the terms would bind an `EVar` to a term containing itself.
+  kCycle
+};
 
 static std::string* kDefaultDatabase = new std::string("builtin");
 static std::string* kStandardIn = new std::string("-");
@@ -120,40 +140,6 @@ static bool EncodedVNameOrIdentEqualTo(AstNode* a, AstNode* b) {
   }
 }
 
-/// \brief Sort entries such that those that set fact values are adjacent.
-static bool EncodedFactLessThan(AstNode* a, AstNode* b) {
-  Tuple* ta = a->AsApp()->rhs()->AsTuple();
-  Tuple* tb = b->AsApp()->rhs()->AsTuple();
-  if (EncodedVNameOrIdentLessThan(ta->element(0), tb->element(0))) {
-    return true;
-  }
-  if (!EncodedVNameOrIdentEqualTo(ta->element(0), tb->element(0))) {
-    return false;
-  }
-  if (EncodedIdentLessThan(ta->element(1), tb->element(1))) {
-    return true;
-  }
-  if (!EncodedIdentEqualTo(ta->element(1), tb->element(1))) {
-    return false;
-  }
-  if (EncodedVNameOrIdentLessThan(ta->element(2), tb->element(2))) {
-    return true;
-  }
-  if (!EncodedVNameOrIdentEqualTo(ta->element(2), tb->element(2))) {
-    return false;
-  }
-  if (EncodedIdentLessThan(ta->element(3), tb->element(3))) {
-    return true;
-  }
-  if (!EncodedIdentEqualTo(ta->element(3), tb->element(3))) {
-    return false;
-  }
-  if (EncodedIdentLessThan(ta->element(4), tb->element(4))) {
-    return true;
-  }
-  return false;
-}
-
 static AstNode* DerefEVar(AstNode* node) {
   while (node) {
     if (auto* evar = node->AsEVar()) {
@@ -169,19 +155,58 @@ static Identifier* SafeAsIdentifier(AstNode* node) {
   return node == nullptr ? nullptr : node->AsIdentifier();
 }
 
+/// \brief The order in which a fact index compares the elements of fact
+/// tuples, most significant first. Elements are numbered as they appear in
+/// the tuple: (source, edge kind, target, fact name, fact value).
+using FactOrder = std::array<size_t, 5>;
+
+/// \brief The ways in which the solver may have the database sorted.
+enum class FactIndex {
+  /// Collates as `(edge_kind, fact_name, fact_value, source, target)`.
+  /// In practice most unification happens between tuples with the first three
+  /// fields present; then the source missing some of the time; then the
+  /// target missing most of the time. This is the order of the database
+  /// itself.
+  kByValue,
+  /// Collates as `(edge_kind, fact_name, fact_value, target, source)`, for
+  /// edges whose target is known but whose source isn't.
+  kByTarget,
+  /// Collates as `(edge_kind, fact_name, source, target, fact_value)`, for
+  /// facts whose source is known but whose value isn't.
+  kBySource,
+};
+constexpr size_t kFactIndexCount = 3;
+
+static const FactOrder& OrderFor(FactIndex index) {
+  static constexpr FactOrder kOrders[kFactIndexCount] = {
+      {1, 3, 4, 0, 2}, {1, 3, 4, 2, 0}, {1, 3, 0, 2, 4}};
+  return kOrders[static_cast<size_t>(index)];
+}
+
+/// \return true if element `i` of a fact tuple may be a vname.
+static bool IsVNameElement(size_t i) { return i == 0 || i == 2; }
+
+/// \brief The order `PrepareDatabase` checks facts in, which puts all the facts
+/// about a node next to one another.
+constexpr FactOrder kFactsByNodeOrder = {0, 1, 2, 3, 4};
+
+/// \brief The parts of a goal's fact tuple that are already bound.
 struct AtomFactKey {
-  Identifier* edge_kind;
-  Identifier* fact_name;
-  Identifier* fact_value;
-  Identifier* source_vname[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
-  Identifier* target_vname[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+  /// Bound identifiers, indexed by tuple element; only the edge kind, fact
+  /// name and fact value are used.
+  Identifier* ident[5] = {nullptr, nullptr, nullptr, nullptr, nullptr};
+  /// Bound vname fields, indexed by tuple element; only the source and
+  /// target are used.
+  Identifier* vname[5][5] = {};
   // fact_tuple is expected to be a full tuple from a Fact head
-  AtomFactKey(AstNode* vname_head, Tuple* fact_tuple)
-      : edge_kind(SafeAsIdentifier(DerefEVar(fact_tuple->element(1)))),
-        fact_name(SafeAsIdentifier(DerefEVar(fact_tuple->element(3)))),
-        fact_value(SafeAsIdentifier(DerefEVar(fact_tuple->element(4)))) {
-    InitVNameFields(vname_head, fact_tuple->element(0), &source_vname[0]);
-    InitVNameFields(vname_head, fact_tuple->element(2), &target_vname[0]);
+  AtomFactKey(AstNode* vname_head, Tuple* fact_tuple) {
+    for (size_t i = 0; i < 5; ++i) {
+      if (IsVNameElement(i)) {
+        InitVNameFields(vname_head, fact_tuple->element(i), &vname[i][0]);
+      } else {
+        ident[i] = SafeAsIdentifier(DerefEVar(fact_tuple->element(i)));
+      }
+    }
   }
   void InitVNameFields(AstNode* vname_head, AstNode* maybe_vname,
                        Identifier** out) {
@@ -207,61 +232,142 @@ struct AtomFactKey {
       }
     }
   }
+  /// \return how much of the key is bound in `order`: two points for each
+  /// leading element that is fully bound and one if the next is partly bound.
+  size_t BoundPrefixScore(const FactOrder& order) const {
+    size_t score = 0;
+    for (size_t i : order) {
+      if (!IsVNameElement(i)) {
+        if (ident[i] == nullptr) {
+          break;
+        }
+        score += 2;
+        continue;
+      }
+      size_t fields = 0;
+      while (fields < 5 && vname[i][fields] != nullptr) {
+        ++fields;
+      }
+      if (fields < 5) {
+        score += fields > 0 ? 1 : 0;
+        break;
+      }
+      score += 2;
+    }
+    return score;
+  }
+};
+
+/// \brief Ground facts laid out column by column, so that looking them up
+/// reads packed symbols instead of chasing `AstNode` pointers.
+///
+/// There is one column for each of the edge kind, fact name and fact value
+/// and one for each of the five fields of the source and target vnames. A
+/// source or target that is an identifier rather than a vname is stored in
+/// the column for its first field and marked in the row's tag.
+class FactColumns {
+ public:
+  FactColumns() = default;
+
+  /// \brief Lays out `facts`, which must be full fact tuples.
+  explicit FactColumns(const Database& facts) {
+    for (auto& column : columns_) {
+      column.reserve(facts.size());
+    }
+    tags_.reserve(facts.size());
+    for (AstNode* fact : facts) {
+      Tuple* tuple = fact->AsApp()->rhs()->AsTuple();
+      uint8_t tag = 0;
+      for (size_t element = 0; element < 5; ++element) {
+        AstNode* node = tuple->element(element);
+        if (!IsVNameElement(element)) {
+          Append(element, 0, node);
+        } else if (App* app = node->AsApp()) {
+          Tuple* fields = app->rhs()->AsTuple();
+          for (size_t field = 0; field < 5; ++field) {
+            Append(element, field, fields->element(field));
+          }
+        } else {
+          tag |= element == 0 ? kSourceIsIdent : kTargetIsIdent;
+          for (size_t field = 0; field < 5; ++field) {
+            Append(element, field, node);
+          }
+        }
+      }
+      tags_.push_back(tag);
+    }
+  }
+
+  size_t size() const { return tags_.size(); }
+
+  /// \return the symbol for `field` of tuple element `element` in `row`.
+  /// Only vname elements have more than one field.
+  Symbol field(size_t row, size_t element, size_t field) const {
+    return columns_[Column(element, field)][row];
+  }
+
+  /// \return true if vname element `element` of `row` is an identifier.
+  bool is_ident(size_t row, size_t element) const {
+    return tags_[row] & (element == 0 ? kSourceIsIdent : kTargetIsIdent);
+  }
+
+ private:
+  static constexpr uint8_t kSourceIsIdent = 1;
+  static constexpr uint8_t kTargetIsIdent = 2;
+
+  static size_t Column(size_t element, size_t field) {
+    static constexpr size_t kFirstColumn[5] = {0, 5, 6, 11, 12};
+    return kFirstColumn[element] + field;
+  }
+
+  void Append(size_t element, size_t field, AstNode* node) {
+    columns_[Column(element, field)].push_back(node->AsIdentifier()->symbol());
+  }
+
+  std::array<std::vector<Symbol>, 13> columns_;
+  std::vector<uint8_t> tags_;
 };
 
 enum class Order { LT, EQ, GT };
 
+/// \return how `a` compares with `b`.
+static Order CompareSymbols(Symbol a, Symbol b) {
+  return a < b ? Order::LT : (a == b ? Order::EQ : Order::GT);
+}
+
 // How we order incomplete keys depends on whether we're looking for
-// an upper or lower bound. See below for details. The node passed in
-// must be an application of Fact to a full fact tuple.
-static Order CompareFactWithKey(Order incomplete, AstNode* a, AtomFactKey* k) {
-  Tuple* ta = a->AsApp()->rhs()->AsTuple();
-  if (k->edge_kind == nullptr) {
-    return incomplete;
-  } else if (EncodedIdentLessThan(ta->element(1), k->edge_kind)) {
-    return Order::LT;
-  } else if (!EncodedIdentEqualTo(ta->element(1), k->edge_kind)) {
-    return Order::GT;
-  }
-  if (k->fact_name == nullptr) {
-    return incomplete;
-  } else if (EncodedIdentLessThan(ta->element(3), k->fact_name)) {
-    return Order::LT;
-  } else if (!EncodedIdentEqualTo(ta->element(3), k->fact_name)) {
-    return Order::GT;
-  }
-  if (k->fact_value == nullptr) {
-    return incomplete;
-  } else if (EncodedIdentLessThan(ta->element(4), k->fact_value)) {
-    return Order::LT;
-  } else if (!EncodedIdentEqualTo(ta->element(4), k->fact_value)) {
-    return Order::GT;
-  }
-  auto vname_compare = [incomplete](Tuple* va, Identifier* tuple[5]) {
-    for (size_t i = 0; i < 5; ++i) {
-      if (tuple[i] == nullptr) {
+// an upper or lower bound. See below for details.
+static Order CompareFactWithKey(const FactOrder& order, Order incomplete,
+                                const FactColumns& columns, size_t row,
+                                AtomFactKey* k) {
+  for (size_t i : order) {
+    if (!IsVNameElement(i)) {
+      if (k->ident[i] == nullptr) {
         return incomplete;
       }
-      if (EncodedIdentLessThan(va->element(i), tuple[i])) {
-        return Order::LT;
-      }
-      if (!EncodedIdentEqualTo(va->element(i), tuple[i])) {
-        return Order::GT;
+      Order field_order =
+          CompareSymbols(columns.field(row, i, 0), k->ident[i]->symbol());
+      if (field_order != Order::EQ) {
+        return field_order;
       }
+      continue;
     }
-    return Order::EQ;
-  };
-  if (Tuple* vs = ta->element(0)->AsApp()->rhs()->AsTuple()) {
-    auto ord = vname_compare(vs, k->source_vname);
-    if (ord != Order::EQ) {
-      return ord;
+    Identifier* const* key_vname = k->vname[i];
+    if (key_vname[0] == nullptr) {
+      return incomplete;
     }
-  }
-  if (auto* app = ta->element(2)->AsApp()) {
-    if (Tuple* vt = app->rhs()->AsTuple()) {
-      auto ord = vname_compare(vt, k->target_vname);
-      if (ord != Order::EQ) {
-        return ord;
+    if (columns.is_ident(row, i)) {
+      // Identifiers are ordered after vnames and can't match one.
+      return Order::GT;
+    }
+    for (size_t f = 0; f < 5; ++f) {
+      if (key_vname[f] == nullptr) {
+        return incomplete;
+      }
+      Order field_order =
+          CompareSymbols(columns.field(row, i, f), key_vname[f]->symbol());
+      if (field_order != Order::EQ) {
+        return field_order;
       }
     }
   }
@@ -272,58 +378,243 @@ static Order CompareFactWithKey(Order incomplete, AstNode* a, AtomFactKey* k) {
 // (0,0,2,3) (0,1,2,3) (0,1,2,4) (1,1,2,4)
 //          ^---  (0,1,_,_)  ---^
 
-static bool FastLookupKeyLessThanFact(AtomFactKey* k, AstNode* a) {
-  // This is used to find upper bounds, so keys with incomplete suffixes should
-  // be ordered after all facts that share their complete prefixes.
-  return CompareFactWithKey(Order::LT, a, k) == Order::GT;
-}
+/// \brief Finds the rows of facts sorted in `order` that may match a key.
+struct FastLookup {
+  const FactOrder& order;
+  const FactColumns& columns;
+
+  /// \return the first row that isn't ordered before `k`.
+  size_t LowerBound(AtomFactKey* k) const {
+    // Keys with incomplete suffixes should be ordered after facts with lower
+    // prefixes but before facts with complete suffixes.
+    return PartitionPoint(0, [this, k](size_t row) {
+      return CompareFactWithKey(order, Order::GT, columns, row, k) ==
+             Order::LT;
+    });
+  }
 
-static bool FastLookupFactLessThanKey(AstNode* a, AtomFactKey* k) {
-  // This is used to find lower bounds, so keys with incomplete suffixes should
-  // be ordered after facts with lower prefixes but before facts with complete
-  // suffixes.
-  return CompareFactWithKey(Order::GT, a, k) == Order::LT;
-}
+  /// \return the first row at or after `begin` that is ordered after `k`.
+  size_t UpperBound(size_t begin, AtomFactKey* k) const {
+    // Keys with incomplete suffixes should be ordered after all facts that
+    // share their complete prefixes.
+    return PartitionPoint(begin, [this, k](size_t row) {
+      return CompareFactWithKey(order, Order::LT, columns, row, k) !=
+             Order::GT;
+    });
+  }
 
-//  Sort entries in lexicographic order, collating as:
-// `(edge_kind, fact_name, fact_value, source_node, target_node)`.
-// In practice most unification was happening between tuples
-// with the first three fields present; then source_node
-// missing some of the time; then target_node missing most of
-// the time.
-static bool FastLookupFactLessThan(AstNode* a, AstNode* b) {
-  Tuple* ta = a->AsApp()->rhs()->AsTuple();
-  Tuple* tb = b->AsApp()->rhs()->AsTuple();
-  if (EncodedIdentLessThan(ta->element(1), tb->element(1))) {
-    return true;
+  /// \return the first row at or after `begin` for which `before` is false,
+  /// given that it is true for a prefix of the rows.
+  template <typename Pred>
+  size_t PartitionPoint(size_t begin, Pred before) const {
+    size_t count = columns.size() - begin;
+    while (count > 0) {
+      size_t step = count / 2;
+      if (before(begin + step)) {
+        begin += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return begin;
   }
-  if (!EncodedIdentEqualTo(ta->element(1), tb->element(1))) {
-    return false;
+};
+
+/// Databases smaller than this are always sorted on one thread.
+constexpr size_t kMinParallelSortSize = 1 << 16;
+
+/// \brief Sorts `items` by sorting one slice per thread in `pool` (if it's
+/// non-null) with `sort_slice`, then merging the slices pairwise by `less`.
+template <typename T, typename SortSlice, typename Less>
+static void ParallelSort(std::vector<T>* items, SortSlice sort_slice,
+                         Less less, ThreadPool* pool) {
+  T* begin = items->data();
+  if (pool == nullptr || pool->size() < 2 ||
+      items->size() < kMinParallelSortSize) {
+    sort_slice(begin, begin + items->size());
+    return;
   }
-  if (EncodedIdentLessThan(ta->element(3), tb->element(3))) {
-    return true;
+  size_t slices = pool->size();
+  std::vector<size_t> bounds(slices + 1);
+  for (size_t i = 0; i <= slices; ++i) {
+    bounds[i] = items->size() * i / slices;
   }
-  if (!EncodedIdentEqualTo(ta->element(3), tb->element(3))) {
-    return false;
+  for (size_t i = 0; i < slices; ++i) {
+    pool->Schedule([begin, &bounds, &sort_slice, i]() {
+      sort_slice(begin + bounds[i], begin + bounds[i + 1]);
+    });
   }
-  if (EncodedIdentLessThan(ta->element(4), tb->element(4))) {
-    return true;
+  pool->Wait();
+  for (size_t width = 1; width < slices; width *= 2) {
+    for (size_t i = 0; i + width < slices; i += 2 * width) {
+      size_t end = bounds[std::min(i + 2 * width, slices)];
+      pool->Schedule([begin, &bounds, &less, i, width, end]() {
+        std::inplace_merge(begin + bounds[i], begin + bounds[i + width],
+                           begin + end, less);
+      });
+    }
+    pool->Wait();
   }
-  if (!EncodedIdentEqualTo(ta->element(4), tb->element(4))) {
-    return false;
+}
+
+/// \brief A fact along with the columns it sorts by, most significant first.
+/// Identifiers are represented by their symbols and vnames by their rank
+/// among all of the database's vnames; both are dense, so they fit.
+struct FactRow {
+  std::array<uint32_t, 5> key;
+  AstNode* fact;
+};
+
+static bool FactRowLessThan(const FactRow& a, const FactRow& b) {
+  return a.key < b.key;
+}
+
+/// The number of bits in each radix sort digit.
+constexpr size_t kRadixBits = 11;
+constexpr uint32_t kRadixMask = (1 << kRadixBits) - 1;
+
+/// \brief Radix sorts the rows in [begin, end) by their keys, using as much
+/// of `scratch` as there are rows. Only the digits below `column_max` are
+/// considered.
+static void RadixSortRows(FactRow* begin, FactRow* end, FactRow* scratch,
+                          const std::array<uint32_t, 5>& column_max) {
+  size_t size = end - begin;
+  if (size < 2) {
+    return;
   }
-  if (EncodedVNameOrIdentLessThan(ta->element(0), tb->element(0))) {
-    return true;
+  FactRow* from = begin;
+  FactRow* to = scratch;
+  std::vector<size_t> counts(kRadixMask + 1);
+  for (size_t column = column_max.size(); column-- > 0;) {
+    for (size_t shift = 0; shift < 32 && (column_max[column] >> shift) != 0;
+         shift += kRadixBits) {
+      std::fill(counts.begin(), counts.end(), 0);
+      for (FactRow* row = from; row != from + size; ++row) {
+        ++counts[(row->key[column] >> shift) & kRadixMask];
+      }
+      if (counts[(from->key[column] >> shift) & kRadixMask] == size) {
+        // Every row has the same digit here.
+        continue;
+      }
+      size_t total = 0;
+      for (auto& count : counts) {
+        size_t digit_count = count;
+        count = total;
+        total += digit_count;
+      }
+      for (FactRow* row = from; row != from + size; ++row) {
+        to[counts[(row->key[column] >> shift) & kRadixMask]++] = *row;
+      }
+      std::swap(from, to);
+    }
   }
-  if (!EncodedVNameOrIdentEqualTo(ta->element(0), tb->element(0))) {
-    return false;
+  if (from != begin) {
+    std::copy(from, from + size, begin);
   }
-  if (EncodedVNameOrIdentLessThan(ta->element(2), tb->element(2))) {
-    return true;
+}
+
+/// \brief Sorts `facts` by the elements of their tuples in `order`.
+///
+/// Rather than comparing facts node by node, this ranks the distinct vnames
+/// once, lays each fact out as a row of fixed-width keys and radix sorts the
+/// rows, on the threads in `pool` if it's non-null.
+static void SortFactsInOrder(Database* facts, const FactOrder& order,
+                             ThreadPool* pool) {
+  absl::flat_hash_map<AstNode*, uint32_t> ranks;
+  std::vector<AstNode*> vnames;
+  for (AstNode* fact : *facts) {
+    Tuple* tuple = fact->AsApp()->rhs()->AsTuple();
+    for (size_t i : {0, 2}) {
+      if (ranks.emplace(tuple->element(i), 0).second) {
+        vnames.push_back(tuple->element(i));
+      }
+    }
+  }
+  std::sort(vnames.begin(), vnames.end(), EncodedVNameOrIdentLessThan);
+  uint32_t rank = 0;
+  for (size_t i = 0; i < vnames.size(); ++i) {
+    if (i > 0 && !EncodedVNameOrIdentEqualTo(vnames[i - 1], vnames[i])) {
+      ++rank;
+    }
+    ranks[vnames[i]] = rank;
+  }
+
+  std::vector<FactRow> rows(facts->size());
+  std::array<uint32_t, 5> column_max = {};
+  for (size_t f = 0; f < facts->size(); ++f) {
+    FactRow& row = rows[f];
+    row.fact = (*facts)[f];
+    Tuple* tuple = row.fact->AsApp()->rhs()->AsTuple();
+    for (size_t column = 0; column < order.size(); ++column) {
+      AstNode* element = tuple->element(order[column]);
+      row.key[column] =
+          IsVNameElement(order[column])
+              ? ranks.find(element)->second
+              : static_cast<uint32_t>(element->AsIdentifier()->symbol());
+      column_max[column] = std::max(column_max[column], row.key[column]);
+    }
+  }
+  std::vector<FactRow> scratch(rows.size());
+  FactRow* rows_begin = rows.data();
+  ParallelSort(
+      &rows,
+      [rows_begin, &scratch, &column_max](FactRow* begin, FactRow* end) {
+        RadixSortRows(begin, end, scratch.data() + (begin - rows_begin),
+                      column_max);
+      },
+      FactRowLessThan, pool);
+  for (size_t f = 0; f < facts->size(); ++f) {
+    (*facts)[f] = rows[f].fact;
   }
-  return false;
 }
 
+/// \brief A view of the fact database sorted for one `FactIndex`.
+struct SortedFacts {
+  /// The facts themselves, which goals are unified against.
+  const Database* facts = nullptr;
+  /// The same facts as columns of symbols, which goals are looked up in.
+  FactColumns columns;
+};
+
+/// \brief The fact database along with copies of it sorted for each
+/// secondary `FactIndex`, built on demand. Safe to share between solvers
+/// running on different threads.
+class FactIndexes {
+ public:
+  explicit FactIndexes(const Database& database) : database_(database) {}
+  FactIndexes(const FactIndexes&) = delete;
+  FactIndexes& operator=(const FactIndexes&) = delete;
+
+  /// \return the database itself, sorted for `FactIndex::kByValue`.
+  const Database& database() const { return database_; }
+
+  /// \return the facts sorted for `index`, sorting a copy of the database
+  /// the first time a secondary index is asked for and laying out the
+  /// columns of any index the first time it is asked for.
+  const SortedFacts& Get(FactIndex index) {
+    size_t slot = static_cast<size_t>(index);
+    absl::call_once(built_[slot], [this, index, slot]() {
+      if (index == FactIndex::kByValue) {
+        indexes_[slot].facts = &database_;
+      } else {
+        copies_[slot] = database_;
+        SortFactsInOrder(&copies_[slot], OrderFor(index), nullptr);
+        indexes_[slot].facts = &copies_[slot];
+      }
+      indexes_[slot].columns = FactColumns(*indexes_[slot].facts);
+    });
+    return indexes_[slot];
+  }
+
+ private:
+  const Database& database_;
+  std::array<absl::once_flag, kFactIndexCount> built_;
+  /// Sorted copies of the database for the secondary indexes.
+  std::array<Database, kFactIndexCount> copies_;
+  std::array<SortedFacts, kFactIndexCount> indexes_;
+};
+
 // The Solver acts in a closed world: any universal quantification can be
 // exhaustively tested against database facts.
 // Based on _A Semi-Functional Implementation of a Higher-Order Logic
@@ -336,55 +627,90 @@ class Solver {
  public:
   using Inspection = AssertionParser::Inspection;
 
-  Solver(Verifier* context, Database& database,
-         std::multimap<std::pair<size_t, size_t>, AstNode*>& anchors,
-         std::function<bool(Verifier*, const Inspection&)>& inspect)
+  /// \brief A goal being solved along with the alternatives still to try.
+  struct ChoicePoint {
+    enum class Kind {
+      /// Unify `goal` with each of `facts[next, end)`.
+      kFacts,
+      /// Unify the right side of `equals` with the VName of each of
+      /// `anchors[next, end)`.
+      kAnchors,
+      /// Unify the two sides of `equals` once.
+      kEquals
+    };
+    Kind kind = Kind::kFacts;
+    AstNode* goal = nullptr;
+    Tuple* equals = nullptr;
+    Database::const_iterator facts;
+    AnchorIndex::const_iterator anchors;
+    size_t next = 0;
+    size_t end = 0;
+    /// The size of the trail before any alternative was tried.
+    size_t trail_mark = 0;
+    /// The position in `plan_` whose goal was swapped into this depth.
+    size_t planned_from = 0;
+  };
+
+  Solver(Verifier* context, FactIndexes& facts,
+         const AnchorIndex& anchors,
+         std::function<bool(Verifier*, const Inspection&)>& inspect,
+         bool plan_goals)
       : context_(*context),
-        database_(database),
+        facts_(facts),
+        database_(facts.database()),
         anchors_(anchors),
-        inspect_(inspect) {}
-
-  ThunkRet UnifyTuple(Tuple* st, Tuple* tt, size_t ofs, size_t max,
-                      ThunkRet cut, Thunk f) {
-    if (ofs == max) return f();
-    return Unify(st->element(ofs), tt->element(ofs), cut,
-                 [this, st, tt, ofs, max, cut, &f]() {
-                   return UnifyTuple(st, tt, ofs + 1, max, cut, f);
-                 });
-  }
-
-  ThunkRet Unify(AstNode* s, AstNode* t, ThunkRet cut, Thunk f) {
-    if (EVar* e = s->AsEVar()) {
-      return UnifyEVar(e, t, cut, f);
-    } else if (EVar* e = t->AsEVar()) {
-      return UnifyEVar(e, s, cut, f);
-    } else if (Identifier* si = s->AsIdentifier()) {
-      if (Identifier* ti = t->AsIdentifier()) {
-        if (si->symbol() == ti->symbol()) {
-          return f();
+        inspect_(inspect),
+        plan_goals_(plan_goals) {}
+
+  /// \brief Unifies `s` with `t`, recording every `EVar` it binds on the
+  /// trail so that the bindings can be undone with `UndoTo`.
+  /// \return whether `s` and `t` unified. If they didn't, some of the
+  /// bindings made along the way may still need to be undone.
+  UnifyResult Unify(AstNode* s, AstNode* t) {
+    unify_stack_.clear();
+    unify_stack_.emplace_back(s, t);
+    while (!unify_stack_.empty()) {
+      std::tie(s, t) = unify_stack_.back();
+      unify_stack_.pop_back();
+      if (EVar* e = s->AsEVar()) {
+        if (!UnifyEVar(e, t)) {
+          return UnifyResult::kCycle;
         }
-      }
-    } else if (App* sa = s->AsApp()) {
-      if (App* ta = t->AsApp()) {
-        return Unify(sa->lhs(), ta->lhs(), cut, [this, sa, ta, cut, &f]() {
-          return Unify(sa->rhs(), ta->rhs(), cut, f);
-        });
-      }
-    } else if (Tuple* st = s->AsTuple()) {
-      if (Tuple* tt = t->AsTuple()) {
-        if (st->size() != tt->size()) {
-          return kNoException;
+      } else if (EVar* e = t->AsEVar()) {
+        if (!UnifyEVar(e, s)) {
+          return UnifyResult::kCycle;
         }
-        return UnifyTuple(st, tt, 0, st->size(), cut, f);
-      }
-    } else if (Range* sr = s->AsRange()) {
-      if (Range* tr = t->AsRange()) {
-        if (*sr == *tr) {
-          return f();
+      } else if (Identifier* si = s->AsIdentifier()) {
+        Identifier* ti = t->AsIdentifier();
+        if (ti == nullptr || si->symbol() != ti->symbol()) {
+          return UnifyResult::kFailed;
+        }
+      } else if (App* sa = s->AsApp()) {
+        App* ta = t->AsApp();
+        if (ta == nullptr) {
+          return UnifyResult::kFailed;
+        }
+        // The stack is LIFO, so this unifies the heads first.
+        unify_stack_.emplace_back(sa->rhs(), ta->rhs());
+        unify_stack_.emplace_back(sa->lhs(), ta->lhs());
+      } else if (Tuple* st = s->AsTuple()) {
+        Tuple* tt = t->AsTuple();
+        if (tt == nullptr || st->size() != tt->size()) {
+          return UnifyResult::kFailed;
+        }
+        for (size_t i = st->size(); i-- > 0;) {
+          unify_stack_.emplace_back(st->element(i), tt->element(i));
+        }
+      } else if (Range* sr = s->AsRange()) {
+        Range* tr = t->AsRange();
+        if (tr == nullptr || *sr != *tr) {
+          return UnifyResult::kFailed;
         }
+      } else {
+        return UnifyResult::kFailed;
       }
     }
-    return kNoException;
+    return UnifyResult::kUnified;
   }
 
   bool Occurs(EVar* e, AstNode* t) {
@@ -408,12 +734,16 @@ class Solver {
     return true;
   }
 
-  ThunkRet UnifyEVar(EVar* e, AstNode* t, ThunkRet cut, Thunk f) {
+  /// \brief Unifies the unbound-or-bound `e` with `t`, binding `e` if it is
+  /// unbound and queueing its value against `t` if it isn't.
+  /// \return false if binding `e` would make a cycle.
+  bool UnifyEVar(EVar* e, AstNode* t) {
     if (AstNode* ec = e->current()) {
-      return Unify(ec, t, cut, f);
+      unify_stack_.emplace_back(ec, t);
+      return true;
     }
     if (t->AsEVar() == e) {
-      return f();
+      return true;
     }
     if (Occurs(e, t)) {
       FileHandlePrettyPrinter printer(stderr);
@@ -422,46 +752,19 @@ class Solver {
       printer.Print(" while unifying it with ");
       t->Dump(*context_.symbol_table(), &printer);
       printer.Print(".\n");
-      return kInvalidProgram;
+      return false;
     }
     e->set_current(t);
-    ThunkRet f_ret = f();
-    if (f_ret != cut) {
-      e->set_current(nullptr);
-    }
-    return f_ret;
+    trail_.push_back(e);
+    return true;
   }
 
-  ThunkRet MatchAtomVersusDatabase(AstNode* atom, ThunkRet cut, Thunk f) {
-    if (auto* app = atom->AsApp()) {
-      if (app->lhs() == context_.fact_id()) {
-        if (auto* tuple = app->rhs()->AsTuple()) {
-          if (tuple->size() == 5) {
-            AtomFactKey key(context_.vname_id(), tuple);
-            // Make use of the fast lookup sort order.
-            auto begin = std::lower_bound(database_.begin(), database_.end(),
-                                          &key, FastLookupFactLessThanKey);
-            auto end = std::upper_bound(database_.begin(), database_.end(),
-                                        &key, FastLookupKeyLessThanFact);
-            for (auto i = begin; i != end; ++i) {
-              ThunkRet exc = Unify(atom, *i, cut, f);
-              if (exc != kNoException) {
-                return exc;
-              }
-            }
-            return kNoException;
-          }
-        }
-      }
-    }
-    // Not enough information to filter by.
-    for (size_t fact = 0; fact < database_.size(); ++fact) {
-      ThunkRet exc = Unify(atom, database_[fact], cut, f);
-      if (exc != kNoException) {
-        return exc;
-      }
+  /// \brief Unbinds the `EVar`s bound since the trail had `mark` entries.
+  void UndoTo(size_t mark) {
+    while (trail_.size() > mark) {
+      trail_.back()->set_current(nullptr);
+      trail_.pop_back();
     }
-    return kNoException;
   }
 
   /// \brief If `atom` has the syntactic form =(a, b), returns the tuple (a, b).
@@ -481,53 +784,211 @@ class Solver {
     return nullptr;
   }
 
-  ThunkRet MatchAtom(AstNode* atom, AstNode* program, ThunkRet cut, Thunk f) {
+  /// \brief Sets up `choice` with the alternatives for solving `goal`.
+  /// \return kNoException, or kImpossible if `goal` can never succeed, or
+  /// kInvalidProgram.
+  ThunkRet InitChoicePoint(AstNode* goal, ChoicePoint* choice) {
+    choice->goal = goal;
+    choice->next = 0;
+    choice->trail_mark = trail_.size();
+    // We only have atomic goals right now.
+    App* app = goal->AsApp();
+    if (app == nullptr) {
+      // TODO(zarko): Replace with a configurable PrettyPrinter.
+      LOG(ERROR) << "Invalid AstNode in goal-expression.";
+      return kInvalidProgram;
+    }
     // We only have the database and eq-constraints right now.
-    assert(program == nullptr);
-    if (auto* tu = MatchEqualsArgs(atom)) {
+    if (auto* tu = MatchEqualsArgs(goal)) {
+      choice->equals = tu;
       if (Range* r = tu->element(0)->AsRange()) {
-        auto anchors =
-            anchors_.equal_range(std::make_pair(r->begin(), r->end()));
+        choice->kind = ChoicePoint::Kind::kAnchors;
+        auto anchors = anchors_.Find(r->begin(), r->end());
         if (anchors.first == anchors.second) {
           // There's no anchor with this range in the database.
           // This goal can therefore never succeed.
           return kImpossible;
         }
-        for (auto anchor = anchors.first; anchor != anchors.second; ++anchor) {
-          ThunkRet unify_ret = Unify(anchor->second, tu->element(1), cut, f);
-          if (unify_ret != kNoException) {
-            return unify_ret;
-          }
-        }
+        choice->anchors = anchors.first;
+        choice->end = anchors.second - anchors.first;
         return kNoException;
       }
       // =(a, b) succeeds if unify(a, b) succeeds.
-      return Unify(tu->element(0), tu->element(1), cut, f);
+      choice->kind = ChoicePoint::Kind::kEquals;
+      choice->end = 1;
+      return kNoException;
+    }
+    choice->kind = ChoicePoint::Kind::kFacts;
+    if (app->lhs() == context_.fact_id()) {
+      if (auto* tuple = app->rhs()->AsTuple()) {
+        if (tuple->size() == 5) {
+          AtomFactKey key(context_.vname_id(), tuple);
+          auto facts = FindFacts(&key);
+          choice->facts = facts.first;
+          choice->end = facts.second - facts.first;
+          return kNoException;
+        }
+      }
     }
-    return MatchAtomVersusDatabase(atom, cut, f);
+    // Not enough information to filter by.
+    choice->facts = database_.begin();
+    choice->end = database_.size();
+    return kNoException;
   }
 
-  ThunkRet SolveGoal(AstNode* goal, ThunkRet cut, Thunk f) {
-    // We only have atomic goals right now.
-    if (App* a = goal->AsApp()) {
-      return MatchAtom(goal, nullptr, cut, f);
-    } else {
-      // TODO(zarko): Replace with a configurable PrettyPrinter.
-      LOG(ERROR) << "Invalid AstNode in goal-expression.";
-      return kInvalidProgram;
+  /// \brief Tries the alternatives left in `choice` in order until one
+  /// unifies, leaving its bindings in place.
+  /// \return kSolved if one unified, kNoException if none did, or
+  /// kInvalidProgram.
+  ThunkRet TryNextAlternative(ChoicePoint* choice) {
+    while (choice->next < choice->end) {
+      size_t i = choice->next++;
+      UnifyResult result = UnifyResult::kFailed;
+      switch (choice->kind) {
+        case ChoicePoint::Kind::kFacts:
+          result = Unify(choice->goal, choice->facts[i]);
+          break;
+        case ChoicePoint::Kind::kAnchors:
+          result = Unify(choice->anchors[i].second, choice->equals->element(1));
+          break;
+        case ChoicePoint::Kind::kEquals:
+          result =
+              Unify(choice->equals->element(0), choice->equals->element(1));
+          break;
+      }
+      if (result == UnifyResult::kUnified) {
+        return kSolved;
+      }
+      UndoTo(choice->trail_mark);
+      if (result == UnifyResult::kCycle) {
+        return kInvalidProgram;
+      }
     }
+    return kNoException;
   }
 
-  ThunkRet SolveGoalArray(GoalGroup* group, size_t cur, ThunkRet cut, Thunk f) {
-    if (cur > highest_goal_reached_) {
-      highest_goal_reached_ = cur;
+  /// \return an estimate of how many ways `goal` can be satisfied under the
+  /// current assignments. Fact goals are looked up in the best index, so the
+  /// estimate for them is exact up to unification of their unbound parts.
+  size_t EstimateGoalCost(AstNode* goal) {
+    if (auto* tu = MatchEqualsArgs(goal)) {
+      if (Range* r = tu->element(0)->AsRange()) {
+        auto anchors = anchors_.Find(r->begin(), r->end());
+        return anchors.second - anchors.first;
+      }
+      return 1;
     }
-    if (cur == group->goals.size()) {
-      return f();
+    if (auto* app = goal->AsApp()) {
+      if (app->lhs() == context_.fact_id()) {
+        if (auto* tuple = app->rhs()->AsTuple()) {
+          if (tuple->size() == 5) {
+            AtomFactKey key(context_.vname_id(), tuple);
+            auto facts = FindFacts(&key);
+            return facts.second - facts.first;
+          }
+        }
+      }
+    }
+    return database_.size();
+  }
+
+  /// \brief Picks which of the goals still to be solved in `group` (those at
+  /// `plan_[cur]` onward) should be tried next.
+  /// \return the position in `plan_` of the chosen goal.
+  ///
+  /// Goals are taken in source order unless a later one is more selective, so
+  /// well-ordered groups are searched exactly as written. A goal that can be
+  /// satisfied at most once is never worth deferring, so the search for a
+  /// better candidate stops there.
+  size_t PlanNextGoal(GoalGroup* group, size_t cur) {
+    size_t best = cur;
+    size_t best_cost = std::numeric_limits<size_t>::max();
+    for (size_t i = cur; i < plan_.size(); ++i) {
+      size_t cost = EstimateGoalCost(group->goals[plan_[i]]);
+      if (cost < best_cost) {
+        best = i;
+        best_cost = cost;
+        if (cost <= 1) {
+          break;
+        }
+      }
+    }
+    return best;
+  }
+
+  /// \brief Records that the `depth`th goal tried in the current group was
+  /// the goal at `index` in source order.
+  void NoteGoalReached(size_t depth, size_t index) {
+    if (depth >= highest_depth_reached_) {
+      highest_depth_reached_ = depth + 1;
+      highest_goal_reached_ = index;
+    }
+  }
+
+  /// \brief Searches for assignments that satisfy every goal in `group`.
+  /// The search is depth-first over `choices_`, one choice point per goal,
+  /// with the bindings for each alternative recorded on `trail_`.
+  /// \return kSolved (keeping the bindings) if the group was satisfied;
+  /// otherwise kNoException, kImpossible or kInvalidProgram, with every
+  /// binding the search made undone.
+  ThunkRet SolveGoalArray(GoalGroup* group) {
+    size_t goals = group->goals.size();
+    if (choices_.size() < goals) {
+      choices_.resize(goals);
+    }
+    size_t depth = 0;
+    bool entering = true;
+    for (;;) {
+      if (entering) {
+        if (depth == goals) {
+          NoteGoalReached(depth, depth);
+          return kSolved;
+        }
+        // Goals in a group are conjoined, so the order in which they're
+        // tried doesn't change whether the group can be satisfied (and hence
+        // doesn't change the meaning of negated groups either).
+        ChoicePoint* choice = &choices_[depth];
+        choice->planned_from =
+            plan_goals_ ? PlanNextGoal(group, depth) : depth;
+        std::swap(plan_[depth], plan_[choice->planned_from]);
+        NoteGoalReached(depth, plan_[depth]);
+        ThunkRet init = InitChoicePoint(group->goals[plan_[depth]], choice);
+        if (profile_ != nullptr && init != kInvalidProgram &&
+            choice->kind != ChoicePoint::Kind::kEquals) {
+          ++profile_->goals[plan_[depth]].probes;
+        }
+        if (init != kNoException) {
+          UndoTo(0);
+          return init;
+        }
+      }
+      size_t tried_from = choices_[depth].next;
+      ThunkRet tried = TryNextAlternative(&choices_[depth]);
+      if (profile_ != nullptr) {
+        profile_->goals[plan_[depth]].unifications +=
+            choices_[depth].next - tried_from;
+      }
+      if (tried == kSolved) {
+        ++depth;
+        entering = true;
+        continue;
+      }
+      if (tried != kNoException) {
+        UndoTo(0);
+        return tried;
+      }
+      // Out of alternatives; backtrack into the previous goal.
+      if (profile_ != nullptr) {
+        ++profile_->goals[plan_[depth]].backtracks;
+      }
+      std::swap(plan_[depth], plan_[choices_[depth].planned_from]);
+      if (depth == 0) {
+        return kNoException;
+      }
+      --depth;
+      UndoTo(choices_[depth].trail_mark);
+      entering = false;
     }
-    return SolveGoal(group->goals[cur], cut, [this, group, cur, cut, &f]() {
-      return SolveGoalArray(group, cur + 1, cut, f);
-    });
   }
 
   bool PerformInspection() {
@@ -539,54 +1000,252 @@ class Solver {
     return true;
   }
 
-  ThunkRet SolveGoalGroups(AssertionParser* context, Thunk f) {
-    for (size_t cur = 0, cut = kFirstCut; cur < context->groups().size();
-         ++cur, ++cut) {
+  /// \brief Solves the groups at `indices` (ascending indices into the
+  /// parser's groups) in order, stopping at the first one that doesn't meet
+  /// its acceptance criterion.
+  /// \return kSolved if every group was accepted, kNoException if one
+  /// wasn't, or some other exception.
+  ThunkRet SolveGroups(AssertionParser* context,
+                       const std::vector<size_t>& indices) {
+    for (size_t cur : indices) {
       auto* group = &context->groups()[cur];
       if (cur > highest_group_reached_) {
         highest_goal_reached_ = 0;
         highest_group_reached_ = cur;
       }
-      ThunkRet result = SolveGoalArray(group, 0, cut, [cut]() { return cut; });
-      // Lots of unwinding later...
-      if (result == cut) {
+      highest_depth_reached_ = 0;
+      plan_.resize(group->goals.size());
+      for (size_t goal = 0; goal < plan_.size(); ++goal) {
+        plan_[goal] = goal;
+      }
+      // Bindings from earlier groups are never undone.
+      trail_.clear();
+      absl::Time start;
+      if (profiles_ != nullptr) {
+        profile_ = &(*profiles_)[cur];
+        profile_->reached = true;
+        profile_->lane = lane_;
+        start = absl::Now();
+      }
+      ThunkRet result = SolveGoalArray(group);
+      if (profile_ != nullptr) {
+        profile_->start = start;
+        profile_->duration = absl::Now() - start;
+      }
+      if (result == kSolved) {
         // That last goal group succeeded.
         if (group->accept_if != GoalGroup::kNoneMayFail) {
-          return PerformInspection() ? kNoException : kInvalidProgram;
+          return kNoException;
         }
       } else if (result == kNoException || result == kImpossible) {
         // That last goal group failed.
         if (group->accept_if != GoalGroup::kSomeMustFail) {
-          return PerformInspection() ? kNoException : kInvalidProgram;
+          return kNoException;
         }
       } else {
         return result;
       }
     }
-    return PerformInspection() ? f() : kInvalidProgram;
+    return kSolved;
+  }
+
+  ThunkRet SolveGoalGroups(AssertionParser* context) {
+    std::vector<size_t> indices(context->groups().size());
+    for (size_t cur = 0; cur < indices.size(); ++cur) {
+      indices[cur] = cur;
+    }
+    ThunkRet result = SolveGroups(context, indices);
+    if (result == kSolved) {
+      return PerformInspection() ? kSolved : kInvalidProgram;
+    } else if (result == kNoException) {
+      return PerformInspection() ? kNoException : kInvalidProgram;
+    }
+    return result;
   }
 
   bool Solve() {
-    ThunkRet exn = SolveGoalGroups(context_.parser(), []() { return kSolved; });
-    return exn == kSolved;
+    return SolveGoalGroups(context_.parser()) == kSolved;
   }
 
   size_t highest_group_reached() const { return highest_group_reached_; }
 
   size_t highest_goal_reached() const { return highest_goal_reached_; }
 
+  /// \brief Counts the work done for each goal in `profiles` (which must
+  /// have an entry with room for every goal for each group), labeling the
+  /// groups this solver handles with `lane`.
+  void Profile(std::vector<GroupProfile>* profiles, size_t lane) {
+    profiles_ = profiles;
+    lane_ = lane;
+  }
+
  private:
+  /// \return the range of facts that may match `key`, taken from whichever
+  /// index has the most of the key bound up front.
+  std::pair<Database::const_iterator, Database::const_iterator> FindFacts(
+      AtomFactKey* key) {
+    FactIndex index = FactIndex::kByValue;
+    size_t best_score = key->BoundPrefixScore(OrderFor(index));
+    for (FactIndex candidate : {FactIndex::kByTarget, FactIndex::kBySource}) {
+      size_t score = key->BoundPrefixScore(OrderFor(candidate));
+      if (score > best_score) {
+        index = candidate;
+        best_score = score;
+      }
+    }
+    const SortedFacts& sorted = facts_.Get(index);
+    FastLookup lookup{OrderFor(index), sorted.columns};
+    size_t begin = lookup.LowerBound(key);
+    size_t end = lookup.UpperBound(begin, key);
+    return {sorted.facts->begin() + begin, sorted.facts->begin() + end};
+  }
+
   Verifier& context_;
-  Database& database_;
-  std::multimap<std::pair<size_t, size_t>, AstNode*>& anchors_;
+  FactIndexes& facts_;
+  const Database& database_;
+  const AnchorIndex& anchors_;
   std::function<bool(Verifier*, const Inspection&)>& inspect_;
+  /// Whether to reorder the goals in each group by selectivity.
+  bool plan_goals_;
+  /// For the group being solved, the source indices of its goals in the
+  /// order they are being tried; goals before the current depth are solved.
+  std::vector<size_t> plan_;
   size_t highest_group_reached_ = 0;
   size_t highest_goal_reached_ = 0;
+  /// One more than the deepest goal reached in the current group.
+  size_t highest_depth_reached_ = 0;
+  /// The choice point for each goal tried so far in the current group, by
+  /// depth. Reused between groups so that the search doesn't allocate.
+  std::vector<ChoicePoint> choices_;
+  /// The `EVar`s bound while solving the current group, in binding order.
+  std::vector<EVar*> trail_;
+  /// The pairs of terms `Unify` has left to unify.
+  std::vector<std::pair<AstNode*, AstNode*>> unify_stack_;
+  /// Where to count the work done for each group, or null.
+  std::vector<GroupProfile>* profiles_ = nullptr;
+  /// The profile of the group being solved, or null.
+  GroupProfile* profile_ = nullptr;
+  /// The lane to record in the group profiles.
+  size_t lane_ = 0;
 };
+
+/// \brief Adds the `EVar`s that appear in `node` to `evars`.
+static void CollectEVars(AstNode* node, std::vector<EVar*>* evars) {
+  if (App* a = node->AsApp()) {
+    CollectEVars(a->lhs(), evars);
+    CollectEVars(a->rhs(), evars);
+  } else if (Tuple* tu = node->AsTuple()) {
+    for (size_t i = 0, c = tu->size(); i != c; ++i) {
+      CollectEVars(tu->element(i), evars);
+    }
+  } else if (EVar* e = node->AsEVar()) {
+    evars->push_back(e);
+  }
+}
+
+/// \brief The outcome of solving all goal groups.
+struct GroupsOutcome {
+  /// kSolved, kNoException if some group wasn't accepted, or another
+  /// exception.
+  ThunkRet result = kSolved;
+  size_t highest_group_reached = 0;
+  size_t highest_goal_reached = 0;
+};
+
+/// \brief Solves the goal groups of `context` using the threads in `pool`.
+///
+/// Groups communicate only through the `EVar`s they share, so the groups are
+/// split into components that share none; each component is solved in order
+/// by its own `Solver`, and different components are solved concurrently.
+/// The outcome (and the assignments left behind for inspections) is the same
+/// as solving every group in order: assignments made by groups after the
+/// first one to fail are undone.
+static GroupsOutcome SolveGroupsInParallel(
+    Verifier* context, FactIndexes* facts,
+    const AnchorIndex& anchors,
+    std::function<bool(Verifier*, const Solver::Inspection&)>& inspect,
+    bool plan_goals, std::vector<GroupProfile>* profiles, ThreadPool* pool) {
+  auto& groups = context->parser()->groups();
+  // Union groups that share EVars, remembering where each EVar first appears.
+  absl::flat_hash_map<EVar*, size_t> first_group;
+  std::vector<size_t> parent(groups.size());
+  for (size_t i = 0; i < parent.size(); ++i) {
+    parent[i] = i;
+  }
+  auto find = [&parent](size_t i) {
+    while (parent[i] != i) {
+      i = parent[i] = parent[parent[i]];
+    }
+    return i;
+  };
+  for (size_t i = 0; i < groups.size(); ++i) {
+    std::vector<EVar*> evars;
+    for (AstNode* goal : groups[i].goals) {
+      CollectEVars(goal, &evars);
+    }
+    for (EVar* evar : evars) {
+      auto inserted = first_group.emplace(evar, i);
+      if (!inserted.second) {
+        parent[find(i)] = find(inserted.first->second);
+      }
+    }
+  }
+  std::vector<std::vector<size_t>> components;
+  absl::flat_hash_map<size_t, size_t> component_for_root;
+  for (size_t i = 0; i < groups.size(); ++i) {
+    auto inserted = component_for_root.emplace(find(i), components.size());
+    if (inserted.second) {
+      components.emplace_back();
+    }
+    components[inserted.first->second].push_back(i);
+  }
+
+  std::vector<GroupsOutcome> outcomes(components.size());
+  for (size_t c = 0; c < components.size(); ++c) {
+    pool->Schedule([&, c]() {
+      Solver solver(context, *facts, anchors, inspect, plan_goals);
+      if (profiles != nullptr) {
+        solver.Profile(profiles, c);
+      }
+      outcomes[c].result = solver.SolveGroups(context->parser(), components[c]);
+      outcomes[c].highest_group_reached = solver.highest_group_reached();
+      outcomes[c].highest_goal_reached = solver.highest_goal_reached();
+    });
+  }
+  pool->Wait();
+
+  // Report the earliest group that failed, or the last group if none did.
+  GroupsOutcome outcome;
+  bool failed = false;
+  for (const auto& component : outcomes) {
+    if (component.result != kSolved) {
+      if (!failed ||
+          component.highest_group_reached < outcome.highest_group_reached) {
+        outcome = component;
+        failed = true;
+      }
+    } else if (!failed &&
+               component.highest_group_reached >=
+                   outcome.highest_group_reached) {
+      outcome = component;
+    }
+  }
+  if (failed) {
+    for (const auto& evar : first_group) {
+      if (evar.second > outcome.highest_group_reached) {
+        evar.first->set_current(nullptr);
+      }
+    }
+  }
+  return outcome;
+}
 }  // namespace
 
 Verifier::Verifier(bool trace_lex, bool trace_parse)
-    : parser_(this, trace_lex, trace_parse),
+    : parser_(absl::make_unique<AssertionParser>(this, trace_lex,
+                                                 trace_parse)),
+      trace_lex_(trace_lex),
+      trace_parse_(trace_parse),
       builtin_location_name_("builtins") {
   builtin_location_.initialize(&builtin_location_name_);
   builtin_location_.begin.column = 1;
@@ -687,7 +1346,7 @@ bool Verifier::LoadInlineProtoFile(const std::string& file_data) {
     }
   }
   Symbol empty = symbol_table_.intern("");
-  return parser_.ParseInlineRuleString(file_data, *kStandardIn, empty, empty,
+  return parser_->ParseInlineRuleString(file_data, *kStandardIn, empty, empty,
                                        empty, "\\s*\\#\\-(.*)");
 }
 
@@ -743,7 +1402,7 @@ bool Verifier::LoadInMemoryRuleFile(const std::string& filename, AstNode* vname,
   StringPrettyPrinter printer;
   vname->Dump(symbol_table_, &printer);
   fake_files_[printer.str()] = text;
-  return parser_.ParseInlineRuleString(
+  return parser_->ParseInlineRuleString(
       symbol_table_.text(text), filename.empty() ? printer.str() : filename,
       checked_tuple->element(3)->AsIdentifier()->symbol(),
       checked_tuple->element(2)->AsIdentifier()->symbol(),
@@ -755,12 +1414,23 @@ void Verifier::IgnoreDuplicateFacts() { ignore_dups_ = true; }
 
 void Verifier::SaveEVarAssignments() {
   saving_assignments_ = true;
-  parser_.InspectAllEVars();
+  parser_->InspectAllEVars();
+}
+
+void Verifier::ResetGoals() {
+  parser_ = absl::make_unique<AssertionParser>(this, trace_lex_, trace_parse_);
+  if (saving_assignments_) {
+    parser_->InspectAllEVars();
+  }
+  saved_assignments_.clear();
+  goal_profiles_.clear();
+  highest_group_reached_ = 0;
+  highest_goal_reached_ = 0;
 }
 
 void Verifier::ShowGoals() {
   FileHandlePrettyPrinter printer(stdout);
-  for (auto& group : parser_.groups()) {
+  for (auto& group : parser_->groups()) {
     if (group.accept_if == GoalGroup::kNoneMayFail) {
       printer.Print("group:\n");
     } else {
@@ -847,14 +1517,14 @@ static bool PrintFileSection(FILE* file, size_t start_line, size_t start_ix,
 
 void Verifier::DumpErrorGoal(size_t group, size_t index) {
   FileHandlePrettyPrinter printer(stderr);
-  if (group >= parser_.groups().size()) {
+  if (group >= parser_->groups().size()) {
     printer.Print("(invalid group index ");
     printer.Print(std::to_string(group));
     printer.Print(")\n");
   }
-  if (index >= parser_.groups()[group].goals.size()) {
-    if (index > parser_.groups()[group].goals.size() ||
-        parser_.groups()[group].goals.empty()) {
+  if (index >= parser_->groups()[group].goals.size()) {
+    if (index > parser_->groups()[group].goals.size() ||
+        parser_->groups()[group].goals.empty()) {
       printer.Print("(invalid index ");
       printer.Print(std::to_string(group));
       printer.Print(":");
@@ -863,13 +1533,13 @@ void Verifier::DumpErrorGoal(size_t group, size_t index) {
       return;
     }
     printer.Print("(past the end of a ");
-    if (parser_.groups()[group].accept_if == GoalGroup::kSomeMustFail) {
+    if (parser_->groups()[group].accept_if == GoalGroup::kSomeMustFail) {
       printer.Print("negated ");
     }
     printer.Print("group, whose last goal was)\n  ");
     --index;
   }
-  auto* goal = parser_.groups()[group].goals[index];
+  auto* goal = parser_->groups()[group].goals[index];
   yy::location goal_location = goal->location();
   yy::position goal_begin = goal_location.begin;
   yy::position goal_end = goal_location.end;
@@ -913,20 +1583,216 @@ void Verifier::DumpErrorGoal(size_t group, size_t index) {
   printer.Print("\n");
 }
 
+/// \return "file:line:column" for the start of `goal`.
+static std::string GoalLocation(AstNode* goal) {
+  const yy::position& begin = goal->location().begin;
+  return absl::StrCat(begin.filename ? *begin.filename : "-", ":", begin.line,
+                      ":", begin.column);
+}
+
+/// \brief Appends `text` to `out` as a quoted JSON string.
+static void AppendJsonString(absl::string_view text, std::string* out) {
+  out->push_back('"');
+  for (char c : text) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          absl::StrAppendFormat(out, "\\u%04x", c);
+        } else {
+          out->push_back(c);
+        }
+    }
+  }
+  out->push_back('"');
+}
+
+void Verifier::DumpGoalProfile(size_t limit) {
+  if (use_fast_solver_) {
+    // Souffle doesn't count work per goal, but relations that grow far
+    // beyond the database point at the goals that are expensive to solve.
+    std::vector<SouffleRelationSize> relations =
+        fast_solver_profile_.relation_sizes;
+    std::stable_sort(relations.begin(), relations.end(),
+                     [](const SouffleRelationSize& a,
+                        const SouffleRelationSize& b) {
+                       return a.size > b.size;
+                     });
+    if (relations.size() > limit) {
+      relations.resize(limit);
+    }
+    FileHandlePrettyPrinter printer(stderr);
+    printer.Print(absl::StrFormat(
+        "Fast solver profile: translated in %s, evaluated in %s on %s\n",
+        absl::FormatDuration(fast_solver_profile_.translation_time),
+        absl::FormatDuration(fast_solver_profile_.evaluation_time),
+        fast_solver_jobs_ == 0 ? "every core"
+                               : absl::StrCat(fast_solver_jobs_, " jobs")));
+    printer.Print(absl::StrFormat("%12s  %s\n", "tuples", "relation"));
+    for (const auto& relation : relations) {
+      printer.Print(
+          absl::StrFormat("%12d  %s\n", relation.size, relation.name));
+    }
+    return;
+  }
+  struct Row {
+    size_t group;
+    size_t goal;
+    const GoalProfile* profile;
+  };
+  std::vector<Row> rows;
+  GoalProfile total;
+  size_t reached = 0;
+  for (size_t group = 0; group < goal_profiles_.size(); ++group) {
+    if (!goal_profiles_[group].reached) {
+      continue;
+    }
+    ++reached;
+    const auto& goals = goal_profiles_[group].goals;
+    for (size_t goal = 0; goal < goals.size(); ++goal) {
+      total.unifications += goals[goal].unifications;
+      total.probes += goals[goal].probes;
+      total.backtracks += goals[goal].backtracks;
+      rows.push_back({group, goal, &goals[goal]});
+    }
+  }
+  // The goals that tried the most candidates come first; they're usually
+  // the ones that need to be rewritten or reordered.
+  auto cost = [](const Row& row) {
+    return std::make_tuple(row.profile->unifications, row.profile->backtracks,
+                           row.profile->probes);
+  };
+  std::stable_sort(rows.begin(), rows.end(),
+                   [&cost](const Row& a, const Row& b) {
+                     return cost(a) > cost(b);
+                   });
+  if (rows.size() > limit) {
+    rows.resize(limit);
+  }
+  FileHandlePrettyPrinter printer(stderr);
+  printer.Print(absl::StrFormat(
+      "Goal profile: %d of %d groups reached; %d unifications, %d probes, "
+      "%d backtracks\n",
+      reached, goal_profiles_.size(), total.unifications, total.probes,
+      total.backtracks));
+  printer.Print(absl::StrFormat("%12s %8s %10s  %-11s %s\n", "unifications",
+                                "probes", "backtracks", "group:goal",
+                                "location"));
+  for (const auto& row : rows) {
+    AstNode* goal = parser_->groups()[row.group].goals[row.goal];
+    printer.Print(absl::StrFormat(
+        "%12d %8d %10d  %-11s %s\n    ", row.profile->unifications,
+        row.profile->probes, row.profile->backtracks,
+        absl::StrCat(row.group, ":", row.goal), GoalLocation(goal)));
+    goal->Dump(symbol_table_, &printer);
+    printer.Print("\n");
+  }
+}
+
+std::string Verifier::GoalProfileTrace() const {
+  absl::Time epoch = absl::InfiniteFuture();
+  size_t lanes = 0;
+  for (const auto& group : goal_profiles_) {
+    if (group.reached) {
+      epoch = std::min(epoch, group.start);
+      lanes = std::max(lanes, group.lane + 1);
+    }
+  }
+  std::string events;
+  for (size_t lane = 0; lane < lanes; ++lane) {
+    absl::StrAppendFormat(&events,
+                          "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                          "\"tid\":%d,\"args\":{\"name\":\"solver %d\"}}",
+                          events.empty() ? "" : ",", lane + 1, lane);
+  }
+  for (size_t index = 0; index < goal_profiles_.size(); ++index) {
+    const auto& group = goal_profiles_[index];
+    if (!group.reached) {
+      continue;
+    }
+    GoalProfile total;
+    for (const auto& goal : group.goals) {
+      total.unifications += goal.unifications;
+      total.probes += goal.probes;
+      total.backtracks += goal.backtracks;
+    }
+    absl::StrAppendFormat(
+        &events,
+        ",{\"name\":\"group %d\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+        "\"ts\":%d,\"dur\":%d,\"args\":{\"location\":",
+        index, group.lane + 1, absl::ToInt64Microseconds(group.start - epoch),
+        absl::ToInt64Microseconds(group.duration));
+    const auto& goals = parser_->groups()[index].goals;
+    AppendJsonString(goals.empty() ? "-" : GoalLocation(goals.front()),
+                     &events);
+    absl::StrAppendFormat(
+        &events,
+        ",\"goals\":%d,\"unifications\":%d,\"probes\":%d,\"backtracks\":%d}}",
+        group.goals.size(), total.unifications, total.probes,
+        total.backtracks);
+  }
+  return absl::StrCat("{\"traceEvents\":[", events,
+                      "],\"displayTimeUnit\":\"ms\"}\n");
+}
+
 bool Verifier::VerifyAllGoals(
     std::function<bool(Verifier*, const Solver::Inspection&)> inspect) {
   if (use_fast_solver_) {
+    SouffleOptions options;
+    options.jobs = fast_solver_jobs_;
+    options.profile = profile_goals_;
     auto result = RunSouffle(
-        symbol_table_, parser_.groups(), facts_, parser_.inspections(),
-        [&](const Solver::Inspection& i) { return inspect(this, i); });
+        symbol_table_, parser_->groups(), facts_, parser_->inspections(),
+        [&](const Solver::Inspection& i) { return inspect(this, i); },
+        options);
     highest_goal_reached_ = result.highest_goal_reached;
     highest_group_reached_ = result.highest_group_reached;
+    if (profile_goals_) {
+      fast_solver_profile_ = result;
+    }
     return result.success;
   }
   if (!PrepareDatabase()) {
     return false;
   }
-  Solver solver(this, facts_, anchors_, inspect);
+  FactIndexes facts(facts_);
+  std::vector<GroupProfile>* profiles = nullptr;
+  goal_profiles_.clear();
+  if (profile_goals_) {
+    goal_profiles_.resize(parser_->groups().size());
+    for (size_t group = 0; group < goal_profiles_.size(); ++group) {
+      goal_profiles_[group].goals.resize(
+          parser_->groups()[group].goals.size());
+    }
+    profiles = &goal_profiles_;
+  }
+  if (solver_threads_ > 1) {
+    auto outcome = SolveGroupsInParallel(this, &facts, anchors_, inspect,
+                                         plan_goals_, profiles, pool());
+    highest_goal_reached_ = outcome.highest_goal_reached;
+    highest_group_reached_ = outcome.highest_group_reached;
+    if (outcome.result != kSolved && outcome.result != kNoException) {
+      return false;
+    }
+    for (const auto& inspection : parser_->inspections()) {
+      if (!inspect(this, inspection)) {
+        return false;
+      }
+    }
+    return outcome.result == kSolved;
+  }
+  Solver solver(this, facts, anchors_, inspect, plan_goals_);
+  if (profiles != nullptr) {
+    solver.Profile(profiles, 0);
+  }
   bool result = solver.Solve();
   highest_goal_reached_ = solver.highest_goal_reached();
   highest_group_reached_ = solver.highest_group_reached();
@@ -961,6 +1827,42 @@ Identifier* Verifier::IdentifierFor(const yy::location& location, int integer) {
   return new (&arena_) Identifier(location, symbol);
 }
 
+AstNode* Verifier::FactIdentifierFor(Symbol symbol) {
+  if (symbol == empty_string_id_->AsIdentifier()->symbol()) {
+    return empty_string_id_;
+  }
+  auto inserted = fact_identifiers_.emplace(symbol, nullptr);
+  if (inserted.second) {
+    inserted.first->second =
+        new (&arena_) Identifier(builtin_location_, symbol);
+  }
+  return inserted.first->second;
+}
+
+AstNode* Verifier::FactVNameFor(const InternedVName& vname) {
+  auto inserted = fact_vnames_.emplace(vname, nullptr);
+  if (inserted.second) {
+    inserted.first->second =
+        MakePredicate(builtin_location_, vname_id_,
+                      {FactIdentifierFor(std::get<0>(vname)),
+                       FactIdentifierFor(std::get<1>(vname)),
+                       FactIdentifierFor(std::get<2>(vname)),
+                       FactIdentifierFor(std::get<3>(vname)),
+                       FactIdentifierFor(std::get<4>(vname))});
+  }
+  return inserted.first->second;
+}
+
+ThreadPool* Verifier::pool() {
+  if (solver_threads_ < 2) {
+    return nullptr;
+  }
+  if (pool_ == nullptr) {
+    pool_ = absl::make_unique<ThreadPool>(solver_threads_);
+  }
+  return pool_.get();
+}
+
 AstNode* Verifier::MakePredicate(const yy::location& location, AstNode* head,
                                  absl::Span<AstNode* const> values) {
   size_t values_count = values.size();
@@ -974,40 +1876,6 @@ AstNode* Verifier::MakePredicate(const yy::location& location, AstNode* head,
   return new (&arena_) App(location, head, tuple);
 }
 
-/// \brief Sort nodes such that nodes and facts are grouped.
-static bool GraphvizSortOrder(AstNode* a, AstNode* b) {
-  Tuple* ta = a->AsApp()->rhs()->AsTuple();
-  Tuple* tb = b->AsApp()->rhs()->AsTuple();
-  if (EncodedVNameOrIdentLessThan(ta->element(0), tb->element(0))) {
-    return true;
-  }
-  if (!EncodedVNameOrIdentEqualTo(ta->element(0), tb->element(0))) {
-    return false;
-  }
-  if (EncodedIdentLessThan(ta->element(1), tb->element(1))) {
-    return true;
-  }
-  if (!EncodedIdentEqualTo(ta->element(1), tb->element(1))) {
-    return false;
-  }
-  if (EncodedVNameOrIdentLessThan(ta->element(2), tb->element(2))) {
-    return true;
-  }
-  if (!EncodedVNameOrIdentEqualTo(ta->element(2), tb->element(2))) {
-    return false;
-  }
-  if (EncodedIdentLessThan(ta->element(3), tb->element(3))) {
-    return true;
-  }
-  if (!EncodedIdentEqualTo(ta->element(3), tb->element(3))) {
-    return false;
-  }
-  if (EncodedIdentLessThan(ta->element(4), tb->element(4))) {
-    return true;
-  }
-  return false;
-}
-
 static bool EncodedFactEqualTo(AstNode* a, AstNode* b) {
   Tuple* ta = a->AsApp()->rhs()->AsTuple();
   Tuple* tb = b->AsApp()->rhs()->AsTuple();
@@ -1117,7 +1985,9 @@ bool Verifier::PrepareDatabase() {
   // vname (ident, ident, ident, ident, ident)
   // and all idents will have been uniqued (so we can compare them purely
   // by symbol ID).
-  std::sort(facts_.begin(), facts_.end(), EncodedFactLessThan);
+  SortFactsInOrder(&facts_, kFactsByNodeOrder, pool());
+  // Anchors are found again below.
+  anchors_.Clear();
   // Now we can do a simple pairwise check on each of the facts to see
   // whether the invariants hold.
   bool is_ok = true;
@@ -1163,7 +2033,7 @@ bool Verifier::PrepareDatabase() {
         last_file_vname = nullptr;
       }
       // Check to see if this fact entry describes part of an anchor.
-      // We've arranged via EncodedFactLessThan to sort kind_id_ before
+      // We've arranged via kFactsByNodeOrder to sort kind_id_ before
       // start_id_ and start_id_ before end_id_ and to group all node facts
       // together in uninterrupted runs.
       if (is_kind_fact && EncodedIdentEqualTo(tb->element(4), anchor_id_)) {
@@ -1256,8 +2126,9 @@ bool Verifier::PrepareDatabase() {
       is_ok = false;
     }
   }
+  anchors_.Sort();
   if (is_ok) {
-    std::sort(facts_.begin(), facts_.end(), FastLookupFactLessThan);
+    SortFactsInOrder(&facts_, OrderFor(FactIndex::kByValue), pool());
   }
   database_prepared_ = is_ok;
   return is_ok;
@@ -1385,54 +2256,120 @@ AstNode* Verifier::ConvertMarkedSource(
   return vname;
 }
 
+Verifier::InternedEntry Verifier::InternEntry(
+    const kythe::proto::Entry& entry) {
+  auto intern_vname = [this](const kythe::proto::VName& vname) {
+    return InternedVName{symbol_table_.intern(vname.signature()),
+                         symbol_table_.intern(vname.corpus()),
+                         symbol_table_.intern(vname.root()),
+                         symbol_table_.intern(vname.path()),
+                         symbol_table_.intern(vname.language())};
+  };
+  InternedEntry interned;
+  if (entry.has_source()) {
+    interned.has_source = true;
+    interned.source = intern_vname(entry.source());
+  }
+  if (entry.has_target()) {
+    interned.has_target = true;
+    interned.target = intern_vname(entry.target());
+  }
+  // We're removing support for ordinal facts. Support them during the
+  // transition, but also support the new dot-separated edge kinds that serve
+  // the same purpose.
+  absl::string_view edge_kind = entry.edge_kind();
+  auto dot_pos = edge_kind.rfind('.');
+  if (dot_pos != absl::string_view::npos && dot_pos > 0 &&
+      dot_pos < edge_kind.size() - 1) {
+    interned.is_ordinal = true;
+    interned.edge_kind = symbol_table_.intern(edge_kind.substr(0, dot_pos));
+    interned.fact_value = symbol_table_.intern(edge_kind.substr(dot_pos + 1));
+    return interned;
+  }
+  interned.edge_kind = symbol_table_.intern(edge_kind);
+  interned.fact_name = symbol_table_.intern(entry.fact_name());
+  interned.is_code = convert_marked_source_ &&
+                     interned.fact_name == code_id_->AsIdentifier()->symbol();
+  if (!interned.is_code) {
+    interned.fact_value = symbol_table_.intern(entry.fact_value());
+  }
+  return interned;
+}
+
 bool Verifier::AssertSingleFact(std::string* database, unsigned int fact_id,
                                 const kythe::proto::Entry& entry) {
+  return AssertInternedFact(database, fact_id, InternEntry(entry), entry);
+}
+
+bool Verifier::AssertSerializedFacts(
+    std::string* database, unsigned int first_fact_id,
+    const std::vector<std::string>& serialized) {
+  std::vector<kythe::proto::Entry> entries(serialized.size());
+  std::vector<InternedEntry> interned(serialized.size());
+  // Not a vector<bool>, since slices are written from different threads.
+  std::vector<char> parsed(serialized.size());
+  auto decode = [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      parsed[i] = entries[i].ParseFromString(serialized[i]);
+      if (parsed[i]) {
+        interned[i] = InternEntry(entries[i]);
+      }
+    }
+  };
+  if (ThreadPool* threads = pool()) {
+    size_t slices = threads->size();
+    for (size_t i = 0; i < slices; ++i) {
+      threads->Schedule([&decode, &serialized, i, slices]() {
+        decode(serialized.size() * i / slices,
+               serialized.size() * (i + 1) / slices);
+      });
+    }
+    threads->Wait();
+  } else {
+    decode(0, serialized.size());
+  }
+  for (size_t i = 0; i < serialized.size(); ++i) {
+    if (!parsed[i]) {
+      LOG(ERROR) << "Couldn't decode fact " << first_fact_id + i;
+      return false;
+    }
+    if (!AssertInternedFact(database, first_fact_id + i, interned[i],
+                            entries[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Verifier::AssertInternedFact(std::string* database, unsigned int fact_id,
+                                  const InternedEntry& interned,
+                                  const kythe::proto::Entry& entry) {
   yy::location loc;
   loc.initialize(database);
   loc.begin.column = 1;
   loc.begin.line = fact_id;
   loc.end = loc.begin;
-  Symbol code_symbol = code_id_->AsIdentifier()->symbol();
   AstNode** values = (AstNode**)arena_.New(sizeof(AstNode*) * 5);
   values[0] =
-      entry.has_source() ? ConvertVName(loc, entry.source()) : empty_string_id_;
-  // We're removing support for ordinal facts. Support them during the
-  // transition, but also support the new dot-separated edge kinds that serve
-  // the same purpose.
-  auto dot_pos = entry.edge_kind().rfind('.');
-  bool is_code = false;
-  if (dot_pos != std::string::npos && dot_pos > 0 &&
-      dot_pos < entry.edge_kind().size() - 1) {
-    values[1] = IdentifierFor(loc, entry.edge_kind().substr(0, dot_pos));
+      interned.has_source ? FactVNameFor(interned.source) : empty_string_id_;
+  values[1] = FactIdentifierFor(interned.edge_kind);
+  values[2] =
+      interned.has_target ? FactVNameFor(interned.target) : empty_string_id_;
+  if (interned.is_ordinal) {
     values[3] = ordinal_id_;
-    values[4] = IdentifierFor(loc, entry.edge_kind().substr(dot_pos + 1));
-  } else {
-    values[1] = entry.edge_kind().empty()
-                    ? empty_string_id_
-                    : IdentifierFor(loc, entry.edge_kind());
-    values[3] = entry.fact_name().empty()
-                    ? empty_string_id_
-                    : IdentifierFor(loc, entry.fact_name());
-    if (values[3]->AsIdentifier()->symbol() == code_symbol &&
-        convert_marked_source_) {
-      // Code facts are turned into subgraphs, so this fact entry will turn
-      // into an edge entry.
-      if ((values[2] = ConvertCodeFact(loc, entry.fact_value())) == nullptr) {
-        return false;
-      }
-      values[1] = marked_source_code_edge_id_;
-      values[3] = root_id_;
-      values[4] = empty_string_id_;
-      is_code = true;
-    } else {
-      values[4] = entry.fact_value().empty()
-                      ? empty_string_id_
-                      : IdentifierFor(loc, entry.fact_value());
+    values[4] = FactIdentifierFor(interned.fact_value);
+  } else if (interned.is_code) {
+    // Code facts are turned into subgraphs, so this fact entry will turn
+    // into an edge entry.
+    if ((values[2] = ConvertCodeFact(loc, entry.fact_value())) == nullptr) {
+      return false;
     }
-  }
-  if (!is_code) {
-    values[2] = entry.has_target() ? ConvertVName(loc, entry.target())
-                                   : empty_string_id_;
+    values[1] = marked_source_code_edge_id_;
+    values[3] = root_id_;
+    values[4] = empty_string_id_;
+  } else {
+    values[3] = FactIdentifierFor(interned.fact_name);
+    values[4] = FactIdentifierFor(interned.fact_value);
   }
 
   Tuple* tuple = new (&arena_) Tuple(loc, 5, values);
@@ -1446,12 +2383,86 @@ bool Verifier::AssertSingleFact(std::string* database, unsigned int fact_id,
   return true;
 }
 
+bool Verifier::FocusDump(const std::string& regex, size_t hops,
+                         std::string* error) {
+  dump_focus_ = absl::make_unique<RE2>(regex);
+  dump_focus_hops_ = hops;
+  if (!dump_focus_->ok()) {
+    *error = dump_focus_->error();
+    dump_focus_.reset();
+    return false;
+  }
+  return true;
+}
+
+Database Verifier::FactsToDump() {
+  // Sort a copy so that the database stays prepared.
+  Database facts = facts_;
+  SortFactsInOrder(&facts, kFactsByNodeOrder, pool());
+  if (dump_focus_ == nullptr) {
+    return facts;
+  }
+  std::set<AstNode*, bool (*)(AstNode*, AstNode*)> focus(
+      EncodedVNameOrIdentLessThan);
+  // Start with the nodes whose vnames or inspection labels match.
+  for (const auto& label_vname : saved_assignments_) {
+    if (label_vname.second != nullptr && label_vname.second->AsApp() &&
+        RE2::PartialMatch(label_vname.first, *dump_focus_)) {
+      focus.insert(label_vname.second);
+    }
+  }
+  for (size_t i = 0; i < facts.size(); ++i) {
+    AstNode* source = facts[i]->AsApp()->rhs()->AsTuple()->element(0);
+    if (i > 0 &&
+        EncodedVNameOrIdentEqualTo(
+            facts[i - 1]->AsApp()->rhs()->AsTuple()->element(0), source)) {
+      continue;
+    }
+    StringPrettyPrinter printer;
+    source->Dump(symbol_table_, &printer);
+    if (RE2::PartialMatch(printer.str(), *dump_focus_)) {
+      focus.insert(source);
+    }
+  }
+  // Then follow edges in either direction.
+  for (size_t hop = 0; hop < dump_focus_hops_; ++hop) {
+    std::vector<AstNode*> reached;
+    for (AstNode* fact : facts) {
+      Tuple* t = fact->AsApp()->rhs()->AsTuple();
+      if (t->element(1) == empty_string_id()) {
+        continue;
+      }
+      bool has_source = focus.count(t->element(0)) != 0;
+      bool has_target = focus.count(t->element(2)) != 0;
+      if (has_source && !has_target) {
+        reached.push_back(t->element(2));
+      } else if (has_target && !has_source) {
+        reached.push_back(t->element(0));
+      }
+    }
+    if (reached.empty()) {
+      break;
+    }
+    focus.insert(reached.begin(), reached.end());
+  }
+  Database focused;
+  for (AstNode* fact : facts) {
+    Tuple* t = fact->AsApp()->rhs()->AsTuple();
+    if (focus.count(t->element(0)) != 0 &&
+        (t->element(1) == empty_string_id() ||
+         focus.count(t->element(2)) != 0)) {
+      focused.push_back(fact);
+    }
+  }
+  return focused;
+}
+
 void Verifier::DumpAsJson() {
   if (!PrepareDatabase()) {
     return;
   }
-  // Use the same sort order as we do with Graphviz.
-  std::sort(facts_.begin(), facts_.end(), GraphvizSortOrder);
+  // Use the same order and focus as we do with Graphviz.
+  Database facts = FactsToDump();
   FileHandlePrettyPrinter printer(stdout);
   QuoteEscapingPrettyPrinter escaping_printer(printer);
   FileHandlePrettyPrinter dprinter(stderr);
@@ -1484,8 +2495,8 @@ void Verifier::DumpAsJson() {
     }
   };
   printer.Print("[");
-  for (size_t i = 0; i < facts_.size(); ++i) {
-    AstNode* fact = facts_[i];
+  for (size_t i = 0; i < facts.size(); ++i) {
+    AstNode* fact = facts[i];
     Tuple* t = fact->AsApp()->rhs()->AsTuple();
     printer.Print("{");
     DumpVName("\"source\":", t->element(0));
@@ -1493,7 +2504,7 @@ void Verifier::DumpAsJson() {
     DumpVName(",\"target\":", t->element(2));
     DumpAsJson(",\"fact_name\":", t->element(3));
     DumpAsJson(",\"fact_value\":", t->element(4));
-    printer.Print(i + 1 == facts_.size() ? "}" : "},");
+    printer.Print(i + 1 == facts.size() ? "}" : "},");
   }
   printer.Print("]\n");
 }
@@ -1535,14 +2546,14 @@ void Verifier::DumpAsDot() {
       return std::string();
     }
   };
-  std::sort(facts_.begin(), facts_.end(), GraphvizSortOrder);
+  Database facts = FactsToDump();
   FileHandlePrettyPrinter printer(stdout);
   QuoteEscapingPrettyPrinter quote_printer(printer);
   HtmlEscapingPrettyPrinter html_printer(printer);
   FileHandlePrettyPrinter dprinter(stderr);
   printer.Print("digraph G {\n");
-  for (size_t i = 0; i < facts_.size(); ++i) {
-    AstNode* fact = facts_[i];
+  for (size_t i = 0; i < facts.size(); ++i) {
+    AstNode* fact = facts[i];
     Tuple* t = fact->AsApp()->rhs()->AsTuple();
     printer.Print("\"");
     t->element(0)->Dump(symbol_table_, &quote_printer);
@@ -1553,9 +2564,9 @@ void Verifier::DumpAsDot() {
       // Figure out if the node is an anchor.
       bool is_anchor_node = false;
       bool is_file_node = false;
-      size_t first_fact = i, last_fact = facts_.size();
-      for (; i < facts_.size(); ++i) {
-        Tuple* nt = facts_[i]->AsApp()->rhs()->AsTuple();
+      size_t first_fact = i, last_fact = facts.size();
+      for (; i < facts.size(); ++i) {
+        Tuple* nt = facts[i]->AsApp()->rhs()->AsTuple();
         if (!EncodedVNameOrIdentEqualTo(nt->element(0), t->element(0)) ||
             nt->element(1) != empty_string_id()) {
           // Moved past the fact block or moved to a different source node.
@@ -1581,7 +2592,7 @@ void Verifier::DumpAsDot() {
       } else {
         printer.Print(" [ label=<<TABLE>");
         printer.Print("<TR><TD COLSPAN=\"2\">");
-        Tuple* nt = facts_[first_fact]->AsApp()->rhs()->AsTuple();
+        Tuple* nt = facts[first_fact]->AsApp()->rhs()->AsTuple();
         // Since all of our facts are well-formed, we know this is a vname.
         nt->element(0)->AsApp()->rhs()->Dump(symbol_table_, &html_printer);
         if (!label.empty()) {
@@ -1590,7 +2601,7 @@ void Verifier::DumpAsDot() {
         }
         printer.Print("</TD></TR>");
         for (i = first_fact; i < last_fact; ++i) {
-          Tuple* nt = facts_[i]->AsApp()->rhs()->AsTuple();
+          Tuple* nt = facts[i]->AsApp()->rhs()->AsTuple();
           printer.Print("<TR><TD>");
           nt->element(3)->Dump(symbol_table_, &html_printer);
           printer.Print("</TD><TD>");
@@ -17,17 +17,97 @@
 #ifndef KYTHE_CXX_VERIFIER_H_
 #define KYTHE_CXX_VERIFIER_H_
 
+#include <algorithm>
 #include <functional>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "assertions.h"
+#include "kythe/cxx/common/thread_pool.h"
+#include "kythe/cxx/verifier/souffle_interpreter.h"
 #include "kythe/proto/common.pb.h"
 #include "kythe/proto/storage.pb.h"
 
 namespace kythe {
 namespace verifier {
+/// \brief Anchor VNames kept in a flat vector sorted by their byte offsets.
+///
+/// Anchors are added in any order; `Sort` must be called before they are
+/// looked up. Lookups are then binary searches over contiguous memory and
+/// the index can be shared between threads.
+class AnchorIndex {
+ public:
+  /// \brief An anchor's (begin, end) offsets and its VName.
+  using Entry = std::pair<std::pair<size_t, size_t>, AstNode*>;
+  using const_iterator = std::vector<Entry>::const_iterator;
+
+  void Add(AstNode* vname, size_t begin, size_t end) {
+    entries_.emplace_back(std::make_pair(begin, end), vname);
+  }
+
+  /// \brief Orders the anchors by offset, keeping anchors with the same
+  /// offsets in the order they were added.
+  void Sort() {
+    std::stable_sort(entries_.begin(), entries_.end(),
+                     [](const Entry& a, const Entry& b) {
+                       return a.first < b.first;
+                     });
+  }
+
+  void Clear() { entries_.clear(); }
+
+  /// \return the anchors spanning exactly [begin, end).
+  std::pair<const_iterator, const_iterator> Find(size_t begin,
+                                                 size_t end) const {
+    auto offsets = std::make_pair(begin, end);
+    auto first = std::lower_bound(
+        entries_.begin(), entries_.end(), offsets,
+        [](const Entry& e, const std::pair<size_t, size_t>& o) {
+          return e.first < o;
+        });
+    auto last = std::upper_bound(
+        first, entries_.end(), offsets,
+        [](const std::pair<size_t, size_t>& o, const Entry& e) {
+          return o < e.first;
+        });
+    return {first, last};
+  }
+
+ private:
+  std::vector<Entry> entries_;
+};
+
+/// \brief The work the solver did on behalf of one goal.
+struct GoalProfile {
+  /// How many facts (or anchors) the goal was unified with.
+  size_t unifications = 0;
+  /// How many times the goal's candidates were looked up in an index.
+  size_t probes = 0;
+  /// How many times the goal ran out of candidates, sending the search back
+  /// to the goal before it.
+  size_t backtracks = 0;
+};
+
+/// \brief The work the solver did on behalf of one goal group.
+struct GroupProfile {
+  /// The profile of each goal in the group, in source order.
+  std::vector<GoalProfile> goals;
+  /// When the solver started on the group.
+  absl::Time start;
+  /// How long the solver spent on the group.
+  absl::Duration duration;
+  /// Which of the concurrent solvers handled the group.
+  size_t lane = 0;
+  /// Whether the solver got to the group; it stops at the first group that
+  /// isn't accepted.
+  bool reached = false;
+};
+
 /// \brief Runs logic programs.
 ///
 /// The `Verifier` combines an `AssertionContext` with a database of Kythe
@@ -66,6 +146,11 @@ class Verifier {
   /// \brief Save results of verification keyed by inspection label.
   void SaveEVarAssignments();
 
+  /// \brief Forgets every goal, inspection and saved assignment loaded so
+  /// far, keeping the fact database (and its preparation). Another set of rule
+  /// files can then be verified against the same facts.
+  void ResetGoals();
+
   /// \brief Dump all goals to standard out.
   void ShowGoals();
 
@@ -76,6 +161,23 @@ class Verifier {
   /// \sa highest_goal_reached, highest_group_reached
   void DumpErrorGoal(size_t group_index, size_t goal_index);
 
+  /// \brief Limits `DumpAsDot` and `DumpAsJson` to the nodes within `hops`
+  /// edges of any node whose printed vname or inspection label partially
+  /// matches `regex`.
+  /// \return false (and sets `error`) if `regex` is invalid.
+  bool FocusDump(const std::string& regex, size_t hops, std::string* error);
+
+  /// \brief Prints the `limit` goals the solver worked hardest on, with
+  /// their locations and counters, to standard error. For the fast solver,
+  /// prints its timings and the `limit` largest relations instead.
+  /// \pre `ProfileGoals(true)` was called before `VerifyAllGoals`.
+  void DumpGoalProfile(size_t limit);
+
+  /// \return the goal group profiles as a Chrome trace-event JSON document
+  /// (loadable by chrome://tracing or Perfetto), with one event per group on
+  /// the lane of the solver that handled it.
+  std::string GoalProfileTrace() const;
+
   /// \brief Dump known facts to standard out as a GraphViz graph.
   void DumpAsDot();
 
@@ -101,6 +203,17 @@ class Verifier {
   bool AssertSingleFact(std::string* database_name, unsigned int fact_id,
                         const kythe::proto::Entry& entry);
 
+  /// \brief Adds Kythe facts from serialized `kythe.proto.Entry` messages,
+  /// decoding them and interning their text on up to `SetSolverThreads`
+  /// threads.
+  /// \param database_name as for `AssertSingleFact`.
+  /// \param first_fact_id the identifier of the first fact; the rest are
+  /// numbered consecutively.
+  /// \return false if an entry couldn't be decoded or something went wrong.
+  bool AssertSerializedFacts(std::string* database_name,
+                             unsigned int first_fact_id,
+                             const std::vector<std::string>& serialized);
+
   /// \brief Perform basic well-formedness checks on the input database.
   /// \pre The database contains only fact-shaped terms, as generated by
   /// `AssertSingleFact`.
@@ -156,7 +269,7 @@ class Verifier {
   AstNode* kind_id() { return kind_id_; }
 
   /// \brief Object for parsing and storing assertions.
-  AssertionParser* parser() { return &parser_; }
+  AssertionParser* parser() { return parser_.get(); }
 
   /// \brief Returns the highest group index the verifier reached during
   /// solving.
@@ -184,7 +297,7 @@ class Verifier {
 
   /// \brief Check for singleton EVars.
   /// \return true if there were singletons.
-  bool CheckForSingletonEVars() { return parser_.CheckForSingletonEVars(); }
+  bool CheckForSingletonEVars() { return parser_->CheckForSingletonEVars(); }
 
   /// \brief Don't search for file vnames.
   void IgnoreFileVnames() { file_vnames_ = false; }
@@ -192,6 +305,33 @@ class Verifier {
   /// \brief Use the fast solver.
   void UseFastSolver(bool value) { use_fast_solver_ = value; }
 
+  /// \brief Let the fast solver evaluate relations on up to `jobs` threads,
+  /// or on every core if `jobs` is 0.
+  void SetFastSolverJobs(size_t jobs) { fast_solver_jobs_ = jobs; }
+
+  /// \brief Let the solver try the goals in a group in an order other than
+  /// the one they were written in when it expects that to be cheaper.
+  void PlanGoals(bool value) { plan_goals_ = value; }
+
+  /// \brief Count the work done for each goal while solving. The fast
+  /// solver instead records how long evaluation took and how large each
+  /// relation grew.
+  void ProfileGoals(bool value) { profile_goals_ = value; }
+
+  /// \return the profile of each goal group from the last call to
+  /// `VerifyAllGoals`, or nothing if goals weren't being profiled.
+  const std::vector<GroupProfile>& goal_profiles() const {
+    return goal_profiles_;
+  }
+
+  /// \brief Use up to `threads` threads to decode facts, sort the database
+  /// and solve goal groups that share no variables. Inspections still run in
+  /// group order once solving is done.
+  void SetSolverThreads(size_t threads) {
+    solver_threads_ = threads;
+    pool_.reset();
+  }
+
  private:
   using InternedVName = std::tuple<Symbol, Symbol, Symbol, Symbol, Symbol>;
 
@@ -223,18 +363,63 @@ class Verifier {
   AstNode* ConvertVName(const yy::location& location,
                         const kythe::proto::VName& vname);
 
+  /// \brief An `Entry` whose text has all been interned.
+  struct InternedEntry {
+    bool has_source = false;
+    InternedVName source;
+    Symbol edge_kind = 0;
+    bool has_target = false;
+    InternedVName target;
+    /// Set if `edge_kind` carried an ordinal, which is then in `fact_value`.
+    bool is_ordinal = false;
+    Symbol fact_name = 0;
+    /// Set if this is a /kythe/code fact to be converted to a subgraph, in
+    /// which case `fact_value` isn't interned.
+    bool is_code = false;
+    Symbol fact_value = 0;
+  };
+
+  /// \brief Interns the text of `entry`. Safe to call from multiple threads.
+  InternedEntry InternEntry(const kythe::proto::Entry& entry);
+
+  /// \brief Adds a fact for `entry` (interned as `interned`) to the database.
+  bool AssertInternedFact(std::string* database_name, unsigned int fact_id,
+                          const InternedEntry& interned,
+                          const kythe::proto::Entry& entry);
+
+  /// \brief Returns the `Identifier` for `symbol` shared by all facts, or
+  /// `empty_string_id_` if `symbol` is the empty string.
+  AstNode* FactIdentifierFor(Symbol symbol);
+
+  /// \brief Returns the AST representation of `vname` shared by all facts.
+  AstNode* FactVNameFor(const InternedVName& vname);
+
+  /// \return the pool to use for parallel work, or null if the verifier
+  /// should use only one thread.
+  ThreadPool* pool();
+
   /// \brief Adds an anchor VName.
   void AddAnchor(AstNode* vname, size_t begin, size_t end) {
-    anchors_.emplace(std::make_pair(begin, end), vname);
+    anchors_.Add(vname, begin, end);
   }
 
+  /// \brief Returns the facts to dump, with the facts about each node
+  /// together and limited to the neighborhood set by `FocusDump`.
+  Database FactsToDump();
+
   /// \brief Processes a fact tuple for the fast solver.
   /// \param tuple the five-tuple representation of a fact
   /// \return true if successful.
   bool ProcessFactTupleForFastSolver(Tuple* tuple);
 
   /// \sa parser()
-  AssertionParser parser_;
+  std::unique_ptr<AssertionParser> parser_;
+
+  /// Whether new parsers should dump lexing debug information.
+  bool trace_lex_;
+
+  /// Whether new parsers should dump parsing debug information.
+  bool trace_parse_;
 
   /// \sa arena()
   Arena arena_;
@@ -245,8 +430,8 @@ class Verifier {
   /// All known facts.
   Database facts_;
 
-  /// Multimap from anchor offsets to anchor VName tuples.
-  std::multimap<std::pair<size_t, size_t>, AstNode*> anchors_;
+  /// Anchor VName tuples by offset, sorted once the database is prepared.
+  AnchorIndex anchors_;
 
   /// Has the database been prepared?
   bool database_prepared_ = false;
@@ -336,6 +521,12 @@ class Verifier {
   /// If true, show anchor locations in graph dumps (instead of @).
   bool show_anchors_ = false;
 
+  /// If set, graph dumps only include nodes near those matching this regex.
+  std::unique_ptr<RE2> dump_focus_;
+
+  /// How many edges away from a matching node graph dumps may reach.
+  size_t dump_focus_hops_ = 0;
+
   /// Identifier for MarkedSource child edges.
   AstNode* marked_source_child_id_;
 
@@ -411,6 +602,28 @@ class Verifier {
   /// Use the fast solver.
   bool use_fast_solver_ = false;
 
+  /// The number of threads the fast solver evaluates on; 0 for every core.
+  size_t fast_solver_jobs_ = 1;
+
+  /// The result of the last fast solver run when `profile_goals_` is set.
+  SouffleResult fast_solver_profile_{};
+
+  /// Reorder goals within a group by selectivity.
+  bool plan_goals_ = false;
+
+  /// The number of threads to solve goal groups on.
+  size_t solver_threads_ = 1;
+
+  /// Count the work done for each goal while solving.
+  bool profile_goals_ = false;
+
+  /// The profile of each goal group, by group index; filled in by
+  /// `VerifyAllGoals` when `profile_goals_` is set.
+  std::vector<GroupProfile> goal_profiles_;
+
+  /// Threads for parallel work, started on first use.
+  std::unique_ptr<ThreadPool> pool_;
+
   /// Sentinel value for a known file.
   Symbol known_file_sym_;
 
@@ -419,6 +632,12 @@ class Verifier {
 
   /// Maps VNames to known_file_sym_, known_not_file_sym_, or file text.
   absl::flat_hash_map<InternedVName, Symbol> fast_solver_files_;
+
+  /// Identifiers shared by every fact that mentions their symbol.
+  absl::flat_hash_map<Symbol, Identifier*> fact_identifiers_;
+
+  /// VNames shared by every fact that mentions them.
+  absl::flat_hash_map<InternedVName, AstNode*> fact_vnames_;
 };
 
 }  // namespace verifier
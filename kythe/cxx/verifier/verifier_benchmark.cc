@@ -0,0 +1,165 @@
+/*
+ * Copyright 2021 The Kythe Authors. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmarks for the verifier's database preparation, solver and symbol
+// table over synthetic inputs.
+
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "benchmark/benchmark.h"
+#include "glog/logging.h"
+#include "kythe/cxx/verifier/verifier.h"
+#include "kythe/proto/storage.pb.h"
+
+namespace kythe {
+namespace verifier {
+namespace {
+
+/// \brief Returns serialized entries for `count` anchors, each defining its
+/// own function node: three entries per anchor.
+std::vector<std::string> MakeFacts(int count) {
+  std::vector<std::string> facts;
+  facts.reserve(count * 3);
+  for (int i = 0; i < count; ++i) {
+    kythe::proto::Entry entry;
+    entry.mutable_source()->set_signature(absl::StrCat("a", i));
+    entry.set_fact_name("/kythe/node/kind");
+    entry.set_fact_value("anchor");
+    facts.push_back(entry.SerializeAsString());
+    entry.set_edge_kind("/kythe/edge/defines/binding");
+    entry.mutable_target()->set_signature(absl::StrCat("n", i));
+    entry.set_fact_name("/");
+    entry.clear_fact_value();
+    facts.push_back(entry.SerializeAsString());
+    entry.Clear();
+    entry.mutable_source()->set_signature(absl::StrCat("n", i));
+    entry.set_fact_name("/kythe/node/kind");
+    entry.set_fact_value("function");
+    facts.push_back(entry.SerializeAsString());
+  }
+  return facts;
+}
+
+/// \brief Returns `count` pairs of goals, each finding the node that one of
+/// the first `count` anchors defines and checking its kind.
+std::string MakeGoals(int count) {
+  std::string goals;
+  for (int i = 0; i < count; ++i) {
+    absl::StrAppend(&goals, "#- vname(\"a", i, "\", \"\", \"\", \"\", \"\") ",
+                    "defines/binding N", i, "\n#- N", i,
+                    ".node/kind function\n");
+  }
+  return goals;
+}
+
+/// \brief Asserts `facts` into `verifier`.
+void AssertFacts(const std::vector<std::string>& facts, Verifier* verifier) {
+  static std::string* database = new std::string("benchmark");
+  CHECK(verifier->AssertSerializedFacts(database, 0, facts));
+}
+
+/// \brief Sorts and checks a database of `range(0)` anchors.
+void BM_PrepareDatabase(benchmark::State& state) {
+  const std::vector<std::string> facts = MakeFacts(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    {
+      Verifier verifier;
+      AssertFacts(facts, &verifier);
+      state.ResumeTiming();
+      CHECK(verifier.PrepareDatabase());
+      // Don't count tearing the database down.
+      state.PauseTiming();
+    }
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * facts.size());
+}
+BENCHMARK(BM_PrepareDatabase)
+    ->RangeMultiplier(8)
+    ->Range(1 << 6, 1 << 15)
+    ->Unit(benchmark::kMillisecond);
+
+/// \brief Solves `range(1)` pairs of goals against a database of `range(0)`
+/// anchors.
+void BM_VerifyAllGoals(benchmark::State& state) {
+  const std::string goals = MakeGoals(state.range(1));
+  Verifier verifier;
+  AssertFacts(MakeFacts(state.range(0)), &verifier);
+  CHECK(verifier.PrepareDatabase());
+  for (auto _ : state) {
+    state.PauseTiming();
+    verifier.ResetGoals();
+    CHECK(verifier.LoadInlineProtoFile(goals));
+    state.ResumeTiming();
+    CHECK(verifier.VerifyAllGoals());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_VerifyAllGoals)
+    ->ArgNames({"anchors", "goals"})
+    ->ArgsProduct({{1 << 8, 1 << 12, 1 << 16}, {1, 16, 256}})
+    ->Unit(benchmark::kMicrosecond);
+
+/// \brief Returns `count` distinct strings shaped like ticket components.
+std::vector<std::string> MakeSymbols(int count) {
+  std::vector<std::string> symbols;
+  symbols.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    symbols.push_back(absl::StrCat("kythe/cxx/file", i % 97, ".cc#sig", i));
+  }
+  return symbols;
+}
+
+/// \brief Interns `range(0)` distinct strings into an empty table.
+void BM_InternNewSymbols(benchmark::State& state) {
+  const std::vector<std::string> symbols = MakeSymbols(state.range(0));
+  for (auto _ : state) {
+    SymbolTable table;
+    for (const auto& symbol : symbols) {
+      benchmark::DoNotOptimize(table.intern(symbol));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * symbols.size());
+}
+BENCHMARK(BM_InternNewSymbols)->RangeMultiplier(8)->Range(1 << 6, 1 << 18);
+
+/// \brief Looks up strings already interned in a table of `range(0)`
+/// symbols, from one or more threads sharing the table.
+void BM_InternExistingSymbols(benchmark::State& state) {
+  static SymbolTable* table = new SymbolTable();
+  const std::vector<std::string> symbols = MakeSymbols(state.range(0));
+  if (state.thread_index() == 0) {
+    for (const auto& symbol : symbols) {
+      table->intern(symbol);
+    }
+  }
+  size_t next = state.thread_index();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table->intern(symbols[next++ % symbols.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InternExistingSymbols)
+    ->RangeMultiplier(8)
+    ->Range(1 << 6, 1 << 18)
+    ->ThreadRange(1, 8);
+
+}  // anonymous namespace
+}  // namespace verifier
+}  // namespace kythe
@@ -17,12 +17,15 @@
 #include <stdio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
 #include "absl/flags/usage.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
 #include "assertion_ast.h"
 #include "glog/logging.h"
 #include "google/protobuf/io/coded_stream.h"
@@ -56,6 +59,40 @@ ABSL_FLAG(bool, file_vnames, true,
 ABSL_FLAG(bool, use_fast_solver, false,
           "Use the fast solver. EXPERIMENTAL; NOT ALL FEATURES ARE CURRENTLY "
           "SUPPORTED.");
+ABSL_FLAG(int, fast_solver_jobs, 1,
+          "Evaluate the fast solver's relations on this many threads, or on "
+          "every core if 0. Needs Souffle built with "
+          "--define=souffle_openmp=1 to have an effect.");
+ABSL_FLAG(bool, plan_goals, false,
+          "Try the most selective goal in each group first rather than "
+          "following source order.");
+ABSL_FLAG(int, solver_threads, 1,
+          "Decode facts, sort the database and solve goal groups that share "
+          "no variables on this many threads.");
+ABSL_FLAG(std::string, dump_focus, "",
+          "If nonempty, only dump the part of the graph around nodes whose "
+          "vnames or inspection labels match this regex.");
+ABSL_FLAG(int, dump_focus_hops, 2,
+          "How many edges away from a --dump_focus match to dump.");
+ABSL_FLAG(bool, batch, false,
+          "Treat each argument as a separate goal set of one or more "
+          "comma-separated rule files. The database is loaded and prepared "
+          "once, then each set is verified against it in turn and reported "
+          "on its own line.");
+ABSL_FLAG(bool, profile_goals, false,
+          "Count the unifications, index probes and backtracks done for each "
+          "goal and print the costliest goals to standard error. With "
+          "--use_fast_solver, print evaluation times and the largest "
+          "relations instead.");
+ABSL_FLAG(int, profile_goals_limit, 20,
+          "How many goals --profile_goals should print.");
+ABSL_FLAG(std::string, profile_goals_trace, "",
+          "If nonempty, write a Chrome trace of the time spent on each goal "
+          "group to this file. Implies --profile_goals. With --batch, the "
+          "file holds the last goal set's trace.");
+
+/// The number of entries to decode at once.
+constexpr size_t kFactBatchSize = 1 << 14;
 
 int main(int argc, char** argv) {
   GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -69,8 +106,17 @@ Example:
   ${INDEXER_BIN} -i $1 | ${VERIFIER_BIN} --show_protos --show_goals $1
   cat foo.entries | ${VERIFIER_BIN} goals1.cc goals2.cc
   cat foo.entries | ${VERIFIER_BIN} --use_file_nodes
+  cat foo.entries | ${VERIFIER_BIN} --batch goals1.cc,goals2.cc goals3.cc
 )");
   std::vector<char*> remain = absl::ParseCommandLine(argc, argv);
+  if (absl::GetFlag(FLAGS_batch) &&
+      (absl::GetFlag(FLAGS_use_file_nodes) || absl::GetFlag(FLAGS_graphviz) ||
+       absl::GetFlag(FLAGS_annotated_graphviz))) {
+    absl::FPrintF(stderr,
+                  "--batch can't be used with --use_file_nodes or graphviz "
+                  "output\n");
+    return 1;
+  }
 
   kythe::verifier::Verifier v;
   if (absl::GetFlag(FLAGS_goal_regex).empty()) {
@@ -103,15 +149,66 @@ Example:
     v.ShowAnchors();
   }
 
+  if (!absl::GetFlag(FLAGS_dump_focus).empty()) {
+    std::string error;
+    if (!v.FocusDump(absl::GetFlag(FLAGS_dump_focus),
+                     std::max(0, absl::GetFlag(FLAGS_dump_focus_hops)),
+                     &error)) {
+      absl::FPrintF(stderr, "While parsing dump focus: %s\n", error);
+      return 1;
+    }
+  }
+
   if (!absl::GetFlag(FLAGS_file_vnames)) {
     v.IgnoreFileVnames();
   }
 
   v.UseFastSolver(absl::GetFlag(FLAGS_use_fast_solver));
+  v.SetFastSolverJobs(std::max(0, absl::GetFlag(FLAGS_fast_solver_jobs)));
+  v.PlanGoals(absl::GetFlag(FLAGS_plan_goals));
+  v.SetSolverThreads(std::max(1, absl::GetFlag(FLAGS_solver_threads)));
+  bool profile_goals = absl::GetFlag(FLAGS_profile_goals) ||
+                       !absl::GetFlag(FLAGS_profile_goals_trace).empty();
+  v.ProfileGoals(profile_goals);
+  // Reports the goal profile after a goal set was verified.
+  auto report_profile = [&]() {
+    if (!profile_goals) {
+      return true;
+    }
+    v.DumpGoalProfile(std::max(0, absl::GetFlag(FLAGS_profile_goals_limit)));
+    const std::string& trace_path = absl::GetFlag(FLAGS_profile_goals_trace);
+    if (trace_path.empty()) {
+      return true;
+    }
+    FILE* trace = fopen(trace_path.c_str(), "w");
+    if (trace == nullptr) {
+      absl::FPrintF(stderr, "Couldn't open %s for writing\n", trace_path);
+      return false;
+    }
+    std::string json = v.GoalProfileTrace();
+    bool written = fwrite(json.data(), 1, json.size(), trace) == json.size();
+    if (fclose(trace) != 0 || !written) {
+      absl::FPrintF(stderr, "Couldn't write %s\n", trace_path);
+      return false;
+    }
+    return true;
+  };
 
   std::string dbname = "database";
   size_t facts = 0;
-  kythe::proto::Entry entry;
+  // Entries are handed to the verifier in batches so that it can decode them
+  // in parallel.
+  std::vector<std::string> batch;
+  auto assert_batch = [&]() {
+    if (!v.AssertSerializedFacts(&dbname, facts, batch)) {
+      absl::FPrintF(stderr, "Error asserting facts %zu-%zu\n", facts,
+                    facts + batch.size() - 1);
+      return false;
+    }
+    facts += batch.size();
+    batch.clear();
+    return true;
+  };
   google::protobuf::uint32 byte_size;
   google::protobuf::io::FileInputStream raw_input(STDIN_FILENO);
   for (;;) {
@@ -120,26 +217,72 @@ Example:
     if (!coded_input.ReadVarint32(&byte_size)) {
       break;
     }
-    auto limit = coded_input.PushLimit(byte_size);
-    if (!entry.ParseFromCodedStream(&coded_input)) {
-      absl::FPrintF(stderr, "Error reading around fact %zu\n", facts);
+    batch.emplace_back();
+    if (!coded_input.ReadString(&batch.back(), byte_size)) {
+      absl::FPrintF(stderr, "Error reading around fact %zu\n",
+                    facts + batch.size() - 1);
       return 1;
     }
     if (absl::GetFlag(FLAGS_show_protos)) {
-      entry.PrintDebugString();
-      putchar('\n');
+      kythe::proto::Entry entry;
+      if (entry.ParseFromString(batch.back())) {
+        entry.PrintDebugString();
+        putchar('\n');
+      }
     }
-    if (!v.AssertSingleFact(&dbname, facts, entry)) {
-      absl::FPrintF(stderr, "Error asserting fact %zu\n", facts);
+    if (batch.size() == kFactBatchSize && !assert_batch()) {
       return 1;
     }
-    ++facts;
+  }
+  if (!batch.empty() && !assert_batch()) {
+    return 1;
   }
 
   if (!absl::GetFlag(FLAGS_use_fast_solver) && !v.PrepareDatabase()) {
     return 1;
   }
 
+  if (absl::GetFlag(FLAGS_batch)) {
+    int result = 0;
+    for (auto arg = remain.begin() + 1; arg != remain.end(); ++arg) {
+      std::vector<std::string> rule_files =
+          absl::StrSplit(*arg, ',', absl::SkipEmpty());
+      v.ResetGoals();
+      bool passed = true;
+      for (const auto& rule_file : rule_files) {
+        if (!v.LoadInlineRuleFile(rule_file)) {
+          absl::FPrintF(stderr, "Failed loading %s.\n", rule_file);
+          passed = false;
+          break;
+        }
+      }
+      if (passed && absl::GetFlag(FLAGS_check_for_singletons) &&
+          v.CheckForSingletonEVars()) {
+        passed = false;
+      }
+      if (passed && absl::GetFlag(FLAGS_show_goals)) {
+        v.ShowGoals();
+      }
+      bool attempted = passed;
+      if (passed && !v.VerifyAllGoals()) {
+        absl::FPrintF(stderr,
+                      "Could not verify all goals in %s. The furthest we "
+                      "reached was:\n  ",
+                      *arg);
+        v.DumpErrorGoal(v.highest_group_reached(), v.highest_goal_reached());
+        passed = false;
+      }
+      if (attempted && !report_profile()) {
+        passed = false;
+      }
+      absl::PrintF("%s: %s\n", passed ? "PASSED" : "FAILED", *arg);
+      if (!passed) {
+        result = 1;
+      }
+    }
+    return result;
+  }
+
   if (!absl::GetFlag(FLAGS_graphviz)) {
     std::vector<std::string> rule_files(remain.begin() + 1, remain.end());
     if (rule_files.empty() && !absl::GetFlag(FLAGS_use_file_nodes)) {
@@ -175,6 +318,10 @@ Example:
     result = 1;
   }
 
+  if (!report_profile()) {
+    result = 1;
+  }
+
   if (absl::GetFlag(FLAGS_graphviz) ||
       absl::GetFlag(FLAGS_annotated_graphviz)) {
     v.DumpAsDot();
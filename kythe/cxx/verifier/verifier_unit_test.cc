@@ -185,6 +185,69 @@ entries {
   ASSERT_FALSE(v.VerifyAllGoals());
 }
 
+TEST(VerifierUnitTest, SerializedFactsAreDecodedInParallel) {
+  Verifier v;
+  v.SetSolverThreads(4);
+  std::vector<std::string> serialized;
+  for (int i = 0; i < 100; ++i) {
+    kythe::proto::Entry entry;
+    entry.mutable_source()->set_root(std::to_string(i));
+    entry.set_edge_kind(i % 2 ? "somekind.1" : "somekind");
+    entry.mutable_target()->set_root("target");
+    entry.set_fact_name("/");
+    serialized.push_back(entry.SerializeAsString());
+  }
+  std::string database = "test";
+  ASSERT_TRUE(v.AssertSerializedFacts(&database, 0, serialized));
+  ASSERT_TRUE(v.PrepareDatabase());
+  // Facts are still checked for duplicates, so they all made it in.
+  ASSERT_TRUE(v.AssertSerializedFacts(&database, 100, {serialized[0]}));
+  ASSERT_FALSE(v.PrepareDatabase());
+}
+
+TEST(VerifierUnitTest, DuplicatesAreFoundAcrossSortSlices) {
+  Verifier v;
+  v.SetSolverThreads(4);
+  std::vector<std::string> serialized;
+  // Enough facts that the database is sorted in parallel slices.
+  for (int i = 0; i < 100000; ++i) {
+    kythe::proto::Entry entry;
+    entry.mutable_source()->set_signature(std::to_string(i));
+    entry.set_fact_name("/kythe/node/kind");
+    entry.set_fact_value(i % 2 ? "record" : "function");
+    serialized.push_back(entry.SerializeAsString());
+  }
+  std::string database = "test";
+  ASSERT_TRUE(v.AssertSerializedFacts(&database, 0, serialized));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_TRUE(
+      v.AssertSerializedFacts(&database, serialized.size(), {serialized[0]}));
+  ASSERT_FALSE(v.PrepareDatabase());
+}
+
+TEST(VerifierUnitTest, ResetGoalsKeepsTheDatabase) {
+  Verifier v;
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- A.content 43
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "42"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoals());
+  v.ResetGoals();
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(
+#- A.content 42
+)"));
+  ASSERT_TRUE(v.VerifyAllGoals());
+}
+
+TEST(VerifierUnitTest, UndecodableSerializedFactsFail) {
+  Verifier v;
+  std::string database = "test";
+  ASSERT_FALSE(v.AssertSerializedFacts(&database, 0, {"\xff\xff"}));
+}
+
 TEST(VerifierUnitTest, EdgesCanSupplyMultipleOrdinals) {
   Verifier v;
   ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
@@ -2598,6 +2661,120 @@ fact_value: "43"
   ASSERT_EQ(2, v.highest_goal_reached());
 }
 
+TEST(VerifierUnitTest, PlannedGoalsAgreeWithSourceOrder) {
+  for (bool plan_goals : {true, false}) {
+    Verifier v;
+    v.PlanGoals(plan_goals);
+    ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- A somekind B
+#- B.content 43
+source { root:"1" }
+edge_kind: "/kythe/edge/somekind"
+target { root:"2" }
+fact_name: "/"
+fact_value: ""
+}
+entries {
+source { root:"1" }
+edge_kind: "/kythe/edge/somekind"
+target { root:"3" }
+fact_name: "/"
+fact_value: ""
+}
+entries {
+source { root:"3" }
+edge_kind: "/kythe/edge/somekind"
+target { root:"2" }
+fact_name: "/"
+fact_value: ""
+}
+entries {
+source { root:"3" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+    ASSERT_TRUE(v.PrepareDatabase());
+    EXPECT_TRUE(v.VerifyAllGoals()) << "plan_goals=" << plan_goals;
+  }
+}
+
+TEST(VerifierUnitTest, LongGroupsDontExhaustTheStack) {
+  Verifier v;
+  std::string goals;
+  for (int i = 0; i < 100000; ++i) {
+    goals.append("#- SomeNode.content 43\n");
+  }
+  ASSERT_TRUE(v.LoadInlineProtoFile(goals + R"(entries {
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_TRUE(v.VerifyAllGoals());
+}
+
+TEST(VerifierUnitTest, ProfileGoalsCountsWork) {
+  Verifier v;
+  v.PlanGoals(false);
+  v.ProfileGoals(true);
+  ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- SomeNode.content 43
+#- SomeNode.content 44
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "43"
+}
+entries {
+source { root:"2" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+  ASSERT_TRUE(v.PrepareDatabase());
+  ASSERT_FALSE(v.VerifyAllGoals());
+  ASSERT_EQ(1, v.goal_profiles().size());
+  const auto& group = v.goal_profiles()[0];
+  EXPECT_TRUE(group.reached);
+  ASSERT_EQ(2, group.goals.size());
+  // Both facts match the first goal; the second goal is looked up (and
+  // found wanting) once for each.
+  EXPECT_EQ(2, group.goals[0].unifications);
+  EXPECT_EQ(1, group.goals[0].probes);
+  EXPECT_EQ(1, group.goals[0].backtracks);
+  EXPECT_EQ(0, group.goals[1].unifications);
+  EXPECT_EQ(2, group.goals[1].probes);
+  EXPECT_EQ(2, group.goals[1].backtracks);
+  EXPECT_NE(std::string::npos,
+            v.GoalProfileTrace().find("\"unifications\":2,\"probes\":3"));
+}
+
+TEST(VerifierUnitTest, ParallelGroupsStopAtFirstFailure) {
+  for (size_t threads : {1, 4}) {
+    Verifier v;
+    v.SetSolverThreads(threads);
+    ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
+#- SomeNode.content 43
+#- { OtherNode.content 44 }
+#- { vname(_,_,Root?,_,_).content 43 }
+source { root:"1" }
+fact_name: "/kythe/content"
+fact_value: "43"
+})"));
+    ASSERT_TRUE(v.PrepareDatabase());
+    bool evar_unset = false;
+    ASSERT_FALSE(v.VerifyAllGoals(
+        [&evar_unset](Verifier* cxt,
+                      const AssertionParser::Inspection& inspection) {
+          if (inspection.label == "Root" && !inspection.evar->current()) {
+            evar_unset = true;
+          }
+          return true;
+        }))
+        << "threads=" << threads;
+    EXPECT_EQ(1, v.highest_group_reached()) << "threads=" << threads;
+    EXPECT_TRUE(evar_unset) << "threads=" << threads;
+  }
+}
+
 TEST(VerifierUnitTest, ReadGoalsFromFileNodeFailure) {
   Verifier v;
   ASSERT_TRUE(v.LoadInlineProtoFile(R"(entries {
@@ -33,7 +33,10 @@ import (
 	"google.golang.org/protobuf/proto"
 )
 
-const jsonBodyType = "application/json; charset=utf-8"
+const (
+	jsonBodyType  = "application/json; charset=utf-8"
+	protoBodyType = "application/x-protobuf"
+)
 
 // JSONMarshaler is the marshaler used to encode all JSON web requests.
 var JSONMarshaler = Marshaler{
@@ -93,7 +96,9 @@ func Call(server, method string, req, reply proto.Message) error {
 }
 
 // ReadJSONBody reads the entire body of r and unmarshals it from JSON into msg.
-// If the request body is empty, no error is returned and msg is unchanged.
+// A body sent with the Content-Type "application/x-protobuf" is instead
+// unmarshaled as a serialized protobuf. If the request body is empty, no
+// error is returned and msg is unchanged.
 func ReadJSONBody(r *http.Request, msg proto.Message) error {
 	rec, err := ioutil.ReadAll(r.Body)
 	if err != nil {
@@ -102,6 +107,9 @@ func ReadJSONBody(r *http.Request, msg proto.Message) error {
 	if len(rec) == 0 {
 		return nil
 	}
+	if strings.HasPrefix(r.Header.Get("Content-Type"), protoBodyType) {
+		return proto.Unmarshal(rec, msg)
+	}
 	return protojson.Unmarshal(rec, msg)
 }
 
@@ -127,7 +135,7 @@ func WriteJSONResponse(w http.ResponseWriter, r *http.Request, v interface{}) er
 
 // WriteProtoResponse serializes msg to w.
 func WriteProtoResponse(w http.ResponseWriter, r *http.Request, msg proto.Message) error {
-	w.Header().Set("Content-Type", "application/x-protobuf")
+	w.Header().Set("Content-Type", protoBodyType)
 	cw := httpencoding.CompressData(w, r)
 	defer cw.Close()
 	rec, err := proto.Marshal(msg)
@@ -297,7 +297,9 @@ func WebClient(addr string) Service {
 //     Response: JSON encoded xrefs.DocumentationReply
 //
 // Note: /nodes, /edges, /decorations, and /xrefs will return their responses as
-// serialized protobufs if the "proto" query parameter is set.
+// serialized protobufs if the "proto" query parameter is set.  Requests posted
+// with the Content-Type "application/x-protobuf" are read as serialized
+// protobufs.
 func RegisterHTTPHandlers(ctx context.Context, xs Service, mux *http.ServeMux) {
 	mux.HandleFunc("/xrefs", func(w http.ResponseWriter, r *http.Request) {
 		start := time.Now()
@@ -111,8 +111,9 @@
 
 namespace souffle {
 
-std::unique_ptr<ram::TranslationUnit> ParseTransform(const std::string& code) {
-  Global::config().set("jobs", "1");
+std::unique_ptr<ram::TranslationUnit> ParseTransform(const std::string& code,
+                                                     size_t jobs) {
+  Global::config().set("jobs", std::to_string(jobs));
   Global::config().has("verbose", "1");
   souffle::ErrorReport errorReport(/*nowarn=*/true);
   souffle::DebugReport debugReport;
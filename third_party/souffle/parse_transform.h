@@ -3,14 +3,18 @@
 
 #include "ram/TranslationUnit.h"
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
 namespace souffle {
 /// \brief Parses and transforms `code` into a `ram::TranslationUnit`.
 /// \param code the Souffle program to transform.
+/// \param jobs the number of threads the program will be evaluated on; any
+/// value other than 1 (including 0, for every core) plans parallel loops.
 /// \return the resulting translation unit or null on error.
-std::unique_ptr<ram::TranslationUnit> ParseTransform(const std::string& code);
+std::unique_ptr<ram::TranslationUnit> ParseTransform(const std::string& code,
+                                                     size_t jobs = 1);
 }  // namespace souffle
 
 #endif  // defined(THIRD_PARTY_SOUFFLE_PARSE_TRANSFORM_H_)
@@ -21,6 +21,7 @@ load(
 )
 load("@bazel_tools//tools/cpp:toolchain_utils.bzl", "find_cpp_toolchain")
 load("@bazel_skylib//lib:paths.bzl", "paths")
+load("@bazel_skylib//lib:shell.bzl", "shell")
 load(
     ":verifier_test.bzl",
     "KytheEntries",
@@ -59,10 +60,13 @@ _VERIFIER_FLAGS = {
 
 _INDEXER_FLAGS = {
     "experimental_alias_template_instantiations": False,
+    "experimental_dataflow_influence_limit": 0,
     "experimental_drop_cpp_fwd_decl_docs": False,
     "experimental_drop_instantiation_independent_data": False,
     "experimental_drop_objc_fwd_class_docs": False,
+    "experimental_lazy_system_macros": False,
     "experimental_record_dataflow_edges": False,
+    "experimental_skip_function_bodies": "",
     "experimental_usr_byte_size": 0,
     "template_instance_exclude_path_pattern": "",
     "fail_on_unimplemented_builtin": True,
@@ -743,6 +747,12 @@ def cc_indexer_test(
         template instantiations.
       experimental_drop_instantiation_independent_data: Whether the indexer should
         drop extraneous instantiation independent data.
+      experimental_dataflow_influence_limit: How many decls the indexer should
+        track per dataflow influence set before flushing it (0 for no limit).
+      experimental_lazy_system_macros: Whether the indexer should only record
+        system macro definitions that non-system code uses.
+      experimental_skip_function_bodies: Which function bodies the indexer
+        should skip ("headers" or "all"), if any.
       experimental_usr_byte_size: How many bytes of a USR to use.
     """
     _indexer_test(
@@ -912,3 +922,101 @@ def cc_extractor_test(
         tags = tags,
         deps = deps,
     )
+
+_DEFAULT_INDEXER = "//kythe/cxx/indexer/cxx:indexer"
+
+def _local_path(label):
+    """Returns the workspace path of a source file label in this package."""
+    if label.startswith("//") or label.startswith("@"):
+        package, _, name = label.partition(":")
+        if package.lstrip("@").partition("//")[2] != native.package_name():
+            return None
+        return paths.join(native.package_name(), name)
+    return paths.join(native.package_name(), label.lstrip(":"))
+
+def _runner_fixture(entries, test):
+    """Returns a manifest line for a single-file indexer test, or None."""
+    srcs = [_local_path(src) for src in entries["srcs"]]
+    if (len(srcs) != 1 or srcs[0] == None or entries["deps"] or
+        paths.split_extension(srcs[0])[1] not in (".c", ".cc", ".m")):
+        return None
+    fields = [
+        test["name"],
+        srcs[0],
+        "pass" if test["expect_success"] else "fail",
+        " ".join(entries["opts"]),
+        " ".join(test["opts"]),
+        " ".join(entries["copts"]),
+    ]
+    for field in fields:
+        if "\t" in field or "$(" in field:
+            return None
+    for flags in (entries["opts"], test["opts"], entries["copts"]):
+        for flag in flags:
+            if " " in flag:
+                return None
+    return "\t".join(fields)
+
+def cc_indexer_test_runner(
+        name,
+        runner = "//kythe/cxx/indexer/cxx:indexer_test_runner",
+        jobs = 0,
+        size = "large",
+        tags = []):
+    """Runs this package's single-file indexer tests in one process.
+
+    Must be called after every cc_indexer_test and objc_indexer_test it
+    should cover. Tests that index more than one file, need deps or are
+    bundled, manual or restricted to some platforms are left out; the rest
+    are indexed and verified by `runner` on `jobs` threads (0 for one per
+    core) and reported one by one, as their own tests would be.
+
+    Args:
+      name: The name of the test rule.
+      runner: The indexer_test_runner binary.
+      jobs: How many fixtures to run at once.
+      size: The size of the test rule.
+      tags: Tags for the test rule.
+    """
+    rules = native.existing_rules()
+    lines = []
+    srcs = []
+    for test in rules.values():
+        if test["kind"] != "verifier_test" or "manual" in test["tags"]:
+            continue
+        if [e for e in test.get("restricted_to", []) if not e.endswith("buildenv:all")]:
+            continue
+        if len(test["srcs"]) != 1 or test["deps"]:
+            continue
+        entries = rules.get(test["srcs"][0].rpartition(":")[2])
+        if not entries or entries["kind"] != "cc_index":
+            continue
+        if not (entries.get("indexer") or _DEFAULT_INDEXER).endswith(_DEFAULT_INDEXER):
+            # The runner can only run the stock indexer.
+            continue
+        line = _runner_fixture(entries, test)
+        if line:
+            lines.append(line)
+            srcs += entries["srcs"]
+    native.genrule(
+        name = name + "_manifest",
+        testonly = True,
+        outs = [name + ".manifest"],
+        cmd = "printf '%%s\\n' %s > $@" % " ".join(
+            [shell.quote(line) for line in sorted(lines)],
+        ),
+    )
+    native.sh_test(
+        name = name,
+        size = size,
+        srcs = [runner],
+        args = [
+            "--manifest=$(location :%s_manifest)" % name,
+            "--jobs=%d" % jobs,
+        ],
+        data = [":" + name + "_manifest"] + srcs + native.glob(
+            ["**/*.h", "**/*.meta"],
+            allow_empty = True,
+        ),
+        tags = tags,
+    )